@@ -23,8 +23,12 @@
 #include "GMath.h"
 #include "GHolders.h"
 #include "GMatrix.h"
+#include "GThread.h"
 #include <stddef.h>
 #include <cmath>
+#include <map>
+#include <limits>
+#include <algorithm>
 
 using namespace GClasses;
 using std::vector;
@@ -417,6 +421,53 @@ double GBNMetropolisNode::currentValue()
 
 
 #define SQRT_2PI 2.50662827463
+#define GBN_SWEEP_BLOCK 32
+
+namespace GClasses {
+
+class GBayesNetWorker : public GWorkerThread
+{
+protected:
+	GBayesNet& m_net;
+
+public:
+	GBayesNetWorker(GMasterThread& master, GBayesNet& net)
+	: GWorkerThread(master), m_net(net)
+	{
+	}
+
+	virtual ~GBayesNetWorker()
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		m_net.sampleBlock(jobId);
+	}
+};
+
+class GBayesNetChainsWorker : public GWorkerThread
+{
+protected:
+	GBayesNetChains& m_chains;
+
+public:
+	GBayesNetChainsWorker(GMasterThread& master, GBayesNetChains& chains)
+	: GWorkerThread(master), m_chains(chains)
+	{
+	}
+
+	virtual ~GBayesNetChainsWorker()
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		m_chains.runChain(jobId);
+	}
+};
+
+} // namespace GClasses
 
 GBNNormal::GBNNormal(GBNNode* pDefaultVal)
 : GBNMetropolisNode(), m_devIsVariance(false)
@@ -930,13 +981,15 @@ double GBNInverseGamma::initMean()
 
 
 GBayesNet::GBayesNet(size_t seed)
-: m_heap(2048), m_rand(seed)
+: m_heap(2048), m_rand(seed), m_workerThreads(1), m_coloredNodes(0), m_color(0), m_pMaster(NULL)
 {
 	m_pConstOne = newConst(1.0);
 }
 
 GBayesNet::~GBayesNet()
 {
+	clearMaster();
+	clearBlockRands();
 	for(size_t i = 0; i < m_nodes.size(); i++)
 		m_nodes[i]->~GBNNode();
 }
@@ -1079,6 +1132,163 @@ void GBayesNet::sample()
 		(*it)->sample(&m_rand);
 }
 
+void GBayesNet::clearBlockRands()
+{
+	for(size_t i = 0; i < m_blockRands.size(); i++)
+		delete(m_blockRands[i]);
+	m_blockRands.clear();
+}
+
+void GBayesNet::setWorkerThreads(size_t n)
+{
+	if(n != m_workerThreads)
+		clearMaster();
+	m_workerThreads = n;
+}
+
+void GBayesNet::clearMaster()
+{
+	delete(m_pMaster);
+	m_pMaster = NULL;
+}
+
+void GBayesNet::makeMaster()
+{
+	clearMaster();
+	size_t maxBlocks = 0;
+	for(size_t c = 0; c < m_colors.size(); c++)
+		maxBlocks = std::max(maxBlocks, m_colorBlockStart[c + 1] - m_colorBlockStart[c]);
+	m_pMaster = new GMasterThread();
+	for(size_t i = 0; i < std::max((size_t)1, std::min(m_workerThreads, maxBlocks)); i++)
+		m_pMaster->addWorker(new GBayesNetWorker(*m_pMaster, *this));
+}
+
+void GBayesNet::color()
+{
+	// Number the nodes in the order they were made
+	std::map<GBNNode*, size_t> indexes;
+	for(size_t i = 0; i < m_sampleNodes.size(); i++)
+		indexes[m_sampleNodes[i]] = 0;
+	vector<GBNVariable*> vars;
+	for(size_t i = 0; i < m_nodes.size(); i++)
+	{
+		std::map<GBNNode*, size_t>::iterator it = indexes.find(m_nodes[i]);
+		if(it != indexes.end())
+		{
+			it->second = vars.size();
+			vars.push_back((GBNVariable*)m_nodes[i]);
+		}
+	}
+	size_t n = vars.size();
+
+	// Connect each node to its Markov blanket (its parents, children, and the other parents of its children)
+	vector< vector<size_t> > neighbors(n);
+	vector< vector<size_t> > parents(n);
+	for(size_t i = 0; i < n; i++)
+	{
+		const vector<GBNVariable*>& kids = vars[i]->children();
+		for(vector<GBNVariable*>::const_iterator it = kids.begin(); it != kids.end(); it++)
+		{
+			std::map<GBNNode*, size_t>::iterator itKid = indexes.find(*it);
+			if(itKid == indexes.end() || itKid->second == i)
+				continue;
+			size_t j = itKid->second;
+			neighbors[i].push_back(j);
+			neighbors[j].push_back(i);
+			parents[j].push_back(i);
+		}
+	}
+	for(size_t j = 0; j < n; j++)
+	{
+		vector<size_t>& par = parents[j];
+		std::sort(par.begin(), par.end());
+		par.erase(std::unique(par.begin(), par.end()), par.end());
+		for(size_t a = 0; a < par.size(); a++)
+		{
+			for(size_t b = a + 1; b < par.size(); b++)
+			{
+				neighbors[par[a]].push_back(par[b]);
+				neighbors[par[b]].push_back(par[a]);
+			}
+		}
+	}
+	vector< std::pair<size_t, size_t> > order; // (n - degree, node)
+	for(size_t i = 0; i < n; i++)
+	{
+		vector<size_t>& nb = neighbors[i];
+		std::sort(nb.begin(), nb.end());
+		nb.erase(std::unique(nb.begin(), nb.end()), nb.end());
+		order.push_back(std::make_pair(n - nb.size(), i));
+	}
+
+	// Greedily give each node the first color that none of its neighbors has, visiting the most-connected nodes first
+	std::sort(order.begin(), order.end());
+	vector<size_t> colorOf(n, INVALID_INDEX);
+	vector<size_t> stamps;
+	for(size_t i = 0; i < n; i++)
+	{
+		size_t node = order[i].second;
+		vector<size_t>& nb = neighbors[node];
+		for(size_t j = 0; j < nb.size(); j++)
+		{
+			if(colorOf[nb[j]] != INVALID_INDEX)
+				stamps[colorOf[nb[j]]] = i + 1;
+		}
+		size_t c = 0;
+		while(c < stamps.size() && stamps[c] == i + 1)
+			c++;
+		if(c == stamps.size())
+			stamps.push_back(0);
+		colorOf[node] = c;
+	}
+	m_colors.clear();
+	m_colors.resize(stamps.size());
+	for(size_t i = 0; i < n; i++)
+		m_colors[colorOf[i]].push_back(vars[i]);
+
+	// Give each block of nodes its own random stream
+	clearBlockRands();
+	m_colorBlockStart.clear();
+	for(size_t c = 0; c < m_colors.size(); c++)
+	{
+		m_colorBlockStart.push_back(m_blockRands.size());
+		size_t blocks = (m_colors[c].size() + GBN_SWEEP_BLOCK - 1) / GBN_SWEEP_BLOCK;
+		for(size_t i = 0; i < blocks; i++)
+			m_blockRands.push_back(new GRand(m_rand.next()));
+	}
+	m_colorBlockStart.push_back(m_blockRands.size());
+	m_coloredNodes = m_sampleNodes.size();
+	makeMaster();
+}
+
+void GBayesNet::sampleBlock(size_t block)
+{
+	const vector<GBNVariable*>& nodes = m_colors[m_color];
+	GRand* pRand = m_blockRands[m_colorBlockStart[m_color] + block];
+	size_t end = std::min(nodes.size(), (block + 1) * GBN_SWEEP_BLOCK);
+	for(size_t i = block * GBN_SWEEP_BLOCK; i < end; i++)
+		nodes[i]->sample(pRand);
+}
+
+void GBayesNet::sweep(size_t iters)
+{
+	if(m_coloredNodes != m_sampleNodes.size())
+		color();
+
+	// Initialize the nodes now, so the workers will not do it concurrently
+	for(vector<GBNVariable*>::iterator it = m_sampleNodes.begin(); it != m_sampleNodes.end(); it++)
+		(*it)->currentValue();
+
+	if(!m_pMaster)
+		makeMaster();
+	for(size_t i = 0; i < iters; i++)
+	{
+		for(m_color = 0; m_color < m_colors.size(); m_color++)
+			m_pMaster->doJobs(m_colorBlockStart[m_color + 1] - m_colorBlockStart[m_color]);
+	}
+	m_color = 0;
+}
+
 void GBayesNet_simpleTest()
 {
 	GBayesNet bn;
@@ -1143,7 +1353,7 @@ void GBayesNet_threeTest()
 		throw Ex("Not close enough");
 }
 
-void GBayesNet_alarmTest()
+void GBayesNet_alarmTest(bool chromatic)
 {
 	// This example is given in Russell and Norvig page 504. (See also http://www.d.umn.edu/~rmaclin/cs8751/Notes/chapter14a.pdf)
 	GBayesNet bn;
@@ -1175,14 +1385,22 @@ void GBayesNet_alarmTest()
 	pMaryCalls->setObserved(0.0);
 
 	GRand rand(0);
-	for(size_t burnin = 0; burnin < 10000; burnin++)
-		bn.sample();
+	if(chromatic)
+		bn.sweep(10000);
+	else
+	{
+		for(size_t burnin = 0; burnin < 10000; burnin++)
+			bn.sample();
+	}
 	size_t sampleCount = 0;
 	vector<double> probs;
 	probs.resize(3);
 	for(size_t sample = 0; sample < 50000; sample++)
 	{
-		bn.sample();
+		if(chromatic)
+			bn.sweep();
+		else
+			bn.sample();
 		sampleCount++;
 		probs[0] *= (1.0 - 1.0 / sampleCount);
 		if(pBurglary->currentValue() == 0.0)
@@ -1203,10 +1421,303 @@ void GBayesNet_alarmTest()
 		throw Ex("Not close enough");
 }
 
+void GBayesNet_chromaticTest()
+{
+	// Make many copies of the network in GBayesNet_simpleTest, so there are several blocks in each color class
+	GBayesNet bnSerial(1234);
+	GBayesNet bnParallel(1234);
+	bnParallel.setWorkerThreads(3);
+	vector<GBNCategorical*> serialPars;
+	vector<GBNCategorical*> parallelPars;
+	for(size_t net = 0; net < 2; net++)
+	{
+		GBayesNet& bn = (net == 0 ? bnSerial : bnParallel);
+		for(size_t i = 0; i < 100; i++)
+		{
+			GBNCategorical* pPar = bn.newCat(2);
+			pPar->setWeights(0, bn.newConst(0.4), bn.newConst(0.6));
+			GBNNormal* pChild = bn.newNormal();
+			pChild->addCatParent(pPar, bn.def());
+			pChild->setMeanAndDev(0, bn.newConst(0.0), bn.newConst(1.0));
+			pChild->setMeanAndDev(1, bn.newConst(3.0), bn.newConst(2.0));
+			pChild->setObserved(1.0);
+			(net == 0 ? serialPars : parallelPars).push_back(pPar);
+		}
+	}
+	bnSerial.color();
+	if(bnSerial.colors().size() != 2 || bnSerial.colors()[0].size() != 100)
+		throw Ex("Unexpected coloring");
+
+	// The results should not depend on the number of threads, and should agree with the true posterior
+	bnSerial.sweep(100);
+	bnParallel.sweep(100);
+	size_t parCount = 0;
+	size_t sampleCount = 0;
+	for(size_t sample = 0; sample < 1000; sample++)
+	{
+		bnSerial.sweep();
+		bnParallel.sweep();
+		for(size_t i = 0; i < serialPars.size(); i++)
+		{
+			if(serialPars[i]->currentValue() != parallelPars[i]->currentValue())
+				throw Ex("The number of threads changed the results");
+			if(serialPars[i]->currentValue() == 0.0)
+				parCount++;
+			sampleCount++;
+		}
+	}
+	if(std::abs((double)parCount / sampleCount - 0.5714286) > 0.005)
+		throw Ex("Not close enough");
+}
+
 void GBayesNet::test()
 {
 	GBayesNet_simpleTest();
 	GBayesNet_threeTest();
-	GBayesNet_alarmTest();
+	GBayesNet_alarmTest(false);
+	GBayesNet_alarmTest(true);
+	GBayesNet_chromaticTest();
+}
+
+
+
+
+
+
+
+
+GBayesNetChains::GBayesNetChains(size_t chains, BayesNetBuilder pBuilder, void* pThis, size_t seed)
+: m_workerThreads(1), m_burnIn(0), m_thin(1)
+{
+	if(chains < 1)
+		throw Ex("Expected at least one chain");
+	GRand seeds(seed);
+	m_monitors.resize(chains);
+	for(size_t i = 0; i < chains; i++)
+	{
+		m_nets.push_back(new GBayesNet((size_t)seeds.next()));
+		m_draws.push_back(new GMatrix());
+		pBuilder(pThis, *m_nets[i], m_monitors[i]);
+	}
+	for(size_t i = 1; i < chains; i++)
+	{
+		if(m_monitors[i].size() != m_monitors[0].size())
+			throw Ex("Expected every chain to monitor the same number of nodes");
+	}
+}
+
+GBayesNetChains::~GBayesNetChains()
+{
+	for(size_t i = 0; i < m_nets.size(); i++)
+	{
+		delete(m_nets[i]);
+		delete(m_draws[i]);
+	}
+}
+
+void GBayesNetChains::run(size_t burnIn, size_t draws, size_t thin)
+{
+	m_burnIn = burnIn;
+	m_thin = std::max((size_t)1, thin);
+	for(size_t i = 0; i < m_draws.size(); i++)
+		m_draws[i]->resize(draws, monitors());
+	GMasterThread master;
+	for(size_t i = 0; i < std::max((size_t)1, std::min(m_workerThreads, chains())); i++)
+		master.addWorker(new GBayesNetChainsWorker(master, *this));
+	master.doJobs(chains());
+}
+
+void GBayesNetChains::runChain(size_t chain)
+{
+	GBayesNet& bn = *m_nets[chain];
+	const vector<GBNVariable*>& monitor = m_monitors[chain];
+	GMatrix& d = *m_draws[chain];
+	for(size_t i = 0; i < m_burnIn; i++)
+		bn.sample();
+	for(size_t i = 0; i < d.rows(); i++)
+	{
+		for(size_t j = 0; j < m_thin; j++)
+			bn.sample();
+		GVec& row = d[i];
+		for(size_t j = 0; j < monitor.size(); j++)
+			row[j] = monitor[j]->currentValue();
+	}
+}
+
+double GBayesNetChains::mean(size_t monitor)
+{
+	double sum = 0.0;
+	size_t count = 0;
+	for(size_t i = 0; i < m_draws.size(); i++)
+	{
+		GMatrix& d = *m_draws[i];
+		for(size_t j = 0; j < d.rows(); j++)
+			sum += d[j][monitor];
+		count += d.rows();
+	}
+	if(count == 0)
+		throw Ex("There are no draws. Call run first.");
+	return sum / count;
+}
+
+size_t GBayesNetChains::splitChains(size_t monitor, vector<double>& seqs, double* pW, double* pVarPlus)
+{
+	size_t n = m_draws[0]->rows() / 2;
+	if(n < 2)
+		throw Ex("At least 4 draws are needed");
+	size_t m = 2 * chains();
+	seqs.resize(m * n);
+	double sumVar = 0.0;
+	double sumMean = 0.0;
+	double sumSqMean = 0.0;
+	for(size_t j = 0; j < m; j++)
+	{
+		// The second half ends with the last draw, so the middle draw is dropped if the number of draws is odd
+		GMatrix& d = *m_draws[j / 2];
+		size_t start = (j % 2 == 0 ? 0 : d.rows() - n);
+		double* pSeq = seqs.data() + j * n;
+		double mean = 0.0;
+		for(size_t i = 0; i < n; i++)
+		{
+			pSeq[i] = d[start + i][monitor];
+			mean += pSeq[i];
+		}
+		mean /= n;
+		double var = 0.0;
+		for(size_t i = 0; i < n; i++)
+		{
+			pSeq[i] -= mean;
+			var += pSeq[i] * pSeq[i];
+		}
+		sumVar += var / (n - 1);
+		sumMean += mean;
+		sumSqMean += mean * mean;
+	}
+	double w = sumVar / m;
+	double meanOfMeans = sumMean / m;
+	double bOverN = std::max(0.0, (sumSqMean - m * meanOfMeans * meanOfMeans) / (m - 1));
+	*pW = w;
+	*pVarPlus = w * (n - 1) / n + bOverN;
+	return n;
+}
+
+double GBayesNetChains::rHat(size_t monitor)
+{
+	vector<double> seqs;
+	double w, varPlus;
+	splitChains(monitor, seqs, &w, &varPlus);
+	if(varPlus <= 0.0)
+		return 1.0; // The node never changed
+	if(w <= 0.0)
+		return std::numeric_limits<double>::infinity(); // Each sequence is stuck on a different value
+	return sqrt(varPlus / w);
+}
+
+double GBayesNetChains::effectiveSampleSize(size_t monitor)
+{
+	vector<double> seqs;
+	double w, varPlus;
+	size_t n = splitChains(monitor, seqs, &w, &varPlus);
+	size_t m = 2 * chains();
+	if(varPlus <= 0.0)
+		return (double)(m * n);
+
+	// Sum the autocorrelations in pairs of consecutive lags, stopping when a pair is not positive,
+	// and forcing the sums of the pairs to be non-increasing
+	double sumPairs = 0.0;
+	double prevPair = 1e308;
+	double rhoEven = 1.0;
+	for(size_t t = 1; t < n; t += 2)
+	{
+		double acov = 0.0;
+		for(size_t j = 0; j < m; j++)
+		{
+			const double* pSeq = seqs.data() + j * n;
+			for(size_t i = 0; i + t < n; i++)
+				acov += pSeq[i] * pSeq[i + t];
+		}
+		double rhoOdd = 1.0 - (w - acov / (m * n)) / varPlus;
+		double pair = std::min(prevPair, rhoEven + rhoOdd);
+		if(pair <= 0.0)
+			break;
+		sumPairs += pair;
+		prevPair = pair;
+		if(t + 1 >= n)
+			break;
+		acov = 0.0;
+		for(size_t j = 0; j < m; j++)
+		{
+			const double* pSeq = seqs.data() + j * n;
+			for(size_t i = 0; i + t + 1 < n; i++)
+				acov += pSeq[i] * pSeq[i + t + 1];
+		}
+		rhoEven = 1.0 - (w - acov / (m * n)) / varPlus;
+	}
+	double tau = std::max(-1.0 + 2.0 * sumPairs, 1.0 / log10((double)(m * n)));
+	return (m * n) / tau;
+}
+
+void GBayesNetChains_simpleBuilder(void* pThis, GBayesNet& bn, vector<GBNVariable*>& monitor)
+{
+	GBNCategorical* pPar = bn.newCat(2);
+	pPar->setWeights(0, bn.newConst(0.4), bn.newConst(0.6));
+
+	GBNNormal* pChild = bn.newNormal();
+	pChild->addCatParent(pPar, bn.def());
+	pChild->setMeanAndDev(0, bn.newConst(0.0), bn.newConst(1.0));
+	pChild->setMeanAndDev(1, bn.newConst(3.0), bn.newConst(2.0));
+	pChild->setObserved(1.0);
+
+	monitor.push_back(pPar);
 }
 
+void GBayesNetChains_stuckBuilder(void* pThis, GBayesNet& bn, vector<GBNVariable*>& monitor)
+{
+	// Each chain samples from a different distribution, so the chains can never agree
+	size_t* pChain = (size_t*)pThis;
+	GBNNormal* pNode = bn.newNormal();
+	pNode->setMeanAndDev(0, bn.newConst(10.0 * (*pChain)++), bn.newConst(1.0));
+	monitor.push_back(pNode);
+}
+
+// static
+void GBayesNetChains::test()
+{
+	// The results should not depend on the number of threads
+	GBayesNetChains serial(4, GBayesNetChains_simpleBuilder, NULL, 1234);
+	serial.run(1000, 5000);
+	GBayesNetChains parallel(4, GBayesNetChains_simpleBuilder, NULL, 1234);
+	parallel.setWorkerThreads(4);
+	parallel.run(1000, 5000);
+	for(size_t i = 0; i < serial.chains(); i++)
+	{
+		GMatrix& a = serial.draws(i);
+		GMatrix& b = parallel.draws(i);
+		for(size_t j = 0; j < a.rows(); j++)
+		{
+			if(a[j][0] != b[j][0])
+				throw Ex("The number of threads changed the results");
+		}
+	}
+
+	// The chains should be different from each other
+	if(serial.draws(0).sumSquaredDifference(serial.draws(1)) == 0.0)
+		throw Ex("Expected the chains to have different random streams");
+
+	// The chains should mix, and agree with the true posterior
+	if(std::abs(serial.mean(0) - (1.0 - 0.5714286)) > 0.02)
+		throw Ex("Not close enough");
+	double rHat = serial.rHat(0);
+	if(rHat < 0.99 || rHat > 1.05)
+		throw Ex("Expected the chains to mix");
+	double ess = serial.effectiveSampleSize(0);
+	if(ess < 1000.0 || ess > 4.0 * 5000.0 * log10(4.0 * 5000.0))
+		throw Ex("Unexpected effective sample size");
+
+	// R-hat should detect chains that do not mix
+	size_t chain = 0;
+	GBayesNetChains stuck(3, GBayesNetChains_stuckBuilder, &chain);
+	stuck.run(100, 1000);
+	if(stuck.rHat(0) < 2.0)
+		throw Ex("Expected R-hat to detect that the chains did not mix");
+}
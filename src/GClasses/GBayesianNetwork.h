@@ -28,8 +28,13 @@
 namespace GClasses {
 
 class GRand;
+class GMasterThread;
+class GMatrix;
 class GBNCategorical;
 class GBNVariable;
+class GBayesNet;
+class GBayesNetWorker;
+class GBayesNetChainsWorker;
 
 
 /// The base class of all nodes in a Bayesian belief network
@@ -712,12 +717,22 @@ public:
 /// easier if you use this class to manage it all.
 class GBayesNet
 {
+friend class GBayesNetWorker;
 protected:
 	GHeap m_heap;
 	std::vector<GBNNode*> m_nodes;
 	std::vector<GBNVariable*> m_sampleNodes;
 	GRand m_rand;
 	GBNConstant* m_pConstOne;
+	size_t m_workerThreads;
+
+	// The color classes used by sweep. Each class is divided into blocks of nodes, and each block has its own random stream.
+	size_t m_coloredNodes;
+	std::vector< std::vector<GBNVariable*> > m_colors;
+	std::vector<size_t> m_colorBlockStart;
+	std::vector<GRand*> m_blockRands;
+	size_t m_color; // The color class that the workers are currently sampling
+	GMasterThread* m_pMaster; // The workers used by sweep. They are kept between calls, so they only start once.
 
 public:
 	/// General-purpose constructor
@@ -781,6 +796,110 @@ public:
 
 	/// Draw a Gibbs sample for each node in the graph in random order.
 	void sample();
+
+	/// Specify the number of worker threads that sweep uses. The default is 1.
+	/// (The results do not depend on the number of threads.)
+	void setWorkerThreads(size_t n);
+
+	/// Partitions the nodes into color classes, such that no node is in the Markov blanket
+	/// of another node with the same color. (Each class is a set of nodes that may be sampled
+	/// concurrently.) This is called automatically the first time sweep is called, and whenever
+	/// new nodes have been added since then, but you should call it yourself if you add parents
+	/// to existing nodes after calling sweep.
+	void color();
+
+	/// Returns the color classes computed by the most recent call to color.
+	const std::vector< std::vector<GBNVariable*> >& colors() { return m_colors; }
+
+	/// Performs iters chromatic Gibbs sweeps. Each sweep draws a sample for every node, one color
+	/// class at a time. The nodes within a class are sampled concurrently by the worker threads,
+	/// and each block of nodes draws from its own random stream, so the samples are the same for
+	/// any number of threads.
+	void sweep(size_t iters = 1);
+
+protected:
+	/// Samples one block of nodes in the current color class.
+	void sampleBlock(size_t block);
+
+	/// Deletes the random streams used by sweep.
+	void clearBlockRands();
+
+	/// Stops the worker threads used by sweep.
+	void clearMaster();
+
+	/// Starts the worker threads used by sweep.
+	void makeMaster();
+};
+
+
+/// A callback function that builds a belief network for GBayesNetChains. It should add
+/// nodes to net, and add the nodes whose values should be recorded to monitor.
+typedef void (*BayesNetBuilder)(void* pThis, GBayesNet& net, std::vector<GBNVariable*>& monitor);
+
+
+/// Runs several independent Markov chains on copies of a belief network. Each chain has its own
+/// network (built by calling a BayesNetBuilder) with its own random seed, so the chains can be run
+/// concurrently by worker threads. The values of the monitored nodes are recorded after each draw,
+/// and the draws from all the chains are used to compute convergence diagnostics.
+class GBayesNetChains
+{
+friend class GBayesNetChainsWorker;
+protected:
+	std::vector<GBayesNet*> m_nets;
+	std::vector< std::vector<GBNVariable*> > m_monitors;
+	std::vector<GMatrix*> m_draws;
+	size_t m_workerThreads;
+	size_t m_burnIn;
+	size_t m_thin;
+
+public:
+	/// Calls pBuilder once for each of the chains to build its network. The networks are seeded from a
+	/// stream of random numbers that starts with seed. Every call must monitor the same number of nodes.
+	GBayesNetChains(size_t chains, BayesNetBuilder pBuilder, void* pThis, size_t seed = 0);
+	~GBayesNetChains();
+
+	/// Performs unit tests for this class. Throws an exception if any tests fail.
+	static void test();
+
+	/// Returns the number of chains.
+	size_t chains() const { return m_nets.size(); }
+
+	/// Returns the number of monitored nodes.
+	size_t monitors() const { return m_monitors[0].size(); }
+
+	/// Returns the network used by the specified chain.
+	GBayesNet& net(size_t chain) { return *m_nets[chain]; }
+
+	/// Specify the number of worker threads. The default is 1. (The results do not depend on the number of threads.)
+	void setWorkerThreads(size_t n) { m_workerThreads = n; }
+
+	/// Runs each chain for burnIn samples that are discarded, then records draws values of each monitored node,
+	/// drawing thin samples between records. The draws from any previous call are discarded.
+	void run(size_t burnIn, size_t draws, size_t thin = 1);
+
+	/// Returns a matrix with one row for each draw and one column for each monitored node.
+	GMatrix& draws(size_t chain) { return *m_draws[chain]; }
+
+	/// Returns the mean of all the draws of the specified monitored node.
+	double mean(size_t monitor);
+
+	/// Returns the potential scale reduction factor (R-hat) of the specified monitored node, computed
+	/// by splitting each chain in half and comparing the variance between the halves with the variance
+	/// within them. Values close to 1 indicate that the chains have mixed. (At least 4 draws are needed.)
+	double rHat(size_t monitor);
+
+	/// Returns the effective number of independent draws of the specified monitored node, estimated from the
+	/// autocorrelation of the split chains, which is summed using Geyer's initial monotone sequence.
+	double effectiveSampleSize(size_t monitor);
+
+protected:
+	/// Runs one of the chains.
+	void runChain(size_t chain);
+
+	/// Splits each chain in half, and stores the draws of the specified monitored node from each half
+	/// (centered about the mean of that half) in seqs. Also computes the mean within-sequence variance and
+	/// the pooled estimate of the variance. Returns the number of draws in each half.
+	size_t splitChains(size_t monitor, std::vector<double>& seqs, double* pW, double* pVarPlus);
 };
 
 
@@ -20,166 +20,558 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <vector>
+#include <algorithm>
 #include "GBigInt.h"
 #include "GError.h"
 #include "GHolders.h"
 #include "GKeyPair.h"
 #include "GDom.h"
-#ifndef WINDOWS
-#include <sys/types.h>
-typedef int64_t __int64;
-#endif // not WINDOWS
+#include "GRand.h"
+#include "GTime.h"
+
+using std::vector;
+
+// Products of operands with at least this many limbs are computed with Karatsuba multiplication
+#define KARATSUBA_THRESHOLD 32
 
 namespace GClasses {
 
+#ifdef __SIZEOF_INT128__
+__extension__ typedef unsigned __int128 GBigInt_uint128;
+#endif
+
+// Returns the low limb of a * b + c + d, and stores the high limb in *pHi. (This cannot overflow.)
+inline uint64_t GBigInt_mulAdd(uint64_t a, uint64_t b, uint64_t c, uint64_t d, uint64_t* pHi)
+{
+#ifdef __SIZEOF_INT128__
+	GBigInt_uint128 t = (GBigInt_uint128)a * b + c + d;
+	*pHi = (uint64_t)(t >> 64);
+	return (uint64_t)t;
+#else
+	uint64_t aLo = a & 0xffffffff;
+	uint64_t aHi = a >> 32;
+	uint64_t bLo = b & 0xffffffff;
+	uint64_t bHi = b >> 32;
+	uint64_t ll = aLo * bLo;
+	uint64_t lh = aLo * bHi;
+	uint64_t hl = aHi * bLo;
+	uint64_t mid = (ll >> 32) + (lh & 0xffffffff) + (hl & 0xffffffff);
+	uint64_t lo = (ll & 0xffffffff) | (mid << 32);
+	uint64_t hi = aHi * bHi + (lh >> 32) + (hl >> 32) + (mid >> 32);
+	lo += c;
+	hi += (lo < c ? 1 : 0);
+	lo += d;
+	hi += (lo < d ? 1 : 0);
+	*pHi = hi;
+	return lo;
+#endif
+}
+
+// Divides (hi * 2^64 + lo) by d, where hi < d. Returns the quotient and stores the remainder in *pRem.
+inline uint64_t GBigInt_div(uint64_t hi, uint64_t lo, uint64_t d, uint64_t* pRem)
+{
+#ifdef __SIZEOF_INT128__
+	GBigInt_uint128 n = ((GBigInt_uint128)hi << 64) | lo;
+	uint64_t q = (uint64_t)(n / d);
+	*pRem = (uint64_t)(n - (GBigInt_uint128)q * d);
+	return q;
+#else
+	uint64_t q = 0;
+	for(int i = 0; i < 64; i++)
+	{
+		bool bTop = (hi >> 63) != 0;
+		hi = (hi << 1) | (lo >> 63);
+		lo <<= 1;
+		q <<= 1;
+		if(bTop || hi >= d)
+		{
+			hi -= d;
+			q |= 1;
+		}
+	}
+	*pRem = hi;
+	return q;
+#endif
+}
+
+unsigned int GBigInt_leadingZeros(uint64_t x)
+{
+	if(x == 0)
+		return 64;
+	unsigned int n = 0;
+	while((x >> 63) == 0)
+	{
+		x <<= 1;
+		n++;
+	}
+	return n;
+}
+
+// Compares two magnitudes that may have different numbers of limbs
+int GBigInt_compare(const uint64_t* a, size_t an, const uint64_t* b, size_t bn)
+{
+	for(size_t i = std::max(an, bn); i > 0; i--)
+	{
+		uint64_t x = (i <= an ? a[i - 1] : 0);
+		uint64_t y = (i <= bn ? b[i - 1] : 0);
+		if(x != y)
+			return x > y ? 1 : -1;
+	}
+	return 0;
+}
+
+// r = a + b, where each has n limbs. Returns the carry.
+uint64_t GBigInt_addN(uint64_t* r, const uint64_t* a, const uint64_t* b, size_t n)
+{
+	uint64_t carry = 0;
+	for(size_t i = 0; i < n; i++)
+	{
+		uint64_t s = a[i] + carry;
+		carry = (s < carry ? 1 : 0);
+		s += b[i];
+		carry += (s < b[i] ? 1 : 0);
+		r[i] = s;
+	}
+	return carry;
+}
+
+// r = a - b, where each has n limbs. Returns the borrow.
+uint64_t GBigInt_subN(uint64_t* r, const uint64_t* a, const uint64_t* b, size_t n)
+{
+	uint64_t borrow = 0;
+	for(size_t i = 0; i < n; i++)
+	{
+		uint64_t x = a[i];
+		uint64_t y = b[i];
+		uint64_t d = x - y;
+		uint64_t nextBorrow = (x < y ? 1 : 0);
+		nextBorrow += (d < borrow ? 1 : 0);
+		r[i] = d - borrow;
+		borrow = nextBorrow;
+	}
+	return borrow;
+}
+
+// Adds c to the n limbs at r. Returns the carry.
+uint64_t GBigInt_addCarry(uint64_t* r, size_t n, uint64_t c)
+{
+	for(size_t i = 0; i < n && c != 0; i++)
+	{
+		r[i] += c;
+		c = (r[i] < c ? 1 : 0);
+	}
+	return c;
+}
+
+// Subtracts b from the n limbs at r. Returns the borrow.
+uint64_t GBigInt_subBorrow(uint64_t* r, size_t n, uint64_t b)
+{
+	for(size_t i = 0; i < n && b != 0; i++)
+	{
+		uint64_t x = r[i];
+		r[i] = x - b;
+		b = (x < b ? 1 : 0);
+	}
+	return b;
+}
+
+// r = |x - y|, where r has as many limbs as the longer of x and y. Returns true iff x < y.
+bool GBigInt_absDiff(uint64_t* r, const uint64_t* x, size_t xn, const uint64_t* y, size_t yn)
+{
+	bool bSwap = GBigInt_compare(x, xn, y, yn) < 0;
+	if(bSwap)
+	{
+		std::swap(x, y);
+		std::swap(xn, yn);
+	}
+	uint64_t borrow = 0;
+	for(size_t i = 0; i < std::max(xn, yn); i++)
+	{
+		uint64_t a = (i < xn ? x[i] : 0);
+		uint64_t b = (i < yn ? y[i] : 0);
+		uint64_t d = a - b;
+		uint64_t nextBorrow = (a < b ? 1 : 0);
+		nextBorrow += (d < borrow ? 1 : 0);
+		r[i] = d - borrow;
+		borrow = nextBorrow;
+	}
+	return bSwap;
+}
+
+// r[0..n) += a[0..n) * b. Returns the carry limb.
+uint64_t GBigInt_mulAdd1(uint64_t* r, const uint64_t* a, size_t n, uint64_t b)
+{
+	uint64_t carry = 0;
+	for(size_t i = 0; i < n; i++)
+		r[i] = GBigInt_mulAdd(a[i], b, r[i], carry, &carry);
+	return carry;
+}
+
+// r = a * b, where r has an + bn limbs and does not overlap a or b
+void GBigInt_mulSchoolbook(uint64_t* r, const uint64_t* a, size_t an, const uint64_t* b, size_t bn)
+{
+	memset(r, '\0', an * sizeof(uint64_t));
+	for(size_t j = 0; j < bn; j++)
+		r[an + j] = GBigInt_mulAdd1(r + j, a, an, b[j]);
+}
+
+// Returns the number of scratch limbs that GBigInt_karatsuba needs for operands with n limbs
+size_t GBigInt_karatsubaScratch(size_t n)
+{
+	if(n < KARATSUBA_THRESHOLD)
+		return 0;
+	size_t hi = n - n / 2;
+	return 6 * hi + 1 + GBigInt_karatsubaScratch(hi);
+}
+
+// r = a * b, where a and b each have n limbs, and r has 2n limbs and does not overlap a or b
+void GBigInt_karatsuba(uint64_t* r, const uint64_t* a, const uint64_t* b, size_t n, uint64_t* pScratch)
+{
+	if(n < KARATSUBA_THRESHOLD)
+	{
+		GBigInt_mulSchoolbook(r, a, n, b, n);
+		return;
+	}
+
+	// Split a = a1 * B^lo + a0 and b = b1 * B^lo + b0
+	size_t lo = n / 2;
+	size_t hi = n - lo;
+	uint64_t* pDa = pScratch;
+	uint64_t* pDb = pDa + hi;
+	uint64_t* pMid = pDb + hi;
+	uint64_t* pSum = pMid + 2 * hi;
+	uint64_t* pNext = pSum + 2 * hi + 1;
+
+	// r = a0 * b0 + a1 * b1 * B^(2lo), and mid = |a0 - a1| * |b1 - b0|
+	GBigInt_karatsuba(r, a, b, lo, pNext);
+	GBigInt_karatsuba(r + 2 * lo, a + lo, b + lo, hi, pNext);
+	bool bNegA = GBigInt_absDiff(pDa, a, lo, a + lo, hi);
+	bool bNegB = GBigInt_absDiff(pDb, b + lo, hi, b, lo);
+	GBigInt_karatsuba(pMid, pDa, pDb, hi, pNext);
+
+	// The middle term is a0 * b0 + a1 * b1 + (a0 - a1) * (b1 - b0)
+	memcpy(pSum, r, 2 * lo * sizeof(uint64_t));
+	memset(pSum + 2 * lo, '\0', (2 * (hi - lo) + 1) * sizeof(uint64_t));
+	pSum[2 * hi] = GBigInt_addN(pSum, pSum, r + 2 * lo, 2 * hi);
+	if(bNegA == bNegB)
+		pSum[2 * hi] += GBigInt_addN(pSum, pSum, pMid, 2 * hi);
+	else
+		pSum[2 * hi] -= GBigInt_subN(pSum, pSum, pMid, 2 * hi);
+	uint64_t carry = GBigInt_addN(r + lo, r + lo, pSum, 2 * hi + 1);
+	GBigInt_addCarry(r + lo + 2 * hi + 1, 2 * n - lo - 2 * hi - 1, carry);
+}
+
+// r = a * b, where r has an + bn limbs and does not overlap a or b
+void GBigInt_mul(uint64_t* r, const uint64_t* a, size_t an, const uint64_t* b, size_t bn)
+{
+	if(an < bn)
+	{
+		std::swap(a, b);
+		std::swap(an, bn);
+	}
+	if(bn < KARATSUBA_THRESHOLD)
+	{
+		GBigInt_mulSchoolbook(r, a, an, b, bn);
+		return;
+	}
+	vector<uint64_t> scratch(GBigInt_karatsubaScratch(bn));
+	if(an == bn)
+	{
+		GBigInt_karatsuba(r, a, b, bn, scratch.data());
+		return;
+	}
+
+	// Multiply b by each slice of bn limbs in a
+	memset(r, '\0', (an + bn) * sizeof(uint64_t));
+	vector<uint64_t> prod(2 * bn);
+	for(size_t off = 0; off < an; off += bn)
+	{
+		size_t len = std::min(bn, an - off);
+		if(len == bn)
+			GBigInt_karatsuba(prod.data(), a + off, b, bn, scratch.data());
+		else
+			GBigInt_mul(prod.data(), a + off, len, b, bn);
+		uint64_t carry = GBigInt_addN(r + off, r + off, prod.data(), len + bn);
+		GBigInt_addCarry(r + off + len + bn, an - off - len, carry);
+	}
+}
+
+// r = a << s, where a and r have n limbs and s < 64. Returns the bits shifted out of the top. (r may be a.)
+uint64_t GBigInt_shiftLeftN(uint64_t* r, const uint64_t* a, size_t n, unsigned int s)
+{
+	if(s == 0)
+	{
+		memmove(r, a, n * sizeof(uint64_t));
+		return 0;
+	}
+	uint64_t out = a[n - 1] >> (64 - s);
+	for(size_t i = n - 1; i > 0; i--)
+		r[i] = (a[i] << s) | (a[i - 1] >> (64 - s));
+	r[0] = a[0] << s;
+	return out;
+}
+
+// Divides u (un limbs) by v (vn limbs, the top one not zero), where un >= vn, using Knuth's algorithm D.
+// Stores the quotient (un - vn + 1 limbs) in q, and the remainder (vn limbs) in r.
+void GBigInt_divide(uint64_t* q, uint64_t* r, const uint64_t* u, size_t un, const uint64_t* v, size_t vn)
+{
+	GAssert(un >= vn && v[vn - 1] != 0);
+	if(vn == 1)
+	{
+		uint64_t rem = 0;
+		for(size_t i = un; i > 0; i--)
+			q[i - 1] = GBigInt_div(rem, u[i - 1], v[0], &rem);
+		r[0] = rem;
+		return;
+	}
+
+	// Normalize, so the top bit of the divisor is set
+	unsigned int s = GBigInt_leadingZeros(v[vn - 1]);
+	vector<uint64_t> vv(vn);
+	vector<uint64_t> uu(un + 1);
+	uint64_t* pV = vv.data();
+	uint64_t* pU = uu.data();
+	GBigInt_shiftLeftN(pV, v, vn, s);
+	pU[un] = GBigInt_shiftLeftN(pU, u, un, s);
+	uint64_t vTop = pV[vn - 1];
+	uint64_t vNext = pV[vn - 2];
+	for(size_t j = un - vn + 1; j > 0; j--)
+	{
+		// Estimate the next digit of the quotient from the top two limbs, which is at most two too big
+		uint64_t* pUj = pU + j - 1;
+		uint64_t qhat, rhat;
+		bool bRhatOverflow = false;
+		if(pUj[vn] >= vTop)
+		{
+			qhat = ~(uint64_t)0;
+			rhat = pUj[vn - 1] + vTop;
+			bRhatOverflow = (rhat < vTop);
+		}
+		else
+			qhat = GBigInt_div(pUj[vn], pUj[vn - 1], vTop, &rhat);
+		while(!bRhatOverflow)
+		{
+			uint64_t pHi;
+			uint64_t pLo = GBigInt_mulAdd(qhat, vNext, 0, 0, &pHi);
+			if(pHi < rhat || (pHi == rhat && pLo <= pUj[vn - 2]))
+				break;
+			qhat--;
+			rhat += vTop;
+			bRhatOverflow = (rhat < vTop);
+		}
+
+		// Subtract qhat * v
+		uint64_t carry = 0;
+		uint64_t borrow = 0;
+		for(size_t i = 0; i < vn; i++)
+		{
+			uint64_t p = GBigInt_mulAdd(qhat, pV[i], carry, 0, &carry);
+			uint64_t x = pUj[i];
+			uint64_t d = x - p;
+			uint64_t nextBorrow = (x < p ? 1 : 0);
+			nextBorrow += (d < borrow ? 1 : 0);
+			pUj[i] = d - borrow;
+			borrow = nextBorrow;
+		}
+		uint64_t x = pUj[vn];
+		uint64_t d = x - carry;
+		uint64_t nextBorrow = (x < carry ? 1 : 0);
+		nextBorrow += (d < borrow ? 1 : 0);
+		pUj[vn] = d - borrow;
+
+		// If that went negative, qhat was one too big, so add v back
+		if(nextBorrow)
+		{
+			qhat--;
+			pUj[vn] += GBigInt_addN(pUj, pUj, pV, vn);
+		}
+		q[j - 1] = qhat;
+	}
+
+	// Unnormalize the remainder
+	for(size_t i = 0; i < vn; i++)
+		r[i] = (s == 0 ? pU[i] : (pU[i] >> s) | (pU[i + 1] << (64 - s)));
+}
+
+// Returns -1/n0 modulo 2^64, where n0 is odd
+uint64_t GBigInt_negInverse(uint64_t n0)
+{
+	// Each Newton iteration doubles the number of correct low bits, starting with 3
+	uint64_t inv = n0;
+	for(int i = 0; i < 5; i++)
+		inv *= 2 - n0 * inv;
+	return (uint64_t)0 - inv;
+}
+
+// r = a * b / B^k modulo n, where a, b < n, and n is odd with k limbs. nInv is -1/n[0] modulo B.
+// t is scratch space with k + 2 limbs. (r may be a or b.)
+void GBigInt_montMul(uint64_t* r, const uint64_t* a, const uint64_t* b, const uint64_t* n, size_t k, uint64_t nInv, uint64_t* t)
+{
+	memset(t, '\0', (k + 2) * sizeof(uint64_t));
+	for(size_t i = 0; i < k; i++)
+	{
+		// t += a * b[i]
+		uint64_t carry = GBigInt_mulAdd1(t, a, k, b[i]);
+		uint64_t s = t[k] + carry;
+		t[k + 1] = (s < carry ? 1 : 0);
+		t[k] = s;
+
+		// t = (t + m * n) / B, where m makes the low limb zero
+		uint64_t m = t[0] * nInv;
+		GBigInt_mulAdd(m, n[0], t[0], 0, &carry);
+		for(size_t j = 1; j < k; j++)
+			t[j - 1] = GBigInt_mulAdd(m, n[j], t[j], carry, &carry);
+		s = t[k] + carry;
+		t[k - 1] = s;
+		t[k] = t[k + 1] + (s < carry ? 1 : 0);
+	}
+	if(t[k] != 0 || GBigInt_compare(t, k, n, k) >= 0)
+		GBigInt_subN(t, t, n, k);
+	memcpy(r, t, k * sizeof(uint64_t));
+}
+
 GBigInt::GBigInt()
+: m_nLimbs(0), m_pLimbs(NULL), m_bSign(true)
 {
-	m_pBits = NULL;
-	m_nUInts = 0;
-	m_bSign = true;
 }
 
 GBigInt::GBigInt(GDomNode* pNode)
+: m_nLimbs(0), m_pLimbs(NULL), m_bSign(true)
 {
 	GDomListIterator it(pNode);
-	m_nUInts = (unsigned int)it.remaining();
-	m_pBits = new unsigned int[m_nUInts - 1];
-	if(it.currentInt() >= 0)
-		m_bSign = true;
-	else
-		m_bSign = false;
+	if(it.remaining() < 1)
+		throw Ex("Expected a list that begins with the sign");
+	m_bSign = (it.currentInt() >= 0);
 	it.advance();
-	for(unsigned int i = 0; i < m_nUInts; i++)
+	unsigned int nUInts = (unsigned int)it.remaining();
+	resize(nUInts * BITS_PER_INT);
+	for(unsigned int i = 0; i < nUInts; i++)
 	{
-		m_pBits[i] = (unsigned int)it.currentInt();
+		setUInt(i, (unsigned int)it.currentInt());
 		it.advance();
 	}
 }
 
 GBigInt::~GBigInt()
 {
-	delete [] m_pBits;
+	delete [] m_pLimbs;
 }
 
 GDomNode* GBigInt::serialize(GDom* pDoc) const
 {
 	GDomNode* pNode = pDoc->newList();
 	pNode->add(pDoc, m_bSign ? 1ll : -1ll);
-	for(unsigned int i = 0; i < m_nUInts; i++)
-		pNode->add(pDoc, (long long)m_pBits[i]);
+	for(unsigned int i = 0; i < m_nLimbs * UINTS_PER_LIMB; i++)
+		pNode->add(pDoc, (long long)(unsigned int)(m_pLimbs[i / UINTS_PER_LIMB] >> (BITS_PER_INT * (i % UINTS_PER_LIMB))));
 	return pNode;
 }
 
+unsigned int GBigInt::usedLimbs() const
+{
+	unsigned int n = m_nLimbs;
+	while(n > 0 && m_pLimbs[n - 1] == 0)
+		n--;
+	return n;
+}
+
 unsigned int GBigInt::getBitCount()
 {
-	if(m_nUInts < 1)
+	unsigned int n = usedLimbs();
+	if(n == 0)
 		return 0;
-	unsigned int nEnd = m_nUInts - 1;
-	unsigned int nBitCount = m_nUInts * BITS_PER_INT;
-	while(m_pBits[nEnd] == 0)
-	{
-		nBitCount -= BITS_PER_INT;
-		if(nEnd == 0)
-			return 0;
-		nEnd--;
-	}
-	unsigned int nVal = m_pBits[nEnd];
-	unsigned int nMask = 1 << (BITS_PER_INT - 1);
-	while((nVal & nMask) == 0)
-	{
-		nBitCount--;
-		nMask >>= 1;
-	}
-	return nBitCount;
+	return n * BITS_PER_LIMB - GBigInt_leadingZeros(m_pLimbs[n - 1]);
 }
 
 void GBigInt::resize(unsigned int nBits)
 {
 	if(nBits < 1)
 	{
-		delete [] m_pBits;
-		m_pBits = NULL;
-		m_nUInts = 0;
+		delete [] m_pLimbs;
+		m_pLimbs = NULL;
+		m_nLimbs = 0;
 		return;
 	}
-	unsigned int nNewUInts = ((nBits - 1) / BITS_PER_INT) + 1;
-	if(nNewUInts <= m_nUInts && nNewUInts + 2 > m_nUInts / 2) // magic heuristic
+	unsigned int nNewLimbs = ((nBits - 1) / BITS_PER_LIMB) + 1;
+	if(nNewLimbs <= m_nLimbs && nNewLimbs + 2 > m_nLimbs / 2) // magic heuristic
 	{
 		unsigned int i;
-		for(i = nNewUInts; i < m_nUInts; i++)
-			m_pBits[i] = 0;
+		for(i = nNewLimbs; i < m_nLimbs; i++)
+			m_pLimbs[i] = 0;
 		return;
 	}
-	unsigned int* pNewBits = new unsigned int[nNewUInts];
-	unsigned int nTop = m_nUInts;
-	if(nNewUInts < nTop)
-		nTop = nNewUInts;
+	uint64_t* pNewLimbs = new uint64_t[nNewLimbs];
+	unsigned int nTop = m_nLimbs;
+	if(nNewLimbs < nTop)
+		nTop = nNewLimbs;
 	unsigned int n;
 	for(n = 0; n < nTop; n++)
-		pNewBits[n] = m_pBits[n];
-	for( ; n < nNewUInts; n++)
-		pNewBits[n] = 0;
-	delete [] m_pBits;
-	m_pBits = pNewBits;
-	m_nUInts = nNewUInts;
+		pNewLimbs[n] = m_pLimbs[n];
+	for( ; n < nNewLimbs; n++)
+		pNewLimbs[n] = 0;
+	delete [] m_pLimbs;
+	m_pLimbs = pNewLimbs;
+	m_nLimbs = nNewLimbs;
+}
+
+void GBigInt::setLimbs(const uint64_t* pLimbs, size_t nLimbs)
+{
+	if(m_nLimbs < nLimbs)
+		resize((unsigned int)nLimbs * BITS_PER_LIMB);
+	for(size_t i = 0; i < nLimbs; i++)
+		m_pLimbs[i] = pLimbs[i];
+	for(size_t i = nLimbs; i < m_nLimbs; i++)
+		m_pLimbs[i] = 0;
 }
 
 void GBigInt::setBit(unsigned int nPos, bool bVal)
 {
-	if(nPos >= m_nUInts * BITS_PER_INT)
+	if(nPos >= m_nLimbs * BITS_PER_LIMB)
 		resize(nPos + 1);
 	if(bVal)
-		m_pBits[nPos / BITS_PER_INT] |= (1 << (nPos % BITS_PER_INT));
+		m_pLimbs[nPos / BITS_PER_LIMB] |= ((uint64_t)1 << (nPos % BITS_PER_LIMB));
 	else
-		m_pBits[nPos / BITS_PER_INT] &= ~(1 << (nPos % BITS_PER_INT));
+		m_pLimbs[nPos / BITS_PER_LIMB] &= ~((uint64_t)1 << (nPos % BITS_PER_LIMB));
 }
 
 void GBigInt::setUInt(unsigned int nPos, unsigned int nVal)
 {
-	if(nPos >= m_nUInts)
+	if(nPos >= getUIntCount())
 		resize((nPos + 1) * BITS_PER_INT);
-	m_pBits[nPos] = nVal;
+	unsigned int nShift = BITS_PER_INT * (nPos % UINTS_PER_LIMB);
+	uint64_t& limb = m_pLimbs[nPos / UINTS_PER_LIMB];
+	limb = (limb & ~((uint64_t)0xffffffff << nShift)) | ((uint64_t)nVal << nShift);
 }
 
 void GBigInt::copy(GBigInt* pBigNumber)
 {
-	if(m_nUInts < pBigNumber->m_nUInts)
-		resize(pBigNumber->m_nUInts * BITS_PER_INT);
-	if(m_nUInts < 1)
+	if(pBigNumber == this)
 		return;
-	unsigned int n;
-	for(n = 0; n < pBigNumber->m_nUInts; n++)
-		m_pBits[n] = pBigNumber->m_pBits[n];
-	for(;n < m_nUInts; n++)
-		m_pBits[n] = 0;
+	setLimbs(pBigNumber->m_pLimbs, pBigNumber->m_nLimbs);
 	m_bSign = pBigNumber->m_bSign;
 }
 
 void GBigInt::setToZero()
 {
-	memset(m_pBits, '\0', m_nUInts * sizeof(unsigned int));
+	if(m_nLimbs > 0)
+		memset(m_pLimbs, '\0', m_nLimbs * sizeof(uint64_t));
 	m_bSign = true;
 }
 
 bool GBigInt::isZero()
 {
-	if(m_nUInts < 1)
-		return true;
-	unsigned int n;
-	for(n = 0; n < m_nUInts; n++)
-	{
-		if(m_pBits[n] != 0)
-			return false;
-	}
-	return true;
+	return usedLimbs() == 0;
 }
 
 unsigned int* GBigInt::toBufferGiveOwnership()
 {
-	unsigned int* pBuffer = m_pBits;
+	unsigned int nUInts = getUIntCount();
+	unsigned int* pBuffer = new unsigned int[nUInts];
+	toBuffer(pBuffer, nUInts);
+	delete [] m_pLimbs;
+	m_pLimbs = NULL;
+	m_nLimbs = 0;
 	m_bSign = true;
-	m_nUInts = 0;
-	m_pBits = NULL;
 	return pBuffer;
 }
 
@@ -190,7 +582,7 @@ bool GBigInt::toBuffer(unsigned int* pBuffer, int nBufferSize)
 		return false;
 	int n;
 	for(n = nSize - 1; n >= 0; n--)
-		pBuffer[n] = m_pBits[n];
+		pBuffer[n] = getUInt(n);
 	return true;
 }
 
@@ -204,33 +596,24 @@ void GBigInt::fromBuffer(const unsigned int* pBuffer, int nBufferSize)
 
 void GBigInt::fromByteBuffer(const unsigned char* pBuffer, int nBufferChars)
 {
-	// Make sure input is alligned to sizeof(unsigned int)
-	int nTempBufSize = nBufferChars + sizeof(unsigned int) - 1;
-	GTEMPBUF(unsigned char, pBuf, nTempBufSize);
-	if((nBufferChars % sizeof(unsigned int)) != 0)
-	{
-		memset(pBuf, '\0', nBufferChars + sizeof(unsigned int) - 1);
-		memcpy(pBuf, pBuffer, nBufferChars);
-		pBuffer = pBuf;
-		nBufferChars += sizeof(unsigned int) - 1;
-	}
-	nBufferChars /= sizeof(unsigned int);
-	fromBuffer((unsigned int*)pBuffer, nBufferChars);
+	setToZero();
+	resize(nBufferChars * 8);
+	for(int n = 0; n < nBufferChars; n++)
+		m_pLimbs[n / sizeof(uint64_t)] |= ((uint64_t)pBuffer[n] << (8 * (n % sizeof(uint64_t))));
 }
 
 bool GBigInt::toHex(char* szBuff, int nBufferSize)
 {
 	bool bStarted = false;
-	int nUInts = getUIntCount();
 	int n, i;
 	unsigned char byte;
 	char c;
 	int nPos = 0;
-	for(n = nUInts - 1; n >= 0; n--)
+	for(n = m_nLimbs - 1; n >= 0; n--)
 	{
-		for(i = sizeof(int) * 2 - 1; i >= 0; i--)
+		for(i = sizeof(uint64_t) * 2 - 1; i >= 0; i--)
 		{
-			byte = (m_pBits[n] >> (4 * i)) & 15;
+			byte = (m_pLimbs[n] >> (4 * i)) & 15;
 			if(byte == 0 && !bStarted)
 				continue;
 			bStarted = true;
@@ -250,12 +633,10 @@ bool GBigInt::fromHex(const char* szHexValue)
 	unsigned int nLength = (unsigned int)strlen(szHexValue);
 	resize(nLength * 4);
 	setToZero();
-	unsigned int nUIntPos = 0;
-	unsigned int nHexCount = 0;
 	unsigned int n;
 	for(n = 0; n < nLength; n++)
 	{
-		unsigned int nTmp;
+		uint64_t nTmp;
 		char cTmp = szHexValue[nLength - n - 1];
 		if(cTmp >= '0' && cTmp <= '9')
 			nTmp = cTmp - '0';
@@ -265,13 +646,7 @@ bool GBigInt::fromHex(const char* szHexValue)
 			nTmp = cTmp - 'a' + 10;
 		else
 			return false;
-		m_pBits[nUIntPos] |= (nTmp << (4 * nHexCount));
-		nHexCount++;
-		if(nHexCount >= sizeof(unsigned int) * 2)
-		{
-			nHexCount = 0;
-			nUIntPos++;
-		}
+		m_pLimbs[n / (sizeof(uint64_t) * 2)] |= (nTmp << (4 * (n % (sizeof(uint64_t) * 2))));
 	}
 	return true;
 }
@@ -289,26 +664,7 @@ int GBigInt::compareTo(GBigInt* pOperand)
 			return 0;
 		return m_bSign ? 1 : -1;
 	}
-	int nCmp = 0;
-	unsigned int nA;
-	unsigned int nB;
-	unsigned int n = m_nUInts;
-	if(pOperand->m_nUInts > n)
-		n = pOperand->m_nUInts;
-	n--;
-	while(true)
-	{
-		nA = getUInt(n);
-		nB = pOperand->getUInt(n);
-		if(nA != nB)
-		{
-			nCmp = nA > nB ? 1 : -1;
-			break;
-		}
-		if(n == 0)
-			break;
-		n--;
-	}
+	int nCmp = GBigInt_compare(m_pLimbs, m_nLimbs, pOperand->m_pLimbs, pOperand->m_nLimbs);
 	return m_bSign ? nCmp : -nCmp;
 }
 
@@ -324,10 +680,10 @@ void GBigInt::increment()
 	unsigned int n;
 	for(n = 0; true; n++)
 	{
-		if(n == m_nUInts)
-			resize(m_nUInts * BITS_PER_INT + 1);
-		m_pBits[n]++;
-		if(m_pBits[n] != 0)
+		if(n == m_nLimbs)
+			resize(m_nLimbs * BITS_PER_LIMB + 1);
+		m_pLimbs[n]++;
+		if(m_pLimbs[n] != 0)
 			return;
 	}
 }
@@ -347,321 +703,177 @@ void GBigInt::decrement()
 		negate();
 		return;
 	}
-	unsigned int n;
-	for(n = 0; true; n++)
-	{
-		if(m_pBits[n] == 0)
-			m_pBits[n]--;
-		else
-		{
-			m_pBits[n]--;
-			return;
-		}
-	}
-}
-
-void GBigInt::add(GBigInt* pBigNumber)
-{
-	// Check signs
-	if(!m_bSign)
-	{
-		negate();
-		subtract(pBigNumber);
-		negate();
-		return;
-	}
-	if(!pBigNumber->m_bSign)
-	{
-		pBigNumber->negate();
-		subtract(pBigNumber);
-		pBigNumber->negate();
-		return;
-	}
-
-	// See if we need a bigger buffer
-	unsigned int nBits = getBitCount();
-	unsigned int nTmp = pBigNumber->getBitCount();
-	if(nTmp > nBits)
-		nBits = nTmp;
-	nBits++;
-	if(nBits > m_nUInts * BITS_PER_INT)
-		resize(nBits);
-
-	// Add it up
-	unsigned int nSum;
-	unsigned int n;
-	unsigned int nOperand;
-	bool bNextCarry;
-	bool bCarry = false;
-	for(n = 0; n < m_nUInts; n++)
-	{
-		nOperand = pBigNumber->getUInt(n);
-		nSum = m_pBits[n] + nOperand;
-		if(nSum < m_pBits[n] && nSum < nOperand)
-			bNextCarry = true;
-		else
-			bNextCarry = false;
-		if(bCarry)
-		{
-			if(++nSum == 0)
-				bNextCarry = true;
-		}
-		bCarry = bNextCarry;
-		m_pBits[n] = nSum;
-	}
+	GBigInt_subBorrow(m_pLimbs, m_nLimbs, 1);
 }
 
-void GBigInt::subtract(GBigInt* pBigNumber)
+void GBigInt::addSigned(GBigInt* pBigNumber, bool bSign)
 {
-	// Check signs
-	if(!m_bSign)
-	{
-		negate();
-		add(pBigNumber);
-		negate();
+	unsigned int an = usedLimbs();
+	unsigned int bn = pBigNumber->usedLimbs();
+	if(bn == 0)
 		return;
-	}
-	if(!pBigNumber->m_bSign)
+	if(an == 0)
+		m_bSign = bSign;
+	if(m_bSign == bSign)
 	{
-		pBigNumber->negate();
-		add(pBigNumber);
-		pBigNumber->negate();
-		return;
+		// Add the magnitudes
+		unsigned int n = std::max(an, bn) + 1;
+		if(m_nLimbs < n)
+			resize(n * BITS_PER_LIMB);
+		uint64_t carry = GBigInt_addN(m_pLimbs, m_pLimbs, pBigNumber->m_pLimbs, bn);
+		GBigInt_addCarry(m_pLimbs + bn, m_nLimbs - bn, carry);
 	}
-
-	// Check sizes
-	GBigInt tmp;
-	GBigInt* pA = this;
-	GBigInt* pB = pBigNumber;
-	int nCmp = compareTo(pBigNumber);
-	if(nCmp < 0)
+	else if(GBigInt_compare(m_pLimbs, an, pBigNumber->m_pLimbs, bn) >= 0)
 	{
-		tmp.copy(pBigNumber);
-		pA = &tmp;
-		pB = this;
+		// Subtract the smaller magnitude from this one
+		uint64_t borrow = GBigInt_subN(m_pLimbs, m_pLimbs, pBigNumber->m_pLimbs, bn);
+		GBigInt_subBorrow(m_pLimbs + bn, an - bn, borrow);
+		if(isZero())
+			m_bSign = true;
 	}
-
-	// Subtract
-	unsigned int n;
-	unsigned int nA;
-	unsigned int nB;
-	bool bNextBorrow;
-	bool bBorrow = false;
-	for(n = 0; n < pA->m_nUInts; n++)
-	{
-		nA = pA->m_pBits[n];
-		nB = pB->getUInt(n);
-		bNextBorrow = false;
-		if(bBorrow)
-		{
-			if(nA == 0)
-				bNextBorrow = true;
-			nA--;
-		}
-		if(nB > nA)
-			bNextBorrow = true;
-		pA->m_pBits[n] = nA - nB;
-		bBorrow = bNextBorrow;
-	}
-
-	// Negate again if we swapped A and B
-	if(nCmp < 0)
+	else
 	{
-		tmp.negate();
-		copy(&tmp);
+		// Subtract this magnitude from the larger one
+		if(m_nLimbs < bn)
+			resize(bn * BITS_PER_LIMB);
+		GBigInt_subN(m_pLimbs, pBigNumber->m_pLimbs, m_pLimbs, bn);
+		m_bSign = bSign;
 	}
 }
 
-void GBigInt::shiftLeft(unsigned int nBits)
+void GBigInt::add(GBigInt* pBigNumber)
 {
-	shiftLeftBits(nBits % BITS_PER_INT);
-	shiftLeftUInts(nBits / BITS_PER_INT);
+	addSigned(pBigNumber, pBigNumber->m_bSign);
 }
 
-void GBigInt::shiftLeftBits(unsigned int nBits)
+void GBigInt::subtract(GBigInt* pBigNumber)
 {
-	if(m_nUInts == 0)
-		return;
-	if(nBits == 0)
-		return;
-	if(m_pBits[m_nUInts - 1] != 0)
-		resize(getBitCount() + nBits);
-	unsigned int n;
-	unsigned int nCarry = 0;
-	unsigned int nNextCarry;
-	for(n = 0; n < m_nUInts; n++)
-	{
-		nNextCarry = m_pBits[n] >> (BITS_PER_INT - nBits);
-		m_pBits[n] <<= nBits;
-		m_pBits[n] |= nCarry;
-		nCarry = nNextCarry;
-	}
+	addSigned(pBigNumber, !pBigNumber->m_bSign);
 }
 
-void GBigInt::shiftLeftUInts(unsigned int nUInts)
+void GBigInt::shiftLeft(unsigned int nBits)
 {
-	if(m_nUInts == 0)
+	if(nBits == 0 || isZero())
 		return;
-	if(nUInts == 0)
-		return;
-	if(!(nUInts == 1 && m_pBits[m_nUInts - 1] == 0)) // optimization to make Multiply faster
-		resize((m_nUInts + nUInts) * BITS_PER_INT);
-	unsigned int n = m_nUInts - 1;
-	if(n >= nUInts)
+	unsigned int nNeeded = getBitCount() + nBits;
+	if(nNeeded > m_nLimbs * BITS_PER_LIMB)
+		resize(nNeeded);
+	unsigned int nLimbShift = nBits / BITS_PER_LIMB;
+	unsigned int nBitShift = nBits % BITS_PER_LIMB;
+	for(unsigned int i = m_nLimbs; i > 0; i--)
 	{
-		while(true)
+		unsigned int nDest = i - 1;
+		if(nDest < nLimbShift)
 		{
-			m_pBits[n] = m_pBits[n - nUInts];
-			if(n - nUInts == 0)
-			{
-				n--;
-				break;
-			}
-			n--;
+			m_pLimbs[nDest] = 0;
+			continue;
 		}
+		unsigned int nSrc = nDest - nLimbShift;
+		uint64_t v = m_pLimbs[nSrc] << nBitShift;
+		if(nBitShift > 0 && nSrc > 0)
+			v |= m_pLimbs[nSrc - 1] >> (BITS_PER_LIMB - nBitShift);
+		m_pLimbs[nDest] = v;
 	}
-	while(true)
-	{
-		m_pBits[n] = 0;
-		if(n == 0)
-			break;
-		n--;
-	}
-	return;
 }
 
 void GBigInt::shiftRight(unsigned int nBits)
 {
-	shiftRightBits(nBits % BITS_PER_INT);
-	shiftRightUInts(nBits / BITS_PER_INT);
-}
-
-void GBigInt::shiftRightBits(unsigned int nBits)
-{
-	if(m_nUInts == 0)
-		return;
-	if(nBits == 0)
-		return;
-	unsigned int n = m_nUInts - 1;
-	unsigned int nCarry = 0;
-	unsigned int nNextCarry;
-	while(true)
+	unsigned int nLimbShift = nBits / BITS_PER_LIMB;
+	unsigned int nBitShift = nBits % BITS_PER_LIMB;
+	for(unsigned int nDest = 0; nDest < m_nLimbs; nDest++)
 	{
-		nNextCarry = m_pBits[n] << (BITS_PER_INT - nBits);
-		m_pBits[n] >>= nBits;
-		m_pBits[n] |= nCarry;
-		nCarry = nNextCarry;
-		if(n == 0)
-			break;
-		n--;
+		uint64_t v = 0;
+		if(nLimbShift < m_nLimbs - nDest)
+		{
+			unsigned int nSrc = nDest + nLimbShift;
+			v = m_pLimbs[nSrc] >> nBitShift;
+			if(nBitShift > 0 && nSrc + 1 < m_nLimbs)
+				v |= m_pLimbs[nSrc + 1] << (BITS_PER_LIMB - nBitShift);
+		}
+		m_pLimbs[nDest] = v;
 	}
 }
 
-void GBigInt::shiftRightUInts(unsigned int nUInts)
-{
-	if(m_nUInts == 0)
-		return;
-	if(nUInts == 0)
-		return;
-	unsigned int n;
-	for(n = 0; n + nUInts < m_nUInts; n++)
-		m_pBits[n] = m_pBits[n + nUInts];
-	for(;n < m_nUInts; n++)
-		m_pBits[n] = 0;
-}
-
 void GBigInt::Or(GBigInt* pBigNumber)
 {
-	if(m_nUInts < pBigNumber->m_nUInts)
-		resize(pBigNumber->m_nUInts * BITS_PER_INT);
-	unsigned int n;
-	for(n = 0; n < m_nUInts; n++)
-		m_pBits[n] |= pBigNumber->getUInt(n);
+	if(m_nLimbs < pBigNumber->m_nLimbs)
+		resize(pBigNumber->m_nLimbs * BITS_PER_LIMB);
+	for(unsigned int n = 0; n < pBigNumber->m_nLimbs; n++)
+		m_pLimbs[n] |= pBigNumber->m_pLimbs[n];
 }
 
 void GBigInt::And(GBigInt* pBigNumber)
 {
-	unsigned int n;
-	for(n = 0; n < m_nUInts; n++)
-		m_pBits[n] &= pBigNumber->getUInt(n);
+	for(unsigned int n = 0; n < m_nLimbs; n++)
+		m_pLimbs[n] &= (n < pBigNumber->m_nLimbs ? pBigNumber->m_pLimbs[n] : 0);
 }
 
 void GBigInt::Xor(GBigInt* pBigNumber)
 {
-	if(m_nUInts < pBigNumber->m_nUInts)
-		resize(pBigNumber->m_nUInts * BITS_PER_INT);
-	unsigned int n;
-	for(n = 0; n < m_nUInts; n++)
-		m_pBits[n] ^= pBigNumber->getUInt(n);
+	if(m_nLimbs < pBigNumber->m_nLimbs)
+		resize(pBigNumber->m_nLimbs * BITS_PER_LIMB);
+	for(unsigned int n = 0; n < pBigNumber->m_nLimbs; n++)
+		m_pLimbs[n] ^= pBigNumber->m_pLimbs[n];
 }
 
 void GBigInt::multiply(GBigInt* pBigNumber, unsigned int nUInt)
 {
-	if(nUInt == 0)
+	unsigned int n = pBigNumber->usedLimbs();
+	if(nUInt == 0 || n == 0)
 	{
 		setToZero();
 		return;
 	}
-	setToZero();
-	resize((pBigNumber->m_nUInts + 1) * BITS_PER_INT);
-	unsigned int n;
-	for(n = 0; n < pBigNumber->m_nUInts; n++)
-	{
-#ifdef BYTE_ORDER_BIG_ENDIAN
-		__int64 prod = (__int64)pBigNumber->m_pBits[n] * (__int64)nUInt;
-		__int64 rev;
-		((unsigned int*)&rev)[0] = ((unsigned int*)&prod)[1];
-		((unsigned int*)&rev)[1] = ((unsigned int*)&prod)[0];
-		*((__int64*)&m_pBits[n]) += rev;
-#else // BYTE_ORDER_BIG_ENDIAN
-		*((__int64*)&m_pBits[n]) += (__int64)pBigNumber->m_pBits[n] * (__int64)nUInt;
-#endif // !BYTE_ORDER_BIG_ENDIAN
-	}
+	bool bSign = pBigNumber->m_bSign;
+	vector<uint64_t> prod(n + 1);
+	prod[n] = GBigInt_mulAdd1(prod.data(), pBigNumber->m_pLimbs, n, nUInt);
+	setLimbs(prod.data(), n + 1);
+	m_bSign = bSign;
 }
 
 void GBigInt::multiply(GBigInt* pFirst, GBigInt* pSecond)
 {
-	setToZero();
-	resize(pFirst->getBitCount() + pSecond->getBitCount());
-	GBigInt tmp;
-	unsigned int nUInts = pFirst->m_nUInts;
-	if(pSecond->m_nUInts > nUInts)
-		nUInts = pSecond->m_nUInts;
-	unsigned int n;
-	for(n = 0; n < nUInts; n++)
+	unsigned int an = pFirst->usedLimbs();
+	unsigned int bn = pSecond->usedLimbs();
+	if(an == 0 || bn == 0)
 	{
-		shiftLeftUInts(1);
-		tmp.multiply(pFirst, pSecond->getUInt(nUInts - 1 - n));
-		add(&tmp);
+		setToZero();
+		return;
 	}
-	m_bSign = ((pFirst->m_bSign == pSecond->m_bSign) ? true : false);
+	bool bSign = (pFirst->m_bSign == pSecond->m_bSign);
+	vector<uint64_t> prod(an + bn);
+	GBigInt_mul(prod.data(), pFirst->m_pLimbs, an, pSecond->m_pLimbs, bn);
+	setLimbs(prod.data(), an + bn);
+	m_bSign = bSign;
 }
 
 void GBigInt::divide(GBigInt* pInNominator, GBigInt* pInDenominator, GBigInt* pOutRemainder)
 {
-	setToZero();
-	resize(pInNominator->getBitCount());
-	pOutRemainder->setToZero();
-	pOutRemainder->resize(pInDenominator->getBitCount());
-	unsigned int nBits = pInNominator->getBitCount();
-	unsigned int n;
-	for(n = 0; n < nBits; n++)
+	unsigned int un = pInNominator->usedLimbs();
+	unsigned int vn = pInDenominator->usedLimbs();
+	if(vn == 0)
+		throw Ex("Division by zero");
+	bool bQuotientSign = (pInNominator->m_bSign == pInDenominator->m_bSign);
+	bool bRemainderSign = pInNominator->m_bSign;
+	if(un < vn)
 	{
-		pOutRemainder->shiftLeftBits(1);
-		pOutRemainder->setBit(0, pInNominator->getBit(nBits - 1 - n));
-		shiftLeftBits(1);
-		if(pOutRemainder->compareTo(pInDenominator) >= 0)
-		{
-			setBit(0, true);
-			pOutRemainder->subtract(pInDenominator);
-		}
-		else
-		{
-			setBit(0, false);
-		}
+		pOutRemainder->copy(pInNominator);
+		setToZero();
+	}
+	else
+	{
+		vector<uint64_t> q(un - vn + 1);
+		vector<uint64_t> r(vn);
+		GBigInt_divide(q.data(), r.data(), pInNominator->m_pLimbs, un, pInDenominator->m_pLimbs, vn);
+		setLimbs(q.data(), q.size());
+		m_bSign = bQuotientSign;
+		pOutRemainder->setLimbs(r.data(), r.size());
+		pOutRemainder->m_bSign = bRemainderSign;
 	}
-	m_bSign = ((pInNominator->m_bSign == pInDenominator->m_bSign) ? true : false);
-	pOutRemainder->m_bSign = pInNominator->m_bSign;
+	if(isZero())
+		m_bSign = true;
+	if(pOutRemainder->isZero())
+		pOutRemainder->m_bSign = true;
 }
 
 // DO NOT use for crypto
@@ -669,20 +881,22 @@ void GBigInt::divide(GBigInt* pInNominator, GBigInt* pInDenominator, GBigInt* pO
 void GBigInt::setRandom(unsigned int nBits)
 {
 	resize(nBits);
+	setToZero();
 	unsigned int nBytes = nBits / 8;
 	unsigned int nExtraBits = nBits % 8;
 	unsigned int n;
 	for(n = 0; n < nBytes; n++)
-		((unsigned char*)m_pBits)[n] = (unsigned char)rand();
+		m_pLimbs[n / sizeof(uint64_t)] |= ((uint64_t)(unsigned char)rand() << (8 * (n % sizeof(uint64_t))));
 	if(nExtraBits > 0)
 	{
 		unsigned char c = (unsigned char)rand();
 		c <<= (8 - nExtraBits);
 		c >>= (8 - nExtraBits);
-		((unsigned char*)m_pBits)[n] = c;
+		m_pLimbs[n / sizeof(uint64_t)] |= ((uint64_t)c << (8 * (n % sizeof(uint64_t))));
 	}
 }
 
+
 // Input:  integers a, b
 // Output: [this,x,y] where "this" is the greatest common divisor of a,b and where g=xa+by (x or y can be negative)
 void GBigInt::euclid(GBigInt* pA1, GBigInt* pB1, GBigInt* pOutX/*=NULL*/, GBigInt* pOutY/*=NULL*/)
@@ -815,29 +1029,118 @@ void GBigInt::calculatePrivateKey(GBigInt* pPublicKey, GBigInt* pProd)
 // Output: "this" where "this" = (a^k)%n   (^ = exponent operator, not xor operatore)
 void GBigInt::powerMod(GBigInt* pA, GBigInt* pK, GBigInt* pN)
 {
-	GBigInt k;
-	k.copy(pK);
+	if(pN->getBit(0))
+	{
+		powerModMontgomery(pA, pK, pN);
+		return;
+	}
+
+	// Square and multiply, dividing by n after each product
+	unsigned int nBits = pK->getBitCount();
 	GBigInt c;
 	c.copy(pA);
 	GBigInt b;
 	b.increment();
 	GBigInt p;
 	GBigInt q;
-	while(!k.isZero())
+	for(unsigned int i = 0; i < nBits; i++)
 	{
-		if(k.getBit(0))
+		if(pK->getBit(i))
 		{
-			k.decrement();
 			p.multiply(&b, &c);
 			q.divide(&p, pN, &b);
 		}
-		p.multiply(&c, &c);
-		q.divide(&p, pN, &c);
-		k.shiftRightBits(1);
+		if(i + 1 < nBits)
+		{
+			p.multiply(&c, &c);
+			q.divide(&p, pN, &c);
+		}
 	}
 	copy(&b);
 }
 
+void GBigInt::powerModMontgomery(GBigInt* pA, GBigInt* pK, GBigInt* pN)
+{
+	unsigned int nBits = pK->getBitCount();
+	if(nBits == 0)
+	{
+		setToZero();
+		increment();
+		return;
+	}
+	size_t k = pN->usedLimbs();
+	vector<uint64_t> n(pN->m_pLimbs, pN->m_pLimbs + k);
+	uint64_t nInv = GBigInt_negInverse(n[0]);
+
+	// Convert a to Montgomery form (a * B^k modulo n), and find one in Montgomery form (B^k modulo n)
+	size_t an = pA->usedLimbs();
+	vector<uint64_t> u(an + k + 1);
+	vector<uint64_t> quot(an + 2);
+	vector<uint64_t> base(k);
+	vector<uint64_t> x(k);
+	for(size_t i = 0; i < an; i++)
+		u[k + i] = pA->m_pLimbs[i];
+	GBigInt_divide(quot.data(), base.data(), u.data(), an + k, n.data(), k);
+	if(!pA->m_bSign && GBigInt_compare(base.data(), k, NULL, 0) != 0)
+		GBigInt_subN(base.data(), n.data(), base.data(), k);
+	std::fill(u.begin(), u.end(), 0);
+	u[k] = 1;
+	GBigInt_divide(quot.data(), x.data(), u.data(), k + 1, n.data(), k);
+
+	// Precompute the odd powers of a up to the window size
+	unsigned int nWindow = nBits > 671 ? 6 : (nBits > 239 ? 5 : (nBits > 79 ? 4 : (nBits > 23 ? 3 : 1)));
+	size_t nOddPowers = (size_t)1 << (nWindow - 1);
+	vector<uint64_t> t(k + 2);
+	vector<uint64_t> oddPowers(nOddPowers * k);
+	std::copy(base.begin(), base.end(), oddPowers.begin());
+	if(nOddPowers > 1)
+	{
+		GBigInt_montMul(base.data(), base.data(), base.data(), n.data(), k, nInv, t.data());
+		for(size_t i = 1; i < nOddPowers; i++)
+			GBigInt_montMul(oddPowers.data() + i * k, oddPowers.data() + (i - 1) * k, base.data(), n.data(), k, nInv, t.data());
+	}
+
+	// Scan the exponent from the top, squaring for each bit, and multiplying by an odd power for each window that ends with a one
+	bool bStarted = false;
+	int i = (int)nBits - 1;
+	while(i >= 0)
+	{
+		if(!pK->getBit(i))
+		{
+			if(bStarted)
+				GBigInt_montMul(x.data(), x.data(), x.data(), n.data(), k, nInv, t.data());
+			i--;
+			continue;
+		}
+		int j = std::max(0, i - (int)nWindow + 1);
+		while(!pK->getBit(j))
+			j++;
+		size_t nVal = 0;
+		for(int m = i; m >= j; m--)
+			nVal = (nVal << 1) | (pK->getBit(m) ? 1 : 0);
+		const uint64_t* pPower = oddPowers.data() + (nVal >> 1) * k;
+		if(bStarted)
+		{
+			for(int m = i; m >= j; m--)
+				GBigInt_montMul(x.data(), x.data(), x.data(), n.data(), k, nInv, t.data());
+			GBigInt_montMul(x.data(), x.data(), pPower, n.data(), k, nInv, t.data());
+		}
+		else
+		{
+			std::copy(pPower, pPower + k, x.begin());
+			bStarted = true;
+		}
+		i = j - 1;
+	}
+
+	// Convert back from Montgomery form
+	std::fill(base.begin(), base.end(), 0);
+	base[0] = 1;
+	GBigInt_montMul(x.data(), x.data(), base.data(), n.data(), k, nInv, t.data());
+	setLimbs(x.data(), k);
+	m_bSign = true;
+}
+
 // Input:  n>=3, a where 2<=a<n
 // Output: "true" if this is either prime or a strong pseudoprime to base a,
 //		   "false" otherwise
@@ -857,7 +1160,7 @@ bool GBigInt::millerRabin(GBigInt* pA)
 	GBigInt s;
 	while(!m.getBit(0))
 	{
-		m.shiftRightBits(1);
+		m.shiftRight(1);
 		s.increment();
 	}
 	GBigInt b;
@@ -937,5 +1240,216 @@ bool GBigInt::isPrime()
 	return true;
 }
 
-} // namespace GClasses
 
+
+// Computes (a^k)%n by squaring and multiplying, and dividing by n after each product, as powerMod used to do
+void GBigInt_powerModReference(GBigInt* pOut, GBigInt* pA, GBigInt* pK, GBigInt* pN)
+{
+	GBigInt k;
+	k.copy(pK);
+	GBigInt c;
+	c.copy(pA);
+	GBigInt b;
+	b.increment();
+	GBigInt p;
+	GBigInt q;
+	while(!k.isZero())
+	{
+		if(k.getBit(0))
+		{
+			k.decrement();
+			p.multiply(&b, &c);
+			q.divide(&p, pN, &b);
+		}
+		p.multiply(&c, &c);
+		q.divide(&p, pN, &c);
+		k.shiftRight(1);
+	}
+	pOut->copy(&b);
+}
+
+// Fills n limbs with random values, favoring values that cause a lot of carries and borrows
+void GBigInt_randomLimbs(GRand& rand, uint64_t* pLimbs, size_t n)
+{
+	size_t mode = (size_t)rand.next(3);
+	for(size_t i = 0; i < n; i++)
+	{
+		if(mode == 0)
+			pLimbs[i] = rand.next();
+		else if(mode == 1)
+			pLimbs[i] = ~(uint64_t)0;
+		else
+			pLimbs[i] = (rand.next(2) == 0 ? 0 : ~(uint64_t)0);
+	}
+}
+
+void GBigInt_randomNumber(GRand& rand, GBigInt& x, unsigned int nUInts)
+{
+	x.setToZero();
+	for(unsigned int i = 0; i < nUInts; i++)
+		x.setUInt(i, (rand.next(4) == 0 ? 0xffffffff : (unsigned int)rand.next()));
+	x.setUInt(nUInts - 1, (unsigned int)rand.next() | 1);
+}
+
+void GBigInt_testSpeed()
+{
+	// Compare the speed of powerMod with the way it used to work. (Be sure to build optimized, or else the results aren't very meaningful.)
+	GRand rand(0);
+	GBigInt a, k, n, r1, r2;
+	GBigInt_randomNumber(rand, a, 64);
+	GBigInt_randomNumber(rand, k, 64);
+	GBigInt_randomNumber(rand, n, 64);
+	n.setBit(0, true);
+	double t1 = GTime::seconds();
+	for(size_t i = 0; i < 10; i++)
+		GBigInt_powerModReference(&r1, &a, &k, &n);
+	double t2 = GTime::seconds();
+	for(size_t i = 0; i < 10; i++)
+		r2.powerMod(&a, &k, &n);
+	double t3 = GTime::seconds();
+	if(t3 - t2 > t2 - t1)
+		throw Ex("Montgomery multiplication is slower than division");
+
+	// Compare the speed of Karatsuba and schoolbook multiplication
+	size_t limbs = 256;
+	vector<uint64_t> x(limbs);
+	vector<uint64_t> y(limbs);
+	vector<uint64_t> prod(2 * limbs);
+	GBigInt_randomLimbs(rand, x.data(), limbs);
+	GBigInt_randomLimbs(rand, y.data(), limbs);
+	t1 = GTime::seconds();
+	for(size_t i = 0; i < 100; i++)
+		GBigInt_mulSchoolbook(prod.data(), x.data(), limbs, y.data(), limbs);
+	t2 = GTime::seconds();
+	for(size_t i = 0; i < 100; i++)
+		GBigInt_mul(prod.data(), x.data(), limbs, y.data(), limbs);
+	t3 = GTime::seconds();
+	if(t3 - t2 > t2 - t1)
+		throw Ex("Karatsuba multiplication is slower than schoolbook multiplication");
+}
+
+// static
+void GBigInt::test()
+{
+	GRand rand(0);
+
+	// Karatsuba multiplication should agree with schoolbook multiplication
+	size_t sizes[] = { 1, 7, 31, 32, 33, 64, 95, 130 };
+	for(size_t i = 0; i < sizeof(sizes) / sizeof(size_t); i++)
+	{
+		for(size_t j = 0; j <= i; j++)
+		{
+			size_t an = sizes[i];
+			size_t bn = sizes[j];
+			vector<uint64_t> a(an);
+			vector<uint64_t> b(bn);
+			vector<uint64_t> p1(an + bn);
+			vector<uint64_t> p2(an + bn);
+			GBigInt_randomLimbs(rand, a.data(), an);
+			GBigInt_randomLimbs(rand, b.data(), bn);
+			GBigInt_mulSchoolbook(p1.data(), a.data(), an, b.data(), bn);
+			GBigInt_mul(p2.data(), a.data(), an, b.data(), bn);
+			if(p1 != p2)
+				throw Ex("Karatsuba multiplication failed");
+		}
+	}
+
+	// Division should produce a quotient and remainder that reconstruct the numerator
+	GBigInt num, den, quot, rem, tmp;
+	for(size_t i = 0; i < 200; i++)
+	{
+		GBigInt_randomNumber(rand, num, 1 + (unsigned int)rand.next(40));
+		GBigInt_randomNumber(rand, den, 1 + (unsigned int)rand.next(20));
+		den.shiftRight((unsigned int)rand.next(32));
+		if(den.isZero())
+			den.increment();
+		quot.divide(&num, &den, &rem);
+		if(rem.compareTo(&den) >= 0)
+			throw Ex("The remainder is too big");
+		tmp.multiply(&quot, &den);
+		tmp.add(&rem);
+		if(tmp.compareTo(&num) != 0)
+			throw Ex("Division failed");
+	}
+
+	// Shifting should agree with multiplication and division by powers of two
+	GBigInt_randomNumber(rand, num, 5);
+	GBigInt pow;
+	pow.setBit(77, true);
+	tmp.copy(&num);
+	tmp.shiftLeft(77);
+	quot.multiply(&num, &pow);
+	if(tmp.compareTo(&quot) != 0)
+		throw Ex("shiftLeft failed");
+	tmp.shiftRight(77);
+	if(tmp.compareTo(&num) != 0)
+		throw Ex("shiftRight failed");
+
+	// Signed arithmetic
+	GBigInt a, b;
+	a.setUInt(0, 5);
+	b.setUInt(0, 7);
+	a.subtract(&b);
+	tmp.setToZero();
+	tmp.setUInt(0, 2);
+	tmp.negate();
+	if(a.compareTo(&tmp) != 0)
+		throw Ex("subtract failed");
+	a.add(&b);
+	b.setUInt(0, 5);
+	if(a.compareTo(&b) != 0)
+		throw Ex("add failed");
+
+	// Hex and serialization should round-trip
+	GBigInt_randomNumber(rand, num, 9);
+	char szHex[128];
+	if(!num.toHex(szHex, 128))
+		throw Ex("toHex failed");
+	tmp.fromHex(szHex);
+	if(tmp.compareTo(&num) != 0)
+		throw Ex("hex round-trip failed");
+	num.negate();
+	GDom doc;
+	GBigInt deserialized(num.serialize(&doc));
+	if(deserialized.compareTo(&num) != 0)
+		throw Ex("serialization round-trip failed");
+
+	// Montgomery exponentiation should agree with repeated division
+	GBigInt k, n, r1, r2;
+	for(size_t i = 0; i < 30; i++)
+	{
+		GBigInt_randomNumber(rand, n, 1 + (unsigned int)rand.next(12));
+		n.setBit(0, i % 3 != 0);
+		if(n.getBitCount() < 2)
+			n.setBit(1, true);
+		GBigInt_randomNumber(rand, a, 1 + (unsigned int)rand.next(12));
+		GBigInt_randomNumber(rand, k, 1 + (unsigned int)rand.next(12));
+		r1.powerMod(&a, &k, &n);
+		GBigInt_powerModReference(&r2, &a, &k, &n);
+		if(r1.compareTo(&r2) != 0)
+			throw Ex("powerMod failed");
+	}
+
+	// Fermat's little theorem holds for the Mersenne prime 2^521 - 1
+	n.setToZero();
+	n.setBit(521, true);
+	n.decrement();
+	k.copy(&n);
+	k.decrement();
+	GBigInt_randomNumber(rand, a, 10);
+	r1.powerMod(&a, &k, &n);
+	b.setToZero();
+	b.increment();
+	if(r1.compareTo(&b) != 0)
+		throw Ex("powerMod failed");
+	if(!n.isPrime())
+		throw Ex("isPrime failed");
+	n.add(&b);
+	n.add(&b);
+	if(n.isPrime())
+		throw Ex("isPrime failed");
+
+	//GBigInt_testSpeed();
+}
+
+} // namespace GClasses
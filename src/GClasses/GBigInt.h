@@ -20,6 +20,9 @@
 #ifndef __GBIGINT_H__
 #define __GBIGINT_H__
 
+#include <stdint.h>
+#include <stddef.h>
+
 namespace GClasses {
 
 class GKeyPair;
@@ -29,16 +32,22 @@ class GDom;
 /// Represents an integer of arbitrary size, and provides basic
 /// arithmetic functionality. Also contains functionality for
 /// implementing RSA symmetric-key cryptography.
+/// The magnitude is stored in 64-bit limbs. Products use 128-bit intermediate values,
+/// large products use Karatsuba multiplication, division uses Knuth's long division
+/// algorithm, and powerMod uses Montgomery multiplication with a sliding window.
+/// (The methods that get or set unsigned ints still work with 32-bit pieces of the number.)
 class GBigInt
 {
 protected:
 	enum
 	{
 		BITS_PER_INT = sizeof(unsigned int) * 8,
+		BITS_PER_LIMB = 64,
+		UINTS_PER_LIMB = BITS_PER_LIMB / BITS_PER_INT,
 	};
-	
-	unsigned int m_nUInts;
-	unsigned int* m_pBits;
+
+	unsigned int m_nLimbs;
+	uint64_t* m_pLimbs;
 	bool m_bSign;
 
 public:
@@ -61,17 +70,20 @@ public:
 	/// Returns the value of the nth bit where 0 represents the least significant bit (little endian)
 	bool getBit(unsigned int n)
 	{
-		return((n >= m_nUInts * BITS_PER_INT) ? false : ((m_pBits[n / BITS_PER_INT] & (1 << (n % BITS_PER_INT))) ? true : false));
+		return((n >= m_nLimbs * BITS_PER_LIMB) ? false : (((m_pLimbs[n / BITS_PER_LIMB] >> (n % BITS_PER_LIMB)) & 1) ? true : false));
 	}
 
 	/// Sets the value of the nth bit where 0 represents the least significant bit (little endian)
 	void setBit(unsigned int nPos, bool bVal);
 
 	/// Returns the number of unsigned integers required to represent this number
-	unsigned int getUIntCount() { return m_nUInts; }
+	unsigned int getUIntCount() { return m_nLimbs * UINTS_PER_LIMB; }
 
 	/// Returns the nth unsigned integer used to represent this number
-	unsigned int getUInt(unsigned int nPos) { return nPos >= m_nUInts ? 0 : m_pBits[nPos]; }
+	unsigned int getUInt(unsigned int nPos)
+	{
+		return nPos >= getUIntCount() ? 0 : (unsigned int)(m_pLimbs[nPos / UINTS_PER_LIMB] >> (BITS_PER_INT * (nPos % UINTS_PER_LIMB)));
+	}
 
 	/// Sets the value of the nth unsigned integer used to represent this number
 	void setUInt(unsigned int nPos, unsigned int nVal);
@@ -155,6 +167,7 @@ public:
 
 	/// Input:  a, k>=0, n>=2
 	/// Output: this will be set to ((a raised to the power of k) modulus n)
+	/// If n is odd, this uses Montgomery multiplication, which avoids dividing at each step.
 	void powerMod(GBigInt* pA, GBigInt* pK, GBigInt* pN);
 
 	/// Input:  "this" must be >= 3, and 2 <= a < "this"
@@ -181,12 +194,23 @@ public:
 	/// DO NOT use for crypto--This is NOT a cryptographic random number generator
 	void setRandom(unsigned int nBits);
 
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
 protected:
 	void resize(unsigned int nBits);
-	void shiftLeftBits(unsigned int nBits);
-	void shiftRightBits(unsigned int nBits);
-	void shiftLeftUInts(unsigned int nBits);
-	void shiftRightUInts(unsigned int nBits);
+
+	/// Returns the number of limbs, not counting leading zeros
+	unsigned int usedLimbs() const;
+
+	/// Replaces the magnitude with the specified limbs. (The sign is not changed.)
+	void setLimbs(const uint64_t* pLimbs, size_t nLimbs);
+
+	/// Adds the magnitude of pBigNumber to this if bSign is true, or subtracts it if bSign is false
+	void addSigned(GBigInt* pBigNumber, bool bSign);
+
+	/// Computes this = (a^k)%n with Montgomery multiplication. n must be odd.
+	void powerModMontgomery(GBigInt* pA, GBigInt* pK, GBigInt* pN);
 };
 
 } // namespace GClasses
@@ -0,0 +1,635 @@
+/*
+  The contents of this file are dedicated by all of its authors, including
+
+    Michael S. Gashler,
+    anonymous contributors,
+
+  to the public domain (http://creativecommons.org/publicdomain/zero/1.0/).
+
+  Note that some moral obligations still exist in the absence of legal ones.
+  For example, it would still be dishonest to deliberately misrepresent the
+  origin of a work. Although we impose no legal requirements to obtain a
+  license, it is beseeming for those who build on the works of others to
+  give back useful improvements, or find a way to pay it forward. If
+  you would like to cite us, a published paper about Waffles can be found
+  at http://jmlr.org/papers/volume12/gashler11a/gashler11a.pdf. If you find
+  our code to be useful, the Waffles team would love to hear how you use it.
+*/
+
+#include "GDataPipeline.h"
+#include "GError.h"
+#include "GFile.h"
+#include "GHolders.h"
+#include "GNeuralNet.h"
+#include "GOptimizer.h"
+#include "GRand.h"
+#include <memory>
+
+namespace GClasses {
+
+using std::string;
+using std::vector;
+
+#define SLOT_FREE 0
+#define SLOT_READY 1
+#define SLOT_HELD 2
+
+
+GMatrixDataSource::GMatrixDataSource(const GMatrix& features, const GMatrix& labels, size_t chunkRows)
+: GDataSource(), m_features(features), m_labels(labels), m_chunkRows(chunkRows), m_pos(0)
+{
+	if(features.rows() != labels.rows())
+		throw Ex("Expected the features and labels to have the same number of rows");
+	if(chunkRows < 1)
+		throw Ex("chunkRows must be at least 1");
+}
+
+// virtual
+bool GMatrixDataSource::nextChunk(GMatrix& features, GMatrix& labels)
+{
+	if(m_pos >= m_features.rows())
+		return false;
+	size_t n = std::min(m_chunkRows, m_features.rows() - m_pos);
+	features.copy(m_features, m_pos, 0, n);
+	labels.copy(m_labels, m_pos, 0, n);
+	m_pos += n;
+	return true;
+}
+
+
+
+
+GFileDataSource::GFileDataSource(const vector<string>& filenames, size_t labelDims)
+: GDataSource(), m_filenames(filenames), m_labelDims(labelDims), m_featureDims(INVALID_INDEX), m_pos(0)
+{
+	if(filenames.size() < 1)
+		throw Ex("Expected at least one filename");
+}
+
+// virtual
+size_t GFileDataSource::featureDims()
+{
+	if(m_featureDims == INVALID_INDEX)
+	{
+		GMatrix m;
+		m.load(m_filenames[0].c_str());
+		if(m.cols() <= m_labelDims)
+			throw Ex("Expected ", m_filenames[0], " to have more than ", to_str(m_labelDims), " columns");
+		m_featureDims = m.cols() - m_labelDims;
+	}
+	return m_featureDims;
+}
+
+// virtual
+bool GFileDataSource::nextChunk(GMatrix& features, GMatrix& labels)
+{
+	if(m_pos >= m_filenames.size())
+		return false;
+	GMatrix m;
+	m.load(m_filenames[m_pos].c_str());
+	if(m.cols() <= m_labelDims)
+		throw Ex("Expected ", m_filenames[m_pos], " to have more than ", to_str(m_labelDims), " columns");
+	size_t featDims = m.cols() - m_labelDims;
+	if(m_featureDims == INVALID_INDEX)
+		m_featureDims = featDims;
+	else if(featDims != m_featureDims)
+		throw Ex("Expected ", m_filenames[m_pos], " to have ", to_str(m_featureDims + m_labelDims), " columns. Got ", to_str(m.cols()));
+	features.copyCols(m, 0, featDims);
+	labels.copyCols(m, featDims, m_labelDims);
+	m_pos++;
+	return true;
+}
+
+
+
+
+/// Loads chunks from the source into the pipeline's queue.
+class GDataPipelineReader : public GThread
+{
+protected:
+	GDataPipeline& m_pipeline;
+
+public:
+	GDataPipelineReader(GDataPipeline& pipeline)
+	: GThread(), m_pipeline(pipeline)
+	{
+	}
+
+	virtual ~GDataPipelineReader()
+	{
+	}
+
+	virtual void run()
+	{
+		GDataPipeline& p = m_pipeline;
+		try
+		{
+			for(size_t epoch = 0; epoch < p.m_epochs && !p.m_stop; epoch++)
+			{
+				if(epoch > 0)
+					p.m_pSource->rewind();
+				while(!p.m_stop)
+				{
+					// Wait for room in the queue
+					while(!p.m_stop)
+					{
+						size_t queued;
+						{
+							GSpinLockHolder lockHolder(&p.m_lock, "GDataPipelineReader::run");
+							queued = p.m_chunks.size() / 2;
+						}
+						if(queued < p.m_prefetchChunks)
+							break;
+						GThread::sleep(1);
+					}
+
+					// Load a chunk
+					std::unique_ptr<GMatrix> hFeatures(new GMatrix());
+					std::unique_ptr<GMatrix> hLabels(new GMatrix());
+					if(!p.m_pSource->nextChunk(*hFeatures, *hLabels))
+						break;
+					if(hFeatures->cols() != p.m_batches[0].features.cols() || hLabels->cols() != p.m_batches[0].labels.cols())
+						throw Ex("The data source delivered a chunk with an unexpected number of columns");
+					if(hFeatures->rows() != hLabels->rows())
+						throw Ex("The data source delivered a chunk with mismatching features and labels");
+					GSpinLockHolder lockHolder(&p.m_lock, "GDataPipelineReader::run");
+					p.m_chunks.push_back(hFeatures.release());
+					p.m_chunks.push_back(hLabels.release());
+				}
+
+				// Mark the end of the pass
+				GSpinLockHolder lockHolder(&p.m_lock, "GDataPipelineReader::run");
+				p.m_chunks.push_back(nullptr);
+				p.m_chunks.push_back(nullptr);
+			}
+		}
+		catch(const std::exception& e)
+		{
+			p.fail(e.what());
+		}
+		GSpinLockHolder lockHolder(&p.m_lock, "GDataPipelineReader::run");
+		p.m_readerDone = true;
+	}
+};
+
+
+
+
+/// Applies the pipeline's stages to the rows of a minibatch. Each job is one row.
+class GDataPipelineWorker : public GWorkerThread
+{
+protected:
+	const vector<GDataPipelineStage*>& m_stages;
+	GDataBatch*& m_pBatch;
+	size_t& m_seed;
+	string& m_error;
+
+public:
+	GDataPipelineWorker(GMasterThread& master, const vector<GDataPipelineStage*>& stages, GDataBatch*& pBatch, size_t& seed, string& error)
+	: GWorkerThread(master), m_stages(stages), m_pBatch(pBatch), m_seed(seed), m_error(error)
+	{
+	}
+
+	virtual ~GDataPipelineWorker()
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		try
+		{
+			GRand rand(m_seed + jobId);
+			for(size_t i = 0; i < m_stages.size(); i++)
+				m_stages[i]->process(m_pBatch->features[jobId], m_pBatch->labels[jobId], rand);
+		}
+		catch(const std::exception& e)
+		{
+			GSpinLockHolder lockHolder(m_master.getLock(), "GDataPipelineWorker::doJob");
+			m_error = e.what();
+		}
+	}
+};
+
+
+
+
+/// Moves rows from the queue into the shuffle buffer, and draws transformed minibatches from it.
+class GDataPipelineProducer : public GThread
+{
+protected:
+	GDataPipeline& m_pipeline;
+	GRand m_rand;
+	GMatrix m_features; // The shuffle buffer
+	GMatrix m_labels;
+	size_t m_count; // The number of rows in the shuffle buffer
+	GMatrix* m_pChunkFeatures;
+	GMatrix* m_pChunkLabels;
+	size_t m_chunkPos;
+	GDataBatch* m_pBatch;
+	size_t m_seed;
+	string m_workerError;
+
+public:
+	GDataPipelineProducer(GDataPipeline& pipeline, size_t seed)
+	: GThread(), m_pipeline(pipeline), m_rand(seed), m_features(pipeline.m_shuffleRows, pipeline.m_batches[0].features.cols()), m_labels(pipeline.m_shuffleRows, pipeline.m_batches[0].labels.cols()), m_count(0), m_pChunkFeatures(nullptr), m_pChunkLabels(nullptr), m_chunkPos(0), m_pBatch(nullptr), m_seed(0)
+	{
+	}
+
+	virtual ~GDataPipelineProducer()
+	{
+		delete(m_pChunkFeatures);
+		delete(m_pChunkLabels);
+	}
+
+	virtual void run()
+	{
+		GDataPipeline& p = m_pipeline;
+		try
+		{
+			GMasterThread master;
+			for(size_t i = 0; i < std::max((size_t)1, p.m_workerThreads); i++)
+				master.addWorker(new GDataPipelineWorker(master, p.m_stages, m_pBatch, m_seed, m_workerError));
+			size_t slot = 0;
+			bool endOfPass = false;
+			bool endOfData = false;
+			while(!p.m_stop)
+			{
+				// Fill the shuffle buffer
+				// (If the current chunk runs out just as the buffer fills, keep pulling from the queue so that an end-of-pass
+				// marker is noticed before the last rows of the pass are drawn.)
+				while(!endOfPass && !p.m_stop)
+				{
+					if(m_pChunkFeatures && m_chunkPos < m_pChunkFeatures->rows())
+					{
+						if(m_count >= m_features.rows())
+							break;
+						m_features[m_count].swapContents((*m_pChunkFeatures)[m_chunkPos]);
+						m_labels[m_count].swapContents((*m_pChunkLabels)[m_chunkPos]);
+						m_count++;
+						m_chunkPos++;
+						continue;
+					}
+					if(!nextChunk(endOfPass, endOfData))
+						GThread::sleep(0);
+				}
+				if(m_count == 0)
+				{
+					if(endOfData)
+						break;
+					endOfPass = false; // An empty pass
+					continue;
+				}
+
+				// Wait for the consumer to release this slot
+				while(p.m_slotState[slot] != SLOT_FREE && !p.m_stop)
+					GThread::sleep(0);
+				if(p.m_stop)
+					break;
+
+				// Draw a random minibatch from the shuffle buffer
+				GDataBatch& batch = p.m_batches[slot];
+				size_t n = std::min(p.m_batchSize, m_count);
+				for(size_t i = 0; i < n; i++)
+				{
+					size_t index = (size_t)m_rand.next(m_count);
+					batch.features[i].swapContents(m_features[index]);
+					batch.labels[i].swapContents(m_labels[index]);
+					m_count--;
+					m_features[index].swapContents(m_features[m_count]);
+					m_labels[index].swapContents(m_labels[m_count]);
+				}
+				batch.rows = n;
+
+				// Apply the stages
+				if(p.m_stages.size() > 0)
+				{
+					m_pBatch = &batch;
+					m_seed = (size_t)m_rand.next();
+					master.doJobs(n);
+					if(m_workerError.length() > 0)
+						throw Ex(m_workerError);
+				}
+
+				// Hand it to the consumer
+				bool endsPass = endOfPass && m_count == 0;
+				if(endsPass)
+					endOfPass = false;
+				GSpinLockHolder lockHolder(&p.m_lock, "GDataPipelineProducer::run");
+				p.m_slotEndsEpoch[slot] = endsPass;
+				p.m_slotState[slot] = SLOT_READY;
+				slot ^= 1;
+			}
+		}
+		catch(const std::exception& e)
+		{
+			p.fail(e.what());
+		}
+		GSpinLockHolder lockHolder(&p.m_lock, "GDataPipelineProducer::run");
+		p.m_producerDone = true;
+	}
+
+protected:
+	/// Takes the next chunk from the queue. Returns false if the queue is empty.
+	bool nextChunk(bool& endOfPass, bool& endOfData)
+	{
+		GDataPipeline& p = m_pipeline;
+		GSpinLockHolder lockHolder(&p.m_lock, "GDataPipelineProducer::nextChunk");
+		if(p.m_chunks.size() == 0)
+		{
+			if(p.m_readerDone)
+			{
+				endOfPass = true;
+				endOfData = true;
+				return true;
+			}
+			return false;
+		}
+		delete(m_pChunkFeatures);
+		delete(m_pChunkLabels);
+		m_pChunkFeatures = p.m_chunks.front();
+		p.m_chunks.pop_front();
+		m_pChunkLabels = p.m_chunks.front();
+		p.m_chunks.pop_front();
+		m_chunkPos = 0;
+		if(!m_pChunkFeatures)
+			endOfPass = true;
+		return true;
+	}
+};
+
+
+
+
+GDataPipeline::GDataPipeline(GDataSource* pSource, GRand& rand, size_t batchSize, size_t shuffleRows)
+: m_pSource(pSource),
+m_rand(rand),
+m_batchSize(batchSize),
+m_shuffleRows(shuffleRows),
+m_epochs(1),
+m_prefetchChunks(2),
+m_workerThreads(1),
+m_readerDone(false),
+m_producerDone(false),
+m_stop(false),
+m_failed(false),
+m_nextSlot(0),
+m_heldSlot(INVALID_INDEX),
+m_epoch(0),
+m_pReader(nullptr),
+m_pProducer(nullptr)
+{
+	if(batchSize < 1)
+		throw Ex("batchSize must be at least 1");
+	if(shuffleRows < batchSize)
+		throw Ex("shuffleRows must be at least batchSize");
+	m_slotState[0] = SLOT_FREE;
+	m_slotState[1] = SLOT_FREE;
+	m_slotEndsEpoch[0] = false;
+	m_slotEndsEpoch[1] = false;
+}
+
+GDataPipeline::~GDataPipeline()
+{
+	stop();
+	for(size_t i = 0; i < m_stages.size(); i++)
+		delete(m_stages[i]);
+	delete(m_pSource);
+}
+
+void GDataPipeline::addStage(GDataPipelineStage* pStage)
+{
+	if(m_pProducer)
+		throw Ex("Stages must be added before the first call to nextBatch");
+	m_stages.push_back(pStage);
+}
+
+void GDataPipeline::start()
+{
+	size_t featDims = m_pSource->featureDims();
+	size_t labDims = m_pSource->labelDims();
+	for(size_t i = 0; i < 2; i++)
+	{
+		m_batches[i].features.resize(m_batchSize, featDims);
+		m_batches[i].labels.resize(m_batchSize, labDims);
+	}
+	m_pSource->rewind();
+	m_pReader = new GDataPipelineReader(*this);
+	m_pProducer = new GDataPipelineProducer(*this, (size_t)m_rand.next());
+	m_pReader->spawn();
+	m_pProducer->spawn();
+}
+
+void GDataPipeline::stop()
+{
+	m_stop = true;
+	if(m_pProducer)
+	{
+		m_pProducer->join();
+		delete(m_pProducer);
+		m_pProducer = nullptr;
+	}
+	if(m_pReader)
+	{
+		m_pReader->join();
+		delete(m_pReader);
+		m_pReader = nullptr;
+	}
+	while(m_chunks.size() > 0)
+	{
+		delete(m_chunks.front());
+		m_chunks.pop_front();
+	}
+}
+
+void GDataPipeline::fail(const char* szMessage)
+{
+	GSpinLockHolder lockHolder(&m_lock, "GDataPipeline::fail");
+	if(!m_failed)
+		m_error = szMessage;
+	m_failed = true;
+}
+
+const GDataBatch* GDataPipeline::nextBatch()
+{
+	if(!m_pProducer)
+	{
+		if(m_stop)
+			return nullptr;
+		start();
+	}
+
+	// Give the previous batch back to the producer
+	if(m_heldSlot != INVALID_INDEX)
+	{
+		GSpinLockHolder lockHolder(&m_lock, "GDataPipeline::nextBatch");
+		m_slotState[m_heldSlot] = SLOT_FREE;
+		m_heldSlot = INVALID_INDEX;
+	}
+
+	// Wait for the next one
+	while(true)
+	{
+		if(m_failed)
+		{
+			stop();
+			throw Ex("The data pipeline failed: ", m_error);
+		}
+		bool done = m_producerDone;
+		if(m_slotState[m_nextSlot] == SLOT_READY)
+			break;
+		if(done)
+			return nullptr;
+		GThread::sleep(0);
+	}
+	GSpinLockHolder lockHolder(&m_lock, "GDataPipeline::nextBatch");
+	m_heldSlot = m_nextSlot;
+	m_slotState[m_heldSlot] = SLOT_HELD;
+	m_nextSlot ^= 1;
+	if(m_slotEndsEpoch[m_heldSlot])
+		m_epoch++;
+	return &m_batches[m_heldSlot];
+}
+
+#ifndef MIN_PREDICT
+class GDataPipelineTestStage : public GDataPipelineStage
+{
+public:
+	virtual void process(GVec& features, GVec& labels, GRand& rand) const override
+	{
+		features[0] += 1000.0;
+		features[1] = rand.uniform();
+	}
+};
+
+void GDataPipeline_checkEpochs(GMatrix& features, GMatrix& labels, GDataSource* pSource, size_t epochs, size_t workers, GMatrix& seen)
+{
+	GRand rand(1234);
+	GDataPipeline pipeline(pSource, rand, 32, 200);
+	pipeline.setEpochs(epochs);
+	pipeline.setWorkerThreads(workers);
+	pipeline.addStage(new GDataPipelineTestStage());
+	vector<size_t> counts(features.rows() * epochs, 0);
+	size_t inOrder = 0;
+	size_t pos = 0;
+	seen.resize(0, 2);
+	while(true)
+	{
+		size_t epoch = pipeline.epoch();
+		const GDataBatch* pBatch = pipeline.nextBatch();
+		if(!pBatch)
+			break;
+		if(pBatch->rows < 1 || pBatch->rows > 32)
+			throw Ex("bad batch size");
+		for(size_t i = 0; i < pBatch->rows; i++)
+		{
+			const GVec& f = pBatch->features[i];
+			size_t index = (size_t)(f[0] - 1000.0);
+			if(f[0] < 1000.0 || index >= features.rows())
+				throw Ex("stage not applied");
+			if(pBatch->labels[i][0] != 2.0 * features[index][0])
+				throw Ex("features and labels got separated");
+			counts[epoch * features.rows() + index]++;
+			if(index == pos % features.rows())
+				inOrder++;
+			pos++;
+			GVec& r = seen.newRow();
+			r[0] = f[0];
+			r[1] = f[1];
+		}
+	}
+	if(pipeline.epoch() != epochs)
+		throw Ex("wrong number of epochs");
+	for(size_t i = 0; i < counts.size(); i++)
+	{
+		if(counts[i] != 1)
+			throw Ex("Each row should be delivered exactly once per epoch");
+	}
+	if(inOrder * 10 > pos)
+		throw Ex("not shuffled");
+}
+
+// static
+void GDataPipeline::test()
+{
+	// Stream an in-memory dataset
+	GMatrix features(1000, 2);
+	GMatrix labels(1000, 1);
+	for(size_t i = 0; i < features.rows(); i++)
+	{
+		features[i][0] = (double)i;
+		features[i][1] = 0.0;
+		labels[i][0] = 2.0 * i;
+	}
+	GMatrix seen1;
+	GDataPipeline_checkEpochs(features, labels, new GMatrixDataSource(features, labels, 64), 2, 3, seen1);
+
+	// The order and the augmentation should not depend on the number of workers
+	GMatrix seen2;
+	GDataPipeline_checkEpochs(features, labels, new GMatrixDataSource(features, labels, 64), 2, 1, seen2);
+	if(seen1.rows() != seen2.rows())
+		throw Ex("wrong number of rows");
+	for(size_t i = 0; i < seen1.rows(); i++)
+	{
+		if(seen1[i][0] != seen2[i][0] || seen1[i][1] != seen2[i][1])
+			throw Ex("not deterministic");
+	}
+
+	// Stream the same data from files
+	vector<string> filenames;
+	for(size_t i = 0; i < 3; i++)
+	{
+		char buf[256];
+		GFile::tempFilename(buf);
+		string filename = buf;
+		filename += ".arff";
+		size_t start = i * 400;
+		size_t n = std::min((size_t)400, features.rows() - start);
+		GMatrix m(n, 3);
+		for(size_t j = 0; j < n; j++)
+		{
+			m[j][0] = features[start + j][0];
+			m[j][1] = features[start + j][1];
+			m[j][2] = labels[start + j][0];
+		}
+		m.saveArff(filename.c_str());
+		filenames.push_back(filename);
+	}
+	try
+	{
+		GMatrix seen3;
+		GDataPipeline_checkEpochs(features, labels, new GFileDataSource(filenames, 1), 2, 2, seen3);
+	}
+	catch(...)
+	{
+		for(size_t i = 0; i < filenames.size(); i++)
+			GFile::deleteFile(filenames[i].c_str());
+		throw;
+	}
+	for(size_t i = 0; i < filenames.size(); i++)
+		GFile::deleteFile(filenames[i].c_str());
+
+	// Train a neural network from the pipeline
+	GRand rand(0);
+	GMatrix x(500, 2);
+	GMatrix y(500, 1);
+	for(size_t i = 0; i < x.rows(); i++)
+	{
+		x[i][0] = rand.uniform();
+		x[i][1] = rand.uniform();
+		y[i][0] = 0.3 * x[i][0] - 0.2 * x[i][1] + 0.1;
+	}
+	GNeuralNet nn;
+	nn.add(new GBlockLinear(2, 1));
+	GSGDOptimizer optimizer(nn, rand);
+	optimizer.setLearningRate(0.1);
+	double before = nn.measureLoss(x, y);
+	GDataPipeline pipeline(new GMatrixDataSource(x, y, 100), rand, 10, 100);
+	pipeline.setEpochs(20);
+	optimizer.optimize(pipeline);
+	double after = nn.measureLoss(x, y);
+	if(after >= before * 0.1)
+		throw Ex("Training from the pipeline did not reduce the loss. Before: ", to_str(before), ", after: ", to_str(after));
+}
+#endif // MIN_PREDICT
+
+} // namespace GClasses
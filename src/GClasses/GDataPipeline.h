@@ -0,0 +1,228 @@
+/*
+  The contents of this file are dedicated by all of its authors, including
+
+    Michael S. Gashler,
+    anonymous contributors,
+
+  to the public domain (http://creativecommons.org/publicdomain/zero/1.0/).
+
+  Note that some moral obligations still exist in the absence of legal ones.
+  For example, it would still be dishonest to deliberately misrepresent the
+  origin of a work. Although we impose no legal requirements to obtain a
+  license, it is beseeming for those who build on the works of others to
+  give back useful improvements, or find a way to pay it forward. If
+  you would like to cite us, a published paper about Waffles can be found
+  at http://jmlr.org/papers/volume12/gashler11a/gashler11a.pdf. If you find
+  our code to be useful, the Waffles team would love to hear how you use it.
+*/
+
+#ifndef __GDATAPIPELINE_H__
+#define __GDATAPIPELINE_H__
+
+#include "GMatrix.h"
+#include "GThread.h"
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace GClasses {
+
+class GRand;
+class GDataPipelineReader;
+class GDataPipelineProducer;
+
+
+/// An abstract source of training data that is delivered in chunks of rows.
+/// A GDataPipeline pulls chunks from a source in a background thread, so only a few chunks
+/// need to be in memory at any time.
+class GDataSource
+{
+public:
+	GDataSource() {}
+	virtual ~GDataSource() {}
+
+	/// Returns the number of feature columns in each chunk.
+	virtual size_t featureDims() = 0;
+
+	/// Returns the number of label columns in each chunk.
+	virtual size_t labelDims() = 0;
+
+	/// Replaces the contents of features and labels with the next chunk of rows.
+	/// Returns false if there are no more chunks in this pass over the data.
+	virtual bool nextChunk(GMatrix& features, GMatrix& labels) = 0;
+
+	/// Starts a new pass over the data.
+	virtual void rewind() = 0;
+};
+
+
+/// A data source that delivers an in-memory dataset in chunks of rows.
+class GMatrixDataSource : public GDataSource
+{
+protected:
+	const GMatrix& m_features;
+	const GMatrix& m_labels;
+	size_t m_chunkRows;
+	size_t m_pos;
+
+public:
+	/// features and labels must remain valid for the lifetime of this object.
+	GMatrixDataSource(const GMatrix& features, const GMatrix& labels, size_t chunkRows = 1024);
+	virtual ~GMatrixDataSource() {}
+
+	virtual size_t featureDims() override { return m_features.cols(); }
+	virtual size_t labelDims() override { return m_labels.cols(); }
+	virtual bool nextChunk(GMatrix& features, GMatrix& labels) override;
+	virtual void rewind() override { m_pos = 0; }
+};
+
+
+/// A data source that reads a dataset that has been split across several files.
+/// Each file is one chunk. The last labelDims columns of each file are the labels,
+/// and the other columns are the features. The files may be in any format that GMatrix::load supports.
+class GFileDataSource : public GDataSource
+{
+protected:
+	std::vector<std::string> m_filenames;
+	size_t m_labelDims;
+	size_t m_featureDims;
+	size_t m_pos;
+
+public:
+	/// labelDims specifies how many columns at the end of each file are labels.
+	GFileDataSource(const std::vector<std::string>& filenames, size_t labelDims);
+	virtual ~GFileDataSource() {}
+
+	/// Returns the number of feature columns. (This reads the first file.)
+	virtual size_t featureDims() override;
+	virtual size_t labelDims() override { return m_labelDims; }
+	virtual bool nextChunk(GMatrix& features, GMatrix& labels) override;
+	virtual void rewind() override { m_pos = 0; }
+};
+
+
+/// An abstract transformation, such as a data augmentation, that a GDataPipeline applies to
+/// each row before it is delivered. Several worker threads call process at the same time,
+/// so implementations must be thread-safe.
+class GDataPipelineStage
+{
+public:
+	GDataPipelineStage() {}
+	virtual ~GDataPipelineStage() {}
+
+	/// Transforms one row in place. rand is seeded for this row, so results are reproducible
+	/// regardless of which thread processes the row.
+	virtual void process(GVec& features, GVec& labels, GRand& rand) const = 0;
+};
+
+
+/// A minibatch of training data produced by a GDataPipeline.
+class GDataBatch
+{
+public:
+	GMatrix features;
+	GMatrix labels;
+	size_t rows; // The number of valid rows. (The last batch of a pass may be smaller than the others.)
+
+	GDataBatch() : rows(0) {}
+};
+
+
+/// Streams shuffled and transformed minibatches to a consumer, such as GNeuralNetOptimizer::optimize.
+/// A background reader thread pulls chunks from a GDataSource into a small queue. A producer thread
+/// moves those rows into a shuffle buffer, draws random minibatches from it, and has a pool of worker
+/// threads apply each GDataPipelineStage to the rows. Minibatches are double-buffered, so the producer
+/// fills one while the consumer trains on the other. Only the shuffle buffer, two minibatches, and a few
+/// chunks are ever in memory, so datasets much larger than RAM can be streamed from disk. Rows are
+/// shuffled within the shuffle buffer, so a larger buffer gives a more uniform shuffle.
+class GDataPipeline
+{
+friend class GDataPipelineReader;
+friend class GDataPipelineProducer;
+protected:
+	GDataSource* m_pSource;
+	GRand& m_rand;
+	size_t m_batchSize;
+	size_t m_shuffleRows;
+	size_t m_epochs;
+	size_t m_prefetchChunks;
+	size_t m_workerThreads;
+	std::vector<GDataPipelineStage*> m_stages;
+
+	// State shared between threads. Take m_lock before touching any of it.
+	GSpinLock m_lock;
+	std::deque<GMatrix*> m_chunks; // pairs of features and labels. A pair of nullptrs marks the end of a pass.
+	volatile bool m_readerDone;
+	volatile bool m_producerDone;
+	volatile bool m_stop;
+	volatile bool m_failed;
+	volatile int m_slotState[2];
+	bool m_slotEndsEpoch[2];
+	std::string m_error;
+
+	GDataBatch m_batches[2];
+	size_t m_nextSlot;
+	size_t m_heldSlot;
+	size_t m_epoch;
+	GDataPipelineReader* m_pReader;
+	GDataPipelineProducer* m_pProducer;
+
+public:
+	/// Takes ownership of pSource. batchSize is the number of rows in each minibatch.
+	/// shuffleRows is the number of rows held in the shuffle buffer. It must be at least batchSize.
+	GDataPipeline(GDataSource* pSource, GRand& rand, size_t batchSize = 32, size_t shuffleRows = 4096);
+
+	/// Stops the background threads.
+	~GDataPipeline();
+
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
+	/// Adds a stage that will be applied to every row. Takes ownership of pStage.
+	/// Stages must be added before the first call to nextBatch.
+	void addStage(GDataPipelineStage* pStage);
+
+	/// Sets the number of passes over the data. Use INVALID_INDEX to stream forever.
+	void setEpochs(size_t n) { m_epochs = n; }
+
+	/// Returns the number of passes over the data.
+	size_t epochs() const { return m_epochs; }
+
+	/// Sets the maximum number of chunks that the reader will load ahead of the producer.
+	void setPrefetchChunks(size_t n) { m_prefetchChunks = n; }
+
+	/// Specify the number of worker threads to use to apply the stages. The default is 1.
+	void setWorkerThreads(size_t count) { m_workerThreads = count; }
+
+	/// Returns the number of rows in each minibatch.
+	size_t batchSize() const { return m_batchSize; }
+
+	/// Returns the number of feature columns.
+	size_t featureDims() { return m_pSource->featureDims(); }
+
+	/// Returns the number of label columns.
+	size_t labelDims() { return m_pSource->labelDims(); }
+
+	/// Returns the next minibatch, or nullptr if all of the passes have been delivered.
+	/// The background threads are started by the first call. The returned batch remains valid until the next call.
+	/// Each pass over the data ends with a batch that may be partial, so batches never mix rows from two passes.
+	const GDataBatch* nextBatch();
+
+	/// Returns the number of complete passes that have been delivered by nextBatch.
+	size_t epoch() const { return m_epoch; }
+
+protected:
+	/// Starts the background threads.
+	void start();
+
+	/// Stops the background threads and waits for them to exit.
+	void stop();
+
+	/// Records an error raised by a background thread, so that nextBatch can report it.
+	void fail(const char* szMessage);
+};
+
+
+} // namespace GClasses
+
+#endif // __GDATAPIPELINE_H__
@@ -439,37 +439,42 @@ void GDecisionTree::trainInner(const GMatrix& features, const GMatrix& labels)
 	m_pRoot = buildBranch(tmpFeatures, tmpLabels, attrPool, 0/*depth*/, 4/*tolerance*/);
 }
 
-void GDecisionTree::autoTune(GMatrix& features, GMatrix& labels)
+size_t GDecisionTree_autoTuneLeafThresh(size_t index)
 {
-	// Try binary splits
-	m_binaryDivisions = false;
-	double bestErr = crossValidate(features, labels, 2);
-	m_binaryDivisions = true;
-	double d = crossValidate(features, labels, 2);
-	if(d < bestErr)
-		bestErr = d;
-	else
-		m_binaryDivisions = false;
+	size_t t = 1;
+	for(size_t i = 0; i < index; i++)
+		t = std::max(t + 1, size_t(t * 1.5));
+	return t;
+}
+
+// static
+GTransducer* GDecisionTree::autoTuneCandidate(void* pThis, size_t candidate)
+{
+	GDecisionTree* pTuner = (GDecisionTree*)pThis;
+	GDecisionTree* pModel = new GDecisionTree();
+	pModel->m_eAlg = pTuner->m_eAlg;
+	pModel->m_randomDraws = pTuner->m_randomDraws;
+
+	// Candidates alternate between binary and non-binary divisions, and the leaf threshold grows by factors of about 1.5
+	pModel->m_binaryDivisions = (candidate % 2 == 1);
+	pModel->m_leafThresh = GDecisionTree_autoTuneLeafThresh(candidate / 2);
+	return pModel;
+}
 
-	// Find the best leaf threshold
+void GDecisionTree::autoTune(GMatrix& features, GMatrix& labels)
+{
 	size_t cap = size_t(floor(sqrt(double(features.rows()))));
-	size_t bestLeafThresh = 1;
-	for(size_t i = 2; i < cap; i = std::max(i + 1, size_t(i * 1.5)))
-	{
-		m_leafThresh = i;
-		double d2 = crossValidate(features, labels, 2);
-		if(d2 < bestErr)
-		{
-			bestErr = d2;
-			bestLeafThresh = i;
-		}
-		else if(i >= 27)
-			break;
-	}
+	size_t threshValues = 1;
+	while(GDecisionTree_autoTuneLeafThresh(threshValues) < cap)
+		threshValues++;
+	GParallelValidator pv(features, labels, 2, 1, (size_t)m_rand.next());
+	pv.setWorkerThreads(m_autoTuneThreads);
+	size_t best = pv.successiveHalving(autoTuneCandidate, this, 2 * threshValues);
 
 	// Set the best values
 	m_maxLevels = 0;
-	m_leafThresh = bestLeafThresh;
+	m_binaryDivisions = (best % 2 == 1);
+	m_leafThresh = GDecisionTree_autoTuneLeafThresh(best / 2);
 }
 
 double GDecisionTree_measureRealSplitInfo(GMatrix& features, GMatrix& labels, GMatrix& tmpFeatures, GMatrix& tmpLabels, size_t attr, double pivot)
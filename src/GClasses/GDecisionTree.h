@@ -112,7 +112,8 @@ public:
 	void print(std::ostream& stream, GArffRelation* pFeatureRel = NULL, GArffRelation* pLabelRel = NULL);
 
 	/// Uses cross-validation to find a set of parameters that works well with
-	/// the provided data.
+	/// the provided data. The candidate configurations are evaluated in parallel
+	/// (see GTransducer::setAutoTuneThreads) and pruned by successive halving.
 	void autoTune(GMatrix& features, GMatrix& labels);
 
 	/// See the comment for GSupervisedLearner::predict
@@ -122,6 +123,9 @@ public:
 	virtual void predictDistribution(const GVec& pIn, GPrediction* pOut);
 
 protected:
+	/// Makes the specified candidate configuration for autoTune. pThis is the model being tuned.
+	static GTransducer* autoTuneCandidate(void* pThis, size_t candidate);
+
 	/// See the comment for GSupervisedLearner::trainInner
 	virtual void trainInner(const GMatrix& features, const GMatrix& labels);
 
@@ -107,6 +107,23 @@ void GDistanceMetric_exerciseMetric(GDistanceMetric& metric)
 	double sqDist2 = pRoundtripped->squaredDistance(a, b);
 	if(std::abs(sqDist - sqDist2) > 1e-12)
 		throw Ex("failed");
+
+	// Make sure the block of distances agrees with the individual distances
+	GMatrix m(3, 2);
+	m[0].copy(a);
+	m[1].copy(b);
+	m[2][0] = 0.5;
+	m[2][1] = 3.0;
+	GMatrix block;
+	metric.squaredDistanceBlock(m, 1, 2, m, 0, 3, block);
+	for(size_t i = 0; i < 2; i++)
+	{
+		for(size_t j = 0; j < 3; j++)
+		{
+			if(std::abs(block[i][j] - metric.squaredDistance(m[1 + i], m[j])) > 1e-12)
+				throw Ex("failed");
+		}
+	}
 }
 
 // static
@@ -118,6 +135,21 @@ void GDistanceMetric::test()
 	GKernelDistance d4(GKernel::kernelComplex1(), true); GDistanceMetric_exerciseMetric(d4);
 }
 
+// virtual
+void GDistanceMetric::squaredDistanceBlock(const GMatrix& a, size_t aStart, size_t aCount, const GMatrix& b, size_t bStart, size_t bCount, GMatrix& out, size_t workerThreads) const
+{
+	if(aStart + aCount > a.rows() || bStart + bCount > b.rows())
+		throw Ex("Row range out of bounds");
+	out.resize(aCount, bCount);
+	for(size_t i = 0; i < aCount; i++)
+	{
+		GVec& row = out[i];
+		const GVec& aRow = a[aStart + i];
+		for(size_t j = 0; j < bCount; j++)
+			row[j] = squaredDistance(aRow, b[bStart + j]);
+	}
+}
+
 // --------------------------------------------------------------------
 
 GRowDistance::GRowDistance()
@@ -318,6 +350,18 @@ double GKernelDistance::squaredDistance(const GVec& a, const GVec& b) const
 	return 1.0 - m_pKernel->apply(a, b);
 }
 
+// virtual
+void GKernelDistance::squaredDistanceBlock(const GMatrix& a, size_t aStart, size_t aCount, const GMatrix& b, size_t bStart, size_t bCount, GMatrix& out, size_t workerThreads) const
+{
+	m_pKernel->applyBlock(a, aStart, aCount, b, bStart, bCount, out, workerThreads);
+	for(size_t i = 0; i < out.rows(); i++)
+	{
+		GVec& row = out[i];
+		for(size_t j = 0; j < out.cols(); j++)
+			row[j] = 1.0 - row[j];
+	}
+}
+
 // --------------------------------------------------------------------
 
 // static
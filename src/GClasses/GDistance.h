@@ -63,6 +63,12 @@ public:
 	/// Computes the squared distance (or squared dissimilarity) between the two specified vectors
 	virtual double squaredDistance(const GVec& a, const GVec& b) const = 0;
 
+	/// Computes the squared distance between every pair of rows from two matrices. Row i of out is set to the
+	/// squared distances between row aStart + i of a and each of the bCount rows of b that begin with row bStart.
+	/// out is resized to aCount-by-bCount. The default implementation calls squaredDistance for each pair,
+	/// and ignores workerThreads.
+	virtual void squaredDistanceBlock(const GMatrix& a, size_t aStart, size_t aCount, const GMatrix& b, size_t bStart, size_t bCount, GMatrix& out, size_t workerThreads = 1) const;
+
 	/// Return squaredDistance(pA, pB).  Allows dissimilarity metrics to
 	/// be used as function objects.  Do not override.  Override
 	/// squaredDistance(pA,pB) instead.  See GDistanceMetric::squaredDistance(const GVec&, const GVec&)
@@ -210,6 +216,9 @@ public:
 
 	/// Returns the distance (using the norm passed to the constructor) between pA and pB
 	virtual double squaredDistance(const GVec& a, const GVec& b) const;
+
+	/// Computes the block of kernel values with GKernel::applyBlock, and subtracts them from 1.
+	virtual void squaredDistanceBlock(const GMatrix& a, size_t aStart, size_t aCount, const GMatrix& b, size_t bStart, size_t bCount, GMatrix& out, size_t workerThreads = 1) const;
 };
 
 
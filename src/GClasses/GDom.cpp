@@ -23,13 +23,17 @@
 #include "GDom.h"
 #include "GFile.h"
 #include "GHolders.h"
+#include "GRand.h"
 #include <vector>
 #include <deque>
 #include <sstream>
 #include <fstream>
 #include <map>
 #include <errno.h>
-#include "GTokenizer.h"
+#include <cmath>
+#ifdef __SSE2__
+#	include <emmintrin.h>
+#endif
 #include "GString.h"
 
 
@@ -412,57 +416,9 @@ void GDomNode::saveJson(const char* filename) const
 
 void GDomNode::writeJson(std::ostream& stream) const
 {
-	std::ios_base::fmtflags oldflags = stream.flags();
-	stream << std::fixed;
-	switch(m_type)
-	{
-		case type_obj:
-			stream << "{";
-			reverseFieldOrder();
-			for(GDomObjField* pField = m_value.m_pLastField; pField; pField = pField->m_pPrev)
-			{
-				if(pField != m_value.m_pLastField)
-					stream << ",";
-				writeJSONString(stream, pField->m_pName);
-				stream << ":";
-				pField->m_pValue->writeJson(stream);
-			}
-			reverseFieldOrder();
-			stream << "}";
-			break;
-		case type_list:
-			stream << "[";
-			if(m_value.m_pArrayList)
-			{
-				if(m_value.m_pArrayList->m_size > 0)
-					m_value.m_pArrayList->m_items[0]->writeJson(stream);
-				for(size_t i = 1; i < m_value.m_pArrayList->m_size; i++)
-				{
-					stream << ",";
-					m_value.m_pArrayList->m_items[i]->writeJson(stream);
-				}
-			}
-			stream << "]";
-			break;
-		case type_bool:
-			stream << (m_value.m_bool ? "true" : "false");
-			break;
-		case type_int:
-			stream << m_value.m_int;
-			break;
-		case type_double:
-			stream << m_value.m_double;
-			break;
-		case type_string:
-			writeJSONString(stream, m_value.m_string);
-			break;
-		case type_null:
-			stream << "null";
-			break;
-		default:
-			throw Ex("Unrecognized node type");
-	}
-	stream.flags(oldflags);
+	GJsonWriter writer(stream);
+	writer.writeNode(this);
+	writer.flush();
 }
 
 void newLineAndIndent(std::ostream& stream, size_t indents)
@@ -845,7 +801,7 @@ bool GDomNode::isEqual(const GDomNode* pOther) const
 				return false;
 
 		case type_null:
-			if(pOther->m_type != type_bool)
+			if(pOther->m_type != type_null)
 				return false;
 			else
 				return true;
@@ -858,18 +814,6 @@ bool GDomNode::isEqual(const GDomNode* pOther) const
 
 // -------------------------------------------------------------------------------
 
-class GJsonTokenizer : public GTokenizer
-{
-public:
-	GCharSet m_whitespace, m_real, m_quot;
-
-	GJsonTokenizer(const char* szFilename) : GTokenizer(szFilename),
-	m_whitespace("\t\n\r "), m_real("-.+0-9eE"), m_quot("\"") {}
-	GJsonTokenizer(const char* pFile, size_t len) : GTokenizer(pFile, len),
-	m_whitespace("\t\n\r "), m_real("-.+0-9eE"), m_quot("\"") {}
-	virtual ~GJsonTokenizer() {}
-};
-
 class Bogus1
 {
 public:
@@ -999,260 +943,1647 @@ GDomNode* GDom::clone(GDomNode* pNode)
 	}
 }
 
-char* GDom::loadJsonString(GJsonTokenizer& tok)
+// Tags for the values in the binary encoding
+enum GDomBinaryTag
+{
+	gdb_null = 0,
+	gdb_false,
+	gdb_true,
+	gdb_int,
+	gdb_double,
+	gdb_string,
+	gdb_list,
+	gdb_doubles,
+	gdb_obj,
+};
+
+// The first two bytes of a binary encoding. (JSON text never begins with a zero byte.)
+#define GDOM_BINARY_MARKER 0
+#define GDOM_BINARY_VERSION 1
+
+// Strings at least this long are gathered from the nodes instead of being copied into the encoding
+#define GDOM_BINARY_EXTERNAL_LEN 256
+
+GDomBinaryWriter::GDomBinaryWriter()
+: m_size(0)
+{
+}
+
+GDomBinaryWriter::~GDomBinaryWriter()
+{
+}
+
+void GDomBinaryWriter::write(const GDomNode* pNode)
+{
+	m_buf.clear();
+	m_external.clear();
+	m_starts.clear();
+	m_lens.clear();
+	m_segments.clear();
+	m_names.clear();
+	m_size = 0;
+
+	// The last segment is always an open segment of m_buf
+	m_external.push_back(NULL);
+	m_starts.push_back(0);
+	writeByte(GDOM_BINARY_MARKER);
+	writeByte(GDOM_BINARY_VERSION);
+	writeNode(pNode);
+	m_lens.push_back(m_buf.size() - m_starts.back());
+
+	// Resolve the segments (now that m_buf will not move again), and drop the empty ones
+	size_t n = 0;
+	for(size_t i = 0; i < m_lens.size(); i++)
+	{
+		if(m_lens[i] == 0)
+			continue;
+		m_segments.push_back(m_external[i] ? m_external[i] : &m_buf[m_starts[i]]);
+		m_lens[n++] = m_lens[i];
+		m_size += m_lens[i];
+	}
+	m_lens.resize(n);
+}
+
+void GDomBinaryWriter::toString(std::string& out) const
+{
+	out.clear();
+	out.reserve(m_size);
+	for(size_t i = 0; i < m_segments.size(); i++)
+		out.append(m_segments[i], m_lens[i]);
+}
+
+void GDomBinaryWriter::writeVarInt(unsigned long long n)
 {
-	tok.skipExact("\"");
-	char* szTok = tok.readUntil_escaped('\\', tok.m_quot);
-	tok.skip(1);
-	size_t eat = 0;
-	char* szString = szTok;
-	while(szString[eat] != '\0')
+	while(n >= 0x80)
 	{
-		char c = szString[eat];
-		if(c == '\\')
-		{
-			switch(szString[eat + 1])
+		writeByte((unsigned char)(n | 0x80));
+		n >>= 7;
+	}
+	writeByte((unsigned char)n);
+}
+
+void GDomBinaryWriter::writeBytes(const void* p, size_t len)
+{
+	const char* pChars = (const char*)p;
+	m_buf.insert(m_buf.end(), pChars, pChars + len);
+}
+
+void GDomBinaryWriter::writeExternal(const char* p, size_t len)
+{
+	m_lens.push_back(m_buf.size() - m_starts.back());
+	m_external.push_back(p);
+	m_starts.push_back(0);
+	m_lens.push_back(len);
+	m_external.push_back(NULL);
+	m_starts.push_back(m_buf.size());
+}
+
+void GDomBinaryWriter::writeNode(const GDomNode* pNode)
+{
+	switch(pNode->type())
+	{
+		case GDomNode::type_obj:
 			{
-				case '"': c = '"'; break;
-				case '\\': c = '\\'; break;
-				case '/': c = '/'; break;
-				case 'b': c = '\b'; break;
-				case 'f': c = '\f'; break;
-				case 'n': c = '\n'; break;
-				case 'r': c = '\r'; break;
-				case 't': c = '\t'; break;
-				case 'u':
-					GAssert(false); // Escaped unicode characters are not yet supported
-					c = '_';
-					eat += 3;
-					break;
-				default:
-					throw Ex("Unrecognized escape sequence");
+				size_t count = pNode->reverseFieldOrder();
+				writeByte(gdb_obj);
+				writeVarInt(count);
+				for(GDomObjField* pField = pNode->m_value.m_pLastField; pField; pField = pField->m_pPrev)
+				{
+					std::map<string, size_t>::iterator it = m_names.find(pField->m_pName);
+					if(it == m_names.end())
+					{
+						size_t len = strlen(pField->m_pName);
+						m_names.insert(std::pair<string, size_t>(pField->m_pName, m_names.size()));
+						writeVarInt(0);
+						writeVarInt(len);
+						writeBytes(pField->m_pName, len);
+					}
+					else
+						writeVarInt(it->second + 1);
+					writeNode(pField->m_pValue);
+				}
+				pNode->reverseFieldOrder();
 			}
-			eat++;
-		}
-		*szString = c;
-		szString++;
+			break;
+		case GDomNode::type_list:
+			{
+				size_t count = pNode->size();
+				bool allDoubles = (count > 0);
+				for(size_t i = 0; i < count && allDoubles; i++)
+				{
+					if(pNode->get(i)->m_type != GDomNode::type_double)
+						allDoubles = false;
+				}
+				if(allDoubles)
+				{
+					writeByte(gdb_doubles);
+					writeVarInt(count);
+					size_t pos = m_buf.size();
+					m_buf.resize(pos + count * sizeof(double));
+					for(size_t i = 0; i < count; i++)
+						memcpy(&m_buf[pos + i * sizeof(double)], &pNode->get(i)->m_value.m_double, sizeof(double));
+				}
+				else
+				{
+					writeByte(gdb_list);
+					writeVarInt(count);
+					for(size_t i = 0; i < count; i++)
+						writeNode(pNode->get(i));
+				}
+			}
+			break;
+		case GDomNode::type_bool:
+			writeByte(pNode->m_value.m_bool ? gdb_true : gdb_false);
+			break;
+		case GDomNode::type_int:
+			{
+				// Zig-zag encoding makes small negative values small too
+				long long n = pNode->m_value.m_int;
+				writeByte(gdb_int);
+				writeVarInt(((unsigned long long)n << 1) ^ (unsigned long long)(n >> 63));
+			}
+			break;
+		case GDomNode::type_double:
+			writeByte(gdb_double);
+			writeBytes(&pNode->m_value.m_double, sizeof(double));
+			break;
+		case GDomNode::type_string:
+			{
+				size_t len = strlen(pNode->m_value.m_string);
+				writeByte(gdb_string);
+				writeVarInt(len);
+				if(len >= GDOM_BINARY_EXTERNAL_LEN)
+					writeExternal(pNode->m_value.m_string, len);
+				else
+					writeBytes(pNode->m_value.m_string, len);
+			}
+			break;
+		case GDomNode::type_null:
+			writeByte(gdb_null);
+			break;
+		default:
+			throw Ex("Unexpected type");
 	}
-	*szString = '\0';
-	return szTok;
 }
 
-GDomNode* GDom::loadJsonObject(GJsonTokenizer& tok)
+#define GRISU_POWER_COUNT 79
+#define GRISU_MIN_DEC_EXP -300
+#define GRISU_DEC_STEP 8
+#define GRISU_ALPHA -60
+#define GRISU_GAMMA -32
+
+// A floating point value with a 64-bit significand, f * 2^e
+struct GDiyFp
+{
+	unsigned long long f;
+	int e;
+
+	GDiyFp() : f(0), e(0) {}
+	GDiyFp(unsigned long long ff, int ee) : f(ff), e(ee) {}
+};
+
+// Returns the upper 64 bits of the 128-bit product (rounded)
+GDiyFp GDiyFp_mul(const GDiyFp& x, const GDiyFp& y)
+{
+	unsigned long long xLo = x.f & 0xffffffffULL;
+	unsigned long long xHi = x.f >> 32;
+	unsigned long long yLo = y.f & 0xffffffffULL;
+	unsigned long long yHi = y.f >> 32;
+	unsigned long long p0 = xLo * yLo;
+	unsigned long long p1 = xLo * yHi;
+	unsigned long long p2 = xHi * yLo;
+	unsigned long long p3 = xHi * yHi;
+	unsigned long long q = (p0 >> 32) + (p1 & 0xffffffffULL) + (p2 & 0xffffffffULL) + (1ULL << 31);
+	return GDiyFp(p3 + (p1 >> 32) + (p2 >> 32) + (q >> 32), x.e + y.e + 64);
+}
+
+GDiyFp GDiyFp_normalize(GDiyFp x)
 {
-	tok.skipExact("{");
-	GDomNode* pNewObj = newObj();
-	bool readyForField = true;
-	GCharSet& whitespace = tok.m_whitespace;
-	while(tok.has_more())
+	while((x.f >> 63) == 0)
 	{
-		tok.skipWhile(whitespace);
-		char c = tok.peek();
-		if(c == '}')
-		{
-			tok.skip(1);
-			break;
-		}
-		else if(c == ',')
-		{
-			if(readyForField)
-				throw Ex("Unexpected ',' in JSON file at line ", to_str(tok.line()), ", col ", to_str(tok.col()));
-			tok.skip(1);
-			readyForField = true;
-		}
-		else if(c == '\"')
-		{
-			if(!readyForField)
-				throw Ex("Expected a ',' before the next field in JSON file at line ", to_str(tok.line()), ", col ", to_str(tok.col()));
-			GDomObjField* pNewField = newField();
-			pNewField->m_pPrev = pNewObj->m_value.m_pLastField;
-			pNewObj->m_value.m_pLastField = pNewField;
-			pNewField->m_pName = m_heap.add(loadJsonString(tok));
-			tok.skipWhile(whitespace);
-			tok.skipExact(":");
-			tok.skipWhile(whitespace);
-			pNewField->m_pValue = loadJsonValue(tok);
-			readyForField = false;
-		}
-		else if(c == '\0')
-			throw Ex("Expected a matching '}' in JSON file at line ", to_str(tok.line()), ", col ", to_str(tok.col()));
-		else
-			throw Ex("Expected a '}' or a '\"' at line ", to_str(tok.line()), ", col ", to_str(tok.col()));
+		x.f <<= 1;
+		x.e--;
 	}
-	return pNewObj;
+	return x;
 }
 
-GDomNode* GDom::loadJsonArray(GJsonTokenizer& tok)
+// Computes the powers of ten that Grisu2 uses to scale values, 10^(GRISU_MIN_DEC_EXP + GRISU_DEC_STEP * i),
+// each rounded to a 64-bit significand. They are computed once with exact big-integer arithmetic.
+class GGrisuPowers
 {
-	tok.skipExact("[");
-	GDomNode* pNewList = newList();
-	bool readyForValue = true;
-	while(tok.has_more())
+public:
+	unsigned long long m_f[GRISU_POWER_COUNT];
+	int m_e[GRISU_POWER_COUNT];
+
+	GGrisuPowers()
 	{
-		tok.skipWhile(tok.m_whitespace);
-		char c = tok.peek();
-		if(c == ']')
+		for(int i = 0; i < GRISU_POWER_COUNT; i++)
 		{
-			tok.skip(1);
-			break;
+			int k = GRISU_MIN_DEC_EXP + GRISU_DEC_STEP * i;
+			std::vector<unsigned int> p;
+			pow10(p, k >= 0 ? k : -k);
+			if(k >= 0)
+				top64(p, m_f[i], m_e[i]);
+			else
+			{
+				// 10^k = (2^n / 10^-k) * 2^-n, where n is big enough to give the quotient more than 64 bits
+				int n = (int)bitLength(p) + 65;
+				std::vector<unsigned int> q;
+				divPow2(n, p, q);
+				top64(q, m_f[i], m_e[i]);
+				m_e[i] -= n;
+			}
 		}
-		else if(c == ',')
+	}
+
+	static const GGrisuPowers& get()
+	{
+		static GGrisuPowers powers;
+		return powers;
+	}
+
+protected:
+	static void pow10(std::vector<unsigned int>& big, int k)
+	{
+		big.assign(1, 1);
+		for(int i = 0; i < k; i++)
 		{
-			if(readyForValue)
-				throw Ex("Unexpected ',' in JSON file at line ", to_str(tok.line()), ", col ", to_str(tok.col()));
-			tok.skip(1);
-			readyForValue = true;
+			unsigned long long carry = 0;
+			for(size_t j = 0; j < big.size(); j++)
+			{
+				carry += (unsigned long long)big[j] * 10;
+				big[j] = (unsigned int)carry;
+				carry >>= 32;
+			}
+			if(carry)
+				big.push_back((unsigned int)carry);
 		}
-		else if(c == '\0')
-			throw Ex("Expected a matching ']' in JSON file at line ", to_str(tok.line()), ", col ", to_str(tok.col()));
-		else
+	}
+
+	static size_t bitLength(const std::vector<unsigned int>& big)
+	{
+		size_t i = big.size();
+		while(i > 0 && big[i - 1] == 0)
+			i--;
+		if(i == 0)
+			return 0;
+		size_t bits = (i - 1) * 32;
+		for(unsigned int w = big[i - 1]; w; w >>= 1)
+			bits++;
+		return bits;
+	}
+
+	static bool bit(const std::vector<unsigned int>& big, size_t i)
+	{
+		return ((big[i / 32] >> (i % 32)) & 1) != 0;
+	}
+
+	// Finds f and e, such that big is approximately f * 2^e, and the high bit of f is set
+	static void top64(const std::vector<unsigned int>& big, unsigned long long& f, int& e)
+	{
+		size_t len = bitLength(big);
+		f = 0;
+		for(size_t j = 0; j < 64; j++)
+			f = (f << 1) | ((j < len && bit(big, len - 1 - j)) ? 1 : 0);
+		e = (int)len - 64;
+		if(len > 64 && bit(big, len - 65))
 		{
-			if(!readyForValue)
-				throw Ex("Expected a ',' or ']' in JSON file at line ", to_str(tok.line()), ", col ", to_str(tok.col()));
-			GDomNode* pValue = loadJsonValue(tok);
-			pNewList->add(this, pValue);
-			readyForValue = false;
+			if(++f == 0)
+			{
+				f = 1ULL << 63;
+				e++;
+			}
 		}
 	}
-	return pNewList;
-}
 
-GDomNode* GDom::loadJsonNumber(GJsonTokenizer& tok)
-{
-	char* szString = tok.readWhile(tok.m_real);
-	bool hasPeriod = false;
-	for(char* szChar = szString; *szChar != '\0'; szChar++)
+	// Computes q = floor(2^n / den) by long division
+	static void divPow2(int n, const std::vector<unsigned int>& den, std::vector<unsigned int>& q)
 	{
-		if(*szChar == '.')
-			hasPeriod = true;
+		q.assign(n / 32 + 1, 0);
+		std::vector<unsigned int> rem(den.size() + 1, 0);
+		for(int i = n; i >= 0; i--)
+		{
+			// rem = rem * 2 + (the next bit of the numerator)
+			unsigned int carry = (i == n ? 1 : 0);
+			for(size_t j = 0; j < rem.size(); j++)
+			{
+				unsigned int next = rem[j] >> 31;
+				rem[j] = (rem[j] << 1) | carry;
+				carry = next;
+			}
+
+			// If rem >= den, subtract den
+			bool ge = true;
+			for(size_t j = rem.size(); j > 0; j--)
+			{
+				unsigned int d = (j - 1 < den.size() ? den[j - 1] : 0);
+				if(rem[j - 1] != d)
+				{
+					ge = rem[j - 1] > d;
+					break;
+				}
+			}
+			if(ge)
+			{
+				long long borrow = 0;
+				for(size_t j = 0; j < rem.size(); j++)
+				{
+					long long diff = (long long)rem[j] - (j < den.size() ? den[j] : 0) - borrow;
+					borrow = (diff < 0 ? 1 : 0);
+					rem[j] = (unsigned int)(diff + (borrow << 32));
+				}
+				q[i / 32] |= (1u << (i % 32));
+			}
+		}
 	}
-	if(hasPeriod)
-		return newDouble(atof(szString));
-	else
+};
+
+// Nudges the last digit down while that brings the result closer to the value, and keeps it within the boundaries
+void GJsonWriter_grisuRound(char* pBuf, int len, unsigned long long dist, unsigned long long delta, unsigned long long rest, unsigned long long tenK)
+{
+	while(rest < dist && delta - rest >= tenK && (rest + tenK < dist || dist - rest > rest + tenK - dist))
 	{
-#ifdef WINDOWS
-		return newInt(_atoi64(szString));
-#else
-		return newInt(strtoll(szString, (char**)NULL, 10));
-#endif
+		pBuf[len - 1]--;
+		rest += tenK;
 	}
 }
 
-GDomNode* GDom::loadJsonValue(GJsonTokenizer& tok)
+// Generates the shortest digits of a number in the interval (mMinus, mPlus), as close as possible to w
+void GJsonWriter_grisuDigits(char* pBuf, int& len, int& decExp, const GDiyFp& mMinus, const GDiyFp& w, const GDiyFp& mPlus)
 {
-	char c = tok.peek();
-	if(c == '"')
-		return newString(loadJsonString(tok));
-	else if(c == '{')
-		return loadJsonObject(tok);
-	else if(c == '[')
-		return loadJsonArray(tok);
-	else if(c == 't')
+	static const unsigned int pows[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+	unsigned long long delta = mPlus.f - mMinus.f;
+	unsigned long long dist = mPlus.f - w.f;
+	int shift = -mPlus.e;
+	unsigned long long one = 1ULL << shift;
+	unsigned int p1 = (unsigned int)(mPlus.f >> shift); // The integral part
+	unsigned long long p2 = mPlus.f & (one - 1); // The fractional part
+
+	// Generate the digits of the integral part
+	int n = 1;
+	while(n < 10 && p1 >= pows[n])
+		n++;
+	while(n > 0)
 	{
-		tok.skipExact("true");
-		return newBool(true);
+		unsigned int pow10 = pows[n - 1];
+		pBuf[len++] = (char)('0' + p1 / pow10);
+		p1 %= pow10;
+		n--;
+		unsigned long long rest = ((unsigned long long)p1 << shift) + p2;
+		if(rest <= delta)
+		{
+			decExp += n;
+			GJsonWriter_grisuRound(pBuf, len, dist, delta, rest, (unsigned long long)pow10 << shift);
+			return;
+		}
 	}
-	else if(c == 'f')
+
+	// Generate the digits of the fractional part
+	int m = 0;
+	while(true)
 	{
-		tok.skipExact("false");
-		return newBool(false);
+		p2 *= 10;
+		pBuf[len++] = (char)('0' + (p2 >> shift));
+		p2 &= (one - 1);
+		m++;
+		delta *= 10;
+		dist *= 10;
+		if(p2 <= delta)
+			break;
 	}
-	else if(c == 'n')
+	decExp -= m;
+	GJsonWriter_grisuRound(pBuf, len, dist, delta, p2, one);
+}
+
+// Finds the shortest digits, d, such that d * 10^decExp rounds to the positive finite value v
+void GJsonWriter_grisu2(char* pBuf, int& len, int& decExp, double v)
+{
+	// Decompose v, and find the boundaries of the interval that rounds to it
+	unsigned long long bits;
+	memcpy(&bits, &v, sizeof(double));
+	unsigned long long fraction = bits & ((1ULL << 52) - 1);
+	int biasedExp = (int)(bits >> 52);
+	GDiyFp w = (biasedExp == 0 ? GDiyFp(fraction, 1 - 1075) : GDiyFp(fraction + (1ULL << 52), biasedExp - 1075));
+	bool lowerIsCloser = (fraction == 0 && biasedExp > 1);
+	GDiyFp mPlus = GDiyFp_normalize(GDiyFp(2 * w.f + 1, w.e - 1));
+	GDiyFp mMinus = lowerIsCloser ? GDiyFp(4 * w.f - 1, w.e - 2) : GDiyFp(2 * w.f - 1, w.e - 1);
+	mMinus.f <<= (mMinus.e - mPlus.e);
+	mMinus.e = mPlus.e;
+	w = GDiyFp_normalize(w);
+
+	// Scale them by a cached power of ten that puts the exponent in [GRISU_ALPHA, GRISU_GAMMA]
+	int f = GRISU_ALPHA - mPlus.e - 1;
+	int k = (f * 78913) / (1 << 18) + (f > 0 ? 1 : 0);
+	int index = (-GRISU_MIN_DEC_EXP + k + (GRISU_DEC_STEP - 1)) / GRISU_DEC_STEP;
+	const GGrisuPowers& powers = GGrisuPowers::get();
+	GAssert(index >= 0 && index < GRISU_POWER_COUNT);
+	GDiyFp c(powers.m_f[index], powers.m_e[index]);
+	GAssert(c.e + mPlus.e + 64 >= GRISU_ALPHA && c.e + mPlus.e + 64 <= GRISU_GAMMA);
+	GDiyFp wScaled = GDiyFp_mul(w, c);
+	GDiyFp wMinus = GDiyFp_mul(mMinus, c);
+	GDiyFp wPlus = GDiyFp_mul(mPlus, c);
+
+	// Shrink the interval by one ulp on each side to account for the rounding in the multiplications
+	wMinus.f++;
+	wPlus.f--;
+	len = 0;
+	decExp = -(GRISU_MIN_DEC_EXP + GRISU_DEC_STEP * index);
+	GJsonWriter_grisuDigits(pBuf, len, decExp, wMinus, wScaled, wPlus);
+}
+
+GJsonWriter::GJsonWriter(std::ostream& stream)
+: m_stream(stream), m_pos(0), m_needComma(false)
+{
+	m_pBuf = new char[GJSONWRITER_BUF_SIZE];
+}
+
+GJsonWriter::~GJsonWriter()
+{
+	try
 	{
-		tok.skipExact("null");
-		return newNull();
+		flush();
 	}
-	else if((c >= '0' && c <= '9') || c == '-')
-		return loadJsonNumber(tok);
-	else if(c == '\0')
+	catch(...)
 	{
-		throw Ex("Unexpected end of file while parsing JSON file at line ", to_str(tok.line()), ", col ", to_str(tok.col()));
-		return NULL;
 	}
-	else
+	delete[] m_pBuf;
+}
+
+void GJsonWriter::flush()
+{
+	if(m_pos > 0)
 	{
-		throw Ex("Unexpected token, \"", to_str(c), "\", while parsing JSON file at line ", to_str(tok.line()), ", col ", to_str(tok.col()));
-		return NULL;
+		m_stream.write(m_pBuf, m_pos);
+		m_pos = 0;
 	}
 }
 
-void GDom::parseJson(const char* pJsonString, size_t len)
+void GJsonWriter::writeRaw(const char* pText, size_t len)
 {
-	GJsonTokenizer tok(pJsonString, len);
-	tok.skipWhile(tok.m_whitespace);
-	setRoot(loadJsonValue(tok));
+	while(len > 0)
+	{
+		if(m_pos >= GJSONWRITER_BUF_SIZE)
+			flush();
+		size_t n = std::min(len, (size_t)GJSONWRITER_BUF_SIZE - m_pos);
+		memcpy(m_pBuf + m_pos, pText, n);
+		m_pos += n;
+		pText += n;
+		len -= n;
+	}
 }
 
-void GDom::loadJson(const char* szFilename)
+void GJsonWriter::writeQuoted(const char* szString)
 {
-	GJsonTokenizer tok(szFilename);
-	tok.skipWhile(tok.m_whitespace);
-	setRoot(loadJsonValue(tok));
+	static const char hex[] = "0123456789abcdef";
+	reserve(1);
+	m_pBuf[m_pos++] = '"';
+	for(const char* pChar = szString; *pChar != '\0'; pChar++)
+	{
+		reserve(6);
+		unsigned char c = (unsigned char)*pChar;
+		if(c >= ' ' && c != '"' && c != '\\')
+			m_pBuf[m_pos++] = (char)c;
+		else
+		{
+			m_pBuf[m_pos++] = '\\';
+			switch(c)
+			{
+				case '"': m_pBuf[m_pos++] = '"'; break;
+				case '\\': m_pBuf[m_pos++] = '\\'; break;
+				case '\b': m_pBuf[m_pos++] = 'b'; break;
+				case '\f': m_pBuf[m_pos++] = 'f'; break;
+				case '\n': m_pBuf[m_pos++] = 'n'; break;
+				case '\r': m_pBuf[m_pos++] = 'r'; break;
+				case '\t': m_pBuf[m_pos++] = 't'; break;
+				default:
+					m_pBuf[m_pos++] = 'u';
+					m_pBuf[m_pos++] = '0';
+					m_pBuf[m_pos++] = '0';
+					m_pBuf[m_pos++] = hex[c >> 4];
+					m_pBuf[m_pos++] = hex[c & 0xf];
+			}
+		}
+	}
+	reserve(1);
+	m_pBuf[m_pos++] = '"';
 }
 
-void GDom::writeJson(std::ostream& stream) const
+void GJsonWriter::beginObj()
 {
-	if(!m_pRoot)
-		throw Ex("No root node has been set");
-	stream.precision(14);
-	m_pRoot->writeJson(stream);
+	separate();
+	m_pBuf[m_pos++] = '{';
+	m_stack.push_back('{');
+	m_needComma = false;
 }
 
-void GDom::writeJsonPretty(std::ostream& stream) const
+void GJsonWriter::endObj()
 {
-	if(!m_pRoot)
-		throw Ex("No root node has been set");
-	stream.precision(14);
-	m_pRoot->writeJsonPretty(stream, 0);
+	if(m_stack.size() == 0 || m_stack.back() != '{')
+		throw Ex("There is no object to end");
+	m_stack.pop_back();
+	reserve(1);
+	m_pBuf[m_pos++] = '}';
+	m_needComma = true;
 }
 
-void GDom::writeJsonCpp(std::ostream& stream) const
+void GJsonWriter::beginList()
 {
-	if(!m_pRoot)
-		throw Ex("No root node has been set");
-	stream.precision(14);
-	stream << "const char* g_rename_me = \"";
-	m_pRoot->writeJsonCpp(stream, 0);
-	stream << "\";\n\n";
+	separate();
+	m_pBuf[m_pos++] = '[';
+	m_stack.push_back('[');
+	m_needComma = false;
 }
 
-void GDom::saveJson(const char* szFilename) const
+void GJsonWriter::endList()
 {
-	std::ofstream os;
-	os.exceptions(std::ios::badbit | std::ios::failbit);
-	try
-	{
-		os.open(szFilename, std::ios::binary);
-	}
-	catch(const std::exception&)
-	{
-		throw Ex("Error while trying to create the file, ", szFilename, ". ", strerror(errno));
-	}
-	writeJson(os);
+	if(m_stack.size() == 0 || m_stack.back() != '[')
+		throw Ex("There is no list to end");
+	m_stack.pop_back();
+	reserve(1);
+	m_pBuf[m_pos++] = ']';
+	m_needComma = true;
 }
 
-void GDom::writeXml(std::ostream& stream) const
+void GJsonWriter::key(const char* szName)
 {
-	if(!m_pRoot)
-		throw Ex("No root node has been set");
-	stream.precision(14);
-	stream << "<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>";
-	m_pRoot->writeXml(stream, "root");
+	if(m_stack.size() == 0 || m_stack.back() != '{')
+		throw Ex("Field names may only be written in an object");
+	separate();
+	writeQuoted(szName);
+	reserve(1);
+	m_pBuf[m_pos++] = ':';
+	m_needComma = false;
 }
 
-std::string to_str(const GDomNode& node)
+void GJsonWriter::writeNull()
 {
-	std::ostringstream os;
-	node.writeJsonPretty(os, 0);
-	return os.str();
+	separate();
+	writeRaw("null", 4);
+	m_needComma = true;
 }
 
-std::string to_str_brief(const GDomNode& node)
+void GJsonWriter::writeBool(bool b)
 {
-	std::ostringstream os;
-	node.writeJsonPretty(os, 0);
-	std::string s = os.str();
-	if(s.length() < 60)
+	separate();
+	if(b)
+		writeRaw("true", 4);
+	else
+		writeRaw("false", 5);
+	m_needComma = true;
+}
+
+void GJsonWriter::writeInt(long long n)
+{
+	separate();
+	reserve(24);
+	char tmp[24];
+	size_t len = 0;
+	unsigned long long u = (n < 0 ? 0ULL - (unsigned long long)n : (unsigned long long)n);
+	do
+	{
+		tmp[len++] = (char)('0' + u % 10);
+		u /= 10;
+	} while(u > 0);
+	if(n < 0)
+		m_pBuf[m_pos++] = '-';
+	while(len > 0)
+		m_pBuf[m_pos++] = tmp[--len];
+	m_needComma = true;
+}
+
+void GJsonWriter::writeDouble(double d)
+{
+	if(!std::isfinite(d))
+		throw Ex("Invalid value: ", to_str(d));
+	separate();
+	reserve(32);
+	m_pos += formatDouble(d, m_pBuf + m_pos);
+	m_needComma = true;
+}
+
+void GJsonWriter::writeString(const char* szString)
+{
+	separate();
+	writeQuoted(szString);
+	m_needComma = true;
+}
+
+void GJsonWriter::writeDoubles(const double* pValues, size_t count)
+{
+	beginList();
+	for(size_t i = 0; i < count; i++)
+		writeDouble(pValues[i]);
+	endList();
+}
+
+void GJsonWriter::writeNode(const GDomNode* pNode)
+{
+	switch(pNode->m_type)
+	{
+		case GDomNode::type_obj:
+			beginObj();
+			writeFields(pNode);
+			endObj();
+			break;
+		case GDomNode::type_list:
+			beginList();
+			if(pNode->m_value.m_pArrayList)
+			{
+				for(size_t i = 0; i < pNode->m_value.m_pArrayList->m_size; i++)
+					writeNode(pNode->m_value.m_pArrayList->m_items[i]);
+			}
+			endList();
+			break;
+		case GDomNode::type_bool:
+			writeBool(pNode->m_value.m_bool);
+			break;
+		case GDomNode::type_int:
+			writeInt(pNode->m_value.m_int);
+			break;
+		case GDomNode::type_double:
+			writeDouble(pNode->m_value.m_double);
+			break;
+		case GDomNode::type_string:
+			writeString(pNode->m_value.m_string);
+			break;
+		case GDomNode::type_null:
+			writeNull();
+			break;
+		default:
+			throw Ex("Unrecognized node type");
+	}
+}
+
+void GJsonWriter::writeFields(const GDomNode* pObj)
+{
+	if(pObj->m_type != GDomNode::type_obj)
+		throw Ex("Expected an object");
+	pObj->reverseFieldOrder();
+	for(GDomObjField* pField = pObj->m_value.m_pLastField; pField; pField = pField->m_pPrev)
+	{
+		key(pField->m_pName);
+		writeNode(pField->m_pValue);
+	}
+	pObj->reverseFieldOrder();
+}
+
+// static
+size_t GJsonWriter::formatDouble(double d, char* pOut)
+{
+	char* pStart = pOut;
+	if(std::signbit(d))
+	{
+		*(pOut++) = '-';
+		d = -d;
+	}
+	if(d == 0.0)
+	{
+		memcpy(pOut, "0.0", 3);
+		return pOut + 3 - pStart;
+	}
+	GAssert(d <= 1.7976931348623157e308);
+
+	// Find the digits
+	char digits[20];
+	int len, decExp;
+	GJsonWriter_grisu2(digits, len, decExp, d);
+
+	// Place the decimal point. The value is digits * 10^decExp, and pos is the position of the
+	// decimal point relative to the start of the digits.
+	int pos = len + decExp;
+	if(len <= pos && pos <= 15)
+	{
+		// digits000.0
+		memcpy(pOut, digits, len);
+		pOut += len;
+		for(int i = len; i < pos; i++)
+			*(pOut++) = '0';
+		*(pOut++) = '.';
+		*(pOut++) = '0';
+	}
+	else if(0 < pos && pos <= 15)
+	{
+		// dig.its
+		memcpy(pOut, digits, pos);
+		pOut += pos;
+		*(pOut++) = '.';
+		memcpy(pOut, digits + pos, len - pos);
+		pOut += len - pos;
+	}
+	else if(-4 < pos && pos <= 0)
+	{
+		// 0.000digits
+		*(pOut++) = '0';
+		*(pOut++) = '.';
+		for(int i = pos; i < 0; i++)
+			*(pOut++) = '0';
+		memcpy(pOut, digits, len);
+		pOut += len;
+	}
+	else
+	{
+		// d.igitse+123
+		*(pOut++) = digits[0];
+		if(len > 1)
+		{
+			*(pOut++) = '.';
+			memcpy(pOut, digits + 1, len - 1);
+			pOut += len - 1;
+		}
+		*(pOut++) = 'e';
+		int e = pos - 1;
+		if(e < 0)
+		{
+			*(pOut++) = '-';
+			e = -e;
+		}
+		else
+			*(pOut++) = '+';
+		if(e >= 100)
+		{
+			*(pOut++) = (char)('0' + e / 100);
+			e %= 100;
+		}
+		*(pOut++) = (char)('0' + e / 10);
+		*(pOut++) = (char)('0' + e % 10);
+	}
+	return pOut - pStart;
+}
+
+
+unsigned long long GDom_readVarInt(const unsigned char*& pData, const unsigned char* pEnd)
+{
+	unsigned long long n = 0;
+	for(unsigned int shift = 0; shift < 64; shift += 7)
+	{
+		if(pData >= pEnd)
+			throw Ex("The binary DOM is truncated");
+		unsigned char b = *(pData++);
+		n |= ((unsigned long long)(b & 0x7f)) << shift;
+		if((b & 0x80) == 0)
+			return n;
+	}
+	throw Ex("Invalid varint in a binary DOM");
+	return 0;
+}
+
+// static
+bool GDom::isBinary(const char* pData, size_t len)
+{
+	return len >= 2 && pData[0] == GDOM_BINARY_MARKER && pData[1] == GDOM_BINARY_VERSION;
+}
+
+GDomNode* GDom::newList(size_t capacity)
+{
+	GDomNode* pNewList = newList();
+	if(capacity > 0)
+	{
+		GDomArrayList* pArrayList = (GDomArrayList*)m_heap.allocAligned(sizeof(size_t) + sizeof(size_t) + sizeof(GDomNode*) * std::max((size_t)2, capacity));
+		pArrayList->m_size = 0;
+		pArrayList->m_capacity = capacity;
+		pNewList->m_value.m_pArrayList = pArrayList;
+	}
+	return pNewList;
+}
+
+GDomNode* GDom::loadBinaryValue(const unsigned char*& pData, const unsigned char* pEnd, vector<const char*>& names, size_t depth)
+{
+	if(pData >= pEnd)
+		throw Ex("The binary DOM is truncated");
+	if(depth > 10000)
+		throw Ex("The binary DOM is nested too deeply");
+	unsigned char tag = *(pData++);
+	switch(tag)
+	{
+		case gdb_null: return newNull();
+		case gdb_false: return newBool(false);
+		case gdb_true: return newBool(true);
+		case gdb_int:
+			{
+				unsigned long long u = GDom_readVarInt(pData, pEnd);
+				return newInt((long long)(u >> 1) ^ -(long long)(u & 1));
+			}
+		case gdb_double:
+			{
+				if(pEnd - pData < (ptrdiff_t)sizeof(double))
+					throw Ex("The binary DOM is truncated");
+				double d;
+				memcpy(&d, pData, sizeof(double));
+				pData += sizeof(double);
+				return newDouble(d);
+			}
+		case gdb_string:
+			{
+				unsigned long long len = GDom_readVarInt(pData, pEnd);
+				if((unsigned long long)(pEnd - pData) < len)
+					throw Ex("The binary DOM is truncated");
+				GDomNode* pString = newString((const char*)pData, (size_t)len);
+				pData += len;
+				return pString;
+			}
+		case gdb_list:
+			{
+				unsigned long long count = GDom_readVarInt(pData, pEnd);
+				if((unsigned long long)(pEnd - pData) < count)
+					throw Ex("The binary DOM is truncated");
+				GDomNode* pList = newList((size_t)count);
+				for(size_t i = 0; i < count; i++)
+					pList->add(this, loadBinaryValue(pData, pEnd, names, depth + 1));
+				return pList;
+			}
+		case gdb_doubles:
+			{
+				unsigned long long count = GDom_readVarInt(pData, pEnd);
+				if((unsigned long long)(pEnd - pData) / sizeof(double) < count)
+					throw Ex("The binary DOM is truncated");
+				GDomNode* pList = newList((size_t)count);
+				for(size_t i = 0; i < count; i++)
+				{
+					double d;
+					memcpy(&d, pData, sizeof(double));
+					pData += sizeof(double);
+					pList->add(this, newDouble(d));
+				}
+				return pList;
+			}
+		case gdb_obj:
+			{
+				unsigned long long count = GDom_readVarInt(pData, pEnd);
+				if((unsigned long long)(pEnd - pData) < count)
+					throw Ex("The binary DOM is truncated");
+				GDomNode* pObj = newObj();
+				for(size_t i = 0; i < count; i++)
+				{
+					// Fields with the same name share one copy of it
+					unsigned long long ref = GDom_readVarInt(pData, pEnd);
+					const char* szName;
+					if(ref == 0)
+					{
+						unsigned long long len = GDom_readVarInt(pData, pEnd);
+						if((unsigned long long)(pEnd - pData) < len)
+							throw Ex("The binary DOM is truncated");
+						szName = m_heap.add((const char*)pData, (size_t)len);
+						pData += len;
+						names.push_back(szName);
+					}
+					else if(ref <= names.size())
+						szName = names[(size_t)ref - 1];
+					else
+						throw Ex("Invalid field name reference in a binary DOM");
+					GDomObjField* pField = newField();
+					pField->m_pPrev = pObj->m_value.m_pLastField;
+					pObj->m_value.m_pLastField = pField;
+					pField->m_pName = szName;
+					pField->m_pValue = loadBinaryValue(pData, pEnd, names, depth + 1);
+				}
+				return pObj;
+			}
+		default:
+			throw Ex("Invalid tag in a binary DOM: ", to_str((int)tag));
+	}
+	return NULL;
+}
+
+void GDom::parseBinary(const char* pData, size_t len)
+{
+	if(!isBinary(pData, len))
+		throw Ex("Expected a binary DOM");
+	const unsigned char* p = (const unsigned char*)pData + 2;
+	const unsigned char* pEnd = (const unsigned char*)pData + len;
+	vector<const char*> names;
+	setRoot(loadBinaryValue(p, pEnd, names, 0));
+	if(p != pEnd)
+		throw Ex("Unexpected data after the end of a binary DOM");
+}
+
+/// Parses JSON in two stages. The first stage scans the text 64 bytes at a time (with SSE2 when it is
+/// available) and builds an index of the positions where tokens begin, skipping over whitespace and the
+/// contents of strings. The second stage walks the index and builds the nodes. The index is built one
+/// window at a time, just ahead of the second stage, so it stays small and in cache.
+class GJsonParser
+{
+protected:
+	GDom* m_pDoc;
+	const char* m_pText;
+	size_t m_len;
+	size_t m_scanPos; // How far the first stage has scanned
+	bool m_inString; // Whether the first stage ended inside a string
+	bool m_escaped; // Whether the first stage ended on an unescaped backslash
+	bool m_afterSep; // Whether the last character scanned was whitespace or an operator (or the start of the text)
+	std::vector<size_t> m_index;
+	size_t m_next; // The next token in m_index
+	std::vector<GDomNode*> m_items; // Scratch space for list items
+
+public:
+	GJsonParser(GDom* pDoc, const char* pText, size_t len)
+	: m_pDoc(pDoc), m_pText(pText), m_len(len), m_scanPos(0), m_inString(false), m_escaped(false), m_afterSep(true), m_next(0)
+	{
+	}
+
+	/// Parses the whole text and returns the root node
+	GDomNode* parse()
+	{
+		size_t pos = nextToken();
+		if(pos >= m_len)
+			throw Ex("Unexpected end of file while parsing JSON file at line 1, col 1");
+		return parseValue(pos, 0);
+	}
+
+	/// Parses a list of numbers into out without making any nodes
+	void parseDoubles(std::vector<double>& out)
+	{
+		out.clear();
+		size_t pos = nextToken();
+		if(pos >= m_len || m_pText[pos] != '[')
+			error("Expected a list of numbers", pos);
+		pos = nextToken();
+		if(pos < m_len && m_pText[pos] == ']')
+			return;
+		while(true)
+		{
+			if(pos >= m_len)
+				error("Expected a matching ']'", pos);
+			double d;
+			long long n;
+			if(parseNumber(pos, &d, &n))
+				out.push_back(d);
+			else
+				out.push_back((double)n);
+			pos = nextToken();
+			if(pos < m_len && m_pText[pos] == ',')
+				pos = nextToken();
+			else if(pos < m_len && m_pText[pos] == ']')
+				break;
+			else
+				error("Expected a ',' or ']'", pos);
+		}
+	}
+
+protected:
+	/// Throws an exception that reports the line and column of pos
+	void error(const char* szMessage, size_t pos)
+	{
+		pos = std::min(pos, m_len);
+		size_t line = 1;
+		size_t lineStart = 0;
+		for(size_t i = 0; i < pos; i++)
+		{
+			if(m_pText[i] == '\n')
+			{
+				line++;
+				lineStart = i + 1;
+			}
+		}
+		if(pos >= m_len)
+			throw Ex("Unexpected end of file while parsing JSON file at line ", to_str(line), ", col ", to_str(pos - lineStart + 1));
+		throw Ex(szMessage, " in JSON file at line ", to_str(line), ", col ", to_str(pos - lineStart + 1));
+	}
+
+	/// Returns the position of the next token, or m_len if there are no more tokens
+	size_t nextToken()
+	{
+		while(m_next >= m_index.size())
+		{
+			if(m_scanPos >= m_len)
+				return m_len;
+			scanWindow();
+		}
+		return m_index[m_next++];
+	}
+
+	static unsigned int ctz(unsigned long long x)
+	{
+#ifdef __GNUC__
+		return (unsigned int)__builtin_ctzll(x);
+#else
+		unsigned int n = 0;
+		while((x & 1) == 0)
+		{
+			x >>= 1;
+			n++;
+		}
+		return n;
+#endif
+	}
+
+	/// Computes the masks of one 64-byte chunk
+	static void classify(const char* pChunk, unsigned long long* pQuote, unsigned long long* pBackslash, unsigned long long* pSpace, unsigned long long* pOp)
+	{
+#ifdef __SSE2__
+		const __m128i quot = _mm_set1_epi8('"');
+		const __m128i bs = _mm_set1_epi8('\\');
+		const __m128i sp = _mm_set1_epi8(' ');
+		const __m128i tab = _mm_set1_epi8('\t');
+		const __m128i nl = _mm_set1_epi8('\n');
+		const __m128i cr = _mm_set1_epi8('\r');
+		const __m128i colon = _mm_set1_epi8(':');
+		const __m128i comma = _mm_set1_epi8(',');
+		const __m128i lbrace = _mm_set1_epi8('{');
+		const __m128i rbrace = _mm_set1_epi8('}');
+		const __m128i lbrack = _mm_set1_epi8('[');
+		const __m128i rbrack = _mm_set1_epi8(']');
+		unsigned long long q = 0, b = 0, w = 0, o = 0;
+		for(size_t i = 0; i < 4; i++)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(pChunk + 16 * i));
+			unsigned int shift = (unsigned int)(16 * i);
+			q |= (unsigned long long)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quot)) << shift;
+			b |= (unsigned long long)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, bs)) << shift;
+			__m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab)), _mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, cr)));
+			w |= (unsigned long long)(unsigned int)_mm_movemask_epi8(ws) << shift;
+			__m128i ops = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)),
+				_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, lbrace), _mm_cmpeq_epi8(v, rbrace)), _mm_or_si128(_mm_cmpeq_epi8(v, lbrack), _mm_cmpeq_epi8(v, rbrack))));
+			o |= (unsigned long long)(unsigned int)_mm_movemask_epi8(ops) << shift;
+		}
+		*pQuote = q;
+		*pBackslash = b;
+		*pSpace = w;
+		*pOp = o;
+#else
+		unsigned long long q = 0, b = 0, w = 0, o = 0;
+		for(size_t i = 0; i < 64; i++)
+		{
+			unsigned long long bit = 1ULL << i;
+			switch(pChunk[i])
+			{
+				case '"': q |= bit; break;
+				case '\\': b |= bit; break;
+				case ' ': case '\t': case '\n': case '\r': w |= bit; break;
+				case ':': case ',': case '{': case '}': case '[': case ']': o |= bit; break;
+				default: break;
+			}
+		}
+		*pQuote = q;
+		*pBackslash = b;
+		*pSpace = w;
+		*pOp = o;
+#endif
+	}
+
+	/// The first stage. Indexes the tokens in the next window of the text.
+	void scanWindow()
+	{
+		m_index.clear();
+		m_next = 0;
+		size_t windowEnd = std::min(m_len, m_scanPos + 65536);
+		char pad[64];
+		while(m_scanPos < windowEnd)
+		{
+			const char* pChunk = m_pText + m_scanPos;
+			if(m_len - m_scanPos < 64)
+			{
+				// Pad the last chunk with whitespace
+				memset(pad, ' ', 64);
+				memcpy(pad, pChunk, m_len - m_scanPos);
+				pChunk = pad;
+			}
+			unsigned long long quote, backslash, space, op;
+			classify(pChunk, &quote, &backslash, &space, &op);
+
+			// Find the escaped characters. (Backslashes are rare, so this is done one at a time.)
+			unsigned long long escaped = m_escaped ? 1 : 0;
+			m_escaped = false;
+			backslash &= ~escaped;
+			while(backslash)
+			{
+				unsigned int i = ctz(backslash);
+				backslash &= backslash - 1;
+				if(i == 63)
+					m_escaped = true;
+				else
+				{
+					unsigned long long next = 1ULL << (i + 1);
+					escaped |= next;
+					backslash &= ~next;
+				}
+			}
+			quote &= ~escaped;
+
+			// Compute the mask of the characters inside strings. (It includes the opening quote, but not the closing one.)
+			unsigned long long inside = quote;
+			inside ^= inside << 1;
+			inside ^= inside << 2;
+			inside ^= inside << 4;
+			inside ^= inside << 8;
+			inside ^= inside << 16;
+			inside ^= inside << 32;
+			if(m_inString)
+				inside = ~inside;
+			m_inString = ((inside >> 63) != 0);
+
+			// Tokens are operators, opening quotes, and the first character of each other run of characters outside strings
+			unsigned long long outside = ~inside;
+			unsigned long long sep = (space | op | quote) & outside;
+			unsigned long long other = ~(space | op | quote) & outside;
+			unsigned long long tokens = (op & outside) | (quote & inside) | (other & ((sep << 1) | (m_afterSep ? 1 : 0)));
+			m_afterSep = ((sep >> 63) != 0);
+
+			// Record the positions of the tokens
+			size_t chunkLen = std::min((size_t)64, m_len - m_scanPos);
+			if(chunkLen < 64)
+				tokens &= (1ULL << chunkLen) - 1;
+			while(tokens)
+			{
+				m_index.push_back(m_scanPos + ctz(tokens));
+				tokens &= tokens - 1;
+			}
+			m_scanPos += chunkLen;
+		}
+	}
+
+	GDomNode* parseValue(size_t pos, size_t depth)
+	{
+		if(depth > 10000)
+			error("The JSON is nested too deeply", pos);
+		char c = m_pText[pos];
+		switch(c)
+		{
+			case '{': return parseObject(pos, depth);
+			case '[': return parseList(pos, depth);
+			case '"': return parseString(pos);
+			case 't': parseWord(pos, "true"); return m_pDoc->newBool(true);
+			case 'f': parseWord(pos, "false"); return m_pDoc->newBool(false);
+			case 'n': parseWord(pos, "null"); return m_pDoc->newNull();
+			default:
+				if((c >= '0' && c <= '9') || c == '-')
+				{
+					double d;
+					long long n;
+					if(parseNumber(pos, &d, &n))
+						return m_pDoc->newDouble(d);
+					else
+						return m_pDoc->newInt(n);
+				}
+				error((string("Unexpected token, \"") + c + "\", while parsing").c_str(), pos);
+		}
+		return NULL;
+	}
+
+	/// Returns true iff the character at pos ends a scalar value
+	bool isEndOfScalar(size_t pos)
+	{
+		if(pos >= m_len)
+			return true;
+		char c = m_pText[pos];
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == ',' || c == ']' || c == '}' || c == ':';
+	}
+
+	void parseWord(size_t pos, const char* szWord)
+	{
+		size_t len = strlen(szWord);
+		if(m_len - pos < len || memcmp(m_pText + pos, szWord, len) != 0 || !isEndOfScalar(pos + len))
+			error("Unexpected token while parsing", pos);
+	}
+
+	/// Parses a number. Returns true and sets *pDouble if it is a floating point value.
+	/// Returns false and sets *pInt if it is an integer.
+	bool parseNumber(size_t pos, double* pDouble, long long* pInt)
+	{
+		static const double powersOfTen[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+		const char* p = m_pText + pos;
+		const char* pEnd = m_pText + m_len;
+		bool neg = false;
+		if(p < pEnd && *p == '-')
+		{
+			neg = true;
+			p++;
+		}
+		if(p >= pEnd || *p < '0' || *p > '9')
+			error("Invalid number", pos);
+		unsigned long long mant = 0;
+		int digits = 0; // significant digits in mant
+		int exp10 = 0;
+		bool isDouble = false;
+		bool exact = true;
+		for( ; p < pEnd && *p >= '0' && *p <= '9'; p++)
+		{
+			if(digits < 19)
+			{
+				mant = 10 * mant + (*p - '0');
+				if(mant > 0)
+					digits++;
+			}
+			else
+			{
+				exact = false;
+				exp10++;
+			}
+		}
+		if(p < pEnd && *p == '.')
+		{
+			isDouble = true;
+			p++;
+			if(p >= pEnd || *p < '0' || *p > '9')
+				error("Invalid number", pos);
+			for( ; p < pEnd && *p >= '0' && *p <= '9'; p++)
+			{
+				if(digits < 19)
+				{
+					mant = 10 * mant + (*p - '0');
+					if(mant > 0)
+						digits++;
+					exp10--;
+				}
+				else
+					exact = false;
+			}
+		}
+		if(p < pEnd && (*p == 'e' || *p == 'E'))
+		{
+			isDouble = true;
+			p++;
+			bool negExp = false;
+			if(p < pEnd && (*p == '+' || *p == '-'))
+			{
+				negExp = (*p == '-');
+				p++;
+			}
+			if(p >= pEnd || *p < '0' || *p > '9')
+				error("Invalid number", pos);
+			int e = 0;
+			for( ; p < pEnd && *p >= '0' && *p <= '9'; p++)
+			{
+				if(e < 100000)
+					e = 10 * e + (*p - '0');
+			}
+			exp10 += (negExp ? -e : e);
+		}
+		size_t end = p - m_pText;
+		if(!isEndOfScalar(end))
+			error("Invalid number", pos);
+		if(!isDouble)
+		{
+			if(exact && digits <= 18)
+			{
+				*pInt = neg ? -(long long)mant : (long long)mant;
+				return false;
+			}
+			string s(m_pText + pos, end - pos);
+#ifdef WINDOWS
+			*pInt = _atoi64(s.c_str());
+#else
+			*pInt = strtoll(s.c_str(), (char**)NULL, 10);
+#endif
+			return false;
+		}
+
+		// Values that fit in the mantissa of a double, scaled by an exact power of ten, are exactly rounded
+		if(exact && mant < (1ULL << 53) && exp10 >= -22 && exp10 <= 22)
+		{
+			double d = (double)mant;
+			if(exp10 < 0)
+				d /= powersOfTen[-exp10];
+			else
+				d *= powersOfTen[exp10];
+			*pDouble = neg ? -d : d;
+			return true;
+		}
+		// Let the C library round the rest correctly. (The text is not null-terminated, so it is copied first.)
+		char buf[64];
+		if(end - pos < sizeof(buf))
+		{
+			memcpy(buf, m_pText + pos, end - pos);
+			buf[end - pos] = '\0';
+			*pDouble = strtod(buf, (char**)NULL);
+		}
+		else
+		{
+			string s(m_pText + pos, end - pos);
+			*pDouble = strtod(s.c_str(), (char**)NULL);
+		}
+		return true;
+	}
+
+	/// Appends the UTF-8 encoding of a code point
+	static char* encodeUtf8(char* pOut, unsigned int cp)
+	{
+		if(cp < 0x80)
+			*(pOut++) = (char)cp;
+		else if(cp < 0x800)
+		{
+			*(pOut++) = (char)(0xc0 | (cp >> 6));
+			*(pOut++) = (char)(0x80 | (cp & 0x3f));
+		}
+		else if(cp < 0x10000)
+		{
+			*(pOut++) = (char)(0xe0 | (cp >> 12));
+			*(pOut++) = (char)(0x80 | ((cp >> 6) & 0x3f));
+			*(pOut++) = (char)(0x80 | (cp & 0x3f));
+		}
+		else
+		{
+			*(pOut++) = (char)(0xf0 | (cp >> 18));
+			*(pOut++) = (char)(0x80 | ((cp >> 12) & 0x3f));
+			*(pOut++) = (char)(0x80 | ((cp >> 6) & 0x3f));
+			*(pOut++) = (char)(0x80 | (cp & 0x3f));
+		}
+		return pOut;
+	}
+
+	unsigned int parseHex4(size_t pos)
+	{
+		if(m_len - pos < 4)
+			error("Invalid unicode escape", pos);
+		unsigned int n = 0;
+		for(size_t i = 0; i < 4; i++)
+		{
+			char c = m_pText[pos + i];
+			n <<= 4;
+			if(c >= '0' && c <= '9')
+				n |= (unsigned int)(c - '0');
+			else if(c >= 'a' && c <= 'f')
+				n |= (unsigned int)(c - 'a' + 10);
+			else if(c >= 'A' && c <= 'F')
+				n |= (unsigned int)(c - 'A' + 10);
+			else
+				error("Invalid unicode escape", pos);
+		}
+		return n;
+	}
+
+	/// Finds the end of the string that begins with a quote at pos. Returns the position of the closing quote,
+	/// and sets *pEscapes to whether the string contains any escape sequences.
+	size_t findEndOfString(size_t pos, bool* pEscapes)
+	{
+		*pEscapes = false;
+		size_t i = pos + 1;
+#ifdef __SSE2__
+		const __m128i quot = _mm_set1_epi8('"');
+		const __m128i bs = _mm_set1_epi8('\\');
+		while(m_len - i >= 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(m_pText + i));
+			unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quot), _mm_cmpeq_epi8(v, bs)));
+			if(mask)
+			{
+				i += ctz(mask);
+				break;
+			}
+			i += 16;
+		}
+#endif
+		while(i < m_len)
+		{
+			char c = m_pText[i];
+			if(c == '"')
+				return i;
+			else if(c == '\\')
+			{
+				*pEscapes = true;
+				i += 2;
+			}
+			else
+				i++;
+		}
+		error("Expected a matching '\"'", pos);
+		return m_len;
+	}
+
+	/// Decodes the string between pos and end (which do not include the quotes) into pOut, and returns the length
+	size_t decodeString(size_t pos, size_t end, char* pOut)
+	{
+		char* pStart = pOut;
+		for(size_t i = pos; i < end; i++)
+		{
+			char c = m_pText[i];
+			if(c != '\\')
+			{
+				*(pOut++) = c;
+				continue;
+			}
+			i++;
+			switch(m_pText[i])
+			{
+				case '"': *(pOut++) = '"'; break;
+				case '\\': *(pOut++) = '\\'; break;
+				case '/': *(pOut++) = '/'; break;
+				case 'b': *(pOut++) = '\b'; break;
+				case 'f': *(pOut++) = '\f'; break;
+				case 'n': *(pOut++) = '\n'; break;
+				case 'r': *(pOut++) = '\r'; break;
+				case 't': *(pOut++) = '\t'; break;
+				case 'u':
+					{
+						unsigned int cp = parseHex4(i + 1);
+						i += 4;
+						if(cp >= 0xd800 && cp < 0xdc00 && end - i > 6 && m_pText[i + 1] == '\\' && m_pText[i + 2] == 'u')
+						{
+							// A surrogate pair
+							unsigned int low = parseHex4(i + 3);
+							if(low >= 0xdc00 && low < 0xe000)
+							{
+								cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+								i += 6;
+							}
+						}
+						pOut = encodeUtf8(pOut, cp);
+					}
+					break;
+				default:
+					error("Unrecognized escape sequence", i - 1);
+			}
+		}
+		return pOut - pStart;
+	}
+
+	GDomNode* parseString(size_t pos)
+	{
+		bool escapes;
+		size_t end = findEndOfString(pos, &escapes);
+		if(!escapes)
+			return m_pDoc->newString(m_pText + pos + 1, end - pos - 1);
+
+		// A decoded string is never longer than its encoding
+		GDomNode* pNode = (GDomNode*)m_pDoc->m_heap.allocAligned(offsetof(Bogus1, m_double) + end - pos);
+		pNode->m_type = GDomNode::type_string;
+		size_t len = decodeString(pos + 1, end, pNode->m_value.m_string);
+		pNode->m_value.m_string[len] = '\0';
+		return pNode;
+	}
+
+	const char* parseFieldName(size_t pos)
+	{
+		bool escapes;
+		size_t end = findEndOfString(pos, &escapes);
+		if(!escapes)
+			return m_pDoc->m_heap.add(m_pText + pos + 1, end - pos - 1);
+		char* szName = m_pDoc->m_heap.allocate(end - pos);
+		szName[decodeString(pos + 1, end, szName)] = '\0';
+		return szName;
+	}
+
+	GDomNode* parseList(size_t pos, size_t depth)
+	{
+		size_t base = m_items.size();
+		pos = nextToken();
+		if(pos < m_len && m_pText[pos] == ']')
+			return m_pDoc->newList();
+		while(true)
+		{
+			if(pos >= m_len)
+				error("Expected a matching ']'", pos);
+			char c = m_pText[pos];
+			if(c == ',' || c == ']')
+				error((string("Unexpected '") + c + "'").c_str(), pos);
+			m_items.push_back(parseValue(pos, depth + 1));
+			pos = nextToken();
+			if(pos < m_len && m_pText[pos] == ',')
+				pos = nextToken();
+			else if(pos < m_len && m_pText[pos] == ']')
+				break;
+			else
+				error("Expected a ',' or ']'", pos);
+		}
+
+		// Make the list with exactly the right capacity
+		size_t count = m_items.size() - base;
+		GDomNode* pList = m_pDoc->newList(count);
+		GDomArrayList* pArrayList = pList->m_value.m_pArrayList;
+		for(size_t i = 0; i < count; i++)
+			pArrayList->m_items[i] = m_items[base + i];
+		pArrayList->m_size = count;
+		m_items.resize(base);
+		return pList;
+	}
+
+	GDomNode* parseObject(size_t pos, size_t depth)
+	{
+		GDomNode* pObj = m_pDoc->newObj();
+		pos = nextToken();
+		if(pos < m_len && m_pText[pos] == '}')
+			return pObj;
+		while(true)
+		{
+			if(pos >= m_len)
+				error("Expected a matching '}'", pos);
+			if(m_pText[pos] != '"')
+				error("Expected a '}' or a '\"'", pos);
+			GDomObjField* pField = m_pDoc->newField();
+			pField->m_pPrev = pObj->m_value.m_pLastField;
+			pObj->m_value.m_pLastField = pField;
+			pField->m_pName = parseFieldName(pos);
+			pField->m_pValue = NULL;
+			pos = nextToken();
+			if(pos >= m_len || m_pText[pos] != ':')
+				error("Expected a ':'", pos);
+			pos = nextToken();
+			if(pos >= m_len)
+				error("Expected a value", pos);
+			pField->m_pValue = parseValue(pos, depth + 1);
+			pos = nextToken();
+			if(pos < m_len && m_pText[pos] == ',')
+				pos = nextToken();
+			else if(pos < m_len && m_pText[pos] == '}')
+				break;
+			else
+				error("Expected a ',' before the next field", pos);
+		}
+		return pObj;
+	}
+};
+
+void GDom::parseJson(const char* pJsonString, size_t len)
+{
+	// Size the blocks of the heap in proportion to the document, so big documents need few allocations
+	size_t minBlockSize = m_heap.minBlockSize();
+	m_heap.setMinBlockSize(std::max(minBlockSize, std::min(len, (size_t)0x4000000)));
+	try
+	{
+		GJsonParser parser(this, pJsonString, len);
+		setRoot(parser.parse());
+	}
+	catch(...)
+	{
+		m_heap.setMinBlockSize(minBlockSize);
+		throw;
+	}
+	m_heap.setMinBlockSize(minBlockSize);
+}
+
+// static
+void GDom::parseJsonDoubles(const char* pJsonString, size_t len, std::vector<double>& out)
+{
+	GJsonParser parser(NULL, pJsonString, len);
+	parser.parseDoubles(out);
+}
+
+void GDom::loadJson(const char* szFilename)
+{
+	size_t len;
+	char* pFile = GFile::loadFile(szFilename, &len);
+	ArrayHolder<char> hFile(pFile);
+	parseJson(pFile, len);
+}
+
+void GDom::writeJson(std::ostream& stream) const
+{
+	if(!m_pRoot)
+		throw Ex("No root node has been set");
+	m_pRoot->writeJson(stream);
+}
+
+void GDom::writeJsonPretty(std::ostream& stream) const
+{
+	if(!m_pRoot)
+		throw Ex("No root node has been set");
+	stream.precision(14);
+	m_pRoot->writeJsonPretty(stream, 0);
+}
+
+void GDom::writeJsonCpp(std::ostream& stream) const
+{
+	if(!m_pRoot)
+		throw Ex("No root node has been set");
+	stream.precision(14);
+	stream << "const char* g_rename_me = \"";
+	m_pRoot->writeJsonCpp(stream, 0);
+	stream << "\";\n\n";
+}
+
+void GDom::saveJson(const char* szFilename) const
+{
+	if(GCompressor::isCompressedFilename(szFilename))
+	{
+		GCompressedOStream cs(szFilename);
+		writeJson(cs);
+		cs.close();
+		return;
+	}
+	std::ofstream os;
+	os.exceptions(std::ios::badbit | std::ios::failbit);
+	try
+	{
+		os.open(szFilename, std::ios::binary);
+	}
+	catch(const std::exception&)
+	{
+		throw Ex("Error while trying to create the file, ", szFilename, ". ", strerror(errno));
+	}
+	writeJson(os);
+}
+
+void GDom::writeXml(std::ostream& stream) const
+{
+	if(!m_pRoot)
+		throw Ex("No root node has been set");
+	stream.precision(14);
+	stream << "<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>";
+	m_pRoot->writeXml(stream, "root");
+}
+
+std::string to_str(const GDomNode& node)
+{
+	std::ostringstream os;
+	node.writeJsonPretty(os, 0);
+	return os.str();
+}
+
+std::string to_str_brief(const GDomNode& node)
+{
+	std::ostringstream os;
+	node.writeJsonPretty(os, 0);
+	std::string s = os.str();
+	if(s.length() < 60)
 		return s;
 	std::string s2 = s.substr(0, 30);
 	s2 += " ... ";
@@ -1302,6 +2633,247 @@ void GDom::test()
 		"}\n";
 	GDom doc;
 	doc.parseJson(szTestFile, strlen(szTestFile));
+	if(strcmp(doc.root()->getString("name"), "Bob\nis\\cool") != 0 || doc.root()->get("pet")->getInt("age") != 12 ||
+		doc.root()->getDouble("height") != 5.8 || !doc.root()->getBool("male") || doc.root()->get("acquantances")->size() != 3)
+		throw Ex("wrong value");
+
+	// Round-trip some random documents with tricky strings through JSON. (The strings cross the
+	// boundaries of the chunks that the parser scans, and some contain escaped quotes and backslashes.)
+	GRand rand(0);
+	for(size_t i = 0; i < 20; i++)
+	{
+		GDom d;
+		GDomNode* pObj = d.newObj();
+		d.setRoot(pObj);
+		for(size_t j = 0; j < 30; j++)
+		{
+			string str;
+			size_t len = (size_t)rand.next(150);
+			for(size_t k = 0; k < len; k++)
+			{
+				const char* szChars = "ab\\\"\n{}[],: ";
+				str += szChars[rand.next(strlen(szChars))];
+			}
+			string name = to_str(j) + str.substr(0, (size_t)rand.next(8));
+			if(rand.next(2) == 0)
+				pObj->add(&d, name.c_str(), str.c_str());
+			else
+			{
+				GDomNode* pList = pObj->add(&d, name.c_str(), d.newList());
+				for(size_t k = (size_t)rand.next(20); k > 0; k--)
+				{
+					if(rand.next(2) == 0)
+						pList->add(&d, (long long)rand.next(2000000) - 1000000);
+					else
+						pList->add(&d, rand.normal() * 1e6);
+				}
+			}
+		}
+		std::ostringstream os;
+		os.precision(17);
+		d.writeJson(os);
+		string json = os.str();
+		GDom d2;
+		d2.parseJson(json.c_str(), json.length());
+		if(!d.root()->isEqual(d2.root()))
+			throw Ex("JSON round-trip failed");
+	}
+
+	// Unicode escapes, exponents, and packed lists of doubles
+	const char* szEsc = "[\"caf\\u00e9 \\ud83d\\ude00\", 1.5e3, -2E-2, 12345678901234567890.5, -0]";
+	GDom docEsc;
+	docEsc.parseJson(szEsc, strlen(szEsc));
+	GDomListIterator itEsc(docEsc.root());
+	if(itEsc.remaining() != 5 || strcmp(itEsc.currentString(), "caf\xc3\xa9 \xf0\x9f\x98\x80") != 0)
+		throw Ex("wrong value");
+	const double escValues[] = { 1500.0, -0.02, 12345678901234567890.5 };
+	for(size_t i = 0; i < 3; i++)
+	{
+		itEsc.advance();
+		if(itEsc.currentDouble() != escValues[i])
+			throw Ex("wrong value");
+	}
+	itEsc.advance();
+	if(itEsc.current()->type() != GDomNode::type_int || itEsc.currentInt() != 0)
+		throw Ex("wrong value");
+	std::vector<double> values;
+	GDom::parseJsonDoubles(" [ 0.25 , -3,\n4e-1 ] ", 22, values);
+	if(values.size() != 3 || values[0] != 0.25 || values[1] != -3.0 || values[2] != 0.4)
+		throw Ex("wrong values");
+
+	// Malformed documents must be rejected
+	const char* badDocs[] = { "[1,]", "{\"a\" 1}", "[1 2]", "[tru]", "{\"a\":\"b}", "[1.]", "[--1]", "{\"a\":1,}", "[12abc]", "" };
+	for(size_t i = 0; i < sizeof(badDocs) / sizeof(const char*); i++)
+	{
+		bool threw = false;
+		try
+		{
+			GExpectException ee;
+			GDom bad;
+			bad.parseJson(badDocs[i], strlen(badDocs[i]));
+		}
+		catch(...)
+		{
+			threw = true;
+		}
+		if(!threw)
+			throw Ex("expected a malformed document to throw: ", badDocs[i]);
+	}
+
+	// Round-trip through the binary encoding, with a packed list of doubles and a long string
+	GDomNode* pVec = doc.root()->add(&doc, "vec", doc.newList());
+	for(size_t i = 0; i < 10; i++)
+		pVec->add(&doc, 0.1 * i - 0.35);
+	doc.root()->add(&doc, "big", (long long)-1234567890123LL);
+	string longString(1000, 'x');
+	doc.root()->add(&doc, "long", longString.c_str());
+	doc.root()->add(&doc, "nothing", doc.newNull());
+	GDomBinaryWriter writer;
+	writer.write(doc.root());
+	if(writer.segmentCount() != 3)
+		throw Ex("expected the long string to be gathered from its node");
+	string enc;
+	writer.toString(enc);
+	if(!GDom::isBinary(enc.data(), enc.length()) || GDom::isBinary(szTestFile, strlen(szTestFile)))
+		throw Ex("failed to tell the formats apart");
+	GDom doc2;
+	doc2.parseBinary(enc.data(), enc.length());
+	if(!doc.root()->isEqual(doc2.root()) || to_str(doc) != to_str(doc2))
+		throw Ex("binary round-trip failed");
+	GDomListIterator itAcq(doc2.root()->get("acquantances"));
+	for(size_t i = 0; i < 2; i++)
+		itAcq.advance();
+	if(itAcq.remaining() == 0 || strcmp(itAcq.current()->getString("name"), "George") != 0)
+		throw Ex("wrong field");
+	GDomListIterator itVec(doc2.root()->get("vec"));
+	if(itVec.remaining() != 10)
+		throw Ex("wrong field");
+	for(size_t i = 0; itVec.remaining() > 0; i++)
+	{
+		if(itVec.currentDouble() != 0.1 * i - 0.35)
+			throw Ex("wrong field");
+		itVec.advance();
+	}
+
+	// Truncated encodings must be rejected
+	GDom doc3;
+	for(size_t i = 2; i < enc.length(); i += 97)
+	{
+		bool threw = false;
+		try
+		{
+			GExpectException ee;
+			doc3.parseBinary(enc.data(), i);
+		}
+		catch(...)
+		{
+			threw = true;
+		}
+		if(!threw)
+			throw Ex("expected a truncated encoding to throw");
+	}
+}
+
+// static
+void GJsonWriter::test()
+{
+	// Check some values with known shortest representations
+	const double vals[] = { 0.1, 1.0, -2.5, 1e21, 1e-7, 5e-324, 1.7976931348623157e308, 123456.789, 0.001, 1e14, 1e16, -0.0, 2.2250738585072014e-308, 100.0, 0.3 };
+	const char* strs[] = { "0.1", "1.0", "-2.5", "1e+21", "1e-07", "5e-324", "1.7976931348623157e+308", "123456.789", "0.001", "100000000000000.0", "1e+16", "-0.0", "2.2250738585072014e-308", "100.0", "0.3" };
+	char buf[32];
+	for(size_t i = 0; i < sizeof(vals) / sizeof(double); i++)
+	{
+		size_t len = formatDouble(vals[i], buf);
+		if(std::string(buf, len).compare(strs[i]) != 0)
+			throw Ex("Expected ", strs[i], ". Got ", std::string(buf, len));
+	}
+
+	// Make sure random values round-trip exactly
+	GRand rand(0);
+	for(size_t i = 0; i < 200000; i++)
+	{
+		double d;
+		if(i & 1)
+		{
+			uint64_t bits = rand.next();
+			if(((bits >> 52) & 0x7ff) == 0x7ff)
+				continue; // Skip infinities and NaNs (without touching them, since comparing a signaling NaN traps)
+			memcpy(&d, &bits, sizeof(double));
+		}
+		else
+			d = rand.normal() * std::pow(10.0, (double)rand.next(40) - 20.0);
+		size_t len = formatDouble(d, buf);
+		buf[len] = '\0';
+		if(strtod(buf, NULL) != d || (d == 0.0 && std::signbit(d) != std::signbit(strtod(buf, NULL))))
+			throw Ex("The value ", buf, " did not round-trip");
+		if(!strchr(buf, '.') && !strchr(buf, 'e'))
+			throw Ex("The value ", buf, " would be parsed as an integer");
+		if(len > 24)
+			throw Ex("Too many digits in ", buf);
+	}
+
+	// Stream a document, and make sure it parses back correctly
+	std::ostringstream os;
+	std::vector<double> big;
+	for(size_t i = 0; i < 10000; i++)
+		big.push_back(rand.normal() * 1e6);
+	{
+		GJsonWriter w(os);
+		w.beginObj();
+		w.key("name"); w.writeString("Tab\there \"quoted\" \\ \x01");
+		w.key("n"); w.writeInt(-9223372036854775807LL - 1);
+		w.key("ok"); w.writeBool(true);
+		w.key("nothing"); w.writeNull();
+		w.key("empty"); w.beginList(); w.endList();
+		w.key("obj"); w.beginObj(); w.key("x"); w.writeDouble(0.5); w.endObj();
+		w.key("big"); w.writeDoubles(big.data(), big.size());
+		w.endObj();
+	}
+	std::string s = os.str();
+	GDom doc;
+	doc.parseJson(s.c_str(), s.length());
+	const GDomNode* pRoot = doc.root();
+	if(strcmp(pRoot->getString("name"), "Tab\there \"quoted\" \\ \x01") != 0)
+		throw Ex("string mismatch");
+	if(pRoot->getInt("n") != -9223372036854775807LL - 1)
+		throw Ex("int mismatch");
+	if(!pRoot->getBool("ok") || pRoot->get("nothing")->type() != GDomNode::type_null || pRoot->get("empty")->size() != 0)
+		throw Ex("value mismatch");
+	if(pRoot->get("obj")->getDouble("x") != 0.5)
+		throw Ex("nested value mismatch");
+	const GDomNode* pBig = pRoot->get("big");
+	if(pBig->size() != big.size())
+		throw Ex("wrong size");
+	for(size_t i = 0; i < big.size(); i++)
+	{
+		if(pBig->get(i)->asDouble() != big[i])
+			throw Ex("double mismatch");
+	}
+
+	// Writing the DOM should reproduce the same text
+	std::ostringstream os2;
+	doc.writeJson(os2);
+	if(os2.str().compare(s) != 0)
+		throw Ex("The text did not round-trip");
+
+	// Mismatched containers should throw
+	{
+		GExpectException ee;
+		std::ostringstream os3;
+		GJsonWriter w(os3);
+		w.beginList();
+		bool threw = false;
+		try
+		{
+			w.endObj();
+		}
+		catch(...)
+		{
+			threw = true;
+		}
+		if(!threw)
+			throw Ex("Expected mismatched containers to throw");
+	}
 }
 
 
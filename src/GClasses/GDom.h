@@ -24,6 +24,8 @@
 #include "GHeap.h"
 #include "GString.h"
 #include <iostream>
+#include <vector>
+#include <map>
 
 namespace GClasses {
 
@@ -31,7 +33,8 @@ class GDomNode;
 class GDom;
 class GDomObjField;
 class GDomArrayList;
-class GJsonTokenizer;
+class GDomBinaryWriter;
+class GJsonParser;
 
 
 #ifdef WINDOWS
@@ -90,6 +93,9 @@ class GDomNode
 {
 friend class GDom;
 friend class GDomListIterator;
+friend class GDomBinaryWriter;
+friend class GJsonParser;
+friend class GJsonWriter;
 public:
 	enum nodetype
 	{
@@ -315,6 +321,7 @@ protected:
 class GDom
 {
 friend class GDomNode;
+friend class GJsonParser;
 protected:
 	GHeap m_heap;
 	GDomNode* m_pRoot;
@@ -336,12 +343,29 @@ public:
 	void loadJson(const char* szFilename);
 
 	/// Saves to a file in JSON format. (See http://json.org.)
+	/// If szFilename ends with ".gcz", the file is compressed with GCompressedOStream. (loadJson decompresses it automatically.)
 	void saveJson(const char* szFilename) const;
 
 	/// Parses a JSON string. The resulting DOM can be retrieved by calling root().
+	/// (The text is indexed in 64-byte chunks with SIMD instructions when they are available,
+	/// and the nodes are built directly from the index, so this is fast even for very big documents.)
 	void parseJson(const char* pJsonString, size_t len);
 
+	/// Parses a JSON list of numbers, such as "[1.5,-2,3e4]", directly into out without building any nodes.
+	/// Throws an exception if the text is not a list of numbers.
+	static void parseJsonDoubles(const char* pJsonString, size_t len, std::vector<double>& out);
+
+	/// Decodes a DOM that was encoded by GDomBinaryWriter. The resulting DOM can be retrieved by calling root().
+	/// The data is decoded directly from pData. (It is not modified, and it is not needed after this returns.)
+	/// Throws an exception if the data is truncated or malformed.
+	void parseBinary(const char* pData, size_t len);
+
+	/// Returns true iff pData begins with the marker that GDomBinaryWriter puts at the start of an encoding.
+	/// (JSON text never begins with this marker, so this can be used to tell the two formats apart.)
+	static bool isBinary(const char* pData, size_t len);
+
 	/// Writes this doc to the specified stream in JSON format. (See http://json.org.)
+	/// Doubles are written with just enough digits to parse back to exactly the same values. (See GJsonWriter.)
 	/// (If you want to write to a memory buffer, you can use open_memstream.)
 	void writeJson(std::ostream& stream) const;
 
@@ -397,11 +421,161 @@ public:
 
 protected:
 	GDomObjField* newField();
-	GDomNode* loadJsonObject(GJsonTokenizer& tok);
-	GDomNode* loadJsonArray(GJsonTokenizer& tok);
-	GDomNode* loadJsonNumber(GJsonTokenizer& tok);
-	GDomNode* loadJsonValue(GJsonTokenizer& tok);
-	char* loadJsonString(GJsonTokenizer& tok);
+	GDomNode* newList(size_t capacity);
+	GDomNode* loadBinaryValue(const unsigned char*& pData, const unsigned char* pEnd, std::vector<const char*>& names, size_t depth);
+};
+
+
+/// Encodes a DOM in a compact binary format that GDom::parseBinary decodes. This is much cheaper to produce
+/// and to consume than JSON. Integers are written as zig-zag varints, doubles are written as raw 8-byte values
+/// (in the byte order of the host), a list that contains only doubles is written as one packed array, and each
+/// distinct field name is written only once, after which it is referred to by its index. Long strings are not
+/// copied into the encoding. Instead, the encoding is a sequence of segments, some of which point directly into
+/// the nodes, so it can be sent with a single scatter/gather call. (See GPackageClient::send.)
+class GDomBinaryWriter
+{
+protected:
+	std::vector<char> m_buf;
+	std::vector<const char*> m_external; // The external data for each segment, or NULL if the segment is in m_buf
+	std::vector<size_t> m_starts; // The start of each segment in m_buf
+	std::vector<size_t> m_lens;
+	std::vector<const char*> m_segments;
+	std::map<std::string, size_t> m_names;
+	size_t m_size;
+
+public:
+	GDomBinaryWriter();
+	~GDomBinaryWriter();
+
+	/// Encodes pNode and all of its descendants. The encoding remains valid until the next call to write,
+	/// or until any of the nodes are modified or destroyed.
+	void write(const GDomNode* pNode);
+
+	/// Returns the total number of bytes in the encoding.
+	size_t size() const { return m_size; }
+
+	/// Returns the number of segments in the encoding.
+	size_t segmentCount() const { return m_segments.size(); }
+
+	/// Returns an array of pointers to the segments of the encoding.
+	const char* const* segments() const { return m_segments.size() > 0 ? &m_segments[0] : NULL; }
+
+	/// Returns an array of the sizes of the segments of the encoding.
+	const size_t* segmentSizes() const { return m_lens.size() > 0 ? &m_lens[0] : NULL; }
+
+	/// Copies the whole encoding into one contiguous string.
+	void toString(std::string& out) const;
+
+protected:
+	void writeByte(unsigned char b) { m_buf.push_back((char)b); }
+	void writeVarInt(unsigned long long n);
+	void writeBytes(const void* p, size_t len);
+	void writeExternal(const char* p, size_t len);
+	void writeNode(const GDomNode* pNode);
+};
+
+
+#define GJSONWRITER_BUF_SIZE 65536
+
+/// Writes JSON text directly to a stream as the values are produced, so a big object (such as a model with
+/// millions of weights) can be serialized without first building a DOM of the whole thing. The text is
+/// collected in a buffer that is written to the stream whenever it fills up. Commas and colons are inserted
+/// automatically. Doubles are written with the shortest decimal representation that parses back to exactly
+/// the same value. Example usage:
+///
+///   GJsonWriter w(std::cout);
+///   w.beginObj();
+///   w.key("name"); w.writeString("weights");
+///   w.key("vals"); w.writeDoubles(weights.data(), weights.size());
+///   w.endObj();
+///   w.flush();
+class GJsonWriter
+{
+protected:
+	std::ostream& m_stream;
+	char* m_pBuf;
+	size_t m_pos;
+	std::vector<char> m_stack; // The opening character of each container that has not been closed yet
+	bool m_needComma;
+
+public:
+	/// Text is written to stream.
+	GJsonWriter(std::ostream& stream);
+
+	/// Flushes any text that remains in the buffer.
+	~GJsonWriter();
+
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
+	/// Begins an object. Each value in the object must be preceded by a call to key.
+	void beginObj();
+
+	/// Ends the current object.
+	void endObj();
+
+	/// Begins a list.
+	void beginList();
+
+	/// Ends the current list.
+	void endList();
+
+	/// Writes the name of the next field in the current object.
+	void key(const char* szName);
+
+	/// Writes a null value.
+	void writeNull();
+
+	/// Writes a boolean value.
+	void writeBool(bool b);
+
+	/// Writes an integer value.
+	void writeInt(long long n);
+
+	/// Writes a double value. Throws an exception if d is not finite.
+	void writeDouble(double d);
+
+	/// Writes a null-terminated string value.
+	void writeString(const char* szString);
+
+	/// Writes a list of count doubles.
+	void writeDoubles(const double* pValues, size_t count);
+
+	/// Writes pNode and all of its descendants.
+	void writeNode(const GDomNode* pNode);
+
+	/// Writes all of the fields of the object pObj into the current object. (This is useful for
+	/// writing the small parts of an object from a DOM, and then streaming the big parts.)
+	void writeFields(const GDomNode* pObj);
+
+	/// Writes the buffered text to the stream.
+	void flush();
+
+	/// Writes a short decimal representation of d that parses back to exactly d into pOut, and returns
+	/// the number of chars written. (It is not null-terminated.) pOut must have room for at least 32 chars.
+	/// The representation always contains a '.' or an exponent, so it will be parsed as a double. This uses
+	/// the Grisu2 algorithm, which finds the shortest representation for all but about 0.1% of values (and
+	/// one digit more for the rest), and is much faster than printing with 17 digits of precision. d must be finite.
+	static size_t formatDouble(double d, char* pOut);
+
+protected:
+	/// Makes sure there is room for n more chars in the buffer.
+	void reserve(size_t n)
+	{
+		if(m_pos + n > GJSONWRITER_BUF_SIZE)
+			flush();
+	}
+
+	/// Writes a comma if the next value is not the first one in its container.
+	void separate()
+	{
+		reserve(1);
+		if(m_needComma)
+			m_pBuf[m_pos++] = ',';
+	}
+
+	void writeRaw(const char* pText, size_t len);
+	void writeQuoted(const char* szString);
 };
 
 
@@ -23,6 +23,7 @@
 #include "GString.h"
 #include "GApp.h"
 #include "GBitTable.h"
+#include "GThread.h"
 #ifdef WINDOWS
 #	include <windows.h>
 #	include <shlobj.h> // to get users' application data dir
@@ -46,6 +47,10 @@
 #include <memory>
 #include <set>
 #include <map>
+#include <thread>
+#include <algorithm>
+#include <ctype.h>
+#include <cmath>
 
 
 using namespace GClasses;
@@ -379,9 +384,39 @@ bool GFile::localStorageDirectory(char *toHere)
 
 /*static*/ char* GFile::loadFile(const char* szFilename, size_t* pnSize)
 {
+	if(GCompressor::isCompressedFile(szFilename))
+	{
+		GCompressedIStream cs(szFilename);
+		*pnSize = (size_t)cs.size();
+		std::unique_ptr<char[]> hBuf(new char[*pnSize + 1]);
+		cs.read(hBuf.get(), *pnSize);
+		if((size_t)cs.gcount() != *pnSize)
+			throw Ex("Error while trying to read the file, ", szFilename);
+		hBuf[*pnSize] = '\0';
+		return hBuf.release();
+	}
 	std::ifstream s;
 	char* pBuf;
 	s.exceptions(std::ios::badbit | std::ios::failbit);
+	struct stat st;
+	if(stat(szFilename, &st) == 0 && (st.st_mode & S_IFMT) == S_IFREG)
+	{
+		// Regular files are read straight into the returned buffer, so large files are only held once
+		try
+		{
+			s.open(szFilename, std::ios::binary);
+			*pnSize = (size_t)st.st_size;
+			std::unique_ptr<char[]> hBuf(new char[*pnSize + 1]);
+			s.read(hBuf.get(), *pnSize);
+			hBuf[*pnSize] = '\0';
+			s.close();
+			return hBuf.release();
+		}
+		catch(const std::exception&)
+		{
+			throw Ex("Error while trying to read the file, ", szFilename, ". ", strerror(errno));
+		}
+	}
 	try
 	{
 		// NB: we double copy the content of the file!
@@ -631,7 +666,7 @@ unsigned char* compressWorker(unsigned char* pData, unsigned int len, unsigned i
 	// Build a map that counts how often all the pieces occur
 	GAssert(keySize > 0); // key size must be more than 0
 	GAssert(pieceSize > keySize && pieceSize <= 255); // piece size must be more than key size and less than 256
-	GAssert(len <= ((unsigned int)1 << (keySize * 8 - 1))); // len too big for this keySize
+	GAssert(keySize < 3 || len <= ((unsigned int)1 << (keySize * 8 - 1))); // len too big for this keySize (short keys are chosen from values that do not occur instead)
 	CompressPieceComparer cpc1(pieceSize);
 	map<unsigned char*,unsigned char,CompressPieceComparer> pieces(cpc1); // map from offset to number of occurrences
 	CompressPieceComparer cpc2(keySize);
@@ -677,13 +712,16 @@ unsigned char* compressWorker(unsigned char* pData, unsigned int len, unsigned i
 	while(minOccurrences < 255 && keySize + pieceSize >= minOccurrences * (pieceSize - keySize)) // while the cost is more than the savings
 		minOccurrences++;
 	map<unsigned char*,unsigned char*,CompressPieceComparer> fops(cpc1); // map from frequently occurring pieces to the corresponding key index
+	size_t maxKeys = 65535;
+	if(keySize <= 2) // Every piece needs a key that does not occur in the data, and there are not many of those with short keys
+		maxKeys = std::min(maxKeys, ((size_t)1 << (keySize * 8)) - nonKeys.size());
 	for(map<unsigned char*,unsigned char,CompressPieceComparer>::iterator it = pieces.begin(); it != pieces.end(); it++)
 	{
 		if(it->second >= minOccurrences)
 		{
-			fops.insert(make_pair(it->first, (unsigned char*)NULL));
-			if(fops.size() >= 65535)
+			if(fops.size() >= maxKeys)
 				break;
+			fops.insert(make_pair(it->first, (unsigned char*)NULL));
 		}
 	}
 	if(fops.size() == 0)
@@ -772,6 +810,13 @@ unsigned char* compressWorker(unsigned char* pData, unsigned int len, unsigned i
 const unsigned char g_pieceSizes[] = { 18, 12, 7, 6, 5, 4, 3, 2 };
 #define PIECE_SIZE_COUNT 8
 
+// The framed format begins and ends with this magic number
+#define GCZ_MAGIC "GCZ1"
+#define GCZ_MAGIC_SIZE 4
+
+// The number of blocks that each worker thread compresses or decompresses in each batch
+#define GCZ_BLOCKS_PER_THREAD 16
+
 unsigned int GCompressor_chooseKeySize(unsigned char* pIn, unsigned int len)
 {
 	// try 1
@@ -822,6 +867,16 @@ unsigned int GCompressor_chooseKeySize(unsigned char* pIn, unsigned int len)
 	return keySize;
 }
 
+unsigned int uncompressWorker(unsigned char* pIn, unsigned int inLen, unsigned char* pOut, unsigned int outLen);
+
+// Returns true iff one pass of compressed data uncompresses to pOrig. (With keys of more than one byte, a literal
+// byte followed by the start of a key can look like another key, so a pass is only kept if it can be read back.)
+bool GCompressor_verify(unsigned char* pCompressed, unsigned int len, unsigned char* pOrig, unsigned int origLen)
+{
+	std::unique_ptr<unsigned char[]> hBuf(new unsigned char[origLen]);
+	return uncompressWorker(pCompressed, len, hBuf.get(), origLen) == origLen && memcmp(hBuf.get(), pOrig, origLen) == 0;
+}
+
 // static
 unsigned char* GCompressor::compress(unsigned char* pIn, unsigned int len, unsigned int* pOutNewLen)
 {
@@ -836,6 +891,11 @@ unsigned char* GCompressor::compress(unsigned char* pIn, unsigned int len, unsig
 			break;
 		unsigned char* pOldOut = pOut;
 		pOut = compressWorker(pIn, len, &newLen, keySize, (unsigned int)pieceSize, origLen);
+		if(pOut && !GCompressor_verify(pOut + sizeof(unsigned int), newLen - sizeof(unsigned int), pIn, len))
+		{
+			delete[] pOut;
+			pOut = NULL;
+		}
 		if(pOut)
 		{
 			delete[] pOldOut;
@@ -857,27 +917,28 @@ unsigned char* GCompressor::compress(unsigned char* pIn, unsigned int len, unsig
 	return pOut;
 }
 
+// Returns the uncompressed length, or 0 if the data is invalid
 unsigned int uncompressWorker(unsigned char* pIn, unsigned int inLen, unsigned char* pOut, unsigned int outLen)
 {
 	// Read the key size
 	if(inLen < sizeof(unsigned char))
-		throw Ex("invalid data");
+		return 0;
 	unsigned int keySize = (unsigned int)*pIn;
 	pIn++;
 	inLen--;
 
 	// Read the piece size
 	if(inLen < sizeof(unsigned char))
-		throw Ex("invalid data");
+		return 0;
 	unsigned int pieceSize = (unsigned int)*pIn;
 	pIn++;
 	inLen--;
 	if(keySize >= pieceSize)
-		throw Ex("invalid data");
+		return 0;
 
 	// Read the number of table entries
 	if(inLen < sizeof(unsigned short))
-		throw Ex("invalid data");
+		return 0;
 	unsigned int origLen = inLen;
 	unsigned short keyCount = *(unsigned short*)pIn;
 	pIn += sizeof(unsigned short);
@@ -889,7 +950,7 @@ unsigned int uncompressWorker(unsigned char* pIn, unsigned int inLen, unsigned c
 	for(unsigned short i = 0; i < keyCount; i++)
 	{
 		if(inLen < keySize + pieceSize)
-			throw Ex("invalid data");
+			return 0;
 		unsigned char* pKey = pIn;
 		pIn += keySize;
 		inLen -= keySize;
@@ -911,7 +972,7 @@ unsigned int uncompressWorker(unsigned char* pIn, unsigned int inLen, unsigned c
 		if(it == table.end())
 		{
 			if(outLen < 1)
-				throw Ex("invalid data");
+				return 0;
 			*(pOut++) = *(pIn++);
 			inLen--;
 			outLen--;
@@ -920,7 +981,7 @@ unsigned int uncompressWorker(unsigned char* pIn, unsigned int inLen, unsigned c
 		else
 		{
 			if(outLen < pieceSize)
-				throw Ex("invalid data");
+				return 0;
 			memcpy(pOut, it->second, pieceSize);
 			pIn += keySize;
 			inLen -= keySize;
@@ -930,7 +991,7 @@ unsigned int uncompressWorker(unsigned char* pIn, unsigned int inLen, unsigned c
 		}
 	}
 	if(newLen <= origLen)
-		throw Ex("invalid data");
+		return 0;
 	return newLen;
 }
 
@@ -962,7 +1023,7 @@ unsigned char* GCompressor::uncompress(unsigned char* pIn, unsigned int len, uns
 	while(true)
 	{
 		unsigned int newLen = uncompressWorker(pCur, len, pOut, origLen);
-		if(newLen <= len)
+		if(newLen == 0 || newLen <= len)
 			throw Ex("invalid data");
 		if(newLen > origLen)
 			throw Ex("invalid data");
@@ -983,6 +1044,549 @@ unsigned char* GCompressor::uncompress(unsigned char* pIn, unsigned int len, uns
 		return hCur.release();
 }
 
+// static
+bool GCompressor::isCompressedFile(const char* szFilename)
+{
+	// Only peek at regular files, because reading from a named pipe would consume the data
+	struct stat st;
+	if(stat(szFilename, &st) != 0 || (st.st_mode & S_IFMT) != S_IFREG)
+		return false;
+	std::ifstream s(szFilename, std::ios::binary);
+	char magic[GCZ_MAGIC_SIZE];
+	s.read(magic, GCZ_MAGIC_SIZE);
+	return s.gcount() == GCZ_MAGIC_SIZE && memcmp(magic, GCZ_MAGIC, GCZ_MAGIC_SIZE) == 0;
+}
+
+// static
+bool GCompressor::isCompressedFilename(const char* szFilename)
+{
+	size_t len = strlen(szFilename);
+	if(len < 4)
+		return false;
+	const char* szExt = szFilename + len - 4;
+	return szExt[0] == '.' && tolower(szExt[1]) == 'g' && tolower(szExt[2]) == 'c' && tolower(szExt[3]) == 'z';
+}
+
+size_t GCompressor_workerThreads(size_t n)
+{
+	if(n == 0)
+		n = std::thread::hardware_concurrency();
+	return std::max((size_t)1, n);
+}
+
+namespace GClasses {
+
+class GCompressedOStreamBufWorker : public GWorkerThread
+{
+protected:
+	GCompressedOStreamBuf& m_buf;
+
+public:
+	GCompressedOStreamBufWorker(GMasterThread& master, GCompressedOStreamBuf& buf)
+	: GWorkerThread(master), m_buf(buf)
+	{
+	}
+
+	virtual ~GCompressedOStreamBufWorker()
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		m_buf.compressBlock(jobId);
+	}
+};
+
+class GCompressedIStreamBufWorker : public GWorkerThread
+{
+protected:
+	GCompressedIStreamBuf& m_buf;
+
+public:
+	GCompressedIStreamBufWorker(GMasterThread& master, GCompressedIStreamBuf& buf)
+	: GWorkerThread(master), m_buf(buf)
+	{
+	}
+
+	virtual ~GCompressedIStreamBufWorker()
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		m_buf.uncompressBlock(jobId);
+	}
+};
+
+} // namespace GClasses
+
+GCompressedOStreamBuf::GCompressedOStreamBuf(std::ostream& out, size_t workerThreads, size_t blockSize)
+: m_out(out),
+m_blockSize(blockSize),
+m_workerThreads(GCompressor_workerThreads(workerThreads)),
+m_batchBytes(0),
+m_pos(GCZ_MAGIC_SIZE),
+m_closed(false),
+m_pMaster(NULL)
+{
+	if(blockSize == 0 || blockSize > 0x7fffffff)
+		throw Ex("Invalid block size");
+	m_buf.resize(m_blockSize * m_workerThreads * GCZ_BLOCKS_PER_THREAD);
+	setp(m_buf.data(), m_buf.data() + m_buf.size());
+	m_out.write(GCZ_MAGIC, GCZ_MAGIC_SIZE);
+}
+
+GCompressedOStreamBuf::~GCompressedOStreamBuf()
+{
+	if(!m_closed)
+	{
+		try
+		{
+			close();
+		}
+		catch(...)
+		{
+		}
+	}
+	delete(m_pMaster);
+}
+
+void GCompressedOStreamBuf::close()
+{
+	if(m_closed)
+		return;
+	m_closed = true;
+	size_t used = pptr() - pbase();
+	if(used > 0)
+		flushBlocks(used);
+	setp(NULL, NULL);
+
+	// Write the index, followed by the number of blocks, the position of the index, and the magic number again
+	if(m_index.size() > 0)
+		m_out.write((const char*)m_index.data(), m_index.size() * sizeof(uint32_t));
+	uint64_t trailer[2];
+	trailer[0] = m_index.size() / 2;
+	trailer[1] = m_pos;
+	m_out.write((const char*)trailer, sizeof(trailer));
+	m_out.write(GCZ_MAGIC, GCZ_MAGIC_SIZE);
+	m_out.flush();
+}
+
+void GCompressedOStreamBuf::flushBlocks(size_t bytes)
+{
+	// Compress the blocks in parallel
+	size_t blocks = (bytes + m_blockSize - 1) / m_blockSize;
+	m_batchBytes = bytes;
+	m_compressed.assign(blocks, NULL);
+	m_compressedLen.assign(blocks, 0);
+	if(blocks == 1)
+		compressBlock(0); // Small streams do not need to start the workers
+	else
+	{
+		if(!m_pMaster)
+		{
+			m_pMaster = new GMasterThread();
+			for(size_t i = 0; i < m_workerThreads; i++)
+				m_pMaster->addWorker(new GCompressedOStreamBufWorker(*m_pMaster, *this));
+		}
+		m_pMaster->doJobs(blocks);
+	}
+
+	// Write them in order
+	std::vector< std::unique_ptr<unsigned char[]> > hCompressed(blocks);
+	for(size_t i = 0; i < blocks; i++)
+		hCompressed[i].reset(m_compressed[i]);
+	for(size_t i = 0; i < blocks; i++)
+	{
+		m_out.write((const char*)m_compressed[i], m_compressedLen[i]);
+		m_pos += m_compressedLen[i];
+		m_index.push_back((uint32_t)m_compressedLen[i]);
+		m_index.push_back((uint32_t)std::min(m_blockSize, bytes - i * m_blockSize));
+	}
+	m_compressed.clear();
+
+	// Move any remaining bytes to the front of the buffer
+	size_t remaining = pptr() - pbase() - bytes;
+	memmove(m_buf.data(), pbase() + bytes, remaining);
+	setp(m_buf.data(), m_buf.data() + m_buf.size());
+	pbump((int)remaining);
+}
+
+void GCompressedOStreamBuf::compressBlock(size_t block)
+{
+	size_t start = block * m_blockSize;
+	unsigned int len = (unsigned int)std::min(m_blockSize, m_batchBytes - start);
+	m_compressed[block] = GCompressor::compress((unsigned char*)m_buf.data() + start, len, &m_compressedLen[block]);
+}
+
+// virtual
+GCompressedOStreamBuf::int_type GCompressedOStreamBuf::overflow(int_type c)
+{
+	if(m_closed)
+		return traits_type::eof();
+	flushBlocks(pptr() - pbase());
+	if(!traits_type::eq_int_type(c, traits_type::eof()))
+	{
+		*pptr() = traits_type::to_char_type(c);
+		pbump(1);
+	}
+	return traits_type::not_eof(c);
+}
+
+// virtual
+int GCompressedOStreamBuf::sync()
+{
+	if(m_closed)
+		return 0;
+
+	// Partial blocks are held until close, so flushing often does not make the blocks small
+	size_t used = pptr() - pbase();
+	size_t full = used - used % m_blockSize;
+	if(full > 0)
+		flushBlocks(full);
+	m_out.flush();
+	return 0;
+}
+
+
+
+GCompressedIStreamBuf::GCompressedIStreamBuf(std::istream& in, size_t workerThreads)
+: m_in(in),
+m_workerThreads(GCompressor_workerThreads(workerThreads)),
+m_firstBlock(0),
+m_batchBlocks(0),
+m_pMaster(NULL)
+{
+	// Check the magic numbers
+	m_in.seekg(0, std::ios::end);
+	uint64_t fileSize = (uint64_t)m_in.tellg();
+	if(m_in.fail() || fileSize < GCZ_MAGIC_SIZE + 2 * sizeof(uint64_t) + GCZ_MAGIC_SIZE)
+		throw Ex("Not a compressed stream");
+	char magic[GCZ_MAGIC_SIZE];
+	m_in.seekg(0);
+	m_in.read(magic, GCZ_MAGIC_SIZE);
+	if(m_in.fail() || memcmp(magic, GCZ_MAGIC, GCZ_MAGIC_SIZE) != 0)
+		throw Ex("Not a compressed stream");
+	uint64_t trailer[2];
+	m_in.seekg(fileSize - sizeof(trailer) - GCZ_MAGIC_SIZE);
+	m_in.read((char*)trailer, sizeof(trailer));
+	m_in.read(magic, GCZ_MAGIC_SIZE);
+	if(m_in.fail() || memcmp(magic, GCZ_MAGIC, GCZ_MAGIC_SIZE) != 0)
+		throw Ex("The compressed stream is truncated");
+	uint64_t blocks = trailer[0];
+	uint64_t indexPos = trailer[1];
+	if(indexPos < GCZ_MAGIC_SIZE || blocks > fileSize / (2 * sizeof(uint32_t)) || indexPos + blocks * 2 * sizeof(uint32_t) + sizeof(trailer) + GCZ_MAGIC_SIZE != fileSize)
+		throw Ex("Invalid compressed stream");
+
+	// Read the index
+	std::vector<uint32_t> index((size_t)blocks * 2);
+	m_in.seekg(indexPos);
+	if(blocks > 0)
+		m_in.read((char*)index.data(), index.size() * sizeof(uint32_t));
+	if(m_in.fail())
+		throw Ex("Failed to read the index of the compressed stream");
+	m_blockPos.resize((size_t)blocks + 1);
+	m_blockStart.resize((size_t)blocks + 1);
+	m_blockPos[0] = GCZ_MAGIC_SIZE;
+	m_blockStart[0] = 0;
+	for(size_t i = 0; i < blocks; i++)
+	{
+		if(index[2 * i + 1] == 0)
+			throw Ex("Invalid compressed stream");
+		m_blockPos[i + 1] = m_blockPos[i] + index[2 * i];
+		m_blockStart[i + 1] = m_blockStart[i] + index[2 * i + 1];
+	}
+	if(m_blockPos[(size_t)blocks] != indexPos)
+		throw Ex("Invalid compressed stream");
+	setg(NULL, NULL, NULL);
+}
+
+GCompressedIStreamBuf::~GCompressedIStreamBuf()
+{
+	delete(m_pMaster);
+}
+
+void GCompressedIStreamBuf::loadBatch(size_t block)
+{
+	// Read the compressed blocks
+	size_t count = std::min(m_workerThreads * GCZ_BLOCKS_PER_THREAD, blocks() - block);
+	m_firstBlock = block;
+	m_batchBlocks = count;
+	setg(NULL, NULL, NULL);
+	m_compressed.resize((size_t)(m_blockPos[block + count] - m_blockPos[block]));
+	m_in.clear();
+	m_in.seekg(m_blockPos[block]);
+	m_in.read(m_compressed.data(), m_compressed.size());
+	if(m_in.fail())
+		throw Ex("Failed to read the compressed stream");
+
+	// Decompress them in parallel
+	m_buf.resize((size_t)(m_blockStart[block + count] - m_blockStart[block]));
+	m_failed.assign(count, 0);
+	if(count == 1)
+		uncompressBlock(0); // Small streams do not need to start the workers
+	else
+	{
+		if(!m_pMaster)
+		{
+			m_pMaster = new GMasterThread();
+			for(size_t i = 0; i < m_workerThreads; i++)
+				m_pMaster->addWorker(new GCompressedIStreamBufWorker(*m_pMaster, *this));
+		}
+		m_pMaster->doJobs(count);
+	}
+	for(size_t i = 0; i < count; i++)
+	{
+		if(m_failed[i])
+			throw Ex("Invalid compressed block");
+	}
+	setg(m_buf.data(), m_buf.data(), m_buf.data() + m_buf.size());
+}
+
+void GCompressedIStreamBuf::uncompressBlock(size_t block)
+{
+	size_t b = m_firstBlock + block;
+	unsigned char* pIn = (unsigned char*)m_compressed.data() + (m_blockPos[b] - m_blockPos[m_firstBlock]);
+	unsigned int inLen = (unsigned int)(m_blockPos[b + 1] - m_blockPos[b]);
+	unsigned int expected = (unsigned int)(m_blockStart[b + 1] - m_blockStart[b]);
+	try
+	{
+		unsigned int outLen;
+		std::unique_ptr<unsigned char[]> hOut(GCompressor::uncompress(pIn, inLen, &outLen));
+		if(outLen == expected)
+			memcpy(m_buf.data() + (m_blockStart[b] - m_blockStart[m_firstBlock]), hOut.get(), outLen);
+		else
+			m_failed[block] = 1;
+	}
+	catch(const std::exception&)
+	{
+		m_failed[block] = 1; // Exceptions cannot leave a worker thread, so loadBatch throws instead
+	}
+}
+
+// virtual
+GCompressedIStreamBuf::int_type GCompressedIStreamBuf::underflow()
+{
+	if(gptr() < egptr())
+		return traits_type::to_int_type(*gptr());
+	size_t next = m_firstBlock + m_batchBlocks;
+	if(next >= blocks())
+		return traits_type::eof();
+	loadBatch(next);
+	return traits_type::to_int_type(*gptr());
+}
+
+// virtual
+GCompressedIStreamBuf::pos_type GCompressedIStreamBuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+{
+	off_type base;
+	if(dir == std::ios_base::beg)
+		base = 0;
+	else if(dir == std::ios_base::cur)
+		base = (off_type)m_blockStart[m_firstBlock] + (gptr() - eback());
+	else
+		base = (off_type)size();
+	return seekpos(pos_type(base + off), which);
+}
+
+// virtual
+GCompressedIStreamBuf::pos_type GCompressedIStreamBuf::seekpos(pos_type pos, std::ios_base::openmode which)
+{
+	off_type p = off_type(pos);
+	if(!(which & std::ios_base::in) || p < 0 || (uint64_t)p > size())
+		return pos_type(off_type(-1));
+	uint64_t start = m_blockStart[m_firstBlock];
+	uint64_t end = m_blockStart[m_firstBlock + m_batchBlocks];
+	if((uint64_t)p >= start && (uint64_t)p < end && eback())
+		setg(eback(), eback() + ((uint64_t)p - start), egptr()); // It is already in the current batch
+	else if((uint64_t)p == size())
+	{
+		m_firstBlock = blocks();
+		m_batchBlocks = 0;
+		setg(NULL, NULL, NULL);
+	}
+	else
+	{
+		// Find the block that contains p, and load the batch that starts with it
+		size_t block = std::upper_bound(m_blockStart.begin(), m_blockStart.end(), (uint64_t)p) - m_blockStart.begin() - 1;
+		loadBatch(block);
+		setg(eback(), eback() + ((uint64_t)p - m_blockStart[block]), egptr());
+	}
+	return pos;
+}
+
+
+
+GCompressedOStream::GCompressedOStream(const char* szFilename, size_t workerThreads, size_t blockSize)
+: std::ostream(NULL), m_pBuf(NULL)
+{
+	m_file.exceptions(std::ios::badbit | std::ios::failbit);
+	try
+	{
+		m_file.open(szFilename, std::ios::binary);
+	}
+	catch(const std::exception&)
+	{
+		throw Ex("Error while trying to create the file, ", szFilename, ". ", strerror(errno));
+	}
+	m_pBuf = new GCompressedOStreamBuf(m_file, workerThreads, blockSize);
+	rdbuf(m_pBuf);
+	exceptions(std::ios::badbit); // so errors that occur while compressing are not silently ignored
+}
+
+// virtual
+GCompressedOStream::~GCompressedOStream()
+{
+	try
+	{
+		close();
+	}
+	catch(...)
+	{
+	}
+	delete(m_pBuf);
+}
+
+void GCompressedOStream::close()
+{
+	m_pBuf->close();
+	if(m_file.is_open())
+		m_file.close();
+}
+
+
+
+GCompressedIStream::GCompressedIStream(const char* szFilename, size_t workerThreads)
+: std::istream(NULL), m_pBuf(NULL)
+{
+	m_file.open(szFilename, std::ios::binary);
+	if(m_file.fail())
+		throw Ex("Error while trying to open the file, ", szFilename, ". ", strerror(errno));
+	m_pBuf = new GCompressedIStreamBuf(m_file, workerThreads);
+	rdbuf(m_pBuf);
+}
+
+// virtual
+GCompressedIStream::~GCompressedIStream()
+{
+	delete(m_pBuf);
+}
+
+void GCompressor_testStreams()
+{
+	// Make some data that is somewhat compressible, and somewhat not
+	std::string data;
+	for(size_t i = 0; data.size() < 24000; i++)
+	{
+		std::ostringstream line;
+		line << i << "," << (i * 7919) % 1013 << ",class" << i % 5 << (i % 3 == 0 ? ",red" : ",green") << "\n";
+		data += line.str();
+		data += (char)(i * 131);
+	}
+
+	// Make sure the compressed bytes do not depend on the number of threads
+	std::string compressed;
+	for(size_t threads = 1; threads <= 3; threads += 2)
+	{
+		std::ostringstream os;
+		{
+			GCompressedOStreamBuf buf(os, threads, 700);
+			std::ostream s(&buf);
+			for(size_t i = 0; i < data.size(); i += 1000)
+			{
+				s.write(data.data() + i, std::min((size_t)1000, data.size() - i));
+				s.flush();
+			}
+			buf.close();
+		}
+		if(threads == 1)
+			compressed = os.str();
+		else if(os.str() != compressed)
+			throw Ex("depends on the number of threads");
+	}
+	if(compressed.size() >= data.size())
+		throw Ex("failed to compress");
+
+	// Read it back sequentially, and with seeking
+	std::istringstream is(compressed);
+	GCompressedIStreamBuf buf(is, 2);
+	std::istream s(&buf);
+	if(buf.size() != data.size() || buf.blocks() != (data.size() + 699) / 700)
+		throw Ex("wrong size");
+	std::string roundTrip((std::istreambuf_iterator<char>(s)), std::istreambuf_iterator<char>());
+	if(roundTrip != data)
+		throw Ex("not the same");
+	char chunk[100];
+	size_t pos = 23;
+	for(size_t i = 0; i < 50; i++)
+	{
+		pos = (pos * 37 + 1001) % (data.size() - sizeof(chunk));
+		s.clear();
+		s.seekg(pos);
+		s.read(chunk, sizeof(chunk));
+		if((size_t)s.tellg() != pos + sizeof(chunk) || memcmp(chunk, data.data() + pos, sizeof(chunk)) != 0)
+			throw Ex("seek failed");
+	}
+	s.seekg(-10, std::ios::end);
+	s.read(chunk, 20);
+	if(s.gcount() != 10 || memcmp(chunk, data.data() + data.size() - 10, 10) != 0)
+		throw Ex("seek from end failed");
+
+	// An empty stream should work too
+	std::ostringstream osEmpty;
+	{
+		GCompressedOStreamBuf bufEmpty(osEmpty, 1);
+	}
+	std::istringstream isEmpty(osEmpty.str());
+	GCompressedIStreamBuf bufEmpty(isEmpty, 1);
+	if(bufEmpty.size() != 0 || bufEmpty.sgetc() != std::char_traits<char>::eof())
+		throw Ex("empty stream failed");
+
+	// Corrupt data should be detected
+	std::string bad = compressed;
+	bad[bad.size() - 1] = 'X';
+	std::istringstream isBad(bad);
+	bool caught = false;
+	try
+	{
+		GExpectException ee;
+		GCompressedIStreamBuf bufBad(isBad, 1);
+	}
+	catch(const std::exception&)
+	{
+		caught = true;
+	}
+	if(!caught)
+		throw Ex("failed to detect a truncated stream");
+
+	// Files in the framed format are decompressed transparently
+	char szFilename[256];
+	GFile::tempFilename(szFilename);
+	try
+	{
+		{
+			GCompressedOStream cs(szFilename, 2);
+			cs.write(data.data(), data.size());
+			cs.close();
+		}
+		if(!GCompressor::isCompressedFile(szFilename))
+			throw Ex("not detected");
+		size_t len;
+		char* pFile = GFile::loadFile(szFilename, &len);
+		std::unique_ptr<char[]> hFile(pFile);
+		if(len != data.size() || memcmp(pFile, data.data(), len) != 0)
+			throw Ex("loadFile failed");
+	}
+	catch(...)
+	{
+		GFile::deleteFile(szFilename);
+		throw;
+	}
+	GFile::deleteFile(szFilename);
+	if(!GCompressor::isCompressedFilename("data.arff.GCZ") || GCompressor::isCompressedFilename("gcz") || GCompressor::isCompressedFilename("data.arff"))
+		throw Ex("isCompressedFilename failed");
+}
+
 // static
 void GCompressor::test()
 {
@@ -1000,5 +1604,22 @@ void GCompressor::test()
 		throw Ex("failed to uncompress");
 	if(memcmp(szTest, pFinal, len) != 0)
 		throw Ex("not the same");
+
+	// Data with many distinct bytes uses longer keys, which must still be read back exactly
+	std::vector<double> vals;
+	for(size_t i = 0; i < 512; i++)
+	{
+		vals.push_back((double)(i % 7));
+		vals.push_back(std::sin((double)i) * 1000.0);
+	}
+	unsigned int valsLen = (unsigned int)(vals.size() * sizeof(double));
+	pCompressed = GCompressor::compress((unsigned char*)vals.data(), valsLen, &compressedLen);
+	hCompressed.reset(pCompressed);
+	pFinal = GCompressor::uncompress(pCompressed, compressedLen, &finalLen);
+	hFinal.reset(pFinal);
+	if(finalLen != valsLen || memcmp(vals.data(), pFinal, valsLen) != 0)
+		throw Ex("not the same");
+
+	GCompressor_testStreams();
 }
 
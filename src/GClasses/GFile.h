@@ -23,7 +23,10 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <istream>
+#include <ostream>
+#include <streambuf>
 #include <vector>
+#include <stdint.h>
 #include <map>
 #include <fstream>
 
@@ -77,6 +80,7 @@ public:
 
 	/// Loads a file into memory and returns a pointer to the
 	/// memory.  You must delete the buffer it returns.
+	/// If the file was written by GCompressedOStream, the uncompressed content is returned.
 	static char* loadFile(const char* szFilename, size_t* pnSize);
 
 	/// Saves a buffer as a file.  Returns true on success
@@ -165,10 +169,155 @@ public:
 	/// Uncompress pIn. You are responsible to delete[] pOut.
 	static unsigned char* uncompress(unsigned char* pIn, unsigned int len, unsigned int* pOutUncompressedLen);
 
+	/// Returns true iff szFilename is a regular file that begins with the framed format written by GCompressedOStream.
+	static bool isCompressedFile(const char* szFilename);
+
+	/// Returns true iff szFilename ends with ".gcz". By convention, files with this extension are saved
+	/// in the framed format, and the extension before it (such as ".arff" or ".json") describes the content.
+	static bool isCompressedFilename(const char* szFilename);
+
 	static void test();
 };
 
 
+class GMasterThread;
+class GCompressedOStreamBufWorker;
+
+/// A stream buffer that compresses everything written to it, and writes it to another stream in a framed format.
+/// The data is cut into blocks of a fixed size, and each block is compressed independently with GCompressor,
+/// so a batch of blocks can be compressed in parallel by worker threads. The compressed blocks are written
+/// in order, followed by an index of block sizes, so the result does not depend on the number of threads,
+/// and GCompressedIStreamBuf can seek to any position without decompressing what comes before it.
+class GCompressedOStreamBuf : public std::streambuf
+{
+friend class GCompressedOStreamBufWorker;
+protected:
+	std::ostream& m_out;
+	size_t m_blockSize;
+	size_t m_workerThreads;
+	std::vector<char> m_buf;
+	size_t m_batchBytes; // The number of uncompressed bytes in the current batch
+	std::vector<unsigned char*> m_compressed; // The compressed blocks in the current batch
+	std::vector<unsigned int> m_compressedLen;
+	std::vector<uint32_t> m_index; // The compressed and uncompressed size of each block that has been written
+	uint64_t m_pos; // The number of bytes that have been written to m_out
+	bool m_closed;
+	GMasterThread* m_pMaster; // The workers that compress each batch. They are kept for the life of the buffer, so they only start once.
+
+public:
+	/// Writes the header to out. If workerThreads is 0, one thread is used for each core.
+	/// blockSize is the number of uncompressed bytes in each block. The default is 4096, because GCompressor
+	/// runs out of short keys in much bigger blocks, so they do not compress as well.
+	GCompressedOStreamBuf(std::ostream& out, size_t workerThreads = 0, size_t blockSize = 4096);
+
+	/// Calls close if it has not already been called.
+	virtual ~GCompressedOStreamBuf();
+
+	/// Compresses any remaining data, and writes the index. (Nothing more can be written after this is called.)
+	/// Call this explicitly if you want to see any errors that occur.
+	void close();
+
+protected:
+	/// Compresses and writes the first bytes in the buffer.
+	void flushBlocks(size_t bytes);
+
+	/// Compresses one block in the current batch.
+	void compressBlock(size_t block);
+
+	/// Compresses the buffer when it is full.
+	virtual int_type overflow(int_type c);
+
+	/// Compresses and writes all of the full blocks in the buffer.
+	virtual int sync();
+};
+
+
+class GCompressedIStreamBufWorker;
+
+/// A stream buffer that reads the framed format written by GCompressedOStreamBuf from another stream.
+/// Blocks are decompressed incrementally, a batch at a time, with the blocks in each batch
+/// decompressed in parallel by worker threads. The index is used to seek directly to any position.
+class GCompressedIStreamBuf : public std::streambuf
+{
+friend class GCompressedIStreamBufWorker;
+protected:
+	std::istream& m_in;
+	size_t m_workerThreads;
+	std::vector<uint64_t> m_blockPos; // The position of each compressed block in m_in, followed by the position of the index
+	std::vector<uint64_t> m_blockStart; // The uncompressed position of each block, followed by the uncompressed size
+	std::vector<char> m_compressed; // The compressed blocks in the current batch
+	std::vector<char> m_buf; // The uncompressed blocks in the current batch
+	std::vector<char> m_failed;
+	size_t m_firstBlock; // The first block in the current batch
+	size_t m_batchBlocks; // The number of blocks in the current batch
+	GMasterThread* m_pMaster; // The workers that decompress each batch. They are kept for the life of the buffer, so they only start once.
+
+public:
+	/// Reads the index from in, which must support seeking. If workerThreads is 0, one thread is used for each core.
+	/// Throws an exception if in does not contain data in the framed format.
+	GCompressedIStreamBuf(std::istream& in, size_t workerThreads = 0);
+	virtual ~GCompressedIStreamBuf();
+
+	/// Returns the total number of uncompressed bytes.
+	uint64_t size() const { return m_blockStart.back(); }
+
+	/// Returns the number of compressed blocks.
+	size_t blocks() const { return m_blockStart.size() - 1; }
+
+protected:
+	/// Reads and decompresses a batch of blocks, starting with the specified block.
+	void loadBatch(size_t block);
+
+	/// Decompresses one block in the current batch.
+	void uncompressBlock(size_t block);
+
+	/// Loads the next batch when the current one has been consumed.
+	virtual int_type underflow();
+
+	/// Seeks relative to the beginning, the current position, or the end of the uncompressed data.
+	virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which = std::ios_base::in);
+
+	/// Seeks to a position in the uncompressed data.
+	virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which = std::ios_base::in);
+};
+
+
+/// Writes a file in the framed compressed format. Use it like a std::ofstream.
+class GCompressedOStream : public std::ostream
+{
+protected:
+	std::ofstream m_file;
+	GCompressedOStreamBuf* m_pBuf;
+
+public:
+	/// Creates the file. If workerThreads is 0, one thread is used for each core.
+	GCompressedOStream(const char* szFilename, size_t workerThreads = 0, size_t blockSize = 4096);
+
+	/// Closes the file if close has not already been called.
+	virtual ~GCompressedOStream();
+
+	/// Compresses any remaining data, writes the index, and closes the file.
+	void close();
+};
+
+
+/// Reads a file in the framed compressed format. Use it like a std::ifstream.
+class GCompressedIStream : public std::istream
+{
+protected:
+	std::ifstream m_file;
+	GCompressedIStreamBuf* m_pBuf;
+
+public:
+	/// Opens the file and reads its index. If workerThreads is 0, one thread is used for each core.
+	GCompressedIStream(const char* szFilename, size_t workerThreads = 0);
+	virtual ~GCompressedIStream();
+
+	/// Returns the total number of uncompressed bytes in the file.
+	uint64_t size() const { return m_pBuf->size(); }
+};
+
+
 
 } // namespace GClasses
 
@@ -24,8 +24,10 @@
 #include "GDistribution.h"
 #include "GKernelTrick.h"
 #include "GHolders.h"
+#include "GThread.h"
 #include <cmath>
 #include <memory>
+#include <algorithm>
 
 namespace GClasses {
 
@@ -105,14 +107,56 @@ void GRunningCovariance::test()
 
 
 
+#define GP_BLOCK_ROWS 256
+
+class GGaussianProcessWorker : public GWorkerThread
+{
+protected:
+	GGaussianProcess& m_gp;
+
+public:
+	GGaussianProcessWorker(GMasterThread& master, GGaussianProcess& gp)
+	: GWorkerThread(master), m_gp(gp)
+	{
+	}
+
+	virtual ~GGaussianProcessWorker()
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		m_gp.absorbBlock(m_gp.m_jobFirstBlock + jobId);
+	}
+};
+
+/// Returns a new GMatrix with the contents of v, which holds a rows-by-cols matrix in row-major order.
+GMatrix* GGaussianProcess_toMatrix(const GVec& v, size_t rows, size_t cols)
+{
+	GMatrix* pM = new GMatrix(rows, cols);
+	for(size_t i = 0; i < rows; i++)
+		pM->row(i).copy(0, v, i * cols, cols);
+	return pM;
+}
+
+/// Returns the inverse of the lower-triangular n-by-n matrix l, which is stored in row-major order.
+void GGaussianProcess_lowerInverse(const GVec& l, size_t n, GVec& inv)
+{
+	inv.resize(n * n);
+	inv.fill(0.0);
+	for(size_t i = 0; i < n; i++)
+		inv[i * n + i] = 1.0;
+	GVec::trsm(false, n, n, l.data(), n, inv.data(), n);
+}
+
 GGaussianProcess::GGaussianProcess()
-: GSupervisedLearner(), m_noiseVar(1.0), m_weightsPriorVar(1024.0), m_maxSamples(350), m_pLInv(NULL), m_pAlpha(NULL), m_pStoredFeatures(NULL), m_pBuf(NULL)
+: GSupervisedLearner(), m_noiseVar(1.0), m_weightsPriorVar(1024.0), m_maxSamples(350), m_inducingPoints(0), m_sparseMethod(VFE), m_workerThreads(1), m_pLInv(NULL), m_pLBInv(NULL), m_pAlpha(NULL), m_pStoredFeatures(NULL), m_pBuf(NULL), m_pJobFeatures(NULL), m_pJobLabels(NULL), m_jobFirstBlock(0)
 {
 	m_pKernel = new GKernelIdentity();
 }
 
 GGaussianProcess::GGaussianProcess(const GDomNode* pNode)
-: GSupervisedLearner(pNode), m_pBuf(NULL)
+: GSupervisedLearner(pNode), m_inducingPoints(0), m_sparseMethod(VFE), m_workerThreads(1), m_pLBInv(NULL), m_pBuf(NULL), m_pJobFeatures(NULL), m_pJobLabels(NULL), m_jobFirstBlock(0)
 {
 	m_weightsPriorVar = pNode->getDouble("wv");
 	m_noiseVar = pNode->getDouble("nv");
@@ -121,6 +165,13 @@ GGaussianProcess::GGaussianProcess(const GDomNode* pNode)
 	m_pAlpha = new GMatrix(pNode->get("a"));
 	m_pStoredFeatures = new GMatrix(pNode->get("feat"));
 	m_pKernel = GKernel::deserialize(pNode->get("kernel"));
+	GDomNode* pLB = pNode->getIfExists("lb");
+	if(pLB)
+	{
+		m_pLBInv = new GMatrix(pLB);
+		m_inducingPoints = (size_t)pNode->getInt("ip");
+		m_sparseMethod = (SparseMethod)pNode->getInt("sm");
+	}
 }
 
 // virtual
@@ -140,6 +191,92 @@ void GGaussianProcess::test()
 	pGP->setKernel(new GKernelGaussianRBF(0.2));
 	GAutoFilter af2(pGP);
 	af2.basicTest(0.67, 0.92);
+	af2.clear();
+	GGaussianProcess* pSparse = new GGaussianProcess();
+	pSparse->setKernel(new GKernelGaussianRBF(0.2));
+	pSparse->setInducingPoints(60);
+	GAutoFilter af3(pSparse);
+	af3.basicTest(0.77, 0.92);
+
+	// With every row as an inducing point, the sparse model is the exact model
+	GRand rand(0);
+	GMatrix f(80, 2);
+	GMatrix l(80, 1);
+	for(size_t i = 0; i < f.rows(); i++)
+	{
+		f[i].fillUniform(rand, -3.0, 3.0);
+		l[i][0] = std::sin(f[i][0]) + 0.5 * std::cos(2.0 * f[i][1]) + 0.1 * rand.normal();
+	}
+	GGaussianProcess exact;
+	exact.setKernel(new GKernelGaussianRBF(1.0));
+	exact.setNoiseVariance(0.01);
+	exact.setWeightsPriorVariance(1.0);
+	exact.train(f, l);
+	for(size_t m = 0; m < 2; m++)
+	{
+		GGaussianProcess sparse;
+		sparse.setKernel(new GKernelGaussianRBF(1.0));
+		sparse.setNoiseVariance(0.01);
+		sparse.setWeightsPriorVariance(1.0);
+		sparse.setInducingPoints(f.rows(), m == 0 ? VFE : FITC);
+		sparse.train(f, l);
+		GVec in(2);
+		GVec a(1);
+		GVec b(1);
+		GPrediction pa, pb;
+		for(size_t i = 0; i < 20; i++)
+		{
+			in.fillUniform(rand, -3.0, 3.0);
+			exact.predict(in, a);
+			sparse.predict(in, b);
+			if(std::abs(a[0] - b[0]) > 1e-5)
+				throw Ex("The sparse model disagrees with the exact model");
+			exact.predictDistribution(in, &pa);
+			sparse.predictDistribution(in, &pb);
+			if(std::abs(pa.asNormal()->variance() - pb.asNormal()->variance()) > 1e-5)
+				throw Ex("The sparse variance disagrees with the exact variance");
+		}
+	}
+
+	// A sparse model uses all of the data, and its results do not depend on the number of threads
+	GMatrix f2(3000, 1);
+	GMatrix l2(3000, 1);
+	for(size_t i = 0; i < f2.rows(); i++)
+	{
+		f2[i][0] = rand.uniform() * 10.0 - 5.0;
+		l2[i][0] = std::sin(f2[i][0]) + 0.3 * rand.normal();
+	}
+	for(size_t m = 0; m < 2; m++)
+	{
+		GGaussianProcess gp1;
+		gp1.setKernel(new GKernelGaussianRBF(1.0));
+		gp1.setNoiseVariance(0.09);
+		gp1.setWeightsPriorVariance(1.0);
+		gp1.setInducingPoints(30, m == 0 ? VFE : FITC);
+		gp1.train(f2, l2);
+		GGaussianProcess gp2;
+		gp2.setKernel(new GKernelGaussianRBF(1.0));
+		gp2.setNoiseVariance(0.09);
+		gp2.setWeightsPriorVariance(1.0);
+		gp2.setInducingPoints(30, m == 0 ? VFE : FITC);
+		gp2.setWorkerThreads(3);
+		gp2.train(f2, l2);
+		GVec in(1);
+		GVec a(1);
+		GVec b(1);
+		double sse = 0.0;
+		for(size_t i = 0; i < 100; i++)
+		{
+			in[0] = -4.5 + 0.09 * i;
+			gp1.predict(in, a);
+			gp2.predict(in, b);
+			if(a[0] != b[0])
+				throw Ex("The results depend on the number of threads");
+			sse += (a[0] - std::sin(in[0])) * (a[0] - std::sin(in[0]));
+		}
+		if(sse / 100 > 0.003)
+			throw Ex("The sparse model is not accurate enough");
+	}
 }
 
 // virtual
@@ -153,6 +290,12 @@ GDomNode* GGaussianProcess::serialize(GDom* pDoc) const
 	pNode->add(pDoc, "a", m_pAlpha->serialize(pDoc));
 	pNode->add(pDoc, "feat", m_pStoredFeatures->serialize(pDoc));
 	pNode->add(pDoc, "kernel", m_pKernel->serialize(pDoc));
+	if(m_pLBInv)
+	{
+		pNode->add(pDoc, "lb", m_pLBInv->serialize(pDoc));
+		pNode->add(pDoc, "ip", m_inducingPoints);
+		pNode->add(pDoc, "sm", (long long)m_sparseMethod);
+	}
 	return pNode;
 }
 
@@ -161,12 +304,24 @@ void GGaussianProcess::clear()
 {
 	delete(m_pLInv);
 	m_pLInv = NULL;
+	delete(m_pLBInv);
+	m_pLBInv = NULL;
 	delete(m_pAlpha);
 	m_pAlpha = NULL;
 	delete(m_pStoredFeatures);
 	m_pStoredFeatures = NULL;
 	delete(m_pBuf);
 	m_pBuf = NULL;
+	for(size_t i = 0; i < m_jobB.size(); i++)
+	{
+		delete(m_jobB[i]);
+		delete(m_jobC[i]);
+		delete(m_jobK[i]);
+	}
+	m_jobB.clear();
+	m_jobC.clear();
+	m_jobK.clear();
+	m_lmm.resize(0);
 }
 
 // virtual
@@ -176,6 +331,11 @@ void GGaussianProcess::trainInner(const GMatrix& features, const GMatrix& labels
 		throw Ex("GGaussianProcess only supports continuous features. Perhaps you should wrap it in a GAutoFilter.");
 	if(!labels.relation().areContinuous())
 		throw Ex("GGaussianProcess only supports continuous labels. Perhaps you should wrap it in a GAutoFilter.");
+	if(m_inducingPoints > 0)
+	{
+		trainSparse(features, labels);
+		return;
+	}
 	if(features.rows() <= m_maxSamples)
 	{
 		trainInnerInner(features, labels);
@@ -199,48 +359,224 @@ void GGaussianProcess::trainInner(const GMatrix& features, const GMatrix& labels
 	trainInnerInner(f, l);
 }
 
+void GGaussianProcess::choleskyWithJitter(GVec& l, size_t n)
+{
+	GVec orig;
+	orig.copy(l);
+	double jitter = 0.0;
+	for(size_t i = 0; i < n; i++)
+		jitter += std::abs(l[i * n + i]);
+	jitter = std::max(1e-300, 1e-10 * jitter / n);
+	for(size_t attempts = 0; !GVec::cholesky(l.data(), n, n, m_workerThreads); attempts++)
+	{
+		if(attempts >= 8)
+			throw Ex("The kernel matrix is not positive definite");
+		l.copy(orig);
+		for(size_t i = 0; i < n; i++)
+			l[i * n + i] += jitter;
+		jitter *= 10.0;
+	}
+}
+
 void GGaussianProcess::trainInnerInner(const GMatrix& features, const GMatrix& labels)
 {
 	clear();
-	GMatrix* pL;
+	size_t n = features.rows();
+	size_t labelDims = labels.cols();
+
+	// Compute the lower triangle of the kernel matrix, one block of rows at a time
+	GVec l(n * n);
 	{
-		// Compute the kernel matrix
-		GMatrix k(features.rows(), features.rows());
-		for(size_t i = 0; i < features.rows(); i++)
+		GMatrix k;
+		for(size_t i0 = 0; i0 < n; i0 += GP_BLOCK_ROWS)
 		{
-			GVec& row = k[i];
-			const GVec& a = features[i];
-			for(size_t j = 0; j < features.rows(); j++)
+			size_t rows = std::min((size_t)GP_BLOCK_ROWS, n - i0);
+			m_pKernel->applyBlock(features, i0, rows, features, 0, i0 + rows, k, m_workerThreads);
+			for(size_t i = 0; i < rows; i++)
 			{
-				const GVec& b = features[j];
-				row[j] = m_weightsPriorVar * m_pKernel->apply(a, b);
+				double* pRow = l.data() + (i0 + i) * n;
+				const GVec& kRow = k[i];
+				for(size_t j = 0; j <= i0 + i; j++)
+					pRow[j] = m_weightsPriorVar * kRow[j];
+
+				// Add the noise variance to the diagonal of the kernel matrix
+				pRow[i0 + i] += m_noiseVar;
 			}
 		}
-
-		// Add the noise variance to the diagonal of the kernel matrix
-		for(size_t i = 0; i < features.rows(); i++)
-			k[i][i] += m_noiseVar;
-
-		// Compute L
-		pL = k.cholesky(true);
 	}
-	std::unique_ptr<GMatrix> hL(pL);
+
+	// Compute L
+	choleskyWithJitter(l, n);
 
 	// Compute the model
-	m_pLInv = pL->pseudoInverse();
-	GMatrix* pTmp = GMatrix::multiply(*m_pLInv, labels, false, false);
-	std::unique_ptr<GMatrix> hTmp(pTmp);
-	GMatrix* pLTrans = pL->transpose();
-	std::unique_ptr<GMatrix> hLTrans(pLTrans);
-	GMatrix* pLTransInv = pLTrans->pseudoInverse();
-	std::unique_ptr<GMatrix> hLTransInv(pLTransInv);
-	m_pAlpha = GMatrix::multiply(*pLTransInv, *pTmp, false, false);
-	GAssert(m_pAlpha->rows() == features.rows());
-	GAssert(m_pAlpha->cols() == labels.cols());
+	GVec lInv;
+	GGaussianProcess_lowerInverse(l, n, lInv);
+	m_pLInv = GGaussianProcess_toMatrix(lInv, n, n);
+	GVec alpha(n * labelDims);
+	for(size_t i = 0; i < n; i++)
+		alpha.copy(i * labelDims, labels[i]);
+	GVec::trsm(false, n, labelDims, l.data(), n, alpha.data(), labelDims);
+	GVec::trsm(true, n, labelDims, l.data(), n, alpha.data(), labelDims);
+	m_pAlpha = GGaussianProcess_toMatrix(alpha, n, labelDims);
 	m_pStoredFeatures = new GMatrix();
 	m_pStoredFeatures->copy(features);
 }
 
+void GGaussianProcess::trainSparse(const GMatrix& features, const GMatrix& labels)
+{
+	clear();
+	size_t n = features.rows();
+	size_t labelDims = labels.cols();
+	if(n == 0)
+		throw Ex("Expected at least one row of training data");
+	size_t m = std::min(m_inducingPoints, n);
+
+	// Draw the inducing points
+	std::vector<size_t> indexes(n);
+	GIndexVec::makeIndexVec(indexes.data(), n);
+	GIndexVec::shuffle(indexes.data(), n, &m_rand);
+	std::sort(indexes.begin(), indexes.begin() + m);
+	m_pStoredFeatures = new GMatrix(features.relation().clone());
+	m_pStoredFeatures->newRows(m);
+	for(size_t i = 0; i < m; i++)
+		m_pStoredFeatures->row(i).copy(features[indexes[i]]);
+
+	// Factor the kernel matrix of the inducing points
+	{
+		GMatrix k;
+		m_pKernel->applyBlock(*m_pStoredFeatures, *m_pStoredFeatures, k, m_workerThreads);
+		m_lmm.resize(m * m);
+		for(size_t i = 0; i < m; i++)
+		{
+			for(size_t j = 0; j < m; j++)
+				m_lmm[i * m + j] = m_weightsPriorVar * k[i][j];
+		}
+		choleskyWithJitter(m_lmm, m);
+	}
+
+	// Absorb the training data one wave of blocks at a time, and sum the block contributions in order
+	size_t blocks = (n + GP_BLOCK_ROWS - 1) / GP_BLOCK_ROWS;
+	size_t wave = std::max((size_t)1, std::min(m_workerThreads, blocks));
+	GMasterThread master;
+	for(size_t i = 0; i < wave; i++)
+	{
+		master.addWorker(new GGaussianProcessWorker(master, *this));
+		m_jobB.push_back(new GVec(m * m));
+		m_jobC.push_back(new GVec(m * labelDims));
+		m_jobK.push_back(new GMatrix());
+	}
+	m_pJobFeatures = &features;
+	m_pJobLabels = &labels;
+	GVec b(m * m);
+	b.fill(0.0);
+	for(size_t i = 0; i < m; i++)
+		b[i * m + i] = 1.0;
+	GVec c(m * labelDims);
+	c.fill(0.0);
+	for(m_jobFirstBlock = 0; m_jobFirstBlock < blocks; m_jobFirstBlock += wave)
+	{
+		size_t jobs = std::min(wave, blocks - m_jobFirstBlock);
+		master.doJobs(jobs);
+		for(size_t i = 0; i < jobs; i++)
+		{
+			b += *m_jobB[i];
+			c += *m_jobC[i];
+		}
+	}
+	m_pJobFeatures = NULL;
+	m_pJobLabels = NULL;
+
+	// Solve for the weights of the inducing points
+	choleskyWithJitter(b, m);
+	GVec::trsm(false, m, labelDims, b.data(), m, c.data(), labelDims);
+	GVec::trsm(true, m, labelDims, b.data(), m, c.data(), labelDims);
+	GVec::trsm(true, m, labelDims, m_lmm.data(), m, c.data(), labelDims);
+	m_pAlpha = GGaussianProcess_toMatrix(c, m, labelDims);
+
+	// Store the factors needed to compute the predictive variance
+	GVec lInv;
+	GGaussianProcess_lowerInverse(m_lmm, m, lInv);
+	m_pLInv = GGaussianProcess_toMatrix(lInv, m, m);
+	GVec::trsm(false, m, m, b.data(), m, lInv.data(), m);
+	m_pLBInv = GGaussianProcess_toMatrix(lInv, m, m);
+	for(size_t i = 0; i < m_jobB.size(); i++)
+	{
+		delete(m_jobB[i]);
+		delete(m_jobC[i]);
+		delete(m_jobK[i]);
+	}
+	m_jobB.clear();
+	m_jobC.clear();
+	m_jobK.clear();
+	m_lmm.resize(0);
+}
+
+void GGaussianProcess::absorbBlock(size_t block)
+{
+	size_t job = block - m_jobFirstBlock;
+	size_t m = m_pStoredFeatures->rows();
+	size_t labelDims = m_pJobLabels->cols();
+	size_t start = block * GP_BLOCK_ROWS;
+	size_t count = std::min((size_t)GP_BLOCK_ROWS, m_pJobFeatures->rows() - start);
+
+	// Compute A = Lmm^-1 * Kmb
+	GMatrix& k = *m_jobK[job];
+	m_pKernel->applyBlock(*m_pStoredFeatures, 0, m, *m_pJobFeatures, start, count, k);
+	GVec a(m * count);
+	for(size_t i = 0; i < m; i++)
+	{
+		double* pRow = a.data() + i * count;
+		const GVec& kRow = k[i];
+		for(size_t j = 0; j < count; j++)
+			pRow[j] = m_weightsPriorVar * kRow[j];
+	}
+	GVec::trsm(false, m, count, m_lmm.data(), m, a.data(), count);
+
+	// Weight each row by the inverse square root of its variance. (FITC adds the prior variance that the inducing points do not explain.)
+	GVec w(count);
+	if(m_sparseMethod == FITC)
+		m_pKernel->applyDiagonal(*m_pJobFeatures, start, count, w);
+	for(size_t j = 0; j < count; j++)
+	{
+		double lambda = m_noiseVar;
+		if(m_sparseMethod == FITC)
+		{
+			double q = 0.0;
+			for(size_t i = 0; i < m; i++)
+				q += a[i * count + j] * a[i * count + j];
+			lambda += std::max(0.0, m_weightsPriorVar * w[j] - q);
+		}
+		w[j] = 1.0 / std::sqrt(lambda);
+	}
+	for(size_t i = 0; i < m; i++)
+	{
+		double* pRow = a.data() + i * count;
+		for(size_t j = 0; j < count; j++)
+			pRow[j] *= w[j];
+	}
+	GVec y(count * labelDims);
+	for(size_t j = 0; j < count; j++)
+	{
+		const GVec& lab = m_pJobLabels->row(start + j);
+		for(size_t i = 0; i < labelDims; i++)
+			y[j * labelDims + i] = w[j] * lab[i];
+	}
+
+	// Compute this block's contributions, A * W * A^T and A * W * y
+	GVec& bOut = *m_jobB[job];
+	bOut.fill(0.0);
+	GVec::gemm(false, true, m, m, count, a.data(), count, a.data(), count, bOut.data(), m);
+	GVec& cOut = *m_jobC[job];
+	cOut.fill(0.0);
+	GVec::gemm(false, false, m, labelDims, count, a.data(), count, y.data(), labelDims, cOut.data(), labelDims);
+}
+
+void GGaussianProcess::kernelVector(const GVec& in, GVec& k)
+{
+	for(size_t i = 0; i < m_pStoredFeatures->rows(); i++)
+		k[i] = m_weightsPriorVar * m_pKernel->apply(m_pStoredFeatures->row(i), in);
+}
+
 // virtual
 void GGaussianProcess::predict(const GVec& in, GVec& out)
 {
@@ -249,11 +585,10 @@ void GGaussianProcess::predict(const GVec& in, GVec& out)
 
 	// Compute k*
 	GVec& k = m_pBuf->row(0);
-	for(size_t i = 0; i < m_pStoredFeatures->rows(); i++)
-		k[i] = m_weightsPriorVar * m_pKernel->apply(m_pStoredFeatures->row(i), in);
+	kernelVector(in, k);
 
 	// Compute the prediction
-	m_pAlpha->multiply(m_pBuf->row(0), out, true);
+	m_pAlpha->multiply(k, out, true);
 }
 
 // virtual
@@ -266,22 +601,28 @@ void GGaussianProcess::predictDistribution(const GVec& in, GPrediction* out)
 
 	// Compute k*
 	GVec& k = m_pBuf->row(0);
-	for(size_t i = 0; i < m_pStoredFeatures->rows(); i++)
-		k[i] = m_weightsPriorVar * m_pKernel->apply(m_pStoredFeatures->row(i), in);
+	kernelVector(in, k);
 
 	// Compute the prediction
-	GVec pred;
-	m_pAlpha->multiply(m_pBuf->row(0), pred, true);
+	GVec pred(m_pAlpha->cols());
+	m_pAlpha->multiply(k, pred, true);
 
 	// Compute the variance
 	GVec& v = m_pBuf->row(1);
 	m_pLInv->multiply(k, v);
-	double variance = m_pKernel->apply(k, k) - v.squaredMagnitude();
+	double variance = m_weightsPriorVar * m_pKernel->apply(in, in) - v.squaredMagnitude();
+	if(m_pLBInv)
+	{
+		// The sparse posterior restores the part of the variance that the training data does not explain
+		m_pLBInv->multiply(k, v);
+		variance += v.squaredMagnitude();
+	}
+	variance = std::max(0.0, variance);
 
 	// Store the results
 	for(size_t i = 0; i < m_pAlpha->cols(); i++)
 	{
-		GNormalDistribution* pNorm = out->makeNormal();
+		GNormalDistribution* pNorm = out[i].makeNormal();
 		pNorm->setMeanAndVariance(pred[i], variance);
 	}
 }
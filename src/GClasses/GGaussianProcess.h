@@ -22,10 +22,13 @@
 
 #include "GMatrix.h"
 #include "GLearner.h"
+#include <vector>
 
 namespace GClasses {
 
 class GKernel;
+class GMasterThread;
+class GGaussianProcessWorker;
 
 /// Computes a running covariance matrix about the origin.
 class GRunningCovariance
@@ -61,18 +64,44 @@ public:
 /// A Gaussian Process model. This class was implemented according to the specification
 /// in Algorithm 2.1 on page 19 of chapter 2 of http://www.gaussianprocesses.org/gpml/chapters/
 /// by Carl Edward Rasmussen and Christopher K. I. Williams.
+/// By default, it trains an exact model on (a random subset of) the training data. If setInducingPoints
+/// is called, it trains a sparse approximation instead, in which the posterior is represented with a
+/// small set of inducing points. The sparse approximation uses all of the training data, in time that
+/// grows linearly with the number of rows, and it streams through the data in blocks that are processed
+/// by worker threads.
 class GGaussianProcess : public GSupervisedLearner
 {
+friend class GGaussianProcessWorker;
+public:
+	enum SparseMethod
+	{
+		VFE, ///< The variational free energy approximation of Titsias, which treats the inducing points as a low-rank approximation of the kernel
+		FITC, ///< The fully independent training conditional approximation, which also models the per-row variance that the inducing points miss
+	};
+
 protected:
 	double m_noiseVar;
 	double m_weightsPriorVar;
 	size_t m_maxSamples;
+	size_t m_inducingPoints;
+	SparseMethod m_sparseMethod;
+	size_t m_workerThreads;
 	GMatrix* m_pLInv;
+	GMatrix* m_pLBInv;
 	GMatrix* m_pAlpha;
 	GMatrix* m_pStoredFeatures;
 	GMatrix* m_pBuf;
 	GKernel* m_pKernel;
 
+	// The wave of blocks that the workers are currently absorbing into the sparse model
+	const GMatrix* m_pJobFeatures;
+	const GMatrix* m_pJobLabels;
+	size_t m_jobFirstBlock;
+	GVec m_lmm;
+	std::vector<GVec*> m_jobB;
+	std::vector<GVec*> m_jobC;
+	std::vector<GMatrix*> m_jobK;
+
 public:
 	/// General-purpose constructor
 	GGaussianProcess();
@@ -104,9 +133,19 @@ public:
 
 	/// Sets the maximum number of samples to train with. If the training data
 	/// contains more than 'm' samples, it will sub-sample the training data
-	/// in order to train efficiently. The default is 350.
+	/// in order to train efficiently. The default is 350. (This does not apply to sparse models,
+	/// which always use all of the training data.)
 	void setMaxSamples(size_t m) { m_maxSamples = m; }
 
+	/// Specifies to train a sparse model with m inducing points, which are drawn at random from the
+	/// training data. Training costs O(n * m^2) time and O(m^2) memory, where n is the number of rows,
+	/// and each prediction costs O(m) kernel evaluations. If m is 0, an exact model is trained. The default is 0.
+	void setInducingPoints(size_t m, SparseMethod method = VFE) { m_inducingPoints = m; m_sparseMethod = method; }
+
+	/// Specify the number of worker threads to use for the matrix decompositions and for absorbing the
+	/// training data into a sparse model. The default is 1. (The results do not depend on the number of threads.)
+	void setWorkerThreads(size_t n) { m_workerThreads = n; }
+
 protected:
 	/// See the comment for GSupervisedLearner::trainInner
 	virtual void trainInner(const GMatrix& features, const GMatrix& labels);
@@ -128,6 +167,19 @@ protected:
 
 	/// Called by trainInner
 	void trainInnerInner(const GMatrix& features, const GMatrix& labels);
+
+	/// Trains a sparse model with inducing points drawn from features.
+	void trainSparse(const GMatrix& features, const GMatrix& labels);
+
+	/// Absorbs one block of rows into the buffers for job number block - m_jobFirstBlock.
+	void absorbBlock(size_t block);
+
+	/// Computes the weighted kernel of each stored feature vector with in, and stores them in k.
+	void kernelVector(const GVec& in, GVec& k);
+
+	/// Factors the weighted kernel matrix in l (which is n-by-n and stored in row-major order) in place.
+	/// If the factorization fails, a small amount of jitter is added to the diagonal and it is tried again.
+	void choleskyWithJitter(GVec& l, size_t n);
 };
 
 } // namespace GClasses
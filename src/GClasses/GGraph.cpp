@@ -29,10 +29,13 @@
 #include "GRand.h"
 #include "GVec.h"
 #include "GHolders.h"
+#include "GThread.h"
 #include <vector>
 #include <deque>
 #include <cmath>
 #include <memory>
+#include <algorithm>
+#include <functional>
 
 using namespace GClasses;
 using std::vector;
@@ -803,6 +806,195 @@ void GDijkstra::test()
 
 
 
+namespace GClasses {
+
+class GMultiSourceDijkstraWorker : public GWorkerThread
+{
+protected:
+	GMultiSourceDijkstra& m_graph;
+
+public:
+	GMultiSourceDijkstraWorker(GMasterThread& master, GMultiSourceDijkstra& graph)
+	: GWorkerThread(master), m_graph(graph)
+	{
+	}
+
+	virtual ~GMultiSourceDijkstraWorker()
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		m_graph.doJob(jobId);
+	}
+};
+
+} // namespace GClasses
+
+GMultiSourceDijkstra::GMultiSourceDijkstra(size_t nodes)
+: m_nodes(nodes), m_workerThreads(1), m_pOrigins(NULL), m_pOut(NULL)
+{
+	m_rowStart.resize(nodes + 1, 0);
+}
+
+GMultiSourceDijkstra::~GMultiSourceDijkstra()
+{
+}
+
+void GMultiSourceDijkstra::addDirectedEdge(size_t from, size_t to, double cost)
+{
+	if(from >= m_nodes || to >= m_nodes)
+		throw Ex("Vertex index out of range");
+	if(cost < 0.0)
+		throw Ex("Dijkstra's algorithm requires non-negative edge costs");
+	m_from.push_back(from);
+	m_to.push_back(to);
+	m_costs.push_back(cost);
+}
+
+void GMultiSourceDijkstra::buildRows()
+{
+	if(m_from.size() == 0)
+		return;
+
+	// Merge the new edges with the ones already in compressed rows, using a counting sort
+	std::vector<size_t> counts(m_nodes + 1, 0);
+	for(size_t i = 0; i < m_nodes; i++)
+		counts[i + 1] = m_rowStart[i + 1] - m_rowStart[i];
+	for(size_t i = 0; i < m_from.size(); i++)
+		counts[m_from[i] + 1]++;
+	for(size_t i = 0; i < m_nodes; i++)
+		counts[i + 1] += counts[i];
+	std::vector<size_t> edgeTo(counts[m_nodes]);
+	std::vector<double> edgeCost(counts[m_nodes]);
+	std::vector<size_t> pos(counts.begin(), counts.end() - 1);
+	for(size_t i = 0; i < m_nodes; i++)
+	{
+		for(size_t j = m_rowStart[i]; j < m_rowStart[i + 1]; j++)
+		{
+			edgeTo[pos[i]] = m_edgeTo[j];
+			edgeCost[pos[i]++] = m_edgeCost[j];
+		}
+	}
+	for(size_t i = 0; i < m_from.size(); i++)
+	{
+		size_t p = pos[m_from[i]]++;
+		edgeTo[p] = m_to[i];
+		edgeCost[p] = m_costs[i];
+	}
+	m_rowStart.swap(counts);
+	m_edgeTo.swap(edgeTo);
+	m_edgeCost.swap(edgeCost);
+	std::vector<size_t>().swap(m_from);
+	std::vector<size_t>().swap(m_to);
+	std::vector<double>().swap(m_costs);
+}
+
+void GMultiSourceDijkstra::computeFrom(size_t origin, double* pCosts) const
+{
+	if(origin >= m_nodes)
+		throw Ex("Vertex index out of range");
+	for(size_t i = 0; i < m_nodes; i++)
+		pCosts[i] = 1e300;
+	pCosts[origin] = 0.0;
+
+	// Use a binary heap with lazy deletion. Stale entries are skipped when they are popped.
+	std::vector< std::pair<double, size_t> > heap;
+	std::greater< std::pair<double, size_t> > comp;
+	heap.push_back(std::make_pair(0.0, origin));
+	while(heap.size() > 0)
+	{
+		std::pop_heap(heap.begin(), heap.end(), comp);
+		double c = heap.back().first;
+		size_t u = heap.back().second;
+		heap.pop_back();
+		if(c > pCosts[u])
+			continue;
+		for(size_t j = m_rowStart[u]; j < m_rowStart[u + 1]; j++)
+		{
+			size_t v = m_edgeTo[j];
+			double alt = c + m_edgeCost[j];
+			if(alt < pCosts[v])
+			{
+				pCosts[v] = alt;
+				heap.push_back(std::make_pair(alt, v));
+				std::push_heap(heap.begin(), heap.end(), comp);
+			}
+		}
+	}
+}
+
+void GMultiSourceDijkstra::doJob(size_t job)
+{
+	computeFrom((*m_pOrigins)[job], m_pOut->row(job).data());
+}
+
+void GMultiSourceDijkstra::compute(const std::vector<size_t>& origins, GMatrix& out)
+{
+	buildRows();
+	out.resize(origins.size(), m_nodes);
+	m_pOrigins = &origins;
+	m_pOut = &out;
+	GMasterThread master;
+	size_t threads = std::max((size_t)1, std::min(m_workerThreads, origins.size()));
+	for(size_t i = 0; i < threads; i++)
+		master.addWorker(new GMultiSourceDijkstraWorker(master, *this));
+	master.doJobs(origins.size());
+	m_pOrigins = NULL;
+	m_pOut = NULL;
+}
+
+// static
+void GMultiSourceDijkstra::test()
+{
+	// Compare with Floyd-Warshall on a random sparse graph
+	GRand rand(0);
+	size_t n = 60;
+	GFloydWarshall fw(n);
+	GMultiSourceDijkstra msd(n);
+	for(size_t i = 0; i < 4 * n; i++)
+	{
+		size_t a = (size_t)rand.next(n);
+		size_t b = (size_t)rand.next(n);
+		if(a == b)
+			continue;
+		double c = rand.uniform() + 0.01;
+		fw.addDirectedEdge(a, b, c);
+		msd.addDirectedEdge(a, b, c);
+	}
+	fw.compute();
+	std::vector<size_t> origins;
+	for(size_t i = 0; i < n; i += 3)
+		origins.push_back(i);
+	GMatrix costs;
+	msd.setWorkerThreads(3);
+	msd.compute(origins, costs);
+	for(size_t i = 0; i < origins.size(); i++)
+	{
+		for(size_t j = 0; j < n; j++)
+		{
+			double expected = fw.cost(origins[i], j);
+			double actual = costs[i][j];
+			if(expected >= 1e200 || actual >= 1e200)
+			{
+				if(expected < 1e200 || actual < 1e200)
+					throw Ex("reachability mismatch");
+			}
+			else if(std::abs(expected - actual) > 1e-12)
+				throw Ex("wrong cost");
+		}
+	}
+
+	// Edges added after computing should be merged into the compressed rows
+	msd.addDirectedEdge(0, n - 1, 0.0);
+	msd.compute(origins, costs);
+	if(costs[0][n - 1] != 0.0)
+		throw Ex("edge not added");
+}
+
+
+
+
 
 
 
@@ -31,6 +31,7 @@ class GHeap;
 class GRegionAjacencyGraph;
 class GGraphEdgeIterator;
 class GRand;
+class GMultiSourceDijkstraWorker;
 
 
 /// This implements an optimized max-flow/min-cut algorithm described in
@@ -205,6 +206,64 @@ public:
 };
 
 
+/// Finds the shortest paths from many origins to every vertex in a sparse graph.
+/// The edges are stored in compressed rows, so memory grows with the number of edges
+/// rather than the square of the number of vertices. The origins are split among
+/// worker threads, which share the read-only graph. Use this instead of GFloydWarshall
+/// when the graph is sparse, or when paths are only needed from a subset of the vertices.
+class GMultiSourceDijkstra
+{
+friend class GMultiSourceDijkstraWorker;
+protected:
+	size_t m_nodes;
+	std::vector<size_t> m_from;
+	std::vector<size_t> m_to;
+	std::vector<double> m_costs;
+	std::vector<size_t> m_rowStart; // The edges out of vertex i are m_to[m_rowStart[i]] through m_to[m_rowStart[i + 1] - 1]
+	std::vector<size_t> m_edgeTo;
+	std::vector<double> m_edgeCost;
+	size_t m_workerThreads;
+
+	// The operation that the workers are currently performing
+	const std::vector<size_t>* m_pOrigins;
+	GMatrix* m_pOut;
+
+public:
+	/// nodes specifies the number of vertices in the graph.
+	GMultiSourceDijkstra(size_t nodes);
+	~GMultiSourceDijkstra();
+
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
+	/// Returns the number of vertices in the graph
+	size_t nodeCount() { return m_nodes; }
+
+	/// Adds a directed edge to the graph. (You must call this to add all
+	/// the edges before calling compute.)
+	void addDirectedEdge(size_t from, size_t to, double cost);
+
+	/// Specify the number of worker threads to use. The default is 1.
+	void setWorkerThreads(size_t n) { m_workerThreads = n; }
+
+	/// Resizes out to have one row for each origin and one column for each vertex, and
+	/// stores the smallest cost to get from each origin to each vertex in it.
+	/// Vertices that cannot be reached are given a cost of 1e300.
+	void compute(const std::vector<size_t>& origins, GMatrix& out);
+
+	/// Finds the shortest paths from a single origin, and stores the cost to reach each vertex in pCosts.
+	/// (compute must have been called at least once since the last edge was added.)
+	void computeFrom(size_t origin, double* pCosts) const;
+
+protected:
+	/// Sorts the edges into compressed rows.
+	void buildRows();
+
+	/// Computes the shortest paths from the origin with the specified index. (This is called by the worker threads.)
+	void doJob(size_t job);
+};
+
+
 /// Computes the number of times that the shortest-path between
 /// every pair of points passes over each edge and vertex
 class GBrandesBetweennessCentrality
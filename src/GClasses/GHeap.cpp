@@ -36,5 +36,6 @@ void GHeap::clear()
 		delete[] m_pCurrentBlock;
 		m_pCurrentBlock = pNext;
 	}
+	m_nCurrentBlockSize = m_nMinBlockSize;
 	m_nCurrentPos = m_nMinBlockSize;
 }
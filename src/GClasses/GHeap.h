@@ -43,6 +43,7 @@ class GHeap
 protected:
 	char* m_pCurrentBlock;
 	size_t m_nMinBlockSize;
+	size_t m_nCurrentBlockSize;
 	size_t m_nCurrentPos;
 
 public:
@@ -50,6 +51,7 @@ public:
 	{
 		m_pCurrentBlock = NULL;
 		m_nMinBlockSize = nMinBlockSize;
+		m_nCurrentBlockSize = nMinBlockSize;
 		m_nCurrentPos = nMinBlockSize;
 	}
 
@@ -63,6 +65,13 @@ public:
 	/// Deletes all the blocks and frees up memory
 	void clear();
 
+	/// Returns the minimum size of the blocks that this heap allocates.
+	size_t minBlockSize() const { return m_nMinBlockSize; }
+
+	/// Sets the minimum size of the blocks that are allocated from now on. Bigger blocks
+	/// mean fewer calls to new when many objects will be allocated, but more unused space at the end.
+	void setMinBlockSize(size_t n) { m_nMinBlockSize = n; }
+
 	/// Allocate space in the heap and copy a string to it.  Returns
 	/// a pointer to the string
 	char* add(const char* szString)
@@ -83,9 +92,10 @@ public:
 	/// Allocate space in the heap and return a pointer to it
 	char* allocate(size_t nLength)
 	{
-		if(m_nCurrentPos + nLength > m_nMinBlockSize)
+		if(m_nCurrentPos + nLength > m_nCurrentBlockSize)
 		{
-			char* pNewBlock = new char[sizeof(char*) + std::max(nLength, m_nMinBlockSize)];
+			m_nCurrentBlockSize = std::max(nLength, m_nMinBlockSize);
+			char* pNewBlock = new char[sizeof(char*) + m_nCurrentBlockSize];
 			*(char**)pNewBlock = m_pCurrentBlock;
 			m_pCurrentBlock = pNewBlock;
 			m_nCurrentPos = 0;
@@ -102,9 +112,10 @@ public:
 	char* allocAligned(size_t nLength)
 	{
 		size_t nAlignedCurPos = ALIGN_UP(m_nCurrentPos);
-		if(nAlignedCurPos + nLength > m_nMinBlockSize)
+		if(nAlignedCurPos + nLength > m_nCurrentBlockSize)
 		{
-			char* pNewBlock = new char[sizeof(char*) + std::max(nLength, m_nMinBlockSize)];
+			m_nCurrentBlockSize = std::max(nLength, m_nMinBlockSize);
+			char* pNewBlock = new char[sizeof(char*) + m_nCurrentBlockSize];
 			*(char**)pNewBlock = m_pCurrentBlock;
 			m_pCurrentBlock = pNewBlock;
 			m_nCurrentPos = 0;
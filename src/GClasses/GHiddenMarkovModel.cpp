@@ -27,13 +27,45 @@
 #include "GError.h"
 #include "GHolders.h"
 #include "GVec.h"
+#include "GRand.h"
+#include "GThread.h"
 #include <string.h>
 
 using namespace GClasses;
 using std::vector;
 
+#define HMM_CHUNK_SEQUENCES 256
+#define HMM_LOG_ZERO -1e30
+
+namespace GClasses {
+
+class GHiddenMarkovModelWorker : public GWorkerThread
+{
+protected:
+	GHiddenMarkovModel& m_hmm;
+	std::vector<double> m_buf;
+	std::vector<int> m_backPointers;
+
+public:
+	GHiddenMarkovModelWorker(GMasterThread& master, GHiddenMarkovModel& hmm)
+	: GWorkerThread(master), m_hmm(hmm)
+	{
+	}
+
+	virtual ~GHiddenMarkovModelWorker()
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		m_hmm.doChunk(jobId, m_buf, m_backPointers);
+	}
+};
+
+} // namespace GClasses
+
 GHiddenMarkovModel::GHiddenMarkovModel(int stateCount, int symbolCount)
-: m_stateCount(stateCount), m_symbolCount(symbolCount), m_pTrainingBuffer(NULL)
+: m_stateCount(stateCount), m_symbolCount(symbolCount), m_workerThreads(1), m_pJobSequences(NULL), m_pJobLengths(NULL), m_pJobStates(NULL), m_pJobLogProbs(NULL), m_jobFirstChunk(0)
 {
 	int modelSize = m_stateCount + m_stateCount * m_stateCount + m_stateCount * m_symbolCount;
 	m_pInitialStateProbabilities = new double[modelSize];
@@ -44,254 +76,286 @@ GHiddenMarkovModel::GHiddenMarkovModel(int stateCount, int symbolCount)
 GHiddenMarkovModel::~GHiddenMarkovModel()
 {
 	delete[] m_pInitialStateProbabilities;
-	delete[] m_pTrainingBuffer;
 }
 
-double GHiddenMarkovModel::forwardAlgorithm(const int* pObservations, int len)
+/// Returns the log of p, or a very negative number if p is 0. (This avoids infinities.)
+inline double GHMM_log(double p)
 {
-	// Compute probabilities of initial observation
-	GVec cur(m_stateCount);
-	GVec prev(m_stateCount);
-	GVec* pCur = &cur;
-	GVec* pPrev = &prev;
-	double logProb = 0;
-	for(int j = 0; j < m_stateCount; j++)
-		(*pCur)[j] = m_pInitialStateProbabilities[j] * m_pSymbolProbabilities[m_symbolCount * j + pObservations[0]];
-
-	// Do the rest
-	for(int i = 1; i < len; i++)
+	return p > 0.0 ? log(p) : HMM_LOG_ZERO;
+}
+
+/// Sets pOut[i] = exp(pIn[i] - m), where m is the max value in pIn, and returns m.
+double GHMM_expShift(const double* pIn, size_t n, double* pOut)
+{
+	double m = pIn[0];
+	for(size_t i = 1; i < n; i++)
+		m = std::max(m, pIn[i]);
+	for(size_t i = 0; i < n; i++)
+		pOut[i] = exp(pIn[i] - m);
+	return m;
+}
+
+/// Computes pOut = pE * pMatrix, where pMatrix is n x n and row-major, then replaces each value with its log plus shift.
+void GHMM_logMultiply(const double* pE, const double* pMatrix, size_t n, double shift, double* pOut)
+{
+	for(size_t j = 0; j < n; j++)
+		pOut[j] = 0.0;
+	for(size_t k = 0; k < n; k++)
+	{
+		double e = pE[k];
+		if(e == 0.0)
+			continue;
+		const double* pRow = pMatrix + n * k;
+		for(size_t j = 0; j < n; j++)
+			pOut[j] += e * pRow[j];
+	}
+	for(size_t j = 0; j < n; j++)
+		pOut[j] = shift + GHMM_log(pOut[j]);
+}
+
+void GHiddenMarkovModel::prepareTables()
+{
+	size_t states = m_stateCount;
+	size_t symbols = m_symbolCount;
+	m_logInit.resize(states);
+	m_logTrans.resize(states * states);
+	m_transT.resize(states * states);
+	m_logEmit.resize(symbols * states);
+	for(size_t i = 0; i < states; i++)
 	{
-		// Compute probabilities for the next time step
-		std::swap(pPrev, pCur);
-		for(int j = 0; j < m_stateCount; j++)
+		m_logInit[i] = GHMM_log(m_pInitialStateProbabilities[i]);
+		for(size_t j = 0; j < states; j++)
 		{
-			(*pCur)[j] = 0;
-			for(int k = 0; k < m_stateCount; k++)
-				(*pCur)[j] += (*pPrev)[k] * m_pTransitionProbabilities[m_stateCount * j + k];
-			(*pCur)[j] *= m_pSymbolProbabilities[m_symbolCount * j + pObservations[i]];
+			double p = m_pTransitionProbabilities[states * i + j];
+			m_logTrans[states * i + j] = GHMM_log(p);
+			m_transT[states * j + i] = p;
 		}
+		for(size_t k = 0; k < symbols; k++)
+			m_logEmit[states * k + i] = GHMM_log(m_pSymbolProbabilities[symbols * i + k]);
+	}
+}
 
-		// Normalize to preserve numerical stability
-		double sum = (*pCur).sum();
-		(*pCur) *= (1.0 / sum);
-		logProb += log(sum);
+double GHiddenMarkovModel::forwardLog(const int* pObservations, int len, double* pAlpha, double* pScratch)
+{
+	size_t states = m_stateCount;
+	double* pE = pScratch;
+	double* pCur = pAlpha;
+	const double* pEmit = m_logEmit.data() + states * pObservations[0];
+	for(size_t j = 0; j < states; j++)
+		pCur[j] = m_logInit[j] + pEmit[j];
+	for(int i = 1; i < len; i++)
+	{
+		// alpha_i(j) = log(sum_k(exp(alpha_i-1(k)) * trans(k, j))) + emit(j, obs_i)
+		const double* pPrev = pCur;
+		pCur += states;
+		double shift = GHMM_expShift(pPrev, states, pE);
+		GHMM_logMultiply(pE, m_pTransitionProbabilities, states, shift, pCur);
+		GAssert(pObservations[i] >= 0 && pObservations[i] < m_symbolCount);
+		pEmit = m_logEmit.data() + states * pObservations[i];
+		for(size_t j = 0; j < states; j++)
+			pCur[j] += pEmit[j];
 	}
+	double shift = GHMM_expShift(pCur, states, pE);
+	double sum = 0.0;
+	for(size_t j = 0; j < states; j++)
+		sum += pE[j];
+	return shift + GHMM_log(sum);
+}
 
-	// Sum to get final probabilities
-	logProb += log((*pCur).sum());
-	return logProb;
+void GHiddenMarkovModel::backwardLog(const int* pObservations, int len, double* pBeta, double* pScratch)
+{
+	size_t states = m_stateCount;
+	double* pV = pScratch;
+	double* pE = pV + states;
+	double* pCur = pBeta + states * (len - 1);
+	for(size_t j = 0; j < states; j++)
+		pCur[j] = 0.0;
+	for(int i = len - 2; i >= 0; i--)
+	{
+		// beta_i(j) = log(sum_k(trans(j, k) * exp(emit(k, obs_i+1) + beta_i+1(k))))
+		const double* pNext = pCur;
+		pCur -= states;
+		const double* pEmit = m_logEmit.data() + states * pObservations[i + 1];
+		for(size_t k = 0; k < states; k++)
+			pV[k] = pEmit[k] + pNext[k];
+		double shift = GHMM_expShift(pV, states, pE);
+		GHMM_logMultiply(pE, m_transT.data(), states, shift, pCur);
+	}
 }
 
-double GHiddenMarkovModel::viterbi(int* pMostLikelyStates, const int* pObservations, int len)
+double GHiddenMarkovModel::forwardAlgorithm(const int* pObservations, int len)
 {
-	// Compute probabilities of initial observation
-	GTEMPBUF(int, backpointers, m_stateCount * (len - 1));
-	GVec cur(m_stateCount);
-	GVec prev(m_stateCount);
-	GVec* pCur = &cur;
-	GVec* pPrev = &prev;
-	double logProb = 0;
-	for(int j = 0; j < m_stateCount; j++)
-		(*pCur)[j] = m_pInitialStateProbabilities[j] * m_pSymbolProbabilities[m_symbolCount * j + pObservations[0]];
-
-	// Do the rest
+	if(len < 1)
+		throw Ex("Expected at least one observation");
+	prepareTables();
+	std::vector<double> buf(m_stateCount * (len + 2));
+	return forwardLog(pObservations, len, buf.data() + 2 * m_stateCount, buf.data());
+}
+
+double GHiddenMarkovModel::viterbiLog(int* pMostLikelyStates, const int* pObservations, int len, std::vector<double>& buf, std::vector<int>& backPointers)
+{
+	size_t states = m_stateCount;
+	if(buf.size() < 2 * states)
+		buf.resize(2 * states);
+	if(backPointers.size() < states * len)
+		backPointers.resize(states * len);
+	double* pCur = buf.data();
+	double* pPrev = pCur + states;
+	const double* pEmit = m_logEmit.data() + states * pObservations[0];
+	for(size_t j = 0; j < states; j++)
+		pCur[j] = m_logInit[j] + pEmit[j];
 	for(int i = 1; i < len; i++)
 	{
-		// Compute probabilities for the next time step
-		std::swap(pPrev, pCur);
-		for(int j = 0; j < m_stateCount; j++)
+		// delta_i(j) = max_k(delta_i-1(k) + trans(k, j)) + emit(j, obs_i)
+		std::swap(pCur, pPrev);
+		int* pBack = backPointers.data() + states * i;
+		const double* pRow = m_logTrans.data();
+		for(size_t j = 0; j < states; j++)
+		{
+			pCur[j] = pPrev[0] + pRow[j];
+			pBack[j] = 0;
+		}
+		for(size_t k = 1; k < states; k++)
 		{
-			(*pCur)[j] = 0;
-			int index = 0;
-			for(int k = 0; k < m_stateCount; k++)
+			double d = pPrev[k];
+			pRow += states;
+			for(size_t j = 0; j < states; j++)
 			{
-				double p = (*pPrev)[k] * m_pTransitionProbabilities[m_stateCount * j + k];
-				if(p >= (*pCur)[j])
+				double p = d + pRow[j];
+				if(p > pCur[j])
 				{
-					(*pCur)[j] = p;
-					index = k;
+					pCur[j] = p;
+					pBack[j] = (int)k;
 				}
 			}
-			(*pCur)[j] *= m_pSymbolProbabilities[m_symbolCount * j + pObservations[i]];
-			backpointers[m_stateCount * (i - 1) + j] = index;
 		}
-
-		// Normalize to preserve numerical stability
-		double sum = (*pCur).sum();
-		(*pCur) *= (1.0 / sum);
-		logProb += log(sum);
+		GAssert(pObservations[i] >= 0 && pObservations[i] < m_symbolCount);
+		pEmit = m_logEmit.data() + states * pObservations[i];
+		for(size_t j = 0; j < states; j++)
+			pCur[j] += pEmit[j];
 	}
 
-	// Find the best path
+	// Follow the back pointers from the most likely final state
 	int index = 0;
-	for(int j = 1; j < m_stateCount; j++)
+	for(size_t j = 1; j < states; j++)
 	{
-		if((*pCur)[j] > (*pCur)[index])
-			index = j;
+		if(pCur[j] > pCur[index])
+			index = (int)j;
 	}
-	pMostLikelyStates[m_stateCount - 1] = index;
-	for(int i = m_stateCount - 2; i >= 0; i--)
+	double logProb = pCur[index];
+	pMostLikelyStates[len - 1] = index;
+	for(int i = len - 1; i > 0; i--)
 	{
-		pMostLikelyStates[i] = backpointers[m_stateCount * i + index];
-		index = pMostLikelyStates[i];
+		index = backPointers[states * i + index];
+		pMostLikelyStates[i - 1] = index;
 	}
-	logProb += log((*pCur)[index]);
 	return logProb;
 }
 
-void GHiddenMarkovModel::baumWelchBeginTraining(int maxLen)
-{
-	// ensure that the buffers are allocated for alpha and beta
-	m_maxLen = maxLen;
-	delete[] m_pTrainingBuffer;
-	m_pTrainingBuffer = new double[
-			m_stateCount + // initial state probabilities accumulator
-			m_stateCount * m_stateCount + // transition probabilities accumulator
-			m_stateCount * m_symbolCount + // symbol probabilities accumulator
-			m_stateCount * maxLen + // beta
-			m_stateCount + // alpha cur
-			m_stateCount + // alpha prev
-			m_stateCount + // gamma
-			m_stateCount * m_stateCount // xi
-		];
-}
-
-void GHMM_setAll(double* pVector, double val, size_t size)
-{
-	for(size_t i = 0; i < size; i++)
-		pVector[i] = val;
-}
-
-void GHiddenMarkovModel::baumWelchBeginPass()
+double GHiddenMarkovModel::viterbi(int* pMostLikelyStates, const int* pObservations, int len)
 {
-	// Reset the accumulators
-	double* pAccumInitProb = m_pTrainingBuffer;
-	double* pAccumTransProb = pAccumInitProb + m_stateCount;
-	double* pAccumSymbolProb = pAccumTransProb + m_stateCount * m_stateCount;
-	GHMM_setAll(pAccumInitProb, 0.0, m_stateCount);
-	GHMM_setAll(pAccumTransProb, 0.0, m_stateCount * m_stateCount);
-	GHMM_setAll(pAccumSymbolProb, 0.0, m_stateCount * m_symbolCount);
+	if(len < 1)
+		throw Ex("Expected at least one observation");
+	prepareTables();
+	std::vector<double> buf;
+	std::vector<int> backPointers;
+	return viterbiLog(pMostLikelyStates, pObservations, len, buf, backPointers);
 }
 
-void GHMM_sumToOne(double* pVector, size_t size)
+void GHiddenMarkovModel::viterbi(std::vector<int*>& mostLikelyStates, const std::vector<int*>& sequences, const std::vector<int>& lengths, std::vector<double>* pLogProbs)
 {
-	GConstVecWrapper vw(pVector, size);
-	double sum = vw.sum();
-	if(sum == 0)
-		GHMM_setAll(pVector, 1.0 / size, size);
-	else
+	if(sequences.size() != lengths.size() || mostLikelyStates.size() != lengths.size())
+		throw Ex("Expected all three vectors to have the same size");
+	for(size_t i = 0; i < lengths.size(); i++)
 	{
-		for(size_t i = 0; i < size; i++)
-			pVector[i] *= (1.0 / sum);
+		if(lengths[i] < 1)
+			throw Ex("Expected at least one observation in each sequence");
 	}
+	if(pLogProbs)
+		pLogProbs->resize(lengths.size());
+	prepareTables();
+	m_pJobSequences = &sequences;
+	m_pJobLengths = &lengths;
+	m_pJobStates = &mostLikelyStates;
+	m_pJobLogProbs = pLogProbs;
+	size_t chunks = (lengths.size() + HMM_CHUNK_SEQUENCES - 1) / HMM_CHUNK_SEQUENCES;
+	GMasterThread master;
+	for(size_t i = 0; i < std::max((size_t)1, std::min(m_workerThreads, chunks)); i++)
+		master.addWorker(new GHiddenMarkovModelWorker(master, *this));
+	master.doJobs(chunks);
+	m_pJobSequences = NULL;
+	m_pJobLengths = NULL;
+	m_pJobStates = NULL;
+	m_pJobLogProbs = NULL;
 }
 
-void GHiddenMarkovModel::backwardAlgorithm(const int* pObservations, int len)
+double GHiddenMarkovModel::baumWelchAddSequence(const int* pObservations, int len, double* pAccum, std::vector<double>& buf)
 {
-	// Initialize probabilities of the last state
-	double* pBeta = m_pTrainingBuffer + m_stateCount + m_stateCount * m_stateCount + m_stateCount * m_symbolCount;
-	double* pCur = pBeta + m_stateCount * (len - 1);
-	for(int j = 0; j < m_stateCount; j++)
-	{
-		*pCur = 1.0;
-		pCur++;
-	}
-
-	// Induct backwards
-	for(int i = len - 2; i >= 0; i--)
+	size_t states = m_stateCount;
+	size_t symbols = m_symbolCount;
+	if(buf.size() < states * (2 * len + 4))
+		buf.resize(states * (2 * len + 4));
+	double* pAlpha = buf.data();
+	double* pBeta = pAlpha + states * len;
+	double* pScratch = pBeta + states * len;
+	double* pV = pScratch + 2 * states;
+	double* pE = pV + states;
+	double logProb = forwardLog(pObservations, len, pAlpha, pScratch);
+	backwardLog(pObservations, len, pBeta, pScratch);
+	double* pAccumInit = pAccum;
+	double* pAccumTrans = pAccumInit + states;
+	double* pAccumSym = pAccumTrans + states * states;
+	for(int i = 0; i < len; i++)
 	{
-		for(int j = 0; j < m_stateCount; j++)
+		// Accumulate gamma, the probability of each state at this time step
+		const double* pA = pAlpha + states * i;
+		const double* pB = pBeta + states * i;
+		int obs = pObservations[i];
+		for(size_t j = 0; j < states; j++)
 		{
-			double d = 0;
-			for(int k = 0; k < m_stateCount; k++)
-				d += 	m_pTransitionProbabilities[m_stateCount * j + k] *
-					m_pSymbolProbabilities[m_symbolCount * k + pObservations[i + 1]] *
-					pBeta[m_stateCount * (i + 1) + k];
-			pBeta[m_stateCount * i + j] = d;
+			double gamma = exp(pA[j] + pB[j] - logProb);
+			if(i == 0)
+				pAccumInit[j] += gamma;
+			pAccumSym[symbols * j + obs] += gamma;
 		}
 
-		// Normalize to preserve numerical stability
-		pCur = pBeta + m_stateCount * i;
-		GHMM_sumToOne(pCur, m_stateCount);
+		// Accumulate xi, the probability of each transition to the next time step
+		if(i + 1 < len)
+		{
+			const double* pEmit = m_logEmit.data() + states * pObservations[i + 1];
+			const double* pNext = pB + states;
+			for(size_t k = 0; k < states; k++)
+				pV[k] = pEmit[k] + pNext[k];
+			double shift = GHMM_expShift(pV, states, pE);
+			for(size_t j = 0; j < states; j++)
+			{
+				double a = exp(pA[j] + shift - logProb);
+				if(a == 0.0)
+					continue;
+				const double* pTrans = m_pTransitionProbabilities + states * j;
+				double* pAcc = pAccumTrans + states * j;
+				for(size_t k = 0; k < states; k++)
+					pAcc[k] += a * pTrans[k] * pE[k];
+			}
+		}
 	}
+	return logProb;
 }
 
-void GVec_add(double* pDest, const double* pSource, size_t nDims)
+void GHMM_sumToOne(double* pVector, size_t size)
 {
-	for(size_t i = 0; i < nDims; i++)
+	double sum = 0.0;
+	for(size_t i = 0; i < size; i++)
+		sum += pVector[i];
+	if(sum == 0)
 	{
-		*pDest += *pSource;
-		pDest++;
-		pSource++;
+		for(size_t i = 0; i < size; i++)
+			pVector[i] = 1.0 / size;
 	}
-}
-
-void GHiddenMarkovModel::baumWelchAddSequence(const int* pObservations, int len)
-{
-	// Do backward algorithm to obtain beta values
-	backwardAlgorithm(pObservations, len);
-
-	// Do forward algorithm to update accumulators
-	double* pAccumInitProb = m_pTrainingBuffer;
-	double* pAccumTransProb = pAccumInitProb + m_stateCount;
-	double* pAccumSymbolProb = pAccumTransProb + m_stateCount * m_stateCount;
-	double* pBeta = pAccumSymbolProb + m_stateCount * m_symbolCount;
-	double* pCur = pBeta + m_stateCount * m_maxLen;
-	double* pPrev = pCur + m_stateCount;
-	double* pGamma = pPrev + m_stateCount;
-	double* pXi = pGamma + m_stateCount;
-	for(int i = 0; i < len; i++)
+	else
 	{
-		// Compute alpha values
-		if(i == 0)
-		{
-			// Compute initial alpha values
-			for(int j = 0; j < m_stateCount; j++)
-				pCur[j] = m_pInitialStateProbabilities[j] * m_pSymbolProbabilities[m_symbolCount * j + pObservations[0]];
-		}
-		else
-		{
-			// Compute probabilities for the next time step
-			std::swap(pPrev, pCur);
-			for(int j = 0; j < m_stateCount; j++)
-			{
-				pCur[j] = 0;
-				for(int k = 0; k < m_stateCount; k++)
-					pCur[j] += pPrev[k] * m_pTransitionProbabilities[m_stateCount * j + k];
-				pCur[j] *= m_pSymbolProbabilities[m_symbolCount * j + pObservations[i]];
-			}
-		}
-
-		// Normalize to preserve numerical stability
-		GHMM_sumToOne(pCur, m_stateCount);
-
-		// Compute xi and gamma
-		for(int j = 0; j < m_stateCount; j++)
-		{
-			pGamma[j] = pCur[j] * pBeta[m_stateCount * i + j];
-			if(i < len - 1)
-			{
-				for(int k = 0; k < m_stateCount; k++)
-				{
-					pXi[m_stateCount * j + k] =
-						pCur[j] *
-						m_pTransitionProbabilities[m_stateCount * j + k] *
-						m_pSymbolProbabilities[m_symbolCount * j + pObservations[i]] *
-						pBeta[m_stateCount * (i + 1) + k];
-				}
-			}
-		}
-		GHMM_sumToOne(pGamma, m_stateCount);
-		if(i < len - 1)
-			GHMM_sumToOne(pXi, m_stateCount * m_stateCount);
-
-		// Accumulate probabilities
-		if(i ==  0)
-			GVec_add(pAccumInitProb, pGamma, m_stateCount);
-		if(i < len - 1)
-			GVec_add(pAccumTransProb, pXi, m_stateCount * m_stateCount);
-		for(int j = 0; j < m_stateCount; j++)
-			pAccumSymbolProb[m_symbolCount * j + pObservations[i]] += pGamma[j];
+		for(size_t i = 0; i < size; i++)
+			pVector[i] *= (1.0 / sum);
 	}
 }
 
@@ -312,7 +376,7 @@ double GHMM_sqDist(const double* pA, const double* pB, size_t nDims)
 double GHiddenMarkovModel::baumWelchEndPass()
 {
 	// Normalize all of the probabilities
-	double* pAccumInitProb = m_pTrainingBuffer;
+	double* pAccumInitProb = m_accum.data();
 	double* pAccumTransProb = pAccumInitProb + m_stateCount;
 	double* pAccumSymbolProb = pAccumTransProb + m_stateCount * m_stateCount;
 	GHMM_sumToOne(pAccumInitProb, m_stateCount);
@@ -329,48 +393,234 @@ double GHiddenMarkovModel::baumWelchEndPass()
 	err += GHMM_sqDist(m_pSymbolProbabilities, pAccumSymbolProb, m_stateCount * m_symbolCount);
 
 	// Copy over the old model
-	memcpy(m_pInitialStateProbabilities, pAccumInitProb, sizeof(double) * m_stateCount);
-	memcpy(m_pTransitionProbabilities, pAccumTransProb, sizeof(double) * m_stateCount * m_stateCount);
-	memcpy(m_pSymbolProbabilities, pAccumSymbolProb, sizeof(double) * m_stateCount * m_symbolCount);
+	memcpy(m_pInitialStateProbabilities, pAccumInitProb, sizeof(double) * m_accum.size());
 
 	return err;
 }
 
-void GHiddenMarkovModel::baumWelchEndTraining()
+void GHiddenMarkovModel::doChunk(size_t job, std::vector<double>& buf, std::vector<int>& backPointers)
 {
-	delete[] m_pTrainingBuffer;
-	m_pTrainingBuffer = NULL;
+	if(m_pJobStates)
+	{
+		// Decode a chunk of sequences
+		size_t start = job * HMM_CHUNK_SEQUENCES;
+		size_t end = std::min(start + HMM_CHUNK_SEQUENCES, m_pJobLengths->size());
+		for(size_t i = start; i < end; i++)
+		{
+			double logProb = viterbiLog((*m_pJobStates)[i], (*m_pJobSequences)[i], (*m_pJobLengths)[i], buf, backPointers);
+			if(m_pJobLogProbs)
+				(*m_pJobLogProbs)[i] = logProb;
+		}
+	}
+	else
+	{
+		// Sum the expected counts for a chunk of sequences. (The last value is the sum of their log probabilities.)
+		std::vector<double>& accum = m_jobAccums[job];
+		std::fill(accum.begin(), accum.end(), 0.0);
+		size_t start = (m_jobFirstChunk + job) * HMM_CHUNK_SEQUENCES;
+		size_t end = std::min(start + HMM_CHUNK_SEQUENCES, m_pJobLengths->size());
+		for(size_t i = start; i < end; i++)
+		{
+			if((*m_pJobLengths)[i] > 0)
+				accum.back() += baumWelchAddSequence((*m_pJobSequences)[i], (*m_pJobLengths)[i], accum.data(), buf);
+		}
+	}
 }
 
 void GHiddenMarkovModel::baumWelch(vector<int*>& sequences, vector<int>& lengths, int maxPasses)
 {
 	if(sequences.size() != lengths.size())
 		throw Ex("Expected both vectors to have the same size");
-	int maxLen = 0;
-	for(size_t i = 0; i < lengths.size(); i++)
-		maxLen = std::max(maxLen, lengths[i]);
-	baumWelchBeginTraining(maxLen);
+	size_t chunks = (lengths.size() + HMM_CHUNK_SEQUENCES - 1) / HMM_CHUNK_SEQUENCES;
+	size_t waveSize = std::max((size_t)1, std::min(m_workerThreads, chunks));
+	m_accum.resize(m_stateCount + m_stateCount * m_stateCount + m_stateCount * m_symbolCount);
+	m_jobAccums.resize(waveSize);
+	for(size_t i = 0; i < waveSize; i++)
+		m_jobAccums[i].resize(m_accum.size() + 1);
+	m_pJobSequences = &sequences;
+	m_pJobLengths = &lengths;
+	GMasterThread master;
+	for(size_t i = 0; i < waveSize; i++)
+		master.addWorker(new GHiddenMarkovModelWorker(master, *this));
 	double prevErr = 1e200;
+#ifdef _DEBUG
+	double prevLogProb = -1e300;
+#endif
 	while(maxPasses > 0)
 	{
-		baumWelchBeginPass();
-		for(size_t i = 0; i < lengths.size(); i++)
-			baumWelchAddSequence(sequences[i], lengths[i]);
+		// Sum the expected counts of the chunks in order, one wave at a time
+		prepareTables();
+		std::fill(m_accum.begin(), m_accum.end(), 0.0);
+		double logProb = 0.0;
+		for(m_jobFirstChunk = 0; m_jobFirstChunk < chunks; m_jobFirstChunk += waveSize)
+		{
+			size_t jobs = std::min(waveSize, chunks - m_jobFirstChunk);
+			master.doJobs(jobs);
+			for(size_t i = 0; i < jobs; i++)
+			{
+				const std::vector<double>& accum = m_jobAccums[i];
+				for(size_t j = 0; j < m_accum.size(); j++)
+					m_accum[j] += accum[j];
+				logProb += accum.back();
+			}
+		}
+#ifdef _DEBUG
+		GAssert(logProb >= prevLogProb - 1e-8 * std::abs(logProb)); // The sequences got less likely? This shouldn't happen
+		prevLogProb = logProb;
+#endif
 		double err = baumWelchEndPass();
 		if(err <= 0)
 			break;
-		GAssert(err <= prevErr); // The error got worse? This shouldn't happen
 		if(1.0 - (err / prevErr) < 0.003)
 			break;
 		prevErr = err;
 		maxPasses--;
 	}
-	baumWelchEndTraining();
+	m_pJobSequences = NULL;
+	m_pJobLengths = NULL;
+	m_jobAccums.clear();
+}
+
+/// Computes the log probability of a sequence and the most likely path by enumerating all of the state sequences.
+double GHMM_bruteForce(GHiddenMarkovModel& hmm, int states, int symbols, const int* pObs, int len, int* pBestPath, double* pBestLogProb)
+{
+	std::vector<int> path(len, 0);
+	double sum = 0.0;
+	double best = -1.0;
+	while(true)
+	{
+		double p = hmm.initialStateProbabilities()[path[0]] * hmm.symbolProbabilities()[symbols * path[0] + pObs[0]];
+		for(int i = 1; i < len; i++)
+			p *= hmm.transitionProbabilities()[states * path[i - 1] + path[i]] * hmm.symbolProbabilities()[symbols * path[i] + pObs[i]];
+		sum += p;
+		if(p > best)
+		{
+			best = p;
+			std::copy(path.begin(), path.end(), pBestPath);
+		}
+
+		// Advance to the next state sequence
+		int i = 0;
+		while(i < len && ++path[i] == states)
+			path[i++] = 0;
+		if(i == len)
+			break;
+	}
+	*pBestLogProb = log(best);
+	return log(sum);
+}
+
+void GHMM_randomize(GHiddenMarkovModel& hmm, int states, int symbols, GRand& rand)
+{
+	for(int i = 0; i < states; i++)
+		hmm.initialStateProbabilities()[i] = 0.1 + rand.uniform();
+	GHMM_sumToOne(hmm.initialStateProbabilities(), states);
+	for(int i = 0; i < states; i++)
+	{
+		for(int j = 0; j < states; j++)
+			hmm.transitionProbabilities()[states * i + j] = 0.1 + rand.uniform();
+		GHMM_sumToOne(hmm.transitionProbabilities() + states * i, states);
+		for(int j = 0; j < symbols; j++)
+			hmm.symbolProbabilities()[symbols * i + j] = 0.1 + rand.uniform();
+		GHMM_sumToOne(hmm.symbolProbabilities() + symbols * i, symbols);
+	}
+}
+
+void GHMM_testAlgorithms()
+{
+	// Compare the forward and Viterbi algorithms with brute force
+	GRand rand(0);
+	int states = 3;
+	int symbols = 4;
+	GHiddenMarkovModel hmm(states, symbols);
+	GHMM_randomize(hmm, states, symbols, rand);
+	int obs[5];
+	int path[5];
+	int expectedPath[5];
+	for(int len = 1; len <= 5; len++)
+	{
+		for(int i = 0; i < len; i++)
+			obs[i] = (int)rand.next(symbols);
+		double expectedLogProb;
+		double logProb = GHMM_bruteForce(hmm, states, symbols, obs, len, expectedPath, &expectedLogProb);
+		if(std::abs(hmm.forwardAlgorithm(obs, len) - logProb) > 1e-10)
+			throw Ex("forward algorithm failed");
+		if(std::abs(hmm.viterbi(path, obs, len) - expectedLogProb) > 1e-10)
+			throw Ex("viterbi failed");
+		for(int i = 0; i < len; i++)
+		{
+			if(path[i] != expectedPath[i])
+				throw Ex("viterbi found the wrong path");
+		}
+	}
+
+	// Make some sequences with a known model
+	std::vector<int> data;
+	vector<int> lengths;
+	for(size_t i = 0; i < 700; i++)
+	{
+		int len = 3 + (int)rand.next(8);
+		int state = (int)rand.next(2);
+		for(int j = 0; j < len; j++)
+		{
+			data.push_back(2 * state + (int)rand.next(2));
+			if(rand.uniform() < 0.2)
+				state = 1 - state;
+		}
+		lengths.push_back(len);
+	}
+	vector<int*> sequences;
+	size_t pos = 0;
+	for(size_t i = 0; i < lengths.size(); i++)
+	{
+		sequences.push_back(data.data() + pos);
+		pos += lengths[i];
+	}
+
+	// Batched decoding should match one-at-a-time decoding
+	std::vector<int> decoded(data.size());
+	vector<int*> decodedStates;
+	for(size_t i = 0; i < lengths.size(); i++)
+		decodedStates.push_back(decoded.data() + (sequences[i] - data.data()));
+	std::vector<double> logProbs;
+	hmm.setWorkerThreads(3);
+	hmm.viterbi(decodedStates, sequences, lengths, &logProbs);
+	for(size_t i = 0; i < lengths.size(); i += 37)
+	{
+		std::vector<int> single(lengths[i]);
+		if(hmm.viterbi(single.data(), sequences[i], lengths[i]) != logProbs[i])
+			throw Ex("batched viterbi failed");
+		for(int j = 0; j < lengths[i]; j++)
+		{
+			if(single[j] != decodedStates[i][j])
+				throw Ex("batched viterbi failed");
+		}
+	}
+
+	// Baum-Welch should not depend on the number of threads, and should make the sequences more likely
+	GHiddenMarkovModel hmm1(states, symbols);
+	GHMM_randomize(hmm1, states, symbols, rand);
+	GHiddenMarkovModel hmm2(states, symbols);
+	memcpy(hmm2.initialStateProbabilities(), hmm1.initialStateProbabilities(), sizeof(double) * (states + states * states + states * symbols));
+	double before = 0.0;
+	for(size_t i = 0; i < lengths.size(); i++)
+		before += hmm1.forwardAlgorithm(sequences[i], lengths[i]);
+	hmm1.baumWelch(sequences, lengths, 5);
+	hmm2.setWorkerThreads(4);
+	hmm2.baumWelch(sequences, lengths, 5);
+	if(memcmp(hmm1.initialStateProbabilities(), hmm2.initialStateProbabilities(), sizeof(double) * (states + states * states + states * symbols)) != 0)
+		throw Ex("The results depend on the number of threads");
+	double after = 0.0;
+	for(size_t i = 0; i < lengths.size(); i++)
+		after += hmm1.forwardAlgorithm(sequences[i], lengths[i]);
+	if(after <= before)
+		throw Ex("Baum-Welch did not improve the model");
 }
 
 // static
 void GHiddenMarkovModel::test()
 {
+	GHMM_testAlgorithms();
 	GHiddenMarkovModel hmm(2, 2);
 
 	// Set priors
@@ -398,13 +648,13 @@ void GHiddenMarkovModel::test()
 		throw Ex("wrong");
 	if(std::abs(pInitial[1] - 0.70150033979821202) > 1e-12)
 		throw Ex("wrong");
-	if(std::abs(pTrans[0] - 0.40399443180411687) > 1e-12)
+	if(std::abs(pTrans[0] - 0.39030955585464333) > 1e-12)
 		throw Ex("wrong");
-	if(std::abs(pTrans[1] - 0.59600556819588313) > 1e-12)
+	if(std::abs(pTrans[1] - 0.60969044414535670) > 1e-12)
 		throw Ex("wrong");
-	if(std::abs(pTrans[2] - 0.61206063945288547) > 1e-12)
+	if(std::abs(pTrans[2] - 0.66072245084590760) > 1e-12)
 		throw Ex("wrong");
-	if(std::abs(pTrans[3] - 0.38793936054711436) > 1e-12)
+	if(std::abs(pTrans[3] - 0.33927754915409230) > 1e-12)
 		throw Ex("wrong");
 	if(std::abs(pSym[0] - 0.49547467745041401) > 1e-12)
 		throw Ex("wrong");
@@ -20,20 +20,43 @@
 #ifndef __GHMM_H__
 #define __GHMM_H__
 
+#include <cstddef>
 #include <vector>
 
 namespace GClasses {
 
+class GHiddenMarkovModelWorker;
+
+/// A hidden Markov model with discrete symbols. The forward, backward, and Viterbi algorithms are
+/// computed in log space, so long sequences do not underflow. Each time step operates on whole vectors
+/// of states with tables that are laid out contiguously by state. Baum-Welch training and batched
+/// Viterbi decoding are split across worker threads by sequence. Baum-Welch sums the expected counts
+/// of fixed-size chunks of sequences in a fixed order, so the results do not depend on the number of threads.
 class GHiddenMarkovModel
 {
+friend class GHiddenMarkovModelWorker;
 protected:
 	int m_stateCount;
 	int m_symbolCount;
 	double* m_pInitialStateProbabilities;
 	double* m_pTransitionProbabilities;
 	double* m_pSymbolProbabilities;
-	double* m_pTrainingBuffer;
-	int m_maxLen;
+	size_t m_workerThreads;
+
+	// Tables that are computed from the probabilities before each operation
+	std::vector<double> m_logInit; // The log of each initial state probability
+	std::vector<double> m_logTrans; // m_logTrans[stateCount * i + j] is the log probability of transitioning from state i to state j
+	std::vector<double> m_transT; // m_transT[stateCount * j + i] is the probability of transitioning from state i to state j
+	std::vector<double> m_logEmit; // m_logEmit[stateCount * k + i] is the log probability of observing symbol k when in state i
+
+	// The operation that the workers are currently performing
+	const std::vector<int*>* m_pJobSequences;
+	const std::vector<int>* m_pJobLengths;
+	std::vector<int*>* m_pJobStates;
+	std::vector<double>* m_pJobLogProbs;
+	size_t m_jobFirstChunk;
+	std::vector<double> m_accum; // The expected counts for the current pass of Baum-Welch
+	std::vector<std::vector<double> > m_jobAccums; // The expected counts for each chunk in the current wave
 
 public:
 	GHiddenMarkovModel(int stateCount, int symbolCount);
@@ -51,19 +74,28 @@ public:
 	double* transitionProbabilities() { return m_pTransitionProbabilities; }
 
 	/// Returns the current vector of symbol probabilities, such that
-	/// pSymbolProbabilities[stateCount * i + j] is the probability of
+	/// pSymbolProbabilities[symbolCount * i + j] is the probability of
 	/// observing symbol j when in state i.
 	double* symbolProbabilities() { return m_pSymbolProbabilities; }
 
+	/// Specify the number of worker threads to use for baumWelch and batched viterbi decoding. The default is 1.
+	void setWorkerThreads(size_t n) { m_workerThreads = n; }
+
 	/// Calculates the log probability that the specified observation
 	/// sequence would occur with this model.
 	double forwardAlgorithm(const int* pObservations, int len);
 
 	/// Finds the most likely state sequence to explain the specified
-	/// observation sequence, and also returns the log probability of
-	/// that state sequence given the observation sequence.
+	/// observation sequence, and also returns the log of the joint probability
+	/// of that state sequence and the observation sequence.
 	double viterbi(int* pMostLikelyStates, const int* pObservations, int len);
 
+	/// Finds the most likely state sequence for each of the specified observation sequences.
+	/// mostLikelyStates[i] must point to a buffer with room for lengths[i] states. If pLogProbs is not NULL,
+	/// it is resized, and the log joint probability of each state sequence and its observation sequence is stored in it.
+	/// This is much faster than calling viterbi for each sequence when the sequences are short.
+	void viterbi(std::vector<int*>& mostLikelyStates, const std::vector<int*>& sequences, const std::vector<int>& lengths, std::vector<double>* pLogProbs = NULL);
+
 	/// Uses expectation maximization to refine the model based on
 	/// a training set of observation sequences. (You should have already
 	/// set prior values for the initial, transition and symbol probabilites
@@ -71,12 +103,28 @@ public:
 	void baumWelch(std::vector<int*>& sequences, std::vector<int>& lengths, int maxPasses = 0x7fffffff);
 
 protected:
-	void backwardAlgorithm(const int* pObservations, int len);
-	void baumWelchBeginTraining(int maxLen);
-	void baumWelchBeginPass();
-	void baumWelchAddSequence(const int* pObservations, int len);
+	/// Computes the log tables from the current probabilities.
+	void prepareTables();
+
+	/// Computes the log forward probabilities of each state at each time step, and stores them in pAlpha (len * stateCount).
+	/// pScratch must have room for 2 * stateCount values. Returns the log probability of the observation sequence.
+	double forwardLog(const int* pObservations, int len, double* pAlpha, double* pScratch);
+
+	/// Computes the log backward probabilities of each state at each time step, and stores them in pBeta (len * stateCount).
+	/// pScratch must have room for 3 * stateCount values.
+	void backwardLog(const int* pObservations, int len, double* pBeta, double* pScratch);
+
+	/// Finds the most likely state sequence with log tables that have already been prepared, and returns its log probability.
+	double viterbiLog(int* pMostLikelyStates, const int* pObservations, int len, std::vector<double>& buf, std::vector<int>& backPointers);
+
+	/// Adds the expected counts for one sequence to pAccum, and returns the log probability of the sequence.
+	double baumWelchAddSequence(const int* pObservations, int len, double* pAccum, std::vector<double>& buf);
+
+	/// Normalizes the expected counts in m_accum, copies them into the model, and returns the squared change.
 	double baumWelchEndPass();
-	void baumWelchEndTraining();
+
+	/// Performs one chunk of the current operation.
+	void doChunk(size_t job, std::vector<double>& buf, std::vector<int>& backPointers);
 };
 
 } // namespace GClasses
@@ -29,6 +29,17 @@
 #include <string>
 #include <sstream>
 #include <stdlib.h>
+#include <algorithm>
+#ifdef __linux__
+#	include <sys/epoll.h>
+#	include <sys/socket.h>
+#	include <netinet/in.h>
+#	include <netinet/tcp.h>
+#	include <arpa/inet.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#	include <errno.h>
+#endif
 
 using std::vector;
 using std::string;
@@ -1392,4 +1403,868 @@ bool GHttpMultipartParser::next(size_t* pNameStart, size_t* pNameLen, size_t* pV
 	return true;
 }
 
+
+
+
+
+
+/// The state of one connection to a GHttpEventServer
+class GHttpEventConnection
+{
+public:
+	SOCKET m_sock;
+	unsigned long long m_id;
+	string m_in; // Bytes that have been received
+	size_t m_inPos; // The start of the first request in m_in that has not been parsed
+	string m_out; // Bytes that are ready to send
+	size_t m_outPos; // The first byte in m_out that has not been sent
+	size_t m_nextSeq; // The sequence number for the next request
+	size_t m_nextSend; // The sequence number of the next response to send
+	size_t m_outstanding; // The number of requests that have not been answered
+	std::map<size_t, string> m_ready; // Responses that are waiting for earlier responses
+	bool m_close; // Close after the outstanding responses are sent
+	bool m_eof; // The client has finished sending
+
+	GHttpEventConnection(SOCKET sock, unsigned long long id)
+	: m_sock(sock), m_id(id), m_inPos(0), m_outPos(0), m_nextSeq(0), m_nextSend(0), m_outstanding(0), m_close(false), m_eof(false)
+	{
+	}
+};
+
+
+/// A request that is waiting for a worker, or a response that is waiting for the event loop
+class GHttpEventJob
+{
+public:
+	unsigned long long m_conn;
+	size_t m_seq;
+	GHttpRequest m_request;
+	string m_response;
+	bool m_close; // Close the connection after this response is sent
+
+	GHttpEventJob() : m_conn(0), m_seq(0), m_close(false) {}
+};
+
+
+class GHttpEventLoop : public GThread
+{
+protected:
+	GHttpEventServer* m_pServer;
+
+public:
+	GHttpEventLoop(GHttpEventServer* pServer) : GThread(), m_pServer(pServer) {}
+	virtual ~GHttpEventLoop() {}
+
+	virtual void run()
+	{
+		try
+		{
+			while(!m_pServer->m_stopping)
+				m_pServer->process(100);
+		}
+		catch(std::exception& e)
+		{
+			GSpinLockHolder hLock(m_pServer->m_pDoneLock, "GHttpEventLoop::run");
+			m_pServer->m_loopError = e.what();
+		}
+	}
+};
+
+
+class GHttpEventWorker : public GThread
+{
+protected:
+	GHttpEventServer* m_pServer;
+	size_t m_index;
+
+public:
+	GHttpEventWorker(GHttpEventServer* pServer, size_t index) : GThread(), m_pServer(pServer), m_index(index) {}
+	virtual ~GHttpEventWorker() {}
+
+	virtual void run();
+};
+
+
+const char* GHttpEventServer::statusText(int status)
+{
+	switch(status)
+	{
+		case 200: return "OK";
+		case 201: return "Created";
+		case 204: return "No Content";
+		case 400: return "Bad Request";
+		case 403: return "Forbidden";
+		case 404: return "Not Found";
+		case 405: return "Method Not Allowed";
+		case 413: return "Payload Too Large";
+		case 415: return "Unsupported Media Type";
+		case 431: return "Request Header Fields Too Large";
+		case 500: return "Internal Server Error";
+		case 501: return "Not Implemented";
+		case 503: return "Service Unavailable";
+		default: return "Unknown";
+	}
+}
+
+// static
+void GHttpEventServer::formatResponse(const GHttpResponse& response, bool keepAlive, bool head, string& out)
+{
+	std::ostringstream os;
+	os << "HTTP/1.1 " << response.status << " " << statusText(response.status) << "\r\n";
+	os << "Content-Type: " << response.contentType << "\r\n";
+	os << "Content-Length: " << response.body.length() << "\r\n";
+	os << "Connection: " << (keepAlive ? "keep-alive" : "close") << "\r\n\r\n";
+	out = os.str();
+	if(!head)
+		out += response.body;
+}
+
+#ifdef __linux__
+
+#define GHTTP_LISTENER_ID 0
+#define GHTTP_WAKE_ID 1
+
+void GHttpEventWorker::run()
+{
+	while(true)
+	{
+		// Wait for a job. (Each job comes with one byte in the pipe. Extra bytes tell the workers to stop.)
+		char c;
+		ssize_t n = read(m_pServer->m_jobPipe[0], &c, 1);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			break;
+		GHttpEventJob* pJob = NULL;
+		{
+			GSpinLockHolder hLock(m_pServer->m_pQueueLock, "GHttpEventWorker::run");
+			if(m_pServer->m_queueHead < m_pServer->m_queue.size())
+			{
+				pJob = m_pServer->m_queue[m_pServer->m_queueHead++];
+				if(m_pServer->m_queueHead >= m_pServer->m_queue.size())
+				{
+					m_pServer->m_queue.clear();
+					m_pServer->m_queueHead = 0;
+				}
+			}
+		}
+		if(!pJob)
+			break;
+		m_pServer->doJob(m_index, pJob);
+	}
+}
+
+GHttpEventServer::GHttpEventServer(unsigned short port, size_t workerThreads)
+: m_workerThreads(std::max((size_t)1, workerThreads)),
+m_maxQueue(1024),
+m_maxPipeline(16),
+m_maxRequestSize(64 * 1024 * 1024),
+m_nextConnection(2),
+m_queueHead(0),
+m_pLoop(NULL),
+m_stopping(false),
+m_requests(0),
+m_rejected(0)
+{
+	m_listener = socket(AF_INET, SOCK_STREAM, 0);
+	if(m_listener < 0)
+		throw Ex("Failed to create a socket: ", strerror(errno));
+
+	// Tell the socket that it's okay to reuse an old crashed socket that hasn't timed out yet
+	int flag = 1;
+	setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&flag, sizeof(flag));
+
+	// Bind the socket to the port
+	struct sockaddr_in addr;
+	memset(&addr, '\0', sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if(bind(m_listener, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+	{
+		close(m_listener);
+		throw Ex("Failed to bind to port ", to_str(port), ": ", strerror(errno));
+	}
+	if(listen(m_listener, SOMAXCONN) != 0)
+	{
+		close(m_listener);
+		throw Ex("Failed to listen on the socket: ", strerror(errno));
+	}
+	socklen_t addrLen = sizeof(addr);
+	getsockname(m_listener, (struct sockaddr*)&addr, &addrLen);
+	m_port = ntohs(addr.sin_port);
+	fcntl(m_listener, F_SETFL, fcntl(m_listener, F_GETFL, 0) | O_NONBLOCK);
+
+	// Make the pipes and the epoll instance
+	if(pipe(m_jobPipe) != 0 || pipe(m_donePipe) != 0)
+		throw Ex("Failed to make a pipe: ", strerror(errno));
+	fcntl(m_donePipe[0], F_SETFL, fcntl(m_donePipe[0], F_GETFL, 0) | O_NONBLOCK);
+	fcntl(m_donePipe[1], F_SETFL, fcntl(m_donePipe[1], F_GETFL, 0) | O_NONBLOCK);
+	m_epoll = epoll_create1(EPOLL_CLOEXEC);
+	if(m_epoll < 0)
+		throw Ex("epoll_create1 failed: ", strerror(errno));
+	struct epoll_event ev;
+	memset(&ev, '\0', sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = GHTTP_LISTENER_ID;
+	epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_listener, &ev);
+	ev.data.u64 = GHTTP_WAKE_ID;
+	epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_donePipe[0], &ev);
+	m_pQueueLock = new GSpinLock();
+	m_pDoneLock = new GSpinLock();
+}
+
+// virtual
+GHttpEventServer::~GHttpEventServer()
+{
+	stop();
+	while(m_conns.size() > 0)
+		closeConnection(m_conns.begin()->second);
+	for(size_t i = m_queueHead; i < m_queue.size(); i++)
+		delete(m_queue[i]);
+	for(size_t i = 0; i < m_done.size(); i++)
+		delete(m_done[i]);
+	close(m_epoll);
+	close(m_jobPipe[0]);
+	close(m_jobPipe[1]);
+	close(m_donePipe[0]);
+	close(m_donePipe[1]);
+	close(m_listener);
+	delete(m_pQueueLock);
+	delete(m_pDoneLock);
+}
+
+void GHttpEventServer::startWorkers()
+{
+	if(m_workers.size() > 0)
+		return;
+	for(size_t i = 0; i < m_workerThreads; i++)
+	{
+		GHttpEventWorker* pWorker = new GHttpEventWorker(this, i);
+		m_workers.push_back(pWorker);
+		pWorker->spawn();
+	}
+}
+
+void GHttpEventServer::start()
+{
+	startWorkers();
+	if(m_pLoop)
+		return;
+	m_stopping = false;
+	m_pLoop = new GHttpEventLoop(this);
+	m_pLoop->spawn();
+}
+
+void GHttpEventServer::stop()
+{
+	m_stopping = true;
+	if(m_pLoop)
+	{
+		char c = 0;
+		if(write(m_donePipe[1], &c, 1) < 0) {} // wake up the event loop
+		m_pLoop->join(1);
+		delete(m_pLoop);
+		m_pLoop = NULL;
+	}
+	if(m_workers.size() > 0)
+	{
+		// Send one extra byte for each worker. The workers finish the jobs that are queued, then stop.
+		string stopBytes(m_workers.size(), '\0');
+		if(write(m_jobPipe[1], stopBytes.c_str(), stopBytes.length()) < 0)
+			throw Ex("Failed to stop the workers: ", strerror(errno));
+		for(size_t i = 0; i < m_workers.size(); i++)
+		{
+			m_workers[i]->join(1);
+			delete(m_workers[i]);
+		}
+		m_workers.clear();
+	}
+	m_stopping = false;
+}
+
+string GHttpEventServer::loopError()
+{
+	GSpinLockHolder hLock(m_pDoneLock, "GHttpEventServer::loopError");
+	return m_loopError;
+}
+
+bool GHttpEventServer::process(int timeoutMs)
+{
+	startWorkers();
+	struct epoll_event events[64];
+	int n = epoll_wait(m_epoll, events, 64, timeoutMs);
+	if(n < 0)
+	{
+		if(errno == EINTR)
+			return false;
+		throw Ex("epoll_wait failed: ", strerror(errno));
+	}
+	for(int i = 0; i < n; i++)
+	{
+		unsigned long long id = events[i].data.u64;
+		if(id == GHTTP_LISTENER_ID)
+			acceptConnections();
+		else if(id == GHTTP_WAKE_ID)
+			collectResponses();
+		else
+		{
+			// (The connection may have been closed while handling an earlier event.)
+			std::map<unsigned long long, GHttpEventConnection*>::iterator it = m_conns.find(id);
+			if(it == m_conns.end())
+				continue;
+			GHttpEventConnection* pConn = it->second;
+			if(events[i].events & (EPOLLERR | EPOLLHUP))
+				closeConnection(pConn);
+			else if(events[i].events & EPOLLIN)
+				readConnection(pConn);
+			else if(events[i].events & EPOLLOUT)
+				writeConnection(pConn);
+		}
+	}
+	return n > 0;
+}
+
+void GHttpEventServer::watch(GHttpEventConnection* pConn, bool add)
+{
+	struct epoll_event ev;
+	memset(&ev, '\0', sizeof(ev));
+	ev.data.u64 = pConn->m_id;
+	if(!pConn->m_eof && !pConn->m_close && pConn->m_outstanding < m_maxPipeline)
+		ev.events |= EPOLLIN;
+	if(pConn->m_outPos < pConn->m_out.length())
+		ev.events |= EPOLLOUT;
+	if(epoll_ctl(m_epoll, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, pConn->m_sock, &ev) != 0)
+		throw Ex("epoll_ctl failed: ", strerror(errno));
+}
+
+void GHttpEventServer::acceptConnections()
+{
+	while(true)
+	{
+		SOCKET s = accept4(m_listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(s < 0)
+			break; // (Usually EAGAIN, meaning no more connections are waiting)
+		int flag = 1;
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&flag, sizeof(flag));
+		GHttpEventConnection* pConn = new GHttpEventConnection(s, m_nextConnection++);
+		m_conns[pConn->m_id] = pConn;
+		watch(pConn, true);
+	}
+}
+
+void GHttpEventServer::closeConnection(GHttpEventConnection* pConn)
+{
+	epoll_ctl(m_epoll, EPOLL_CTL_DEL, pConn->m_sock, NULL);
+	close(pConn->m_sock);
+	m_conns.erase(pConn->m_id);
+	delete(pConn);
+}
+
+void GHttpEventServer::readConnection(GHttpEventConnection* pConn)
+{
+	char buf[16384];
+	while(true)
+	{
+		ssize_t n = recv(pConn->m_sock, buf, sizeof(buf), 0);
+		if(n > 0)
+			pConn->m_in.append(buf, (size_t)n);
+		else if(n == 0)
+		{
+			pConn->m_eof = true;
+			break;
+		}
+		else if(errno == EINTR)
+			continue;
+		else if(errno == EAGAIN || errno == EWOULDBLOCK)
+			break;
+		else
+		{
+			closeConnection(pConn);
+			return;
+		}
+	}
+	parseRequests(pConn);
+	writeConnection(pConn);
+}
+
+void GHttpEventServer::parseRequests(GHttpEventConnection* pConn)
+{
+	string& in = pConn->m_in;
+	while(!pConn->m_close && pConn->m_outstanding < m_maxPipeline)
+	{
+		// Find the end of the headers
+		size_t headerEnd = in.find("\r\n\r\n", pConn->m_inPos);
+		int error = 0;
+		if(headerEnd == string::npos)
+		{
+			if(in.length() - pConn->m_inPos > MAX_HEADER_LEN)
+				error = 431;
+			else
+				break;
+		}
+
+		// Parse the request line and the headers
+		GHttpEventJob* pJob = NULL;
+		size_t contentLength = 0;
+		if(error == 0)
+		{
+			pJob = new GHttpEventJob();
+			GHttpRequest& req = pJob->m_request;
+			const char* szLine = in.c_str() + pConn->m_inPos;
+			const char* szEnd = in.c_str() + headerEnd + 2;
+			const char* szMethodEnd = strchr(szLine, ' ');
+			const char* szUrlEnd = szMethodEnd ? strchr(szMethodEnd + 1, ' ') : NULL;
+			const char* szLineEnd = strstr(szLine, "\r\n");
+			if(!szUrlEnd || szUrlEnd > szLineEnd || szMethodEnd == szLine)
+				error = 400;
+			else
+			{
+				req.method.assign(szLine, szMethodEnd - szLine);
+				const char* szQuery = szMethodEnd + 1;
+				while(szQuery < szUrlEnd && *szQuery != '?')
+					szQuery++;
+				req.url.assign(szMethodEnd + 1, szQuery - (szMethodEnd + 1));
+				if(szQuery < szUrlEnd)
+					req.params.assign(szQuery + 1, szUrlEnd - (szQuery + 1));
+				bool http11 = (strncmp(szUrlEnd + 1, "HTTP/1.1", 8) == 0);
+				req.keepAlive = http11;
+				for(szLine = szLineEnd + 2; szLine < szEnd; szLine = szLineEnd + 2)
+				{
+					szLineEnd = strstr(szLine, "\r\n");
+					if(_strnicmp(szLine, "Content-Length:", 15) == 0)
+						contentLength = (size_t)strtoull(szLine + 15, NULL, 10);
+					else if(_strnicmp(szLine, "Content-Type:", 13) == 0)
+					{
+						const char* szVal = szLine + 13;
+						while(*szVal == ' ')
+							szVal++;
+						req.contentType.assign(szVal, szLineEnd - szVal);
+					}
+					else if(_strnicmp(szLine, "Connection:", 11) == 0)
+					{
+						const char* szVal = szLine + 11;
+						while(*szVal == ' ')
+							szVal++;
+						if(_strnicmp(szVal, "close", 5) == 0)
+							req.keepAlive = false;
+						else if(_strnicmp(szVal, "keep-alive", 10) == 0)
+							req.keepAlive = true;
+					}
+					else if(_strnicmp(szLine, "Transfer-Encoding:", 18) == 0)
+						error = 501; // chunked requests are not supported
+				}
+				if(error == 0 && contentLength > m_maxRequestSize)
+					error = 413;
+			}
+		}
+
+		// Reject bad requests and close the connection
+		size_t seq = pConn->m_nextSeq++;
+		pConn->m_outstanding++;
+		if(error != 0)
+		{
+			delete(pJob);
+			GHttpResponse response;
+			response.status = error;
+			response.contentType = "text/plain";
+			response.body = statusText(error);
+			string bytes;
+			formatResponse(response, false, false, bytes);
+			deliver(pConn, seq, bytes);
+			pConn->m_close = true;
+			break;
+		}
+
+		// Wait for the rest of the body
+		size_t requestEnd = headerEnd + 4 + contentLength;
+		if(in.length() < requestEnd)
+		{
+			delete(pJob);
+			pConn->m_nextSeq--;
+			pConn->m_outstanding--;
+			break;
+		}
+		pJob->m_request.body.assign(in, headerEnd + 4, contentLength);
+		pConn->m_inPos = requestEnd;
+		if(!pJob->m_request.keepAlive)
+			pConn->m_close = true;
+		pJob->m_conn = pConn->m_id;
+		pJob->m_seq = seq;
+
+		// Queue the request, or reject it if the queue is full
+		bool queued = false;
+		{
+			GSpinLockHolder hLock(m_pQueueLock, "GHttpEventServer::parseRequests");
+			if(m_queue.size() - m_queueHead < m_maxQueue)
+			{
+				m_queue.push_back(pJob);
+				queued = true;
+			}
+		}
+		if(queued)
+		{
+			char c = 0;
+			if(write(m_jobPipe[1], &c, 1) != 1)
+				throw Ex("Failed to signal the workers: ", strerror(errno));
+		}
+		else
+		{
+			m_rejected++;
+			GHttpResponse response;
+			response.status = 503;
+			response.contentType = "text/plain";
+			response.body = statusText(503);
+			string bytes;
+			formatResponse(response, pJob->m_request.keepAlive, pJob->m_request.method.compare("HEAD") == 0, bytes);
+			delete(pJob);
+			deliver(pConn, seq, bytes);
+		}
+	}
+
+	// Discard the requests that have been parsed
+	if(pConn->m_inPos >= in.length())
+	{
+		in.clear();
+		pConn->m_inPos = 0;
+	}
+	else if(pConn->m_inPos > 65536)
+	{
+		in.erase(0, pConn->m_inPos);
+		pConn->m_inPos = 0;
+	}
+}
+
+void GHttpEventServer::deliver(GHttpEventConnection* pConn, size_t seq, string& bytes)
+{
+	pConn->m_outstanding--;
+	if(seq != pConn->m_nextSend)
+	{
+		pConn->m_ready[seq].swap(bytes);
+		return;
+	}
+	pConn->m_out.append(bytes);
+	pConn->m_nextSend++;
+	while(pConn->m_ready.size() > 0 && pConn->m_ready.begin()->first == pConn->m_nextSend)
+	{
+		pConn->m_out.append(pConn->m_ready.begin()->second);
+		pConn->m_ready.erase(pConn->m_ready.begin());
+		pConn->m_nextSend++;
+	}
+}
+
+bool GHttpEventServer::writeConnection(GHttpEventConnection* pConn)
+{
+	while(pConn->m_outPos < pConn->m_out.length())
+	{
+		ssize_t n = ::send(pConn->m_sock, pConn->m_out.c_str() + pConn->m_outPos, pConn->m_out.length() - pConn->m_outPos, MSG_NOSIGNAL);
+		if(n > 0)
+			pConn->m_outPos += n;
+		else if(n < 0 && errno == EINTR)
+			continue;
+		else if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		else
+		{
+			closeConnection(pConn);
+			return false;
+		}
+	}
+	if(pConn->m_outPos >= pConn->m_out.length())
+	{
+		pConn->m_out.clear();
+		pConn->m_outPos = 0;
+		if(pConn->m_outstanding == 0 && (pConn->m_close || pConn->m_eof))
+		{
+			closeConnection(pConn);
+			return false;
+		}
+	}
+	watch(pConn, false);
+	return true;
+}
+
+void GHttpEventServer::doJob(size_t worker, GHttpEventJob* pJob)
+{
+	GHttpResponse response;
+	response.pJob = pJob;
+	try
+	{
+		handleRequest(worker, pJob->m_request, response);
+	}
+	catch(std::exception& e)
+	{
+		// If the request was deferred, the handle is no longer valid. The state of the connection is unknown,
+		// so it is closed after this response.
+		if(response.deferred)
+		{
+			response.deferred = false;
+			pJob->m_request.keepAlive = false;
+			pJob->m_close = true;
+		}
+		response.status = 500;
+		response.contentType = "text/plain";
+		response.body = e.what();
+	}
+	if(!response.deferred)
+		complete(pJob, response);
+}
+
+GHttpEventJob* GHttpEventServer::defer(GHttpResponse& response)
+{
+	if(!response.pJob)
+		throw Ex("defer may only be called from handleRequest");
+	response.deferred = true;
+	return response.pJob;
+}
+
+void GHttpEventServer::complete(GHttpEventJob* pJob, const GHttpResponse& response)
+{
+	formatResponse(response, pJob->m_request.keepAlive, pJob->m_request.method.compare("HEAD") == 0, pJob->m_response);
+	pJob->m_request.body.clear();
+	{
+		GSpinLockHolder hLock(m_pDoneLock, "GHttpEventServer::complete");
+		m_done.push_back(pJob);
+	}
+	char c = 0;
+	if(write(m_donePipe[1], &c, 1) < 0) {} // (If the pipe is full, the event loop is already awake.)
+}
+
+void GHttpEventServer::collectResponses()
+{
+	char buf[256];
+	while(read(m_donePipe[0], buf, sizeof(buf)) > 0)
+	{
+	}
+	vector<GHttpEventJob*> done;
+	{
+		GSpinLockHolder hLock(m_pDoneLock, "GHttpEventServer::collectResponses");
+		done.swap(m_done);
+	}
+	vector<unsigned long long> touched;
+	for(size_t i = 0; i < done.size(); i++)
+	{
+		GHttpEventJob* pJob = done[i];
+		m_requests++;
+		std::map<unsigned long long, GHttpEventConnection*>::iterator it = m_conns.find(pJob->m_conn);
+		if(it != m_conns.end())
+		{
+			deliver(it->second, pJob->m_seq, pJob->m_response);
+			if(pJob->m_close)
+				it->second->m_close = true;
+			if(touched.size() == 0 || touched.back() != pJob->m_conn)
+				touched.push_back(pJob->m_conn);
+		}
+		delete(pJob);
+	}
+	for(size_t i = 0; i < touched.size(); i++)
+	{
+		std::map<unsigned long long, GHttpEventConnection*>::iterator it = m_conns.find(touched[i]);
+		if(it == m_conns.end())
+			continue;
+		parseRequests(it->second); // (There may be more room in the pipeline now.)
+		writeConnection(it->second);
+	}
+}
+
+#else // __linux__
+
+void GHttpEventWorker::run()
+{
+}
+
+GHttpEventServer::GHttpEventServer(unsigned short port, size_t workerThreads)
+{
+	throw Ex("GHttpEventServer uses epoll, so it is only supported on Linux");
+}
+
+// virtual
+GHttpEventServer::~GHttpEventServer()
+{
+}
+
+void GHttpEventServer::startWorkers() {}
+void GHttpEventServer::start() {}
+void GHttpEventServer::stop() {}
+bool GHttpEventServer::process(int timeoutMs) { return false; }
+string GHttpEventServer::loopError() { return string(); }
+void GHttpEventServer::watch(GHttpEventConnection* pConn, bool add) {}
+void GHttpEventServer::acceptConnections() {}
+void GHttpEventServer::closeConnection(GHttpEventConnection* pConn) {}
+void GHttpEventServer::readConnection(GHttpEventConnection* pConn) {}
+void GHttpEventServer::parseRequests(GHttpEventConnection* pConn) {}
+void GHttpEventServer::deliver(GHttpEventConnection* pConn, size_t seq, string& bytes) {}
+bool GHttpEventServer::writeConnection(GHttpEventConnection* pConn) { return false; }
+void GHttpEventServer::doJob(size_t worker, GHttpEventJob* pJob) {}
+GHttpEventJob* GHttpEventServer::defer(GHttpResponse& response) { return NULL; }
+void GHttpEventServer::complete(GHttpEventJob* pJob, const GHttpResponse& response) {}
+void GHttpEventServer::collectResponses() {}
+
+#endif // !__linux__
+
+#ifdef __linux__
+class GHttpEventServer_TestServer : public GHttpEventServer
+{
+public:
+	GHttpEventServer_TestServer(size_t workers) : GHttpEventServer(0, workers) {}
+	virtual ~GHttpEventServer_TestServer() { stop(); }
+
+protected:
+	virtual void handleRequest(size_t worker, const GHttpRequest& request, GHttpResponse& response)
+	{
+		if(request.url.compare("/slow") == 0)
+			GThread::sleep(30);
+		if(request.url.compare("/throw") == 0)
+			throw Ex("oops");
+		if(request.url.compare("/defer") == 0)
+		{
+			GHttpEventJob* pJob = defer(response);
+			GHttpResponse later;
+			later.body = "later";
+			complete(pJob, later);
+			return;
+		}
+		if(request.url.compare("/deferthrow") == 0)
+		{
+			defer(response);
+			throw Ex("oops");
+		}
+		response.contentType = "text/plain";
+		response.body = request.method + " " + request.url + "?" + request.params + ":" + request.body;
+	}
+};
+
+SOCKET GHttpEventServer_connect(unsigned short port)
+{
+	SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, '\0', sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(connect(s, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+		throw Ex("Failed to connect to the test server: ", strerror(errno));
+	struct timeval timeout;
+	timeout.tv_sec = 10;
+	timeout.tv_usec = 0;
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+	return s;
+}
+
+void GHttpEventServer_send(SOCKET s, const string& request)
+{
+	if(send(s, request.c_str(), request.length(), MSG_NOSIGNAL) != (ssize_t)request.length())
+		throw Ex("Failed to send a request");
+}
+
+// Receives one response, and returns its status code. buf holds bytes that were received but not yet consumed.
+// Returns 0 if the server closed the connection.
+int GHttpEventServer_receive(SOCKET s, string& buf, string& body)
+{
+	while(true)
+	{
+		size_t headerEnd = buf.find("\r\n\r\n");
+		if(headerEnd != string::npos)
+		{
+			size_t lenPos = buf.find("Content-Length: ");
+			if(lenPos == string::npos || lenPos > headerEnd)
+				throw Ex("Expected a Content-Length header");
+			size_t len = (size_t)strtoull(buf.c_str() + lenPos + 16, NULL, 10);
+			if(buf.length() >= headerEnd + 4 + len)
+			{
+				int status = atoi(buf.c_str() + 9);
+				body = buf.substr(headerEnd + 4, len);
+				buf.erase(0, headerEnd + 4 + len);
+				return status;
+			}
+		}
+		char tmp[4096];
+		ssize_t n = recv(s, tmp, sizeof(tmp), 0);
+		if(n == 0)
+			return 0;
+		if(n < 0)
+			throw Ex("Failed to receive a response: ", strerror(errno));
+		buf.append(tmp, (size_t)n);
+	}
+}
+
+// static
+void GHttpEventServer::test()
+{
+	GHttpEventServer_TestServer server(2);
+	server.start();
+	string buf, body;
+
+	// Pipeline several requests, with a slow one first, and make sure the responses come back in order
+	SOCKET s = GHttpEventServer_connect(server.port());
+	GHttpEventServer_send(s, "GET /slow?a=1 HTTP/1.1\r\nHost: x\r\n\r\n"
+		"POST /b HTTP/1.1\r\nContent-Length: 5\r\nContent-Type: text/plain\r\n\r\nhello"
+		"GET /defer HTTP/1.1\r\n\r\n"
+		"GET /c HTTP/1.1\r\n\r\n");
+	if(GHttpEventServer_receive(s, buf, body) != 200 || body.compare("GET /slow?a=1:") != 0)
+		throw Ex("wrong response");
+	if(GHttpEventServer_receive(s, buf, body) != 200 || body.compare("POST /b?:hello") != 0)
+		throw Ex("wrong response");
+	if(GHttpEventServer_receive(s, buf, body) != 200 || body.compare("later") != 0)
+		throw Ex("wrong response");
+	if(GHttpEventServer_receive(s, buf, body) != 200 || body.compare("GET /c?:") != 0)
+		throw Ex("wrong response");
+
+	// The connection should still be alive. Send a request in two pieces.
+	GHttpEventServer_send(s, "POST /d HTTP/1.1\r\nContent-Len");
+	GThread::sleep(5);
+	GHttpEventServer_send(s, "gth: 3\r\n\r\nabc");
+	if(GHttpEventServer_receive(s, buf, body) != 200 || body.compare("POST /d?:abc") != 0)
+		throw Ex("wrong response");
+
+	// An exception in the handler should produce a 500, and "Connection: close" should close the connection
+	{
+		GExpectException ee;
+		GHttpEventServer_send(s, "GET /throw HTTP/1.1\r\nConnection: close\r\n\r\n");
+		if(GHttpEventServer_receive(s, buf, body) != 500 || body.compare("oops") != 0)
+			throw Ex("wrong response");
+	}
+	if(GHttpEventServer_receive(s, buf, body) != 0)
+		throw Ex("expected the connection to close");
+	close(s);
+
+	// An exception after deferring should also produce a 500, and close the connection
+	s = GHttpEventServer_connect(server.port());
+	{
+		GExpectException ee;
+		GHttpEventServer_send(s, "GET /deferthrow HTTP/1.1\r\n\r\n");
+		if(GHttpEventServer_receive(s, buf, body) != 500 || body.compare("oops") != 0)
+			throw Ex("wrong response");
+	}
+	if(GHttpEventServer_receive(s, buf, body) != 0)
+		throw Ex("expected the connection to close");
+	close(s);
+
+	// A malformed request should get a 400
+	s = GHttpEventServer_connect(server.port());
+	GHttpEventServer_send(s, "garbage\r\n\r\n");
+	if(GHttpEventServer_receive(s, buf, body) != 400)
+		throw Ex("expected a bad request");
+	close(s);
+	if(server.requests() != 7)
+		throw Ex("wrong number of requests");
+
+	// When the queue is full, requests should be rejected without closing the connection
+	server.setMaxQueue(0);
+	s = GHttpEventServer_connect(server.port());
+	GHttpEventServer_send(s, "GET /e HTTP/1.1\r\n\r\nGET /f HTTP/1.1\r\n\r\n");
+	if(GHttpEventServer_receive(s, buf, body) != 503 || GHttpEventServer_receive(s, buf, body) != 503)
+		throw Ex("expected the request to be rejected");
+	if(server.rejected() != 2)
+		throw Ex("wrong number of rejected requests");
+	close(s);
+	server.stop();
+}
+#else
+// static
+void GHttpEventServer::test()
+{
+}
+#endif
+
 } // namespace GClasses
@@ -23,6 +23,8 @@
 #include <vector>
 #include <sstream>
 #include <map>
+#include <string>
+#include <atomic>
 #include <string.h>
 #include "GSocket.h"
 
@@ -35,6 +37,11 @@ class GTCPServer;
 class GHttpConnection;
 class GHeap;
 class GConstStringHashTable;
+class GSpinLock;
+class GHttpEventConnection;
+class GHttpEventJob;
+class GHttpEventLoop;
+class GHttpEventWorker;
 
 
 /// This class allows you to get files using the HTTP protocol
@@ -260,6 +267,167 @@ protected:
 };
 
 
+/// A request that has been fully received by a GHttpEventServer.
+struct GHttpRequest
+{
+	std::string method; ///< "GET", "POST", "HEAD", etc.
+	std::string url; ///< The path, without the parameters
+	std::string params; ///< Everything after the '?' in the URL
+	std::string contentType; ///< The value of the Content-Type header, or "" if there was none
+	std::string body; ///< The payload of a POST request
+	bool keepAlive; ///< True iff the connection will remain open after the response is sent
+};
+
+
+/// A response that is produced by GHttpEventServer::handleRequest.
+struct GHttpResponse
+{
+	int status; ///< The HTTP status code. The default is 200.
+	std::string contentType; ///< The default is "text/html".
+	std::string body;
+	GHttpEventJob* pJob; ///< (Used by GHttpEventServer::defer)
+	bool deferred; ///< (Used by GHttpEventServer::defer)
+
+	GHttpResponse() : status(200), contentType("text/html"), pJob(NULL), deferred(false) {}
+};
+
+
+/// An HTTP server that serves many connections concurrently. A single event loop waits on all of
+/// the sockets with epoll, reads whatever has arrived without blocking, and parses complete requests
+/// out of the stream. Requests are placed in a bounded queue and handled by a pool of worker threads, so a slow
+/// request does not delay the others. Connections are kept alive (per HTTP/1.1) and clients may pipeline
+/// requests. Responses on each connection are sent in the order in which the requests arrived. When the queue is full,
+/// requests are answered immediately with "503 Service Unavailable" instead of waiting. (Only Linux is supported,
+/// because this uses epoll.)
+/// To use this class, inherit from it and implement handleRequest. Derived classes should call stop in their
+/// destructors, so the workers are no longer using them when they are destroyed.
+class GHttpEventServer
+{
+friend class GHttpEventLoop;
+friend class GHttpEventWorker;
+protected:
+	SOCKET m_listener;
+	unsigned short m_port;
+	int m_epoll;
+	int m_jobPipe[2]; // The event loop writes one byte for each queued job, and the workers block reading them
+	int m_donePipe[2]; // The workers write a byte to wake up the event loop when responses are ready
+	size_t m_workerThreads;
+	std::atomic<size_t> m_maxQueue;
+	std::atomic<size_t> m_maxPipeline;
+	std::atomic<size_t> m_maxRequestSize;
+	unsigned long long m_nextConnection;
+	std::map<unsigned long long, GHttpEventConnection*> m_conns;
+	GSpinLock* m_pQueueLock;
+	std::vector<GHttpEventJob*> m_queue;
+	size_t m_queueHead;
+	GSpinLock* m_pDoneLock; // Guards m_done and m_loopError
+	std::vector<GHttpEventJob*> m_done;
+	std::vector<GHttpEventWorker*> m_workers;
+	GHttpEventLoop* m_pLoop;
+	volatile bool m_stopping;
+	std::atomic<size_t> m_requests;
+	std::atomic<size_t> m_rejected;
+	std::string m_loopError;
+
+public:
+	/// Listens on the specified port. If port is 0, an unused port is chosen. (Call port() to find out which one.)
+	/// workerThreads specifies the number of threads that call handleRequest.
+	GHttpEventServer(unsigned short port, size_t workerThreads = 1);
+	virtual ~GHttpEventServer();
+
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
+	/// Returns the port on which this server listens.
+	unsigned short port() const { return m_port; }
+
+	/// Specify the maximum number of requests that may wait in the queue for a worker. The default is 1024.
+	void setMaxQueue(size_t n) { m_maxQueue = n; }
+
+	/// Specify the maximum number of pipelined requests that one connection may have outstanding. When this
+	/// many are outstanding, no more are read from that connection until some of them are answered. The default is 16.
+	void setMaxPipeline(size_t n) { m_maxPipeline = n; }
+
+	/// Specify the maximum size of a request body in bytes. Larger requests are answered with
+	/// "413 Payload Too Large", and the connection is closed. The default is 64MB.
+	void setMaxRequestSize(size_t n) { m_maxRequestSize = n; }
+
+	/// Performs one iteration of the event loop. It waits up to timeoutMs milliseconds for something to
+	/// happen. Returns true if it did anything. (Call this constantly in your main loop, or call start instead.)
+	bool process(int timeoutMs = 0);
+
+	/// Runs the event loop in its own thread until stop is called.
+	void start();
+
+	/// Stops the event loop (if it was started) and the worker threads. Requests that have not been
+	/// answered are dropped. It is safe to call this more than once.
+	void stop();
+
+	/// Returns the number of requests that have been answered by handleRequest.
+	size_t requests() const { return m_requests; }
+
+	/// Returns the number of requests that were rejected because the queue was full.
+	size_t rejected() const { return m_rejected; }
+
+	/// Returns the message of the error that stopped the event loop thread that start began, or an empty string
+	/// if it has not stopped because of an error.
+	std::string loopError();
+
+	/// Returns the standard reason phrase for an HTTP status code, such as "Not Found" for 404.
+	static const char* statusText(int status);
+
+protected:
+	/// This is called by the worker threads to answer each request. worker is the index of the
+	/// worker thread that is calling it, from 0 to workerThreads-1, so implementations can keep
+	/// per-thread state without locking. If this throws, the client receives "500 Internal Server Error"
+	/// with the exception message. (If it throws after calling defer, the connection is also closed after
+	/// that response, and the handle that defer returned must not be passed to complete.)
+	virtual void handleRequest(size_t worker, const GHttpRequest& request, GHttpResponse& response) = 0;
+
+	/// Call this in handleRequest to answer the request later, instead of filling in response. It returns a
+	/// handle that must be passed to complete exactly once, from any thread. The connection keeps its other
+	/// responses in order while it waits, and the worker thread is free to handle other requests.
+	GHttpEventJob* defer(GHttpResponse& response);
+
+	/// Sends the response to a request that was deferred. (This may be called from any thread.)
+	void complete(GHttpEventJob* pJob, const GHttpResponse& response);
+
+	/// Starts the worker threads, if they have not already been started.
+	void startWorkers();
+
+	/// Accepts all pending connections.
+	void acceptConnections();
+
+	/// Reads everything that is available on pConn, and queues any complete requests.
+	void readConnection(GHttpEventConnection* pConn);
+
+	/// Parses as many complete requests from the input buffer of pConn as its pipeline allows.
+	void parseRequests(GHttpEventConnection* pConn);
+
+	/// Sends as much of the output buffer of pConn as the socket will take. Closes the connection if
+	/// it is finished. Returns false if the connection was closed.
+	bool writeConnection(GHttpEventConnection* pConn);
+
+	/// Moves responses that the workers have finished to their connections.
+	void collectResponses();
+
+	/// Stores a response to be sent when all the earlier responses on the same connection have been sent.
+	void deliver(GHttpEventConnection* pConn, size_t seq, std::string& bytes);
+
+	/// Closes a connection and forgets it.
+	void closeConnection(GHttpEventConnection* pConn);
+
+	/// Updates the events that epoll watches for on pConn.
+	void watch(GHttpEventConnection* pConn, bool add);
+
+	/// Handles one job. (This is called by the worker threads.)
+	void doJob(size_t worker, GHttpEventJob* pJob);
+
+	/// Formats a complete response, including the headers.
+	static void formatResponse(const GHttpResponse& response, bool keepAlive, bool head, std::string& out);
+};
+
+
 struct strComp
 {
 	bool operator()(const char* a, const char* b) const { return strcmp(a, b) < 0; }
@@ -0,0 +1,482 @@
+/*
+  The contents of this file are dedicated by all of its authors, including
+
+    Michael S. Gashler,
+    anonymous contributors,
+
+  to the public domain (http://creativecommons.org/publicdomain/zero/1.0/).
+
+  Note that some moral obligations still exist in the absence of legal ones.
+  For example, it would still be dishonest to deliberately misrepresent the
+  origin of a work. Although we impose no legal requirements to obtain a
+  license, it is beseeming for those who build on the works of others to
+  give back useful improvements, or find a way to pay it forward. If
+  you would like to cite us, a published paper about Waffles can be found
+  at http://jmlr.org/papers/volume12/gashler11a/gashler11a.pdf. If you find
+  our code to be useful, the Waffles team would love to hear how you use it.
+*/
+
+#include "GIncrementalPCA.h"
+#include "GDataPipeline.h"
+#include "GTruncatedSVD.h"
+#include "GError.h"
+#include "GRand.h"
+#include "GThread.h"
+#include "GHolders.h"
+#include <cmath>
+#include <memory>
+#include <algorithm>
+
+namespace GClasses {
+
+GPCASketch::GPCASketch(size_t dims, size_t sketchRows, bool aboutOrigin)
+: m_dims(dims), m_maxRows(sketchRows), m_aboutOrigin(aboutOrigin), m_count(0), m_mean(dims), m_rows(0, dims)
+{
+	if(sketchRows < 1)
+		throw Ex("Expected at least one sketch row");
+	m_mean.fill(0.0, 0, dims);
+}
+
+GPCASketch::~GPCASketch()
+{
+}
+
+void GPCASketch::clear()
+{
+	m_count = 0;
+	m_mean.fill(0.0, 0, m_dims);
+	m_rows.resize(0, m_dims);
+}
+
+void GPCASketch::add(const GMatrix& data, size_t rowStart, size_t rowCount)
+{
+	if(data.cols() != m_dims)
+		throw Ex("Expected ", to_str(m_dims), " columns. Got ", to_str(data.cols()));
+	if(rowCount == INVALID_INDEX)
+		rowCount = data.rows() - rowStart;
+	if(rowStart + rowCount > data.rows())
+		throw Ex("Row range out of range");
+
+	// Absorb the rows one block at a time, so the stacked matrix stays small
+	size_t blockSize = m_maxRows;
+	m_block.resize(blockSize, m_dims);
+	GVec blockMean(m_dims);
+	std::vector<const double*> rowPtrs(blockSize);
+	for(size_t r = rowStart; r < rowStart + rowCount; r += blockSize)
+	{
+		size_t b = std::min(blockSize, rowStart + rowCount - r);
+
+		// Compute the mean of the known values in each column
+		for(size_t j = 0; j < m_dims; j++)
+		{
+			double sum = 0.0;
+			size_t known = 0;
+			for(size_t i = 0; i < b; i++)
+			{
+				double v = data[r + i][j];
+				if(v != UNKNOWN_REAL_VALUE)
+				{
+					sum += v;
+					known++;
+				}
+			}
+			if(m_aboutOrigin)
+				blockMean[j] = 0.0;
+			else
+				blockMean[j] = (known > 0 ? sum / known : m_mean[j]);
+		}
+
+		// Center the block
+		for(size_t i = 0; i < b; i++)
+		{
+			const GVec& in = data[r + i];
+			GVec& out = m_block[i];
+			for(size_t j = 0; j < m_dims; j++)
+				out[j] = (in[j] == UNKNOWN_REAL_VALUE ? 0.0 : in[j] - blockMean[j]);
+			rowPtrs[i] = out.data();
+		}
+		absorb(rowPtrs.data(), b, b, blockMean);
+	}
+}
+
+void GPCASketch::merge(const GPCASketch& that)
+{
+	if(that.m_dims != m_dims)
+		throw Ex("Mismatching dims");
+	if(that.m_aboutOrigin != m_aboutOrigin)
+		throw Ex("Cannot merge a sketch about the origin with a sketch about the mean");
+	if(that.m_count == 0)
+		return;
+	std::vector<const double*> rowPtrs(that.m_rows.rows());
+	for(size_t i = 0; i < that.m_rows.rows(); i++)
+		rowPtrs[i] = that.m_rows[i].data();
+	absorb(rowPtrs.data(), that.m_rows.rows(), that.m_count, that.m_mean);
+}
+
+void GPCASketch::absorb(const double* const* ppRows, size_t rows, size_t count, const GVec& mean)
+{
+	// Stack the current directions, the new rows, and a row that accounts for the difference between the means
+	size_t n1 = m_count;
+	size_t n2 = count;
+	bool correct = (!m_aboutOrigin && n1 > 0 && n2 > 0);
+	size_t stackRows = m_rows.rows() + rows + (correct ? 1 : 0);
+	if(stackRows == 0)
+	{
+		m_count += n2;
+		return;
+	}
+	m_stack.resize(stackRows * m_dims);
+	double* pS = m_stack.data();
+	for(size_t i = 0; i < m_rows.rows(); i++)
+	{
+		const GVec& row = m_rows[i];
+		for(size_t j = 0; j < m_dims; j++)
+			*(pS++) = row[j];
+	}
+	for(size_t i = 0; i < rows; i++)
+	{
+		const double* pRow = ppRows[i];
+		for(size_t j = 0; j < m_dims; j++)
+			*(pS++) = pRow[j];
+	}
+	if(correct)
+	{
+		double scale = std::sqrt((double)n1 * (double)n2 / (double)(n1 + n2));
+		for(size_t j = 0; j < m_dims; j++)
+			*(pS++) = scale * (m_mean[j] - mean[j]);
+	}
+
+	// Update the mean and count
+	if(!m_aboutOrigin)
+	{
+		double w1 = (double)n1 / (double)(n1 + n2);
+		double w2 = (double)n2 / (double)(n1 + n2);
+		for(size_t j = 0; j < m_dims; j++)
+			m_mean[j] = w1 * m_mean[j] + w2 * mean[j];
+	}
+	m_count += n2;
+
+	// Rotate the stacked rows until they are orthogonal, then keep the strongest ones
+	m_rot.resize(stackRows * stackRows);
+	GTruncatedSVD::jacobi(m_stack.data(), stackRows, m_dims, m_rot.data());
+	std::vector< std::pair<double, size_t> > order;
+	for(size_t i = 0; i < stackRows; i++)
+	{
+		const double* pRow = m_stack.data() + i * m_dims;
+		double sq = 0.0;
+		for(size_t j = 0; j < m_dims; j++)
+			sq += pRow[j] * pRow[j];
+		order.push_back(std::make_pair(-sq, i));
+	}
+	std::sort(order.begin(), order.end());
+	double threshold = -order[0].first * 1e-24;
+	size_t keep = 0;
+	while(keep < std::min(m_maxRows, stackRows) && -order[keep].first > threshold)
+		keep++;
+	m_rows.resize(keep, m_dims);
+	for(size_t i = 0; i < keep; i++)
+		m_rows[i].copy(m_stack.data() + order[i].second * m_dims, m_dims);
+}
+
+void GPCASketch::components(size_t k, GMatrix& basis, GVec* pEigVals) const
+{
+	basis.resize(1 + k, m_dims);
+	basis[0].copy(m_mean);
+	if(pEigVals)
+		pEigVals->resize(k);
+	for(size_t i = 0; i < k; i++)
+	{
+		GVec& vec = basis[1 + i];
+		double sq = 0.0;
+		if(i < m_rows.rows())
+		{
+			vec.copy(m_rows[i]);
+			sq = vec.squaredMagnitude();
+			vec *= (1.0 / std::sqrt(sq));
+		}
+		else
+			vec.fill(0.0, 0, m_dims);
+		if(pEigVals)
+			(*pEigVals)[i] = (m_count > 1 ? sq / (m_count - 1) : 0.0);
+	}
+}
+
+
+
+
+class GIncrementalPCAWorker : public GWorkerThread
+{
+protected:
+	GIncrementalPCA& m_pca;
+
+public:
+	GIncrementalPCAWorker(GMasterThread& master, GIncrementalPCA& pca)
+	: GWorkerThread(master), m_pca(pca)
+	{
+	}
+
+	virtual ~GIncrementalPCAWorker()
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		m_pca.sketchChunk(jobId);
+	}
+};
+
+
+GIncrementalPCA::GIncrementalPCA(size_t targetDims)
+: GPCA(targetDims), m_sketchRows(0), m_chunkRows(4096)
+{
+}
+
+// virtual
+GIncrementalPCA::~GIncrementalPCA()
+{
+	for(size_t i = 0; i < m_jobSketches.size(); i++)
+		delete(m_jobSketches[i]);
+}
+
+size_t GIncrementalPCA::sketchRows() const
+{
+	if(m_sketchRows == 0)
+		return 2 * m_targetDims + 10;
+	return std::max(m_sketchRows, m_targetDims);
+}
+
+void GIncrementalPCA::makeJobSketches(size_t dims, size_t count)
+{
+	for(size_t i = 0; i < m_jobSketches.size(); i++)
+		delete(m_jobSketches[i]);
+	m_jobSketches.clear();
+	for(size_t i = 0; i < count; i++)
+		m_jobSketches.push_back(new GPCASketch(dims, sketchRows(), m_aboutOrigin));
+	m_jobData.clear();
+	m_jobStart.clear();
+	m_jobCount.clear();
+}
+
+void GIncrementalPCA::sketchChunk(size_t job)
+{
+	m_jobSketches[job]->add(*m_jobData[job], m_jobStart[job], m_jobCount[job]);
+}
+
+void GIncrementalPCA::sketchWave(GMasterThread& master, GPCASketch& sketch)
+{
+	for(size_t i = 0; i < m_jobData.size(); i++)
+		m_jobSketches[i]->clear();
+	master.doJobs(m_jobData.size());
+
+	// Merge in a fixed order, so the results do not depend on which thread sketched which chunk
+	for(size_t i = 0; i < m_jobData.size(); i++)
+		sketch.merge(*m_jobSketches[i]);
+	m_jobData.clear();
+	m_jobStart.clear();
+	m_jobCount.clear();
+}
+
+void GIncrementalPCA::setComponents(const GPCASketch& sketch)
+{
+	delete(m_pBasisVectors);
+	m_pBasisVectors = new GMatrix();
+	sketch.components(m_targetDims, *m_pBasisVectors, m_eigVals.size() > 0 ? &m_eigVals : NULL);
+}
+
+// virtual
+GRelation* GIncrementalPCA::trainInner(const GMatrix& data)
+{
+	if(!before().areContinuous())
+		throw Ex("GIncrementalPCA doesn't support nominal values. (You could filter with nominaltocat to make them real.)");
+	if(m_chunkRows < 1)
+		throw Ex("Expected at least one row per chunk");
+	size_t threads = std::max((size_t)1, m_workerThreads);
+	GPCASketch sketch(data.cols(), sketchRows(), m_aboutOrigin);
+	GMasterThread master;
+	for(size_t i = 0; i < threads; i++)
+		master.addWorker(new GIncrementalPCAWorker(master, *this));
+	makeJobSketches(data.cols(), threads);
+
+	// Sketch the rows in place, one wave of chunks at a time
+	for(size_t start = 0; start < data.rows(); )
+	{
+		while(m_jobData.size() < threads && start < data.rows())
+		{
+			size_t n = std::min(m_chunkRows, data.rows() - start);
+			m_jobData.push_back(&data);
+			m_jobStart.push_back(start);
+			m_jobCount.push_back(n);
+			start += n;
+		}
+		sketchWave(master, sketch);
+	}
+	setComponents(sketch);
+	return new GUniformRelation(m_targetDims, 0);
+}
+
+void GIncrementalPCA::train(GDataSource& source)
+{
+	size_t dims = source.featureDims();
+	setBefore(new GUniformRelation(dims, 0));
+	size_t threads = std::max((size_t)1, m_workerThreads);
+	GPCASketch sketch(dims, sketchRows(), m_aboutOrigin);
+	GMasterThread master;
+	for(size_t i = 0; i < threads; i++)
+		master.addWorker(new GIncrementalPCAWorker(master, *this));
+	makeJobSketches(dims, threads);
+
+	// Read a wave of chunks, sketch them in parallel, and repeat until the source is exhausted
+	std::vector<GMatrix*> chunks;
+	std::vector<std::unique_ptr<GMatrix> > hChunks;
+	for(size_t i = 0; i < threads; i++)
+	{
+		chunks.push_back(new GMatrix());
+		hChunks.emplace_back(chunks[i]);
+	}
+	GMatrix labels;
+	source.rewind();
+	bool more = true;
+	while(more)
+	{
+		while(m_jobData.size() < threads)
+		{
+			GMatrix* pChunk = chunks[m_jobData.size()];
+			if(!source.nextChunk(*pChunk, labels))
+			{
+				more = false;
+				break;
+			}
+			if(pChunk->cols() != dims)
+				throw Ex("Expected ", to_str(dims), " feature columns. Got ", to_str(pChunk->cols()));
+			m_jobData.push_back(pChunk);
+			m_jobStart.push_back(0);
+			m_jobCount.push_back(pChunk->rows());
+		}
+		if(m_jobData.size() > 0)
+			sketchWave(master, sketch);
+	}
+	setComponents(sketch);
+	setAfter(new GUniformRelation(m_targetDims, 0));
+}
+
+#ifndef MIN_PREDICT
+static void GIncrementalPCA_checkBasis(GMatrix& expected, GMatrix& actual, double tol)
+{
+	if(expected.rows() != actual.rows() || expected.cols() != actual.cols())
+		throw Ex("wrong size");
+	for(size_t j = 0; j < expected.cols(); j++)
+	{
+		if(std::abs(expected[0][j] - actual[0][j]) > tol)
+			throw Ex("wrong centroid");
+	}
+	for(size_t i = 1; i < expected.rows(); i++)
+	{
+		if(std::abs(std::abs(expected[i].dotProduct(actual[i])) - 1.0) > tol)
+			throw Ex("wrong component");
+	}
+}
+
+// static
+void GIncrementalPCA::test()
+{
+	// Make some data with 4 dimensions of variance and an offset
+	GRand rand(0);
+	size_t n = 2000;
+	size_t d = 12;
+	GMatrix left(n, 4);
+	GMatrix right(4, d);
+	for(size_t i = 0; i < n; i++)
+		left[i].fillNormal(rand);
+	for(size_t i = 0; i < 4; i++)
+	{
+		right[i].fillNormal(rand);
+		right[i] *= (4.0 - i);
+	}
+	GMatrix* pData = GMatrix::multiply(left, right, false, false);
+	std::unique_ptr<GMatrix> hData(pData);
+	for(size_t i = 0; i < n; i++)
+	{
+		for(size_t j = 0; j < d; j++)
+			(*pData)[i][j] += 3.0 + j;
+	}
+
+	// Compare with PCA
+	GPCA pca(3);
+	pca.computeEigVals();
+	pca.train(*pData);
+	GIncrementalPCA ipca(3);
+	ipca.computeEigVals();
+	ipca.setSketchRows(6);
+	ipca.setChunkRows(150);
+	ipca.train(*pData);
+	GIncrementalPCA_checkBasis(*pca.components(), *ipca.components(), 1e-8);
+	for(size_t i = 0; i < 3; i++)
+	{
+		if(std::abs(pca.eigVals()[i] - ipca.eigVals()[i]) > 1e-8 * pca.eigVals()[i])
+			throw Ex("wrong eigenvalue");
+	}
+
+	// The number of threads should not affect the results
+	GIncrementalPCA ipca2(3);
+	ipca2.setSketchRows(6);
+	ipca2.setChunkRows(150);
+	ipca2.setWorkerThreads(3);
+	ipca2.train(*pData);
+	for(size_t i = 0; i < 4; i++)
+	{
+		for(size_t j = 0; j < d; j++)
+		{
+			if((*ipca.components())[i][j] != (*ipca2.components())[i][j])
+				throw Ex("threads changed the results");
+		}
+	}
+
+	// Merging sketches of two halves should be the same as sketching all the rows
+	GPCASketch a(d, 6);
+	GPCASketch b(d, 6);
+	a.add(*pData, 0, 700);
+	b.add(*pData, 700, n - 700);
+	a.merge(b);
+	if(a.count() != n)
+		throw Ex("wrong count");
+	GMatrix merged;
+	a.components(3, merged);
+	GIncrementalPCA_checkBasis(*pca.components(), merged, 1e-8);
+
+	// Streaming from a data source should give the same results
+	GMatrix labels(n, 0);
+	GMatrixDataSource source(*pData, labels, 333);
+	GIncrementalPCA ipca3(3);
+	ipca3.setSketchRows(6);
+	ipca3.setWorkerThreads(2);
+	ipca3.train(source);
+	GIncrementalPCA_checkBasis(*pca.components(), *ipca3.components(), 1e-8);
+	GVec in(d);
+	GVec out1(3);
+	GVec out2(3);
+	in.copy((*pData)[5]);
+	pca.transform(in, out1);
+	ipca3.transform(in, out2);
+	for(size_t i = 0; i < 3; i++)
+	{
+		if(std::abs(std::abs(out1[i]) - std::abs(out2[i])) > 1e-6)
+			throw Ex("wrong transform");
+	}
+
+	// With noise in every dimension, the sketch is approximate, but should still find the strong components
+	for(size_t i = 0; i < n; i++)
+	{
+		for(size_t j = 0; j < d; j++)
+			(*pData)[i][j] += 0.05 * rand.normal();
+	}
+	GPCA pca2(2);
+	pca2.train(*pData);
+	GIncrementalPCA ipca4(2);
+	ipca4.setChunkRows(100);
+	ipca4.setSketchRows(4);
+	ipca4.train(*pData);
+	GIncrementalPCA_checkBasis(*pca2.components(), *ipca4.components(), 1e-3);
+}
+#endif
+
+} // namespace GClasses
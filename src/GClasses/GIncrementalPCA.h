@@ -0,0 +1,148 @@
+/*
+  The contents of this file are dedicated by all of its authors, including
+
+    Michael S. Gashler,
+    anonymous contributors,
+
+  to the public domain (http://creativecommons.org/publicdomain/zero/1.0/).
+
+  Note that some moral obligations still exist in the absence of legal ones.
+  For example, it would still be dishonest to deliberately misrepresent the
+  origin of a work. Although we impose no legal requirements to obtain a
+  license, it is beseeming for those who build on the works of others to
+  give back useful improvements, or find a way to pay it forward. If
+  you would like to cite us, a published paper about Waffles can be found
+  at http://jmlr.org/papers/volume12/gashler11a/gashler11a.pdf. If you find
+  our code to be useful, the Waffles team would love to hear how you use it.
+*/
+
+#ifndef __GINCREMENTALPCA_H__
+#define __GINCREMENTALPCA_H__
+
+#include "GTransform.h"
+#include <vector>
+
+namespace GClasses {
+
+class GDataSource;
+class GMasterThread;
+class GIncrementalPCAWorker;
+
+
+/// A low-rank summary of a stream of rows. It keeps the number of rows, their mean, and a small
+/// number of weighted directions whose outer products approximate the scatter matrix of the rows about
+/// their mean. Rows are absorbed one block at a time, so memory does not grow with the number of rows.
+/// Two sketches of disjoint sets of rows can be merged, so separate threads (or machines) can each
+/// sketch part of the data. When the centered data has no more than sketchRows dimensions of
+/// variance, the sketch is exact. Otherwise, the weakest directions are truncated after each block.
+class GPCASketch
+{
+protected:
+	size_t m_dims;
+	size_t m_maxRows;
+	bool m_aboutOrigin;
+	size_t m_count;
+	GVec m_mean;
+	GMatrix m_rows; // Each row is a principal direction scaled by its singular value, in order of decreasing magnitude
+	GMatrix m_block;
+	GVec m_stack;
+	GVec m_rot;
+
+public:
+	/// dims is the number of columns in the data. sketchRows is the maximum number of directions to keep.
+	/// If aboutOrigin is true, the rows are not centered, as with GPCA::aboutOrigin.
+	GPCASketch(size_t dims, size_t sketchRows, bool aboutOrigin = false);
+	~GPCASketch();
+
+	/// Forgets all the rows that have been added.
+	void clear();
+
+	/// Adds rowCount rows of data, starting with rowStart, to this sketch. (The data is not copied.)
+	/// Unknown values are treated as if they were equal to the mean of the known values in the same block of rows.
+	void add(const GMatrix& data, size_t rowStart = 0, size_t rowCount = INVALID_INDEX);
+
+	/// Adds all the rows summarized by that to this sketch. that must have the same number of dims.
+	void merge(const GPCASketch& that);
+
+	/// Returns the number of rows that have been added.
+	size_t count() const { return m_count; }
+
+	/// Returns the mean of the rows that have been added. (It is all zeros if aboutOrigin was specified.)
+	const GVec& mean() const { return m_mean; }
+
+	/// Returns the weighted directions. Each row is a principal direction times its singular value.
+	const GMatrix& directions() const { return m_rows; }
+
+	/// Stores the mean in the first row of basis, and the k strongest principal components in the
+	/// next k rows, which is the same format as GPCA::components. basis is resized as needed.
+	/// If pEigVals is not NULL, it is resized to k and the corresponding eigenvalues are stored in it.
+	void components(size_t k, GMatrix& basis, GVec* pEigVals = NULL) const;
+
+protected:
+	/// Absorbs the rows pointed to by ppRows, which are centered about mean, and which summarize count rows of data.
+	void absorb(const double* const* ppRows, size_t rows, size_t count, const GVec& mean);
+};
+
+
+/// Principal component analysis that does not need all of the data in memory at once. The rows are
+/// streamed through a GPCASketch in fixed-size chunks, so only the sketch and a few chunks are ever
+/// held in memory. Chunks are sketched in parallel by worker threads, and the chunk sketches are merged
+/// in a fixed order, so the results do not depend on the number of threads. When training is complete,
+/// this is an ordinary GPCA with the same basis format, so it transforms and serializes like one.
+class GIncrementalPCA : public GPCA
+{
+friend class GIncrementalPCAWorker;
+protected:
+	size_t m_sketchRows;
+	size_t m_chunkRows;
+
+	// The wave of chunks that the workers are currently sketching
+	std::vector<const GMatrix*> m_jobData;
+	std::vector<size_t> m_jobStart;
+	std::vector<size_t> m_jobCount;
+	std::vector<GPCASketch*> m_jobSketches;
+
+public:
+	GIncrementalPCA(size_t targetDims);
+	virtual ~GIncrementalPCA();
+
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
+	/// Specify the number of directions that the sketch keeps. More directions make the results more accurate
+	/// when the data has more than targetDims dimensions of variance. The default is 2 * targetDims + 10.
+	void setSketchRows(size_t n) { m_sketchRows = n; }
+
+	/// Specify the number of rows in each chunk that a worker sketches. The default is 4096.
+	void setChunkRows(size_t n) { m_chunkRows = n; }
+
+	using GIncrementalTransform::train;
+
+	/// Trains from a source of data, one chunk at a time. Only the feature columns are used.
+	/// The source is rewound first, and one pass is made over it.
+	void train(GDataSource& source);
+
+protected:
+	/// See the comment for GIncrementalTransform::train
+	virtual GRelation* trainInner(const GMatrix& data);
+
+	/// Returns the number of directions to keep in the sketch.
+	size_t sketchRows() const;
+
+	/// Allocates a sketch for each of count concurrent jobs.
+	void makeJobSketches(size_t dims, size_t count);
+
+	/// Sketches the chunks that have been set up in m_jobData, m_jobStart, and m_jobCount, then merges them into sketch in order.
+	void sketchWave(GMasterThread& master, GPCASketch& sketch);
+
+	/// Sketches one of the chunks in the current wave.
+	void sketchChunk(size_t job);
+
+	/// Copies the components from a completed sketch.
+	void setComponents(const GPCASketch& sketch);
+};
+
+
+} // namespace GClasses
+
+#endif // __GINCREMENTALPCA_H__
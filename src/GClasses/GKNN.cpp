@@ -198,33 +198,85 @@ GDomNode* GKNN::serialize(GDom* pDoc) const
 	return pNode;
 }
 
-void GKNN::autoTune(GMatrix& feats, GMatrix& labs)
+// virtual
+void GKNN::serializeStream(GJsonWriter& writer) const
 {
-	// Find the best value for k
-	size_t cap = size_t(floor(sqrt(double(feats.rows()))));
-	size_t bestK = 1;
-	double bestErr = 1e308;
-	for(size_t i = 1; i < cap; i *= 3)
+	if(m_eInterpolationMethod == Learner)
+		throw Ex("Sorry, serialize is not supported for the \"Learner\" interpolation method");
+	GDom doc;
+	baseStreamObj(writer, "GKNN");
+	writer.key("neighbors");
+	writer.writeInt((long long)m_nNeighbors);
+	writer.key("interpMethod");
+	writer.writeInt((long long)m_eInterpolationMethod);
+	writer.key("trainMethod");
+	writer.writeInt((long long)m_eTrainMethod);
+	writer.key("trainParam");
+	writer.writeDouble(m_trainParam);
+	writer.key("normalize");
+	writer.writeBool(m_normalizeScaleFactors);
+	writer.key("optimize");
+	writer.writeBool(m_optimizeScaleFactors);
+	if(m_pFeatures)
 	{
-		setNeighborCount(i);
-		double d = crossValidate(feats, labs, 2);
-		if(d < bestErr)
-		{
-			bestErr = d;
-			bestK = i;
-		}
-		else if(i >= 27)
-			break;
+		writer.key("features");
+		m_pFeatures->serializeStream(writer);
 	}
+	else
+	{
+		writer.key("sparseFeatures");
+		writer.writeNode(m_pSparseFeatures->serialize(&doc));
+	}
+	writer.key("labels");
+	m_pLabels->serializeStream(writer);
+	if(m_pDistanceMetric)
+	{
+		writer.key("metric");
+		writer.writeNode(m_pDistanceMetric->serialize(&doc));
+	}
+	else
+	{
+		writer.key("sparseMetric");
+		writer.writeNode(m_pSparseMetric->serialize(&doc));
+	}
+	writer.endObj();
+}
 
-	// Set the best values
-	m_nNeighbors = bestK;
+// static
+GTransducer* GKNN::autoTuneCandidate(void* pThis, size_t candidate)
+{
+	GKNN* pTuner = (GKNN*)pThis;
+	GKNN* pModel = new GKNN();
+	if(pTuner->m_eInterpolationMethod != Learner)
+		pModel->m_eInterpolationMethod = pTuner->m_eInterpolationMethod;
+	pModel->m_eTrainMethod = pTuner->m_eTrainMethod;
+	pModel->m_trainParam = pTuner->m_trainParam;
+	pModel->m_optimizeScaleFactors = pTuner->m_optimizeScaleFactors;
+
+	// Candidates alternate between normalizing and not, and k grows by factors of 3
+	size_t k = 1;
+	for(size_t i = 0; i < candidate / 2; i++)
+		k *= 3;
+	pModel->m_nNeighbors = k;
+	pModel->m_normalizeScaleFactors = (candidate % 2 == 0);
+	return pModel;
+}
+
+void GKNN::autoTune(GMatrix& feats, GMatrix& labs)
+{
+	size_t cap = size_t(floor(sqrt(double(feats.rows()))));
+	size_t kValues = 1;
+	for(size_t i = 3; i < cap; i *= 3)
+		kValues++;
+	GParallelValidator pv(feats, labs, 2, 1, (size_t)m_rand.next());
+	pv.setWorkerThreads(m_autoTuneThreads);
+	size_t best = pv.successiveHalving(autoTuneCandidate, this, 2 * kValues);
 
-	// Try without normalization
-	m_normalizeScaleFactors = false;
-	double d = crossValidate(feats, labs, 2);
-	if(d >= bestErr)
-		m_normalizeScaleFactors = true;
+	// Set the best values
+	GKNN* pBest = (GKNN*)autoTuneCandidate(this, best);
+	m_nNeighbors = pBest->m_nNeighbors;
+	m_normalizeScaleFactors = pBest->m_normalizeScaleFactors;
+	delete(pBest);
 }
 
 void GKNN::setNeighborCount(size_t k)
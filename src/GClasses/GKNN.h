@@ -98,6 +98,9 @@ public:
 	/// Marshal this object into a DOM, which can then be converted to a variety of serial formats.
 	virtual GDomNode* serialize(GDom* pDoc) const;
 
+	/// Streams the training data, since that is most of the model. See the comment for GSupervisedLearner::serializeStream.
+	virtual void serializeStream(GJsonWriter& writer) const;
+
 	/// See the comment for GSupervisedLearner::predict
 	virtual void predict(const GVec& in, GVec& out);
 
@@ -149,7 +152,8 @@ public:
 	GMatrix* labels() { return m_pLabels; }
 
 	/// Uses cross-validation to find a set of parameters that works well with
-	/// the provided data.
+	/// the provided data. The candidate configurations are evaluated in parallel
+	/// (see GTransducer::setAutoTuneThreads) and pruned by successive halving.
 	void autoTune(GMatrix& features, GMatrix& labels);
 
 	/// Specify to train by drawing 'n' random patterns from the training set.
@@ -160,6 +164,9 @@ public:
 	}
 
 protected:
+	/// Makes the specified candidate configuration for autoTune. pThis is the model being tuned.
+	static GTransducer* autoTuneCandidate(void* pThis, size_t candidate);
+
 	/// See the comment for GSupervisedLearner::trainInner
 	virtual void trainInner(const GMatrix& features, const GMatrix& labels);
 
@@ -20,6 +20,9 @@
 #include "GHillClimber.h"
 #include "GDistribution.h"
 #include "GMath.h"
+#include "GRand.h"
+#include "GThread.h"
+#include <memory>
 
 using namespace GClasses;
 
@@ -86,3 +89,446 @@ GKernel* GKernel::kernelComplex1()
 	return pK14;
 }
 
+
+#define KERNEL_BLOCK_ROWS 64
+
+/// Holds the state of a call to GKernel::applyBlock, so each block of rows can be computed as a separate job.
+class GKernel_blockJobs
+{
+public:
+	GKernel& m_kernel;
+	const GMatrix& m_a;
+	size_t m_aStart;
+	size_t m_aCount;
+	const GMatrix& m_b;
+	size_t m_bStart;
+	GMatrix& m_out;
+
+	GKernel_blockJobs(GKernel& kernel, const GMatrix& a, size_t aStart, size_t aCount, const GMatrix& b, size_t bStart, GMatrix& out)
+	: m_kernel(kernel), m_a(a), m_aStart(aStart), m_aCount(aCount), m_b(b), m_bStart(bStart), m_out(out)
+	{
+	}
+
+	/// Computes one block of rows, and copies it into the corresponding rows of out.
+	void doJob(size_t job)
+	{
+		size_t start = job * KERNEL_BLOCK_ROWS;
+		size_t count = std::min((size_t)KERNEL_BLOCK_ROWS, m_aCount - start);
+		GMatrix block;
+		m_kernel.applyBlock(m_a, m_aStart + start, count, m_b, m_bStart, m_out.cols(), block);
+		for(size_t i = 0; i < count; i++)
+			m_out[start + i].copy(block[i]);
+	}
+};
+
+class GKernel_blockWorker : public GWorkerThread
+{
+protected:
+	GKernel_blockJobs& m_jobs;
+
+public:
+	GKernel_blockWorker(GMasterThread& master, GKernel_blockJobs& jobs)
+	: GWorkerThread(master), m_jobs(jobs)
+	{
+	}
+
+	virtual ~GKernel_blockWorker()
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		m_jobs.doJob(jobId);
+	}
+};
+
+void GKernel::applyBlock(const GMatrix& a, size_t aStart, size_t aCount, const GMatrix& b, size_t bStart, size_t bCount, GMatrix& out, size_t workerThreads)
+{
+	if(aStart + aCount > a.rows() || bStart + bCount > b.rows())
+		throw Ex("Row range out of bounds");
+	if(a.cols() != b.cols())
+		throw Ex("Mismatching number of columns");
+	out.resize(aCount, bCount);
+	if(aCount == 0 || bCount == 0)
+		return;
+	if(aCount <= KERNEL_BLOCK_ROWS)
+	{
+		applyBlockInner(a, aStart, b, bStart, out);
+		return;
+	}
+
+	// Split the rows of a into fixed-size blocks, so the results do not depend on the number of threads
+	size_t blocks = (aCount + KERNEL_BLOCK_ROWS - 1) / KERNEL_BLOCK_ROWS;
+	GKernel_blockJobs jobs(*this, a, aStart, aCount, b, bStart, out);
+	GMasterThread master;
+	for(size_t i = 0; i < std::max((size_t)1, std::min(workerThreads, blocks)); i++)
+		master.addWorker(new GKernel_blockWorker(master, jobs));
+	master.doJobs(blocks);
+}
+
+void GKernel::applyDiagonal(const GMatrix& m, size_t start, size_t count, GVec& out)
+{
+	if(start + count > m.rows())
+		throw Ex("Row range out of bounds");
+	out.resize(count);
+	if(count > 0)
+		applyDiagonalInner(m, start, out);
+}
+
+// virtual
+void GKernel::applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out)
+{
+	for(size_t i = 0; i < out.rows(); i++)
+	{
+		GVec& row = out[i];
+		const GVec& aRow = a[aStart + i];
+		for(size_t j = 0; j < out.cols(); j++)
+			row[j] = apply(aRow, b[bStart + j]);
+	}
+}
+
+// virtual
+void GKernel::applyDiagonalInner(const GMatrix& m, size_t start, GVec& out)
+{
+	for(size_t i = 0; i < out.size(); i++)
+		out[i] = apply(m[start + i], m[start + i]);
+}
+
+/// Copies count rows of m, starting with row start, into packed, one row after another.
+/// If pCenter is not NULL, it is subtracted from each known value. Returns false if any of the rows contain unknown values.
+bool GKernel_packRows(const GMatrix& m, size_t start, size_t count, const GVec* pCenter, GVec& packed)
+{
+	size_t dims = m.cols();
+	packed.resize(count * dims);
+	double* pOut = packed.data();
+	bool known = true;
+	for(size_t i = 0; i < count; i++)
+	{
+		const GVec& row = m[start + i];
+		for(size_t j = 0; j < dims; j++)
+		{
+			if(row[j] == UNKNOWN_REAL_VALUE)
+			{
+				known = false;
+				*(pOut++) = UNKNOWN_REAL_VALUE;
+			}
+			else
+				*(pOut++) = (pCenter && (*pCenter)[j] != UNKNOWN_REAL_VALUE) ? row[j] - (*pCenter)[j] : row[j];
+		}
+	}
+	return known;
+}
+
+/// Sets out[i][j] to the dot product of packed row i of a with packed row j of b.
+void GKernel_dotBlock(const GVec& a, const GVec& b, size_t dims, GMatrix& out)
+{
+	size_t m = out.rows();
+	size_t n = out.cols();
+	GVec c(m * n);
+	c.fill(0.0);
+	GVec::gemm(false, true, m, n, dims, a.data(), dims, b.data(), dims, c.data(), n);
+	for(size_t i = 0; i < m; i++)
+		out[i].copy(0, c, i * n, n);
+}
+
+/// Returns the squared magnitude of the dims values that begin at p.
+double GKernel_squaredNorm(const double* p, size_t dims)
+{
+	double sum = 0.0;
+	for(size_t i = 0; i < dims; i++)
+		sum += p[i] * p[i];
+	return sum;
+}
+
+// virtual
+void GKernelIdentity::applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out)
+{
+	GVec packedA, packedB;
+	if(!GKernel_packRows(a, aStart, out.rows(), NULL, packedA) || !GKernel_packRows(b, bStart, out.cols(), NULL, packedB))
+	{
+		GKernel::applyBlockInner(a, aStart, b, bStart, out);
+		return;
+	}
+	GKernel_dotBlock(packedA, packedB, a.cols(), out);
+}
+
+// virtual
+void GKernelPolynomial::applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out)
+{
+	GVec packedA, packedB;
+	if(!GKernel_packRows(a, aStart, out.rows(), NULL, packedA) || !GKernel_packRows(b, bStart, out.cols(), NULL, packedB))
+	{
+		GKernel::applyBlockInner(a, aStart, b, bStart, out);
+		return;
+	}
+	GKernel_dotBlock(packedA, packedB, a.cols(), out);
+	for(size_t i = 0; i < out.rows(); i++)
+	{
+		GVec& row = out[i];
+		for(size_t j = 0; j < out.cols(); j++)
+			row[j] = pow(row[j] + m_offset, (int)m_order);
+	}
+}
+
+// virtual
+void GKernelGaussianRBF::applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out)
+{
+	// Center both blocks about the first row of a, so the squared distances do not lose precision to large offsets
+	GVec packedA, packedB;
+	const GVec* pCenter = &a[aStart];
+	if(!GKernel_packRows(a, aStart, out.rows(), pCenter, packedA) || !GKernel_packRows(b, bStart, out.cols(), pCenter, packedB))
+	{
+		GKernel::applyBlockInner(a, aStart, b, bStart, out);
+		return;
+	}
+	size_t dims = a.cols();
+	GKernel_dotBlock(packedA, packedB, dims, out);
+	GVec normB(out.cols());
+	for(size_t j = 0; j < out.cols(); j++)
+		normB[j] = GKernel_squaredNorm(packedB.data() + j * dims, dims);
+	double scale = -0.5 / m_variance;
+	for(size_t i = 0; i < out.rows(); i++)
+	{
+		GVec& row = out[i];
+		double normA = GKernel_squaredNorm(packedA.data() + i * dims, dims);
+		for(size_t j = 0; j < out.cols(); j++)
+			row[j] = exp(scale * std::max(0.0, normA + normB[j] - 2.0 * row[j]));
+	}
+}
+
+// virtual
+void GKernelChiSquared::applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out)
+{
+	GVec packedB;
+	GKernel_packRows(b, bStart, out.cols(), NULL, packedB);
+	size_t dims = a.cols();
+	for(size_t i = 0; i < out.rows(); i++)
+	{
+		GVec& row = out[i];
+		const GVec& aRow = a[aStart + i];
+		const double* pB = packedB.data();
+		for(size_t j = 0; j < out.cols(); j++)
+		{
+			double d = 0.0;
+			for(size_t k = 0; k < dims; k++)
+			{
+				if(aRow[k] != UNKNOWN_REAL_VALUE && pB[k] != UNKNOWN_REAL_VALUE)
+					d += 2.0 * aRow[k] * pB[k] / (aRow[k] + pB[k]);
+			}
+			row[j] = d;
+			pB += dims;
+		}
+	}
+}
+
+// virtual
+void GKernelTranslate::applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out)
+{
+	m_pK->applyBlock(a, aStart, out.rows(), b, bStart, out.cols(), out);
+	for(size_t i = 0; i < out.rows(); i++)
+		out[i] += m_value;
+}
+
+// virtual
+void GKernelTranslate::applyDiagonalInner(const GMatrix& m, size_t start, GVec& out)
+{
+	m_pK->applyDiagonal(m, start, out.size(), out);
+	out += m_value;
+}
+
+// virtual
+void GKernelScale::applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out)
+{
+	m_pK->applyBlock(a, aStart, out.rows(), b, bStart, out.cols(), out);
+	for(size_t i = 0; i < out.rows(); i++)
+		out[i] *= m_value;
+}
+
+// virtual
+void GKernelScale::applyDiagonalInner(const GMatrix& m, size_t start, GVec& out)
+{
+	m_pK->applyDiagonal(m, start, out.size(), out);
+	out *= m_value;
+}
+
+// virtual
+void GKernelAdd::applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out)
+{
+	GMatrix tmp;
+	m_pK1->applyBlock(a, aStart, out.rows(), b, bStart, out.cols(), out);
+	m_pK2->applyBlock(a, aStart, out.rows(), b, bStart, out.cols(), tmp);
+	for(size_t i = 0; i < out.rows(); i++)
+		out[i] += tmp[i];
+}
+
+// virtual
+void GKernelAdd::applyDiagonalInner(const GMatrix& m, size_t start, GVec& out)
+{
+	GVec tmp;
+	m_pK1->applyDiagonal(m, start, out.size(), out);
+	m_pK2->applyDiagonal(m, start, out.size(), tmp);
+	out += tmp;
+}
+
+// virtual
+void GKernelMultiply::applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out)
+{
+	GMatrix tmp;
+	m_pK1->applyBlock(a, aStart, out.rows(), b, bStart, out.cols(), out);
+	m_pK2->applyBlock(a, aStart, out.rows(), b, bStart, out.cols(), tmp);
+	for(size_t i = 0; i < out.rows(); i++)
+	{
+		GVec& row = out[i];
+		const GVec& tmpRow = tmp[i];
+		for(size_t j = 0; j < out.cols(); j++)
+			row[j] *= tmpRow[j];
+	}
+}
+
+// virtual
+void GKernelMultiply::applyDiagonalInner(const GMatrix& m, size_t start, GVec& out)
+{
+	GVec tmp;
+	m_pK1->applyDiagonal(m, start, out.size(), out);
+	m_pK2->applyDiagonal(m, start, out.size(), tmp);
+	for(size_t i = 0; i < out.size(); i++)
+		out[i] *= tmp[i];
+}
+
+// virtual
+void GKernelPow::applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out)
+{
+	m_pK->applyBlock(a, aStart, out.rows(), b, bStart, out.cols(), out);
+	for(size_t i = 0; i < out.rows(); i++)
+	{
+		GVec& row = out[i];
+		for(size_t j = 0; j < out.cols(); j++)
+			row[j] = pow(row[j], m_value);
+	}
+}
+
+// virtual
+void GKernelPow::applyDiagonalInner(const GMatrix& m, size_t start, GVec& out)
+{
+	m_pK->applyDiagonal(m, start, out.size(), out);
+	for(size_t i = 0; i < out.size(); i++)
+		out[i] = pow(out[i], m_value);
+}
+
+// virtual
+void GKernelExp::applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out)
+{
+	m_pK->applyBlock(a, aStart, out.rows(), b, bStart, out.cols(), out);
+	for(size_t i = 0; i < out.rows(); i++)
+	{
+		GVec& row = out[i];
+		for(size_t j = 0; j < out.cols(); j++)
+			row[j] = exp(row[j]);
+	}
+}
+
+// virtual
+void GKernelExp::applyDiagonalInner(const GMatrix& m, size_t start, GVec& out)
+{
+	m_pK->applyDiagonal(m, start, out.size(), out);
+	for(size_t i = 0; i < out.size(); i++)
+		out[i] = exp(out[i]);
+}
+
+// virtual
+void GKernelNormalize::applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out)
+{
+	GVec diagA, diagB;
+	m_pK->applyBlock(a, aStart, out.rows(), b, bStart, out.cols(), out);
+	m_pK->applyDiagonal(a, aStart, out.rows(), diagA);
+	m_pK->applyDiagonal(b, bStart, out.cols(), diagB);
+	for(size_t i = 0; i < out.rows(); i++)
+	{
+		GVec& row = out[i];
+		for(size_t j = 0; j < out.cols(); j++)
+			row[j] /= sqrt(diagA[i] * diagB[j]);
+	}
+}
+
+// virtual
+void GKernelNormalize::applyDiagonalInner(const GMatrix& m, size_t start, GVec& out)
+{
+	m_pK->applyDiagonal(m, start, out.size(), out);
+	for(size_t i = 0; i < out.size(); i++)
+		out[i] /= sqrt(out[i] * out[i]);
+}
+
+// static
+void GKernel::test()
+{
+	GRand rand(0);
+	GMatrix a(150, 5);
+	GMatrix b(23, 5);
+	for(size_t i = 0; i < a.rows(); i++)
+	{
+		a[i].fillNormal(rand);
+		a[i] += 1000.0; // a large offset should not cost the distance-based kernels their precision
+	}
+	for(size_t i = 0; i < b.rows(); i++)
+	{
+		b[i].fillNormal(rand);
+		b[i] += 1000.0;
+	}
+	GMatrix bUnknown;
+	bUnknown.copy(b);
+	bUnknown[4][2] = UNKNOWN_REAL_VALUE;
+	for(size_t k = 0; k < 7; k++)
+	{
+		GKernel* pKernel;
+		if(k == 0)
+			pKernel = new GKernelIdentity();
+		else if(k == 1)
+			pKernel = new GKernelPolynomial(1.0, 3);
+		else if(k == 2)
+			pKernel = new GKernelGaussianRBF(2.0);
+		else if(k == 3)
+			pKernel = new GKernelChiSquared();
+		else if(k == 4)
+			pKernel = kernelComplex1();
+		else if(k == 5)
+			pKernel = new GKernelPow(new GKernelTranslate(new GKernelScale(new GKernelGaussianRBF(3.0), 2.0), 0.5), 2);
+		else
+			pKernel = new GKernelExp(new GKernelMultiply(new GKernelGaussianRBF(5.0), new GKernelNormalize(new GKernelIdentity())));
+		std::unique_ptr<GKernel> hKernel(pKernel);
+		for(size_t u = 0; u < 2; u++)
+		{
+			const GMatrix& bb = (u == 0 ? b : bUnknown);
+			GMatrix out;
+			pKernel->applyBlock(a, 3, 140, bb, 1, 20, out);
+			if(out.rows() != 140 || out.cols() != 20)
+				throw Ex("wrong size");
+			for(size_t i = 0; i < out.rows(); i++)
+			{
+				for(size_t j = 0; j < out.cols(); j++)
+				{
+					double expected = pKernel->apply(a[3 + i], bb[1 + j]);
+					if(std::abs(out[i][j] - expected) > 1e-9 * std::max(1.0, std::abs(expected)))
+						throw Ex("applyBlock disagrees with apply for the ", pKernel->name(), " kernel");
+				}
+			}
+
+			// The results should not depend on the number of threads
+			GMatrix out2;
+			pKernel->applyBlock(a, 3, 140, bb, 1, 20, out2, 3);
+			for(size_t i = 0; i < out.rows(); i++)
+			{
+				if(out2[i].squaredDistance(out[i]) != 0.0)
+					throw Ex("applyBlock depends on the number of threads");
+			}
+
+			GVec diag;
+			pKernel->applyDiagonal(bb, 0, bb.rows(), diag);
+			for(size_t i = 0; i < bb.rows(); i++)
+			{
+				double expected = pKernel->apply(bb[i], bb[i]);
+				if(std::abs(diag[i] - expected) > 1e-9 * std::max(1.0, std::abs(expected)))
+					throw Ex("applyDiagonal disagrees with apply for the ", pKernel->name(), " kernel");
+			}
+		}
+	}
+}
@@ -48,6 +48,26 @@ public:
 	/// Applies the kernel to the two specified vectors.
 	virtual double apply(const GVec& pA, const GVec& pB) = 0;
 
+	/// Applies the kernel to every pair of rows from two matrices. Row i of out is set to the kernel of row aStart + i
+	/// of a with each of the bCount rows of b that begin with row bStart. out is resized to aCount-by-bCount.
+	/// Kernels that are built on dot products or distances compute each block of rows with one matrix multiplication,
+	/// and composite kernels combine the blocks computed by their parts, so this is much faster than calling apply
+	/// for each pair. The rows of a are processed in fixed-size blocks that are split across workerThreads threads.
+	/// (The results do not depend on the number of threads.)
+	void applyBlock(const GMatrix& a, size_t aStart, size_t aCount, const GMatrix& b, size_t bStart, size_t bCount, GMatrix& out, size_t workerThreads = 1);
+
+	/// Applies the kernel to every pair of rows from a and b. out is resized to a.rows()-by-b.rows().
+	void applyBlock(const GMatrix& a, const GMatrix& b, GMatrix& out, size_t workerThreads = 1)
+	{
+		applyBlock(a, 0, a.rows(), b, 0, b.rows(), out, workerThreads);
+	}
+
+	/// Applies the kernel to each of count rows of m with itself, starting with row start. out is resized to count.
+	void applyDiagonal(const GMatrix& m, size_t start, size_t count, GVec& out);
+
+	/// Performs unit tests for the kernels. Throws an exception if there is a failure.
+	static void test();
+
 	/// Deserializes a kernel object
 	static GKernel* deserialize(GDomNode* pNode);
 
@@ -60,6 +80,13 @@ public:
 protected:
 	/// Helper method used by the serialize methods in child classes
 	GDomNode* makeBaseNode(GDom* pDoc) const;
+
+	/// Called by applyBlock for each block of rows, after out has been resized to hold the block.
+	/// The default implementation calls apply for each pair.
+	virtual void applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out);
+
+	/// Called by applyDiagonal after out has been resized. The default implementation calls apply for each row.
+	virtual void applyDiagonalInner(const GMatrix& m, size_t start, GVec& out);
 };
 
 /// The identity kernel
@@ -85,6 +112,10 @@ public:
 	{
 		return pA.dotProductIgnoringUnknowns(pB);
 	}
+
+protected:
+	/// Computes the dot products with one matrix multiplication
+	virtual void applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out);
 };
 
 /// Chi Squared kernel
@@ -116,6 +147,10 @@ public:
 		}
 		return d;
 	}
+
+protected:
+	/// Computes the sums for each pair of packed rows without virtual calls
+	virtual void applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out);
 };
 
 /// A polynomial kernel
@@ -147,6 +182,10 @@ public:
 	{
 		return pow(pA.dotProductIgnoringUnknowns(pB) + m_offset, (int)m_order);
 	}
+
+protected:
+	/// Computes the dot products with one matrix multiplication
+	virtual void applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out);
 };
 
 /// A Gaussian RBF kernel
@@ -176,6 +215,10 @@ public:
 	{
 		return exp(-0.5 * pA.estimateSquaredDistanceWithUnknowns(pB) / m_variance);
 	}
+
+protected:
+	/// Computes the squared distances as ||A||^2 + ||B||^2 - 2 * A * B, with the dot products from one matrix multiplication
+	virtual void applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out);
 };
 
 /// A translation kernel
@@ -208,6 +251,13 @@ public:
 	{
 		return m_pK->apply(pA, pB) + m_value;
 	}
+
+protected:
+	/// Adds the value to the block computed by the inner kernel
+	virtual void applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out);
+
+	/// Adds the value to the diagonal computed by the inner kernel
+	virtual void applyDiagonalInner(const GMatrix& m, size_t start, GVec& out);
 };
 
 /// A scalar kernel
@@ -240,6 +290,13 @@ public:
 	{
 		return m_pK->apply(pA, pB) * m_value;
 	}
+
+protected:
+	/// Scales the block computed by the inner kernel
+	virtual void applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out);
+
+	/// Scales the diagonal computed by the inner kernel
+	virtual void applyDiagonalInner(const GMatrix& m, size_t start, GVec& out);
 };
 
 /// An addition kernel
@@ -272,6 +329,13 @@ public:
 	{
 		return m_pK1->apply(pA, pB) + m_pK2->apply(pA, pB);
 	}
+
+protected:
+	/// Adds the blocks computed by the two inner kernels
+	virtual void applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out);
+
+	/// Adds the diagonals computed by the two inner kernels
+	virtual void applyDiagonalInner(const GMatrix& m, size_t start, GVec& out);
 };
 
 /// A multiplication kernel
@@ -304,6 +368,13 @@ public:
 	{
 		return m_pK1->apply(pA, pB) * m_pK2->apply(pA, pB);
 	}
+
+protected:
+	/// Multiplies the blocks computed by the two inner kernels
+	virtual void applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out);
+
+	/// Multiplies the diagonals computed by the two inner kernels
+	virtual void applyDiagonalInner(const GMatrix& m, size_t start, GVec& out);
 };
 
 /// A power kernel
@@ -336,6 +407,13 @@ public:
 	{
 		return pow(m_pK->apply(pA, pB), m_value);
 	}
+
+protected:
+	/// Raises the block computed by the inner kernel to the power
+	virtual void applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out);
+
+	/// Raises the diagonal computed by the inner kernel to the power
+	virtual void applyDiagonalInner(const GMatrix& m, size_t start, GVec& out);
 };
 
 /// The Exponential kernel
@@ -366,6 +444,13 @@ public:
 	{
 		return exp(m_pK->apply(pA, pB));
 	}
+
+protected:
+	/// Exponentiates the block computed by the inner kernel
+	virtual void applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out);
+
+	/// Exponentiates the diagonal computed by the inner kernel
+	virtual void applyDiagonalInner(const GMatrix& m, size_t start, GVec& out);
 };
 
 /// A Normalizing kernel
@@ -396,6 +481,13 @@ public:
 	{
 		return m_pK->apply(pA, pB) / sqrt(m_pK->apply(pA, pA) * m_pK->apply(pB, pB));
 	}
+
+protected:
+	/// Divides the block computed by the inner kernel by the square roots of the diagonals
+	virtual void applyBlockInner(const GMatrix& a, size_t aStart, const GMatrix& b, size_t bStart, GMatrix& out);
+
+	/// Divides the diagonal computed by the inner kernel by itself
+	virtual void applyDiagonalInner(const GMatrix& m, size_t start, GVec& out);
 };
 
 
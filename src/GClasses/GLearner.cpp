@@ -36,11 +36,13 @@
 #include "GTransform.h"
 #include "GRand.h"
 #include "GHolders.h"
+#include "GThread.h"
 #include "GPlot.h"
 #include "GDistribution.h"
 #include "GRecommender.h"
 #include <cmath>
 #include <iostream>
+#include <sstream>
 
 using std::vector;
 
@@ -119,7 +121,7 @@ GNormalDistribution* GPrediction::asNormal()
 // ---------------------------------------------------------------
 
 GTransducer::GTransducer()
-: m_rand(0)
+: m_rand(0), m_autoTuneThreads(1)
 {
 }
 
@@ -400,6 +402,351 @@ double GTransducer::repValidate(const GMatrix& features, const GMatrix& labels,
 
 // ---------------------------------------------------------------
 
+// The number of learners that are made ahead of time for each worker thread
+#define PARALLEL_VALIDATOR_JOBS_PER_THREAD 4
+
+class GParallelValidatorJob
+{
+public:
+	GTransducer* m_pLearner;
+	const std::vector<size_t>* m_pOrder;
+	size_t m_rows;
+	size_t m_fold;
+	double m_sse;
+	double m_sae;
+	std::string m_error;
+
+	GParallelValidatorJob() : m_pLearner(NULL), m_pOrder(NULL), m_rows(0), m_fold(0), m_sse(0.0), m_sae(0.0) {}
+	~GParallelValidatorJob() { delete(m_pLearner); }
+};
+
+class GParallelValidatorWorker : public GWorkerThread
+{
+protected:
+	const GMatrix& m_features;
+	const GMatrix& m_labels;
+	size_t m_folds;
+	std::vector<GParallelValidatorJob>& m_jobs;
+	const size_t& m_batchStart;
+
+public:
+	GParallelValidatorWorker(GMasterThread& master, const GMatrix& features, const GMatrix& labels, size_t folds, std::vector<GParallelValidatorJob>& jobs, const size_t& batchStart)
+	: GWorkerThread(master), m_features(features), m_labels(labels), m_folds(folds), m_jobs(jobs), m_batchStart(batchStart)
+	{
+	}
+
+	virtual ~GParallelValidatorWorker()
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		GParallelValidatorJob& job = m_jobs[m_batchStart + jobId];
+		try
+		{
+			// Divide into a training set and a test set. (The rows are shared with the other jobs, not copied.)
+			GMatrix trainFeatures(m_features.relation().cloneMinimal());
+			GReleaseDataHolder hTrainFeatures(&trainFeatures);
+			GMatrix testFeatures(m_features.relation().cloneMinimal());
+			GReleaseDataHolder hTestFeatures(&testFeatures);
+			GMatrix trainLabels(m_labels.relation().cloneMinimal());
+			GReleaseDataHolder hTrainLabels(&trainLabels);
+			GMatrix testLabels(m_labels.relation().cloneMinimal());
+			GReleaseDataHolder hTestLabels(&testLabels);
+			const std::vector<size_t>& order = *job.m_pOrder;
+			size_t foldStart = job.m_fold * job.m_rows / m_folds;
+			size_t foldEnd = (job.m_fold + 1) * job.m_rows / m_folds;
+			trainFeatures.reserve(job.m_rows - (foldEnd - foldStart));
+			trainLabels.reserve(job.m_rows - (foldEnd - foldStart));
+			for(size_t i = 0; i < job.m_rows; i++)
+			{
+				size_t index = order[i];
+				if(i >= foldStart && i < foldEnd)
+				{
+					testFeatures.takeRow((GVec*)&m_features[index]);
+					testLabels.takeRow((GVec*)&m_labels[index]);
+				}
+				else
+				{
+					trainFeatures.takeRow((GVec*)&m_features[index]);
+					trainLabels.takeRow((GVec*)&m_labels[index]);
+				}
+			}
+
+			// Evaluate
+			double sae = 0.0;
+			job.m_sse = job.m_pLearner->trainAndTest(trainFeatures, trainLabels, testFeatures, testLabels, &sae);
+			job.m_sae = sae;
+		}
+		catch(const std::exception& e)
+		{
+			job.m_error = e.what();
+		}
+
+		// Free the trained model now, so only the models that are currently training are held in memory
+		delete(job.m_pLearner);
+		job.m_pLearner = NULL;
+	}
+};
+
+GParallelValidator::GParallelValidator(const GMatrix& features, const GMatrix& labels, size_t folds, size_t reps, size_t seed)
+: m_features(features), m_labels(labels), m_folds(folds), m_seed(seed), m_workerThreads(1)
+{
+	if(features.rows() != labels.rows())
+		throw Ex("Expected the features and labels to have the same number of rows");
+	if(folds < 2)
+		throw Ex("There must be at least 2 folds");
+	if(features.rows() < folds)
+		throw Ex("There must be at least as many rows as folds");
+	if(reps < 1)
+		throw Ex("There must be at least 1 rep");
+	m_orders.resize(reps);
+	for(size_t i = 0; i < reps; i++)
+	{
+		std::vector<size_t>& order = m_orders[i];
+		order.resize(features.rows());
+		for(size_t j = 0; j < order.size(); j++)
+			order[j] = j;
+		GRand rand(learnerSeed(i, INVALID_INDEX));
+		for(size_t j = order.size(); j > 1; j--)
+			std::swap(order[j - 1], order[(size_t)rand.next(j)]);
+	}
+}
+
+GParallelValidator::~GParallelValidator()
+{
+}
+
+size_t GParallelValidator::learnerSeed(size_t rep, size_t fold) const
+{
+	// Every candidate gets the same seed for the same fold, so candidates are compared under the same conditions
+	uint64_t h = (uint64_t)m_seed;
+	h = h * 0x9e3779b97f4a7c15ull + (uint64_t)rep + 1;
+	h = h * 0x9e3779b97f4a7c15ull + (uint64_t)fold + 1;
+	h ^= (h >> 31);
+	return (size_t)h;
+}
+
+void GParallelValidator::evaluate(TransducerFactory pFactory, void* pThis, const std::vector<size_t>& candidates, size_t rows, GVec& outSSE, GVec& outSAE)
+{
+	// Describe the jobs
+	size_t reps = m_orders.size();
+	size_t jobCount = candidates.size() * reps * m_folds;
+	std::vector<GParallelValidatorJob> jobs(jobCount);
+	size_t n = 0;
+	for(size_t i = 0; i < candidates.size(); i++)
+	{
+		for(size_t j = 0; j < reps; j++)
+		{
+			for(size_t k = 0; k < m_folds; k++)
+			{
+				GParallelValidatorJob& job = jobs[n++];
+				job.m_pOrder = &m_orders[j];
+				job.m_rows = rows;
+				job.m_fold = k;
+			}
+		}
+	}
+
+	// Do the jobs one batch at a time. The learners for each batch are made just before it starts, because
+	// the factory is only called from this thread, and each worker frees its learner when its job is done.
+	size_t workers = std::max((size_t)1, std::min(m_workerThreads, jobCount));
+	size_t batchSize = workers * PARALLEL_VALIDATOR_JOBS_PER_THREAD;
+	size_t batchStart = 0;
+	GMasterThread master;
+	for(size_t i = 0; i < workers; i++)
+		master.addWorker(new GParallelValidatorWorker(master, m_features, m_labels, m_folds, jobs, batchStart));
+	for(batchStart = 0; batchStart < jobCount; batchStart += batchSize)
+	{
+		size_t batchEnd = std::min(jobCount, batchStart + batchSize);
+		for(size_t i = batchStart; i < batchEnd; i++)
+		{
+			size_t perCandidate = reps * m_folds;
+			GParallelValidatorJob& job = jobs[i];
+			job.m_pLearner = pFactory(pThis, candidates[i / perCandidate]);
+			job.m_pLearner->rand().setSeed(learnerSeed((i % perCandidate) / m_folds, job.m_fold));
+		}
+		master.doJobs(batchEnd - batchStart);
+	}
+
+	// Collect the results
+	outSSE.resize(jobCount);
+	outSAE.resize(jobCount);
+	for(size_t i = 0; i < jobCount; i++)
+	{
+		if(jobs[i].m_error.length() > 0)
+			throw Ex(jobs[i].m_error);
+		outSSE[i] = jobs[i].m_sse;
+		outSAE[i] = jobs[i].m_sae;
+	}
+}
+
+double GParallelValidator::crossValidate(TransducerFactory pFactory, void* pThis, size_t candidate, double* pOutSAE, RepValidateCallback pCB, void* pCBThis)
+{
+	std::vector<size_t> candidates;
+	candidates.push_back(candidate);
+	GVec sse, sae;
+	size_t rows = m_features.rows();
+	evaluate(pFactory, pThis, candidates, rows, sse, sae);
+	size_t reps = m_orders.size();
+	double ssse = 0.0;
+	double ssae = 0.0;
+	for(size_t i = 0; i < reps; i++)
+	{
+		for(size_t j = 0; j < m_folds; j++)
+		{
+			size_t index = i * m_folds + j;
+			ssse += sse[index];
+			ssae += sae[index];
+			if(pCB)
+				pCB(pCBThis, i, j, sse[index], (j + 1) * rows / m_folds - j * rows / m_folds);
+		}
+	}
+	if(pOutSAE)
+		*pOutSAE = ssae / reps;
+	return ssse / reps;
+}
+
+void GParallelValidator::crossValidate(TransducerFactory pFactory, void* pThis, size_t candidates, GVec& outErrors)
+{
+	std::vector<size_t> cands;
+	for(size_t i = 0; i < candidates; i++)
+		cands.push_back(i);
+	GVec sse, sae;
+	evaluate(pFactory, pThis, cands, m_features.rows(), sse, sae);
+	size_t jobsPerCandidate = m_orders.size() * m_folds;
+	outErrors.resize(candidates);
+	outErrors.fill(0.0);
+	for(size_t i = 0; i < sse.size(); i++)
+		outErrors[i / jobsPerCandidate] += sse[i];
+	outErrors *= (1.0 / m_orders.size());
+}
+
+size_t GParallelValidator::successiveHalving(TransducerFactory pFactory, void* pThis, size_t candidates, size_t eta, double* pOutErr)
+{
+	if(candidates < 1)
+		throw Ex("Expected at least one candidate");
+	if(eta < 2)
+		throw Ex("eta must be at least 2");
+	size_t rungs = 0;
+	for(size_t n = candidates; n > 1; n = (n + eta - 1) / eta)
+		rungs++;
+	size_t minRows = std::min(m_features.rows(), std::max((size_t)50, m_folds * 10));
+	std::vector<size_t> survivors;
+	for(size_t i = 0; i < candidates; i++)
+		survivors.push_back(i);
+	size_t jobsPerCandidate = m_orders.size() * m_folds;
+	GVec sse, sae;
+	for(size_t rung = 0; true; rung++)
+	{
+		// Evaluate the survivors with a growing portion of the rows
+		size_t rows = m_features.rows();
+		for(size_t i = rung; i < rungs; i++)
+			rows /= eta;
+		rows = std::max(rows, minRows);
+		evaluate(pFactory, pThis, survivors, rows, sse, sae);
+		std::vector< std::pair<double, size_t> > scores;
+		for(size_t i = 0; i < survivors.size(); i++)
+		{
+			double err = 0.0;
+			for(size_t j = 0; j < jobsPerCandidate; j++)
+				err += sse[i * jobsPerCandidate + j];
+			scores.push_back(std::make_pair(err / m_orders.size(), survivors[i]));
+		}
+		std::sort(scores.begin(), scores.end());
+		if(survivors.size() == 1 || rung >= rungs)
+		{
+			if(pOutErr)
+				*pOutErr = scores[0].first;
+			return scores[0].second;
+		}
+
+		// Cancel the worst candidates
+		survivors.resize((survivors.size() + eta - 1) / eta);
+		for(size_t i = 0; i < survivors.size(); i++)
+			survivors[i] = scores[i].second;
+		std::sort(survivors.begin(), survivors.end());
+	}
+}
+
+#ifndef MIN_PREDICT
+GTransducer* GParallelValidator_testFactory(void* pThis, size_t candidate)
+{
+	switch(candidate)
+	{
+		case 0: return new GBaselineLearner();
+		case 1: return new GLinearRegressor();
+		case 2: return new GKNN();
+		default:
+			GKNN* pKNN = new GKNN();
+			pKNN->setNeighborCount(7);
+			return pKNN;
+	}
+}
+
+// static
+void GParallelValidator::test()
+{
+	GRand rand(0);
+	GMatrix features(300, 2);
+	GMatrix labels(300, 1);
+	for(size_t i = 0; i < features.rows(); i++)
+	{
+		features[i][0] = rand.uniform();
+		features[i][1] = rand.uniform();
+		labels[i][0] = 2.0 * features[i][0] - features[i][1] + 0.1 * rand.normal();
+	}
+
+	// Check that the folds match GTransducer::crossValidate
+	GParallelValidator pv(features, labels, 3, 2, 1234);
+	pv.setWorkerThreads(3);
+	double sse = pv.crossValidate(GParallelValidator_testFactory, NULL, 3);
+	double expected = 0.0;
+	for(size_t i = 0; i < pv.reps(); i++)
+	{
+		GMatrix f(features.relation().cloneMinimal());
+		GReleaseDataHolder hF(&f);
+		GMatrix l(labels.relation().cloneMinimal());
+		GReleaseDataHolder hL(&l);
+		for(size_t j = 0; j < features.rows(); j++)
+		{
+			f.takeRow(&features[pv.m_orders[i][j]]);
+			l.takeRow(&labels[pv.m_orders[i][j]]);
+		}
+		GKNN knn;
+		knn.setNeighborCount(7);
+		expected += knn.crossValidate(f, l, 3);
+	}
+	expected /= pv.reps();
+	if(std::abs(sse - expected) > 1e-9 * expected)
+		throw Ex("Expected ", to_str(expected), ". Got ", to_str(sse));
+
+	// Check that the number of threads does not affect the results
+	GVec errs1, errs2;
+	pv.crossValidate(GParallelValidator_testFactory, NULL, 4, errs1);
+	pv.setWorkerThreads(1);
+	pv.crossValidate(GParallelValidator_testFactory, NULL, 4, errs2);
+	for(size_t i = 0; i < 4; i++)
+	{
+		if(errs1[i] != errs2[i])
+			throw Ex("not deterministic");
+	}
+	if(errs1[3] != sse)
+		throw Ex("inconsistent");
+
+	// Check that successive halving finds the best candidate
+	pv.setWorkerThreads(4);
+	double err;
+	size_t best = pv.successiveHalving(GParallelValidator_testFactory, NULL, 4, 2, &err);
+	if(best != 1 || errs1.indexOfMin() != 1)
+		throw Ex("Successive halving picked the wrong candidate");
+	if(err != errs1[1])
+		throw Ex("The last round should use all of the rows");
+}
+#endif // MIN_PREDICT
+
+// ---------------------------------------------------------------
+
 GSupervisedLearner::GSupervisedLearner()
 : GTransducer(), m_pRelFeatures(NULL), m_pRelLabels(NULL)
 {
@@ -443,6 +790,27 @@ GDomNode* GSupervisedLearner::baseDomNode(GDom* pDoc, const char* szClassName) c
 	return pNode;
 }
 
+// virtual
+void GSupervisedLearner::serializeStream(GJsonWriter& writer) const
+{
+	GDom doc;
+	writer.writeNode(serialize(&doc));
+}
+
+void GSupervisedLearner::baseStreamObj(GJsonWriter& writer, const char* szClassName) const
+{
+	if(!m_pRelLabels)
+		throw Ex("The model must be trained before it is serialized.");
+	GDom doc;
+	writer.beginObj();
+	writer.key("class");
+	writer.writeString(szClassName);
+	writer.key("_rf");
+	writer.writeNode(m_pRelFeatures->serialize(&doc));
+	writer.key("_rl");
+	writer.writeNode(m_pRelLabels->serialize(&doc));
+}
+
 std::string to_str(const GSupervisedLearner& learner)
 {
 	GDom doc;
@@ -466,6 +834,14 @@ void GSupervisedLearner::train(const GMatrix& features, const GMatrix& labels)
 	trainInner(features, labels);
 }
 
+// virtual
+void GSupervisedLearner::predictBatch(const GMatrix& in, GMatrix& out)
+{
+	out.resize(in.rows(), relLabels().size());
+	for(size_t i = 0; i < in.rows(); i++)
+		predict(in[i], out[i]);
+}
+
 void GSupervisedLearner::confusion(GMatrix& features, GMatrix& labels, std::vector<GMatrix*>& stats)
 {
 	if(features.rows() != labels.rows())
@@ -820,6 +1196,17 @@ void GSupervisedLearner_basicTestEngine(GSupervisedLearner* pLearner, GMatrix& f
 	const GRelation& relLabelsBefore = pLearner->relLabels();
 	GDom doc;
 	doc.setRoot(pLearner->serialize(&doc));
+
+	// Streaming the model should produce the same text
+	std::ostringstream osDom;
+	doc.writeJson(osDom);
+	std::ostringstream osStream;
+	{
+		GJsonWriter writer(osStream);
+		pLearner->serializeStream(writer);
+	}
+	if(osStream.str().compare(osDom.str()) != 0)
+		throw Ex("serializeStream did not produce the same text as serialize");
 	pLearner->clear(); // free up some memory, just because we can
 	GLearnerLoader ll;
 	GSupervisedLearner* pModel = ll.loadLearner(doc.root());
@@ -1149,6 +1536,13 @@ GDomNode* GFilter::domNode(GDom* pDoc, const char* szClassName) const
 	return pNode;
 }
 
+void GFilter::domStream(GJsonWriter& writer, const char* szClassName) const
+{
+	baseStreamObj(writer, szClassName);
+	writer.key("learner");
+	m_pLearner->serializeStream(writer);
+}
+
 GMatrix* GFilter::prefilterFeatures(const GMatrix& in)
 {
 	GSupervisedLearner* pInnerLearner = m_pLearner;
@@ -1207,6 +1601,16 @@ GDomNode* GFeatureFilter::serialize(GDom* pDoc) const
 	return pNode;
 }
 
+// virtual
+void GFeatureFilter::serializeStream(GJsonWriter& writer) const
+{
+	GDom doc;
+	domStream(writer, "GFeatureFilter");
+	writer.key("trans");
+	writer.writeNode(m_pTransform->serialize(&doc));
+	writer.endObj();
+}
+
 // virtual
 void GFeatureFilter::trainInner(const GMatrix& features, const GMatrix& labels)
 {
@@ -1227,6 +1631,15 @@ void GFeatureFilter::predict(const GVec& in, GVec& out)
 	m_pLearner->predict(m_pTransform->innerBuf(), out);
 }
 
+// virtual
+void GFeatureFilter::predictBatch(const GMatrix& in, GMatrix& out)
+{
+	GMatrix inner(in.rows(), m_pTransform->after().size());
+	for(size_t i = 0; i < in.rows(); i++)
+		m_pTransform->transform(in[i], inner[i]);
+	m_pLearner->predictBatch(inner, out);
+}
+
 // virtual
 void GFeatureFilter::predictDistribution(const GVec& in, GPrediction* out)
 {
@@ -1302,6 +1715,16 @@ GDomNode* GLabelFilter::serialize(GDom* pDoc) const
 	return pNode;
 }
 
+// virtual
+void GLabelFilter::serializeStream(GJsonWriter& writer) const
+{
+	GDom doc;
+	domStream(writer, "GLabelFilter");
+	writer.key("trans");
+	writer.writeNode(m_pTransform->serialize(&doc));
+	writer.endObj();
+}
+
 // virtual
 void GLabelFilter::trainInner(const GMatrix& features, const GMatrix& labels)
 {
@@ -1322,6 +1745,16 @@ void GLabelFilter::predict(const GVec& in, GVec& out)
 	m_pTransform->untransform(m_pTransform->innerBuf(), out);
 }
 
+// virtual
+void GLabelFilter::predictBatch(const GMatrix& in, GMatrix& out)
+{
+	GMatrix inner;
+	m_pLearner->predictBatch(in, inner);
+	out.resize(in.rows(), m_pTransform->before().size());
+	for(size_t i = 0; i < in.rows(); i++)
+		m_pTransform->untransform(inner[i], out[i]);
+}
+
 // virtual
 void GLabelFilter::predictDistribution(const GVec& in, GPrediction* out)
 {
@@ -1397,6 +1830,13 @@ GDomNode* GAutoFilter::serialize(GDom* pDoc) const
 	return pNode;
 }
 
+// virtual
+void GAutoFilter::serializeStream(GJsonWriter& writer) const
+{
+	domStream(writer, "GAutoFilter");
+	writer.endObj();
+}
+
 void GAutoFilter::whatTypesAreNeeded(const GRelation& featureRel, const GRelation& labelRel, bool& hasNominalFeatures, bool& hasContinuousFeatures, bool& hasNominalLabels, bool& hasContinuousLabels)
 {
 	// Determine what types are present in the feature data
@@ -1627,6 +2067,12 @@ void GAutoFilter::predict(const GVec& in, GVec& out)
 	m_pLearner->predict(in, out);
 }
 
+// virtual
+void GAutoFilter::predictBatch(const GMatrix& in, GMatrix& out)
+{
+	m_pLearner->predictBatch(in, out);
+}
+
 // virtual
 void GAutoFilter::predictDistribution(const GVec& in, GPrediction* out)
 {
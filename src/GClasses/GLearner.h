@@ -28,6 +28,7 @@ namespace GClasses {
 
 class GDom;
 class GDomNode;
+class GJsonWriter;
 class GDistribution;
 class GCategoricalDistribution;
 class GNormalDistribution;
@@ -104,13 +105,14 @@ class GTransducer
 {
 protected:
 	GRand m_rand;
+	size_t m_autoTuneThreads;
 
 public:
 	/// General-purpose constructor.
 	GTransducer();
 
 	/// Copy-constructor. Throws an exception to prevent models from being copied by value.
-	GTransducer(const GTransducer& that) : m_rand(0)
+	GTransducer(const GTransducer& that) : m_rand(0), m_autoTuneThreads(1)
 	{
 		throw Ex("This object is not intended to be copied by value");
 	}
@@ -164,6 +166,12 @@ public:
 	/// This might be important, for example, in an ensemble of learners.
 	GRand& rand() { return m_rand; }
 
+	/// Specify the number of threads that autoTune may use to evaluate candidate configurations. The default is 1.
+	void setAutoTuneThreads(size_t n) { m_autoTuneThreads = n; }
+
+	/// Returns the number of threads that autoTune may use.
+	size_t autoTuneThreads() const { return m_autoTuneThreads; }
+
 	/// Returns true iff this algorithm can implicitly handle nominal features. If it
 	/// cannot, then the GNominalToCat transform will be used to convert nominal
 	/// features to continuous values before passing them to it.
@@ -207,6 +215,73 @@ protected:
 };
 
 
+/// Returns a new, untrained learner configured for the specified candidate. The caller takes ownership of it.
+/// pThis is just a pointer that is passed through to the factory.
+typedef GTransducer* (*TransducerFactory)(void* pThis, size_t candidate);
+
+
+/// Cross-validates learners in parallel. Each fold of each rep is trained by its own learner instance,
+/// made by a factory, and the folds (and, for a hyperparameter search, the candidate configurations)
+/// are spread over a pool of worker threads. Every instance trains on a read-only view of the same
+/// rows, so the data is never copied. The row order of each rep and the seed of each learner are
+/// derived from the seed passed to the constructor, so the results do not depend on the number of threads.
+class GParallelValidator
+{
+protected:
+	const GMatrix& m_features;
+	const GMatrix& m_labels;
+	size_t m_folds;
+	size_t m_seed;
+	size_t m_workerThreads;
+	std::vector< std::vector<size_t> > m_orders; // One permutation of the rows for each rep
+
+public:
+	/// features and labels must remain valid for the lifetime of this object.
+	/// Each rep shuffles the rows with its own permutation, derived from seed.
+	GParallelValidator(const GMatrix& features, const GMatrix& labels, size_t folds = 2, size_t reps = 1, size_t seed = 0);
+	~GParallelValidator();
+
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
+	/// Specify the number of worker threads to use. The default is 1.
+	void setWorkerThreads(size_t n) { m_workerThreads = n; }
+
+	/// Returns the number of worker threads.
+	size_t workerThreads() const { return m_workerThreads; }
+
+	/// Returns the number of folds.
+	size_t folds() const { return m_folds; }
+
+	/// Returns the number of reps.
+	size_t reps() const { return m_orders.size(); }
+
+	/// Returns the seed given to the learner that is trained on the specified rep and fold.
+	/// (Every candidate is given the same seeds, so candidates are compared under the same conditions.)
+	size_t learnerSeed(size_t rep, size_t fold) const;
+
+	/// Cross-validates the learner that pFactory makes for candidate. Returns the sum-squared error over
+	/// all folds, averaged over the reps (like GTransducer::repValidate). If pOutSAE is not NULL, the
+	/// sum absolute error is placed there. If pCB is not NULL, it is called for each fold, in order, after all
+	/// of the folds are done.
+	double crossValidate(TransducerFactory pFactory, void* pThis, size_t candidate = 0, double* pOutSAE = NULL, RepValidateCallback pCB = NULL, void* pCBThis = NULL);
+
+	/// Cross-validates every candidate from 0 to candidates-1, and puts the errors in outErrors.
+	void crossValidate(TransducerFactory pFactory, void* pThis, size_t candidates, GVec& outErrors);
+
+	/// Searches for the best of the specified number of candidates by successive halving.
+	/// The first round cross-validates every candidate with only a small portion of the rows. Only the best 1/eta of the
+	/// candidates survive to the next round, which uses eta times as many rows. The last round uses all of the rows.
+	/// Returns the index of the best candidate. If pOutErr is not NULL, its error with all of the rows is placed there.
+	size_t successiveHalving(TransducerFactory pFactory, void* pThis, size_t candidates, size_t eta = 3, double* pOutErr = NULL);
+
+protected:
+	/// Cross-validates the specified candidates, using only the first rows rows of each rep.
+	/// Puts the sum-squared error of each (candidate, rep, fold) job in outSSE, and the sum absolute error in outSAE.
+	void evaluate(TransducerFactory pFactory, void* pThis, const std::vector<size_t>& candidates, size_t rows, GVec& outSSE, GVec& outSAE);
+};
+
+
 /// This is the base class of algorithms that learn with supervision and
 /// have an internal hypothesis model that allows them to generalize
 /// rows that were not available at training time.
@@ -230,6 +305,12 @@ public:
 	/// of formats. (Implementations of this method should use baseDomNode.)
 	virtual GDomNode* serialize(GDom* pDoc) const = 0;
 
+	/// Writes this object to writer in JSON format. The text is the same as the text of the node returned by
+	/// serialize, but models with big arrays of parameters override this to stream those arrays without first
+	/// building a DOM of them, so much less memory is needed to save (or checkpoint) them. The default
+	/// implementation just writes the node returned by serialize.
+	virtual void serializeStream(GJsonWriter& writer) const;
+
 	/// Returns true because fully supervised learners have an internal
 	/// model that allows them to generalize previously unseen rows.
 	virtual bool canGeneralize() { return true; }
@@ -254,6 +335,12 @@ public:
 	/// method.
 	virtual void predict(const GVec& in, GVec& out) = 0;
 
+	/// Computes a prediction for each row of in, and stores them in the corresponding rows of out,
+	/// which is resized as needed. The default implementation calls predict for each row, but models
+	/// that can evaluate many rows with one blocked matrix operation override this, so scoring a batch
+	/// is much faster than scoring the same rows one at a time.
+	virtual void predictBatch(const GMatrix& in, GMatrix& out);
+
 	/// Evaluate pIn and compute a prediction for pOut. pOut is expected
 	/// to point to an array of GPrediction objects which have already been
 	/// allocated. There should be labelDims() elements in this array.
@@ -319,6 +406,10 @@ protected:
 
 	/// Child classes should use this in their implementation of serialize
 	GDomNode* baseDomNode(GDom* pDoc, const char* szClassName) const;
+
+	/// Child classes should use this in their implementation of serializeStream. It begins an object
+	/// and writes the same fields that baseDomNode adds. (The child class must end the object.)
+	void baseStreamObj(GJsonWriter& writer, const char* szClassName) const;
 };
 
 ///\brief Converts a GSupervisedLearner to a string
@@ -449,6 +540,9 @@ protected:
 	/// Helper function for serialization
 	GDomNode* domNode(GDom* pDoc, const char* szClassName) const;
 
+	/// Helper function for streaming serialization. Begins an object, and streams the inner learner into it.
+	void domStream(GJsonWriter& writer, const char* szClassName) const;
+
 public:
 	/// See the comment for GSupervisedLearner::clear
 	virtual void clear();
@@ -504,9 +598,15 @@ using GFilter::prefilterLabels;
 	/// Marshal this object into a DOM, which can then be converted to a variety of serial formats.
 	virtual GDomNode* serialize(GDom* pDoc) const;
 
+	/// See the comment for GSupervisedLearner::serializeStream
+	virtual void serializeStream(GJsonWriter& writer) const;
+
 	/// See the comment for GSupervisedLearner::predict
 	virtual void predict(const GVec& in, GVec& out);
 
+	/// See the comment for GSupervisedLearner::predictBatch
+	virtual void predictBatch(const GMatrix& in, GMatrix& out);
+
 	/// See the comment for GSupervisedLearner::predictDistributionInner
 	virtual void predictDistribution(const GVec& in, GPrediction* pOut);
 
@@ -553,9 +653,15 @@ using GFilter::prefilterLabels;
 	/// Marshal this object into a DOM, which can then be converted to a variety of serial formats.
 	virtual GDomNode* serialize(GDom* pDoc) const;
 
+	/// See the comment for GSupervisedLearner::serializeStream
+	virtual void serializeStream(GJsonWriter& writer) const;
+
 	/// See the comment for GSupervisedLearner::predict
 	virtual void predict(const GVec& in, GVec& out);
 
+	/// See the comment for GSupervisedLearner::predictBatch
+	virtual void predictBatch(const GMatrix& in, GMatrix& out);
+
 	/// See the comment for GSupervisedLearner::predictDistribution
 	virtual void predictDistribution(const GVec& in, GPrediction* pOut);
 
@@ -603,9 +709,15 @@ using GFilter::prefilterLabels;
 	/// Marshal this object into a DOM, which can then be converted to a variety of serial formats.
 	virtual GDomNode* serialize(GDom* pDoc) const;
 
+	/// See the comment for GSupervisedLearner::serializeStream
+	virtual void serializeStream(GJsonWriter& writer) const;
+
 	/// See the comment for GSupervisedLearner::predict
 	virtual void predict(const GVec& in, GVec& out);
 
+	/// See the comment for GSupervisedLearner::predictBatch
+	virtual void predictBatch(const GMatrix& in, GMatrix& out);
+
 	/// See the comment for GSupervisedLearner::predictDistribution
 	virtual void predictDistribution(const GVec& in, GPrediction* pOut);
 
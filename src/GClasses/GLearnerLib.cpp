@@ -494,6 +494,12 @@ GGaussianProcess* GLearnerLib::InstantiateGaussianProcess(GArgReader& args, GMat
 			pModel->setWeightsPriorVariance(args.pop_double());
 		}else if(args.if_pop("-maxsamples")){
 			pModel->setMaxSamples(args.pop_uint());
+		}else if(args.if_pop("-inducing")){
+			pModel->setInducingPoints(args.pop_uint());
+		}else if(args.if_pop("-fitc")){
+			pModel->setInducingPoints(args.pop_uint(), GGaussianProcess::FITC);
+		}else if(args.if_pop("-threads")){
+			pModel->setWorkerThreads(args.pop_uint());
 		}else if(args.if_pop("-kernel")){
 			if(args.if_pop("identity"))
 				pModel->setKernel(new GKernelIdentity());
@@ -632,6 +638,10 @@ GLinearRegressor* GLearnerLib::InstantiateLinearRegressor(GArgReader& args, GMat
 				throw Ex("Insufficient data to support automatic tuning");
 			pModel->autoTune(*pFeatures, *pLabels);
 		}
+		else if(args.if_pop("-ridge"))
+			pModel->setRidge(args.pop_double());
+		else if(args.if_pop("-threads"))
+			pModel->setWorkerThreads(args.pop_uint());
 		else
 			throw Ex("Invalid option: ", args.peek());
 	}
@@ -668,6 +678,8 @@ GNaiveBayes* GLearnerLib::InstantiateNaiveBayes(GArgReader& args, GMatrix* pFeat
 		}
 		else if(args.if_pop("-ess"))
 			pModel->setEquivalentSampleSize(args.pop_double());
+		else if(args.if_pop("-threads"))
+			pModel->setWorkerThreads(args.pop_uint());
 		else
 			throw Ex("Invalid option: ", args.peek());
 	}
@@ -687,6 +699,8 @@ GNaiveInstance* GLearnerLib::InstantiateNaiveInstance(GArgReader& args, GMatrix*
 		}
 		else if(args.if_pop("-neighbors"))
 			pModel->setNeighbors(args.pop_uint());
+		else if(args.if_pop("-threads"))
+			pModel->setWorkerThreads(args.pop_uint());
 		else
 			throw Ex("Invalid option: ", args.peek());
 	}
@@ -886,9 +900,10 @@ GTransducer* GLearnerLib::InstantiateAlgorithm(GArgReader& args, GMatrix* pFeatu
 	return pAlg;
 }
 
-void GLearnerLib::autoTuneDecisionTree(GMatrix& features, GMatrix& labels)
+void GLearnerLib::autoTuneDecisionTree(GMatrix& features, GMatrix& labels, size_t threads)
 {
 	GDecisionTree dt;
+	dt.setAutoTuneThreads(threads);
 	dt.autoTune(features, labels);
 	cout << "decisiontree";
 	if(dt.leafThresh() != 1)
@@ -898,9 +913,10 @@ void GLearnerLib::autoTuneDecisionTree(GMatrix& features, GMatrix& labels)
 	cout << "\n";
 }
 
-void GLearnerLib::autoTuneKNN(GMatrix& features, GMatrix& labels)
+void GLearnerLib::autoTuneKNN(GMatrix& features, GMatrix& labels, size_t threads)
 {
 	GKNN model;
+	model.setAutoTuneThreads(threads);
 	model.autoTune(features, labels);
 	cout << "knn";
 	if(model.neighborCount() != 1)
@@ -913,9 +929,10 @@ void GLearnerLib::autoTuneNeuralNet(GMatrix& features, GMatrix& labels)
 	throw Ex("Cannot autotune neural net at this time. Recent changes to the way optimization works have broken this functionality.");
 }
 
-void GLearnerLib::autoTuneNaiveBayes(GMatrix& features, GMatrix& labels)
+void GLearnerLib::autoTuneNaiveBayes(GMatrix& features, GMatrix& labels, size_t threads)
 {
 	GNaiveBayes model;
+	model.setAutoTuneThreads(threads);
 	model.autoTune(features, labels);
 	cout << "naivebayes";
 	cout << " -ess " << model.equivalentSampleSize();
@@ -942,6 +959,16 @@ void GLearnerLib::autoTuneGraphCutTransducer(GMatrix& features, GMatrix& labels)
 
 void GLearnerLib::autoTune(GArgReader& args)
 {
+	// Parse options
+	size_t threads = 1;
+	while(args.next_is_flag())
+	{
+		if(args.if_pop("-threads"))
+			threads = args.pop_uint();
+		else
+			throw Ex("Invalid autotune option: ", args.peek());
+	}
+
 	// Load the data
 	std::unique_ptr<GMatrix> hFeatures, hLabels;
 	loadData(args, hFeatures, hLabels);
@@ -953,17 +980,17 @@ void GLearnerLib::autoTune(GArgReader& args)
 	if(strcmp(szModel, "agglomerativetransducer") == 0)
 		cout << "agglomerativetransducer\n"; // no params to tune
 	else if(strcmp(szModel, "decisiontree") == 0)
-		autoTuneDecisionTree(*pFeatures, *pLabels);
+		autoTuneDecisionTree(*pFeatures, *pLabels, threads);
 	else if(strcmp(szModel, "graphcuttransducer") == 0)
 		autoTuneGraphCutTransducer(*pFeatures, *pLabels);
 	else if(strcmp(szModel, "knn") == 0)
-		autoTuneKNN(*pFeatures, *pLabels);
+		autoTuneKNN(*pFeatures, *pLabels, threads);
 	else if(strcmp(szModel, "meanmarginstree") == 0)
 		cout << "meanmarginstree\n"; // no params to tune
 	else if(strcmp(szModel, "neuralnet") == 0)
 		autoTuneNeuralNet(*pFeatures, *pLabels);
 	else if(strcmp(szModel, "naivebayes") == 0)
-		autoTuneNaiveBayes(*pFeatures, *pLabels);
+		autoTuneNaiveBayes(*pFeatures, *pLabels, threads);
 	else if(strcmp(szModel, "naiveinstance") == 0)
 		autoTuneNaiveInstance(*pFeatures, *pLabels);
 	else
@@ -1005,13 +1032,17 @@ void GLearnerLib::Train(GArgReader& args)
 	pModel->train(*pFeatures, *pLabels);
 
 	// Output the trained model
-	GDom doc;
-	GDomNode* pRoot = pModel->serialize(&doc);
-	doc.setRoot(pRoot);
 	if(embed)
+	{
+		GDom doc;
+		doc.setRoot(pModel->serialize(&doc));
 		doc.writeJsonCpp(cout);
+	}
 	else
-		doc.writeJson(cout);
+	{
+		GJsonWriter writer(cout);
+		pModel->serializeStream(writer);
+	}
 }
 
 void GLearnerLib::predict(GArgReader& args)
@@ -1156,6 +1187,57 @@ void GLearnerLib::predictDistribution(GArgReader& args)
 	}
 }
 
+void GLearnerLib::serve(GArgReader& args)
+{
+	// Parse options
+	int port = 8080;
+	size_t threads = 1;
+	size_t queue = 1024;
+	size_t maxBatch = 0;
+	double maxWait = 0.0;
+	while(args.next_is_flag())
+	{
+		if(args.if_pop("-port"))
+			port = args.pop_uint();
+		else if(args.if_pop("-threads"))
+			threads = args.pop_uint();
+		else if(args.if_pop("-queue"))
+			queue = args.pop_uint();
+		else if(args.if_pop("-batch"))
+		{
+			maxBatch = args.pop_uint();
+			maxWait = args.pop_double();
+		}
+		else
+			throw Ex("Invalid serve option: ", args.peek());
+	}
+	if(port < 0 || port > 65535)
+		throw Ex("Invalid port: ", to_str(port));
+
+	// Load the models. Each one is named after its file.
+	GModelServer server((unsigned short)port, threads);
+	server.setMaxQueue(queue);
+	if(maxBatch > 0)
+		server.setBatching(maxBatch, maxWait);
+	if(args.size() < 1)
+		throw Ex("Model not specified.");
+	while(args.size() > 0)
+	{
+		const char* szFilename = args.pop_string();
+		PathData pd;
+		GFile::parsePath(szFilename, &pd);
+		string name(szFilename + pd.fileStart, pd.extStart - pd.fileStart);
+		server.loadModel(name.c_str(), szFilename);
+		cerr << "Serving " << szFilename << " at /predict/" << name << "\n";
+	}
+
+	// Serve until killed
+	cerr << "Listening on port " << server.port() << "\n";
+	cerr.flush();
+	while(true)
+		server.process(1000);
+}
+
 void GLearnerLib::leftJustifiedString(const char* pIn, char* pOut, size_t outLen)
 {
 	for(size_t i = 0; outLen > 0 && *pIn != '\0'; i++)
@@ -1554,12 +1636,10 @@ void GLearnerLib::SplitTest(GArgReader& args)
 				GSupervisedLearner* pSup =
 				  dynamic_cast<GSupervisedLearner*>
 				  (pSupLearner);
-				GDom doc;
-				GDomNode* pRoot = pSup->serialize(&doc);
-				doc.setRoot(pRoot);
 				std::ofstream out(lastModelFile.c_str());
 				if(out){
-					doc.writeJson(out);
+					GJsonWriter writer(out);
+					pSup->serializeStream(writer);
 				}
 			}
 			cout << "rep " << i << ") ";
@@ -1583,12 +1663,35 @@ void GLearnerLib::CrossValidateCallback(void* pSupLearner, size_t nRep, size_t n
 	cout << "Rep: " << nRep << ", Fold: " << nFold <<", Mean squared error: " << to_str(foldSSE / rows) << "\n";
 }
 
+class GLearnerLibAlgorithmArgs
+{
+public:
+	GArgReader& m_args;
+	int m_pos;
+	GMatrix* m_pFeatures;
+	GMatrix* m_pLabels;
+
+	GLearnerLibAlgorithmArgs(GArgReader& args, GMatrix* pFeatures, GMatrix* pLabels)
+	: m_args(args), m_pos(args.get_pos()), m_pFeatures(pFeatures), m_pLabels(pLabels)
+	{
+	}
+
+	/// Instantiates another copy of the algorithm specified on the command line.
+	static GTransducer* instantiate(void* pThis, size_t candidate)
+	{
+		GLearnerLibAlgorithmArgs* pAlgArgs = (GLearnerLibAlgorithmArgs*)pThis;
+		pAlgArgs->m_args.set_pos(pAlgArgs->m_pos);
+		return GLearnerLib::InstantiateAlgorithm(pAlgArgs->m_args, pAlgArgs->m_pFeatures, pAlgArgs->m_pLabels);
+	}
+};
+
 void GLearnerLib::CrossValidate(GArgReader& args)
 {
 	// Parse options
 	unsigned int seed = getpid() * (unsigned int)time(NULL);
 	int reps = 5;
 	int folds = 2;
+	size_t threads = 1;
 	bool succinct = false;
 	while(args.next_is_flag())
 	{
@@ -1598,6 +1701,8 @@ void GLearnerLib::CrossValidate(GArgReader& args)
 			reps = args.pop_uint();
 		else if(args.if_pop("-folds"))
 			folds = args.pop_uint();
+		else if(args.if_pop("-threads"))
+			threads = args.pop_uint();
 		else if(args.if_pop("-succinct"))
 			succinct = true;
 		else
@@ -1615,16 +1720,18 @@ void GLearnerLib::CrossValidate(GArgReader& args)
 	GMatrix* pLabels = hLabels.get();
 
 	// Instantiate the modeler
-	GTransducer* pSupLearner = InstantiateAlgorithm(args, pFeatures, pLabels);
+	GLearnerLibAlgorithmArgs algArgs(args, pFeatures, pLabels);
+	GTransducer* pSupLearner = InstantiateAlgorithm(args, pFeatures, pLabels); // This instance just checks the arguments
 	std::unique_ptr<GTransducer> hModel(pSupLearner);
 	if(args.size() > 0)
 		throw Ex("Superfluous argument: ", args.peek());
-	pSupLearner->rand().setSeed(seed);
 
-	// Test
+	// Test. (Each fold is trained by its own instance of the algorithm, even with one thread, so the results do not depend on the number of threads.)
 	cout.precision(8);
 	double sae;
-	double sse = pSupLearner->repValidate(*pFeatures, *pLabels, reps, folds, &sae, succinct ? NULL : CrossValidateCallback, pSupLearner);
+	GParallelValidator pv(*pFeatures, *pLabels, folds, reps, seed);
+	pv.setWorkerThreads(threads);
+	double sse = pv.crossValidate(GLearnerLibAlgorithmArgs::instantiate, &algArgs, 0, &sae, succinct ? NULL : CrossValidateCallback, pSupLearner);
 	if(succinct)
 		cout << to_str(sse / pFeatures->rows());
 	else
@@ -1842,142 +1949,69 @@ void GLearnerLib::sterilize(GArgReader& args)
 	std::unique_ptr<GMatrix> hSterile(pSterile);
 	pSterile->print(cout);
 }
-/*
 void GLearnerLib::trainRecurrent(GArgReader& args)
 {
 	// Parse options
-	unsigned int seed = getpid() * (unsigned int)time(NULL);
-	vector<size_t> paramDims;
-	const char* stateFilename = NULL;
-	double validationInterval = 0;
-	vector<string> validationFilenames;
-	const char* outFilename = "model.json";
-	double trainTime = 60 * 60; // 1 hour
-	bool useIsomap = false;
+	size_t seed = getpid() * (unsigned int)time(NULL);
+	size_t units = 32;
+	size_t batchSize = 16;
+	size_t steps = 20;
+	size_t epochs = 100;
+	double learningRate = 0.01;
+	double clip = 5.0;
+	bool verbose = false;
 	while(args.next_is_flag())
 	{
 		if(args.if_pop("-seed"))
 			seed = args.pop_uint();
-		else if(args.if_pop("-paramdims"))
-		{
-			unsigned int count = args.pop_uint();
-			for(unsigned int i = 0; i < count; i++)
-				paramDims.push_back(args.pop_uint());
-		}
-		else if(args.if_pop("-state"))
-			stateFilename = args.pop_string();
-		else if(args.if_pop("-validate"))
-		{
-			validationInterval = args.pop_double();
-			int count = args.pop_uint();
-			for(int i = 0; i < count; i++)
-			{
-				validationFilenames.push_back(args.pop_string());
-				validationFilenames.push_back(args.pop_string());
-			}
-		}
-		else if(args.if_pop("-out"))
-			outFilename = args.pop_string();
-		else if(args.if_pop("-traintime"))
-			trainTime = args.pop_double();
-		else if(args.if_pop("-isomap"))
-			useIsomap = true;
+		else if(args.if_pop("-units"))
+			units = args.pop_uint();
+		else if(args.if_pop("-batch"))
+			batchSize = args.pop_uint();
+		else if(args.if_pop("-bptt"))
+			steps = args.pop_uint();
+		else if(args.if_pop("-epochs"))
+			epochs = args.pop_uint();
+		else if(args.if_pop("-learningrate"))
+			learningRate = args.pop_double();
+		else if(args.if_pop("-clip"))
+			clip = args.pop_double();
+		else if(args.if_pop("-verbose"))
+			verbose = true;
 		else
-			throw Ex("Invalid trainRecurrent option: ", args.peek());
-	}
-
-	// Parse the algorithm
-	const char* alg = args.pop_string();
-//	int bpttDepth = 0;
-//	int bpttItersPerGrow = 0;
-	double annealDeviation = 0.0;
-	double annealDecay = 0.0;
-	double annealTimeWindow = 0.0;
-	if(strcmp(alg, "moses") == 0)
-	{
-	}
-	else if(strcmp(alg, "evolutionary") == 0)
-	{
-	}
-	else if(strcmp(alg, "hillclimber") == 0)
-	{
-	}
-	else if(strcmp(alg, "annealing") == 0)
-	{
-		annealDeviation = args.pop_double();
-		annealDecay = args.pop_double();
-		annealTimeWindow = args.pop_double();
+			throw Ex("Invalid trainrecurrent option: ", args.peek());
 	}
-	else
-		throw Ex("Unrecognized recurrent model training algorithm: ", alg);
 
 	// Load the data
-	GMatrix dataObs;
-	dataObs.loadArff(args.pop_string());
-	GMatrix dataAction;
-	dataAction.loadArff(args.pop_string());
-
-	// Get the number of context dims
-	int contextDims = args.pop_uint();
-
-	// Infer remaining values and check that the parts fit together
-	size_t pixels = 1;
-	for(vector<size_t>::iterator it = paramDims.begin(); it != paramDims.end(); it++)
-		pixels *= *it;
-	size_t channels = dataObs.cols() / pixels;
-	if((channels * pixels) != dataObs.cols())
-		throw Ex("The number of columns in the observation data must be a multiple of the product of the param dims");
-
-	// Instantiate the recurrent model
-	GTransducer* pTransitionFunc = InstantiateAlgorithm(args, NULL, NULL);
-	std::unique_ptr<GTransducer> hTransitionFunc(pTransitionFunc);
-	if(!pTransitionFunc->canGeneralize())
-		throw Ex("The algorithm specified for the transition function cannot be \"trained\". It can only be used to \"transduce\".");
-	pTransitionFunc->rand().setSeed(seed);
-	GTransducer* pObservationFunc = InstantiateAlgorithm(args, NULL, NULL);
-	std::unique_ptr<GTransducer> hObservationFunc(pObservationFunc);
-	if(!pObservationFunc->canGeneralize())
-		throw Ex("The algorithm specified for the observation function cannot be \"trained\". It can only be used to \"transduce\".");
-	pObservationFunc->rand().setSeed((seed + 13) * 11);
+	std::unique_ptr<GMatrix> hFeatures, hLabels;
+	loadData(args, hFeatures, hLabels);
+	GMatrix* pFeatures = hFeatures.get();
+	GMatrix* pLabels = hLabels.get();
 	if(args.size() > 0)
 		throw Ex("Superfluous argument: ", args.peek());
-	GRand prng(seed);
-	MyRecurrentModel model((GSupervisedLearner*)hTransitionFunc.release(), (GSupervisedLearner*)hObservationFunc.release(), dataAction.cols(), contextDims, dataObs.cols(), &prng, &paramDims, stateFilename, validationInterval);
+	if(!pFeatures->relation().areContinuous() || !pLabels->relation().areContinuous())
+		throw Ex("Expected only continuous attributes. Use waffles_transform nominaltocat to convert nominal attributes first.");
 
-	// Set it up to do validation during training if specified
-	vector<GMatrix*> validationData;
-	VectorOfPointersHolder<GMatrix> hValidationData(validationData);
-	if(validationInterval > 0)
+	// Train the model
+	GRand rand(seed);
+	GFusedLSTM model(pFeatures->cols(), units, pLabels->cols());
+	model.initWeights(rand);
+	GFusedLSTMTrainer trainer(model, batchSize, steps);
+	trainer.setLearningRate(learningRate);
+	trainer.setGradientClip(clip);
+	for(size_t i = 0; i < epochs; i++)
 	{
-		for(size_t i = 0; i < validationFilenames.size(); i++)
-		{
-			GMatrix* pVal = new GMatrix();
-			std::unique_ptr<GMatrix> hVal(pVal);
-			pVal->loadArff(validationFilenames[i].c_str());
-			validationData.push_back(hVal.release());
-		}
-		model.validateDuringTraining(validationInterval, &validationData);
-		cout << "@RELATION validation_scores\n\n@ATTRIBUTE seconds real\n@ATTRIBUTE " << alg << " real\n\n@DATA\n";
-	}
-
-	// Set other flags
-	model.setTrainingSeconds(trainTime);
-	model.setUseIsomap(useIsomap);
-
-	// Do the training
-	if(strcmp(alg, "moses") == 0)
-		model.trainMoses(&dataAction, &dataObs);
-	else if(strcmp(alg, "evolutionary") == 0)
-		model.trainEvolutionary(&dataAction, &dataObs);
-	else if(strcmp(alg, "hillclimber") == 0)
-		model.trainHillClimber(&dataAction, &dataObs, 0.0, 0.0, 0.0, true, false);
-	else if(strcmp(alg, "annealing") == 0)
-		model.trainHillClimber(&dataAction, &dataObs, annealDeviation, annealDecay, annealTimeWindow, false, true);
+		double mse = trainer.trainEpoch(*pFeatures, *pLabels);
+		if(verbose)
+			cerr << "Epoch " << to_str(i + 1) << ", mse=" << to_str(mse) << "\n";
+	}
+
+	// Output the trained model
 	GDom doc;
 	doc.setRoot(model.serialize(&doc));
-	doc.saveJson(outFilename);
+	doc.writeJson(cout);
 }
-*/
+
 void GLearnerLib::regress(GArgReader& args)
 {
 	// Load the data
@@ -39,11 +39,13 @@
 #include "GLinear.h"
 #include "GError.h"
 #include "GManifold.h"
+#include "GModelServer.h"
 #include "GNaiveBayes.h"
 #include "GNaiveInstance.h"
 #include "GNeuralNet.h"
 #include "GOptimizer.h"
 #include "GRand.h"
+#include "GRecurrent.h"
 #include "GSparseMatrix.h"
 #include "GTime.h"
 #include "GTransform.h"
@@ -130,13 +132,13 @@ public:
 
 	static void showInstantiateAlgorithmError(const char* szMessage, GArgReader& args);
 
-	static void autoTuneDecisionTree(GMatrix& features, GMatrix& labels);
+	static void autoTuneDecisionTree(GMatrix& features, GMatrix& labels, size_t threads);
 
-	static void autoTuneKNN(GMatrix& features, GMatrix& labels);
+	static void autoTuneKNN(GMatrix& features, GMatrix& labels, size_t threads);
 
 	static void autoTuneNeuralNet(GMatrix& features, GMatrix& labels);
 
-	static void autoTuneNaiveBayes(GMatrix& features, GMatrix& labels);
+	static void autoTuneNaiveBayes(GMatrix& features, GMatrix& labels, size_t threads);
 
 	static void autoTuneNaiveInstance(GMatrix& features, GMatrix& labels);
 
@@ -150,6 +152,8 @@ public:
 
 	static void predictDistribution(GArgReader& args);
 
+	static void serve(GArgReader& args);
+
 	static void leftJustifiedString(const char* pIn, char* pOut, size_t outLen);
 
 	static void rightJustifiedString(const char* pIn, char* pOut, size_t outLen);
@@ -224,6 +228,8 @@ public:
 
 	static void sterilize(GArgReader& args);
 
+	static void trainRecurrent(GArgReader& args);
+
 	static void regress(GArgReader& args);
 
 	static void metaData(GArgReader& args);
@@ -25,19 +25,234 @@
 #include "GOptimizer.h"
 #include "GHillClimber.h"
 #include "GHolders.h"
+#include "GThread.h"
+#include "GDataPipeline.h"
 #include <cmath>
 #include <math.h>
 #include <memory>
+#include <algorithm>
 
 namespace GClasses {
 
+#define GLINEARSTATS_BLOCK_ROWS 256
+
+GLinearStats::GLinearStats(size_t featureDims, size_t labelDims)
+: m_featureDims(featureDims), m_labelDims(labelDims), m_count(0)
+{
+	size_t dims = featureDims + labelDims;
+	m_mean.resize(dims);
+	m_comoment.resize(dims * dims);
+	clear();
+}
+
+GLinearStats::~GLinearStats()
+{
+}
+
+void GLinearStats::clear()
+{
+	m_count = 0;
+	m_mean.fill(0.0);
+	m_comoment.fill(0.0);
+}
+
+double GLinearStats::comoment(size_t i, size_t j) const
+{
+	return m_comoment[i * (m_featureDims + m_labelDims) + j];
+}
+
+void GLinearStats::add(const GMatrix& features, const GMatrix& labels, size_t rowStart, size_t rowCount)
+{
+	if(features.cols() != m_featureDims || labels.cols() != m_labelDims)
+		throw Ex("Expected ", to_str(m_featureDims), " feature columns and ", to_str(m_labelDims), " label columns");
+	if(rowCount == INVALID_INDEX)
+		rowCount = features.rows() - rowStart;
+	if(rowStart + rowCount > features.rows() || rowStart + rowCount > labels.rows())
+		throw Ex("Row range out of range");
+	size_t dims = m_featureDims + m_labelDims;
+	size_t end = rowStart + rowCount;
+	for(size_t start = rowStart; start < end; start += GLINEARSTATS_BLOCK_ROWS)
+	{
+		// Pack the block contiguously, and find its mean
+		size_t n = std::min((size_t)GLINEARSTATS_BLOCK_ROWS, end - start);
+		m_block.resize(n * dims);
+		m_blockMean.resize(dims);
+		m_blockMean.fill(0.0);
+		for(size_t i = 0; i < n; i++)
+		{
+			double* pRow = m_block.data() + i * dims;
+			memcpy(pRow, features[start + i].data(), sizeof(double) * m_featureDims);
+			memcpy(pRow + m_featureDims, labels[start + i].data(), sizeof(double) * m_labelDims);
+			for(size_t j = 0; j < dims; j++)
+				m_blockMean[j] += pRow[j];
+		}
+		m_blockMean *= (1.0 / n);
+
+		// Center the block, and compute its co-moments with one matrix multiplication
+		for(size_t i = 0; i < n; i++)
+		{
+			double* pRow = m_block.data() + i * dims;
+			for(size_t j = 0; j < dims; j++)
+				pRow[j] -= m_blockMean[j];
+		}
+		m_blockComoment.resize(dims * dims);
+		m_blockComoment.fill(0.0);
+		GVec::gemm(true, false, dims, dims, n, m_block.data(), dims, m_block.data(), dims, m_blockComoment.data(), dims);
+		merge(n, m_blockMean, m_blockComoment);
+	}
+}
+
+void GLinearStats::merge(const GLinearStats& that)
+{
+	if(that.m_featureDims != m_featureDims || that.m_labelDims != m_labelDims)
+		throw Ex("Mismatching dimensions");
+	merge(that.m_count, that.m_mean, that.m_comoment);
+}
+
+void GLinearStats::merge(size_t count, const GVec& mean, const GVec& comoment)
+{
+	if(count == 0)
+		return;
+	if(m_count == 0)
+	{
+		m_count = count;
+		m_mean.copy(mean);
+		m_comoment.copy(comoment);
+		return;
+	}
+
+	// Combine the co-moments about the two means (Chan et al.), then combine the means
+	size_t dims = m_featureDims + m_labelDims;
+	double total = (double)m_count + (double)count;
+	double scale = (double)m_count * (double)count / total;
+	GVec delta(dims);
+	for(size_t i = 0; i < dims; i++)
+		delta[i] = mean[i] - m_mean[i];
+	for(size_t i = 0; i < dims; i++)
+	{
+		double* pDest = m_comoment.data() + i * dims;
+		const double* pSrc = comoment.data() + i * dims;
+		double s = delta[i] * scale;
+		for(size_t j = 0; j < dims; j++)
+			pDest[j] += pSrc[j] + s * delta[j];
+	}
+	for(size_t i = 0; i < dims; i++)
+		m_mean[i] += delta[i] * ((double)count / total);
+	m_count += count;
+}
+
+void GLinearStats::solve(double ridge, GMatrix& beta, GVec& epsilon) const
+{
+	if(m_count == 0)
+		throw Ex("No rows have been added");
+	size_t fDims = m_featureDims;
+	size_t lDims = m_labelDims;
+
+	// Factor the feature co-moments (plus the ridge term) as L*L^T. Any feature whose
+	// remaining variance is negligible is dependent on earlier features, so it is dropped.
+	GVec l(fDims * fDims);
+	l.fill(0.0);
+	std::vector<bool> dropped(fDims, false);
+	for(size_t j = 0; j < fDims; j++)
+	{
+		double* pRowJ = l.data() + j * fDims;
+		double diag = comoment(j, j) + ridge;
+		double d = diag;
+		for(size_t k = 0; k < j; k++)
+			d -= pRowJ[k] * pRowJ[k];
+		if(diag <= 0.0 || d <= 1e-10 * diag)
+		{
+			dropped[j] = true;
+			continue;
+		}
+		pRowJ[j] = sqrt(d);
+		for(size_t i = j + 1; i < fDims; i++)
+		{
+			double* pRowI = l.data() + i * fDims;
+			double s = comoment(i, j);
+			for(size_t k = 0; k < j; k++)
+				s -= pRowI[k] * pRowJ[k];
+			pRowI[j] = s / pRowJ[j];
+		}
+	}
+
+	// Solve for each label
+	beta.resize(lDims, fDims);
+	epsilon.resize(lDims);
+	GVec y(fDims);
+	for(size_t k = 0; k < lDims; k++)
+	{
+		// Forward substitution
+		for(size_t j = 0; j < fDims; j++)
+		{
+			if(dropped[j])
+			{
+				y[j] = 0.0;
+				continue;
+			}
+			const double* pRowJ = l.data() + j * fDims;
+			double s = comoment(j, fDims + k);
+			for(size_t i = 0; i < j; i++)
+				s -= pRowJ[i] * y[i];
+			y[j] = s / pRowJ[j];
+		}
+
+		// Back substitution
+		GVec& b = beta[k];
+		for(size_t j = fDims; j > 0; j--)
+		{
+			size_t jj = j - 1;
+			if(dropped[jj])
+			{
+				b[jj] = 0.0;
+				continue;
+			}
+			double s = y[jj];
+			for(size_t i = jj + 1; i < fDims; i++)
+				s -= l[i * fDims + jj] * b[i];
+			b[jj] = s / l[jj * fDims + jj];
+		}
+
+		// The intercept makes the fit pass through the means
+		double e = m_mean[fDims + k];
+		for(size_t j = 0; j < fDims; j++)
+			e -= b[j] * m_mean[j];
+		epsilon[k] = e;
+	}
+}
+
+
+
+
+class GLinearRegressorWorker : public GWorkerThread
+{
+protected:
+	GLinearRegressor& m_lr;
+
+public:
+	GLinearRegressorWorker(GMasterThread& master, GLinearRegressor& lr)
+	: GWorkerThread(master), m_lr(lr)
+	{
+	}
+
+	virtual ~GLinearRegressorWorker()
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		m_lr.accumulateChunk(jobId);
+	}
+};
+
+
 GLinearRegressor::GLinearRegressor()
-: GSupervisedLearner(), m_pBeta(NULL)
+: GSupervisedLearner(), m_pBeta(NULL), m_ridge(0.0), m_workerThreads(1), m_chunkRows(4096)
 {
 }
 
 GLinearRegressor::GLinearRegressor(const GDomNode* pNode)
-: GSupervisedLearner(pNode)
+: GSupervisedLearner(pNode), m_ridge(0.0), m_workerThreads(1), m_chunkRows(4096)
 {
 	m_pBeta = new GMatrix(pNode->get("beta"));
 	m_epsilon.deserialize(pNode->get("epsilon"));
@@ -47,6 +262,8 @@ GLinearRegressor::GLinearRegressor(const GDomNode* pNode)
 GLinearRegressor::~GLinearRegressor()
 {
 	clear();
+	for(size_t i = 0; i < m_jobStats.size(); i++)
+		delete(m_jobStats[i]);
 }
 
 // virtual
@@ -149,34 +366,114 @@ void GLinearRegressor::trainInner(const GMatrix& features, const GMatrix& labels
 	if(!labels.relation().areContinuous())
 		throw Ex("GLinearRegressor only supports continuous labels. Perhaps you should wrap it in a GAutoFilter.");
 
-	// Use a fast, but not-very-numerically-stable technique to compute an initial approximation for beta and epsilon
+	if(m_chunkRows < 1)
+		throw Ex("Expected at least one row per chunk");
+
+	// Accumulate the statistics in place, one wave of chunks at a time
+	GLinearStats stats(features.cols(), labels.cols());
+	GMasterThread master;
+	startJobs(master, features.cols(), labels.cols());
+	size_t threads = m_jobStats.size();
+	for(size_t start = 0; start < features.rows(); )
+	{
+		while(m_jobFeatures.size() < threads && start < features.rows())
+		{
+			size_t n = std::min(m_chunkRows, features.rows() - start);
+			m_jobFeatures.push_back(&features);
+			m_jobLabels.push_back(&labels);
+			m_jobStart.push_back(start);
+			m_jobCount.push_back(n);
+			start += n;
+		}
+		accumulateWave(master, stats);
+	}
+	solve(stats);
+}
+
+void GLinearRegressor::train(GDataSource& source)
+{
+	size_t featureDims = source.featureDims();
+	size_t labelDims = source.labelDims();
+	delete(m_pRelFeatures);
+	m_pRelFeatures = new GUniformRelation(featureDims, 0);
+	delete(m_pRelLabels);
+	m_pRelLabels = new GUniformRelation(labelDims, 0);
+	GLinearStats stats(featureDims, labelDims);
+	GMasterThread master;
+	startJobs(master, featureDims, labelDims);
+	size_t threads = m_jobStats.size();
+
+	// Read a wave of chunks, accumulate them in parallel, and repeat until the source is exhausted
+	std::vector<std::unique_ptr<GMatrix> > hFeatures;
+	std::vector<std::unique_ptr<GMatrix> > hLabels;
+	for(size_t i = 0; i < threads; i++)
+	{
+		hFeatures.emplace_back(new GMatrix());
+		hLabels.emplace_back(new GMatrix());
+	}
+	source.rewind();
+	bool more = true;
+	while(more)
+	{
+		while(m_jobFeatures.size() < threads)
+		{
+			GMatrix* pFeatures = hFeatures[m_jobFeatures.size()].get();
+			GMatrix* pLabels = hLabels[m_jobFeatures.size()].get();
+			if(!source.nextChunk(*pFeatures, *pLabels))
+			{
+				more = false;
+				break;
+			}
+			if(pFeatures->cols() != featureDims || pLabels->cols() != labelDims)
+				throw Ex("Expected ", to_str(featureDims), " feature columns and ", to_str(labelDims), " label columns");
+			m_jobFeatures.push_back(pFeatures);
+			m_jobLabels.push_back(pLabels);
+			m_jobStart.push_back(0);
+			m_jobCount.push_back(pFeatures->rows());
+		}
+		if(m_jobFeatures.size() > 0)
+			accumulateWave(master, stats);
+	}
+	solve(stats);
+}
+
+void GLinearRegressor::startJobs(GMasterThread& master, size_t featureDims, size_t labelDims)
+{
+	size_t threads = std::max((size_t)1, m_workerThreads);
+	for(size_t i = 0; i < threads; i++)
+		master.addWorker(new GLinearRegressorWorker(master, *this));
+	for(size_t i = 0; i < m_jobStats.size(); i++)
+		delete(m_jobStats[i]);
+	m_jobStats.clear();
+	for(size_t i = 0; i < threads; i++)
+		m_jobStats.push_back(new GLinearStats(featureDims, labelDims));
+}
+
+void GLinearRegressor::accumulateWave(GMasterThread& master, GLinearStats& stats)
+{
+	for(size_t i = 0; i < m_jobFeatures.size(); i++)
+		m_jobStats[i]->clear();
+	master.doJobs(m_jobFeatures.size());
+
+	// Merge in a fixed order, so the results do not depend on which thread accumulated which chunk
+	for(size_t i = 0; i < m_jobFeatures.size(); i++)
+		stats.merge(*m_jobStats[i]);
+	m_jobFeatures.clear();
+	m_jobLabels.clear();
+	m_jobStart.clear();
+	m_jobCount.clear();
+}
+
+void GLinearRegressor::accumulateChunk(size_t job)
+{
+	m_jobStats[job]->add(*m_jobFeatures[job], *m_jobLabels[job], m_jobStart[job], m_jobCount[job]);
+}
+
+void GLinearRegressor::solve(const GLinearStats& stats)
+{
 	clear();
-	GMatrix* pAll = GMatrix::mergeHoriz(&features, &labels);
-	std::unique_ptr<GMatrix> hAll(pAll);
-	GPCA pca(features.cols());
-	pca.train(*pAll);
-	size_t inputs = features.cols();
-	size_t outputs = labels.cols();
-	GMatrix f(inputs, inputs);
-	GMatrix l(inputs, outputs);
-	for(size_t i = 0; i < inputs; i++)
-	{
-		memcpy(f[i].data(), pca.components()->row(1 + i).data(), sizeof(double) * inputs);
-		double sqmag = f[i].squaredMagnitude();
-		if(sqmag > 1e-10)
-			f[i] *= 1.0 / sqmag;
-		l[i].copy(pca.components()->row(1 + i).data() + inputs, outputs);
-	}
-	m_pBeta = GMatrix::multiply(l, f, true, false);
-	m_epsilon.resize(outputs);
-	GConstVecWrapper vw(pca.centroid().data(), m_pBeta->cols());
-	m_pBeta->multiply(vw, m_epsilon, false);
-	m_epsilon *= -1.0;
-	for(size_t i = 0; i < outputs; i++)
-		m_epsilon[i] += pca.centroid()[inputs + i];
-
-	// Refine the results using gradient descent
-	refine(features, labels, 0.06, 20, 0.75);
+	m_pBeta = new GMatrix();
+	stats.solve(m_ridge, *m_pBeta, m_epsilon);
 }
 
 // virtual
@@ -192,6 +489,33 @@ void GLinearRegressor::predict(const GVec& in, GVec& out)
 	out += m_epsilon;
 }
 
+// virtual
+void GLinearRegressor::predictBatch(const GMatrix& in, GMatrix& out)
+{
+	size_t rows = in.rows();
+	size_t inDims = m_pBeta->cols();
+	size_t outDims = m_pBeta->rows();
+	if(in.cols() != inDims)
+		throw Ex("Expected ", to_str(inDims), " columns. Got ", to_str(in.cols()));
+
+	// Pack the rows and the weights into contiguous buffers
+	GVec a(rows * inDims);
+	for(size_t i = 0; i < rows; i++)
+		memcpy(a.data() + i * inDims, in[i].data(), sizeof(double) * inDims);
+	GVec b(outDims * inDims);
+	for(size_t i = 0; i < outDims; i++)
+		memcpy(b.data() + i * inDims, m_pBeta->row(i).data(), sizeof(double) * inDims);
+	GVec c(rows * outDims);
+	for(size_t i = 0; i < rows; i++)
+		memcpy(c.data() + i * outDims, m_epsilon.data(), sizeof(double) * outDims);
+
+	// out = in * beta^T + epsilon
+	GVec::gemm(false, true, rows, outDims, inDims, a.data(), inDims, b.data(), inDims, c.data(), outDims);
+	out.resize(rows, outDims);
+	for(size_t i = 0; i < rows; i++)
+		memcpy(out[i].data(), c.data() + i * outDims, sizeof(double) * outDims);
+}
+
 // virtual
 void GLinearRegressor::clear()
 {
@@ -246,6 +570,104 @@ void GLinearRegressor_linear_test(GRand& prng)
 	double rmse = sqrt(lr.sumSquaredError(features2, labels2) / features2.rows());
 	if(rmse > 0.0224)
 		throw Ex("failed");
+
+	// Predicting a batch should give the same results as predicting one row at a time
+	GMatrix batch;
+	lr.predictBatch(features2, batch);
+	GVec pred(1);
+	for(size_t i = 0; i < features2.rows(); i++)
+	{
+		lr.predict(features2[i], pred);
+		if(std::abs(batch[i][0] - pred[0]) > 1e-12)
+			throw Ex("failed");
+	}
+}
+
+void GLinearRegressor_solver_test(GRand& prng)
+{
+	// Make data with large offsets, a constant column, and a column that duplicates another one
+	GMatrix features(0, 5);
+	GMatrix labels(0, 2);
+	for(size_t i = 0; i < 3000; i++)
+	{
+		GVec& f = features.newRow();
+		f[0] = 1e6 + prng.normal();
+		f[1] = prng.normal();
+		f[2] = 7.0;
+		f[3] = f[1];
+		f[4] = prng.normal() * 1e-3;
+		GVec& l = labels.newRow();
+		l[0] = 2.0 * f[0] - 3.0 * f[1] + 500.0 * f[4] + 1.0 + 0.01 * prng.normal();
+		l[1] = -f[0] + 4.0;
+	}
+
+	// Training with any number of threads should give exactly the same model
+	GLinearRegressor lr1;
+	lr1.setChunkRows(250);
+	lr1.train(features, labels);
+	GLinearRegressor lr3;
+	lr3.setChunkRows(250);
+	lr3.setWorkerThreads(3);
+	lr3.train(features, labels);
+	for(size_t i = 0; i < 2; i++)
+	{
+		for(size_t j = 0; j < 5; j++)
+		{
+			if(lr1.beta()->row(i)[j] != lr3.beta()->row(i)[j])
+				throw Ex("The number of threads affected the results");
+		}
+		if(lr1.epsilon()[i] != lr3.epsilon()[i])
+			throw Ex("The number of threads affected the results");
+	}
+
+	// Check the fit
+	GMatrix* pBeta = lr1.beta();
+	if(std::abs(pBeta->row(0)[0] - 2.0) > 1e-3 || std::abs(pBeta->row(0)[1] + pBeta->row(0)[3] + 3.0) > 1e-3 || std::abs(pBeta->row(0)[4] - 500.0) > 1.0)
+		throw Ex("failed");
+	if(std::abs(pBeta->row(1)[0] + 1.0) > 1e-9 || std::abs(lr1.epsilon()[1] + 7.0 * pBeta->row(1)[2] - 4.0) > 1e-3)
+		throw Ex("failed");
+	double rmse = sqrt(lr1.sumSquaredError(features, labels) / features.rows());
+	if(rmse > 0.02)
+		throw Ex("failed");
+
+	// Training from a data source should give the same model
+	GMatrixDataSource source(features, labels, 250);
+	GLinearRegressor lrs;
+	lrs.setWorkerThreads(2);
+	lrs.train(source);
+	for(size_t i = 0; i < 2; i++)
+	{
+		for(size_t j = 0; j < 5; j++)
+		{
+			if(lrs.beta()->row(i)[j] != pBeta->row(i)[j])
+				throw Ex("Training from a data source gave different results");
+		}
+	}
+
+	// Compare a ridge fit with its closed form in one dimension
+	GMatrix f1(0, 1);
+	GMatrix l1(0, 1);
+	for(size_t i = 0; i < 200; i++)
+	{
+		double x = prng.normal();
+		f1.newRow()[0] = x;
+		l1.newRow()[0] = 3.0 * x + prng.normal();
+	}
+	double mx = f1.columnMean(0);
+	double my = l1.columnMean(0);
+	double sxx = 0.0;
+	double sxy = 0.0;
+	for(size_t i = 0; i < f1.rows(); i++)
+	{
+		sxx += (f1[i][0] - mx) * (f1[i][0] - mx);
+		sxy += (f1[i][0] - mx) * (l1[i][0] - my);
+	}
+	GLinearRegressor lrr;
+	lrr.setRidge(50.0);
+	lrr.train(f1, l1);
+	double b = sxy / (sxx + 50.0);
+	if(std::abs(lrr.beta()->row(0)[0] - b) > 1e-9 || std::abs(lrr.epsilon()[0] - (my - b * mx)) > 1e-9)
+		throw Ex("ridge regression failed");
 }
 
 // static
@@ -253,6 +675,7 @@ void GLinearRegressor::test()
 {
 	GRand prng(0);
 	GLinearRegressor_linear_test(prng);
+	GLinearRegressor_solver_test(prng);
 	GAutoFilter af(new GLinearRegressor ());
 	af.basicTest(0.76, 0.93);
 }
@@ -25,18 +25,87 @@
 namespace GClasses {
 
 class GPCA;
+class GDataSource;
+class GMasterThread;
+class GLinearRegressorWorker;
+
+
+/// The sufficient statistics for a least-squares linear fit: the number of rows, the mean of each
+/// feature and label column, and the matrix of centered cross products (co-moments) of those columns.
+/// Rows are absorbed one block at a time, so the data does not need to be held in memory. Statistics of
+/// disjoint sets of rows can be merged exactly, so separate threads can each accumulate part of the data.
+/// (Centering each block about its own mean before it is merged keeps the results accurate even when
+/// the columns have large offsets.)
+class GLinearStats
+{
+protected:
+	size_t m_featureDims;
+	size_t m_labelDims;
+	size_t m_count;
+	GVec m_mean; // The features, followed by the labels
+	GVec m_comoment; // A symmetric matrix, stored in row-major order
+	GVec m_block;
+	GVec m_blockMean;
+	GVec m_blockComoment;
+
+public:
+	GLinearStats(size_t featureDims, size_t labelDims);
+	~GLinearStats();
+
+	/// Forgets all the rows that have been added.
+	void clear();
+
+	/// Adds rowCount rows, starting with rowStart, to these statistics. (The data is not copied.)
+	void add(const GMatrix& features, const GMatrix& labels, size_t rowStart = 0, size_t rowCount = INVALID_INDEX);
+
+	/// Adds all the rows summarized by that to these statistics. that must have the same dimensions.
+	void merge(const GLinearStats& that);
+
+	/// Returns the number of rows that have been added.
+	size_t count() const { return m_count; }
+
+	/// Returns the mean of the feature columns, followed by the mean of the label columns.
+	const GVec& mean() const { return m_mean; }
+
+	/// Returns the sum over all rows of (x_i - mean_i) * (x_j - mean_j), where x is a feature vector
+	/// followed by its label vector. (i and j index into that concatenated vector.)
+	double comoment(size_t i, size_t j) const;
+
+	/// Finds beta and epsilon that minimize the sum-squared error of the fit, plus ridge times the
+	/// sum of the squared elements of beta. (epsilon is not penalized.) beta is resized to labelDims rows
+	/// and featureDims columns, and epsilon is resized to labelDims. This uses a Cholesky factorization of the
+	/// feature co-moments. Features that are linear combinations of earlier ones (such as constant columns,
+	/// or the last column of a one-hot encoding) are detected during the factorization and given weights of zero.
+	void solve(double ridge, GMatrix& beta, GVec& epsilon) const;
+
+protected:
+	/// Merges the statistics of count rows with the specified mean and co-moments into these statistics.
+	void merge(size_t count, const GVec& mean, const GVec& comoment);
+};
+
 
 /// A linear regression model. Let f be a feature vector of real values, and let l be a label vector of real values,
 /// then this model estimates l=Bf+e, where B is a matrix of real values, and e is a
 /// vector of real values. (In the Wikipedia article on linear regression, B is called
-/// "beta", and e is called "epsilon". The approach used by this model to compute
-/// beta and epsilon, however, is much more efficient than the approach currently
-/// described in that article.)
+/// "beta", and e is called "epsilon".) Training accumulates the sufficient statistics of the data
+/// in a single pass (see GLinearStats), split across worker threads, and then solves for the least-squares
+/// beta and epsilon directly, with optional ridge regularization.
 class GLinearRegressor : public GSupervisedLearner
 {
+friend class GLinearRegressorWorker;
 protected:
 	GMatrix* m_pBeta;
 	GVec m_epsilon;
+	double m_ridge;
+	size_t m_workerThreads;
+	size_t m_chunkRows;
+
+	// The wave of chunks that the workers are currently accumulating
+	std::vector<const GMatrix*> m_jobFeatures;
+	std::vector<const GMatrix*> m_jobLabels;
+	std::vector<size_t> m_jobStart;
+	std::vector<size_t> m_jobCount;
+	std::vector<GLinearStats*> m_jobStats;
 
 public:
 	GLinearRegressor();
@@ -63,6 +132,27 @@ public:
 	/// Returns the vector that is added to the results after the linear transformation is applied.
 	GVec& epsilon() { return m_epsilon; }
 
+	/// Specify the ridge (L2) regularization term. The sum of the squared elements of beta, times this value,
+	/// is added to the sum-squared error that training minimizes. The default is 0.
+	void setRidge(double d) { m_ridge = d; }
+
+	/// Returns the ridge regularization term.
+	double ridge() const { return m_ridge; }
+
+	/// Specify the number of worker threads to use for training. The default is 1.
+	/// (The results do not depend on the number of threads.)
+	void setWorkerThreads(size_t n) { m_workerThreads = n; }
+
+	/// Specify the number of rows in each chunk that a worker accumulates. The default is 4096.
+	void setChunkRows(size_t n) { m_chunkRows = n; }
+
+	/// Trains from a source of data, one chunk at a time, in a single pass. Only the accumulated
+	/// statistics are held in memory, so the data may be much bigger than memory. All of the
+	/// columns are assumed to be continuous.
+	void train(GDataSource& source);
+
+	using GSupervisedLearner::train;
+
 	/// Performs on-line gradient descent to refine the model
 	void refine(const GMatrix& features, const GMatrix& labels, double learningRate, size_t epochs, double learningRateDecayFactor);
 
@@ -72,6 +162,9 @@ public:
 	/// See the comment for GSupervisedLearner::predict
 	virtual void predict(const GVec& pIn, GVec& pOut);
 
+	/// Computes all of the predictions with one blocked matrix multiplication.
+	virtual void predictBatch(const GMatrix& in, GMatrix& out);
+
 	/// See the comment for GSupervisedLearner::predictDistribution
 	virtual void predictDistribution(const GVec& pIn, GPrediction* pOut);
 
@@ -87,6 +180,18 @@ protected:
 
 	/// See the comment for GTransducer::canImplicitlyHandleMissingFeatures
 	virtual bool canImplicitlyHandleMissingFeatures() { return false; }
+
+	/// Allocates the master thread and workers, and a set of statistics for each concurrent job.
+	void startJobs(GMasterThread& master, size_t featureDims, size_t labelDims);
+
+	/// Accumulates the chunks that have been set up in the job vectors, then merges them into stats in order.
+	void accumulateWave(GMasterThread& master, GLinearStats& stats);
+
+	/// Accumulates one of the chunks in the current wave.
+	void accumulateChunk(size_t job);
+
+	/// Solves for beta and epsilon from the accumulated statistics.
+	void solve(const GLinearStats& stats);
 };
 
 
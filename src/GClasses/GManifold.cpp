@@ -34,6 +34,8 @@
 #include "GSparseMatrix.h"
 #include "GTime.h"
 #include "GTransform.h"
+#include "GTruncatedSVD.h"
+#include "GThread.h"
 #include "GDom.h"
 #include "GVec.h"
 #include "GHolders.h"
@@ -409,7 +411,7 @@ struct GManifoldSculptingStuff
 };
 
 GManifoldSculpting::GManifoldSculpting(size_t nNeighbors, size_t targetDims, GRand* pRand)
-: m_pRand(pRand), m_pNF(NULL)
+: m_pRand(pRand), m_pNF(NULL), m_workerThreads(1), m_pMaster(NULL), m_trackProgress(false), m_startTime(0.0), m_jobStage(0), m_jobSeed(INVALID_INDEX), m_passSeed(0)
 {
 	m_pMetaData = NULL;
 	m_nDimensions = 0;
@@ -431,10 +433,21 @@ GManifoldSculpting::GManifoldSculpting(size_t nNeighbors, size_t targetDims, GRa
 
 GManifoldSculpting::~GManifoldSculpting()
 {
+	delete(m_pMaster);
 	delete(m_pData);
 	delete[] m_pMetaData;
 }
 
+void GManifoldSculpting::setWorkerThreads(size_t n)
+{
+	if(n != m_workerThreads)
+	{
+		delete(m_pMaster);
+		m_pMaster = NULL;
+	}
+	m_workerThreads = n;
+}
+
 void GManifoldSculpting::setPreprocessedData(GMatrix* pData)
 {
 	delete(m_pData);
@@ -534,6 +547,10 @@ void GManifoldSculpting::beginTransform(const GMatrix* pRealSpaceData)
 	m_nDimensions = m_pData->relation().size();
 	m_nPass = 0;
 	m_scale = 1.0;
+	m_conflictStart.clear();
+	m_conflicts.clear();
+	m_progress.resize(0, 3);
+	m_startTime = GTime::seconds();
 	for(size_t i = 0; i < m_pData->rows(); i++)
 	{
 		struct GManifoldSculptingNeighbor* pArrNeighbors = record(i);
@@ -789,13 +806,13 @@ double GManifoldSculpting::computeError(size_t nPoint)
 	return dError + supervisedError(nPoint);
 }
 
-size_t GManifoldSculpting::adjustDataPoint(size_t nPoint, double* pError)
+size_t GManifoldSculpting::adjustDataPoint(size_t nPoint, double* pError, GRand& rand)
 {
 	bool bMadeProgress = true;
 	double* pValues = m_pData->row(nPoint).data();
 	double dErrorBase = computeError(nPoint);
 	double dError = 0;
-	double dStepSize = m_dLearningRate * (m_pRand->uniform() * .4 + .6); // We multiply the learning rate by a random value so that the points can get away from each other
+	double dStepSize = m_dLearningRate * (rand.uniform() * .4 + .6); // We multiply the learning rate by a random value so that the points can get away from each other
 	size_t nSteps;
 	for(nSteps = 0; bMadeProgress && nSteps < 30; nSteps++)
 	{
@@ -838,7 +855,6 @@ double GManifoldSculpting::squishPass(size_t nSeedDataPoint)
 	if(!m_pMetaData)
 		throw Ex("You must call BeginTransform before calling this method");
 	struct GManifoldSculptingNeighbor* pPoint;
-	struct GManifoldSculptingStuff* pStuff;
 
 	// Squish the extra dimensions
 	if(m_scale > 0.001)
@@ -863,36 +879,48 @@ double GManifoldSculpting::squishPass(size_t nSeedDataPoint)
 	}
 
 	// Start at the seed point and correct outward in a breadth-first mannner
+	size_t n = m_pData->rows();
+	m_order.clear();
+	GBitTable visited(n);
 	m_q.push_back(nSeedDataPoint);
-	size_t nVisitedNodes = 0;
-	size_t nSteps = 0;
-	double dError = 0;
-	double dTotalError = 0;
 	while(m_q.size() > 0)
 	{
-		// Check if this one has already been done
+		// Check if this one has already been found
 		size_t nPoint = m_q.front();
 		m_q.pop_front();
-		pPoint = record(nPoint);
-		pStuff = stuff(nPoint);
-		if(pStuff->m_nCycle == m_nPass)
+		if(visited.bit(nPoint))
 			continue;
-		pStuff->m_nCycle = m_nPass;
-		nVisitedNodes++;
+		visited.set(nPoint);
+		m_order.push_back(nPoint);
 
 		// Push all neighbors into the queue
-		for(size_t n = 0; n < m_nNeighbors; n++)
+		pPoint = record(nPoint);
+		for(size_t i = 0; i < m_nNeighbors; i++)
 		{
-			if(pPoint[n].m_nNeighbor < m_pData->rows())
-				m_q.push_back(pPoint[n].m_nNeighbor);
+			if(pPoint[i].m_nNeighbor < n)
+				m_q.push_back(pPoint[i].m_nNeighbor);
 		}
+	}
 
-		// Adjust this data point
-		if(pStuff->m_bAdjustable && nPoint != nSeedDataPoint)
-		{
-			nSteps += adjustDataPoint(nPoint, &dError);
-			dTotalError += dError;
-		}
+	// Adjust the points in that order. (Each point draws its step size from its own generator,
+	// so the results are the same whether or not the points are adjusted in parallel.)
+	m_pointSteps.resize(n);
+	m_pointErrors.resize(n);
+	m_jobSeed = nSeedDataPoint;
+	m_passSeed = m_pRand->next();
+	if(m_workerThreads > 1)
+		parallelPass();
+	else
+	{
+		for(size_t i = 0; i < m_order.size(); i++)
+			adjustPoint(m_order[i]);
+	}
+	size_t nSteps = 0;
+	double dTotalError = 0;
+	for(size_t i = 0; i < m_order.size(); i++)
+	{
+		nSteps += m_pointSteps[m_order[i]];
+		dTotalError += m_pointErrors[m_order[i]];
 	}
 	if(nSteps < m_pData->rows())
 		m_dLearningRate *= .87;
@@ -903,21 +931,248 @@ double GManifoldSculpting::squishPass(size_t nSeedDataPoint)
 	if(m_nPass % 20 == 0)
 		moveMeanToOrigin();
 
+	if(m_trackProgress)
+	{
+		GVec& row = m_progress.newRow();
+		row[0] = (double)m_nPass;
+		row[1] = stress();
+		row[2] = GTime::seconds() - m_startTime;
+	}
 	m_nPass++;
 	return dTotalError;
 }
 
+double GManifoldSculpting::stress()
+{
+	double squaredScale = m_scale * m_scale;
+	double sse = 0.0;
+	double sst = 0.0;
+	for(size_t i = 0; i < m_pData->rows(); i++)
+	{
+		struct GManifoldSculptingNeighbor* pPoint = record(i);
+		for(size_t j = 0; j < m_nNeighbors; j++)
+		{
+			size_t neighbor = pPoint[j].m_nNeighbor;
+			if(neighbor < m_pData->rows())
+			{
+				double dist = sqrt(GMS_sqDist(m_pData->row(i).data(), m_pData->row(neighbor).data(), m_nTargetDims) + squaredScale * pPoint[j].m_junkSquaredDist);
+				double d = dist - pPoint[j].m_dDistance;
+				sse += d * d;
+				sst += pPoint[j].m_dDistance * pPoint[j].m_dDistance;
+			}
+		}
+	}
+	return sst > 0.0 ? sse / sst : 0.0;
+}
 
+void GManifoldSculpting_makeSheet(GMatrix& data, GRand& rand)
+{
+	// Sample points from a rolled-up sheet
+	for(size_t i = 0; i < data.rows(); i++)
+	{
+		double t = rand.uniform() * M_PI;
+		double h = rand.uniform() * 3.0;
+		data[i][0] = 2.0 * cos(t);
+		data[i][1] = 2.0 * sin(t);
+		data[i][2] = h;
+	}
+}
 
+// static
+void GManifoldSculpting::test()
+{
+	GRand rand(0);
+	GMatrix data(300, 3);
+	GManifoldSculpting_makeSheet(data, rand);
 
+	// The passes should restore the local distances
+	{
+		GRand r(1);
+		GManifoldSculpting ms(10, 2, &r);
+		ms.setSquishingRate(0.9);
+		ms.trackProgress();
+		ms.beginTransform(&data);
+		for(size_t pass = 0; pass < 200; pass++)
+			ms.squishPass((size_t)r.next(data.rows()));
+		if(ms.progress().rows() != 200)
+			throw Ex("wrong number of progress rows");
+		if(ms.progress()[199][1] > 0.002)
+			throw Ex("too much stress");
+	}
 
+	// The results should not depend on the number of threads
+	GMatrix* pResults[2];
+	for(size_t i = 0; i < 2; i++)
+	{
+		GRand r(1);
+		GManifoldSculpting ms(10, 2, &r);
+		ms.setWorkerThreads(i == 0 ? 1 : 3);
+		ms.setSquishingRate(0.9);
+		ms.beginTransform(&data);
+		for(size_t pass = 0; pass < 5; pass++)
+			ms.squishPass((size_t)r.next(data.rows()));
+		pResults[i] = new GMatrix(ms.data());
+	}
+	std::unique_ptr<GMatrix> hA(pResults[0]);
+	std::unique_ptr<GMatrix> hB(pResults[1]);
+	if(pResults[0]->sumSquaredDifference(*pResults[1]) != 0.0)
+		throw Ex("The results depend on the number of threads");
+}
 
-GIsomap::GIsomap(size_t neighborCount, size_t targetDims, GRand* pRand) : m_neighborCount(neighborCount), m_targetDims(targetDims), m_pNF(NULL), m_pRand(pRand), m_dropDisconnectedPoints(false)
+void GManifoldSculpting::findConflicts()
+{
+	// Each point reads the locations of its neighbors, and of the neighbor of each neighbor that is used
+	// to measure the angle. Two points conflict if either one reads the other.
+	size_t n = m_pData->rows();
+	std::vector<size_t> degree(n, 0);
+	for(int phase = 0; phase < 2; phase++)
+	{
+		for(size_t i = 0; i < n; i++)
+		{
+			struct GManifoldSculptingNeighbor* pPoint = record(i);
+			for(size_t j = 0; j < m_nNeighbors; j++)
+			{
+				size_t neighbor = pPoint[j].m_nNeighbor;
+				if(neighbor >= n)
+					continue;
+				size_t reads[2];
+				reads[0] = neighbor;
+				reads[1] = INVALID_INDEX;
+				size_t slot = pPoint[j].m_nNeighborsNeighborSlot;
+				if(slot < m_nNeighbors)
+					reads[1] = record(neighbor)[slot].m_nNeighbor;
+				for(size_t k = 0; k < 2; k++)
+				{
+					size_t other = reads[k];
+					if(other >= n || other == i)
+						continue;
+					if(phase == 0)
+					{
+						degree[i]++;
+						degree[other]++;
+					}
+					else
+					{
+						m_conflicts[m_conflictStart[i] + --degree[i]] = other;
+						m_conflicts[m_conflictStart[other] + --degree[other]] = i;
+					}
+				}
+			}
+		}
+		if(phase == 0)
+		{
+			m_conflictStart.resize(n + 1);
+			m_conflictStart[0] = 0;
+			for(size_t i = 0; i < n; i++)
+				m_conflictStart[i + 1] = m_conflictStart[i] + degree[i];
+			m_conflicts.resize(m_conflictStart[n]);
+		}
+	}
+}
+
+class GManifoldSculptingWorker : public GWorkerThread
+{
+protected:
+	GManifoldSculpting& m_ms;
+
+public:
+	GManifoldSculptingWorker(GMasterThread& master, GManifoldSculpting& ms)
+	: GWorkerThread(master), m_ms(ms)
+	{
+	}
+
+	virtual ~GManifoldSculptingWorker()
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		m_ms.doJob(jobId);
+	}
+};
+
+#define MS_STAGE_BLOCK 16
+
+void GManifoldSculpting::parallelPass()
+{
+	// Put each point in the stage after the last stage of any conflicting point that comes before it in the
+	// breadth-first order. Conflicting points are then adjusted in the same order as they would be sequentially,
+	// and the points within a stage can be adjusted concurrently.
+	size_t n = m_pData->rows();
+	if(m_conflictStart.size() != n + 1)
+		findConflicts();
+	std::vector<size_t> stage(n, INVALID_INDEX);
+	size_t stageCount = 0;
+	for(size_t i = 0; i < m_order.size(); i++)
+	{
+		size_t nPoint = m_order[i];
+		size_t s = 0;
+		for(size_t j = m_conflictStart[nPoint]; j < m_conflictStart[nPoint + 1]; j++)
+		{
+			size_t other = stage[m_conflicts[j]];
+			if(other != INVALID_INDEX)
+				s = std::max(s, other + 1);
+		}
+		stage[nPoint] = s;
+		stageCount = std::max(stageCount, s + 1);
+	}
+	m_stageStart.assign(stageCount + 1, 0);
+	for(size_t i = 0; i < m_order.size(); i++)
+		m_stageStart[stage[m_order[i]] + 1]++;
+	for(size_t i = 0; i < stageCount; i++)
+		m_stageStart[i + 1] += m_stageStart[i];
+	m_stageOrder.resize(m_order.size());
+	std::vector<size_t> pos(m_stageStart.begin(), m_stageStart.end() - 1);
+	for(size_t i = 0; i < m_order.size(); i++)
+		m_stageOrder[pos[stage[m_order[i]]]++] = m_order[i];
+
+	// Adjust the points one stage at a time
+	if(!m_pMaster)
+	{
+		m_pMaster = new GMasterThread();
+		for(size_t i = 0; i < m_workerThreads; i++)
+			m_pMaster->addWorker(new GManifoldSculptingWorker(*m_pMaster, *this));
+	}
+	for(m_jobStage = 0; m_jobStage < stageCount; m_jobStage++)
+	{
+		size_t count = m_stageStart[m_jobStage + 1] - m_stageStart[m_jobStage];
+		m_pMaster->doJobs((count + MS_STAGE_BLOCK - 1) / MS_STAGE_BLOCK);
+	}
+}
+
+void GManifoldSculpting::doJob(size_t job)
+{
+	size_t start = m_stageStart[m_jobStage] + job * MS_STAGE_BLOCK;
+	size_t end = std::min(m_stageStart[m_jobStage + 1], start + MS_STAGE_BLOCK);
+	for(size_t i = start; i < end; i++)
+		adjustPoint(m_stageOrder[i]);
+}
+
+void GManifoldSculpting::adjustPoint(size_t nPoint)
+{
+	struct GManifoldSculptingStuff* pStuff = stuff(nPoint);
+	pStuff->m_nCycle = m_nPass;
+	m_pointSteps[nPoint] = 0;
+	m_pointErrors[nPoint] = 0.0;
+	if(pStuff->m_bAdjustable && nPoint != m_jobSeed)
+	{
+		GRand rand(m_passSeed + nPoint * 0x9E3779B97F4A7C15ull);
+		m_pointSteps[nPoint] = adjustDataPoint(nPoint, &m_pointErrors[nPoint], rand);
+	}
+}
+
+
+
+
+
+
+GIsomap::GIsomap(size_t neighborCount, size_t targetDims, GRand* pRand)
+: m_neighborCount(neighborCount), m_targetDims(targetDims), m_pNF(NULL), m_pRand(pRand), m_dropDisconnectedPoints(false), m_landmarks(0), m_workerThreads(1), m_pExtendNF(NULL)
 {
 }
 
 GIsomap::GIsomap(GDomNode* pNode)
-: GTransform(pNode)
+: GTransform(pNode), m_neighborCount(0), m_pNF(NULL), m_pRand(NULL), m_dropDisconnectedPoints(false), m_landmarks(0), m_workerThreads(1), m_pExtendNF(NULL)
 {
 	m_targetDims = (size_t)pNode->getInt("targetDims");
 }
@@ -925,6 +1180,7 @@ GIsomap::GIsomap(GDomNode* pNode)
 // virtual
 GIsomap::~GIsomap()
 {
+	delete(m_pExtendNF);
 }
 
 GDomNode* GIsomap::serialize(GDom* pDoc) const
@@ -949,9 +1205,12 @@ GMatrix* GIsomap::reduce(const GMatrix& in)
 		pNF = new GKdTree(&in, NULL, true);
 		hNF.reset(pNF);
 	}
+	if(m_landmarks > 0)
+		return reduceWithLandmarks(in, pNF);
 
-	// Compute the distance matrix using the Floyd Warshall algorithm
-	GFloydWarshall graph(in.rows());
+	// Compute the distance between every pair of points with Dijkstra's algorithm on the sparse neighbor graph
+	GMultiSourceDijkstra graph(in.rows());
+	graph.setWorkerThreads(m_workerThreads);
 	for(size_t i = 0; i < in.rows(); i++)
 	{
 		size_t nc = pNF->findNearest(m_neighborCount, i);
@@ -961,46 +1220,275 @@ GMatrix* GIsomap::reduce(const GMatrix& in)
 			graph.addDirectedEdge(i, pNF->neighbor(j), d);
 		}
 	}
-	graph.compute();
-	if(!graph.isConnected())
+	std::vector<size_t> origins;
+	for(size_t i = 0; i < in.rows(); i++)
+		origins.push_back(i);
+	GMatrix costs;
+	graph.compute(origins, costs);
+	GMatrix* pCM = &costs;
+	size_t c = pCM->cols();
+	while(true)
 	{
-		if(!m_dropDisconnectedPoints)
-			throw Ex("The local neighborhoods do not form a connected graph. Increasing the neighbor count may be a good solution. Another solution is to specify to dropDisconnectedPoints.");
-		GMatrix* pCM = graph.costMatrix();
-		size_t c = pCM->cols();
-		while(true)
+		size_t worstRow = 0;
+		size_t missing_count = 0;
+		for(size_t i = 0; i < pCM->rows(); i++)
 		{
-			size_t worstRow = 0;
-			size_t missing_count = 0;
-			for(size_t i = 0; i < pCM->rows(); i++)
+			double* pRow = pCM->row(i).data();
+			size_t count = 0;
+			for(size_t j = 0; j < c; j++)
 			{
-				double* pRow = pCM->row(i).data();
-				size_t count = 0;
-				for(size_t j = 0; j < c; j++)
-				{
-					if(*(pRow++) >= 1e200)
-						count++;
-				}
-				if(count > missing_count)
-				{
-					missing_count = count;
-					worstRow = i;
-				}
+				if(*(pRow++) >= 1e200)
+					count++;
 			}
-			if(missing_count > 0)
+			if(count > missing_count)
 			{
-				pCM->deleteRow(worstRow);
-				pCM->deleteColumns(worstRow, 1);
+				missing_count = count;
+				worstRow = i;
 			}
-			else
-				break;
 		}
+		if(missing_count > 0)
+		{
+			if(!m_dropDisconnectedPoints)
+				throw Ex("The local neighborhoods do not form a connected graph. Increasing the neighbor count may be a good solution. Another solution is to specify to dropDisconnectedPoints.");
+			pCM->deleteRow(worstRow);
+			pCM->deleteColumns(worstRow, 1);
+			c--;
+		}
+		else
+			break;
 	}
 
 	// Do classic MDS on the distance matrix
-	return GManifold::multiDimensionalScaling(graph.costMatrix(), m_targetDims, m_pRand, false);
+	return GManifold::multiDimensionalScaling(pCM, m_targetDims, m_pRand, false);
+}
+
+GMatrix* GIsomap::reduceWithLandmarks(const GMatrix& in, GNeighborFinder* pNF)
+{
+	// Build the symmetric neighbor graph, and find its connected components
+	size_t n = in.rows();
+	GMultiSourceDijkstra graph(n);
+	graph.setWorkerThreads(m_workerThreads);
+	std::vector<size_t> component(n);
+	for(size_t i = 0; i < n; i++)
+		component[i] = i;
+	for(size_t i = 0; i < n; i++)
+	{
+		size_t nc = pNF->findNearest(m_neighborCount, i);
+		for(size_t j = 0; j < nc; j++)
+		{
+			size_t neigh = pNF->neighbor(j);
+			double d = sqrt(pNF->distance(j));
+			graph.addDirectedEdge(i, neigh, d);
+			graph.addDirectedEdge(neigh, i, d);
+
+			// Union the two components
+			size_t a = i;
+			while(component[a] != a)
+				a = component[a] = component[component[a]];
+			size_t b = neigh;
+			while(component[b] != b)
+				b = component[b] = component[component[b]];
+			if(a != b)
+				component[std::max(a, b)] = std::min(a, b);
+		}
+	}
+	std::vector<size_t> componentSize(n, 0);
+	for(size_t i = 0; i < n; i++)
+	{
+		size_t a = i;
+		while(component[a] != a)
+			a = component[a];
+		component[i] = a;
+		componentSize[a]++;
+	}
+	size_t biggest = std::max_element(componentSize.begin(), componentSize.end()) - componentSize.begin();
+	std::vector<size_t> kept;
+	for(size_t i = 0; i < n; i++)
+	{
+		if(component[i] == biggest)
+			kept.push_back(i);
+	}
+	if(kept.size() < n && !m_dropDisconnectedPoints)
+		throw Ex("The local neighborhoods do not form a connected graph. Increasing the neighbor count may be a good solution. Another solution is to specify to dropDisconnectedPoints.");
+
+	// Pick the landmarks from the connected points, and compute the geodesic distances from each landmark
+	size_t landmarkCount = std::min(m_landmarks, kept.size());
+	if(landmarkCount <= m_targetDims)
+		throw Ex("Expected more landmarks than target dims");
+	std::vector<size_t> landmarks(kept);
+	for(size_t i = 0; i < landmarkCount; i++)
+	{
+		size_t j = i + (m_pRand ? (size_t)m_pRand->next(landmarks.size() - i) : 0);
+		std::swap(landmarks[i], landmarks[j]);
+	}
+	landmarks.resize(landmarkCount);
+	graph.compute(landmarks, m_landmarkCosts);
+
+	// Do classic MDS on the squared distances between the landmarks
+	GMatrix b(landmarkCount, landmarkCount);
+	for(size_t i = 0; i < landmarkCount; i++)
+	{
+		b[i][i] = 0.0;
+		for(size_t j = i + 1; j < landmarkCount; j++)
+		{
+			double d = 0.5 * (m_landmarkCosts[i][landmarks[j]] + m_landmarkCosts[j][landmarks[i]]);
+			b[i][j] = d * d;
+			b[j][i] = d * d;
+		}
+	}
+	m_meanSquaredCosts.resize(landmarkCount);
+	for(size_t i = 0; i < landmarkCount; i++)
+		m_meanSquaredCosts[i] = b[i].sum() / landmarkCount;
+	double grandMean = m_meanSquaredCosts.sum() / landmarkCount;
+	for(size_t i = 0; i < landmarkCount; i++)
+	{
+		GVec& row = b[i];
+		for(size_t j = 0; j < landmarkCount; j++)
+			row[j] = -0.5 * (row[j] - m_meanSquaredCosts[i] - m_meanSquaredCosts[j] + grandMean);
+	}
+	GVec eigenVals(m_targetDims);
+	GRand tmpRand(0);
+	GMatrix* pEigs = b.eigs(m_targetDims, eigenVals, m_pRand ? m_pRand : &tmpRand, true);
+	std::unique_ptr<GMatrix> hEigs(pEigs);
+
+	// Each point is placed at -0.5 * pinv(L) * (squared distances from the landmarks - mean squared distances)
+	m_landmarkMap.resize(m_targetDims, landmarkCount);
+	for(size_t i = 0; i < m_targetDims; i++)
+	{
+		if(eigenVals[i] > 0.0)
+		{
+			m_landmarkMap[i].copy(pEigs->row(i));
+			m_landmarkMap[i] *= (-0.5 / std::sqrt(eigenVals[i]));
+		}
+		else
+			m_landmarkMap[i].fill(0.0, 0, landmarkCount);
+	}
+	GMatrix* pOut = new GMatrix(kept.size(), m_targetDims);
+	GVec sq(landmarkCount);
+	for(size_t i = 0; i < kept.size(); i++)
+	{
+		for(size_t j = 0; j < landmarkCount; j++)
+		{
+			double d = m_landmarkCosts[j][kept[i]];
+			sq[j] = d * d;
+		}
+		triangulate(sq, pOut->row(i));
+	}
+
+	// Remember the training data for out-of-sample extension
+	delete(m_pExtendNF);
+	m_pExtendNF = NULL;
+	m_trainData.copy(in);
+	return pOut;
+}
+
+void GIsomap::triangulate(const GVec& squaredCosts, GVec& out)
+{
+	for(size_t i = 0; i < m_targetDims; i++)
+	{
+		const GVec& row = m_landmarkMap[i];
+		double sum = 0.0;
+		for(size_t j = 0; j < row.size(); j++)
+			sum += row[j] * (squaredCosts[j] - m_meanSquaredCosts[j]);
+		out[i] = sum;
+	}
+}
+
+void GIsomap::extend(const GVec& in, GVec& out)
+{
+	if(m_landmarkMap.rows() == 0)
+		throw Ex("reduce must be called with landmarks before points can be extended");
+	if(!m_pExtendNF)
+		m_pExtendNF = new GKdTree(&m_trainData, NULL, true);
+	size_t nc = m_pExtendNF->findNearest(m_neighborCount, in);
+	size_t landmarkCount = m_landmarkCosts.rows();
+	GVec sq(landmarkCount);
+	for(size_t j = 0; j < landmarkCount; j++)
+	{
+		const GVec& costs = m_landmarkCosts[j];
+		double best = 1e300;
+		for(size_t k = 0; k < nc; k++)
+			best = std::min(best, costs[m_pExtendNF->neighbor(k)] + sqrt(m_pExtendNF->distance(k)));
+		if(best >= 1e200)
+			throw Ex("The point is not connected to the training data");
+		sq[j] = best * best;
+	}
+	out.resize(m_targetDims);
+	triangulate(sq, out);
 }
 
+#ifndef MIN_PREDICT
+// static
+void GIsomap::test()
+{
+	// Sample points from a rolled-up sheet, whose geodesic coordinates are (r * t, h)
+	GRand rand(0);
+	size_t n = 500;
+	double r = 3.0;
+	GMatrix data(n, 3);
+	GMatrix truth(n, 2);
+	for(size_t i = 0; i < n; i++)
+	{
+		double t = rand.uniform() * M_PI;
+		double h = rand.uniform() * 4.0;
+		data[i][0] = r * cos(t);
+		data[i][1] = r * sin(t);
+		data[i][2] = h;
+		truth[i][0] = r * t;
+		truth[i][1] = h;
+	}
+
+	// Both kinds of Isomap should approximately preserve the geodesic distances
+	GIsomap classic(10, 2, &rand);
+	classic.setWorkerThreads(2);
+	GMatrix* pClassic = classic.reduce(data);
+	std::unique_ptr<GMatrix> hClassic(pClassic);
+	GIsomap landmark(10, 2, &rand);
+	landmark.setLandmarks(40);
+	landmark.setWorkerThreads(3);
+	GMatrix* pLandmark = landmark.reduce(data);
+	std::unique_ptr<GMatrix> hLandmark(pLandmark);
+	if(pClassic->rows() != n || pLandmark->rows() != n)
+		throw Ex("wrong number of rows");
+	double errClassic = 0.0;
+	double errLandmark = 0.0;
+	double sum = 0.0;
+	for(size_t i = 0; i < 300; i++)
+	{
+		size_t a = (size_t)rand.next(n);
+		size_t b = (size_t)rand.next(n);
+		double expected = std::sqrt(truth[a].squaredDistance(truth[b]));
+		errClassic += std::abs(std::sqrt(pClassic->row(a).squaredDistance(pClassic->row(b))) - expected);
+		errLandmark += std::abs(std::sqrt(pLandmark->row(a).squaredDistance(pLandmark->row(b))) - expected);
+		sum += expected;
+	}
+	if(errClassic > 0.1 * sum)
+		throw Ex("classic isomap failed to preserve geodesic distances");
+	if(errLandmark > 0.1 * sum)
+		throw Ex("landmark isomap failed to preserve geodesic distances");
+
+	// A training point should extend to its own coordinates
+	GVec out(2);
+	landmark.extend(data[7], out);
+	if(std::sqrt(out.squaredDistance(pLandmark->row(7))) > 1e-8)
+		throw Ex("extension is inconsistent with the training embedding");
+
+	// A new point should land among the training points near it
+	GVec x(3);
+	x[0] = r * cos(1.0);
+	x[1] = r * sin(1.0);
+	x[2] = 2.0;
+	landmark.extend(x, out);
+	size_t nearest = 0;
+	for(size_t i = 1; i < n; i++)
+	{
+		if(data[i].squaredDistance(x) < data[nearest].squaredDistance(x))
+			nearest = i;
+	}
+	if(std::sqrt(out.squaredDistance(pLandmark->row(nearest))) > 0.5)
+		throw Ex("extension put a new point in the wrong place");
+}
+#endif
 
 
 
@@ -1014,11 +1502,11 @@ GMatrix* GIsomap::reduce(const GMatrix& in)
 
 
 
-#define SPARSE
 
 // Locally Linear Embedding
 class GLLEHelper
 {
+friend class GLLEWorker;
 protected:
 	const GMatrix* m_pInputData;
 	GMatrix* m_pOutputData;
@@ -1026,44 +1514,72 @@ protected:
 	size_t m_nTargetDims;
 	size_t m_nNeighbors;
 	size_t* m_pNeighbors;
-#ifdef SPARSE
-	GSparseMatrix* m_pWeights;
-#else
-	GMatrix* m_pWeights;
-#endif
+	GVec m_weights; // m_weights[i * m_nNeighbors + j] is the weight of neighbor j in the reconstruction of point i
 	GRand* m_pRand;
+	size_t m_workerThreads;
 
-	GLLEHelper(const GMatrix* pData, size_t nTargetDims, size_t nNeighbors, GRand* pRand);
+	// The operation that the workers are currently performing
+	bool m_computingWeights;
+	const double* m_pIn;
+	double* m_pOut;
+
+	GLLEHelper(const GMatrix* pData, size_t nTargetDims, size_t nNeighbors, GRand* pRand, size_t workerThreads);
 public:
 	~GLLEHelper();
 
 	// Uses LLE to compute the reduced dimensional embedding of the data
 	// associated with pNF.
-	static GMatrix* doLLE(GNeighborFinder* pNF, size_t nTargetDims, size_t neighbors, GRand* pRand);
+	static GMatrix* doLLE(GNeighborFinder* pNF, size_t nTargetDims, size_t neighbors, GRand* pRand, size_t workerThreads = 1);
 
 protected:
 	void findNeighbors(GNeighborFinder* pNF);
-	void findNeighborsTheSlowWay();
 	void computeWeights();
 	void computeEmbedding();
 	GMatrix* releaseOutputData();
+
+	// Performs one job of the current operation
+	void doJob(size_t job);
+
+	// Computes out = M * in for a block of vecs vectors, where M = (I - W)^T (I - W)
+	void multiply(GMasterThread& master, const double* in, double* out, size_t vecs);
+};
+
+class GLLEWorker : public GWorkerThread
+{
+protected:
+	GLLEHelper& m_lle;
+
+public:
+	GLLEWorker(GMasterThread& master, GLLEHelper& lle)
+	: GWorkerThread(master), m_lle(lle)
+	{
+	}
+
+	virtual ~GLLEWorker()
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		m_lle.doJob(jobId);
+	}
 };
 
-GLLEHelper::GLLEHelper(const GMatrix* pData, size_t nTargetDims, size_t nNeighbors, GRand* pRand)
-: m_pRand(pRand)
+#define LLE_WEIGHT_BLOCK 64
+
+GLLEHelper::GLLEHelper(const GMatrix* pData, size_t nTargetDims, size_t nNeighbors, GRand* pRand, size_t workerThreads)
+: m_pRand(pRand), m_workerThreads(workerThreads), m_computingWeights(false), m_pIn(NULL), m_pOut(NULL)
 {
 	m_pInputData = pData;
 	m_nTargetDims = nTargetDims;
 	m_nNeighbors = nNeighbors;
 	m_pNeighbors = NULL;
-	m_pWeights = NULL;
 	m_pOutputData = NULL;
 }
 
 GLLEHelper::~GLLEHelper()
 {
-	delete(m_pNeighbors);
-	delete(m_pWeights);
+	delete[] m_pNeighbors;
 	delete(m_pOutputData);
 }
 
@@ -1075,9 +1591,9 @@ GMatrix* GLLEHelper::releaseOutputData()
 }
 
 // static
-GMatrix* GLLEHelper::doLLE(GNeighborFinder* pNF, size_t nTargetDims, size_t neighbors, GRand* pRand)
+GMatrix* GLLEHelper::doLLE(GNeighborFinder* pNF, size_t nTargetDims, size_t neighbors, GRand* pRand, size_t workerThreads)
 {
-	GLLEHelper lle(pNF->data(), nTargetDims, neighbors, pRand);
+	GLLEHelper lle(pNF->data(), nTargetDims, neighbors, pRand, workerThreads);
 	lle.findNeighbors(pNF);
 	lle.computeWeights();
 	lle.computeEmbedding();
@@ -1086,7 +1602,7 @@ GMatrix* GLLEHelper::doLLE(GNeighborFinder* pNF, size_t nTargetDims, size_t neig
 
 void GLLEHelper::findNeighbors(GNeighborFinder* pNF)
 {
-	delete(m_pNeighbors);
+	delete[] m_pNeighbors;
 	m_pNeighbors = new size_t[m_nNeighbors * m_pInputData->rows()];
 	size_t* pHood = m_pNeighbors;
 	for(size_t i = 0; i < m_pInputData->rows(); i++)
@@ -1100,132 +1616,246 @@ void GLLEHelper::findNeighbors(GNeighborFinder* pNF)
 	}
 }
 
-void GLLEHelper::computeWeights()
+void GLLEHelper::doJob(size_t job)
 {
 	size_t nRowCount = m_pInputData->rows();
-	GTEMPBUF(double, pVec, m_nNeighbors);
-#ifdef SPARSE
-	m_pWeights = new GSparseMatrix(nRowCount, nRowCount);
-#else
-	m_pWeights = new GMatrix(nRowCount, nRowCount);
-#endif
-	for(size_t n = 0; n < nRowCount; n++)
+	if(m_computingWeights)
 	{
-		GManifold::computeNeighborWeights(m_pInputData, n, m_nNeighbors, m_pNeighbors + n * m_nNeighbors, pVec);
-		size_t pos = 0;
-		size_t* pHood = m_pNeighbors + n * m_nNeighbors;
-#ifdef SPARSE
-		for(size_t i = 0; i < m_nNeighbors; i++)
+		// Solve the local Gram systems for a block of points
+		size_t end = std::min(nRowCount, (job + 1) * LLE_WEIGHT_BLOCK);
+		for(size_t n = job * LLE_WEIGHT_BLOCK; n < end; n++)
 		{
-			if(pHood[i] < nRowCount)
-				m_pWeights->set(n, pHood[i], pVec[pos++]);
-			else
-				pos++;
+			double* pW = m_weights.data() + n * m_nNeighbors;
+			GManifold::computeNeighborWeights(m_pInputData, n, m_nNeighbors, m_pNeighbors + n * m_nNeighbors, pW);
+			size_t* pHood = m_pNeighbors + n * m_nNeighbors;
+			for(size_t i = 0; i < m_nNeighbors; i++)
+			{
+				if(pHood[i] >= nRowCount)
+					pW[i] = 0.0;
+			}
 		}
-#else
-		GVec_setAll(m_pWeights->row(n), 0.0, nRowCount);
-		for(size_t i = 0; i < m_nNeighbors; i++)
+	}
+	else
+	{
+		// Compute y = (I - W)^T (I - W) x for one vector
+		const double* pX = m_pIn + job * nRowCount;
+		double* pY = m_pOut + job * nRowCount;
+		GVec z(nRowCount);
+		for(size_t i = 0; i < nRowCount; i++)
 		{
-			if(pHood[i] < nRowCount)
-				m_pWeights->row(n)[pHood[i]] = pVec[pos++];
-			else
-				pos++;
+			const double* pW = m_weights.data() + i * m_nNeighbors;
+			const size_t* pHood = m_pNeighbors + i * m_nNeighbors;
+			double sum = pX[i];
+			for(size_t j = 0; j < m_nNeighbors; j++)
+			{
+				if(pHood[j] < nRowCount)
+					sum -= pW[j] * pX[pHood[j]];
+			}
+			z[i] = sum;
+		}
+		for(size_t i = 0; i < nRowCount; i++)
+			pY[i] = z[i];
+		for(size_t i = 0; i < nRowCount; i++)
+		{
+			const double* pW = m_weights.data() + i * m_nNeighbors;
+			const size_t* pHood = m_pNeighbors + i * m_nNeighbors;
+			for(size_t j = 0; j < m_nNeighbors; j++)
+			{
+				if(pHood[j] < nRowCount)
+					pY[pHood[j]] -= pW[j] * z[i];
+			}
 		}
-#endif
 	}
 }
 
-void GLLEHelper::computeEmbedding()
+void GLLEHelper::computeWeights()
 {
-	//  Subtract the weights from the identity matrix
-	size_t row, col;
-	m_pWeights->multiply(-1.0);
 	size_t nRowCount = m_pInputData->rows();
-#ifdef SPARSE
-	for(row = 0; row < nRowCount; row++)
-		m_pWeights->set(row, row, m_pWeights->get(row, row) + 1.0);
-#else
-	for(row = 0; row < nRowCount; row++)
-		m_pWeights->row(row)[row] += 1.0;
-#endif
+	m_weights.resize(nRowCount * m_nNeighbors);
+	size_t jobs = (nRowCount + LLE_WEIGHT_BLOCK - 1) / LLE_WEIGHT_BLOCK;
+	GMasterThread master;
+	for(size_t i = 0; i < std::max((size_t)1, std::min(m_workerThreads, jobs)); i++)
+		master.addWorker(new GLLEWorker(master, *this));
+	m_computingWeights = true;
+	master.doJobs(jobs);
+	m_computingWeights = false;
+}
 
-	// Compute the smallest (m_nTargetDims+1) eigenvectors of (A^T)A, where A is m_pWeights
-#ifdef SPARSE
-	// The sparse matrix SVD way
-	GSparseMatrix* pU;
-	double* diag;
-	GSparseMatrix* pV;
-	m_pWeights->singularValueDecomposition(&pU, &diag, &pV);
-	std::unique_ptr<GSparseMatrix> hU(pU);
-	std::unique_ptr<double[]> hDiag(diag);
-	std::unique_ptr<GSparseMatrix> hV(pV);
-	GMatrix* pEigVecs = new GMatrix(m_nTargetDims + 1, pV->cols());
-	std::unique_ptr<GMatrix> hEigVecs(pEigVecs);
-	for(size_t i = 1; i <= m_nTargetDims; i++)
-	{
-		size_t rowIn = pV->rows() - 1 - i;
-		double* pRow = pEigVecs->row(i).data();
-		for(size_t j = 0; j < pV->cols(); j++)
-			pRow[j] = pV->get(rowIn, j);
-	}
-#else
-/*
-	// The brute-force way (slow and not very precise)
-	GMatrix* pTmp = m_pWeights->clone();
-	std::unique_ptr<GMatrix> hTmp(pTmp);
-	GMatrix* pEigVecs = new GMatrix(nRowCount);
-	std::unique_ptr<GMatrix> hEigVecs(pEigVecs);
-	pEigVecs->newRows(m_nTargetDims + 1);
-	GTEMPBUF(double, mean, nRowCount);
-	pTmp->meanVector(mean);
-	for(size_t i = 0; i < nRowCount; i++)
-	{
-		size_t r = std::min(m_nTargetDims, nRowCount - 1 - i);
-		pTmp->principalComponent(pEigVecs->row(r), nRowCount, mean, m_pRand);
-		pTmp->removeComponent(mean, pEigVecs->row(r), nRowCount);
-	}
-*/
+void GLLEHelper::multiply(GMasterThread& master, const double* in, double* out, size_t vecs)
+{
+	m_pIn = in;
+	m_pOut = out;
+	master.doJobs(vecs);
+	m_pIn = NULL;
+	m_pOut = NULL;
+}
 
-	// The SVD way (seems to be the fastest and most accurate)
-	GMatrix* pU;
-	double* diag;
-	GMatrix* pV;
-	m_pWeights->singularValueDecomposition(&pU, &diag, &pV);
-	std::unique_ptr<GMatrix> hU(pU);
-	std::unique_ptr<double[]> hDiag(diag);
-	std::unique_ptr<GMatrix> hV(pV);
-	GMatrix* pEigVecs = new GMatrix(pV->relation(), pV->heap());
-	std::unique_ptr<GMatrix> hEigVecs(pEigVecs);
-	for(size_t i = 0; i <= m_nTargetDims; i++)
-		pEigVecs->takeRow(pV->releaseRow(pV->rows() - 1));
+void GLLEHelper::computeEmbedding()
+{
+	// Find the eigenvectors of M = (I - W)^T (I - W) with the smallest eigenvalues, using a thick-restarted block Krylov method.
+	// M is never formed. It is only applied to vectors with sparse products. The constant vector is always an
+	// eigenvector with an eigenvalue of 0, so it is locked in the first row of the basis, and the next nTargetDims are found.
+	size_t n = m_pInputData->rows();
+	if(n <= m_nTargetDims + 1)
+		throw Ex("Not enough points to reduce into ", to_str(m_nTargetDims), " dims");
+	size_t want = m_nTargetDims;
+	size_t blockSize = std::min(n - 1, want + std::max((size_t)2, want));
+	size_t maxBasis = std::min(n - 1, std::max(6 * blockSize, (size_t)60));
+	GVec basis((1 + maxBasis) * n); // Row 0 is the constant vector. The rest are orthonormal basis vectors.
+	GVec mBasis(maxBasis * n); // M times each basis vector
+	GVec ritz(maxBasis * n);
+	GVec mRitz(maxBasis * n);
+	GVec h(maxBasis * maxBasis);
+	GVec rot(maxBasis * maxBasis);
+	GMasterThread master;
+	for(size_t i = 0; i < std::max((size_t)1, std::min(m_workerThreads, blockSize)); i++)
+		master.addWorker(new GLLEWorker(master, *this));
+	double c = 1.0 / sqrt((double)n);
+	for(size_t i = 0; i < n; i++)
+		basis[i] = c;
+
+	// Start with random vectors
+	GRand tmpRand(0);
+	GRand& rand = (m_pRand ? *m_pRand : tmpRand);
+	for(size_t i = 0; i < blockSize * n; i++)
+		ritz[i] = rand.normal();
+	basis.copy(n, ritz, 0, blockSize * n);
+	size_t rows = GTruncatedSVD::orthonormalize(basis.data(), 1, 1 + blockSize, n) - 1;
+	multiply(master, basis.data() + n, mBasis.data(), rows);
+	double tol = 1e-10;
+	size_t next = 0; // The first basis vector whose product with M has not yet been added to the basis
+	for(size_t restart = 0; restart < 1000; restart++)
+	{
+		// Expand the Krylov subspace by adding M times the basis vectors, one block at a time
+		while(rows < maxBasis && next < rows)
+		{
+			size_t newRows = std::min(std::min(rows - next, blockSize), maxBasis - rows);
+			basis.copy((1 + rows) * n, mBasis, next * n, newRows * n);
+			next += newRows;
+			size_t total = GTruncatedSVD::orthonormalize(basis.data(), 1 + rows, 1 + rows + newRows, n) - 1;
+			multiply(master, basis.data() + (1 + rows) * n, mBasis.data() + rows * n, total - rows);
+			rows = total;
+		}
 
-/*
-	// The standard way
-	GMatrix* m = GMatrix::multiply(*m_pWeights, *m_pWeights, true, false);
-	std::unique_ptr<GMatrix> hM(m);
-	GMatrix* pEigVecs = m->eigs(m_nTargetDims + 1, NULL, m_pRand, false);
-	std::unique_ptr<GMatrix> hEigVecs(pEigVecs);
-*/
-#endif
+		// Project M into the subspace, and find its eigenvectors. (The projection is positive semi-definite,
+		// so after Jacobi rotations make its rows orthogonal, the rotations are its eigenvectors, and the
+		// magnitudes of the rows are its eigenvalues.)
+		for(size_t i = 0; i < rows; i++)
+		{
+			const double* pB = basis.data() + (1 + i) * n;
+			for(size_t j = i; j < rows; j++)
+			{
+				const double* pMB = mBasis.data() + j * n;
+				double sum = 0.0;
+				for(size_t k = 0; k < n; k++)
+					sum += pB[k] * pMB[k];
+				h[i * rows + j] = sum;
+				h[j * rows + i] = sum;
+			}
+		}
+		GTruncatedSVD::jacobi(h.data(), rows, rows, rot.data());
+		std::vector< std::pair<double, size_t> > order;
+		double biggest = 0.0;
+		for(size_t i = 0; i < rows; i++)
+		{
+			const double* pH = h.data() + i * rows;
+			double sse = 0.0;
+			for(size_t j = 0; j < rows; j++)
+				sse += pH[j] * pH[j];
+			double mag = sqrt(sse);
+			order.push_back(std::make_pair(mag, i));
+			biggest = std::max(biggest, mag);
+		}
+		std::sort(order.begin(), order.end());
+
+		// Compute the Ritz vectors with the smallest Ritz values, and M times them.
+		// Half of the subspace is kept when restarting, so little of the Krylov information is lost.
+		size_t keep = std::min(rows, std::max(blockSize, rows / 2));
+		ritz.fill(0.0, 0, keep * n);
+		mRitz.fill(0.0, 0, keep * n);
+		for(size_t i = 0; i < keep; i++)
+		{
+			const double* r = rot.data() + order[i].second * rows;
+			double* pX = ritz.data() + i * n;
+			double* pMX = mRitz.data() + i * n;
+			for(size_t j = 0; j < rows; j++)
+			{
+				const double* pB = basis.data() + (1 + j) * n;
+				const double* pMB = mBasis.data() + j * n;
+				double w = r[j];
+				for(size_t k = 0; k < n; k++)
+				{
+					pX[k] += w * pB[k];
+					pMX[k] += w * pMB[k];
+				}
+			}
+		}
+
+		// Check whether the wanted vectors have converged
+		bool converged = true;
+		for(size_t i = 0; i < std::min(want, keep) && converged; i++)
+		{
+			double* pX = ritz.data() + i * n;
+			double* pMX = mRitz.data() + i * n;
+			double sse = 0.0;
+			for(size_t k = 0; k < n; k++)
+			{
+				double r = pMX[k] - order[i].first * pX[k];
+				sse += r * r;
+			}
+			if(sqrt(sse) > tol * biggest)
+				converged = false;
+		}
+		if(converged || next >= rows || restart == 999)
+			break;
+
+		// Restart with the Ritz vectors. Their residuals lie in the span of M times the basis vectors that
+		// have not been expanded yet, so those products (made orthogonal to the whole basis) are kept too.
+		size_t lastRows = std::min(rows - next, maxBasis - keep);
+		GVec carry(lastRows * n);
+		carry.copy(0, mBasis, next * n, lastRows * n);
+		for(size_t pass = 0; pass < 2; pass++)
+		{
+			for(size_t i = 0; i < lastRows; i++)
+			{
+				double* pC = carry.data() + i * n;
+				for(size_t j = 0; j <= rows; j++)
+				{
+					const double* pB = basis.data() + j * n;
+					double d = 0.0;
+					for(size_t k = 0; k < n; k++)
+						d += pC[k] * pB[k];
+					for(size_t k = 0; k < n; k++)
+						pC[k] -= d * pB[k];
+				}
+			}
+		}
+		basis.copy(n, ritz, 0, keep * n);
+		mBasis.copy(0, mRitz, 0, keep * n);
+		basis.copy((1 + keep) * n, carry, 0, lastRows * n);
+		rows = GTruncatedSVD::orthonormalize(basis.data(), 1 + keep, 1 + keep + lastRows, n) - 1;
+		multiply(master, basis.data() + (1 + keep) * n, mBasis.data() + keep * n, rows - keep);
+		next = keep;
+	}
 
 	// Make the output data
-	m_pOutputData = new GMatrix(nRowCount, m_nTargetDims);
-	double d = sqrt((double)nRowCount);
-	for(row = 0; row < nRowCount; row++)
+	m_pOutputData = new GMatrix(n, m_nTargetDims);
+	double d = sqrt((double)n);
+	for(size_t row = 0; row < n; row++)
 	{
 		double* pRow = m_pOutputData->row(row).data();
-		for(col = 0; col < m_nTargetDims; col++)
-			pRow[col] = pEigVecs->row(col + 1)[row] * d;
+		for(size_t col = 0; col < m_nTargetDims; col++)
+			pRow[col] = ritz[col * n + row] * d;
 	}
 }
 
 
-GLLE::GLLE(size_t neighborCount, size_t targetDims, GRand* pRand) : m_neighborCount(neighborCount), m_targetDims(targetDims), m_pNF(NULL), m_pRand(pRand)
+GLLE::GLLE(size_t neighborCount, size_t targetDims, GRand* pRand) : m_neighborCount(neighborCount), m_targetDims(targetDims), m_pNF(NULL), m_pRand(pRand), m_workerThreads(1)
 {
 }
 
 GLLE::GLLE(GDomNode* pNode)
-: GTransform(pNode)
+: GTransform(pNode), m_neighborCount(0), m_pNF(NULL), m_pRand(NULL), m_workerThreads(1)
 {
 	m_targetDims = (size_t)pNode->getInt("targetDims");
 }
@@ -1257,8 +1887,84 @@ GMatrix* GLLE::reduce(const GMatrix& in)
 		pNF = new GKdTree(&in, NULL, true);
 		hNF.reset(pNF);
 	}
-	return GLLEHelper::doLLE(pNF, m_targetDims, m_neighborCount, m_pRand);
+	return GLLEHelper::doLLE(pNF, m_targetDims, m_neighborCount, m_pRand, m_workerThreads);
+}
+
+#ifndef MIN_PREDICT
+// static
+void GLLE::test()
+{
+	// Sample points from a plane that is linearly embedded in 4 dimensions
+	GRand rand(0);
+	size_t n = 600;
+	GMatrix truth(n, 2);
+	GMatrix data(n, 4);
+	for(size_t i = 0; i < n; i++)
+	{
+		double u = rand.uniform() * 3.0;
+		double v = rand.uniform() * 2.0;
+		truth[i][0] = u;
+		truth[i][1] = v;
+		data[i][0] = u + v;
+		data[i][1] = u - 2.0 * v;
+		data[i][2] = 0.5 * u;
+		data[i][3] = 3.0 - v;
+	}
+
+	// LLE should recover the plane up to an affine transformation
+	GRand r1(1);
+	GLLE lle(12, 2, &r1);
+	GMatrix* pOut = lle.reduce(data);
+	std::unique_ptr<GMatrix> hOut(pOut);
+	for(size_t c = 0; c < 2; c++)
+	{
+		// Regress each truth coordinate on the embedding
+		GMatrix x(n, 3);
+		GMatrix y(n, 1);
+		for(size_t i = 0; i < n; i++)
+		{
+			x[i][0] = pOut->row(i)[0];
+			x[i][1] = pOut->row(i)[1];
+			x[i][2] = 1.0;
+			y[i][0] = truth[i][c];
+		}
+		GMatrix* pXtX = GMatrix::multiply(x, x, true, false);
+		std::unique_ptr<GMatrix> hXtX(pXtX);
+		GMatrix* pXtY = GMatrix::multiply(x, y, true, false);
+		std::unique_ptr<GMatrix> hXtY(pXtY);
+		GMatrix* pInv = pXtX->pseudoInverse();
+		std::unique_ptr<GMatrix> hInv(pInv);
+		GMatrix* pCoef = GMatrix::multiply(*pInv, *pXtY, false, false);
+		std::unique_ptr<GMatrix> hCoef(pCoef);
+		double sse = 0.0;
+		double sst = 0.0;
+		double mean = truth.columnMean(c);
+		for(size_t i = 0; i < n; i++)
+		{
+			double pred = x[i][0] * pCoef->row(0)[0] + x[i][1] * pCoef->row(1)[0] + pCoef->row(2)[0];
+			sse += (pred - y[i][0]) * (pred - y[i][0]);
+			sst += (mean - y[i][0]) * (mean - y[i][0]);
+		}
+		if(sse > 0.05 * sst)
+			throw Ex("LLE did not recover the plane");
+	}
+
+	// The number of threads should not change the results
+	GRand r2(1);
+	GLLE lle2(12, 2, &r2);
+	lle2.setWorkerThreads(3);
+	GMatrix* pOut2 = lle2.reduce(data);
+	std::unique_ptr<GMatrix> hOut2(pOut2);
+	for(size_t i = 0; i < n; i++)
+	{
+		for(size_t j = 0; j < 2; j++)
+		{
+			if(pOut->row(i)[j] != pOut2->row(i)[j])
+				throw Ex("threads changed the results");
+		}
+	}
 }
+#endif
 
 
 
@@ -1664,13 +2370,19 @@ m_targetDims(2),
 m_passes(50),
 m_refines_per_scale(100),
 m_scaleRate(0.9),
-m_rand(0)
+m_rand(0),
+m_workerThreads(1),
+m_partSize(2048),
+m_trackProgress(false)
 {
 }
 
 GScalingUnfolder::GScalingUnfolder(GDomNode* pNode)
 : GTransform(pNode),
-m_rand(0)
+m_rand(0),
+m_workerThreads(1),
+m_partSize(2048),
+m_trackProgress(false)
 {
 	throw Ex("Sorry, this method is not implemented yet");
 }
@@ -1681,13 +2393,14 @@ GScalingUnfolder::~GScalingUnfolder()
 
 }
 
-void GScalingUnfolder_adjustPoints(double* pA, double* pB, size_t dims, double curSqDist, double tarSqDist, GRand& rand)
+void GScalingUnfolder_adjustPoints(double* pA, double* pB, size_t dims, double curSqDist, double tarSqDist, uint64_t seed)
 {
 	if(curSqDist == 0.0)
 	{
 		if(tarSqDist > 0.0)
 		{
 			// Perturb A and B by a small random amount to separate them
+			GRand rand(seed);
 			double d = 0.01 * sqrt(tarSqDist);
 			for(size_t i = 0; i < dims; i++)
 			{
@@ -1706,12 +2419,148 @@ void GScalingUnfolder_adjustPoints(double* pA, double* pB, size_t dims, double c
 	}
 }
 
-// static
-void GScalingUnfolder::restore_local_distances_pass(GMatrix& intrinsic, GNeighborGraph& ng, size_t neighborCount, GRand& rand)
+class GScalingUnfolderWorker;
+
+/// Restores the distance across each edge of a neighbor graph, in breadth-first order. The points may be
+/// partitioned into spatially compact parts. The edges within each part are refined concurrently by worker
+/// threads, and then the edges that cross between parts are refined. The partition does not depend on the
+/// number of threads, so neither do the results.
+class GScalingUnfolderPass
 {
+friend class GScalingUnfolderWorker;
+protected:
+	size_t m_workerThreads;
+	GMasterThread* m_pMaster;
+	std::vector<size_t> m_part; // The part that each point belongs to
+	size_t m_parts;
+	std::vector<size_t> m_a; // The first point of each edge, in breadth-first order
+	std::vector<size_t> m_b; // The second point of each edge
+	std::vector<double> m_target; // The target squared distance of each edge
+	std::vector<size_t> m_partEdges; // The edges within parts, sorted by part
+	std::vector<size_t> m_partStart; // The index in m_partEdges where each part begins
+	std::vector<size_t> m_crossEdges; // The edges that connect different parts
+	GMatrix* m_pIntrinsic;
+	uint64_t m_seed;
+
+public:
+	GScalingUnfolderPass(size_t workerThreads);
+	~GScalingUnfolderPass();
+
+	/// Partitions the points into parts of no more than maxPartSize points, by recursively
+	/// splitting them at the median of the dimension with the largest range.
+	void partition(const GMatrix& points, size_t maxPartSize);
+
+	/// Performs one pass over all the edges in ng.
+	void run(GMatrix& intrinsic, GNeighborGraph& ng, size_t neighborCount, GRand& rand);
+
+protected:
+	/// Assigns the count points in pIndexes to parts
+	void bisect(const GMatrix& points, size_t* pIndexes, size_t count, size_t maxPartSize);
+
+	/// Restores the distance across one edge
+	void refineEdge(size_t edge);
+
+	/// Refines the edges within one part
+	void doJob(size_t job);
+};
+
+class GScalingUnfolderWorker : public GWorkerThread
+{
+protected:
+	GScalingUnfolderPass& m_pass;
+
+public:
+	GScalingUnfolderWorker(GMasterThread& master, GScalingUnfolderPass& pass)
+	: GWorkerThread(master), m_pass(pass)
+	{
+	}
+
+	virtual ~GScalingUnfolderWorker()
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		m_pass.doJob(jobId);
+	}
+};
+
+GScalingUnfolderPass::GScalingUnfolderPass(size_t workerThreads)
+: m_workerThreads(workerThreads), m_pMaster(NULL), m_parts(1), m_pIntrinsic(NULL), m_seed(0)
+{
+}
+
+GScalingUnfolderPass::~GScalingUnfolderPass()
+{
+	delete(m_pMaster);
+}
+
+class GScalingUnfolderComparer
+{
+protected:
+	const GMatrix& m_points;
+	size_t m_dim;
+
+public:
+	GScalingUnfolderComparer(const GMatrix& points, size_t dim) : m_points(points), m_dim(dim)
+	{
+	}
+
+	bool operator()(size_t a, size_t b) const
+	{
+		return m_points[a][m_dim] < m_points[b][m_dim];
+	}
+};
+
+void GScalingUnfolderPass::partition(const GMatrix& points, size_t maxPartSize)
+{
+	std::vector<size_t> indexes(points.rows());
+	for(size_t i = 0; i < points.rows(); i++)
+		indexes[i] = i;
+	m_part.resize(points.rows());
+	m_parts = 0;
+	bisect(points, indexes.data(), indexes.size(), std::max((size_t)1, maxPartSize));
+}
+
+void GScalingUnfolderPass::bisect(const GMatrix& points, size_t* pIndexes, size_t count, size_t maxPartSize)
+{
+	if(count <= maxPartSize)
+	{
+		for(size_t i = 0; i < count; i++)
+			m_part[pIndexes[i]] = m_parts;
+		m_parts++;
+		return;
+	}
+	size_t bestDim = 0;
+	double bestRange = -1.0;
+	for(size_t d = 0; d < points.cols(); d++)
+	{
+		double lo = 1e308;
+		double hi = -1e308;
+		for(size_t i = 0; i < count; i++)
+		{
+			double v = points[pIndexes[i]][d];
+			lo = std::min(lo, v);
+			hi = std::max(hi, v);
+		}
+		if(hi - lo > bestRange)
+		{
+			bestRange = hi - lo;
+			bestDim = d;
+		}
+	}
+	size_t half = count / 2;
+	std::nth_element(pIndexes, pIndexes + half, pIndexes + count, GScalingUnfolderComparer(points, bestDim));
+	bisect(points, pIndexes, half, maxPartSize);
+	bisect(points, pIndexes + half, count - half, maxPartSize);
+}
 
-	// Do it in breadth-first order
-	size_t dims = intrinsic.cols();
+void GScalingUnfolderPass::run(GMatrix& intrinsic, GNeighborGraph& ng, size_t neighborCount, GRand& rand)
+{
+	// Find the edges in breadth-first order
+	m_a.clear();
+	m_b.clear();
+	m_target.clear();
 	std::queue<size_t> q;
 	GBitTable used(ng.data()->rows());
 	size_t random_row = rand.next(intrinsic.rows());
@@ -1743,27 +2592,123 @@ void GScalingUnfolder::restore_local_distances_pass(GMatrix& intrinsic, GNeighbo
 			for(size_t i = 0; i < neighborCount; i++)
 				q.push(ed++);
 		}
+		m_a.push_back(a);
+		m_b.push_back(b);
+		m_target.push_back(ng.distance(neighbor_index));
+	}
+	m_seed = rand.next();
+	m_pIntrinsic = &intrinsic;
+
+	// Sort the edges within parts by part, and set aside the edges that cross between parts
+	if(m_part.size() != intrinsic.rows())
+	{
+		m_part.assign(intrinsic.rows(), 0);
+		m_parts = 1;
+	}
+	m_partStart.assign(m_parts + 1, 0);
+	m_crossEdges.clear();
+	for(size_t i = 0; i < m_a.size(); i++)
+	{
+		if(m_part[m_a[i]] == m_part[m_b[i]])
+			m_partStart[m_part[m_a[i]] + 1]++;
+	}
+	for(size_t i = 0; i < m_parts; i++)
+		m_partStart[i + 1] += m_partStart[i];
+	m_partEdges.resize(m_partStart[m_parts]);
+	std::vector<size_t> pos(m_partStart.begin(), m_partStart.end() - 1);
+	for(size_t i = 0; i < m_a.size(); i++)
+	{
+		if(m_part[m_a[i]] == m_part[m_b[i]])
+			m_partEdges[pos[m_part[m_a[i]]]++] = i;
+		else
+			m_crossEdges.push_back(i);
+	}
 
-		double dTarget = ng.distance(neighbor_index);
-		GVec& aa = intrinsic.row(a);
-		GVec& bb = intrinsic.row(b);
-		double dCur = aa.squaredDistance(bb);
-		GScalingUnfolder_adjustPoints(aa.data(), bb.data(), dims, dCur, dTarget, rand);
+	// Refine the edges
+	if(m_workerThreads < 2 || m_parts < 2)
+	{
+		for(size_t i = 0; i < m_parts; i++)
+			doJob(i);
 	}
+	else
+	{
+		if(!m_pMaster)
+		{
+			m_pMaster = new GMasterThread();
+			for(size_t i = 0; i < m_workerThreads; i++)
+				m_pMaster->addWorker(new GScalingUnfolderWorker(*m_pMaster, *this));
+		}
+		m_pMaster->doJobs(m_parts);
+	}
+	for(size_t i = 0; i < m_crossEdges.size(); i++)
+		refineEdge(m_crossEdges[i]);
+}
 
+void GScalingUnfolderPass::refineEdge(size_t edge)
+{
+	GVec& aa = m_pIntrinsic->row(m_a[edge]);
+	GVec& bb = m_pIntrinsic->row(m_b[edge]);
+	double dCur = aa.squaredDistance(bb);
+	GScalingUnfolder_adjustPoints(aa.data(), bb.data(), m_pIntrinsic->cols(), dCur, m_target[edge], m_seed + edge * 0x9E3779B97F4A7C15ull);
+}
+
+void GScalingUnfolderPass::doJob(size_t job)
+{
+	for(size_t i = m_partStart[job]; i < m_partStart[job + 1]; i++)
+		refineEdge(m_partEdges[i]);
+}
+
+// static
+void GScalingUnfolder::restore_local_distances_pass(GMatrix& intrinsic, GNeighborGraph& ng, size_t neighborCount, GRand& rand)
+{
+	GScalingUnfolderPass pass(1);
+	pass.run(intrinsic, ng, neighborCount, rand);
+}
+
+// static
+double GScalingUnfolder::stress(const GMatrix& intrinsic, GNeighborGraph& ng, size_t neighborCount)
+{
+	double sse = 0.0;
+	double sst = 0.0;
+	for(size_t a = 0; a < intrinsic.rows(); a++)
+	{
+		size_t count = ng.findNearest(neighborCount, a);
+		for(size_t j = 0; j < count; j++)
+		{
+			size_t b = ng.neighbor(j);
+			if(b >= intrinsic.rows())
+				continue;
+			double target = sqrt(ng.distance(j));
+			double d = sqrt(intrinsic.row(a).squaredDistance(intrinsic.row(b))) - target;
+			sse += d * d;
+			sst += target * target;
+		}
+	}
+	return sst > 0.0 ? sse / sst : 0.0;
 }
 
 void GScalingUnfolder::unfold(GMatrix& intrinsic, GNeighborGraph& nf, size_t encoderTrainIters, GNeuralNetLearner* pEncoder, GNeuralNetLearner* pDecoder, const GMatrix* pVisible)
 {
 	GRandomIndexIterator* ii = pEncoder ? new GRandomIndexIterator(intrinsic.rows(), m_rand) : NULL;
 	std::unique_ptr<GRandomIndexIterator> hII2(ii);
+	GScalingUnfolderPass refiner(m_workerThreads);
+	refiner.partition(intrinsic, m_partSize);
+	m_progress.resize(0, 3);
+	double startTime = GTime::seconds();
 	for(size_t pass = 0; pass < m_passes; pass++)
 	{
 		// Scale up the data
 		intrinsic.multiply(1.0 / m_scaleRate);
 
 		for(size_t i = 0; i < m_refines_per_scale; i++)
-			restore_local_distances_pass(intrinsic, nf, m_neighborCount, m_rand);
+			refiner.run(intrinsic, nf, m_neighborCount, m_rand);
+		if(m_trackProgress)
+		{
+			GVec& row = m_progress.newRow();
+			row[0] = (double)pass;
+			row[1] = stress(intrinsic, nf, m_neighborCount);
+			row[2] = GTime::seconds() - startTime;
+		}
 
 		// Train the encoder
 		if(pVisible)
@@ -1826,6 +2771,55 @@ GMatrix* GScalingUnfolder::reduce(const GMatrix& in)
 	return pca.transformBatch(intrinsic);
 }
 
+// static
+void GScalingUnfolder::test()
+{
+	GRand rand(0);
+	GMatrix data(300, 3);
+	GManifoldSculpting_makeSheet(data, rand);
+	GKdTree kdtree(&data, NULL, false);
+	GNeighborGraph ng(&kdtree, false, 10);
+
+	// Unfolding should restore the local distances
+	GScalingUnfolder su;
+	su.setNeighborCount(10);
+	su.setPasses(20);
+	su.setRefinesPerScale(20);
+	su.setPartSize(40);
+	su.trackProgress();
+	GMatrix intrinsic(data);
+	su.unfold(intrinsic, ng);
+	if(su.progress().rows() != 20)
+		throw Ex("wrong number of progress rows");
+	if(su.progress()[19][1] > 0.01)
+		throw Ex("too much stress");
+
+	// The results should not depend on the number of threads
+	GMatrix* pResults[2];
+	for(size_t i = 0; i < 2; i++)
+	{
+		GScalingUnfolder su2;
+		su2.setNeighborCount(10);
+		su2.setPasses(2);
+		su2.setRefinesPerScale(2);
+		su2.setWorkerThreads(i == 0 ? 1 : 3);
+		su2.setPartSize(40);
+		pResults[i] = new GMatrix(data);
+		su2.unfold(*pResults[i], ng);
+	}
+	std::unique_ptr<GMatrix> hA(pResults[0]);
+	std::unique_ptr<GMatrix> hB(pResults[1]);
+	if(pResults[0]->sumSquaredDifference(*pResults[1]) != 0.0)
+		throw Ex("The results depend on the number of threads");
+
+	// The sheet should be unrolled, so the points at the ends should be far apart
+	double maxDist = 0.0;
+	for(size_t i = 0; i < data.rows(); i++)
+		maxDist = std::max(maxDist, intrinsic.row(i).squaredDistance(intrinsic.row(0)));
+	if(sqrt(maxDist) < 5.0)
+		throw Ex("The sheet was not unrolled");
+}
+
 
 
 
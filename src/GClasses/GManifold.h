@@ -34,6 +34,8 @@ class GNeighborFinderGeneralizing;
 class GNeuralNetLearner;
 class GNeuralNetLayer;
 class GNeighborGraph;
+class GMasterThread;
+class GManifoldSculptingWorker;
 
 
 /// This class stores static methods that are useful for manifold learning
@@ -71,8 +73,12 @@ public:
 /// non-linear dimensionality reduction with manifold sculpting. In Advances
 /// in Neural Information Processing Systems 20, pages 513–520, MIT Press,
 /// Cambridge, MA, 2008.)
+/// Each pass adjusts the points in breadth-first order from a seed point. With multiple worker threads,
+/// the points are partitioned into stages, such that points in the same stage do not read each other's
+/// locations, and the points in each stage are adjusted concurrently.
 class GManifoldSculpting : public GTransform
 {
+friend class GManifoldSculptingWorker;
 protected:
 	size_t m_nDimensions;
 	size_t m_nNeighbors;
@@ -92,11 +98,31 @@ protected:
 	GMatrix* m_pData;
 	unsigned char* m_pMetaData;
 	GNeighborFinderGeneralizing* m_pNF;
+	size_t m_workerThreads;
+	GMasterThread* m_pMaster; // The workers used by parallelPass. They are kept between passes, so they only start once.
+	std::vector<size_t> m_conflictStart; // The index in m_conflicts where the conflicts of each point begin
+	std::vector<size_t> m_conflicts; // The points that each point reads, or that read it
+	bool m_trackProgress;
+	GMatrix m_progress;
+	double m_startTime;
+
+	// The current pass
+	std::vector<size_t> m_order; // The points in breadth-first order
+	std::vector<size_t> m_stageOrder; // The points, sorted by stage
+	std::vector<size_t> m_stageStart; // The index in m_stageOrder where each stage begins
+	size_t m_jobStage;
+	size_t m_jobSeed;
+	uint64_t m_passSeed;
+	std::vector<size_t> m_pointSteps;
+	std::vector<double> m_pointErrors;
 
 public:
 	GManifoldSculpting(size_t nNeighbors, size_t targetDims, GRand* pRand);
 	virtual ~GManifoldSculpting();
 
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
 	/// Perform NLDR.
 	virtual GMatrix* reduce(const GMatrix& in);
 
@@ -114,6 +140,21 @@ public:
 	/// Set the rate of squishing. (.99 is a good value)
 	void setSquishingRate(double d) { m_dSquishingRate = d; }
 
+	/// Specify the number of worker threads to use for adjusting the points. The default is 1.
+	/// (The results do not depend on the number of threads.)
+	void setWorkerThreads(size_t n);
+
+	/// Record the pass number, the stress, and the elapsed seconds after each call to squishPass.
+	void trackProgress() { m_trackProgress = true; }
+
+	/// Returns a matrix with one row for each pass since beginTransform was called, if trackProgress
+	/// was called. The columns are the pass number, the stress, and the elapsed seconds.
+	GMatrix& progress() { return m_progress; }
+
+	/// Returns the stress of the current points. This is the sum over all neighbor pairs of the squared
+	/// difference between the current and original distances, divided by the sum of squared original distances.
+	double stress();
+
 	/// Returns the current learning rate
 	double learningRate() { return m_dLearningRate; }
 
@@ -168,16 +209,29 @@ protected:
 	double vectorCorrelation(const double* pdA, const double* pdV, const double* pdB);
 	double vectorCorrelation2(double squaredScale, size_t a, size_t vertex, struct GManifoldSculptingNeighbor* pNeighborRec);
 	double computeError(size_t nPoint);
-	size_t adjustDataPoint(size_t nPoint, double* pError);
+	size_t adjustDataPoint(size_t nPoint, double* pError, GRand& rand);
 	double averageNeighborDistance(size_t nDims);
 	void moveMeanToOrigin();
+
+	/// Finds the pairs of points that cannot be adjusted concurrently, because one reads the location of the other.
+	void findConflicts();
+
+	/// Adjusts the points in m_order, one stage at a time, with worker threads.
+	void parallelPass();
+
+	/// Adjusts one block of the points in the current stage.
+	void doJob(size_t job);
+
+	/// Adjusts one point, and records its steps and error for the current pass.
+	void adjustPoint(size_t nPoint);
 };
 
 
-/// Isomap is a manifold learning algorithm that uses the Floyd-Warshall algorithm
-/// to compute an estimate of the geodesic distance between every pair of points
-/// using local neighborhoods, and then uses classic multidimensional scaling to
-/// compute a low-dimensional projection.
+/// Isomap is a manifold learning algorithm that uses Dijkstra's algorithm on the graph
+/// of local neighborhoods to compute an estimate of the geodesic distance between every
+/// pair of points, and then uses classic multidimensional scaling to compute a
+/// low-dimensional projection. With landmarks, geodesic distances are only computed
+/// from a few points, so it scales to much larger datasets.
 class GIsomap : public GTransform
 {
 protected:
@@ -186,12 +240,24 @@ protected:
 	GNeighborFinder* m_pNF;
 	GRand* m_pRand;
 	bool m_dropDisconnectedPoints;
+	size_t m_landmarks;
+	size_t m_workerThreads;
+
+	// The model used for out-of-sample extension (only when landmarks are used)
+	GMatrix m_trainData;
+	GMatrix m_landmarkCosts;
+	GMatrix m_landmarkMap;
+	GVec m_meanSquaredCosts;
+	GNeighborFinderGeneralizing* m_pExtendNF;
 
 public:
 	GIsomap(size_t neighborCount, size_t targetDims, GRand* pRand);
 	GIsomap(GDomNode* pNode);
 	virtual ~GIsomap();
 
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
 	/// Serializes this object
 	GDomNode* serialize(GDom* pDoc) const;
 
@@ -206,13 +272,37 @@ public:
 	/// specified to the constructor, and ignore the data passed to the "transform" method.
 	void setNeighborFinder(GNeighborFinder* pNF);
 
+	/// Specifies to use Landmark Isomap with n randomly chosen landmarks. Geodesic distances are only computed
+	/// from the landmarks, which takes O(n * points * log(points)) time and O(n * points) memory, and the landmarks
+	/// are embedded with classic MDS, then every other point is placed by triangulating from the landmarks.
+	/// If n is 0 (the default), geodesic distances are computed between all pairs of points, as in classic Isomap.
+	void setLandmarks(size_t n) { m_landmarks = n; }
+
+	/// Specify the number of worker threads to use for computing geodesic distances. The default is 1.
+	void setWorkerThreads(size_t n) { m_workerThreads = n; }
+
 	/// Performs NLDR
 	virtual GMatrix* reduce(const GMatrix& in);
+
+	/// Computes the low-dimensional coordinates of a point that was not in the training data. The geodesic distance
+	/// from each landmark to the new point is estimated through its nearest neighbors in the training data. This
+	/// requires that reduce was previously called with landmarks.
+	void extend(const GVec& in, GVec& out);
+
+protected:
+	/// Performs Landmark Isomap with the specified neighborhood graph.
+	GMatrix* reduceWithLandmarks(const GMatrix& in, GNeighborFinder* pNF);
+
+	/// Maps the squared geodesic distances from each landmark to a point to low-dimensional coordinates.
+	void triangulate(const GVec& squaredCosts, GVec& out);
 };
 
 
 /// Locally Linear Embedding is a manifold learning algorithm that uses
 /// sparse matrix techniques to efficiently compute a low-dimensional projection.
+/// The reconstruction weights are stored with k values per point, and the bottom
+/// eigenvectors are found with a restarted block Krylov method that only needs
+/// sparse matrix-vector products, so it scales linearly with the number of points.
 class GLLE : public GTransform
 {
 protected:
@@ -220,12 +310,19 @@ protected:
 	size_t m_targetDims;
 	GNeighborFinder* m_pNF;
 	GRand* m_pRand;
+	size_t m_workerThreads;
 
 public:
 	GLLE(size_t neighborCount, size_t targetDims, GRand* pRand);
 	GLLE(GDomNode* pNode);
 	virtual ~GLLE();
 
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
+	/// Specify the number of worker threads to use. The default is 1. (The results do not depend on the number of threads.)
+	void setWorkerThreads(size_t n) { m_workerThreads = n; }
+
 	/// Serialize this object
 	GDomNode* serialize(GDom* pDoc) const;
 
@@ -302,6 +399,10 @@ protected:
 	size_t m_refines_per_scale;
 	double m_scaleRate;
 	GRand m_rand;
+	size_t m_workerThreads;
+	size_t m_partSize;
+	bool m_trackProgress;
+	GMatrix m_progress;
 
 public:
 	GScalingUnfolder();
@@ -326,6 +427,31 @@ public:
 	/// Returns a reference to the pseudo-random number generator used by this object
 	GRand& rand() { return m_rand; }
 
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
+	/// Specify the number of worker threads to use for refining the points. The default is 1.
+	/// (The results do not depend on the number of threads.)
+	void setWorkerThreads(size_t n) { m_workerThreads = n; }
+
+	/// Specify the maximum number of points in each part. Before unfolding, the points are split into
+	/// spatially compact parts. In each refinement pass, the edges within each part are refined concurrently,
+	/// then the edges between parts are refined. Smaller parts allow more concurrency, but more of the edges
+	/// will be between parts. The default is 2048.
+	void setPartSize(size_t n) { m_partSize = n; }
+
+	/// Record the pass number, the stress, and the elapsed seconds after each scaling pass.
+	void trackProgress() { m_trackProgress = true; }
+
+	/// Returns a matrix with one row for each scaling pass, if trackProgress was called.
+	/// The columns are the pass number, the stress, and the elapsed seconds.
+	GMatrix& progress() { return m_progress; }
+
+	/// Returns the stress of intrinsic with respect to the neighbor distances in ng. This is the sum over all
+	/// edges of the squared difference between the current and target distances, divided by the sum of
+	/// squared target distances.
+	static double stress(const GMatrix& intrinsic, GNeighborGraph& ng, size_t neighborCount);
+
 	/// Reduces the dimensionality of "in".
 	virtual GMatrix* reduce(const GMatrix& in);
 
@@ -35,6 +35,7 @@
 #include "GRand.h"
 #include "GTokenizer.h"
 #include "GTime.h"
+#include "GTruncatedSVD.h"
 #include <algorithm>
 #include <fstream>
 #include <sstream>
@@ -198,6 +199,13 @@ void GRelation::printRow(ostream& stream, const double* pRow, char separator, co
 
 void GRelation::save(const GMatrix* pData, const char* szFilename) const
 {
+	if(GCompressor::isCompressedFilename(szFilename))
+	{
+		GCompressedOStream cs(szFilename);
+		pData->print(cs);
+		cs.close();
+		return;
+	}
 	std::ofstream stream;
 	stream.exceptions(std::ios::badbit | std::ios::failbit);
 	try
@@ -1223,20 +1231,33 @@ void GMatrix::loadArff(const char* szFilename, size_t maxRows)
 void GMatrix::loadRaw(const char* szFilename)
 {
 	size_t r, c;
-	std::ifstream fin(szFilename, std::ios::in | std::ios::binary);
-	if(fin.fail())
-		throw Ex("Error while trying to open the file, ", szFilename, ". ", strerror(errno));
+	std::unique_ptr<std::istream> hIn;
+	if(GCompressor::isCompressedFile(szFilename))
+	{
+		hIn.reset(new GCompressedIStream(szFilename));
+		hIn->exceptions(std::ios::badbit);
+	}
+	else
+	{
+		hIn.reset(new std::ifstream(szFilename, std::ios::in | std::ios::binary));
+		if(hIn->fail())
+			throw Ex("Error while trying to open the file, ", szFilename, ". ", strerror(errno));
+	}
+	std::istream& fin = *hIn;
 	fin.read((char *) &r, sizeof(size_t));
 	fin.read((char *) &c, sizeof(size_t));
 	resize(r, c);
 	for(size_t i = 0; i < r; i++)
 		fin.read((char *) m_rows[i]->data(), sizeof(double) * c);
-	fin.close();
 }
 
 void GMatrix::load(const char* szFilename)
 {
-	const char *extPos = strrchr(szFilename, '.');
+	// The extension before ".gcz" describes the content of a compressed file
+	string name(szFilename);
+	if(GCompressor::isCompressedFilename(szFilename))
+		name.resize(name.size() - 4);
+	const char *extPos = strrchr(name.c_str(), '.');
 	if(extPos)
 	{
 		string ext(extPos+1);
@@ -1260,14 +1281,26 @@ void GMatrix::saveArff(const char* szFilename)
 
 void GMatrix::saveRaw(const char* szFilename)
 {
+	if(GCompressor::isCompressedFilename(szFilename))
+	{
+		GCompressedOStream cs(szFilename);
+		writeRaw(cs);
+		cs.close();
+		return;
+	}
 	std::ofstream fout(szFilename, std::ios::out | std::ios::binary);
+	writeRaw(fout);
+	fout.close();
+}
+
+void GMatrix::writeRaw(std::ostream& stream)
+{
 	size_t r = rows();
 	size_t c = cols();
-	fout.write((char *) &r, sizeof(size_t));
-	fout.write((char *) &c, sizeof(size_t));
+	stream.write((char *) &r, sizeof(size_t));
+	stream.write((char *) &c, sizeof(size_t));
 	for(size_t i = 0; i < r; i++)
-		fout.write((char *) m_rows[i]->data(), sizeof(double) * c);
-	fout.close();
+		stream.write((char *) m_rows[i]->data(), sizeof(double) * c);
 }
 
 // static
@@ -1310,6 +1343,21 @@ GDomNode* GMatrix::serialize(GDom* pDoc) const
 	return pData;
 }
 
+void GMatrix::serializeStream(GJsonWriter& writer) const
+{
+	GDom doc;
+	size_t attrCount = m_pRelation->size();
+	writer.beginObj();
+	writer.key("rel");
+	writer.writeNode(m_pRelation->serialize(&doc));
+	writer.key("vals");
+	writer.beginList();
+	for(size_t i = 0; i < rows(); i++)
+		writer.writeDoubles(row(i).data(), attrCount);
+	writer.endList();
+	writer.endObj();
+}
+
 
 void GMatrix::col(size_t index, double* pOutVector)
 {
@@ -2445,42 +2493,27 @@ GMatrix* GMatrix::eigs(size_t nCount, GVec& eigenVals, GRand* pRand, bool mostSi
 	}
 */
 
-	// Use the power method to compute the first few eigenvectors. todo: we really should use the Lanczos method instead
-	GMatrix* pOut = new GMatrix(m_pRelation->cloneMinimal());
-	pOut->newRows(nCount);
-	GMatrix* pA;
-	if(mostSignificant)
-	{
-		pA = new GMatrix();
-		pA->copy(*this);
-	}
-	else
+	GMatrix* pA = NULL;
+	if(!mostSignificant)
 		pA = pseudoInverse();
 	std::unique_ptr<GMatrix> hA(pA);
-	GVec pTemp(dims);
+
+	// For a symmetric matrix, the singular vectors are the eigenvectors, and the singular values are the magnitudes
+	// of the eigenvalues. The sign of each eigenvalue is revealed by whether the left and right singular vectors agree.
+	GTruncatedSVD svd(nCount);
+	svd.setIterations(10);
+	svd.setOversample(std::max((size_t)10, nCount));
+	svd.compute(pA ? *pA : *this, *pRand);
+	GMatrix* pOut = new GMatrix(m_pRelation->cloneMinimal());
+	pOut->newRows(nCount);
 	for(size_t i = 0; i < nCount; i++)
 	{
-		// Use the power method to compute the next eigenvector
-		GVec& x = pOut->row(i);
-		x.fillSphericalShell(*pRand);
-		for(size_t j = 0; j < 100; j++) // todo: is there a better way to detect convergence?
-		{
-			pA->multiply(x, pTemp);
-			x.copy(pTemp);
-			x.normalize();
-		}
-
-		// Compute the corresponding eigenvalue
-		double lambda = pA->eigenValue(x);
-		eigenVals[i] = lambda;
-
-		// Deflate (subtract out the eigenvector)
+		const GVec& v = svd.v()[i];
+		double d = 0.0;
 		for(size_t j = 0; j < dims; j++)
-		{
-			GVec& r = pA->row(j);
-			for(size_t k = 0; k < dims; k++)
-				r[k] = r[k] - lambda * x[j] * x[k];
-		}
+			d += svd.u()[j][i] * v[j];
+		eigenVals[i] = (d < 0.0 ? -svd.singularValues()[i] : svd.singularValues()[i]);
+		pOut->row(i).copy(v);
 	}
 
 	return pOut;
@@ -4747,6 +4780,51 @@ void GMatrix_testImport()
 		throw Ex("failed");
 }
 
+void GMatrix_testCompressedFile(GRand& prng)
+{
+	GMatrix m(300, 3);
+	for(size_t i = 0; i < m.rows(); i++)
+	{
+		m[i][0] = (double)(i % 7);
+		m[i][1] = prng.normal();
+		m[i][2] = (double)i;
+	}
+	for(size_t raw = 0; raw < 2; raw++)
+	{
+		char buf[256];
+		GFile::tempFilename(buf);
+		string filename = buf;
+		filename += (raw ? ".raw.gcz" : ".arff.gcz");
+		GMatrix m2;
+		try
+		{
+			if(raw)
+				m.saveRaw(filename.c_str());
+			else
+				m.saveArff(filename.c_str());
+			if(!GCompressor::isCompressedFile(filename.c_str()))
+				throw Ex("not compressed");
+			m2.load(filename.c_str());
+		}
+		catch(...)
+		{
+			GFile::deleteFile(filename.c_str());
+			throw;
+		}
+		GFile::deleteFile(filename.c_str());
+		if(m2.rows() != m.rows() || m2.cols() != m.cols())
+			throw Ex("wrong size");
+		for(size_t i = 0; i < m.rows(); i++)
+		{
+			for(size_t j = 0; j < m.cols(); j++)
+			{
+				if(std::abs(m2[i][j] - m[i][j]) > 1e-12)
+					throw Ex("wrong value");
+			}
+		}
+	}
+}
+
 // static
 void GMatrix::test()
 {
@@ -4767,6 +4845,7 @@ void GMatrix::test()
 	GMatrix_testWilcoxon();
 	GMatrix_testBoundingSphere(prng);
 	GMatrix_testImport();
+	GMatrix_testCompressedFile(prng);
 }
 
 std::string to_str(const GMatrix& m){
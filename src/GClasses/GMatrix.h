@@ -44,6 +44,7 @@ class GPrediction;
 class GRand;
 class GDom;
 class GDomNode;
+class GJsonWriter;
 class GArffTokenizer;
 class GDistanceMetric;
 class GSimpleAssignment;
@@ -135,7 +136,7 @@ public:
 	/// \brief Load from a DOM.
 	static GRelation* deserialize(const GDomNode* pNode);
 
-	/// \brief Saves to a file
+	/// \brief Saves to a file. If szFilename ends with ".gcz", the file is compressed with GCompressedOStream.
 	void save(const GMatrix* pData, const char* szFilename) const;
 
 	/// \brief Performs unit tests for this class. Throws an exception
@@ -610,9 +611,11 @@ public:
 	void loadArff(const char* szFilename, size_t maxRows = (size_t)-1);
 
 	/// \brief Loads a raw (binary) file and replaces the contents of this matrix with it.
+	/// If the file was written by GCompressedOStream, it is decompressed as it is read.
 	void loadRaw(const char* szFilename);
 
-	/// \brief Loads a file and automatically detects ARFF or raw (binary)
+	/// \brief Loads a file and automatically detects ARFF or raw (binary).
+	/// Compressed files (with names like "data.arff.gcz" or "data.raw.gcz") are decompressed incrementally as they are read.
 	void load(const char* szFilename);
 
 	/// \brief Parses an ARFF file and replaces the contents of this matrix with it.
@@ -648,8 +651,8 @@ public:
 	void mergeVert(GMatrix* pData, bool ignoreMismatchingName = false);
 
 	/// \brief Computes nCount eigenvectors and the corresponding
-	/// eigenvalues using the power method (which is only accurate if a
-	/// small number of eigenvalues/vectors are needed.)
+	/// eigenvalues of a symmetric matrix using a randomized block Krylov
+	/// method (which is only efficient if a small number of eigenvalues/vectors are needed.)
 	///
 	/// If mostSignificant is true, the largest eigenvalues are
 	/// found. If mostSignificant is false, the smallest eigenvalues are
@@ -705,9 +708,13 @@ public:
 	/// \brief Saves this matrix to a file in ARFF format
 	void saveArff(const char* szFilename);
 
-	/// \brief Saves this matrix to a file in raw (binary) format
+	/// \brief Saves this matrix to a file in raw (binary) format.
+	/// If szFilename ends with ".gcz", the file is compressed with GCompressedOStream.
 	void saveRaw(const char* szFilename);
 
+	/// \brief Writes this matrix to a stream in raw (binary) format
+	void writeRaw(std::ostream& stream);
+
 	/// \brief Performs SVD on A, where A is this m-by-n matrix.
 	///
 	/// You are responsible to delete(*ppU), delete(*ppV), and delete[]
@@ -762,6 +769,10 @@ public:
 	/// \brief Marshalls this object to a DOM, which may be saved to a variety of serial formats.
 	GDomNode* serialize(GDom* pDoc) const;
 
+	/// \brief Writes this matrix to writer in JSON format, the same as the node returned by serialize,
+	/// one row at a time, without building nodes for the values.
+	void serializeStream(GJsonWriter& writer) const;
+
 	/// \brief Returns the sum of the diagonal elements
 	double trace();
 
@@ -0,0 +1,869 @@
+/*
+  The contents of this file are dedicated by all of its authors, including
+
+    Michael S. Gashler,
+    anonymous contributors,
+
+  to the public domain (http://creativecommons.org/publicdomain/zero/1.0/).
+
+  Note that some moral obligations still exist in the absence of legal ones.
+  For example, it would still be dishonest to deliberately misrepresent the
+  origin of a work. Although we impose no legal requirements to obtain a
+  license, it is beseeming for those who build on the works of others to
+  give back useful improvements, or find a way to pay it forward. If
+  you would like to cite us, a published paper about Waffles can be found
+  at http://jmlr.org/papers/volume12/gashler11a/gashler11a.pdf. If you find
+  our code to be useful, the Waffles team would love to hear how you use it.
+*/
+
+#include "GModelServer.h"
+#include "GLearner.h"
+#include "GRecommender.h"
+#include "GLinear.h"
+#include "GDom.h"
+#include "GMatrix.h"
+#include "GRand.h"
+#include "GError.h"
+#include "GThread.h"
+#include "GTime.h"
+#include <sstream>
+#include <memory>
+#include <deque>
+#include <cmath>
+#include <algorithm>
+#ifndef WINDOWS
+#	include <unistd.h>
+#	include <fcntl.h>
+#	include <poll.h>
+#	include <errno.h>
+#	include <string.h>
+#endif
+#ifdef __linux__
+#	include <sys/socket.h>
+#	include <netinet/in.h>
+#endif
+
+using std::string;
+using std::vector;
+
+namespace GClasses {
+
+GLogHistogram::GLogHistogram(double unit)
+: m_unit(unit), m_count(0), m_sum(0.0), m_max(0.0)
+{
+}
+
+void GLogHistogram::add(double x)
+{
+	size_t i = 0;
+	double bound = m_unit;
+	while(x > bound && i < 1000)
+	{
+		bound *= 2.0;
+		i++;
+	}
+	if(i >= m_counts.size())
+		m_counts.resize(i + 1, 0);
+	m_counts[i]++;
+	m_count++;
+	m_sum += x;
+	m_max = std::max(m_max, x);
+}
+
+void GLogHistogram::clear()
+{
+	m_counts.clear();
+	m_count = 0;
+	m_sum = 0.0;
+	m_max = 0.0;
+}
+
+double GLogHistogram::upperBound(size_t i) const
+{
+	return std::ldexp(m_unit, (int)i);
+}
+
+double GLogHistogram::quantile(double q) const
+{
+	if(m_count == 0)
+		return 0.0;
+	size_t target = std::max((size_t)1, (size_t)std::ceil(q * m_count));
+	size_t sum = 0;
+	for(size_t i = 0; i < m_counts.size(); i++)
+	{
+		sum += m_counts[i];
+		if(sum >= target)
+			return upperBound(i);
+	}
+	return upperBound(m_counts.size() - 1);
+}
+
+GDomNode* GLogHistogram::serialize(GDom* pDoc) const
+{
+	GDomNode* pNode = pDoc->newObj();
+	pNode->add(pDoc, "count", m_count);
+	pNode->add(pDoc, "mean", mean());
+	pNode->add(pDoc, "p50", quantile(0.5));
+	pNode->add(pDoc, "p99", quantile(0.99));
+	pNode->add(pDoc, "max", m_max);
+	GDomNode* pBuckets = pNode->add(pDoc, "buckets", pDoc->newList());
+	for(size_t i = 0; i < m_counts.size(); i++)
+	{
+		if(m_counts[i] == 0)
+			continue;
+		GDomNode* pBucket = pBuckets->add(pDoc, pDoc->newObj());
+		pBucket->add(pDoc, "le", upperBound(i));
+		pBucket->add(pDoc, "count", m_counts[i]);
+	}
+	return pNode;
+}
+
+
+
+
+/// One model that is being served. Each worker thread and each batcher has its own copy.
+class GModelServerModel
+{
+public:
+	string m_name;
+	vector<GSupervisedLearner*> m_learners;
+	vector<GCollaborativeFilter*> m_filters;
+	size_t m_featureDims;
+	size_t m_labelDims;
+	std::deque<GModelServerPending*> m_pending; // Requests that are waiting for the batcher
+	size_t m_pendingRows;
+
+	GModelServerModel(const char* szName) : m_name(szName), m_featureDims(0), m_labelDims(0), m_pendingRows(0)
+	{
+	}
+
+	~GModelServerModel()
+	{
+		for(size_t i = 0; i < m_learners.size(); i++)
+			delete(m_learners[i]);
+		for(size_t i = 0; i < m_filters.size(); i++)
+			delete(m_filters[i]);
+	}
+};
+
+
+/// A request that is waiting to be scored in a batch
+class GModelServerPending
+{
+public:
+	GHttpEventJob* m_pJob;
+	GMatrix m_rows;
+	bool m_binary;
+	double m_time;
+
+	GModelServerPending() : m_pJob(NULL), m_binary(false), m_time(0.0) {}
+};
+
+
+class GModelServerBatcher : public GThread
+{
+protected:
+	GModelServer* m_pServer;
+	size_t m_replica;
+
+public:
+	GModelServerBatcher(GModelServer* pServer, size_t replica) : GThread(), m_pServer(pServer), m_replica(replica) {}
+	virtual ~GModelServerBatcher() {}
+
+	virtual void run()
+	{
+		while(!m_pServer->m_stopBatchers)
+			m_pServer->scoreBatch(m_replica, 0.1);
+	}
+};
+
+
+GModelServer::GModelServer(unsigned short port, size_t workerThreads)
+: GHttpEventServer(port, workerThreads),
+m_maxBatch(0),
+m_maxWait(0.0),
+m_batchThreads(0),
+m_stopBatchers(false),
+m_queueTimes(0.01),
+m_batchSizes(1.0),
+m_batchedRequests(0)
+{
+#ifndef WINDOWS
+	if(pipe(m_batchPipe) != 0)
+		throw Ex("Failed to make a pipe: ", strerror(errno));
+	fcntl(m_batchPipe[0], F_SETFL, fcntl(m_batchPipe[0], F_GETFL, 0) | O_NONBLOCK);
+	fcntl(m_batchPipe[1], F_SETFL, fcntl(m_batchPipe[1], F_GETFL, 0) | O_NONBLOCK);
+#endif
+	m_pBatchLock = new GSpinLock();
+	m_pStatsLock = new GSpinLock();
+}
+
+// virtual
+GModelServer::~GModelServer()
+{
+	stop();
+	stopBatching();
+	for(std::map<string, GModelServerModel*>::iterator it = m_models.begin(); it != m_models.end(); it++)
+		delete(it->second);
+#ifndef WINDOWS
+	close(m_batchPipe[0]);
+	close(m_batchPipe[1]);
+#endif
+	delete(m_pBatchLock);
+	delete(m_pStatsLock);
+}
+
+void GModelServer::setBatching(size_t maxBatch, double maxWaitMs, size_t batchThreads)
+{
+	if(m_models.size() > 0)
+		throw Ex("Batching must be enabled before any models are added");
+	if(maxBatch < 1 || batchThreads < 1)
+		throw Ex("Expected a batch size and a number of threads of at least 1");
+	m_maxBatch = maxBatch;
+	m_maxWait = 0.001 * maxWaitMs;
+	m_batchThreads = batchThreads;
+}
+
+void GModelServer::addModel(const char* szName, const GDomNode* pModel)
+{
+	if(m_models.find(szName) != m_models.end())
+		throw Ex("There is already a model named ", szName);
+	std::unique_ptr<GModelServerModel> hModel(new GModelServerModel(szName));
+	GModelServerModel* pM = hModel.get();
+	GLearnerLoader llFilter(false);
+	GLearnerLoader llLearner(true);
+	for(size_t i = 0; i < m_workerThreads + m_batchThreads; i++)
+	{
+		GCollaborativeFilter* pFilter = llFilter.loadCollaborativeFilter(pModel);
+		if(pFilter)
+			pM->m_filters.push_back(pFilter);
+		else
+		{
+			GSupervisedLearner* pLearner = llLearner.loadLearner(pModel);
+			pM->m_learners.push_back(pLearner);
+			pLearner->rand().setSeed(i);
+			pM->m_featureDims = pLearner->relFeatures().size();
+			pM->m_labelDims = pLearner->relLabels().size();
+		}
+	}
+	m_models[szName] = hModel.release();
+}
+
+void GModelServer::addModel(const char* szName, const GSupervisedLearner& model)
+{
+	GDom doc;
+	addModel(szName, model.serialize(&doc));
+}
+
+void GModelServer::addModel(const char* szName, const GCollaborativeFilter& model)
+{
+	GDom doc;
+	addModel(szName, model.serialize(&doc));
+}
+
+void GModelServer::loadModel(const char* szName, const char* szFilename)
+{
+	GDom doc;
+	doc.loadJson(szFilename);
+	addModel(szName, doc.root());
+}
+
+GModelServerModel* GModelServer::findModel(const string& url)
+{
+	if(url.length() <= 9) // "/predict" or "/predict/"
+	{
+		if(m_models.size() != 1)
+			return NULL;
+		return m_models.begin()->second;
+	}
+	std::map<string, GModelServerModel*>::iterator it = m_models.find(url.substr(9));
+	if(it == m_models.end())
+		return NULL;
+	return it->second;
+}
+
+/// Formats an error as a JSON response
+void GModelServer_error(int status, const char* szMessage, GHttpResponse& response)
+{
+	response.status = status;
+	GDom doc;
+	GDomNode* pRoot = doc.newObj();
+	pRoot->add(&doc, "error", szMessage);
+	doc.setRoot(pRoot);
+	std::ostringstream os;
+	doc.writeJson(os);
+	response.contentType = "application/json";
+	response.body = os.str();
+}
+
+// virtual
+void GModelServer::handleRequest(size_t worker, const GHttpRequest& request, GHttpResponse& response)
+{
+	response.contentType = "application/json";
+	try
+	{
+		if(request.url.compare("/models") == 0)
+			listModels(response);
+		else if(request.url.compare("/stats") == 0)
+		{
+			GDom doc;
+			doc.setRoot(stats(&doc));
+			std::ostringstream os;
+			doc.writeJson(os);
+			response.body = os.str();
+		}
+		else if(request.url.compare(0, 8, "/predict") == 0 && (request.url.length() == 8 || request.url[8] == '/'))
+		{
+			if(request.method.compare("POST") != 0)
+			{
+				response.status = 405;
+				throw Ex("Predictions must be requested with POST");
+			}
+			GModelServerModel* pModel = findModel(request.url);
+			if(!pModel)
+			{
+				response.status = 404;
+				throw Ex("No such model");
+			}
+			if(pModel->m_learners.size() > 0)
+				predictRows(pModel, worker, request, response);
+			else
+				predictPairs(pModel, worker, request, response);
+		}
+		else
+		{
+			response.status = 404;
+			throw Ex("Not found: ", request.url);
+		}
+	}
+	catch(std::exception& e)
+	{
+		GModelServer_error(response.status == 200 ? 400 : response.status, e.what(), response);
+	}
+}
+
+void GModelServer::listModels(GHttpResponse& response)
+{
+	GDom doc;
+	GDomNode* pRoot = doc.newObj();
+	GDomNode* pList = pRoot->add(&doc, "models", doc.newList());
+	for(std::map<string, GModelServerModel*>::iterator it = m_models.begin(); it != m_models.end(); it++)
+	{
+		GModelServerModel* pModel = it->second;
+		GDomNode* pM = pList->add(&doc, doc.newObj());
+		pM->add(&doc, "name", pModel->m_name.c_str());
+		if(pModel->m_learners.size() > 0)
+		{
+			pM->add(&doc, "type", "learner");
+			pM->add(&doc, "features", pModel->m_featureDims);
+			pM->add(&doc, "labels", pModel->m_labelDims);
+		}
+		else
+			pM->add(&doc, "type", "recommender");
+	}
+	doc.setRoot(pRoot);
+	std::ostringstream os;
+	doc.writeJson(os);
+	response.body = os.str();
+}
+
+/// Returns the list of rows or pairs in a JSON request
+const GDomNode* GModelServer_batch(GDom& doc, const GHttpRequest& request, const char* szField)
+{
+	doc.parseJson(request.body.c_str(), request.body.length());
+	const GDomNode* pBatch = doc.root();
+	if(pBatch->type() == GDomNode::type_obj)
+		pBatch = pBatch->get(szField);
+	if(pBatch->type() != GDomNode::type_list)
+		throw Ex("Expected a list of ", szField);
+	return pBatch;
+}
+
+void GModelServer::parseRows(GModelServerModel* pModel, const GHttpRequest& request, GMatrix& rows)
+{
+	size_t dims = pModel->m_featureDims;
+	if(request.contentType.compare("application/octet-stream") == 0)
+	{
+		size_t rowBytes = sizeof(double) * dims;
+		if(rowBytes == 0 || request.body.length() % rowBytes != 0)
+			throw Ex("Expected the body to contain rows of ", to_str(dims), " doubles");
+		size_t count = request.body.length() / rowBytes;
+		rows.resize(count, dims);
+		for(size_t i = 0; i < count; i++)
+			memcpy(rows[i].data(), request.body.data() + i * rowBytes, rowBytes);
+		return;
+	}
+	const GRelation& relFeatures = pModel->m_learners[0]->relFeatures();
+	GDom doc;
+	const GDomNode* pRows = GModelServer_batch(doc, request, "rows");
+	rows.resize(0, dims);
+	for(GDomListIterator it(pRows); it.remaining() > 0; it.advance())
+	{
+		GDomListIterator itVal(it.current());
+		if(itVal.remaining() != dims)
+			throw Ex("Expected each row to have ", to_str(dims), " values");
+		GVec& row = rows.newRow();
+		for(size_t j = 0; itVal.remaining() > 0; itVal.advance(), j++)
+		{
+			const GDomNode* pVal = itVal.current();
+			if(pVal->type() == GDomNode::type_null)
+				row[j] = (relFeatures.valueCount(j) == 0 ? UNKNOWN_REAL_VALUE : UNKNOWN_DISCRETE_VALUE);
+			else
+				row[j] = pVal->asDouble();
+		}
+	}
+}
+
+void GModelServer::writePredictions(const GMatrix& predictions, size_t start, size_t count, bool binary, GHttpResponse& response)
+{
+	size_t dims = predictions.cols();
+	if(binary)
+	{
+		response.contentType = "application/octet-stream";
+		response.body.resize(count * sizeof(double) * dims);
+		for(size_t i = 0; i < count; i++)
+			memcpy(&response.body[i * sizeof(double) * dims], predictions[start + i].data(), sizeof(double) * dims);
+		return;
+	}
+	GDom doc;
+	GDomNode* pRoot = doc.newObj();
+	GDomNode* pPredictions = pRoot->add(&doc, "predictions", doc.newList());
+	for(size_t i = 0; i < count; i++)
+	{
+		const GVec& pred = predictions[start + i];
+		GDomNode* pRow = pPredictions->add(&doc, doc.newList());
+		for(size_t j = 0; j < dims; j++)
+			pRow->add(&doc, pred[j]);
+	}
+	doc.setRoot(pRoot);
+	std::ostringstream os;
+	os.precision(17);
+	doc.writeJson(os);
+	response.contentType = "application/json";
+	response.body = os.str();
+}
+
+void GModelServer::predictRows(GModelServerModel* pModel, size_t worker, const GHttpRequest& request, GHttpResponse& response)
+{
+	bool binary = (request.contentType.compare("application/octet-stream") == 0);
+	std::unique_ptr<GModelServerPending> hPending(new GModelServerPending());
+	GModelServerPending* pPending = hPending.get();
+	parseRows(pModel, request, pPending->m_rows);
+	if(m_maxBatch > 0)
+	{
+		// Let the batcher score it with other requests
+		pPending->m_binary = binary;
+		pPending->m_time = GTime::seconds();
+		pPending->m_pJob = defer(response);
+		enqueue(pModel, hPending.release());
+		return;
+	}
+	GMatrix predictions;
+	pModel->m_learners[worker]->predictBatch(pPending->m_rows, predictions);
+	writePredictions(predictions, 0, predictions.rows(), binary, response);
+}
+
+void GModelServer::enqueue(GModelServerModel* pModel, GModelServerPending* pPending)
+{
+	bool wake;
+	{
+		GSpinLockHolder hLock(m_pBatchLock, "GModelServer::enqueue");
+		if(m_batchers.size() == 0)
+		{
+			for(size_t i = 0; i < m_batchThreads; i++)
+			{
+				GModelServerBatcher* pBatcher = new GModelServerBatcher(this, m_workerThreads + i);
+				m_batchers.push_back(pBatcher);
+				pBatcher->spawn();
+			}
+		}
+
+		// Wake up the batchers when there is a new deadline, or when a batch is full
+		wake = (pModel->m_pending.size() == 0 || (pModel->m_pendingRows < m_maxBatch && pModel->m_pendingRows + pPending->m_rows.rows() >= m_maxBatch));
+		pModel->m_pending.push_back(pPending);
+		pModel->m_pendingRows += pPending->m_rows.rows();
+	}
+#ifndef WINDOWS
+	if(wake)
+	{
+		char c = 0;
+		if(write(m_batchPipe[1], &c, 1) < 0) {} // (If the pipe is full, the batchers are already awake.)
+	}
+#endif
+}
+
+bool GModelServer::scoreBatch(size_t replica, double maxSleepSecs)
+{
+	// Find the model whose batch is ready and has waited the longest
+	GModelServerModel* pModel = NULL;
+	vector<GModelServerPending*> batch;
+	size_t rows = 0;
+	double wait = maxSleepSecs;
+	{
+		GSpinLockHolder hLock(m_pBatchLock, "GModelServer::scoreBatch");
+		double now = GTime::seconds();
+		double oldest = 1e308;
+		for(std::map<string, GModelServerModel*>::iterator it = m_models.begin(); it != m_models.end(); it++)
+		{
+			GModelServerModel* pM = it->second;
+			if(pM->m_pending.size() == 0)
+				continue;
+			double t = pM->m_pending.front()->m_time;
+			if(pM->m_pendingRows >= m_maxBatch || now - t >= m_maxWait)
+			{
+				if(t < oldest)
+				{
+					oldest = t;
+					pModel = pM;
+				}
+			}
+			else
+				wait = std::min(wait, t + m_maxWait - now);
+		}
+
+		// Take as many requests as fit in one batch
+		if(pModel)
+		{
+			while(pModel->m_pending.size() > 0 && (batch.size() == 0 || rows + pModel->m_pending.front()->m_rows.rows() <= m_maxBatch))
+			{
+				batch.push_back(pModel->m_pending.front());
+				rows += pModel->m_pending.front()->m_rows.rows();
+				pModel->m_pending.pop_front();
+			}
+			pModel->m_pendingRows -= rows;
+		}
+	}
+	if(!pModel)
+	{
+		// Sleep until the next deadline, or until a request arrives
+#ifndef WINDOWS
+		struct pollfd pfd;
+		pfd.fd = m_batchPipe[0];
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if(poll(&pfd, 1, std::max(1, (int)std::ceil(wait * 1000.0))) > 0)
+		{
+			char buf[64];
+			while(read(m_batchPipe[0], buf, sizeof(buf)) > 0)
+			{
+			}
+		}
+#else
+		GThread::sleep(1);
+#endif
+		return false;
+	}
+
+	// Score all of the rows at once
+	double start = GTime::seconds();
+	GMatrix in(rows, pModel->m_featureDims);
+	size_t pos = 0;
+	for(size_t i = 0; i < batch.size(); i++)
+	{
+		const GMatrix& r = batch[i]->m_rows;
+		for(size_t j = 0; j < r.rows(); j++)
+			in[pos++].copy(r[j]);
+	}
+	GMatrix out;
+	string error;
+	try
+	{
+		pModel->m_learners[replica]->predictBatch(in, out);
+	}
+	catch(std::exception& e)
+	{
+		error = e.what();
+	}
+
+	// Record the statistics (before any client can see the results)
+	{
+		GSpinLockHolder hLock(m_pStatsLock, "GModelServer::scoreBatch");
+		for(size_t i = 0; i < batch.size(); i++)
+			m_queueTimes.add(1000.0 * (start - batch[i]->m_time));
+		m_batchSizes.add((double)rows);
+		m_batchedRequests += batch.size();
+	}
+
+	// Scatter the results back to the requests
+	pos = 0;
+	for(size_t i = 0; i < batch.size(); i++)
+	{
+		GModelServerPending* pPending = batch[i];
+		size_t count = pPending->m_rows.rows();
+		GHttpResponse response;
+		if(error.length() > 0)
+			GModelServer_error(500, error.c_str(), response);
+		else
+			writePredictions(out, pos, count, pPending->m_binary, response);
+		pos += count;
+		complete(pPending->m_pJob, response);
+	}
+
+	for(size_t i = 0; i < batch.size(); i++)
+		delete(batch[i]);
+	return true;
+}
+
+void GModelServer::stopBatching()
+{
+	vector<GModelServerBatcher*> batchers;
+	{
+		GSpinLockHolder hLock(m_pBatchLock, "GModelServer::stopBatching");
+		batchers.swap(m_batchers);
+	}
+	if(batchers.size() > 0)
+	{
+		m_stopBatchers = true;
+#ifndef WINDOWS
+		char c = 0;
+		if(write(m_batchPipe[1], &c, 1) < 0) {}
+#endif
+		for(size_t i = 0; i < batchers.size(); i++)
+		{
+			batchers[i]->join(1);
+			delete(batchers[i]);
+		}
+		m_stopBatchers = false;
+	}
+
+	// Answer the requests that are still waiting
+	for(std::map<string, GModelServerModel*>::iterator it = m_models.begin(); it != m_models.end(); it++)
+	{
+		GModelServerModel* pModel = it->second;
+		while(pModel->m_pending.size() > 0)
+		{
+			GModelServerPending* pPending = pModel->m_pending.front();
+			pModel->m_pending.pop_front();
+			GHttpResponse response;
+			GModelServer_error(503, "The server is shutting down", response);
+			complete(pPending->m_pJob, response);
+			delete(pPending);
+		}
+		pModel->m_pendingRows = 0;
+	}
+}
+
+GDomNode* GModelServer::stats(GDom* pDoc)
+{
+	GSpinLockHolder hLock(m_pStatsLock, "GModelServer::stats");
+	GDomNode* pNode = pDoc->newObj();
+	pNode->add(pDoc, "requests", m_batchedRequests);
+	pNode->add(pDoc, "batches", m_batchSizes.count());
+	pNode->add(pDoc, "queue_ms", m_queueTimes.serialize(pDoc));
+	pNode->add(pDoc, "batch_rows", m_batchSizes.serialize(pDoc));
+	return pNode;
+}
+
+void GModelServer::predictPairs(GModelServerModel* pModel, size_t worker, const GHttpRequest& request, GHttpResponse& response)
+{
+	GCollaborativeFilter* pFilter = pModel->m_filters[worker];
+	if(request.contentType.compare("application/octet-stream") == 0)
+	{
+		size_t pairBytes = 2 * sizeof(double);
+		if(request.body.length() % pairBytes != 0)
+			throw Ex("Expected the body to contain pairs of doubles");
+		size_t pairs = request.body.length() / pairBytes;
+		response.contentType = "application/octet-stream";
+		response.body.resize(pairs * sizeof(double));
+		for(size_t i = 0; i < pairs; i++)
+		{
+			double pair[2];
+			memcpy(pair, request.body.data() + i * pairBytes, pairBytes);
+			if(pair[0] < 0.0 || pair[1] < 0.0)
+				throw Ex("Users and items must be non-negative");
+			double prediction = pFilter->predict((size_t)pair[0], (size_t)pair[1]);
+			memcpy(&response.body[i * sizeof(double)], &prediction, sizeof(double));
+		}
+		return;
+	}
+	GDom doc;
+	const GDomNode* pPairs = GModelServer_batch(doc, request, "pairs");
+	GDom docOut;
+	GDomNode* pRoot = docOut.newObj();
+	GDomNode* pPredictions = pRoot->add(&docOut, "predictions", docOut.newList());
+	for(GDomListIterator it(pPairs); it.remaining() > 0; it.advance())
+	{
+		const GDomNode* pPair = it.current();
+		if(pPair->size() != 2)
+			throw Ex("Expected each pair to contain a user and an item");
+		long long user = pPair->get((size_t)0)->asInt();
+		long long item = pPair->get((size_t)1)->asInt();
+		if(user < 0 || item < 0)
+			throw Ex("Users and items must be non-negative");
+		pPredictions->add(&docOut, pFilter->predict((size_t)user, (size_t)item));
+	}
+	docOut.setRoot(pRoot);
+	std::ostringstream os;
+	os.precision(17);
+	docOut.writeJson(os);
+	response.body = os.str();
+}
+
+#ifdef __linux__
+// (These are defined in GHttp.cpp.)
+SOCKET GHttpEventServer_connect(unsigned short port);
+void GHttpEventServer_send(SOCKET s, const string& request);
+int GHttpEventServer_receive(SOCKET s, string& buf, string& body);
+
+int GModelServer_post(SOCKET s, const char* szUrl, const char* szContentType, const string& payload, string& buf, string& body)
+{
+	std::ostringstream os;
+	os << "POST " << szUrl << " HTTP/1.1\r\nContent-Type: " << szContentType << "\r\nContent-Length: " << payload.length() << "\r\n\r\n" << payload;
+	GHttpEventServer_send(s, os.str());
+	return GHttpEventServer_receive(s, buf, body);
+}
+
+// static
+void GModelServer::test()
+{
+	// Train a regressor and a recommender
+	GRand rand(0);
+	GMatrix features(50, 3);
+	GMatrix labels(50, 2);
+	for(size_t i = 0; i < features.rows(); i++)
+	{
+		features[i].fillNormal(rand);
+		labels[i][0] = features[i][0] - 2.0 * features[i][1] + 0.5;
+		labels[i][1] = features[i][2] + 0.1 * rand.normal();
+	}
+	GLinearRegressor lr;
+	lr.train(features, labels);
+	GMatrix ratings(0, 3);
+	for(size_t i = 0; i < 40; i++)
+	{
+		GVec& r = ratings.newRow();
+		r[0] = (double)rand.next(5);
+		r[1] = (double)rand.next(4);
+		r[2] = (double)rand.next(6);
+	}
+	GBaselineRecommender rec;
+	rec.train(ratings);
+
+	GModelServer server(0, 2);
+	server.addModel("lin", lr);
+	server.addModel("rec", rec);
+	server.start();
+	SOCKET s = GHttpEventServer_connect(server.port());
+	string buf, body;
+
+	// Score a JSON batch
+	if(GModelServer_post(s, "/predict/lin", "application/json", "{\"rows\":[[0.5,-1,2],[0,0,0],[1.25,3,-0.5]]}", buf, body) != 200)
+		throw Ex("predict failed: ", body);
+	GDom doc;
+	doc.parseJson(body.c_str(), body.length());
+	const GDomNode* pPredictions = doc.root()->get("predictions");
+	if(pPredictions->size() != 3)
+		throw Ex("wrong number of predictions");
+	GVec in(3);
+	GVec out(2);
+	double rows[9] = { 0.5, -1, 2, 0, 0, 0, 1.25, 3, -0.5 };
+	for(size_t i = 0; i < 3; i++)
+	{
+		for(size_t j = 0; j < 3; j++)
+			in[j] = rows[3 * i + j];
+		lr.predict(in, out);
+		for(size_t j = 0; j < 2; j++)
+		{
+			if(std::abs(pPredictions->get(i)->get(j)->asDouble() - out[j]) > 1e-12)
+				throw Ex("wrong prediction");
+		}
+	}
+
+	// Score the same batch in binary
+	string payload((const char*)rows, sizeof(rows));
+	if(GModelServer_post(s, "/predict/lin", "application/octet-stream", payload, buf, body) != 200 || body.length() != 6 * sizeof(double))
+		throw Ex("binary predict failed");
+	for(size_t i = 0; i < 3; i++)
+	{
+		for(size_t j = 0; j < 3; j++)
+			in[j] = rows[3 * i + j];
+		lr.predict(in, out);
+		double pred[2];
+		memcpy(pred, body.data() + i * 2 * sizeof(double), 2 * sizeof(double));
+		if(std::abs(pred[0] - out[0]) > 1e-12 || std::abs(pred[1] - out[1]) > 1e-12)
+			throw Ex("wrong binary prediction");
+	}
+
+	// Score some pairs with the recommender
+	if(GModelServer_post(s, "/predict/rec", "application/json", "[[0,1],[3,2]]", buf, body) != 200)
+		throw Ex("predict failed: ", body);
+	doc.parseJson(body.c_str(), body.length());
+	pPredictions = doc.root()->get("predictions");
+	if(std::abs(pPredictions->get((size_t)0)->asDouble() - rec.predict(0, 1)) > 1e-12 || std::abs(pPredictions->get(1)->asDouble() - rec.predict(3, 2)) > 1e-12)
+		throw Ex("wrong recommendation");
+
+	// Check the errors
+	GExpectException ee;
+	if(GModelServer_post(s, "/predict", "application/json", "[[0,1]]", buf, body) != 404)
+		throw Ex("expected an ambiguous model to be not found");
+	if(GModelServer_post(s, "/predict/lin", "application/json", "[[1,2]]", buf, body) != 400)
+		throw Ex("expected a bad request");
+	if(GModelServer_post(s, "/predict/lin", "application/octet-stream", "abc", buf, body) != 400)
+		throw Ex("expected a bad request");
+	GHttpEventServer_send(s, "GET /models HTTP/1.1\r\n\r\n");
+	if(GHttpEventServer_receive(s, buf, body) != 200)
+		throw Ex("failed to list the models");
+	doc.parseJson(body.c_str(), body.length());
+	if(doc.root()->get("models")->size() != 2)
+		throw Ex("wrong number of models");
+	close(s);
+	server.stop();
+
+	// Send several small requests to a batching server on separate connections
+	GModelServer batching(0, 2);
+	batching.setBatching(8, 200.0);
+	batching.addModel("lin", lr);
+	batching.start();
+	SOCKET socks[4];
+	for(size_t i = 0; i < 4; i++)
+	{
+		socks[i] = GHttpEventServer_connect(batching.port());
+		string req = "{\"rows\":[[" + to_str(rows[0] + i) + ",-1,2],[0,0," + to_str(i) + "]]}";
+		GHttpEventServer_send(socks[i], "POST /predict/lin HTTP/1.1\r\nContent-Type: application/json\r\nContent-Length: " + to_str(req.length()) + "\r\n\r\n" + req);
+	}
+	for(size_t i = 0; i < 4; i++)
+	{
+		if(GHttpEventServer_receive(socks[i], buf, body) != 200)
+			throw Ex("batched predict failed: ", body);
+		doc.parseJson(body.c_str(), body.length());
+		pPredictions = doc.root()->get("predictions");
+		if(pPredictions->size() != 2)
+			throw Ex("wrong number of batched predictions");
+		in[0] = rows[0] + i; in[1] = -1; in[2] = 2;
+		lr.predict(in, out);
+		if(std::abs(pPredictions->get((size_t)0)->get((size_t)0)->asDouble() - out[0]) > 1e-12)
+			throw Ex("wrong batched prediction");
+		in[0] = 0; in[1] = 0; in[2] = (double)i;
+		lr.predict(in, out);
+		if(std::abs(pPredictions->get(1)->get(1)->asDouble() - out[1]) > 1e-12)
+			throw Ex("wrong batched prediction");
+	}
+
+	// A request that is bigger than a batch is scored by itself
+	string big = "[";
+	for(size_t i = 0; i < 10; i++)
+		big += (i > 0 ? ",[1,2," : "[1,2,") + to_str(i) + "]";
+	big += "]";
+	if(GModelServer_post(socks[0], "/predict/lin", "application/json", big, buf, body) != 200)
+		throw Ex("big predict failed: ", body);
+	doc.parseJson(body.c_str(), body.length());
+	if(doc.root()->get("predictions")->size() != 10)
+		throw Ex("wrong number of predictions");
+	GDomNode* pStats = batching.stats(&doc);
+	if(pStats->get("requests")->asInt() != 5)
+		throw Ex("wrong number of batched requests");
+	size_t batches = (size_t)pStats->get("batches")->asInt();
+	if(batches < 2 || batches > 4)
+		throw Ex("the requests were not batched");
+	if(pStats->get("batch_rows")->get("max")->asDouble() != 10.0)
+		throw Ex("expected the big request to be scored by itself");
+	for(size_t i = 0; i < 4; i++)
+		close(socks[i]);
+}
+#else
+// static
+void GModelServer::test()
+{
+}
+#endif
+} // namespace GClasses
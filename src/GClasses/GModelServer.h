@@ -0,0 +1,202 @@
+/*
+  The contents of this file are dedicated by all of its authors, including
+
+    Michael S. Gashler,
+    anonymous contributors,
+
+  to the public domain (http://creativecommons.org/publicdomain/zero/1.0/).
+
+  Note that some moral obligations still exist in the absence of legal ones.
+  For example, it would still be dishonest to deliberately misrepresent the
+  origin of a work. Although we impose no legal requirements to obtain a
+  license, it is beseeming for those who build on the works of others to
+  give back useful improvements, or find a way to pay it forward. If
+  you would like to cite us, a published paper about Waffles can be found
+  at http://jmlr.org/papers/volume12/gashler11a/gashler11a.pdf. If you find
+  our code to be useful, the Waffles team would love to hear how you use it.
+*/
+
+
+#ifndef __GMODELSERVER_H__
+#define __GMODELSERVER_H__
+
+#include "GHttp.h"
+#include <string>
+#include <vector>
+#include <map>
+
+namespace GClasses {
+
+class GDom;
+class GDomNode;
+class GSupervisedLearner;
+class GCollaborativeFilter;
+class GMatrix;
+class GSpinLock;
+class GModelServerModel;
+class GModelServerPending;
+class GModelServerBatcher;
+
+
+/// Counts samples in buckets whose upper bounds double from one bucket to the next. This suits
+/// quantities like latencies and batch sizes, which span several orders of magnitude.
+class GLogHistogram
+{
+protected:
+	double m_unit;
+	std::vector<size_t> m_counts;
+	size_t m_count;
+	double m_sum;
+	double m_max;
+
+public:
+	/// The first bucket counts samples no bigger than unit. Each bucket after that has twice the upper bound of the one before it.
+	GLogHistogram(double unit);
+
+	/// Adds a sample.
+	void add(double x);
+
+	/// Forgets all the samples.
+	void clear();
+
+	/// Returns the number of samples.
+	size_t count() const { return m_count; }
+
+	/// Returns the mean of the samples.
+	double mean() const { return m_count > 0 ? m_sum / m_count : 0.0; }
+
+	/// Returns the largest sample.
+	double max() const { return m_max; }
+
+	/// Returns the upper bound of the bucket that contains the q-quantile. For example, quantile(0.99)
+	/// bounds the 99th percentile to within a factor of two.
+	double quantile(double q) const;
+
+	/// Returns the number of buckets.
+	size_t bucketCount() const { return m_counts.size(); }
+
+	/// Returns the number of samples in bucket i.
+	size_t bucket(size_t i) const { return m_counts[i]; }
+
+	/// Returns the upper bound of bucket i.
+	double upperBound(size_t i) const;
+
+	/// Marshals the summary statistics and the non-empty buckets into a DOM.
+	GDomNode* serialize(GDom* pDoc) const;
+};
+
+
+/// Serves predictions from trained models over HTTP. Each model is registered under a name,
+/// and each worker thread gets its own copy of each model, so the models do not need to be thread-safe.
+/// The following requests are supported:
+///
+/// GET /models returns a JSON list of the models with their types and dimensions.
+///
+/// POST /predict/[name] scores a batch with the named model. (If only one model has been added, the name may be omitted.)
+/// If the Content-Type is "application/octet-stream", the body is a packed array of doubles in native byte order.
+/// For a GSupervisedLearner, it contains one row of features after another, and the response contains one row
+/// of predicted labels after another. For a GCollaborativeFilter, it contains (user, item) pairs, and the response
+/// contains one predicted rating for each pair.
+/// Otherwise, the body is JSON. For a GSupervisedLearner, it is {"rows":[[f1,f2,...],...]}, and the response is
+/// {"predictions":[[l1,l2,...],...]}. For a GCollaborativeFilter, it is {"pairs":[[user,item],...]}, and the response
+/// is {"predictions":[r1,r2,...]}. (A bare list of rows or pairs may also be posted.) Values are in the same encoding
+/// that GMatrix uses, so nominal values are zero-based indexes, and null represents an unknown value.
+///
+/// Errors are reported with an appropriate status code and a JSON body of the form {"error":"message"}.
+///
+/// GET /stats returns the queue-time and batch-size histograms of the batcher.
+///
+/// When batching is enabled (see setBatching), the rows of concurrent predict requests for the same
+/// supervised learner are coalesced into one matrix and scored with a single call to GSupervisedLearner::predictBatch.
+/// This trades a little latency for much higher throughput when many small requests arrive at once.
+class GModelServer : public GHttpEventServer
+{
+friend class GModelServerBatcher;
+protected:
+	std::map<std::string, GModelServerModel*> m_models;
+	size_t m_maxBatch;
+	double m_maxWait;
+	size_t m_batchThreads;
+	std::vector<GModelServerBatcher*> m_batchers;
+	GSpinLock* m_pBatchLock; // Guards the pending requests of every model, and m_batchers
+	int m_batchPipe[2]; // Wakes up the batchers when a request is queued
+	volatile bool m_stopBatchers;
+	GSpinLock* m_pStatsLock;
+	GLogHistogram m_queueTimes;
+	GLogHistogram m_batchSizes;
+	size_t m_batchedRequests;
+
+public:
+	/// Listens on the specified port. (If port is 0, an unused port is chosen.)
+	GModelServer(unsigned short port, size_t workerThreads = 1);
+	virtual ~GModelServer();
+
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
+	/// Adds a model that is deserialized from pModel, which may represent any GSupervisedLearner
+	/// or GCollaborativeFilter that GLearnerLoader can load. Models must be added before the server
+	/// starts processing requests.
+	void addModel(const char* szName, const GDomNode* pModel);
+
+	/// Adds a copy of a trained model.
+	void addModel(const char* szName, const GSupervisedLearner& model);
+
+	/// Adds a copy of a trained model.
+	void addModel(const char* szName, const GCollaborativeFilter& model);
+
+	/// Loads a model from a JSON file, such as the ones that "waffles_learn train" makes.
+	void loadModel(const char* szName, const char* szFilename);
+
+	/// Returns the number of models that have been added.
+	size_t modelCount() const { return m_models.size(); }
+
+	/// Enables dynamic batching of the requests for supervised learners. Requests wait until the rows that are
+	/// waiting for the same model fill a batch of maxBatch rows, or until the oldest one has waited maxWaitMs
+	/// milliseconds, and then the whole batch is scored at once. (A request with more than maxBatch rows is scored
+	/// by itself.) batchThreads specifies how many threads score batches. Each one has its own copy of each model.
+	/// This must be called before any models are added.
+	void setBatching(size_t maxBatch, double maxWaitMs, size_t batchThreads = 1);
+
+	/// Adds the current batching statistics to pDoc, and returns the node. This includes the number of batched
+	/// requests and batches, a histogram of the time that requests waited in milliseconds ("queue_ms"),
+	/// and a histogram of the number of rows in each batch ("batch_rows").
+	GDomNode* stats(GDom* pDoc);
+
+	/// Stops the threads that score batches. Any requests that are still waiting are answered with
+	/// "503 Service Unavailable". (This is called by the destructor.)
+	void stopBatching();
+
+protected:
+	/// Answers requests. (See the comment for this class.)
+	virtual void handleRequest(size_t worker, const GHttpRequest& request, GHttpResponse& response);
+
+	/// Returns the model that the URL of a predict request names. Throws if there is no such model.
+	GModelServerModel* findModel(const std::string& url);
+
+	/// Scores a batch with one of the supervised learners, or queues it for the batcher.
+	void predictRows(GModelServerModel* pModel, size_t worker, const GHttpRequest& request, GHttpResponse& response);
+
+	/// Parses the rows in a predict request.
+	void parseRows(GModelServerModel* pModel, const GHttpRequest& request, GMatrix& rows);
+
+	/// Formats count predictions, starting with row start of predictions, as a response.
+	void writePredictions(const GMatrix& predictions, size_t start, size_t count, bool binary, GHttpResponse& response);
+
+	/// Queues a request for the batcher.
+	void enqueue(GModelServerModel* pModel, GModelServerPending* pPending);
+
+	/// Waits for a batch that is ready, scores it, and answers its requests. Returns false if there was nothing to do.
+	bool scoreBatch(size_t replica, double maxSleepSecs);
+
+	/// Scores a batch with one of the collaborative filters.
+	void predictPairs(GModelServerModel* pModel, size_t worker, const GHttpRequest& request, GHttpResponse& response);
+
+	/// Writes a list of the models in JSON format.
+	void listModels(GHttpResponse& response);
+};
+
+
+} // namespace GClasses
+
+#endif // __GMODELSERVER_H__
@@ -28,232 +28,82 @@
 #include "GTransform.h"
 #include "GSparseMatrix.h"
 #include "GHolders.h"
+#include "GThread.h"
 #include <cmath>
 #include <memory>
 
 namespace GClasses {
 
-struct GNaiveBayesInputAttr
-{
-	size_t m_nValues;
-	size_t* m_pValueCounts;
-
-	GNaiveBayesInputAttr(size_t nValues)
-	{
-		m_nValues = nValues;
-		m_pValueCounts = new size_t[m_nValues];
-		memset(m_pValueCounts, '\0', sizeof(size_t) * m_nValues);
-	}
-
-	GNaiveBayesInputAttr(GDomNode* pNode)
-	{
-		GDomListIterator it(pNode);
-		m_nValues = it.remaining();
-		m_pValueCounts = new size_t[m_nValues];
-		for(size_t i = 0; i < m_nValues; i++)
-		{
-			m_pValueCounts[i] = (size_t)it.currentInt();
-			it.advance();
-		}
-	}
-
-	~GNaiveBayesInputAttr()
-	{
-		delete[] m_pValueCounts;
-	}
-
-	GDomNode* serialize(GDom* pDoc)
-	{
-		GDomNode* pNode = pDoc->newList();
-		for(size_t i = 0; i < m_nValues; i++)
-			pNode->add(pDoc, m_pValueCounts[i]);
-		return pNode;
-	}
+#define NAIVEBAYES_MIN_JOB_ROWS 1024
 
-	void AddTrainingSample(const int inputValue)
-	{
-		if(inputValue >= 0 && (size_t)inputValue < m_nValues)
-			m_pValueCounts[inputValue]++;
-		else
-			GAssert(inputValue == UNKNOWN_DISCRETE_VALUE);
-	}
-
-	size_t eval(const int inputValue)
-	{
-		if(inputValue >= 0 && (size_t)inputValue < m_nValues)
-			return m_pValueCounts[inputValue];
-		else
-			return 0;
-	}
-};
-
-// --------------------------------------------------------------------
-
-struct GNaiveBayesOutputValue
+class GNaiveBayesWorker : public GWorkerThread
 {
-	size_t m_nCount;
-	size_t m_featureDims;
-	struct GNaiveBayesInputAttr** m_pInputs;
-
-	GNaiveBayesOutputValue(GRelation* pFeatureRel, size_t nInputCount)
-	{
-		m_nCount = 0;
-		m_featureDims = nInputCount;
-		m_pInputs = new struct GNaiveBayesInputAttr*[nInputCount];
-		for(size_t n = 0; n < m_featureDims; n++)
-			m_pInputs[n] = new struct GNaiveBayesInputAttr(pFeatureRel->valueCount(n));
-	}
+protected:
+	GNaiveBayes& m_nb;
 
-	GNaiveBayesOutputValue(GDomNode* pNode, size_t nInputCount)
+public:
+	GNaiveBayesWorker(GMasterThread& master, GNaiveBayes& nb)
+	: GWorkerThread(master), m_nb(nb)
 	{
-		GDomListIterator it(pNode);
-		if(it.remaining() != nInputCount + 1)
-			throw Ex("Unexpected number of inputs");
-		m_nCount = (size_t)it.currentInt();
-		it.advance();
-		m_featureDims = nInputCount;
-		m_pInputs = new struct GNaiveBayesInputAttr*[m_featureDims];
-		for(size_t n = 0; n < m_featureDims; n++)
-		{
-			m_pInputs[n] = new struct GNaiveBayesInputAttr(it.current());
-			it.advance();
-		}
 	}
 
-	~GNaiveBayesOutputValue()
+	virtual ~GNaiveBayesWorker()
 	{
-		for(size_t n = 0; n < m_featureDims; n++)
-			delete(m_pInputs[n]);
-		delete[] m_pInputs;
 	}
 
-	GDomNode* serialize(GDom* pDoc)
+	virtual void doJob(size_t jobId)
 	{
-		GDomNode* pNode = pDoc->newList();
-		pNode->add(pDoc, m_nCount);
-		for(size_t i = 0; i < m_featureDims; i++)
-			pNode->add(pDoc, m_pInputs[i]->serialize(pDoc));
-		return pNode;
-	}
-
-	void AddTrainingSample(const double* pIn)
-	{
-		for(size_t n = 0; n < m_featureDims; n++)
-			m_pInputs[n]->AddTrainingSample((int)pIn[n]);
-		m_nCount++;
-	}
-
-	double eval(const double* pInputVector, double equivalentSampleSize)
-	{
-		// The prior output probability
-		double dLogProb = log((double)m_nCount);
-
-		// The probability of inputs given this output
-		for(size_t n = 0; n < m_featureDims; n++)
-		{
-			dLogProb += log(std::max(1e-300,
-					(
-						(double)m_pInputs[n]->eval((int)pInputVector[n]) +
-						(equivalentSampleSize / m_pInputs[n]->m_nValues)
-					) /
-					(equivalentSampleSize + m_nCount)
-				));
-		}
-		return dLogProb;
-	}
-};
-
-// --------------------------------------------------------------------
-
-struct GNaiveBayesOutputAttr
-{
-	size_t m_nValueCount;
-	struct GNaiveBayesOutputValue** m_pValues;
-
-	GNaiveBayesOutputAttr(GRelation* pFeatureRel, size_t nInputCount, size_t nValueCount)
-	{
-		m_nValueCount = nValueCount;
-		m_pValues = new struct GNaiveBayesOutputValue*[m_nValueCount];
-		for(size_t n = 0; n < m_nValueCount; n++)
-			m_pValues[n] = new struct GNaiveBayesOutputValue(pFeatureRel, nInputCount);
-	}
-
-	GNaiveBayesOutputAttr(GDomNode* pNode, size_t nInputCount, size_t nValueCount)
-	{
-		GDomListIterator it(pNode);
-		if(it.remaining() != nValueCount)
-			throw Ex("Unexpected number of values");
-		m_nValueCount = nValueCount;
-		m_pValues = new struct GNaiveBayesOutputValue*[m_nValueCount];
-		for(size_t n = 0; n < m_nValueCount; n++)
-		{
-			m_pValues[n] = new struct GNaiveBayesOutputValue(it.current(), nInputCount);
-			it.advance();
-		}
-	}
-
-	~GNaiveBayesOutputAttr()
-	{
-		for(size_t n = 0; n < m_nValueCount; n++)
-			delete(m_pValues[n]);
-		delete[] m_pValues;
-	}
-
-	GDomNode* serialize(GDom* pDoc)
-	{
-		GDomNode* pNode = pDoc->newList();
-		for(size_t i = 0; i < m_nValueCount; i++)
-			pNode->add(pDoc, m_pValues[i]->serialize(pDoc));
-		return pNode;
-	}
-
-	void AddTrainingSample(const double* pIn, int out)
-	{
-		if(out >= 0 && (size_t)out < m_nValueCount)
-			m_pValues[out]->AddTrainingSample(pIn);
-	}
-
-	void eval(const double* pIn, GPrediction* pOut, double equivalentSampleSize)
-	{
-		GCategoricalDistribution* pDist = pOut->makeCategorical();
-		GVec& values = pDist->values(m_nValueCount);
-		for(size_t n = 0; n < m_nValueCount; n++)
-			values[n] = m_pValues[n]->eval(pIn, equivalentSampleSize);
-		pDist->normalizeFromLogSpace();
-	}
-
-	double predict(const double* pIn, double equivalentSampleSize, GRand* pRand)
-	{
-		GQUICKVEC(values, m_nValueCount);
-		for(size_t n = 0; n < m_nValueCount; n++)
-			values[n] = m_pValues[n]->eval(pIn, equivalentSampleSize);
-		return (double)values.indexOfMax();
+		m_nb.countJob(jobId);
 	}
 };
 
 // --------------------------------------------------------------------
 
 GNaiveBayes::GNaiveBayes()
-: GIncrementalLearner()
+: GIncrementalLearner(), m_nSampleCount(0), m_equivalentSampleSize(0.5), m_workerThreads(1), m_logProbsStale(true), m_pJobFeatures(NULL), m_pJobSparse(NULL), m_pJobLabels(NULL), m_jobCount(0), m_jobDefaultBit(0)
 {
-	m_pOutputs = NULL;
-	m_equivalentSampleSize = 0.5;
-	m_nSampleCount = 0;
 }
 
 GNaiveBayes::GNaiveBayes(const GDomNode* pNode)
-: GIncrementalLearner(pNode)
+: GIncrementalLearner(pNode), m_workerThreads(1), m_logProbsStale(true), m_pJobFeatures(NULL), m_pJobSparse(NULL), m_pJobLabels(NULL), m_jobCount(0), m_jobDefaultBit(0)
 {
+	beginIncrementalLearningInner(*m_pRelFeatures, *m_pRelLabels);
 	m_nSampleCount = (size_t)pNode->getInt("sampleCount");
 	m_equivalentSampleSize = pNode->getDouble("ess");
 	GDomNode* pOutputs = pNode->get("outputs");
 	GDomListIterator it(pOutputs);
 	if(it.remaining() != m_pRelLabels->size())
 		throw Ex("Wrong number of outputs");
-	m_pOutputs = new struct GNaiveBayesOutputAttr*[m_pRelLabels->size()];
-	for(size_t i = 0; i < m_pRelLabels->size(); i++)
+	size_t featureDims = m_pRelFeatures->size();
+	size_t cols = m_featureOffsets[featureDims];
+	for(size_t n = 0; n < m_pRelLabels->size(); n++)
 	{
-		m_pOutputs[i] = new struct GNaiveBayesOutputAttr(it.current(), m_pRelFeatures->size(), m_pRelLabels->valueCount(i));
+		GDomListIterator itValues(it.current());
+		if(itValues.remaining() != m_labelOffsets[n + 1] - m_labelOffsets[n])
+			throw Ex("Unexpected number of values");
+		for(size_t r = m_labelOffsets[n]; r < m_labelOffsets[n + 1]; r++)
+		{
+			GDomListIterator itInputs(itValues.current());
+			if(itInputs.remaining() != featureDims + 1)
+				throw Ex("Unexpected number of inputs");
+			m_classCounts[r] = (size_t)itInputs.currentInt();
+			itInputs.advance();
+			for(size_t f = 0; f < featureDims; f++)
+			{
+				GDomListIterator itCounts(itInputs.current());
+				size_t valueCount = m_featureOffsets[f + 1] - m_featureOffsets[f];
+				if(itCounts.remaining() != valueCount)
+					throw Ex("Unexpected number of feature values");
+				size_t* pCounts = m_counts.data() + r * cols + m_featureOffsets[f];
+				for(size_t v = 0; v < valueCount; v++)
+				{
+					pCounts[v] = (size_t)itCounts.currentInt();
+					itCounts.advance();
+				}
+				itInputs.advance();
+			}
+			itValues.advance();
+		}
 		it.advance();
 	}
 }
@@ -270,8 +120,24 @@ GDomNode* GNaiveBayes::serialize(GDom* pDoc) const
 	pNode->add(pDoc, "sampleCount", m_nSampleCount);
 	pNode->add(pDoc, "ess", m_equivalentSampleSize);
 	GDomNode* pOutputs = pNode->add(pDoc, "outputs", pDoc->newList());
-	for(size_t i = 0; i < m_pRelLabels->size(); i++)
-		pOutputs->add(pDoc, m_pOutputs[i]->serialize(pDoc));
+	size_t featureDims = m_pRelFeatures->size();
+	size_t cols = m_featureOffsets[featureDims];
+	for(size_t n = 0; n < m_pRelLabels->size(); n++)
+	{
+		GDomNode* pValues = pOutputs->add(pDoc, pDoc->newList());
+		for(size_t r = m_labelOffsets[n]; r < m_labelOffsets[n + 1]; r++)
+		{
+			GDomNode* pInputs = pValues->add(pDoc, pDoc->newList());
+			pInputs->add(pDoc, m_classCounts[r]);
+			for(size_t f = 0; f < featureDims; f++)
+			{
+				GDomNode* pCounts = pInputs->add(pDoc, pDoc->newList());
+				const size_t* pRow = m_counts.data() + r * cols;
+				for(size_t i = m_featureOffsets[f]; i < m_featureOffsets[f + 1]; i++)
+					pCounts->add(pDoc, pRow[i]);
+			}
+		}
+	}
 	return pNode;
 }
 
@@ -279,30 +145,55 @@ GDomNode* GNaiveBayes::serialize(GDom* pDoc) const
 void GNaiveBayes::clear()
 {
 	m_nSampleCount = 0;
-	if(m_pOutputs)
-	{
-		for(size_t n = 0; n < m_pRelLabels->size(); n++)
-			delete(m_pOutputs[n]);
-		delete[] m_pOutputs;
-	}
-	m_pOutputs = NULL;
+	m_featureOffsets.clear();
+	m_labelOffsets.clear();
+	m_classCounts.clear();
+	m_counts.clear();
+	m_logPriors.clear();
+	m_logProbs.clear();
+	m_logProbsStale = true;
 }
 
 // virtual
 void GNaiveBayes::beginIncrementalLearningInner(const GRelation& featureRel, const GRelation& labelRel)
 {
 	clear();
-	m_pOutputs = new struct GNaiveBayesOutputAttr*[m_pRelLabels->size()];
-	for(size_t n = 0; n < m_pRelLabels->size(); n++)
-		m_pOutputs[n] = new struct GNaiveBayesOutputAttr(m_pRelFeatures, m_pRelFeatures->size(), m_pRelLabels->valueCount(n));
+	m_featureOffsets.resize(featureRel.size() + 1);
+	m_featureOffsets[0] = 0;
+	for(size_t i = 0; i < featureRel.size(); i++)
+		m_featureOffsets[i + 1] = m_featureOffsets[i] + featureRel.valueCount(i);
+	m_labelOffsets.resize(labelRel.size() + 1);
+	m_labelOffsets[0] = 0;
+	for(size_t i = 0; i < labelRel.size(); i++)
+		m_labelOffsets[i + 1] = m_labelOffsets[i] + labelRel.valueCount(i);
+	m_classCounts.resize(m_labelOffsets[labelRel.size()], 0);
+	m_counts.resize(m_labelOffsets[labelRel.size()] * m_featureOffsets[featureRel.size()], 0);
 }
 
 // virtual
 void GNaiveBayes::trainIncremental(const GVec& in, const GVec& out)
 {
+	size_t featureDims = m_pRelFeatures->size();
+	size_t cols = m_featureOffsets[featureDims];
 	for(size_t n = 0; n < m_pRelLabels->size(); n++)
-		m_pOutputs[n]->AddTrainingSample(in.data(), (int)out[n]);
+	{
+		int c = (int)out[n];
+		if(c < 0 || (size_t)c >= m_labelOffsets[n + 1] - m_labelOffsets[n])
+			continue;
+		size_t r = m_labelOffsets[n] + c;
+		m_classCounts[r]++;
+		size_t* pRow = m_counts.data() + r * cols;
+		for(size_t f = 0; f < featureDims; f++)
+		{
+			int v = (int)in[f];
+			if(v >= 0 && (size_t)v < m_featureOffsets[f + 1] - m_featureOffsets[f])
+				pRow[m_featureOffsets[f] + v]++;
+			else
+				GAssert(v == UNKNOWN_DISCRETE_VALUE);
+		}
+	}
 	m_nSampleCount++;
+	m_logProbsStale = true;
 }
 
 // virtual
@@ -313,8 +204,10 @@ void GNaiveBayes::trainInner(const GMatrix& features, const GMatrix& labels)
 	if(!labels.relation().areNominal())
 		throw Ex("GNaiveBayes only supports nominal labels. Perhaps you should wrap it in a GAutoFilter.");
 	beginIncrementalLearningInner(features.relation(), labels.relation());
-	for(size_t n = 0; n < features.rows(); n++)
-		trainIncremental(features[n], labels[n]);
+	m_pJobFeatures = &features;
+	m_pJobSparse = NULL;
+	m_pJobLabels = &labels;
+	countRows();
 }
 
 // virtual
@@ -325,18 +218,173 @@ void GNaiveBayes::trainSparse(GSparseMatrix& features, GMatrix& labels)
 	size_t featureDims = features.cols();
 	GUniformRelation featureRel(featureDims, 2);
 	beginIncrementalLearning(featureRel, labels.relation());
-	GVec fullRow(featureDims);
-	for(size_t n = 0; n < features.rows(); n++)
+	m_pJobFeatures = NULL;
+	m_pJobSparse = &features;
+	m_pJobLabels = &labels;
+	m_jobDefaultBit = (features.defaultValue() < 1e-6 ? 0 : 1);
+	countRows();
+}
+
+void GNaiveBayes::countRows()
+{
+	size_t rows = m_pJobLabels->rows();
+	size_t cols = m_featureOffsets[m_pRelFeatures->size()];
+	m_jobCount = std::max((size_t)1, std::min(m_workerThreads, rows / NAIVEBAYES_MIN_JOB_ROWS));
+	GMasterThread master;
+	for(size_t i = 0; i < m_jobCount; i++)
 	{
-		features.fullRow(fullRow, n);
-		for(size_t i = 0; i < featureDims; i++)
+		master.addWorker(new GNaiveBayesWorker(master, *this));
+		m_jobClassCounts.push_back(new std::vector<size_t>(m_classCounts.size(), 0));
+		m_jobCounts.push_back(new std::vector<size_t>(m_counts.size(), 0));
+	}
+	try
+	{
+		master.doJobs(m_jobCount);
+	}
+	catch(...)
+	{
+		for(size_t i = 0; i < m_jobCount; i++)
 		{
-			if(fullRow[i] < 1e-6)
-				fullRow[i] = 0.0;
+			delete(m_jobClassCounts[i]);
+			delete(m_jobCounts[i]);
+		}
+		m_jobClassCounts.clear();
+		m_jobCounts.clear();
+		throw;
+	}
+
+	// Sum the tables
+	std::vector<size_t>& classCounts = *m_jobClassCounts[0];
+	std::vector<size_t>& counts = *m_jobCounts[0];
+	for(size_t i = 1; i < m_jobCount; i++)
+	{
+		const std::vector<size_t>& jobClassCounts = *m_jobClassCounts[i];
+		for(size_t j = 0; j < classCounts.size(); j++)
+			classCounts[j] += jobClassCounts[j];
+		const std::vector<size_t>& jobCounts = *m_jobCounts[i];
+		for(size_t j = 0; j < counts.size(); j++)
+			counts[j] += jobCounts[j];
+	}
+	if(m_pJobSparse)
+	{
+		// The sparse jobs only counted the elements that differ from the default value, so the rest of each row has the default value
+		for(size_t r = 0; r < classCounts.size(); r++)
+		{
+			size_t* pRow = counts.data() + r * cols;
+			for(size_t i = m_jobDefaultBit; i < cols; i += 2)
+				pRow[i] = classCounts[r] - pRow[i ^ 1];
+		}
+	}
+	for(size_t j = 0; j < classCounts.size(); j++)
+		m_classCounts[j] += classCounts[j];
+	for(size_t j = 0; j < counts.size(); j++)
+		m_counts[j] += counts[j];
+	m_nSampleCount += rows;
+	m_logProbsStale = true;
+	for(size_t i = 0; i < m_jobCount; i++)
+	{
+		delete(m_jobClassCounts[i]);
+		delete(m_jobCounts[i]);
+	}
+	m_jobClassCounts.clear();
+	m_jobCounts.clear();
+	m_pJobFeatures = NULL;
+	m_pJobSparse = NULL;
+	m_pJobLabels = NULL;
+}
+
+void GNaiveBayes::countJob(size_t job)
+{
+	size_t rows = m_pJobLabels->rows();
+	size_t rowStart = rows * job / m_jobCount;
+	size_t rowEnd = rows * (job + 1) / m_jobCount;
+	size_t featureDims = m_pRelFeatures->size();
+	size_t labelDims = m_pRelLabels->size();
+	size_t cols = m_featureOffsets[featureDims];
+	std::vector<size_t>& classCounts = *m_jobClassCounts[job];
+	std::vector<size_t>& counts = *m_jobCounts[job];
+	for(size_t i = rowStart; i < rowEnd; i++)
+	{
+		const GVec& out = m_pJobLabels->row(i);
+		for(size_t n = 0; n < labelDims; n++)
+		{
+			int c = (int)out[n];
+			if(c < 0 || (size_t)c >= m_labelOffsets[n + 1] - m_labelOffsets[n])
+				continue;
+			size_t r = m_labelOffsets[n] + c;
+			classCounts[r]++;
+			size_t* pRow = counts.data() + r * cols;
+			if(m_pJobSparse)
+			{
+				// Each feature has two values, so its first column is 2 * f. Only count the elements that differ from the default value.
+				GSparseMatrix::Iter end = m_pJobSparse->rowEnd(i);
+				for(GSparseMatrix::Iter it = m_pJobSparse->rowBegin(i); it != end; it++)
+				{
+					size_t bit = (it->second < 1e-6 ? 0 : 1);
+					if(bit != m_jobDefaultBit)
+						pRow[2 * it->first + bit]++;
+				}
+			}
 			else
-				fullRow[i] = 1.0;
+			{
+				const GVec& in = m_pJobFeatures->row(i);
+				for(size_t f = 0; f < featureDims; f++)
+				{
+					int v = (int)in[f];
+					if(v >= 0 && (size_t)v < m_featureOffsets[f + 1] - m_featureOffsets[f])
+						pRow[m_featureOffsets[f] + v]++;
+					else
+						GAssert(v == UNKNOWN_DISCRETE_VALUE);
+				}
+			}
 		}
-		trainIncremental(fullRow, labels[n]);
+	}
+}
+
+void GNaiveBayes::updateLogProbs()
+{
+	size_t featureDims = m_pRelFeatures->size();
+	size_t cols = m_featureOffsets[featureDims];
+	m_logPriors.resize(m_classCounts.size());
+	m_logProbs.resize(m_counts.size());
+	for(size_t r = 0; r < m_classCounts.size(); r++)
+	{
+		double count = (double)m_classCounts[r];
+		m_logPriors[r] = log(count);
+		const size_t* pCounts = m_counts.data() + r * cols;
+		double* pLogProbs = m_logProbs.data() + r * cols;
+		for(size_t f = 0; f < featureDims; f++)
+		{
+			double prior = m_equivalentSampleSize / (m_featureOffsets[f + 1] - m_featureOffsets[f]);
+			for(size_t i = m_featureOffsets[f]; i < m_featureOffsets[f + 1]; i++)
+				pLogProbs[i] = log(std::max(1e-300, ((double)pCounts[i] + prior) / (m_equivalentSampleSize + count)));
+		}
+	}
+	m_logProbsStale = false;
+}
+
+void GNaiveBayes::evalLabel(size_t n, const double* pIn, GVec& values)
+{
+	size_t featureDims = m_pRelFeatures->size();
+	size_t cols = m_featureOffsets[featureDims];
+	for(size_t c = 0; c < values.size(); c++)
+	{
+		// The prior output probability
+		size_t r = m_labelOffsets[n] + c;
+		double dLogProb = m_logPriors[r];
+
+		// The probability of inputs given this output
+		const double* pLogProbs = m_logProbs.data() + r * cols;
+		for(size_t f = 0; f < featureDims; f++)
+		{
+			int v = (int)pIn[f];
+			size_t valueCount = m_featureOffsets[f + 1] - m_featureOffsets[f];
+			if(v >= 0 && (size_t)v < valueCount)
+				dLogProb += pLogProbs[m_featureOffsets[f] + v];
+			else
+				dLogProb += log(std::max(1e-300, (m_equivalentSampleSize / valueCount) / (m_equivalentSampleSize + m_classCounts[r])));
+		}
+		values[c] = dLogProb;
 	}
 }
 
@@ -344,38 +392,47 @@ void GNaiveBayes::predictDistribution(const GVec& in, GPrediction* out)
 {
 	if(m_nSampleCount <= 0)
 		throw Ex("You must call train before you call eval");
+	if(m_logProbsStale)
+		updateLogProbs();
 	for(size_t n = 0; n < m_pRelLabels->size(); n++)
-		m_pOutputs[n]->eval(in.data(), &out[n], m_equivalentSampleSize);
+	{
+		GCategoricalDistribution* pDist = out[n].makeCategorical();
+		GVec& values = pDist->values(m_labelOffsets[n + 1] - m_labelOffsets[n]);
+		evalLabel(n, in.data(), values);
+		pDist->normalizeFromLogSpace();
+	}
 }
 
 void GNaiveBayes::predict(const GVec& in, GVec& out)
 {
 	if(m_nSampleCount <= 0)
 		throw Ex("You must call train before you call eval");
+	if(m_logProbsStale)
+		updateLogProbs();
 	for(size_t n = 0; n < m_pRelLabels->size(); n++)
-		out[n] = m_pOutputs[n]->predict(in.data(), m_equivalentSampleSize, &m_rand);
+	{
+		GQUICKVEC(values, m_labelOffsets[n + 1] - m_labelOffsets[n]);
+		evalLabel(n, in.data(), values);
+		out[n] = (double)values.indexOfMax();
+	}
+}
+
+GTransducer* GNaiveBayes_autoTuneCandidate(void* pThis, size_t candidate)
+{
+	GNaiveBayes* pModel = new GNaiveBayes();
+	pModel->setEquivalentSampleSize(0.25 * candidate);
+	return pModel;
 }
 
 void GNaiveBayes::autoTune(GMatrix& features, GMatrix& labels)
 {
-	// Find the best ess value
-	double bestEss = 0.0;
-	double bestErr = 1e308;
-	for(double i = 0.0; i < 8; i += 0.25)
-	{
-		m_equivalentSampleSize = i;
-		double d = crossValidate(features, labels, 2);
-		if(d < bestErr)
-		{
-			bestErr = d;
-			bestEss = i;
-		}
-		else if(i >= 2.0)
-			break;
-	}
+	// Find the best ess value in [0, 8)
+	GParallelValidator pv(features, labels, 2, 1, (size_t)m_rand.next());
+	pv.setWorkerThreads(m_autoTuneThreads);
+	size_t best = pv.successiveHalving(GNaiveBayes_autoTuneCandidate, NULL, 32);
 
 	// Set the best values
-	m_equivalentSampleSize = bestEss;
+	m_equivalentSampleSize = 0.25 * best;
 }
 
 void GNaiveBayes_CheckResults(double yprior, double ycond, double nprior, double ncond, GPrediction* out)
@@ -444,10 +501,63 @@ void GNaiveBayes_testMath()
 	GNaiveBayes_CheckResults(7.0/12.0, 3.0/7.0*2.0/7.0, 5.0/12.0, 3.0/5.0*0.0/5.0, &out);
 }
 
+void GNaiveBayes_testSparse(double defaultValue)
+{
+	// Make a sparse binary matrix with enough rows to divide among several jobs
+	GRand rand(0);
+	size_t rows = 3 * NAIVEBAYES_MIN_JOB_ROWS + 500;
+	size_t featureDims = 30;
+	GSparseMatrix sparse(rows, featureDims, defaultValue);
+	GMatrix dense(new GUniformRelation(featureDims, 2));
+	dense.newRows(rows);
+	GMatrix labels(new GUniformRelation(1, 3));
+	labels.newRows(rows);
+	for(size_t i = 0; i < rows; i++)
+	{
+		size_t c = (size_t)rand.next(3);
+		labels[i][0] = (double)c;
+		for(size_t j = 0; j < featureDims; j++)
+		{
+			double bit = (rand.uniform() < 0.05 + 0.1 * (double)((j + c) % 3) ? 1.0 : 0.0);
+			dense[i][j] = bit;
+			if(bit != defaultValue)
+				sparse.set(i, j, bit);
+		}
+	}
+
+	// Sparse training should be equivalent to dense training, and should not depend on the number of threads
+	GNaiveBayes nbDense;
+	nbDense.train(dense, labels);
+	GNaiveBayes nbSparse;
+	nbSparse.trainSparse(sparse, labels);
+	GNaiveBayes nbThreads;
+	nbThreads.setWorkerThreads(4);
+	nbThreads.trainSparse(sparse, labels);
+	GPrediction a, b, c;
+	for(size_t i = 0; i < 50; i++)
+	{
+		nbDense.predictDistribution(dense[i], &a);
+		nbSparse.predictDistribution(dense[i], &b);
+		nbThreads.predictDistribution(dense[i], &c);
+		GVec& va = a.asCategorical()->values(3);
+		GVec& vb = b.asCategorical()->values(3);
+		GVec& vc = c.asCategorical()->values(3);
+		for(size_t j = 0; j < 3; j++)
+		{
+			if(std::abs(va[j] - vb[j]) > 1e-12)
+				throw Ex("Sparse training does not match dense training");
+			if(vb[j] != vc[j])
+				throw Ex("The results depend on the number of threads");
+		}
+	}
+}
+
 // static
 void GNaiveBayes::test()
 {
 	GNaiveBayes_testMath();
+	GNaiveBayes_testSparse(0.0);
+	GNaiveBayes_testSparse(1.0);
 	GAutoFilter af(new GNaiveBayes());
 	af.basicTest(0.77, 0.94);
 }
@@ -21,19 +21,40 @@
 #define __GNAIVEBAYES_H__
 
 #include "GLearner.h"
+#include <vector>
 
 namespace GClasses {
 
-class GXMLTag;
-struct GNaiveBayesOutputAttr;
+class GSparseMatrix;
+class GNaiveBayesWorker;
 
-/// A naive Bayes classifier
+/// A naive Bayes classifier. The counts are stored in flat tables, with one row for each value of each label,
+/// and one column for each value of each feature, so a prediction is a sequence of table lookups.
+/// Training with many rows is split across worker threads, each of which counts a contiguous range of rows
+/// in its own table. The tables are summed when all of the rows have been counted.
 class GNaiveBayes : public GIncrementalLearner
 {
+friend class GNaiveBayesWorker;
 protected:
 	size_t m_nSampleCount;
-	GNaiveBayesOutputAttr** m_pOutputs;
 	double m_equivalentSampleSize;
+	size_t m_workerThreads;
+	std::vector<size_t> m_featureOffsets; // The first column of each feature in the count table. The last element is the number of columns.
+	std::vector<size_t> m_labelOffsets; // The first row of each label in the count table. The last element is the number of rows.
+	std::vector<size_t> m_classCounts; // The number of training rows with each value of each label
+	std::vector<size_t> m_counts; // The number of training rows with each value of each label and each value of each feature
+	std::vector<double> m_logPriors; // The log of each element in m_classCounts
+	std::vector<double> m_logProbs; // The log of the smoothed conditional probability of each element in m_counts
+	bool m_logProbsStale;
+
+	// The rows that the workers are currently counting
+	const GMatrix* m_pJobFeatures;
+	GSparseMatrix* m_pJobSparse;
+	const GMatrix* m_pJobLabels;
+	size_t m_jobCount;
+	size_t m_jobDefaultBit; // The binary value of the elements that the sparse matrix does not store
+	std::vector<std::vector<size_t>*> m_jobClassCounts;
+	std::vector<std::vector<size_t>*> m_jobCounts;
 
 public:
 	GNaiveBayes();
@@ -57,17 +78,21 @@ public:
 	/// distribution by multiplying by a zero, each value is given
 	/// at least as much representation as specified here. (The default
 	/// is 0.5, which is as if there were half of a sample for each value.)
-	void setEquivalentSampleSize(double d) { m_equivalentSampleSize = d; }
+	void setEquivalentSampleSize(double d) { m_equivalentSampleSize = d; m_logProbsStale = true; }
 
 	/// Returns the equivalent sample size. (The number of samples of each
 	/// possible value that is added by default to prevent zeros.)
 	double equivalentSampleSize() { return m_equivalentSampleSize; }
 
+	/// Specify the number of worker threads to use for counting the training data. The default is 1.
+	void setWorkerThreads(size_t n) { m_workerThreads = n; }
+
 	/// See the comment for GSupervisedLearner::clear
 	virtual void clear();
 
 	/// Uses cross-validation to find a set of parameters that works well with
-	/// the provided data.
+	/// the provided data. The candidate configurations are evaluated in parallel
+	/// (see GTransducer::setAutoTuneThreads) and pruned by successive halving.
 	void autoTune(GMatrix& features, GMatrix& labels);
 
 	/// See the comment for GSupervisedLearner::predict
@@ -91,6 +116,19 @@ protected:
 
 	/// See the comment for GIncrementalLearner::beginIncrementalLearningInner
 	virtual void beginIncrementalLearningInner(const GRelation& featureRel, const GRelation& labelRel);
+
+	/// Counts the rows that have been set up in m_pJobFeatures (or m_pJobSparse) and m_pJobLabels
+	/// with m_jobCount jobs, and adds the counts to the tables.
+	void countRows();
+
+	/// Counts one contiguous range of the rows in its own table.
+	void countJob(size_t job);
+
+	/// Computes the log-probability tables from the counts.
+	void updateLogProbs();
+
+	/// Returns the log-probability of each value of label n given the features in pIn.
+	void evalLabel(size_t n, const double* pIn, GVec& values);
 };
 
 } // namespace GClasses
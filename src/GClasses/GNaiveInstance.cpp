@@ -21,89 +21,208 @@
 #include "GDom.h"
 #include "GDistribution.h"
 #include "GTransform.h"
-#include <map>
-
-using std::multimap;
-using std::make_pair;
+#include "GRand.h"
+#include "GSparseMatrix.h"
+#include "GThread.h"
+#include <algorithm>
 
 namespace GClasses {
 
-class GNaiveInstanceAttr
+class GNaiveInstanceWorker : public GWorkerThread
 {
 protected:
-	multimap<double,const double*> m_instances;
+	GNaiveInstance& m_ni;
 
 public:
-	GNaiveInstanceAttr() {}
+	GNaiveInstanceWorker(GMasterThread& master, GNaiveInstance& ni)
+	: GWorkerThread(master), m_ni(ni)
+	{
+	}
 
-	GNaiveInstanceAttr(GDomNode* pAttr, size_t labelDims, GHeap* pHeap)
+	virtual ~GNaiveInstanceWorker()
 	{
-		GDomListIterator it(pAttr);
-		size_t count = it.remaining() / (1 + labelDims);
-		if(count * (1 + labelDims) != it.remaining())
-			throw Ex("invalid list size");
-		for(size_t i = 0; i < count; i++)
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		m_ni.addJob(jobId);
+	}
+};
+
+bool GNaiveInstanceEntry_less(const GNaiveInstanceEntry& a, const GNaiveInstanceEntry& b)
+{
+	return a.m_value < b.m_value;
+}
+
+/// Sorts the entries after the first sorted ones, and merges them with the first ones. Entries with
+/// equal values remain in the order in which they were added.
+void GNaiveInstance_sortTail(std::vector<GNaiveInstanceEntry>& entries, size_t sorted)
+{
+	std::stable_sort(entries.begin() + sorted, entries.end(), GNaiveInstanceEntry_less);
+	std::inplace_merge(entries.begin(), entries.begin() + sorted, entries.end(), GNaiveInstanceEntry_less);
+}
+
+/// A sorted view of the training values of one attribute, in which the rows that took the default value
+/// of the sparse training matrix appear as one block of equal values. The rows in the block are in
+/// ascending order, as they would be if they were stored as entries.
+class GNaiveInstanceAttrView
+{
+protected:
+	const std::vector<GNaiveInstanceEntry>& m_entries;
+	const std::vector<size_t>* m_pNonDefaultRows;
+	double m_defaultValue;
+	size_t m_defaults;
+	size_t m_blockStart;
+
+public:
+	GNaiveInstanceAttrView(const std::vector<GNaiveInstanceEntry>& entries, const std::vector<size_t>* pNonDefaultRows, double defaultValue, size_t defaultRowCount)
+	: m_entries(entries), m_pNonDefaultRows(pNonDefaultRows), m_defaultValue(defaultValue), m_defaults(0), m_blockStart(0)
+	{
+		if(pNonDefaultRows)
 		{
-			double d = it.currentDouble();
-			it.advance();
-			double* pLabel = (double*)pHeap->allocAligned(sizeof(double) * labelDims);
-			m_instances.insert(make_pair(d, pLabel));
-			for(size_t j = 0; j < labelDims; j++)
-			{
-				*(pLabel++) = it.currentDouble();
-				it.advance();
-			}
+			m_defaults = defaultRowCount - pNonDefaultRows->size();
+			m_blockStart = entryLowerBound(defaultValue);
 		}
 	}
 
-	virtual ~GNaiveInstanceAttr()
+	/// Returns the number of values, including the default block.
+	size_t size() const { return m_entries.size() + m_defaults; }
+
+	/// Returns the index of the first value that is not less than value.
+	size_t lowerBound(double value) const
 	{
+		size_t pos = entryLowerBound(value);
+		if(m_defaults > 0 && m_defaultValue < value)
+			pos += m_defaults;
+		return pos;
 	}
 
-	multimap<double,const double*>& instances() { return m_instances; }
+	/// Returns the i'th value.
+	double value(size_t i) const
+	{
+		if(i < m_blockStart)
+			return m_entries[i].m_value;
+		else if(i < m_blockStart + m_defaults)
+			return m_defaultValue;
+		else
+			return m_entries[i - m_defaults].m_value;
+	}
 
-	GDomNode* serialize(GDom* pDoc, size_t labelDims)
+	/// Returns the training row of the i'th value.
+	size_t row(size_t i) const
 	{
-		GDomNode* pList = pDoc->newList();
-		for(multimap<double,const double*>::iterator it = m_instances.begin(); it != m_instances.end(); it++)
+		if(i < m_blockStart)
+			return m_entries[i].m_row;
+		else if(i < m_blockStart + m_defaults)
 		{
-			pList->add(pDoc, it->first);
-			for(size_t i = 0; i < labelDims; i++)
-				pList->add(pDoc, it->second[i]);
+			// Find the j'th row that is not in the sorted list of non-default rows. Before the
+			// k'th non-default row, there are (*m_pNonDefaultRows)[k] - k default rows.
+			size_t j = i - m_blockStart;
+			const std::vector<size_t>& rows = *m_pNonDefaultRows;
+			size_t lo = 0;
+			size_t hi = rows.size();
+			while(lo < hi)
+			{
+				size_t mid = (lo + hi) / 2;
+				if(rows[mid] - mid <= j)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			return j + lo;
 		}
-		return pList;
+		else
+			return m_entries[i - m_defaults].m_row;
 	}
 
-	void addInstance(double dInput, const double* pOutputs)
+protected:
+	size_t entryLowerBound(double value) const
 	{
-		m_instances.insert(make_pair(dInput, pOutputs));
+		GNaiveInstanceEntry target;
+		target.m_value = value;
+		return std::lower_bound(m_entries.begin(), m_entries.end(), target, GNaiveInstanceEntry_less) - m_entries.begin();
 	}
 };
 
 // -----------------------------------------------------------
 
 GNaiveInstance::GNaiveInstance()
-: GIncrementalLearner(), m_pHeap(NULL)
+: GIncrementalLearner(), m_nNeighbors(12), m_workerThreads(1), m_defaultValue(UNKNOWN_REAL_VALUE), m_defaultRowCount(0), m_pJobFeatures(NULL), m_pJobSparse(NULL), m_jobFirstRow(0), m_jobCount(0)
 {
-	m_nNeighbors = 12;
-	m_pAttrs = NULL;
 }
 
 GNaiveInstance::GNaiveInstance(const GDomNode* pNode)
-: GIncrementalLearner(pNode), m_pHeap(NULL)
+: GIncrementalLearner(pNode), m_workerThreads(1), m_defaultValue(UNKNOWN_REAL_VALUE), m_defaultRowCount(0), m_pJobFeatures(NULL), m_pJobSparse(NULL), m_jobFirstRow(0), m_jobCount(0)
 {
-	m_pAttrs = NULL;
 	m_nNeighbors = (size_t)pNode->getInt("neighbors");
 	beginIncrementalLearningInner(*m_pRelFeatures, *m_pRelLabels);
 	GDomNode* pAttrs = pNode->get("attrs");
 	GDomListIterator it(pAttrs);
 	if(it.remaining() != m_pRelFeatures->size())
 		throw Ex("Expected ", to_str(m_pRelFeatures->size()), " attrs, got ", to_str(it.remaining()), " attrs");
-	m_pHeap = new GHeap(1024);
+	size_t labelDims = m_pRelLabels->size();
+	GDomNode* pLabels = pNode->getIfExists("labels");
+	if(pLabels)
+	{
+		// The model was trained with a sparse matrix, so the labels are stored once per row, and each
+		// attribute lists its (value, row) entries and its non-default rows
+		for(GDomListIterator itLabels(pLabels); itLabels.remaining() > 0; itLabels.advance())
+			m_labels.push_back(itLabels.currentDouble());
+		m_defaultValue = pNode->getDouble("default");
+		m_defaultRowCount = (size_t)pNode->getInt("defaultRows");
+		m_nonDefaultRows.resize(m_pRelFeatures->size());
+		size_t rows = m_labels.size() / std::max((size_t)1, labelDims);
+		for(size_t i = 0; i < m_pRelFeatures->size(); i++)
+		{
+			GDomListIterator itAttr(it.current());
+			if(itAttr.remaining() != 2)
+				throw Ex("invalid list size");
+			GDomListIterator itEntries(itAttr.current());
+			size_t count = itEntries.remaining() / 2;
+			if(count * 2 != itEntries.remaining())
+				throw Ex("invalid list size");
+			std::vector<GNaiveInstanceEntry>& entries = m_attrs[i];
+			entries.resize(count);
+			for(size_t j = 0; j < count; j++)
+			{
+				entries[j].m_value = itEntries.currentDouble();
+				itEntries.advance();
+				entries[j].m_row = (size_t)itEntries.currentInt();
+				itEntries.advance();
+				if(entries[j].m_row >= rows)
+					throw Ex("row index out of range");
+			}
+			m_sortedCounts[i] = count;
+			itAttr.advance();
+			std::vector<size_t>& nonDefaultRows = m_nonDefaultRows[i];
+			for(GDomListIterator itRows(itAttr.current()); itRows.remaining() > 0; itRows.advance())
+				nonDefaultRows.push_back((size_t)itRows.currentInt());
+			if(nonDefaultRows.size() > m_defaultRowCount || (nonDefaultRows.size() > 0 && nonDefaultRows.back() >= m_defaultRowCount))
+				throw Ex("row index out of range");
+			it.advance();
+		}
+		return;
+	}
 	for(size_t i = 0; i < m_pRelFeatures->size(); i++)
 	{
-		delete(m_pAttrs[i]);
-		m_pAttrs[i] = new GNaiveInstanceAttr(it.current(), m_pRelLabels->size(), m_pHeap);
+		GDomListIterator itAttr(it.current());
+		size_t count = itAttr.remaining() / (1 + labelDims);
+		if(count * (1 + labelDims) != itAttr.remaining())
+			throw Ex("invalid list size");
+		std::vector<GNaiveInstanceEntry>& entries = m_attrs[i];
+		entries.resize(count);
+		for(size_t j = 0; j < count; j++)
+		{
+			entries[j].m_value = itAttr.currentDouble();
+			entries[j].m_row = m_labels.size() / labelDims;
+			itAttr.advance();
+			for(size_t k = 0; k < labelDims; k++)
+			{
+				m_labels.push_back(itAttr.currentDouble());
+				itAttr.advance();
+			}
+		}
+		m_sortedCounts[i] = count;
 		it.advance();
 	}
 }
@@ -116,16 +235,13 @@ GNaiveInstance::~GNaiveInstance()
 
 void GNaiveInstance::clear()
 {
-	if(m_pAttrs)
-	{
-		for(size_t i = 0; i < m_pRelFeatures->size(); i++)
-			delete(m_pAttrs[i]);
-		delete[] m_pAttrs;
-	}
-	m_pAttrs = NULL;
+	m_attrs.clear();
+	m_sortedCounts.clear();
+	m_labels.clear();
+	m_defaultValue = UNKNOWN_REAL_VALUE;
+	m_defaultRowCount = 0;
+	m_nonDefaultRows.clear();
 	m_pValueSums.resize(0);
-	delete(m_pHeap);
-	m_pHeap = NULL;
 }
 
 // virtual
@@ -134,8 +250,50 @@ GDomNode* GNaiveInstance::serialize(GDom* pDoc) const
 	GDomNode* pNode = baseDomNode(pDoc, "GNaiveInstance");
 	pNode->add(pDoc, "neighbors", m_nNeighbors);
 	GDomNode* pAttrs = pNode->add(pDoc, "attrs", pDoc->newList());
+	size_t labelDims = m_pRelLabels->size();
+	if(m_defaultRowCount > 0)
+	{
+		GDomNode* pLabels = pNode->add(pDoc, "labels", pDoc->newList());
+		for(size_t i = 0; i < m_labels.size(); i++)
+			pLabels->add(pDoc, m_labels[i]);
+		pNode->add(pDoc, "default", m_defaultValue);
+		pNode->add(pDoc, "defaultRows", m_defaultRowCount);
+	}
 	for(size_t i = 0; i < m_pRelFeatures->size(); i++)
-		pAttrs->add(pDoc, m_pAttrs[i]->serialize(pDoc, m_pRelLabels->size()));
+	{
+		// Entries that were added incrementally might not be sorted yet
+		const std::vector<GNaiveInstanceEntry>* pEntries = &m_attrs[i];
+		std::vector<GNaiveInstanceEntry> sortedCopy;
+		if(m_sortedCounts[i] < pEntries->size())
+		{
+			sortedCopy = *pEntries;
+			GNaiveInstance_sortTail(sortedCopy, m_sortedCounts[i]);
+			pEntries = &sortedCopy;
+		}
+		GDomNode* pList = pAttrs->add(pDoc, pDoc->newList());
+		if(m_defaultRowCount > 0)
+		{
+			GDomNode* pEntryList = pList->add(pDoc, pDoc->newList());
+			for(size_t j = 0; j < pEntries->size(); j++)
+			{
+				pEntryList->add(pDoc, (*pEntries)[j].m_value);
+				pEntryList->add(pDoc, (*pEntries)[j].m_row);
+			}
+			GDomNode* pRowList = pList->add(pDoc, pDoc->newList());
+			const std::vector<size_t>& nonDefaultRows = m_nonDefaultRows[i];
+			for(size_t j = 0; j < nonDefaultRows.size(); j++)
+				pRowList->add(pDoc, nonDefaultRows[j]);
+			continue;
+		}
+		for(size_t j = 0; j < pEntries->size(); j++)
+		{
+			const GNaiveInstanceEntry& entry = (*pEntries)[j];
+			pList->add(pDoc, entry.m_value);
+			const double* pLabel = m_labels.data() + entry.m_row * labelDims;
+			for(size_t k = 0; k < labelDims; k++)
+				pList->add(pDoc, pLabel[k]);
+		}
+	}
 	return pNode;
 }
 
@@ -168,9 +326,8 @@ void GNaiveInstance::beginIncrementalLearningInner(const GRelation& featureRel,
 	if(!featureRel.areContinuous() || !labelRel.areContinuous())
 		throw Ex("Only continuous attributes are supported.");
 	clear();
-	m_pAttrs = new GNaiveInstanceAttr*[m_pRelFeatures->size()];
-	for(size_t i = 0; i < m_pRelFeatures->size(); i++)
-		m_pAttrs[i] = new GNaiveInstanceAttr();
+	m_attrs.resize(m_pRelFeatures->size());
+	m_sortedCounts.resize(m_pRelFeatures->size(), 0);
 	m_pValueSums.resize(m_pRelLabels->size());
 	m_pWeightSums.resize(m_pRelLabels->size());
 	m_pSumBuffer.resize(m_pRelLabels->size());
@@ -180,14 +337,18 @@ void GNaiveInstance::beginIncrementalLearningInner(const GRelation& featureRel,
 // virtual
 void GNaiveInstance::trainIncremental(const GVec& pIn, const GVec& pOut)
 {
-	if(!m_pHeap)
-		m_pHeap = new GHeap(1024);
-	double* pOutputs = (double*)m_pHeap->allocAligned(sizeof(double) * m_pRelLabels->size());
-	memcpy(pOutputs, pOut.data(), sizeof(double) * m_pRelLabels->size());
+	size_t labelDims = m_pRelLabels->size();
+	GNaiveInstanceEntry entry;
+	entry.m_row = m_labels.size() / labelDims;
+	for(size_t i = 0; i < labelDims; i++)
+		m_labels.push_back(pOut[i]);
 	for(size_t i = 0; i < m_pRelFeatures->size(); i++)
 	{
 		if(pIn[i] != UNKNOWN_REAL_VALUE)
-			m_pAttrs[i]->addInstance(pIn[i], pOutputs);
+		{
+			entry.m_value = pIn[i];
+			m_attrs[i].push_back(entry);
+		}
 	}
 }
 
@@ -200,14 +361,105 @@ void GNaiveInstance::trainInner(const GMatrix& features, const GMatrix& labels)
 		throw Ex("GNaiveInstance only supports continuous labels. Perhaps you should wrap it in a GAutoFilter.");
 
 	beginIncrementalLearningInner(features.relation(), labels.relation());
-	for(size_t i = 0; i < features.rows(); i++)
-		trainIncremental(features[i], labels[i]);
+	for(size_t i = 0; i < labels.rows(); i++)
+		m_labels.insert(m_labels.end(), labels[i].data(), labels[i].data() + labels.cols());
+	m_pJobFeatures = &features;
+	m_pJobSparse = NULL;
+	m_jobFirstRow = 0;
+	addRows();
 }
 
 // virtual
 void GNaiveInstance::trainSparse(GSparseMatrix& features, GMatrix& labels)
 {
-	throw Ex("Sorry, trainSparse is not implemented yet in GNaiveInstance");
+	if(features.rows() != labels.rows())
+		throw Ex("Expected the features and labels to have the same number of rows");
+	GUniformRelation featureRel(features.cols(), 0);
+	beginIncrementalLearning(featureRel, labels.relation());
+	for(size_t i = 0; i < labels.rows(); i++)
+		m_labels.insert(m_labels.end(), labels[i].data(), labels[i].data() + labels.cols());
+	if(features.defaultValue() != UNKNOWN_REAL_VALUE)
+	{
+		m_defaultValue = features.defaultValue();
+		m_defaultRowCount = features.rows();
+		m_nonDefaultRows.resize(m_attrs.size());
+	}
+	m_pJobFeatures = NULL;
+	m_pJobSparse = &features;
+	m_jobFirstRow = 0;
+	addRows();
+}
+
+void GNaiveInstance::addRows()
+{
+	m_jobCount = std::max((size_t)1, std::min(m_workerThreads, m_attrs.size()));
+	GMasterThread master;
+	for(size_t i = 0; i < m_jobCount; i++)
+		master.addWorker(new GNaiveInstanceWorker(master, *this));
+	master.doJobs(m_jobCount);
+	m_pJobFeatures = NULL;
+	m_pJobSparse = NULL;
+}
+
+void GNaiveInstance::addJob(size_t job)
+{
+	size_t attrStart = m_attrs.size() * job / m_jobCount;
+	size_t attrEnd = m_attrs.size() * (job + 1) / m_jobCount;
+	size_t rows = m_pJobSparse ? m_pJobSparse->rows() : m_pJobFeatures->rows();
+	double defaultValue = m_pJobSparse ? m_pJobSparse->defaultValue() : UNKNOWN_REAL_VALUE;
+	bool keepDefaults = m_pJobSparse && defaultValue != UNKNOWN_REAL_VALUE;
+	GNaiveInstanceEntry entry;
+	for(size_t i = 0; i < rows; i++)
+	{
+		entry.m_row = m_jobFirstRow + i;
+		if(m_pJobSparse)
+		{
+			// Walk the stored elements of this range of attributes. The elements with the default
+			// value are left to the default block of their attribute.
+			const SparseVec& row = m_pJobSparse->row(i);
+			for(SparseVec::const_iterator it = row.lower_bound(attrStart); it != row.end() && it->first < attrEnd; it++)
+			{
+				if(it->second == defaultValue)
+					continue;
+				if(keepDefaults)
+					m_nonDefaultRows[it->first].push_back(entry.m_row);
+				if(it->second != UNKNOWN_REAL_VALUE)
+				{
+					entry.m_value = it->second;
+					m_attrs[it->first].push_back(entry);
+				}
+			}
+		}
+		else
+		{
+			const GVec& in = m_pJobFeatures->row(i);
+			for(size_t a = attrStart; a < attrEnd; a++)
+			{
+				if(in[a] != UNKNOWN_REAL_VALUE)
+				{
+					entry.m_value = in[a];
+					m_attrs[a].push_back(entry);
+				}
+			}
+		}
+	}
+	for(size_t a = attrStart; a < attrEnd; a++)
+	{
+		GNaiveInstance_sortTail(m_attrs[a], m_sortedCounts[a]);
+		m_sortedCounts[a] = m_attrs[a].size();
+	}
+}
+
+void GNaiveInstance::sortAttrs()
+{
+	for(size_t i = 0; i < m_attrs.size(); i++)
+	{
+		if(m_sortedCounts[i] < m_attrs[i].size())
+		{
+			GNaiveInstance_sortTail(m_attrs[i], m_sortedCounts[i]);
+			m_sortedCounts[i] = m_attrs[i].size();
+		}
+	}
 }
 
 void GNaiveInstance::evalInput(size_t nInputDim, double dInput)
@@ -216,46 +468,47 @@ void GNaiveInstance::evalInput(size_t nInputDim, double dInput)
 	m_pSumBuffer.fill(0.0);
 	m_pSumOfSquares.fill(0.0);
 
-	// Find the nodes on either side of dInput
-	GNaiveInstanceAttr* pAttr = m_pAttrs[nInputDim];
-	multimap<double,const double*>& instances = pAttr->instances();
-	multimap<double,const double*>::iterator itLeft = instances.lower_bound(dInput);
-	multimap<double,const double*>::iterator itRight = itLeft;
+	// Find the entries on either side of dInput
+	GNaiveInstanceAttrView entries(m_attrs[nInputDim], m_defaultRowCount > 0 ? &m_nonDefaultRows[nInputDim] : NULL, m_defaultValue, m_defaultRowCount);
+	size_t count = entries.size();
+	size_t left = entries.lowerBound(dInput);
+	size_t right = left;
 	bool leftValid = true;
-	if(itLeft == instances.end())
+	if(left == count)
 	{
-		if(instances.size() > 0)
-			itLeft--;
+		if(count > 0)
+			left--;
 		else
 			leftValid = false;
 	}
 	else
-		itRight++;
+		right++;
 
 	// Compute the mean and variance of the values for the k-nearest neighbors
+	size_t labelDims = m_pRelLabels->size();
 	size_t nNeighbors = 0;
 	bool goRight;
 	while(true)
 	{
-		// Pick the closer of the two nodes
+		// Pick the closer of the two entries
 		if(!leftValid)
 		{
-			if(itRight == instances.end())
+			if(right == count)
 				break;
 			goRight = true;
 		}
-		else if(itRight == instances.end())
+		else if(right == count)
 			goRight = false;
-		else if(dInput - itLeft->first < itRight->first - dInput)
+		else if(dInput - entries.value(left) < entries.value(right) - dInput)
 			goRight = false;
 		else
 			goRight = true;
 
 		// Accumulate values
-		const double* pOutputVec = goRight ? itRight->second : itLeft->second;
+		const double* pOutputVec = m_labels.data() + entries.row(goRight ? right : left) * labelDims;
 		GConstVecWrapper vw(pOutputVec, m_pSumBuffer.size());
 		m_pSumBuffer += vw;
-		for(size_t j = 0; j < m_pRelLabels->size(); j++)
+		for(size_t j = 0; j < labelDims; j++)
 			m_pSumOfSquares[j] += (pOutputVec[j] * pOutputVec[j]);
 
 		// See if we're done
@@ -264,13 +517,13 @@ void GNaiveInstance::evalInput(size_t nInputDim, double dInput)
 
 		// Advance
 		if(goRight)
-			itRight++;
+			right++;
 		else
 		{
-			if(itLeft == instances.begin())
+			if(left == 0)
 				leftValid = false;
 			else
-				itLeft--;
+				left--;
 		}
 	}
 	m_pSumBuffer *= (1.0 / nNeighbors);
@@ -291,6 +544,7 @@ void GNaiveInstance::evalInput(size_t nInputDim, double dInput)
 // virtual
 void GNaiveInstance::predictDistribution(const GVec& pIn, GPrediction* pOut)
 {
+	sortAttrs();
 	m_pWeightSums.fill(0.0);
 	m_pValueSums.fill(0.0);
 	for(size_t i = 0; i < m_pRelFeatures->size(); i++)
@@ -305,6 +559,7 @@ void GNaiveInstance::predictDistribution(const GVec& pIn, GPrediction* pOut)
 // virtual
 void GNaiveInstance::predict(const GVec& pIn, GVec& pOut)
 {
+	sortAttrs();
 	m_pWeightSums.fill(0.0);
 	m_pValueSums.fill(0.0);
 	for(size_t i = 0; i < m_pRelFeatures->size(); i++)
@@ -314,8 +569,71 @@ void GNaiveInstance::predict(const GVec& pIn, GVec& pOut)
 }
 
 //static
+void GNaiveInstance_testSparse()
+{
+	// Make some data in which most of the feature values are zero
+	GRand rand(0);
+	size_t rows = 300;
+	size_t featureDims = 12;
+	GSparseMatrix sparse(rows, featureDims, 0.0);
+	GMatrix dense(rows, featureDims);
+	GMatrix labels(rows, 2);
+	for(size_t i = 0; i < rows; i++)
+	{
+		double sum = 0.0;
+		for(size_t j = 0; j < featureDims; j++)
+		{
+			double d = (rand.uniform() < 0.3 ? rand.normal() : 0.0);
+			dense[i][j] = d;
+			if(d != 0.0)
+				sparse.set(i, j, d);
+			sum += d * (double)(j % 4);
+		}
+		labels[i][0] = sum;
+		labels[i][1] = rand.normal();
+	}
+
+	// Dense, sparse, multi-threaded, and incremental training should all produce the same model
+	GNaiveInstance niDense;
+	niDense.train(dense, labels);
+	GNaiveInstance niSparse;
+	niSparse.trainSparse(sparse, labels);
+	GNaiveInstance niThreads;
+	niThreads.setWorkerThreads(5);
+	niThreads.trainSparse(sparse, labels);
+	GDom doc;
+	doc.setRoot(niSparse.serialize(&doc));
+	GNaiveInstance niLoaded(doc.root());
+	GNaiveInstance niIncremental;
+	niIncremental.beginIncrementalLearning(dense.relation(), labels.relation());
+	for(size_t i = 0; i < rows; i++)
+		niIncremental.trainIncremental(dense[i], labels[i]);
+	GVec in(featureDims);
+	GVec a(2), b(2), c(2), d(2), e(2);
+	for(size_t i = 0; i < 40; i++)
+	{
+		for(size_t j = 0; j < featureDims; j++)
+			in[j] = (rand.uniform() < 0.5 ? rand.normal() : 0.0);
+		niDense.predict(in, a);
+		niSparse.predict(in, b);
+		niThreads.predict(in, c);
+		niIncremental.predict(in, d);
+		niLoaded.predict(in, e);
+		for(size_t j = 0; j < 2; j++)
+		{
+			if(a[j] != b[j] || a[j] != d[j])
+				throw Ex("Sparse or incremental training does not match dense training");
+			if(b[j] != c[j])
+				throw Ex("The results depend on the number of threads");
+			if(b[j] != e[j])
+				throw Ex("The sparse model did not round-trip");
+		}
+	}
+}
+
 void GNaiveInstance::test()
 {
+	GNaiveInstance_testSparse();
 
 	GNaiveInstance* pNI = new GNaiveInstance();
 	GAutoFilter af(pNI);
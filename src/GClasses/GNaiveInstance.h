@@ -21,11 +21,19 @@
 #define __GNAIVEINSTANCE_H__
 
 #include "GLearner.h"
+#include <vector>
 
 namespace GClasses {
 
-class GNaiveInstanceAttr;
-class GHeap;
+class GNaiveInstanceWorker;
+
+
+/// One training value of one attribute, and the row of labels that goes with it.
+struct GNaiveInstanceEntry
+{
+	double m_value;
+	size_t m_row;
+};
 
 
 /// This is an instance-based learner. Instead of finding the k-nearest
@@ -39,16 +47,32 @@ class GHeap;
 /// supports continuous features and labels (so it is common to wrap it
 /// in a Categorize filter which will convert nominal features to a categorical
 /// distribution of continuous values).
+/// Each attribute keeps its training values in a flat array sorted by value, and the labels are stored once
+/// per training row. When training with a batch of rows, the attributes are built and sorted by worker threads.
+/// When training with a sparse matrix, the rows that take its default value are not stored as entries. Each
+/// attribute only keeps the rows that differ from the default, and the others are treated as one block of equal values.
 class GNaiveInstance : public GIncrementalLearner
 {
+friend class GNaiveInstanceWorker;
 protected:
 	size_t m_nNeighbors;
-	GNaiveInstanceAttr** m_pAttrs;
+	size_t m_workerThreads;
+	std::vector< std::vector<GNaiveInstanceEntry> > m_attrs; // The training values of each attribute
+	std::vector<size_t> m_sortedCounts; // The number of entries at the start of each attribute that are in sorted order
+	std::vector<double> m_labels; // The labels of each training row
+	double m_defaultValue; // The default value of the sparse matrix that the model was trained with
+	size_t m_defaultRowCount; // The number of sparse training rows whose default-valued elements are not stored as entries
+	std::vector< std::vector<size_t> > m_nonDefaultRows; // For each attribute, the sorted sparse training rows that do not have the default value
 	GVec m_pValueSums;
 	GVec m_pWeightSums;
 	GVec m_pSumBuffer;
 	GVec m_pSumOfSquares;
-	GHeap* m_pHeap;
+
+	// The batch of rows that the workers are currently adding
+	const GMatrix* m_pJobFeatures;
+	GSparseMatrix* m_pJobSparse;
+	size_t m_jobFirstRow;
+	size_t m_jobCount;
 
 public:
 	/// nNeighbors is the number of neighbors (in each dimension)
@@ -71,7 +95,13 @@ public:
 	/// Returns the number of neighbors.
 	size_t neighbors() { return m_nNeighbors; }
 
+	/// Specify the number of worker threads to use for building the attributes when training with a batch of rows. The default is 1.
+	void setWorkerThreads(size_t n) { m_workerThreads = n; }
+
 	/// See the comment for GIncrementalLearner::trainSparse.
+	/// Elements that the sparse matrix does not store have its default value. Only the elements that differ
+	/// from the default value are kept as entries, so the model stays about as small as the sparse matrix.
+	/// (If the default value is UNKNOWN_REAL_VALUE, the other elements are skipped.)
 	virtual void trainSparse(GSparseMatrix& features, GMatrix& labels);
 
 	/// See the comment for GSupervisedLearner::clear.
@@ -93,6 +123,16 @@ public:
 protected:
 	void evalInput(size_t nInputDim, double dInput);
 
+	/// Sorts the entries that have been added to each attribute since it was last sorted.
+	void sortAttrs();
+
+	/// Adds the rows that have been set up in m_pJobFeatures (or m_pJobSparse) to the attributes
+	/// with m_jobCount jobs. Their labels must already be in m_labels, starting with row m_jobFirstRow.
+	void addRows();
+
+	/// Adds the values of one contiguous range of the attributes, and sorts those attributes.
+	void addJob(size_t job);
+
 	/// See the comment for GSupervisedLearner::trainInner
 	virtual void trainInner(const GMatrix& features, const GMatrix& labels);
 
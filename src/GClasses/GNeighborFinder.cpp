@@ -39,8 +39,10 @@
 #include <string>
 #include <iostream>
 #include "GDistance.h"
+#include "GKernelTrick.h"
 #include <cmath>
 #include <map>
+#include <algorithm>
 #include "GPriorityQueue.h"
 #include <memory>
 #include "GSparseMatrix.h"
@@ -448,27 +450,33 @@ void GBruteForceNeighborFinder::reoptimize()
 {
 }
 
-size_t GBruteForceNeighborFinder::findNearest(size_t k, const GVec& vec, size_t exclude)
+size_t GBruteForceNeighborFinder::findNearest(size_t k, const GMatrix& queries, size_t query, size_t exclude)
 {
+	GMatrix block;
+	m_pMetric->squaredDistanceBlock(queries, query, 1, *m_pData, 0, m_pData->rows(), block);
+	const GVec& dists = block[0];
 	GClosestNeighborFindingHelper helper(k, m_neighs, m_dists);
 	for(size_t i = 0; i < m_pData->rows(); i++)
 	{
 		if(i == exclude)
 			continue;
-		helper.TryPoint(i, m_pMetric->squaredDistance(vec, m_pData->row(i)));
+		helper.TryPoint(i, dists[i]);
 	}
 	return m_neighs.size();
 }
 
-size_t GBruteForceNeighborFinder::findWithinRadius(double squaredRadius, const GVec& vec, size_t exclude)
+size_t GBruteForceNeighborFinder::findWithinRadius(double squaredRadius, const GMatrix& queries, size_t query, size_t exclude)
 {
+	GMatrix block;
+	m_pMetric->squaredDistanceBlock(queries, query, 1, *m_pData, 0, m_pData->rows(), block);
+	const GVec& dists = block[0];
 	m_neighs.clear();
 	m_dists.clear();
 	for(size_t i = 0; i < m_pData->rows(); i++)
 	{
 		if(i == exclude)
 			continue;
-		double d = m_pMetric->squaredDistance(vec, m_pData->row(i));
+		double d = dists[i];
 		if(d <= squaredRadius)
 		{
 			m_neighs.push_back(i);
@@ -481,25 +489,29 @@ size_t GBruteForceNeighborFinder::findWithinRadius(double squaredRadius, const G
 // virtual
 size_t GBruteForceNeighborFinder::findNearest(size_t k, const GVec& vec)
 {
-	return findNearest(k, vec, INVALID_INDEX);
+	GMatrix query(1, vec.size());
+	query[0].copy(vec);
+	return findNearest(k, query, 0, INVALID_INDEX);
 }
 
 // virtual
 size_t GBruteForceNeighborFinder::findNearest(size_t k, size_t index)
 {
-	return findNearest(k, m_pData->row(index), index);
+	return findNearest(k, *m_pData, index, index);
 }
 
 // virtual
 size_t GBruteForceNeighborFinder::findWithinRadius(double squaredRadius, const GVec& vec)
 {
-	return findWithinRadius(squaredRadius, vec, INVALID_INDEX);
+	GMatrix query(1, vec.size());
+	query[0].copy(vec);
+	return findWithinRadius(squaredRadius, query, 0, INVALID_INDEX);
 }
 
 // virtual
 size_t GBruteForceNeighborFinder::findWithinRadius(double squaredRadius, size_t index)
 {
-	return findWithinRadius(squaredRadius, m_pData->row(index), index);
+	return findWithinRadius(squaredRadius, *m_pData, index, index);
 }
 
 // --------------------------------------------------------------------------------
@@ -1379,6 +1391,27 @@ void GKdTree::test()
 				throw Ex("Neighbors out of order");
 		}
 	}
+
+	// A kernel distance measures its block of distances with the kernel, and should find the same neighbors
+	GKernelDistance kernelMetric(GKernel::kernelComplex1(), true);
+	kernelMetric.init(&data.relation(), false);
+	GBruteForceNeighborFinder bfKernel(&data, &kernelMetric, false);
+	GVec query(TEST_DIMS);
+	query.fillNormal(prng);
+	std::vector<double> expected;
+	for(size_t i = 0; i < TEST_PATTERNS; i++)
+		expected.push_back(kernelMetric.squaredDistance(query, data[i]));
+	std::sort(expected.begin(), expected.end());
+	if(bfKernel.findNearest(TEST_NEIGHBORS, query) != TEST_NEIGHBORS)
+		throw Ex("found unexpected number of neighbors");
+	bfKernel.sortNeighbors();
+	for(size_t j = 0; j < TEST_NEIGHBORS; j++)
+	{
+		if(std::abs(bfKernel.distance(j) - expected[j]) > 1e-12)
+			throw Ex("wrong kernel distance");
+		if(std::abs(bfKernel.distance(j) - kernelMetric.squaredDistance(query, data[bfKernel.neighbor(j)])) > 1e-12)
+			throw Ex("wrong kernel neighbor");
+	}
 }
 
 // --------------------------------------------------------------------------------------------------------
@@ -221,7 +221,9 @@ protected:
 
 
 /// Finds neighbors by measuring the distance to all points. This one should work properly even if
-/// the distance metric does not support the triangle inequality.
+/// the distance metric does not support the triangle inequality. The distances from each query to all of the
+/// points are measured with one call to GDistanceMetric::squaredDistanceBlock, so metrics that compute blocks
+/// in batches (such as GKernelDistance) are used that way.
 class GBruteForceNeighborFinder : public GNeighborFinderGeneralizing
 {
 public:
@@ -244,8 +246,11 @@ public:
 	virtual size_t findWithinRadius(double squaredRadius, const GVec& vector);
 
 protected:
-	size_t findNearest(size_t k, const GVec& vec, size_t exclude);
-	size_t findWithinRadius(double squaredRadius, const GVec& vec, size_t exclude);
+	/// Finds the k-nearest neighbors of row query of queries, skipping the point at index exclude.
+	size_t findNearest(size_t k, const GMatrix& queries, size_t query, size_t exclude);
+
+	/// Finds the neighbors of row query of queries within a radius, skipping the point at index exclude.
+	size_t findWithinRadius(double squaredRadius, const GMatrix& queries, size_t query, size_t exclude);
 };
 
 
@@ -112,6 +112,7 @@ GBlock* GBlock::deserialize(GDomNode* pNode, GRand& rand)
 	else if(strcmp(type, "GBlockSoftExp") == 0) return new GBlockSoftExp(pNode);
 	else if(strcmp(type, "GBlockPAL") == 0) return new GBlockPAL(pNode, rand);
 	else if(strcmp(type, "GBlockLSTM") == 0) return new GBlockLSTM(pNode);
+	else if(strcmp(type, "GBlockRunningNormalizer") == 0) return new GBlockRunningNormalizer(pNode);
 	else throw Ex("Unrecognized neural network block type: ", type);
 }
 
@@ -1109,9 +1110,17 @@ GBlockRunningNormalizer::GBlockRunningNormalizer(size_t units, double effective_
 }
 
 GBlockRunningNormalizer::GBlockRunningNormalizer(GDomNode* pNode)
-: GBlock(pNode)
+: GBlock(pNode), batch_size(pNode->getDouble("batch_size")), inv_bs(1.0 / batch_size), decay_scalar(1.0 - inv_bs), epsilon(pNode->getDouble("epsilon"))
 {}
 
+GDomNode* GBlockRunningNormalizer::serialize(GDom* pDoc) const
+{
+	GDomNode* pNode = baseDomNode(pDoc);
+	pNode->add(pDoc, "batch_size", batch_size);
+	pNode->add(pDoc, "epsilon", epsilon);
+	return pNode;
+}
+
 void GBlockRunningNormalizer::forwardProp()
 {
 	size_t pos = 0;
@@ -1226,6 +1235,22 @@ void GBlockRunningNormalizer::initWeights(GRand& rand)
 	}
 }
 
+void GBlockRunningNormalizer::affine(GVec& scale, GVec& shift) const
+{
+	scale.resize(outputCount);
+	shift.resize(outputCount);
+	size_t pos = 0;
+	for(size_t i = 0; i < outputCount; i++)
+	{
+		double running_mean = weights[pos++] * inv_bs;
+		double running_var = weights[pos++] * inv_bs - (running_mean * running_mean);
+		double gamma = weights[pos++];
+		double beta = weights[pos++];
+		scale[i] = gamma / std::sqrt(running_var + epsilon);
+		shift[i] = beta - scale[i] * running_mean;
+	}
+}
+
 
 
 
@@ -1532,56 +1557,52 @@ GDomNode* GBlockConv::serialize(GDom* pDoc) const
 	return pNode;
 }
 
-void GBlockConv::forwardProp()
+void GBlockConv::lowerInput()
 {
 	tensorInput.setData(input);
-	size_t weightsPos = 0;
-	size_t outPos = 0;
+	m_cols.resize(filterSize * outputsPerFilter);
+	GTensor::im2col(tensorInput, tensorFilter.shape, tensorOutput.shape, 1, m_cols.data());
+}
+
+void GBlockConv::forwardProp()
+{
+	if(filterCount * (filterSize + 1) != weights.size())
+		throw Ex("Expected ", GClasses::to_str(filterCount * (filterSize + 1)), " weights. Got ", GClasses::to_str(weights.size()));
+
+	// Initialize each output channel with its bias value
 	for(size_t i = 0; i < filterCount; i++)
-	{
-		tensorOutput.setData(output, outPos, outputsPerFilter);
-		tensorOutput.fill(weights[weightsPos++]); // initialize with the bias value
-		tensorFilter.setData(*(GVec*)&weights, weightsPos, filterSize);
-		GTensor::convolve(tensorInput, tensorFilter, tensorOutput, false, 1);
-		weightsPos += filterSize;
-		outPos += outputsPerFilter;
-	}
-	if(weightsPos != weights.size())
-		throw Ex("Expected ", GClasses::to_str(weightsPos), " weights. Got ", GClasses::to_str(weights.size()));
+		output.fill(weights[i * (filterSize + 1)], i * outputsPerFilter, outputsPerFilter);
+
+	// output += filters * cols
+	lowerInput();
+	GVec::gemm(false, false, filterCount, outputsPerFilter, filterSize, weights.data() + 1, filterSize + 1, m_cols.data(), outputsPerFilter, output.data(), outputsPerFilter);
 }
 
 void GBlockConv::backProp()
 {
+	// colBlame = filters^T * outBlame
+	m_colBlame.resize(filterSize * outputsPerFilter);
+	m_colBlame.fill(0.0);
+	GVec::gemm(true, false, filterSize, outputsPerFilter, filterCount, weights.data() + 1, filterSize + 1, outBlame.data(), outputsPerFilter, m_colBlame.data(), outputsPerFilter);
+
+	// Scatter the blame back to the positions in the input that it came from
 	tensorInput.setData(inBlame);
-	size_t weightsPos = 0;
-	size_t outPos = 0;
-	for(size_t i = 0; i < filterCount; i++)
-	{
-		tensorOutput.setData(outBlame, outPos, outputsPerFilter);
-		weightsPos++; // skip the bias
-		tensorFilter.setData(*(GVec*)&weights, weightsPos, filterSize);
-		GTensor::convolve(tensorFilter, tensorOutput, tensorInput, true, 1);
-		weightsPos += filterSize;
-		outPos += outputsPerFilter;
-	}
-	GAssert(weightsPos == weights.size());
+	GTensor::col2im(m_colBlame.data(), tensorFilter.shape, tensorOutput.shape, 1, tensorInput);
 }
 
 void GBlockConv::updateGradient()
 {
-	tensorInput.setData(input);
-	size_t gradPos = 0;
-	size_t outPos = 0;
+	// The bias gradients
 	for(size_t i = 0; i < filterCount; i++)
 	{
-		tensorOutput.setData(outBlame, outPos, outputsPerFilter);
-		gradient[gradPos++] += tensorOutput.sum(); // the bias gradient
-		tensorFilter.setData(gradient, gradPos, filterSize);
-		GTensor::convolve(tensorInput, tensorOutput, tensorFilter, false, 1);
-		gradPos += filterSize;
-		outPos += outputsPerFilter;
+		const GConstVecWrapper blame(outBlame, i * outputsPerFilter, outputsPerFilter);
+		gradient[i * (filterSize + 1)] += blame.sum();
 	}
-	GAssert(gradPos == weights.size());
+
+	// filterGradient += outBlame * cols^T
+	// (The input is lowered again because callers are not required to call forwardProp with the same input first.)
+	lowerInput();
+	GVec::gemm(false, true, filterCount, filterSize, outputsPerFilter, outBlame.data(), outputsPerFilter, m_cols.data(), outputsPerFilter, gradient.data() + 1, filterSize + 1);
 }
 
 size_t GBlockConv::weightCount() const
@@ -1628,6 +1649,12 @@ void GBlockConv::test()
 	if(std::abs(1.0 - grad[2]) > 1e-8) throw Ex("wrong");
 	if(std::abs(6.0 - grad[3]) > 1e-8) throw Ex("wrong");
 */
+
+	// Test the gradients of a multi-channel 2D convolution, and of one with an even-sized filter
+	GBlockConv b1({6, 5, 2}, {3, 3, 2, 3}, {6, 5, 1, 3});
+	b1.finiteDifferencingTest();
+	GBlockConv b2({5, 4}, {2, 2, 2}, {4, 3, 2});
+	b2.finiteDifferencingTest();
 }
 
 
@@ -1641,12 +1668,15 @@ width(_width),
 height(_height),
 channels(_channels)
 {
-	if((width % 1) || (height % 1))
+	if((width % 2) || (height % 2))
 		throw Ex("Expected an even width and height");
 }
 
 GBlockMaxPooling2D::GBlockMaxPooling2D(GDomNode* pNode)
-: GBlockWeightless(pNode)
+: GBlockWeightless(pNode),
+width(pNode->getInt("width")),
+height(pNode->getInt("height")),
+channels(pNode->getInt("channels"))
 {
 }
 
@@ -1654,67 +1684,91 @@ GBlockMaxPooling2D::~GBlockMaxPooling2D()
 {
 }
 
+// virtual
+GDomNode* GBlockMaxPooling2D::serialize(GDom* pDoc) const
+{
+	GDomNode* pNode = baseDomNode(pDoc);
+	pNode->add(pDoc, "width", width);
+	pNode->add(pDoc, "height", height);
+	pNode->add(pDoc, "channels", channels);
+	return pNode;
+}
+
 // virtual
 void GBlockMaxPooling2D::forwardProp()
 {
-	size_t chanSize = width * height;
-	size_t chanStart = 0;
-	size_t pos = 0;
-	for(size_t c = 0; c < channels; c++)
+	// Each pass of the inner loop consumes two adjacent input rows, so it can be vectorized
+	size_t halfWidth = width / 2;
+	size_t rowPairs = height / 2 * channels;
+	const double* pIn = input.data();
+	double* pOut = output.data();
+	for(size_t r = 0; r < rowPairs; r++)
 	{
-		size_t vertStart = chanStart;
-		for(size_t y = 0; y < height; y += 2)
-		{
-			for(size_t x = 0; x < width; x += 2)
-			{
-				output[pos++] = std::max(
-						std::max(input[vertStart + x], input[vertStart + 1 + x]),
-						std::max(input[vertStart + width + x], input[vertStart + width + 1 + x])
-					);
-			}
-			vertStart += (width + width);
-		}
-		chanStart += chanSize;
+		const double* pTop = pIn;
+		const double* pBot = pIn + width;
+		for(size_t x = 0; x < halfWidth; x++)
+			pOut[x] = std::max(std::max(pTop[2 * x], pTop[2 * x + 1]), std::max(pBot[2 * x], pBot[2 * x + 1]));
+		pIn += 2 * width;
+		pOut += halfWidth;
 	}
 }
 
 void GBlockMaxPooling2D::backProp()
 {
-	size_t chanSize = width * height;
-	size_t chanStart = 0;
-	size_t pos = 0;
-	for(size_t c = 0; c < channels; c++)
+	// The blame goes to the first of the four inputs that holds the maximum value, just as forwardProp picked it
+	size_t halfWidth = width / 2;
+	size_t rowPairs = height / 2 * channels;
+	const double* pIn = input.data();
+	double* pInBlame = inBlame.data();
+	const double* pOutBlame = outBlame.data();
+	for(size_t r = 0; r < rowPairs; r++)
 	{
-		size_t vertStart = chanStart;
-		for(size_t y = 0; y < height; y += 2)
+		for(size_t x = 0; x < 2 * halfWidth; x += 2)
 		{
-			for(size_t x = 0; x < width; x += 2)
-			{
-				size_t i = vertStart + x;
-				double d = input[i];
-				double cand = input[i + 1];
-				if(cand > d)
-				{
-					d = cand;
-					i++;
-				}
-				cand = input[vertStart + width + x];
-				if(cand > d)
-				{
-					d = cand;
-					i = vertStart + width + x;
-				}
-				cand = input[vertStart + width + 1 + x];
-				if(cand > d)
-					i = vertStart + width + 1 + x;
-				inBlame[i] += outBlame[pos++];
-			}
-			vertStart += (width + width);
+			size_t best = x;
+			if(pIn[x + 1] > pIn[best])
+				best = x + 1;
+			if(pIn[width + x] > pIn[best])
+				best = width + x;
+			if(pIn[width + x + 1] > pIn[best])
+				best = width + x + 1;
+			pInBlame[best] += pOutBlame[x / 2];
 		}
-		chanStart += chanSize;
+		pIn += 2 * width;
+		pInBlame += 2 * width;
+		pOutBlame += halfWidth;
 	}
 }
 
+// static
+void GBlockMaxPooling2D::test()
+{
+	GBlockMaxPooling2D b(4, 2, 2);
+	GVec in({1, 5, 2, 0, 3, 4, 9, 1, /* second channel */ 0, 0, -1, -3, 0, 7, -2, -4});
+	GVec inBl(in.size());
+	inBl.fill(0.0);
+	b.bind(&in, nullptr, nullptr, &inBl, nullptr, nullptr);
+	b.forwardProp();
+	GVec expected({5, 9, 7, -1});
+	if(std::sqrt(b.output.squaredDistance(expected)) > 1e-10)
+		throw Ex("wrong");
+	b.outBlame.fill(1.0);
+	b.backProp();
+	GVec expectedBlame({0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 1, 0, 0});
+	if(std::sqrt(inBl.squaredDistance(expectedBlame)) > 1e-10)
+		throw Ex("wrong");
+
+	// Make sure the dimensions survive a round-trip through serialization
+	GDom doc;
+	GBlockMaxPooling2D b2(b.serialize(&doc));
+	if(b2.outputs() != 4 || b2.inputs() != 16)
+		throw Ex("serialization failed");
+	b2.bind(&in, nullptr, nullptr, &inBl, nullptr, nullptr);
+	b2.forwardProp();
+	if(std::sqrt(b2.output.squaredDistance(expected)) > 1e-10)
+		throw Ex("serialization failed");
+}
+
 
 
 
@@ -3506,6 +3560,22 @@ GDomNode* GNeuralNet::serialize(GDom* pDoc) const
 	return pNode;
 }
 
+void GNeuralNet::serializeStream(GJsonWriter& writer) const
+{
+	GDom doc;
+	GDomNode* pNode = baseDomNode(&doc);
+	GDomNode* pLayers = pNode->add(&doc, "layers", doc.newList());
+	for(size_t i = 0; i < m_layers.size(); i++)
+		pLayers->add(&doc, m_layers[i]->serialize(&doc));
+	if(weights.size() == 0)
+		throw Ex("Attempted to serialize a neural net that was never initialized");
+	writer.beginObj();
+	writer.writeFields(pNode);
+	writer.key("weights");
+	weights.serializeStream(writer);
+	writer.endObj();
+}
+
 void GNeuralNet::deserialize(GDomNode* pNode, GRand& rand)
 {
 	deleteAllLayers();
@@ -4910,6 +4980,436 @@ void GBlockResidual::backProp()
 
 
 
+GCompiledNeuralNet::Op::Op(OpType t, size_t in, size_t out)
+: type(t), inputs(in), outputs(out), inPos(0), outPos(0), pActivation(nullptr)
+{
+}
+
+GCompiledNeuralNet::Op::~Op()
+{
+	delete(pActivation);
+	for(size_t i = 0; i < blocks.size(); i++)
+		delete(blocks[i]);
+	for(size_t i = 0; i < blockWeights.size(); i++)
+		delete(blockWeights[i]);
+}
+
+// Returns true iff blocks of the specified type are derived from GBlockActivation
+bool GCompiledNeuralNet_isActivation(GBlock::BlockType t)
+{
+	return t >= GBlock::block_identity && t <= GBlock::block_softroot;
+}
+
+GCompiledNeuralNet::GCompiledNeuralNet(const GNeuralNet& nn)
+: m_inputs(nn.inputs()), m_outputs(nn.outputs())
+{
+	if(nn.weights.size() != nn.weightCount())
+		throw Ex("The neural network must be initialized before it is compiled");
+	for(size_t i = 0; i < nn.layerCount(); i++)
+	{
+		const GLayer& lay = nn.layer(i);
+		if(lay.blockCount() == 1 && lay.block(0).inPos() == 0 && lay.block(0).inputs() == lay.inputs())
+		{
+			const GBlock& b = lay.block(0);
+			if(b.type() == GBlock::block_identity)
+				continue;
+			else if(b.type() == GBlock::block_linear)
+			{
+				Op* pOp = new Op(op_dense, b.inputs(), b.outputs());
+				pOp->weights.copy(b.weights);
+				addDense(pOp);
+				continue;
+			}
+			else if(b.type() == GBlock::block_running_normalizer)
+			{
+				GVec scale, shift;
+				((const GBlockRunningNormalizer&)b).affine(scale, shift);
+				addAffine(scale, shift);
+				continue;
+			}
+			else if(GCompiledNeuralNet_isActivation(b.type()))
+			{
+				addActivation((GBlockActivation*)b.clone());
+				continue;
+			}
+		}
+
+		// Evaluate this layer with copies of its blocks
+		Op* pOp = new Op(op_blocks, lay.inputs(), lay.outputs());
+		m_ops.push_back(pOp);
+		for(size_t j = 0; j < lay.blockCount(); j++)
+		{
+			const GBlock& b = lay.block(j);
+			if(b.isRecurrent())
+				throw Ex("Recurrent blocks cannot be compiled");
+			pOp->blocks.push_back(b.clone());
+			GVec* pWeights = new GVec();
+			pOp->blockWeights.push_back(pWeights);
+			pWeights->copy(b.weights);
+		}
+	}
+	plan();
+}
+
+GCompiledNeuralNet::GCompiledNeuralNet(const GDomNode* pNode, GRand& rand)
+: m_inputs((size_t)pNode->getInt("inputs")), m_outputs((size_t)pNode->getInt("outputs"))
+{
+	GDomListIterator it(pNode->get("ops"));
+	while(it.remaining() > 0)
+	{
+		GDomNode* pOpNode = it.current();
+		const char* szType = pOpNode->getString("op");
+		OpType t;
+		if(strcmp(szType, "dense") == 0)
+			t = op_dense;
+		else if(strcmp(szType, "affine") == 0)
+			t = op_affine;
+		else if(strcmp(szType, "activation") == 0)
+			t = op_activation;
+		else if(strcmp(szType, "blocks") == 0)
+			t = op_blocks;
+		else
+			throw Ex("Unrecognized operation: ", szType);
+		Op* pOp = new Op(t, (size_t)pOpNode->getInt("in"), (size_t)pOpNode->getInt("out"));
+		m_ops.push_back(pOp);
+		if(t == op_dense || t == op_affine)
+			pOp->weights.deserialize(pOpNode->get("weights"));
+		GDomNode* pAct = pOpNode->getIfExists("act");
+		if(pAct)
+		{
+			GBlock* pBlock = GBlock::deserialize(pAct, rand);
+			if(!GCompiledNeuralNet_isActivation(pBlock->type()))
+			{
+				delete(pBlock);
+				throw Ex("Expected an activation function");
+			}
+			pOp->pActivation = (GBlockActivation*)pBlock;
+		}
+		if(t == op_blocks)
+		{
+			GDomListIterator itBlocks(pOpNode->get("blocks"));
+			while(itBlocks.remaining() > 0)
+			{
+				pOp->blocks.push_back(GBlock::deserialize(itBlocks.current()->get("block"), rand));
+				pOp->blockWeights.push_back(new GVec(itBlocks.current()->get("weights")));
+				itBlocks.advance();
+			}
+		}
+		it.advance();
+	}
+	plan();
+}
+
+GCompiledNeuralNet::~GCompiledNeuralNet()
+{
+	for(size_t i = 0; i < m_ops.size(); i++)
+		delete(m_ops[i]);
+}
+
+GDomNode* GCompiledNeuralNet::serialize(GDom* pDoc) const
+{
+	GDomNode* pNode = pDoc->newObj();
+	pNode->add(pDoc, "inputs", m_inputs);
+	pNode->add(pDoc, "outputs", m_outputs);
+	GDomNode* pOps = pNode->add(pDoc, "ops", pDoc->newList());
+	for(size_t i = 0; i < m_ops.size(); i++)
+	{
+		const Op* pOp = m_ops[i];
+		GDomNode* pOpNode = pOps->add(pDoc, pDoc->newObj());
+		const char* szType = "blocks";
+		if(pOp->type == op_dense)
+			szType = "dense";
+		else if(pOp->type == op_affine)
+			szType = "affine";
+		else if(pOp->type == op_activation)
+			szType = "activation";
+		pOpNode->add(pDoc, "op", szType);
+		pOpNode->add(pDoc, "in", pOp->inputs);
+		pOpNode->add(pDoc, "out", pOp->outputs);
+		if(pOp->type == op_dense || pOp->type == op_affine)
+			pOpNode->add(pDoc, "weights", pOp->weights.serialize(pDoc));
+		if(pOp->pActivation)
+			pOpNode->add(pDoc, "act", pOp->pActivation->serialize(pDoc));
+		if(pOp->type == op_blocks)
+		{
+			GDomNode* pBlocks = pOpNode->add(pDoc, "blocks", pDoc->newList());
+			for(size_t j = 0; j < pOp->blocks.size(); j++)
+			{
+				GDomNode* pBlockNode = pBlocks->add(pDoc, pDoc->newObj());
+				pBlockNode->add(pDoc, "block", pOp->blocks[j]->serialize(pDoc));
+				pBlockNode->add(pDoc, "weights", pOp->blockWeights[j]->serialize(pDoc));
+			}
+		}
+	}
+	return pNode;
+}
+
+void GCompiledNeuralNet::addDense(Op* pOp)
+{
+	size_t in = pOp->inputs;
+	size_t out = pOp->outputs;
+	if(m_ops.size() > 0 && m_ops.back()->type == op_affine && m_ops.back()->outputs == in)
+	{
+		// Fold the preceding scale and shift into the inputs of this op
+		Op* pPrev = m_ops.back();
+		const double* pScale = pPrev->weights.data();
+		const double* pShift = pScale + in;
+		double* pBias = pOp->weights.data();
+		for(size_t i = 0; i < in; i++)
+		{
+			double* pRow = pBias + out * (i + 1);
+			for(size_t j = 0; j < out; j++)
+			{
+				pBias[j] += pShift[i] * pRow[j];
+				pRow[j] *= pScale[i];
+			}
+		}
+		delete(pPrev);
+		m_ops.pop_back();
+	}
+	if(m_ops.size() > 0 && m_ops.back()->type == op_dense && !m_ops.back()->pActivation && m_ops.back()->outputs == in)
+	{
+		// Merge two consecutive linear ops if the product is cheaper than evaluating both
+		Op* pPrev = m_ops.back();
+		size_t first = pPrev->inputs;
+		if(first * out <= first * in + in * out)
+		{
+			GVec merged((first + 1) * out);
+			merged.copy(0, pOp->weights, 0, out);
+			merged.fill(0.0, out, first * out);
+			const double* pW = pOp->weights.data() + out;
+			GVec::gemm(false, false, 1, out, in, pPrev->weights.data(), in, pW, out, merged.data(), out);
+			GVec::gemm(false, false, first, out, in, pPrev->weights.data() + in, in, pW, out, merged.data() + out, out);
+			pPrev->weights.swapContents(merged);
+			pPrev->outputs = out;
+			delete(pOp);
+			return;
+		}
+	}
+	m_ops.push_back(pOp);
+}
+
+void GCompiledNeuralNet::addAffine(const GVec& scale, const GVec& shift)
+{
+	size_t n = scale.size();
+	if(m_ops.size() > 0 && m_ops.back()->outputs == n)
+	{
+		Op* pPrev = m_ops.back();
+		if(pPrev->type == op_dense && !pPrev->pActivation)
+		{
+			// Fold into the outputs of the preceding linear op
+			double* pBias = pPrev->weights.data();
+			for(size_t j = 0; j < n; j++)
+				pBias[j] = scale[j] * pBias[j] + shift[j];
+			for(size_t i = 0; i < pPrev->inputs; i++)
+			{
+				double* pRow = pBias + n * (i + 1);
+				for(size_t j = 0; j < n; j++)
+					pRow[j] *= scale[j];
+			}
+			return;
+		}
+		else if(pPrev->type == op_affine)
+		{
+			// Compose with the preceding scale and shift
+			double* pScale = pPrev->weights.data();
+			double* pShift = pScale + n;
+			for(size_t j = 0; j < n; j++)
+			{
+				pScale[j] *= scale[j];
+				pShift[j] = scale[j] * pShift[j] + shift[j];
+			}
+			return;
+		}
+	}
+	Op* pOp = new Op(op_affine, n, n);
+	pOp->weights.resize(2 * n);
+	pOp->weights.copy(0, scale);
+	pOp->weights.copy(n, shift);
+	m_ops.push_back(pOp);
+}
+
+void GCompiledNeuralNet::addActivation(GBlockActivation* pAct)
+{
+	size_t n = pAct->outputs();
+	if(m_ops.size() > 0 && m_ops.back()->type == op_dense && !m_ops.back()->pActivation && m_ops.back()->outputs == n)
+	{
+		m_ops.back()->pActivation = pAct;
+		return;
+	}
+	Op* pOp = new Op(op_activation, n, n);
+	pOp->pActivation = pAct;
+	m_ops.push_back(pOp);
+}
+
+void GCompiledNeuralNet::plan()
+{
+	// The arena has two regions, each large enough for the widest vector.
+	// Each op reads from one region and writes to the other, except element-wise ops, which work in place.
+	size_t width = m_inputs;
+	for(size_t i = 0; i < m_ops.size(); i++)
+		width = std::max(width, std::max(m_ops[i]->inputs, m_ops[i]->outputs));
+	m_arena.resize(2 * width);
+	m_arena.fill(0.0);
+	size_t pos = 0;
+	size_t size = m_inputs;
+	for(size_t i = 0; i < m_ops.size(); i++)
+	{
+		Op* pOp = m_ops[i];
+		if(pOp->inputs != size)
+			throw Ex("Operation ", GClasses::to_str(i), " expects ", GClasses::to_str(pOp->inputs), " inputs, but is given ", GClasses::to_str(size));
+		pOp->inPos = pos;
+		if(pOp->type == op_affine || pOp->type == op_activation)
+			pOp->outPos = pos;
+		else
+			pOp->outPos = (pos == 0 ? width : 0);
+		if(pOp->type == op_blocks)
+		{
+			size_t outPos = pOp->outPos;
+			for(size_t j = 0; j < pOp->blocks.size(); j++)
+			{
+				GBlock* pBlock = pOp->blocks[j];
+				if(pBlock->inPos() + pBlock->inputs() > pOp->inputs)
+					throw Ex("Block inputs out of range");
+				GConstVecWrapper in(m_arena, pOp->inPos + pBlock->inPos(), pBlock->inputs());
+				GVecWrapper out(m_arena, outPos, pBlock->outputs());
+				pBlock->bind(&in, &out, nullptr, nullptr, pOp->blockWeights[j], nullptr);
+				outPos += pBlock->outputs();
+			}
+		}
+		pos = pOp->outPos;
+		size = pOp->outputs;
+	}
+	if(size != m_outputs)
+		throw Ex("Expected ", GClasses::to_str(m_outputs), " outputs. Got ", GClasses::to_str(size));
+	m_output.setData(m_arena, pos, m_outputs);
+}
+
+// Applies an activation function in place
+void GCompiledNeuralNet_activate(const GBlockActivation* pAct, double* pVals, size_t n)
+{
+	switch(pAct->type())
+	{
+		case GBlock::block_tanh:
+			for(size_t i = 0; i < n; i++)
+				pVals[i] = std::tanh(pVals[i]);
+			break;
+		case GBlock::block_rectifier:
+			for(size_t i = 0; i < n; i++)
+				pVals[i] = std::max(0.0, pVals[i]);
+			break;
+		default:
+			for(size_t i = 0; i < n; i++)
+				pVals[i] = pAct->eval(pVals[i]);
+	}
+}
+
+const GVec& GCompiledNeuralNet::forwardProp(const GVec& input)
+{
+	if(input.size() != m_inputs)
+		throw Ex("Expected ", GClasses::to_str(m_inputs), " inputs. Got ", GClasses::to_str(input.size()));
+	double* pArena = m_arena.data();
+	memcpy(pArena, input.data(), sizeof(double) * m_inputs);
+	for(size_t i = 0; i < m_ops.size(); i++)
+	{
+		Op* pOp = m_ops[i];
+		const double* pIn = pArena + pOp->inPos;
+		double* pOut = pArena + pOp->outPos;
+		size_t out = pOp->outputs;
+		switch(pOp->type)
+		{
+			case op_dense:
+				memcpy(pOut, pOp->weights.data(), sizeof(double) * out);
+				GVec::gemm(false, false, 1, out, pOp->inputs, pIn, pOp->inputs, pOp->weights.data() + out, out, pOut, out);
+				if(pOp->pActivation)
+					GCompiledNeuralNet_activate(pOp->pActivation, pOut, out);
+				break;
+			case op_affine:
+			{
+				const double* pScale = pOp->weights.data();
+				const double* pShift = pScale + out;
+				for(size_t j = 0; j < out; j++)
+					pOut[j] = pScale[j] * pIn[j] + pShift[j];
+				break;
+			}
+			case op_activation:
+				GCompiledNeuralNet_activate(pOp->pActivation, pOut, out);
+				break;
+			case op_blocks:
+				for(size_t j = 0; j < pOp->blocks.size(); j++)
+					pOp->blocks[j]->forwardProp();
+				break;
+		}
+	}
+	return m_output;
+}
+
+// static
+void GCompiledNeuralNet::test()
+{
+	GRand rand(0);
+	GNeuralNet nn;
+	GBlockRunningNormalizer* pNorm1 = new GBlockRunningNormalizer(5, 10.0);
+	GBlockRunningNormalizer* pNorm2 = new GBlockRunningNormalizer(8, 10.0);
+	GBlockRunningNormalizer* pNorm3 = new GBlockRunningNormalizer(3, 10.0);
+	nn.add(pNorm1); // folds into the next linear block
+	nn.add(new GBlockLinear(5, 8), new GBlockTanh(8));
+	nn.add(pNorm2); // folds into the next linear block
+	nn.add(new GBlockLinear(8, 6), new GBlockIdentity(6), new GBlockLeakyRectifier(6));
+	nn.add(new GBlockLinear(6, 6), new GBlockLinear(6, 3)); // merge into one
+	nn.add(pNorm3); // folds into the preceding linear block
+	nn.add(new GBlockLogistic(3));
+	nn.add(new GBlockTanh(3)); // a layer with two blocks is evaluated by copies of the blocks
+	nn.concat(new GBlockLinear(3, 2), 0);
+	nn.add(new GBlockLinear(5, 2));
+	nn.init(rand);
+
+	// Give the normalizers some non-trivial statistics
+	GBlockRunningNormalizer* norms[] = { pNorm1, pNorm2, pNorm3 };
+	for(size_t i = 0; i < 3; i++)
+	{
+		GBlock& b = *norms[i];
+		for(size_t j = 0; j < b.outputs(); j++)
+		{
+			double mean = rand.normal();
+			double var = 0.5 + rand.uniform();
+			b.weights[4 * j] = 10.0 * mean;
+			b.weights[4 * j + 1] = 10.0 * (var + mean * mean);
+			b.weights[4 * j + 2] = 0.5 + rand.uniform();
+			b.weights[4 * j + 3] = rand.normal();
+		}
+	}
+
+	GCompiledNeuralNet compiled(nn);
+	if(compiled.opCount() != 5)
+		throw Ex("Expected 5 ops. Got ", GClasses::to_str(compiled.opCount()));
+	if(compiled.arenaSize() != 16)
+		throw Ex("Unexpected arena size");
+	GDom doc;
+	doc.setRoot(compiled.serialize(&doc));
+	GCompiledNeuralNet loaded(doc.root(), rand);
+	GVec in(5);
+	for(size_t i = 0; i < 20; i++)
+	{
+		in.fillNormal(rand);
+		GVec& expected = nn.forwardProp(in);
+		const GVec& actual = compiled.forwardProp(in);
+		if(std::sqrt(expected.squaredDistance(actual)) > 1e-9)
+			throw Ex("The compiled network does not match the original");
+		if(std::sqrt(expected.squaredDistance(loaded.forwardProp(in))) > 1e-9)
+			throw Ex("The deserialized network does not match the original");
+	}
+}
+
+
+
+
+
+
+
+
+
+
 GNeuralNetLearner::GNeuralNetLearner()
 : GIncrementalLearner(), m_pOptimizer(nullptr)
 {}
@@ -4941,6 +5441,15 @@ GDomNode* GNeuralNetLearner::serialize(GDom* pDoc) const
 	return pNode;
 }
 
+// virtual
+void GNeuralNetLearner::serializeStream(GJsonWriter& writer) const
+{
+	baseStreamObj(writer, "GNeuralNetLearner");
+	writer.key("nn");
+	m_nn.serializeStream(writer);
+	writer.endObj();
+}
+
 void GNeuralNetLearner::trainIncremental(const GVec &in, const GVec &out)
 {
 	throw Ex("GNeuralNetLearner::trainIncremental is not implemented (need to use GDifferentiableOptimizer).");
@@ -97,6 +97,7 @@ public:
 		block_catout,
 		block_weight_digester,
 		block_optional,
+		block_running_normalizer,
 
 		// weightless transfer
 		block_scalarsum,
@@ -918,7 +919,8 @@ public:
 	GBlockRunningNormalizer(size_t units, double effective_batch_size);
 
 	/// Copy constructor
-	GBlockRunningNormalizer(const GBlockRunningNormalizer& that) : GBlock(that) {}
+	GBlockRunningNormalizer(const GBlockRunningNormalizer& that)
+	: GBlock(that), batch_size(that.batch_size), inv_bs(that.inv_bs), decay_scalar(that.decay_scalar), epsilon(that.epsilon) {}
 
 	/// Unmarshalling constructor
 	GBlockRunningNormalizer(GDomNode* pNode);
@@ -927,11 +929,14 @@ public:
 	virtual ~GBlockRunningNormalizer() {}
 
 	/// Returns the type of this block
-	virtual BlockType type() const override { return block_linear; }
+	virtual BlockType type() const override { return block_running_normalizer; }
 
 	/// Returns the name of this block
 	virtual std::string name() const override { return "GBlockRunningNormalizer"; }
 
+	/// Marshall this block into a DOM.
+	virtual GDomNode* serialize(GDom* pDoc) const override;
+
 	/// Returns a copy of this block
 	virtual GBlockRunningNormalizer* clone() const override { return new GBlockRunningNormalizer(*this); }
 
@@ -957,6 +962,10 @@ public:
 
 	/// Initialize the weights with small random values.
 	virtual void initWeights(GRand& rand) override;
+
+	/// Computes the element-wise scale and shift that this block currently applies to its input.
+	/// That is, output[i] = scale[i] * input[i] + shift[i].
+	void affine(GVec& scale, GVec& shift) const;
 };
 
 
@@ -1066,6 +1075,8 @@ public:
 
 
 /// A convolutional layer.
+/// Internally, the convolution is lowered to a matrix product (see GTensor::im2col), so all of the filters
+/// are applied with a single call to GVec::gemm in each of forwardProp, backProp, and updateGradient.
 class GBlockConv : public GBlock
 {
 protected:
@@ -1075,6 +1086,8 @@ protected:
 	GTensor tensorOutput;
 	size_t filterCount;
 	size_t outputsPerFilter;
+	GVec m_cols; // The lowered input. (filterSize rows by outputsPerFilter columns.)
+	GVec m_colBlame; // The blame on the lowered input. (Same layout as m_cols.)
 
 public:
 	/// General-purpose constructor. Example:
@@ -1120,14 +1133,18 @@ public:
 	virtual void initWeights(GRand& rand) override;
 
 	static void test();
+
+protected:
+	/// Fills m_cols with the lowered input.
+	void lowerInput();
 };
 
 
 
 
 
-/// Treats the input as two concatenated vectors.
-/// Adds each corresponding pair of values together to produce the output.
+/// Shrinks each channel of a 2D image by a factor of two in each dimension by keeping
+/// the largest value in each 2x2 square. (The input is expected in raster order, one channel after another.)
 class GBlockMaxPooling2D : public GBlockWeightless
 {
 protected:
@@ -1139,7 +1156,7 @@ public:
 	GBlockMaxPooling2D(size_t width, size_t height, size_t channels);
 
 	/// Copy constructor
-	GBlockMaxPooling2D(const GBlockMaxPooling2D& that) : GBlockWeightless(that) {}
+	GBlockMaxPooling2D(const GBlockMaxPooling2D& that) : GBlockWeightless(that), width(that.width), height(that.height), channels(that.channels) {}
 
 	/// Deserializing constructor
 	GBlockMaxPooling2D(GDomNode* pNode);
@@ -1147,6 +1164,9 @@ public:
 	/// Destructor
 	~GBlockMaxPooling2D();
 
+	/// Marshall this block into a DOM.
+	virtual GDomNode* serialize(GDom* pDoc) const override;
+
 	/// Returns the type of this block
 	virtual BlockType type() const override { return block_scalarsum; }
 
@@ -1162,6 +1182,9 @@ public:
 	/// Evaluates outBlame, and adds to inBlame.
 	/// (Note that it "adds to" the inBlame because multiple blocks may fork from a common source.)
 	virtual void backProp() override;
+
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
 };
 
 
@@ -2090,6 +2113,10 @@ public:
 	/// Marshal this object into a dom node.
 	GDomNode* serialize(GDom* pDoc) const override;
 
+	/// Writes this object to writer in JSON format, the same as the node returned by serialize, but the weights
+	/// are streamed directly from the weight vector instead of being copied into a DOM first.
+	void serializeStream(GJsonWriter& writer) const;
+
 	/// Unmarshalls this object in place from a dom node.
 	void deserialize(GDomNode* pNode, GRand& rand);
 
@@ -2267,6 +2294,100 @@ class GBlockResidual : public GNeuralNet
 
 
 
+/// An inference-only form of a trained GNeuralNet.
+/// Compiling a neural network fuses each GBlockLinear with the activation function that follows it,
+/// folds GBlockRunningNormalizer blocks into adjacent linear weights, merges consecutive linear
+/// blocks when that reduces the work, and drops GBlockIdentity blocks. All of the intermediate
+/// activations share one arena, which alternates between two regions, so evaluating the network
+/// does not walk through a separate buffer for each layer. Layers that cannot be compiled, such as
+/// layers with several blocks, are evaluated by copies of their original blocks, writing into the arena.
+/// Recurrent blocks are not supported. The compiled network cannot be trained, but it can be serialized
+/// and loaded again.
+class GCompiledNeuralNet
+{
+protected:
+	enum OpType
+	{
+		op_dense, // linear weights, optionally followed by an activation function
+		op_affine, // element-wise scale and shift
+		op_activation, // element-wise activation function
+		op_blocks, // copies of the original blocks of a layer
+	};
+
+	struct Op
+	{
+		OpType type;
+		size_t inputs;
+		size_t outputs;
+		size_t inPos; // offset of the input in the arena
+		size_t outPos; // offset of the output in the arena
+		GVec weights; // op_dense: the biases, then an inputs-by-outputs matrix. op_affine: the scales, then the shifts.
+		GBlockActivation* pActivation;
+		std::vector<GBlock*> blocks;
+		std::vector<GVec*> blockWeights;
+
+		Op(OpType t, size_t in, size_t out);
+		~Op();
+	};
+
+	size_t m_inputs;
+	size_t m_outputs;
+	std::vector<Op*> m_ops;
+	GVec m_arena;
+	GVecWrapper m_output;
+
+public:
+	/// Compiles nn, which must already be initialized with its trained weights.
+	GCompiledNeuralNet(const GNeuralNet& nn);
+
+	/// Deserializing constructor
+	GCompiledNeuralNet(const GDomNode* pNode, GRand& rand);
+
+	~GCompiledNeuralNet();
+
+	/// Marshals this object into a DOM.
+	GDomNode* serialize(GDom* pDoc) const;
+
+	/// Returns the number of inputs this network consumes.
+	size_t inputs() const { return m_inputs; }
+
+	/// Returns the number of outputs this network produces.
+	size_t outputs() const { return m_outputs; }
+
+	/// Returns the number of operations that remain after compiling.
+	size_t opCount() const { return m_ops.size(); }
+
+	/// Returns the number of elements in the activation arena.
+	size_t arenaSize() const { return m_arena.size(); }
+
+	/// Evaluates the input vector. Returns an output vector, which is only valid until the next call.
+	const GVec& forwardProp(const GVec& input);
+
+	/// Run unit tests for this class
+	static void test();
+
+protected:
+	/// Adds a linear operation, folding a preceding element-wise scale and shift into it, and merging it with
+	/// a preceding linear operation if that would be cheaper.
+	void addDense(Op* pOp);
+
+	/// Adds an element-wise scale and shift, folding it into the preceding operation if possible.
+	void addAffine(const GVec& scale, const GVec& shift);
+
+	/// Adds an activation function, fusing it with the preceding operation if possible. Takes ownership of pAct.
+	void addActivation(GBlockActivation* pAct);
+
+	/// Assigns arena offsets to every operation and binds the fallback blocks to the arena.
+	void plan();
+};
+
+
+
+
+
+
+
+
 /// A thin wrapper around a GNeuralNet that implements the GIncrementalLearner interface.
 class GNeuralNetLearner : public GIncrementalLearner
 {
@@ -2294,6 +2415,9 @@ public:
 	/// Saves the model to a text file.
 	virtual GDomNode* serialize(GDom* pDoc) const override;
 
+	/// See the comment for GSupervisedLearner::serializeStream
+	virtual void serializeStream(GJsonWriter& writer) const override;
+
 	/// See the comment for GSupervisedLearner::clear
 	virtual void clear() override;
 
@@ -21,6 +21,7 @@
 #include "GNeuralNet.h"
 #include "GVec.h"
 #include "GRand.h"
+#include "GDataPipeline.h"
 #include <string.h>
 #include <math.h>
 
@@ -159,6 +160,19 @@ void GNeuralNetOptimizer::optimize(const GMatrix &features, const GMatrix &label
 			optimizeBatch(features, labels, ii, m_batchSize);
 }
 
+void GNeuralNetOptimizer::optimize(GDataPipeline& pipeline)
+{
+	if(pipeline.featureDims() != m_model.layer(0).inputs() || pipeline.labelDims() != m_model.outputLayer().outputs())
+		throw Ex("The pipeline delivers ", to_str(pipeline.featureDims()), " features and ", to_str(pipeline.labelDims()), " labels, but the model expects ", to_str(m_model.layer(0).inputs()), " and ", to_str(m_model.outputLayer().outputs()));
+	while(true)
+	{
+		const GDataBatch* pBatch = pipeline.nextBatch();
+		if(!pBatch)
+			break;
+		optimizeBatch(pBatch->features, pBatch->labels, 0, pBatch->rows);
+	}
+}
+
 void GNeuralNetOptimizer::optimizeWithValidation(const GMatrix &features, const GMatrix &labels, const GMatrix &validationFeat, const GMatrix &validationLab)
 {
 	size_t batchesPerEpoch = m_batchesPerEpoch;
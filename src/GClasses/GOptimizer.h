@@ -33,6 +33,7 @@ class GAction;
 class GRand;
 class GNeuralNet;
 class GContextNeuralNet;
+class GDataPipeline;
 
 
 /// Optimizes the parameters of a differentiable function using an objective function.
@@ -98,6 +99,10 @@ public:
 	void optimize(const GMatrix &features, const GMatrix &labels);
 	void optimizeWithValidation(const GMatrix &features, const GMatrix &labels, const GMatrix &validationFeat, const GMatrix &validationLab);
 	void optimizeWithValidation(const GMatrix &features, const GMatrix &labels, double validationPortion = 0.35);
+
+	/// Trains on the minibatches streamed by pipeline until it runs out of data.
+	/// The pipeline's batch size and number of epochs are used instead of the ones set on this object.
+	void optimize(GDataPipeline& pipeline);
 	
 	// getters/setters
 #ifdef GCUDA
@@ -374,6 +374,7 @@ GBaselineRecommender::GBaselineRecommender(const GDomNode* pNode, GLearnerLoader
 : GCollaborativeFilter(pNode, ll)
 {
 	m_ratings.deserialize(pNode->get("ratings"));
+	m_items = m_ratings.size();
 }
 
 // virtual
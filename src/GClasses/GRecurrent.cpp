@@ -0,0 +1,564 @@
+/*
+  The contents of this file are dedicated by all of its authors, including
+
+    Michael S. Gashler,
+    anonymous contributors,
+
+  to the public domain (http://creativecommons.org/publicdomain/zero/1.0/).
+
+  Note that some moral obligations still exist in the absence of legal ones.
+  For example, it would still be dishonest to deliberately misrepresent the
+  origin of a work. Although we impose no legal requirements to obtain a
+  license, it is beseeming for those who build on the works of others to
+  give back useful improvements, or find a way to pay it forward. If
+  you would like to cite us, a published paper about Waffles can be found
+  at http://jmlr.org/papers/volume12/gashler11a/gashler11a.pdf. If you find
+  our code to be useful, the Waffles team would love to hear how you use it.
+*/
+
+#include "GRecurrent.h"
+#include "GDom.h"
+#include "GMath.h"
+#include "GMatrix.h"
+#include "GRand.h"
+#include <string.h>
+#include <math.h>
+#include <memory>
+
+namespace GClasses {
+
+GFusedLSTM::GFusedLSTM(size_t inputs, size_t units, size_t outputs)
+: m_inputs(inputs), m_units(units), m_outputs(outputs)
+{
+	if(units == 0 || outputs == 0)
+		throw Ex("Expected at least one unit and one output");
+	m_weights.resize(gateWeightCount() + (m_units + 1) * m_outputs);
+	m_weights.fill(0.0);
+	resetState();
+}
+
+GFusedLSTM::GFusedLSTM(const GDomNode* pNode)
+: m_inputs((size_t)pNode->getInt("inputs")),
+  m_units((size_t)pNode->getInt("units")),
+  m_outputs((size_t)pNode->getInt("outputs")),
+  m_weights(pNode->get("weights"))
+{
+	if(m_weights.size() != gateWeightCount() + (m_units + 1) * m_outputs)
+		throw Ex("Unexpected number of weights");
+	resetState();
+}
+
+GFusedLSTM::~GFusedLSTM()
+{
+}
+
+GDomNode* GFusedLSTM::serialize(GDom* pDoc) const
+{
+	GDomNode* pNode = pDoc->newObj();
+	pNode->add(pDoc, "class", "GFusedLSTM");
+	pNode->add(pDoc, "inputs", m_inputs);
+	pNode->add(pDoc, "units", m_units);
+	pNode->add(pDoc, "outputs", m_outputs);
+	pNode->add(pDoc, "weights", m_weights.serialize(pDoc));
+	return pNode;
+}
+
+void GFusedLSTM::initWeights(GRand& rand)
+{
+	size_t cols = 4 * m_units;
+	size_t fanIn = m_inputs + m_units;
+	double dev = std::max(0.03, 1.0 / sqrt((double)fanIn));
+	double* pW = m_weights.data();
+	for(size_t i = 0; i < fanIn; i++)
+	{
+		for(size_t j = 0; j < cols; j++)
+			*(pW++) = dev * rand.normal();
+	}
+	for(size_t j = 0; j < cols; j++)
+		*(pW++) = (j >= m_units && j < 2 * m_units) ? 1.0 : 0.0;
+	dev = std::max(0.03, 1.0 / sqrt((double)m_units));
+	for(size_t i = 0; i < m_units; i++)
+	{
+		for(size_t j = 0; j < m_outputs; j++)
+			*(pW++) = dev * rand.normal();
+	}
+	for(size_t j = 0; j < m_outputs; j++)
+		*(pW++) = 0.0;
+}
+
+void GFusedLSTM::resetState()
+{
+	m_hidden.resize(m_units);
+	m_hidden.fill(0.0);
+	m_cell.resize(m_units);
+	m_cell.fill(0.0);
+}
+
+void GFusedLSTM::predict(const GVec& in, GVec& out)
+{
+	if(in.size() != m_inputs)
+		throw Ex("Expected ", to_str(m_inputs), " inputs. Got ", to_str(in.size()));
+	m_xh.resize(m_inputs + m_units + 1);
+	m_gates.resize(4 * m_units);
+	m_tanhCell.resize(m_units);
+	memcpy(m_xh.data(), in.data(), sizeof(double) * m_inputs);
+	memcpy(m_xh.data() + m_inputs, m_hidden.data(), sizeof(double) * m_units);
+	m_xh[m_inputs + m_units] = 1.0;
+	forwardStep(1, m_xh.data(), m_gates.data(), m_cell.data(), m_cell.data(), m_tanhCell.data(), m_hidden.data());
+	out.resize(m_outputs);
+	readout(1, m_hidden.data(), out.data());
+}
+
+void GFusedLSTM::forwardStep(size_t batch, const double* xh, double* gates, const double* cellPrev, double* cell, double* tanhCell, double* hidden) const
+{
+	size_t cols = 4 * m_units;
+	size_t k = m_inputs + m_units + 1;
+	memset(gates, '\0', sizeof(double) * batch * cols);
+	GVec::gemm(false, false, batch, cols, k, xh, k, m_weights.data(), cols, gates, cols);
+	for(size_t b = 0; b < batch; b++)
+	{
+		double* pI = gates + b * cols;
+		double* pF = pI + m_units;
+		double* pG = pF + m_units;
+		double* pO = pG + m_units;
+		size_t pos = b * m_units;
+		for(size_t j = 0; j < m_units; j++)
+		{
+			pI[j] = GMath::logistic(pI[j]);
+			pF[j] = GMath::logistic(pF[j]);
+			pG[j] = tanh(pG[j]);
+			pO[j] = GMath::logistic(pO[j]);
+			double c = pF[j] * cellPrev[pos + j] + pI[j] * pG[j];
+			double tc = tanh(c);
+			cell[pos + j] = c;
+			tanhCell[pos + j] = tc;
+			hidden[pos + j] = pO[j] * tc;
+		}
+	}
+}
+
+void GFusedLSTM::readout(size_t rows, const double* hidden, double* out) const
+{
+	const double* pV = readoutWeights();
+	const double* pBias = pV + m_units * m_outputs;
+	for(size_t i = 0; i < rows; i++)
+		memcpy(out + i * m_outputs, pBias, sizeof(double) * m_outputs);
+	GVec::gemm(false, false, rows, m_outputs, m_units, hidden, m_units, pV, m_outputs, out, m_outputs);
+}
+
+void GFusedLSTM_testGradient()
+{
+	GRand rand(0);
+	GFusedLSTM model(3, 4, 2);
+	model.initWeights(rand);
+	GFusedLSTMTrainer trainer(model, 2, 5);
+	trainer.features().fillNormal(rand);
+	trainer.labels().fillNormal(rand);
+
+	// Compute the gradient with backpropagation
+	trainer.resetState();
+	trainer.forwardProp(5);
+	trainer.gradient().fill(0.0);
+	trainer.backProp();
+	GVec grad;
+	grad.copy(trainer.gradient());
+
+	// Compare against finite differences of the loss, 0.5 * sse
+	GVec& w = model.weights();
+	double epsilon = 1e-6;
+	for(size_t i = 0; i < w.size(); i++)
+	{
+		double orig = w[i];
+		w[i] = orig + epsilon;
+		trainer.resetState();
+		trainer.forwardProp(5);
+		double lossPlus = 0.5 * trainer.backProp();
+		w[i] = orig - epsilon;
+		trainer.resetState();
+		trainer.forwardProp(5);
+		double lossMinus = 0.5 * trainer.backProp();
+		w[i] = orig;
+		double expected = (lossMinus - lossPlus) / (2.0 * epsilon);
+		if(std::abs(grad[i] - expected) > 1e-6 * std::max(1.0, std::abs(expected)))
+			throw Ex("Gradient mismatch at weight ", to_str(i));
+	}
+}
+
+void GFusedLSTM_testTruncation()
+{
+	// Unrolling two windows with carried state should make the same predictions as one long window
+	GRand rand(0);
+	GFusedLSTM model(2, 3, 1);
+	model.initWeights(rand);
+	GFusedLSTMTrainer trainer(model, 3, 6);
+	GVec feat(6 * 3 * 2);
+	feat.fillNormal(rand);
+	trainer.features().copy(feat);
+	trainer.resetState();
+	trainer.forwardProp(6);
+	GVec whole;
+	whole.copy(trainer.predictions());
+	trainer.resetState();
+	trainer.features().copy(0, feat, 0, 3 * 3 * 2);
+	trainer.forwardProp(3);
+	GVec firstHalf;
+	firstHalf.copy(trainer.predictions());
+	trainer.carryState();
+	trainer.features().copy(0, feat, 3 * 3 * 2, 3 * 3 * 2);
+	trainer.forwardProp(3);
+	for(size_t i = 0; i < 3 * 3; i++)
+	{
+		if(std::abs(whole[i] - firstHalf[i]) > 1e-12 || std::abs(whole[3 * 3 + i] - trainer.predictions()[i]) > 1e-12)
+			throw Ex("Carried state does not match");
+	}
+
+	// predict should agree with the trainer on stream 1
+	model.resetState();
+	GVec in(2);
+	GVec out(1);
+	for(size_t t = 0; t < 6; t++)
+	{
+		in.copy(0, feat, (t * 3 + 1) * 2, 2);
+		model.predict(in, out);
+		if(std::abs(out[0] - whole[t * 3 + 1]) > 1e-12)
+			throw Ex("predict does not match the trainer");
+	}
+}
+
+void GFusedLSTM_testLearning()
+{
+	// Learn to output the input from two time steps ago
+	GRand rand(0);
+	size_t len = 2000;
+	GMatrix features(len, 1);
+	GMatrix labels(len, 1);
+	for(size_t i = 0; i < len; i++)
+	{
+		features[i][0] = rand.uniform() < 0.5 ? -1.0 : 1.0;
+		labels[i][0] = i >= 2 ? features[i - 2][0] : 0.0;
+	}
+	GFusedLSTM model(1, 8, 1);
+	model.initWeights(rand);
+	GFusedLSTMTrainer trainer(model, 8, 10);
+	trainer.setLearningRate(0.1);
+	trainer.train(features, labels, 40);
+	double mse = trainer.trainEpoch(features, labels);
+	if(mse > 0.1)
+		throw Ex("Failed to learn a delay. mse=", to_str(mse));
+
+	// The rows left over after splitting the sequence into streams should be trained on too
+	GMatrix tailFeatures(len + 3, 1);
+	GMatrix tailLabels(len + 3, 1);
+	tailFeatures.copyBlock(features, 0, 0, len, 1, 0, 0);
+	tailLabels.copyBlock(labels, 0, 0, len, 1, 0, 0);
+	for(size_t i = len; i < len + 3; i++)
+	{
+		tailFeatures[i][0] = 1.0;
+		tailLabels[i][0] = 1.0;
+	}
+	GVec before;
+	before.copy(model.weights());
+	trainer.trainEpoch(tailFeatures, tailLabels);
+	GVec withTail;
+	withTail.copy(model.weights());
+	model.weights().copy(before);
+	for(size_t i = len; i < len + 3; i++)
+		tailLabels[i][0] = -1.0;
+	trainer.trainEpoch(tailFeatures, tailLabels);
+	if(withTail.squaredDistance(model.weights()) == 0.0)
+		throw Ex("The rows after the last whole batch were not trained on");
+
+	// Round-trip through serialization
+	GDom doc;
+	doc.setRoot(model.serialize(&doc));
+	GFusedLSTM model2(doc.root());
+	model.resetState();
+	model2.resetState();
+	GVec out1(1), out2(1);
+	for(size_t i = 0; i < 20; i++)
+	{
+		model.predict(features[i], out1);
+		model2.predict(features[i], out2);
+		if(std::abs(out1[0] - out2[0]) > 1e-12)
+			throw Ex("Serialization changed the predictions");
+	}
+}
+
+// static
+void GFusedLSTM::test()
+{
+	GFusedLSTM_testGradient();
+	GFusedLSTM_testTruncation();
+	GFusedLSTM_testLearning();
+}
+
+
+
+
+
+
+
+
+GFusedLSTMTrainer::GFusedLSTMTrainer(GFusedLSTM& model, size_t batchSize, size_t steps)
+: m_model(model), m_batchSize(batchSize), m_steps(steps), m_lastSteps(0), m_learningRate(0.01), m_gradientClip(5.0)
+{
+	if(batchSize == 0 || steps == 0)
+		throw Ex("Expected a positive batch size and number of steps");
+	size_t in = model.inputs();
+	size_t units = model.units();
+	size_t out = model.outputs();
+	size_t slot = batchSize * units;
+	m_gradient.resize(model.weightCount());
+	m_gradient.fill(0.0);
+	m_features.resize(steps * batchSize * in);
+	m_features.fill(0.0);
+	m_labels.resize(steps * batchSize * out);
+	m_labels.fill(0.0);
+	m_xh.resize(steps * batchSize * (in + units + 1));
+	m_gates.resize(steps * slot * 4);
+	m_cell.resize((steps + 1) * slot);
+	m_hidden.resize((steps + 1) * slot);
+	m_tanhCell.resize(steps * slot);
+	m_pred.resize(steps * batchSize * out);
+	m_blame.resize(steps * batchSize * out);
+	m_hiddenBlame.resize(steps * slot);
+	m_gateBlame.resize(steps * slot * 4);
+	m_cellBlame.resize(slot);
+	resetState();
+}
+
+GFusedLSTMTrainer::~GFusedLSTMTrainer()
+{
+}
+
+void GFusedLSTMTrainer::resetState()
+{
+	size_t slot = m_batchSize * m_model.units();
+	memset(m_cell.data(), '\0', sizeof(double) * slot);
+	memset(m_hidden.data(), '\0', sizeof(double) * slot);
+	m_lastSteps = 0;
+}
+
+void GFusedLSTMTrainer::forwardProp(size_t steps)
+{
+	if(steps == 0 || steps > m_steps)
+		throw Ex("Expected between 1 and ", to_str(m_steps), " steps");
+	size_t in = m_model.inputs();
+	size_t units = m_model.units();
+	size_t k = in + units + 1;
+	size_t slot = m_batchSize * units;
+	for(size_t t = 0; t < steps; t++)
+	{
+		// Assemble [x, h, 1] for each stream
+		double* pXH = m_xh.data() + t * m_batchSize * k;
+		const double* pX = m_features.data() + t * m_batchSize * in;
+		const double* pH = m_hidden.data() + t * slot;
+		for(size_t b = 0; b < m_batchSize; b++)
+		{
+			memcpy(pXH, pX, sizeof(double) * in);
+			memcpy(pXH + in, pH, sizeof(double) * units);
+			pXH[in + units] = 1.0;
+			pXH += k;
+			pX += in;
+			pH += units;
+		}
+		m_model.forwardStep(m_batchSize,
+			m_xh.data() + t * m_batchSize * k,
+			m_gates.data() + t * slot * 4,
+			m_cell.data() + t * slot,
+			m_cell.data() + (t + 1) * slot,
+			m_tanhCell.data() + t * slot,
+			m_hidden.data() + (t + 1) * slot);
+	}
+
+	// The read-out does not depend on the recurrence, so do all of the time steps at once
+	m_model.readout(steps * m_batchSize, m_hidden.data() + slot, m_pred.data());
+	m_lastSteps = steps;
+}
+
+double GFusedLSTMTrainer::backProp()
+{
+	size_t steps = m_lastSteps;
+	if(steps == 0)
+		throw Ex("Expected forwardProp to be called first");
+	size_t in = m_model.inputs();
+	size_t units = m_model.units();
+	size_t out = m_model.outputs();
+	size_t k = in + units + 1;
+	size_t cols = 4 * units;
+	size_t slot = m_batchSize * units;
+	size_t rows = steps * m_batchSize;
+
+	// Compute the output blame
+	double sse = 0.0;
+	const double* pLab = m_labels.data();
+	const double* pPred = m_pred.data();
+	double* pBlame = m_blame.data();
+	for(size_t i = 0; i < rows * out; i++)
+	{
+		double d = pLab[i] - pPred[i];
+		pBlame[i] = d;
+		sse += d * d;
+	}
+
+	// Read-out gradient and the blame on the hidden states
+	const double* pV = m_model.readoutWeights();
+	double* pReadoutGrad = m_gradient.data() + m_model.gateWeightCount();
+	GVec::gemm(true, false, units, out, rows, m_hidden.data() + slot, units, pBlame, out, pReadoutGrad, out);
+	double* pBiasGrad = pReadoutGrad + units * out;
+	for(size_t i = 0; i < rows; i++)
+	{
+		for(size_t j = 0; j < out; j++)
+			pBiasGrad[j] += pBlame[i * out + j];
+	}
+	memset(m_hiddenBlame.data(), '\0', sizeof(double) * rows * units);
+	GVec::gemm(false, true, rows, units, out, pBlame, out, pV, out, m_hiddenBlame.data(), units);
+
+	// Backpropagate through time. The blame on the carried-in state is discarded, which truncates the gradient.
+	const double* pHW = m_model.gateWeights() + in * cols;
+	memset(m_cellBlame.data(), '\0', sizeof(double) * slot);
+	for(size_t t = steps; t-- > 0;)
+	{
+		const double* pGates = m_gates.data() + t * slot * 4;
+		const double* pCellPrev = m_cell.data() + t * slot;
+		const double* pTanhCell = m_tanhCell.data() + t * slot;
+		const double* pHB = m_hiddenBlame.data() + t * slot;
+		double* pGB = m_gateBlame.data() + t * slot * 4;
+		double* pCB = m_cellBlame.data();
+		for(size_t b = 0; b < m_batchSize; b++)
+		{
+			const double* pI = pGates + b * cols;
+			const double* pF = pI + units;
+			const double* pG = pF + units;
+			const double* pO = pG + units;
+			double* pIB = pGB + b * cols;
+			double* pFB = pIB + units;
+			double* pGGB = pFB + units;
+			double* pOB = pGGB + units;
+			size_t pos = b * units;
+			for(size_t j = 0; j < units; j++)
+			{
+				double dh = pHB[pos + j];
+				double tc = pTanhCell[pos + j];
+				double dc = dh * pO[j] * (1.0 - tc * tc) + pCB[pos + j];
+				pIB[j] = dc * pG[j] * pI[j] * (1.0 - pI[j]);
+				pFB[j] = dc * pCellPrev[pos + j] * pF[j] * (1.0 - pF[j]);
+				pGGB[j] = dc * pI[j] * (1.0 - pG[j] * pG[j]);
+				pOB[j] = dh * tc * pO[j] * (1.0 - pO[j]);
+				pCB[pos + j] = dc * pF[j];
+			}
+		}
+		if(t > 0)
+			GVec::gemm(false, true, m_batchSize, units, cols, pGB, cols, pHW, cols, m_hiddenBlame.data() + (t - 1) * slot, units);
+	}
+
+	// One product accumulates the gate gradient for every time step in the window
+	GVec::gemm(true, false, k, cols, rows, m_xh.data(), k, m_gateBlame.data(), cols, m_gradient.data(), cols);
+	return sse;
+}
+
+void GFusedLSTMTrainer::descendGradient()
+{
+	double scale = m_learningRate / m_batchSize;
+	if(m_gradientClip > 0.0)
+	{
+		double mag = sqrt(m_gradient.squaredMagnitude()) / m_batchSize;
+		if(mag > m_gradientClip)
+			scale *= m_gradientClip / mag;
+	}
+	m_model.weights().addScaled(scale, m_gradient);
+	m_gradient.fill(0.0);
+}
+
+void GFusedLSTMTrainer::carryState()
+{
+	if(m_lastSteps == 0)
+		return;
+	size_t slot = m_batchSize * m_model.units();
+	memcpy(m_cell.data(), m_cell.data() + m_lastSteps * slot, sizeof(double) * slot);
+	memcpy(m_hidden.data(), m_hidden.data() + m_lastSteps * slot, sizeof(double) * slot);
+}
+
+double GFusedLSTMTrainer::trainWindow(size_t steps)
+{
+	forwardProp(steps);
+	double sse = backProp();
+	descendGradient();
+	carryState();
+	return sse;
+}
+
+double GFusedLSTMTrainer::trainEpoch(const GMatrix& features, const GMatrix& labels)
+{
+	size_t in = m_model.inputs();
+	size_t out = m_model.outputs();
+	if(features.cols() != in || labels.cols() != out)
+		throw Ex("Expected ", to_str(in), " feature columns and ", to_str(out), " label columns");
+	if(features.rows() != labels.rows())
+		throw Ex("Mismatching numbers of feature and label rows");
+	size_t streamLen = features.rows() / m_batchSize;
+	if(streamLen == 0)
+		throw Ex("The sequence must have at least as many rows as the batch size");
+
+	// When the rows do not divide evenly, the first few streams are one row longer than the others
+	size_t longStreams = features.rows() % m_batchSize;
+	size_t maxLen = streamLen + (longStreams > 0 ? 1 : 0);
+	resetState();
+	double sse = 0.0;
+	for(size_t start = 0; start < maxLen; start += m_steps)
+	{
+		size_t steps = std::min(m_steps, maxLen - start);
+		double* pF = m_features.data();
+		double* pL = m_labels.data();
+		bool partial = false;
+		for(size_t t = 0; t < steps; t++)
+		{
+			for(size_t b = 0; b < m_batchSize; b++)
+			{
+				if(start + t < streamLen || b < longStreams)
+				{
+					size_t row = b * streamLen + std::min(b, longStreams) + start + t;
+					memcpy(pF, features[row].data(), sizeof(double) * in);
+					memcpy(pL, labels[row].data(), sizeof(double) * out);
+				}
+				else
+				{
+					memset(pF, '\0', sizeof(double) * in);
+					partial = true;
+				}
+				pF += in;
+				pL += out;
+			}
+		}
+		if(!partial)
+		{
+			sse += trainWindow(steps);
+			continue;
+		}
+
+		// The streams that have ended take their own predictions as labels, so they contribute no blame
+		forwardProp(steps);
+		for(size_t t = 0; t < steps; t++)
+		{
+			if(start + t < streamLen)
+				continue;
+			for(size_t b = longStreams; b < m_batchSize; b++)
+			{
+				size_t pos = (t * m_batchSize + b) * out;
+				memcpy(m_labels.data() + pos, m_pred.data() + pos, sizeof(double) * out);
+			}
+		}
+		sse += backProp();
+		descendGradient();
+		carryState();
+	}
+	return sse / (features.rows() * out);
+}
+
+void GFusedLSTMTrainer::train(const GMatrix& features, const GMatrix& labels, size_t epochs)
+{
+	for(size_t i = 0; i < epochs; i++)
+		trainEpoch(features, labels);
+}
+
+} // namespace GClasses
@@ -0,0 +1,214 @@
+/*
+  The contents of this file are dedicated by all of its authors, including
+
+    Michael S. Gashler,
+    anonymous contributors,
+
+  to the public domain (http://creativecommons.org/publicdomain/zero/1.0/).
+
+  Note that some moral obligations still exist in the absence of legal ones.
+  For example, it would still be dishonest to deliberately misrepresent the
+  origin of a work. Although we impose no legal requirements to obtain a
+  license, it is beseeming for those who build on the works of others to
+  give back useful improvements, or find a way to pay it forward. If
+  you would like to cite us, a published paper about Waffles can be found
+  at http://jmlr.org/papers/volume12/gashler11a/gashler11a.pdf. If you find
+  our code to be useful, the Waffles team would love to hear how you use it.
+*/
+
+#ifndef __GRECURRENT_H__
+#define __GRECURRENT_H__
+
+#include "GVec.h"
+
+namespace GClasses {
+
+class GDom;
+class GDomNode;
+class GMatrix;
+class GRand;
+
+
+/// A long short-term memory layer followed by a linear read-out layer.
+/// Unlike GBlockLSTM, which computes each gate with its own small products, this class stores the weights of
+/// all four gates (input, forget, candidate, and output) in one matrix, so a single matrix multiplication
+/// computes every gate of every unit for a whole batch of sequences at each time step.
+/// Use GFusedLSTMTrainer to train it.
+class GFusedLSTM
+{
+protected:
+	size_t m_inputs;
+	size_t m_units;
+	size_t m_outputs;
+	GVec m_weights;
+
+	// Scratch buffers used by predict
+	GVec m_hidden;
+	GVec m_cell;
+	GVec m_xh;
+	GVec m_gates;
+	GVec m_tanhCell;
+
+public:
+	/// General-purpose constructor.
+	GFusedLSTM(size_t inputs, size_t units, size_t outputs);
+
+	/// Deserializing constructor.
+	GFusedLSTM(const GDomNode* pNode);
+
+	~GFusedLSTM();
+
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
+	/// Marshals this object into a DOM.
+	GDomNode* serialize(GDom* pDoc) const;
+
+	/// Returns the number of values in each input vector.
+	size_t inputs() const { return m_inputs; }
+
+	/// Returns the number of LSTM units.
+	size_t units() const { return m_units; }
+
+	/// Returns the number of values in each output vector.
+	size_t outputs() const { return m_outputs; }
+
+	/// Returns the total number of weights.
+	size_t weightCount() const { return m_weights.size(); }
+
+	/// Returns the number of weights in the gate matrix.
+	size_t gateWeightCount() const { return (m_inputs + m_units + 1) * 4 * m_units; }
+
+	/// Returns all of the weights. The gate matrix comes first, followed by the read-out matrix.
+	GVec& weights() { return m_weights; }
+
+	/// Returns the gate matrix. It has (inputs + units + 1) rows and 4 * units columns.
+	/// Each row corresponds to one element of the vector [x, h, 1], and the columns are grouped into
+	/// the input gates, forget gates, candidate values, and output gates.
+	const double* gateWeights() const { return m_weights.data(); }
+
+	/// Returns the read-out matrix. It has units + 1 rows and outputs columns. The last row holds the biases.
+	const double* readoutWeights() const { return m_weights.data() + gateWeightCount(); }
+
+	/// Initializes the weights with small random values. The forget gates are biased toward remembering.
+	void initWeights(GRand& rand);
+
+	/// Clears the hidden state used by predict. Call this before predicting a new sequence.
+	void resetState();
+
+	/// Advances the hidden state by one time step and predicts the outputs for the input vector in.
+	void predict(const GVec& in, GVec& out);
+
+	/// Computes one time step for a batch of sequences. Each row of xh is the vector [x, h, 1] for one sequence,
+	/// where h is that sequence's previous hidden state. The activated gates, the new cell states, the
+	/// hyperbolic tangent of the new cell states, and the new hidden states are written to the respective buffers.
+	/// cellPrev may be the same buffer as cell.
+	void forwardStep(size_t batch, const double* xh, double* gates, const double* cellPrev, double* cell, double* tanhCell, double* hidden) const;
+
+	/// Computes the outputs for rows hidden state vectors. hidden is rows-by-units, and out is rows-by-outputs.
+	void readout(size_t rows, const double* hidden, double* out) const;
+};
+
+
+
+/// Trains a GFusedLSTM with truncated backpropagation through time.
+/// A long training sequence is split into batchSize parallel streams, which are unrolled together
+/// in windows of at most steps time steps. The hidden state is carried from one window to the next,
+/// but the gradient is not. All of the buffers needed to unroll a window are allocated once by the
+/// constructor, so no memory is allocated during training.
+class GFusedLSTMTrainer
+{
+protected:
+	GFusedLSTM& m_model;
+	size_t m_batchSize;
+	size_t m_steps;
+	size_t m_lastSteps;
+	double m_learningRate;
+	double m_gradientClip;
+	GVec m_gradient;
+
+	// State arenas. Each buffer is laid out by time step, then by stream.
+	GVec m_features; // steps x batch x inputs
+	GVec m_labels; // steps x batch x outputs
+	GVec m_xh; // steps x batch x (inputs + units + 1)
+	GVec m_gates; // steps x batch x 4*units
+	GVec m_cell; // (steps + 1) x batch x units. Slot 0 holds the state carried in from the previous window.
+	GVec m_hidden; // (steps + 1) x batch x units. Slot 0 holds the state carried in from the previous window.
+	GVec m_tanhCell; // steps x batch x units
+	GVec m_pred; // steps x batch x outputs
+	GVec m_blame; // steps x batch x outputs
+	GVec m_hiddenBlame; // steps x batch x units
+	GVec m_gateBlame; // steps x batch x 4*units
+	GVec m_cellBlame; // batch x units
+
+public:
+	/// model is the model to train. batchSize specifies the number of sequences that are unrolled together,
+	/// and steps specifies the maximum number of time steps in each window.
+	GFusedLSTMTrainer(GFusedLSTM& model, size_t batchSize = 16, size_t steps = 20);
+	~GFusedLSTMTrainer();
+
+	/// Returns the number of sequences unrolled together.
+	size_t batchSize() const { return m_batchSize; }
+
+	/// Returns the maximum number of time steps in each window.
+	size_t steps() const { return m_steps; }
+
+	/// Sets the learning rate.
+	void setLearningRate(double d) { m_learningRate = d; }
+
+	/// Returns the learning rate.
+	double learningRate() const { return m_learningRate; }
+
+	/// Sets the maximum magnitude of the gradient. Larger gradients are scaled down to this magnitude
+	/// before each step. A value of 0 disables clipping.
+	void setGradientClip(double d) { m_gradientClip = d; }
+
+	/// Returns the maximum magnitude of the gradient.
+	double gradientClip() const { return m_gradientClip; }
+
+	/// Returns the gradient accumulated by backProp.
+	GVec& gradient() { return m_gradient; }
+
+	/// Returns the features arena. Fill it with steps x batchSize x inputs values before calling forwardProp.
+	GVec& features() { return m_features; }
+
+	/// Returns the labels arena. Fill it with steps x batchSize x outputs values before calling backProp.
+	GVec& labels() { return m_labels; }
+
+	/// Returns the predictions made by the last call to forwardProp, laid out as steps x batchSize x outputs.
+	const GVec& predictions() const { return m_pred; }
+
+	/// Clears the hidden state of every stream.
+	void resetState();
+
+	/// Unrolls the model over the first steps time steps in the features arena.
+	void forwardProp(size_t steps);
+
+	/// Computes the error of the last call to forwardProp with respect to the labels arena,
+	/// backpropagates it through the window, and adds the result to the gradient.
+	/// Returns the sum-squared error.
+	double backProp();
+
+	/// Steps the weights in the direction of the gradient, then clears the gradient.
+	void descendGradient();
+
+	/// Moves the hidden state at the end of the last window to the start of the next one.
+	void carryState();
+
+	/// Trains on one window that has already been loaded into the features and labels arenas.
+	/// Returns the sum-squared error.
+	double trainWindow(size_t steps);
+
+	/// Trains for one pass over a single long sequence, where each row of features and labels is one time step.
+	/// The sequence is split into batchSize contiguous streams. If the rows do not divide evenly, the first
+	/// streams get one extra row each, and the final window only trains those streams. Returns the mean-squared error.
+	double trainEpoch(const GMatrix& features, const GMatrix& labels);
+
+	/// Calls trainEpoch the specified number of times.
+	void train(const GMatrix& features, const GMatrix& labels, size_t epochs);
+};
+
+
+} // namespace GClasses
+
+#endif // __GRECURRENT_H__
@@ -39,6 +39,7 @@
 #	include <netdb.h>
 #	include <stdlib.h>
 #	include <sys/ioctl.h>
+#	include <sys/uio.h>
 #	include <errno.h>
 #	define SOCKET_ERROR -1
 #endif
@@ -171,6 +172,37 @@ size_t GSocket_send(SOCKET s, const char* buf, size_t len)
 		return (size_t)bytesSent;
 }
 
+// Sends as much as possible from a sequence of buffers with one call. Returns the number of bytes sent.
+size_t GSocket_sendv(SOCKET s, const char* const* ppBufs, const size_t* pLens, size_t count)
+{
+#ifdef WINDOWS
+	return GSocket_send(s, ppBufs[0], pLens[0]);
+#else
+	if(s == INVALID_SOCKET)
+		throw Ex("Tried to send over a socket that was not connected");
+	struct iovec iov[64];
+	size_t n = std::min(count, (size_t)64);
+	for(size_t i = 0; i < n; i++)
+	{
+		iov[i].iov_base = (void*)ppBufs[i];
+		iov[i].iov_len = pLens[i];
+	}
+	struct msghdr msg;
+	memset(&msg, '\0', sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = n;
+	ssize_t bytesSent = sendmsg(s, &msg, 0);
+	if(bytesSent < 0)
+	{
+		if(errno == EWOULDBLOCK)
+			return 0;
+		else
+			throw Ex("Error sending in GSocket_sendv: ", strerror(errno));
+	}
+	return (size_t)bytesSent;
+#endif
+}
+
 void GSocket_init()
 {
 #ifdef WINDOWS
@@ -742,34 +774,66 @@ void GPackageClient::pump()
 	GThread::sleep(0);
 }
 
+// Prepends a package header to a sequence of buffers
+void GPackage_frame(unsigned int* pHeader, const char* const* ppBufs, const size_t* pLens, size_t count, vector<const char*>& bufs, vector<size_t>& lens)
+{
+	size_t total = 0;
+	for(size_t i = 0; i < count; i++)
+		total += pLens[i];
+	if(total > 0xffffffff)
+		throw Ex("The package is too big");
+	pHeader[0] = MAGIC_VALUE;
+	pHeader[1] = (unsigned int)total;
+	bufs.push_back((const char*)pHeader);
+	lens.push_back(2 * sizeof(unsigned int));
+	for(size_t i = 0; i < count; i++)
+	{
+		if(pLens[i] == 0)
+			continue;
+		bufs.push_back(ppBufs[i]);
+		lens.push_back(pLens[i]);
+	}
+}
+
+// Skips over the bytes that have been sent, and returns the index of the first buffer with bytes remaining
+size_t GPackage_advance(vector<const char*>& bufs, vector<size_t>& lens, size_t first, size_t bytesSent)
+{
+	while(bytesSent > 0)
+	{
+		if(bytesSent >= lens[first])
+		{
+			bytesSent -= lens[first];
+			first++;
+		}
+		else
+		{
+			bufs[first] += bytesSent;
+			lens[first] -= bytesSent;
+			bytesSent = 0;
+		}
+	}
+	return first;
+}
+
 void GPackageClient::send(const char* buf, size_t len)
+{
+	send(&buf, &len, 1);
+}
+
+void GPackageClient::send(const char* const* ppBufs, const size_t* pLens, size_t count)
 {
 	unsigned int header[2];
-	header[0] = MAGIC_VALUE;
-	header[1] = (unsigned int)len;
-	char* pH = (char*)header;
-	size_t hl = 2 * sizeof(unsigned int);
+	vector<const char*> bufs;
+	vector<size_t> lens;
+	GPackage_frame(header, ppBufs, pLens, count, bufs, lens);
 	try
 	{
-		while(hl > 0)
+		size_t first = 0;
+		while(first < bufs.size())
 		{
-			size_t bytesSent = GSocket_send(m_conn.socket(), pH, hl);
+			size_t bytesSent = GSocket_sendv(m_conn.socket(), &bufs[first], &lens[first], bufs.size() - first);
 			if(bytesSent > 0)
-			{
-				pH += bytesSent;
-				hl -= bytesSent;
-			}
-			else
-				pump();
-		}
-		while(len > 0)
-		{
-			size_t bytesSent = GSocket_send(m_conn.socket(), buf, len);
-			if(bytesSent > 0)
-			{
-				buf += bytesSent;
-				len -= bytesSent;
-			}
+				first = GPackage_advance(bufs, lens, first, bytesSent);
 			else
 				pump();
 		}
@@ -901,33 +965,24 @@ void GPackageServer::checkForNewConnections()
 }
 
 void GPackageServer::send(const char* buf, size_t len, GPackageConnection* pConn)
+{
+	send(&buf, &len, 1, pConn);
+}
+
+void GPackageServer::send(const char* const* ppBufs, const size_t* pLens, size_t count, GPackageConnection* pConn)
 {
 	unsigned int header[2];
-	header[0] = MAGIC_VALUE;
-	header[1] = (unsigned int)len;
-	char* pH = (char*)header;
-	size_t hl = 2 * sizeof(unsigned int);
+	vector<const char*> bufs;
+	vector<size_t> lens;
+	GPackage_frame(header, ppBufs, pLens, count, bufs, lens);
 	try
 	{
-		while(hl > 0)
-		{
-			size_t bytesSent = GSocket_send(pConn->socket(), pH, hl);
-			if(bytesSent > 0)
-			{
-				pH += bytesSent;
-				hl -= bytesSent;
-			}
-			else
-				pump(pConn);
-		}
-		while(len > 0)
+		size_t first = 0;
+		while(first < bufs.size())
 		{
-			size_t bytesSent = GSocket_send(pConn->socket(), buf, len);
+			size_t bytesSent = GSocket_sendv(pConn->socket(), &bufs[first], &lens[first], bufs.size() - first);
 			if(bytesSent > 0)
-			{
-				buf += bytesSent;
-				len -= bytesSent;
-			}
+				first = GPackage_advance(bufs, lens, first, bytesSent);
 			else
 				pump(pConn);
 		}
@@ -1070,11 +1125,19 @@ void GPackageServer::test()
 
 void GDomClient::send(GDomNode* pNode)
 {
-	std::ostringstream os;
-	m_doc.setRoot(pNode);
-	m_doc.writeJson(os);
-	string s = os.str();
-	GPackageClient::send(s.c_str(), s.length());
+	if(m_json)
+	{
+		std::ostringstream os;
+		m_doc.setRoot(pNode);
+		m_doc.writeJson(os);
+		string s = os.str();
+		GPackageClient::send(s.c_str(), s.length());
+	}
+	else
+	{
+		m_writer.write(pNode);
+		GPackageClient::send(m_writer.segments(), m_writer.segmentSizes(), m_writer.segmentCount());
+	}
 }
 
 const GDomNode* GDomClient::receive()
@@ -1084,7 +1147,10 @@ const GDomNode* GDomClient::receive()
 	char* pPackage = GPackageClient::receive(&len);
 	if(pPackage)
 	{
-		m_doc.parseJson(pPackage, len);
+		if(GDom::isBinary(pPackage, len))
+			m_doc.parseBinary(pPackage, len);
+		else
+			m_doc.parseJson(pPackage, len);
 		return m_doc.root();
 	}
 	else
@@ -1097,11 +1163,19 @@ const GDomNode* GDomClient::receive()
 
 void GDomServer::send(GDomNode* pNode, GPackageConnection* pConn)
 {
-	std::ostringstream os;
-	m_doc.setRoot(pNode);
-	m_doc.writeJson(os);
-	string s = os.str();
-	GPackageServer::send(s.c_str(), s.length(), pConn);
+	if(m_json)
+	{
+		std::ostringstream os;
+		m_doc.setRoot(pNode);
+		m_doc.writeJson(os);
+		string s = os.str();
+		GPackageServer::send(s.c_str(), s.length(), pConn);
+	}
+	else
+	{
+		m_writer.write(pNode);
+		GPackageServer::send(m_writer.segments(), m_writer.segmentSizes(), m_writer.segmentCount(), pConn);
+	}
 }
 
 const GDomNode* GDomServer::receive(GPackageConnection** pOutConn)
@@ -1111,13 +1185,73 @@ const GDomNode* GDomServer::receive(GPackageConnection** pOutConn)
 	char* pPackage = GPackageServer::receive(&len, pOutConn);
 	if(pPackage)
 	{
-		m_doc.parseJson(pPackage, len);
+		if(GDom::isBinary(pPackage, len))
+			m_doc.parseBinary(pPackage, len);
+		else
+			m_doc.parseJson(pPackage, len);
 		return m_doc.root();
 	}
 	else
 		return NULL;
 }
 
+// static
+void GDomServer::test()
+{
+	GDomServer server(TEST_PORT + 1);
+	GDomClient binClient;
+	GDomClient jsonClient;
+	jsonClient.useJson(true);
+	binClient.connect("localhost", TEST_PORT + 1, 5);
+	jsonClient.connect("localhost", TEST_PORT + 1, 5);
+
+	// Make a message with a big packed vector and a long string. (The values are exactly
+	// representable in a few digits, so they also survive the trip through JSON.)
+	GDom doc;
+	GDomNode* pMsg = doc.newObj();
+	doc.setRoot(pMsg);
+	pMsg->add(&doc, "cmd", "train");
+	pMsg->add(&doc, "epoch", (long long)-3);
+	GDomNode* pVec = pMsg->add(&doc, "weights", doc.newList());
+	GRand rand(0);
+	for(size_t i = 0; i < 5000; i++)
+		pVec->add(&doc, 0.125 * (double)rand.next(1000) - 60.0);
+	string blob(3000, 'b');
+	pMsg->add(&doc, "blob", blob.c_str());
+
+	// Each client sends the message, and the server bounces it back (in binary)
+	GDomClient* clients[2] = { &binClient, &jsonClient };
+	for(size_t i = 0; i < 2; i++)
+	{
+		clients[i]->send(pMsg);
+		const GDomNode* pReceived = NULL;
+		GPackageConnection* pConn = NULL;
+		double timeout = GTime::seconds() + 10.0;
+		while(!pReceived)
+		{
+			if(GTime::seconds() > timeout)
+				throw Ex("timed out");
+			pReceived = server.receive(&pConn);
+			if(!pReceived)
+				GThread::sleep(0);
+		}
+		if(!pReceived->isEqual(pMsg))
+			throw Ex("The server received the wrong message");
+		server.send((GDomNode*)pReceived, pConn);
+		pReceived = NULL;
+		while(!pReceived)
+		{
+			if(GTime::seconds() > timeout)
+				throw Ex("timed out");
+			pReceived = clients[i]->receive();
+			if(!pReceived)
+				GThread::sleep(0);
+		}
+		if(!pReceived->isEqual(pMsg))
+			throw Ex("The client received the wrong message");
+	}
+}
+
 
 
 
@@ -235,6 +235,10 @@ public:
 	/// same order and size as it was sent.
 	void send(const char* buf, size_t len);
 
+	/// Send a package that is gathered from count separate buffers. The buffers are
+	/// sent with scatter/gather calls, so they are not copied into one contiguous buffer first.
+	void send(const char* const* ppBufs, const size_t* pLens, size_t count);
+
 	/// Receive the next available package. (This returns a
 	/// pointer to an internal buffer, the contents of which only remain
 	/// valid until the next time you call receive.)
@@ -289,6 +293,10 @@ public:
 	/// same order and size as it was sent.
 	void send(const char* buf, size_t len, GPackageConnection* pConn);
 
+	/// Send a package that is gathered from count separate buffers. The buffers are
+	/// sent with scatter/gather calls, so they are not copied into one contiguous buffer first.
+	void send(const char* const* ppBufs, const size_t* pLens, size_t count, GPackageConnection* pConn);
+
 	/// Receives the next available package. (The order and size is
 	/// guaranteed to arrive the same as when it was sent.)
 	/// NULL is returned if no package is ready in its entirety.
@@ -340,16 +348,24 @@ protected:
 
 
 
-/// This is a socket client that sends and receives DOM nodes
+/// This is a socket client that sends and receives DOM nodes. By default, nodes are
+/// sent in the binary format of GDomBinaryWriter. Received packages may be in either
+/// that format or JSON.
 class GDomClient : public GPackageClient
 {
 protected:
 	GDom m_doc;
+	GDomBinaryWriter m_writer;
+	bool m_json;
 
 public:
-	GDomClient() : GPackageClient() {}
+	GDomClient() : GPackageClient(), m_json(false) {}
 	virtual ~GDomClient() {}
 
+	/// Specify whether to send nodes as JSON text instead of in the binary format.
+	/// (This is only needed to talk to peers that do not understand the binary format.)
+	void useJson(bool b) { m_json = b; }
+
 	/// Send the specified DOM node.
 	void send(GDomNode* pNode);
 
@@ -358,16 +374,27 @@ public:
 };
 
 
-/// This is a socket server that sends and receives DOM nodes
+/// This is a socket server that sends and receives DOM nodes. By default, nodes are
+/// sent in the binary format of GDomBinaryWriter. Received packages may be in either
+/// that format or JSON.
 class GDomServer : public GPackageServer
 {
 protected:
 	GDom m_doc;
+	GDomBinaryWriter m_writer;
+	bool m_json;
 
 public:
-	GDomServer(unsigned int port) : GPackageServer(port) {}
+	GDomServer(unsigned int port) : GPackageServer(port), m_json(false) {}
 	virtual ~GDomServer() {}
 
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
+	/// Specify whether to send nodes as JSON text instead of in the binary format.
+	/// (This is only needed to talk to peers that do not understand the binary format.)
+	void useJson(bool b) { m_json = b; }
+
 	/// Send the specified DOM node.
 	void send(GDomNode* pNode, GPackageConnection* pConn);
 
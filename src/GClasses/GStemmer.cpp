@@ -31,7 +31,11 @@
 #include <stdlib.h>  /* for malloc, free */
 #include <string.h>  /* for memcmp, memmove */
 #include <iostream>
+#include <algorithm>
 #include "GStemmer.h"
+#include "GError.h"
+#include "GRand.h"
+#include "GThread.h"
 
 namespace GClasses {
 
@@ -405,23 +409,311 @@ extern int stem(struct stemmer * z, char * b, int k)
 
 GStemmer::GStemmer()
 {
-	m_pPorterStemmer = create_stemmer();
 }
 
 GStemmer::~GStemmer()
 {
-	free_stemmer(m_pPorterStemmer);
 }
 
 const char* GStemmer::getStem(const char* szWord, size_t nLen)
+{
+	findStem(szWord, nLen, m_szBuf);
+	return m_szBuf;
+}
+
+// static
+size_t GStemmer::findStem(const char* szWord, size_t nLen, char* pOut)
 {
 	if(nLen > GSTEMMER_MAX_WORD_SIZE)
 		nLen = GSTEMMER_MAX_WORD_SIZE;
 	for(size_t n = 0; n < nLen; n++)
-		m_szBuf[n] = tolower(szWord[n]);
-	int nStemLen = stem(m_pPorterStemmer, m_szBuf, (int)nLen - 1) + 1;
-	m_szBuf[nStemLen] = '\0';
-	return m_szBuf;
+		pOut[n] = tolower(szWord[n]);
+	struct stemmer z;
+	int nStemLen = stem(&z, pOut, (int)nLen - 1) + 1;
+	pOut[nStemLen] = '\0';
+	return (size_t)nStemLen;
+}
+
+// --------------------------------------------------------------------------
+
+#define GSTEMMERCACHE_SHARDS 64
+
+unsigned long long GStemmerCache_hash(const char* pWord, size_t len)
+{
+	unsigned long long h = 14695981039346656037ull;
+	for(size_t i = 0; i < len; i++)
+	{
+		h ^= (unsigned char)pWord[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+class GStemmerCacheShard
+{
+public:
+	GSpinLock m_lock;
+	std::vector<size_t> m_slots; // The position of each entry in m_chars plus one, or 0 for an empty slot
+	std::vector<char> m_chars; // Each entry is the length of the word, the word, the length of the stem, and the stem
+	size_t m_count;
+
+	GStemmerCacheShard()
+	: m_slots(256, 0), m_count(0)
+	{
+	}
+
+	void clear()
+	{
+		m_slots.assign(256, 0);
+		m_chars.clear();
+		m_count = 0;
+	}
+
+	/// Returns the slot that holds the specified word, or the empty slot where it belongs.
+	size_t find(const char* pWord, size_t len, unsigned long long hash) const
+	{
+		size_t mask = m_slots.size() - 1;
+		for(size_t i = (size_t)hash & mask; true; i = (i + 1) & mask)
+		{
+			size_t pos = m_slots[i];
+			if(pos == 0)
+				return i;
+			const char* pEntry = m_chars.data() + pos - 1;
+			if((size_t)(unsigned char)pEntry[0] == len && memcmp(pEntry + 1, pWord, len) == 0)
+				return i;
+		}
+	}
+
+	/// Doubles the number of slots.
+	void grow()
+	{
+		std::vector<size_t> oldSlots;
+		oldSlots.swap(m_slots);
+		m_slots.resize(oldSlots.size() * 2, 0);
+		for(size_t i = 0; i < oldSlots.size(); i++)
+		{
+			size_t pos = oldSlots[i];
+			if(pos == 0)
+				continue;
+			const char* pEntry = m_chars.data() + pos - 1;
+			size_t len = (unsigned char)pEntry[0];
+			m_slots[find(pEntry + 1, len, GStemmerCache_hash(pEntry + 1, len))] = pos;
+		}
+	}
+
+	/// Adds a word and its stem to the empty slot.
+	void add(size_t slot, const char* pWord, size_t len, const char* pStem, size_t stemLen)
+	{
+		m_slots[slot] = m_chars.size() + 1;
+		m_chars.push_back((char)len);
+		m_chars.insert(m_chars.end(), pWord, pWord + len);
+		m_chars.push_back((char)stemLen);
+		m_chars.insert(m_chars.end(), pStem, pStem + stemLen);
+		m_count++;
+	}
+};
+
+GStemmerCache::GStemmerCache(size_t maxWords)
+: m_maxWordsPerShard((maxWords + GSTEMMERCACHE_SHARDS - 1) / GSTEMMERCACHE_SHARDS)
+{
+	for(size_t i = 0; i < GSTEMMERCACHE_SHARDS; i++)
+		m_shards.push_back(new GStemmerCacheShard());
+}
+
+GStemmerCache::~GStemmerCache()
+{
+	for(size_t i = 0; i < m_shards.size(); i++)
+		delete(m_shards[i]);
+}
+
+size_t GStemmerCache::stem(const char* szWord, size_t nLen, char* pOut)
+{
+	// Look for the lowercase word in its shard
+	if(nLen > GSTEMMER_MAX_WORD_SIZE)
+		nLen = GSTEMMER_MAX_WORD_SIZE;
+	char word[GSTEMMER_MAX_WORD_SIZE];
+	for(size_t n = 0; n < nLen; n++)
+		word[n] = tolower(szWord[n]);
+	unsigned long long hash = GStemmerCache_hash(word, nLen);
+	GStemmerCacheShard& shard = *m_shards[(size_t)(hash >> 58) % m_shards.size()];
+	{
+		GSpinLockHolder hLock(&shard.m_lock, "GStemmerCache::stem");
+		size_t pos = shard.m_slots[shard.find(word, nLen, hash)];
+		if(pos > 0)
+		{
+			const char* pStem = shard.m_chars.data() + pos + nLen;
+			size_t stemLen = (unsigned char)pStem[0];
+			memcpy(pOut, pStem + 1, stemLen);
+			pOut[stemLen] = '\0';
+			return stemLen;
+		}
+	}
+
+	// Stem it without holding the lock, then add it
+	size_t stemLen = GStemmer::findStem(word, nLen, pOut);
+	GSpinLockHolder hLock(&shard.m_lock, "GStemmerCache::stem");
+	if(shard.m_count >= m_maxWordsPerShard)
+		return stemLen;
+	if((shard.m_count + 1) * 2 > shard.m_slots.size())
+		shard.grow();
+	size_t slot = shard.find(word, nLen, hash);
+	if(shard.m_slots[slot] == 0) // (Another thread may have added it in the meantime)
+		shard.add(slot, word, nLen, pOut, stemLen);
+	return stemLen;
+}
+
+void GStemmerCache::stemInPlace(char** ppWords, size_t* pLens, size_t count)
+{
+	char buf[GSTEMMER_MAX_WORD_SIZE + 1];
+	for(size_t i = 0; i < count; i++)
+	{
+		size_t len = stem(ppWords[i], pLens[i], buf);
+		memcpy(ppWords[i], buf, len);
+		pLens[i] = len;
+	}
+}
+
+void GStemmerCache::stemInPlace(std::vector<std::string>& words)
+{
+	char buf[GSTEMMER_MAX_WORD_SIZE + 1];
+	for(size_t i = 0; i < words.size(); i++)
+	{
+		size_t len = stem(words[i].data(), words[i].length(), buf);
+		words[i].assign(buf, len);
+	}
+}
+
+size_t GStemmerCache::size()
+{
+	size_t count = 0;
+	for(size_t i = 0; i < m_shards.size(); i++)
+	{
+		GSpinLockHolder hLock(&m_shards[i]->m_lock, "GStemmerCache::size");
+		count += m_shards[i]->m_count;
+	}
+	return count;
+}
+
+void GStemmerCache::clear()
+{
+	for(size_t i = 0; i < m_shards.size(); i++)
+	{
+		GSpinLockHolder hLock(&m_shards[i]->m_lock, "GStemmerCache::clear");
+		m_shards[i]->clear();
+	}
+}
+
+class GStemmerCacheTestWorker : public GWorkerThread
+{
+protected:
+	GStemmerCache& m_cache;
+	const std::vector<std::string>& m_words;
+	std::vector<std::string>& m_stems;
+
+public:
+	GStemmerCacheTestWorker(GMasterThread& master, GStemmerCache& cache, const std::vector<std::string>& words, std::vector<std::string>& stems)
+	: GWorkerThread(master), m_cache(cache), m_words(words), m_stems(stems)
+	{
+	}
+
+	virtual ~GStemmerCacheTestWorker()
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		// Each job stems all the words, starting at a different place
+		char buf[GSTEMMER_MAX_WORD_SIZE + 1];
+		for(size_t i = 0; i < m_words.size(); i++)
+		{
+			size_t index = (i + jobId * 37) % m_words.size();
+			size_t len = m_cache.stem(m_words[index].data(), m_words[index].length(), buf);
+			if(jobId == 0)
+				m_stems[index].assign(buf, len);
+		}
+	}
+};
+
+// static
+void GStemmerCache::test()
+{
+	// Make some words
+	GRand rand(0);
+	const char* szParts[] = { "hop", "ing", "s", "es", "ed", "ly", "ness", "ful", "at", "ion", "y", "ies", "E", "ca", "ss" };
+	size_t partCount = sizeof(szParts) / sizeof(const char*);
+	std::vector<std::string> words;
+	words.push_back("");
+	words.push_back("a");
+	words.push_back(std::string(GSTEMMER_MAX_WORD_SIZE + 6, 'x') + "ing");
+	for(size_t i = 0; i < 3000; i++)
+	{
+		std::string word;
+		size_t parts = 1 + (size_t)rand.next(4);
+		for(size_t j = 0; j < parts; j++)
+			word += szParts[rand.next(partCount)];
+		words.push_back(word);
+	}
+
+	// The cache should find the same stems as GStemmer
+	GStemmer stemmer;
+	std::vector<std::string> expected;
+	for(size_t i = 0; i < words.size(); i++)
+		expected.push_back(stemmer.getStem(words[i].data(), words[i].length()));
+	if(expected[0] != "" || expected[2].length() > GSTEMMER_MAX_WORD_SIZE)
+		throw Ex("GStemmer failed");
+	GStemmerCache cache;
+	char buf[GSTEMMER_MAX_WORD_SIZE + 1];
+	for(size_t pass = 0; pass < 2; pass++)
+	{
+		for(size_t i = 0; i < words.size(); i++)
+		{
+			size_t len = cache.stem(words[i].data(), words[i].length(), buf);
+			if(len != expected[i].length() || strcmp(buf, expected[i].c_str()) != 0)
+				throw Ex("wrong stem for ", words[i]);
+		}
+	}
+
+	// Several threads should be able to share a cache, even when it is full
+	for(size_t maxWords = 100; maxWords <= 1000000; maxWords *= 10000)
+	{
+		GStemmerCache sharedCache(maxWords);
+		std::vector<std::string> stems(words.size());
+		GMasterThread master;
+		for(size_t i = 0; i < 4; i++)
+			master.addWorker(new GStemmerCacheTestWorker(master, sharedCache, words, stems));
+		master.doJobs(4);
+		if(stems != expected)
+			throw Ex("wrong stems with threads");
+		if(sharedCache.size() > std::min(maxWords + GSTEMMERCACHE_SHARDS, words.size()))
+			throw Ex("too many words in the cache");
+	}
+
+	// Test the batch interface
+	std::vector<std::string> batch(words);
+	cache.stemInPlace(batch);
+	if(batch != expected)
+		throw Ex("wrong stems in place");
+	std::string text;
+	for(size_t i = 0; i < words.size(); i++)
+		text += words[i];
+	std::vector<char*> pointers;
+	std::vector<size_t> lens;
+	size_t pos = 0;
+	for(size_t i = 0; i < words.size(); i++)
+	{
+		pointers.push_back(&text[pos]);
+		lens.push_back(words[i].length());
+		pos += words[i].length();
+	}
+	cache.stemInPlace(pointers.data(), lens.data(), words.size());
+	for(size_t i = 0; i < words.size(); i++)
+	{
+		if(std::string(pointers[i], lens[i]) != expected[i])
+			throw Ex("wrong stems in place");
+	}
+	cache.clear();
+	if(cache.size() != 0)
+		throw Ex("failed to clear");
 }
 
 } // namespace GClasses
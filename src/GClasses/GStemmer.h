@@ -3,9 +3,13 @@
 
 #define GSTEMMER_MAX_WORD_SIZE 64
 
+#include <stddef.h>
+#include <string>
+#include <vector>
+
 namespace GClasses {
 
-struct stemmer;
+class GStemmerCacheShard;
 
 /// This class just wraps the Porter Stemmer.
 /// It finds the stems of words.  Examples:
@@ -34,8 +38,7 @@ struct stemmer;
 class GStemmer
 {
 protected:
-	struct stemmer* m_pPorterStemmer;
-	char m_szBuf[GSTEMMER_MAX_WORD_SIZE];
+	char m_szBuf[GSTEMMER_MAX_WORD_SIZE + 1];
 
 public:
 	GStemmer();
@@ -45,6 +48,51 @@ public:
 	/// will return its stem. The buffer it returns is only valid until the next time
 	/// you call GetStem.
 	const char* getStem(const char* szWord, size_t nLen);
+
+	/// Writes the stem of the first nLen chars of szWord to pOut, and returns the length of the stem.
+	/// (Only the first GSTEMMER_MAX_WORD_SIZE chars are used.) pOut must have room for
+	/// GSTEMMER_MAX_WORD_SIZE + 1 chars. The stem is null-terminated. This method is thread-safe.
+	static size_t findStem(const char* szWord, size_t nLen, char* pOut);
+};
+
+
+/// A thread-safe cache of stems. Natural text uses the same word forms over and over, so most
+/// words can be stemmed with a single hash table look-up. The table is split into shards by the hash
+/// of each word, and each shard has its own lock, so many threads can share one cache with little contention.
+/// Each shard is an open-addressing table that stores its words and stems contiguously. Once the cache holds
+/// the maximum number of words, new words are still stemmed, but they are not added.
+/// The stems are the same ones that GStemmer finds.
+class GStemmerCache
+{
+protected:
+	size_t m_maxWordsPerShard;
+	std::vector<GStemmerCacheShard*> m_shards;
+
+public:
+	/// maxWords specifies the maximum number of distinct words to cache.
+	GStemmerCache(size_t maxWords = 1048576);
+	~GStemmerCache();
+
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
+	/// Writes the stem of the first nLen chars of szWord to pOut, and returns the length of the stem.
+	/// pOut must have room for GSTEMMER_MAX_WORD_SIZE + 1 chars. The stem is null-terminated.
+	size_t stem(const char* szWord, size_t nLen, char* pOut);
+
+	/// Stems count words in place. The i'th word begins at ppWords[i] and has pLens[i] chars.
+	/// Stems are never longer than their words, so each stem is written over its word, and
+	/// pLens[i] is set to the length of the stem. (The stems are not null-terminated.)
+	void stemInPlace(char** ppWords, size_t* pLens, size_t count);
+
+	/// Replaces each word in words with its stem.
+	void stemInPlace(std::vector<std::string>& words);
+
+	/// Returns the number of distinct words in the cache.
+	size_t size();
+
+	/// Removes all of the words from the cache.
+	void clear();
 };
 
 } // namespace GClasses
@@ -20,7 +20,15 @@
 #include "GHashTable.h"
 #include "GHeap.h"
 #include "GStemmer.h"
+#include "GDom.h"
+#include "GFile.h"
+#include "GRand.h"
+#include "GSparseMatrix.h"
+#include "GThread.h"
 #include <math.h>
+#include <algorithm>
+#include <memory>
+#include <sstream>
 
 namespace GClasses {
 
@@ -258,6 +266,556 @@ double GVocabulary::weight(size_t word)
 
 
 
+class GDocumentIndexerDoc
+{
+public:
+	std::vector<std::string> m_words; // The distinct words in the order in which they first occur
+	std::vector<unsigned long long> m_hashes; // The hash of each word
+	std::vector<size_t> m_counts; // The number of times each word occurs
+	std::vector<size_t> m_slots; // The index of each word within its shard
+	std::vector<size_t> m_cols; // The columns of the row, in ascending order
+	std::vector<size_t> m_colCounts; // The number of words in each column
+
+	void clear()
+	{
+		m_words.clear();
+		m_hashes.clear();
+		m_counts.clear();
+		m_slots.clear();
+		m_cols.clear();
+		m_colCounts.clear();
+	}
+
+	/// Sorts the (column, count) pairs in pairs, combines the ones with the same column, and stores them in m_cols and m_colCounts.
+	void setRow(std::vector<std::pair<size_t, size_t> >& pairs)
+	{
+		std::sort(pairs.begin(), pairs.end());
+		for(size_t i = 0; i < pairs.size(); i++)
+		{
+			if(m_cols.size() > 0 && m_cols.back() == pairs[i].first)
+				m_colCounts.back() += pairs[i].second;
+			else
+			{
+				m_cols.push_back(pairs[i].first);
+				m_colCounts.push_back(pairs[i].second);
+			}
+		}
+	}
+};
+
+class GDocumentIndexerWorker : public GWorkerThread
+{
+protected:
+	GDocumentIndexer& m_indexer;
+
+public:
+	GDocumentIndexerWorker(GMasterThread& master, GDocumentIndexer& indexer)
+	: GWorkerThread(master), m_indexer(indexer)
+	{
+	}
+
+	virtual ~GDocumentIndexerWorker()
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		m_indexer.doJob(jobId);
+	}
+};
+
+GDocumentIndexer::GDocumentIndexer(bool stemWords)
+: m_pStemmerCache(stemWords ? new GStemmerCache() : NULL), m_minWordSize(4), m_hashBuckets(0), m_binary(false), m_workerThreads(1), m_batchSize(4096),
+m_pJobFilenames(NULL), m_pJobTexts(NULL), m_jobFirstDoc(0), m_batchDocs(0), m_docCount(0), m_phase(0)
+{
+}
+
+GDocumentIndexer::~GDocumentIndexer()
+{
+	clear();
+	delete(m_pStemmerCache);
+}
+
+void GDocumentIndexer::clear()
+{
+	m_shards.clear();
+	m_shardCols.clear();
+	m_shardDocs.clear();
+	m_shardMax.clear();
+	m_words.clear();
+	m_bucketDocs.clear();
+	m_bucketMax.clear();
+	m_rowStarts.clear();
+	m_rowCols.clear();
+	m_rowCounts.clear();
+	for(size_t i = 0; i < m_batch.size(); i++)
+		delete(m_batch[i]);
+	m_batch.clear();
+	m_docCount = 0;
+}
+
+void GDocumentIndexer::addStopWord(const char* szWord)
+{
+	std::string word;
+	if(m_pStemmerCache)
+	{
+		char buf[GSTEMMER_MAX_WORD_SIZE + 1];
+		GStemmer::findStem(szWord, strlen(szWord), buf);
+		word = buf;
+	}
+	else
+	{
+		word = szWord;
+		for(size_t i = 0; i < word.length(); i++)
+			word[i] = tolower(word[i]);
+	}
+	m_stopWords.insert(word);
+}
+
+void GDocumentIndexer::addTypicalStopWords()
+{
+	for(size_t i = 0; i < (sizeof(g_szStopWords) / sizeof(const char*)); i++)
+		m_stopWords.insert(g_szStopWords[i]);
+}
+
+// static
+unsigned long long GDocumentIndexer::hashWord(const char* szWord, size_t len)
+{
+	unsigned long long h = 14695981039346656037ull;
+	for(size_t i = 0; i < len; i++)
+	{
+		h ^= (unsigned char)szWord[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+void GDocumentIndexer::indexFiles(const std::vector<std::string>& filenames, std::ostream& stream)
+{
+	m_pJobFilenames = &filenames;
+	m_pJobTexts = NULL;
+	indexDocs(filenames.size(), stream);
+}
+
+void GDocumentIndexer::indexTexts(const std::vector<std::string>& texts, std::ostream& stream)
+{
+	m_pJobFilenames = NULL;
+	m_pJobTexts = &texts;
+	indexDocs(texts.size(), stream);
+}
+
+void GDocumentIndexer::indexDocs(size_t docCount, std::ostream& stream)
+{
+	clear();
+	size_t shards = std::max((size_t)1, m_workerThreads);
+	if(m_hashBuckets > 0)
+	{
+		m_bucketDocs.resize(m_hashBuckets, 0);
+		m_bucketMax.resize(m_hashBuckets, 0);
+	}
+	else
+	{
+		m_shards.resize(shards);
+		m_shardCols.resize(shards);
+		m_shardDocs.resize(shards);
+		m_shardMax.resize(shards);
+	}
+	size_t batchSize = std::max((size_t)1, std::min(m_batchSize, docCount));
+	for(size_t i = 0; i < batchSize; i++)
+		m_batch.push_back(new GDocumentIndexerDoc());
+	m_rowStarts.push_back(0);
+	GMasterThread master;
+	for(size_t i = 0; i < shards; i++)
+		master.addWorker(new GDocumentIndexerWorker(master, *this));
+
+	// Process the documents one batch at a time
+	GJsonWriter writer(stream);
+	writer.beginObj();
+	writer.key("def");
+	writer.writeDouble(0.0);
+	writer.key("rows");
+	writer.beginList();
+	for(m_jobFirstDoc = 0; m_jobFirstDoc < docCount; m_jobFirstDoc += batchSize)
+	{
+		m_batchDocs = std::min(batchSize, docCount - m_jobFirstDoc);
+		m_phase = 0;
+		master.doJobs(m_batchDocs);
+		m_phase = 1;
+		master.doJobs(shards);
+		if(m_hashBuckets == 0)
+		{
+			numberNewWords();
+			m_phase = 2;
+			master.doJobs(m_batchDocs);
+		}
+		writeBatch(writer);
+	}
+	m_docCount = docCount;
+	if(!m_binary)
+		writeWeightedRows(writer);
+	writer.endList();
+
+	// The number of columns is not known until all of the documents have been processed
+	writer.key("cols");
+	writer.writeInt(cols());
+	writer.endObj();
+	writer.flush();
+	for(size_t i = 0; i < m_batch.size(); i++)
+		delete(m_batch[i]);
+	m_batch.clear();
+	m_pJobFilenames = NULL;
+	m_pJobTexts = NULL;
+}
+
+void GDocumentIndexer::doJob(size_t job)
+{
+	if(m_phase == 0)
+		tokenize(job);
+	else if(m_phase == 1)
+		lookUp(job);
+	else
+		makeRow(job);
+}
+
+void GDocumentIndexer::tokenize(size_t doc)
+{
+	// Get the text
+	GDocumentIndexerDoc& d = *m_batch[doc];
+	d.clear();
+	size_t index = m_jobFirstDoc + doc;
+	const char* pText;
+	size_t len;
+	std::unique_ptr<char[]> hFile;
+	if(m_pJobFilenames)
+	{
+		char* pFile = GFile::loadFile((*m_pJobFilenames)[index].c_str(), &len);
+		hFile.reset(pFile);
+		pText = pFile;
+	}
+	else
+	{
+		pText = (*m_pJobTexts)[index].data();
+		len = (*m_pJobTexts)[index].length();
+	}
+
+	// Count the distinct words
+	std::unordered_map<std::string, size_t> positions;
+	std::string stem;
+	char buf[GSTEMMER_MAX_WORD_SIZE + 1];
+	GWordIterator it(pText, len);
+	const char* pWord;
+	size_t wordLen;
+	while(it.next(&pWord, &wordLen))
+	{
+		if(wordLen < m_minWordSize)
+			continue;
+		if(m_pStemmerCache)
+			stem.assign(buf, m_pStemmerCache->stem(pWord, wordLen, buf));
+		else
+		{
+			stem.assign(pWord, std::min((size_t)63, wordLen));
+			for(size_t i = 0; i < stem.length(); i++)
+				stem[i] = tolower(stem[i]);
+		}
+		if(m_stopWords.find(stem) != m_stopWords.end())
+			continue;
+		std::unordered_map<std::string, size_t>::iterator itPos = positions.find(stem);
+		if(itPos == positions.end())
+		{
+			positions.insert(std::make_pair(stem, d.m_words.size()));
+			d.m_words.push_back(stem);
+			d.m_hashes.push_back(hashWord(stem.data(), stem.length()));
+			d.m_counts.push_back(1);
+		}
+		else
+			d.m_counts[itPos->second]++;
+	}
+	d.m_slots.resize(d.m_words.size());
+
+	// With feature hashing, the row can be made right away
+	if(m_hashBuckets > 0)
+	{
+		std::vector<std::pair<size_t, size_t> > pairs;
+		for(size_t i = 0; i < d.m_words.size(); i++)
+			pairs.push_back(std::make_pair((size_t)(d.m_hashes[i] % m_hashBuckets), d.m_counts[i]));
+		d.setRow(pairs);
+	}
+}
+
+void GDocumentIndexer::lookUp(size_t shard)
+{
+	if(m_hashBuckets > 0)
+	{
+		// Each job updates the statistics of a separate set of buckets
+		size_t shards = std::max((size_t)1, m_workerThreads);
+		for(size_t i = 0; i < m_batchDocs; i++)
+		{
+			GDocumentIndexerDoc& d = *m_batch[i];
+			for(size_t j = 0; j < d.m_cols.size(); j++)
+			{
+				size_t col = d.m_cols[j];
+				if(col % shards != shard)
+					continue;
+				m_bucketDocs[col]++;
+				m_bucketMax[col] = std::max(m_bucketMax[col], d.m_colCounts[j]);
+			}
+		}
+		return;
+	}
+	std::unordered_map<std::string, size_t>& words = m_shards[shard];
+	std::vector<size_t>& cols = m_shardCols[shard];
+	std::vector<size_t>& docs = m_shardDocs[shard];
+	std::vector<size_t>& maxCounts = m_shardMax[shard];
+	for(size_t i = 0; i < m_batchDocs; i++)
+	{
+		GDocumentIndexerDoc& d = *m_batch[i];
+		for(size_t j = 0; j < d.m_words.size(); j++)
+		{
+			if(d.m_hashes[j] % m_shards.size() != shard)
+				continue;
+			size_t slot;
+			std::unordered_map<std::string, size_t>::iterator it = words.find(d.m_words[j]);
+			if(it == words.end())
+			{
+				// This word will be numbered after all the shards are done with this batch
+				slot = cols.size();
+				words.insert(std::make_pair(d.m_words[j], slot));
+				cols.push_back(INVALID_INDEX);
+				docs.push_back(0);
+				maxCounts.push_back(0);
+			}
+			else
+				slot = it->second;
+			d.m_slots[j] = slot;
+			docs[slot]++;
+			maxCounts[slot] = std::max(maxCounts[slot], d.m_counts[j]);
+		}
+	}
+}
+
+void GDocumentIndexer::numberNewWords()
+{
+	for(size_t i = 0; i < m_batchDocs; i++)
+	{
+		GDocumentIndexerDoc& d = *m_batch[i];
+		for(size_t j = 0; j < d.m_words.size(); j++)
+		{
+			size_t& col = m_shardCols[d.m_hashes[j] % m_shards.size()][d.m_slots[j]];
+			if(col == INVALID_INDEX)
+			{
+				col = m_words.size();
+				m_words.push_back(d.m_words[j]);
+			}
+		}
+	}
+}
+
+void GDocumentIndexer::makeRow(size_t doc)
+{
+	GDocumentIndexerDoc& d = *m_batch[doc];
+	std::vector<std::pair<size_t, size_t> > pairs;
+	for(size_t i = 0; i < d.m_words.size(); i++)
+		pairs.push_back(std::make_pair(m_shardCols[d.m_hashes[i] % m_shards.size()][d.m_slots[i]], d.m_counts[i]));
+	d.setRow(pairs);
+}
+
+void GDocumentIndexer::writeBatch(GJsonWriter& writer)
+{
+	for(size_t i = 0; i < m_batchDocs; i++)
+	{
+		GDocumentIndexerDoc& d = *m_batch[i];
+		if(m_binary)
+		{
+			writer.beginList();
+			for(size_t j = 0; j < d.m_cols.size(); j++)
+			{
+				writer.writeInt(d.m_cols[j]);
+				writer.writeDouble(1.0);
+			}
+			writer.endList();
+		}
+		else
+		{
+			m_rowCols.insert(m_rowCols.end(), d.m_cols.begin(), d.m_cols.end());
+			m_rowCounts.insert(m_rowCounts.end(), d.m_colCounts.begin(), d.m_colCounts.end());
+			m_rowStarts.push_back(m_rowCols.size());
+		}
+	}
+}
+
+void GDocumentIndexer::writeWeightedRows(GJsonWriter& writer)
+{
+	// Gather the statistics of each column
+	std::vector<size_t> colDocs;
+	std::vector<size_t> colMax;
+	if(m_hashBuckets > 0)
+	{
+		colDocs.swap(m_bucketDocs);
+		colMax.swap(m_bucketMax);
+	}
+	else
+	{
+		colDocs.resize(m_words.size());
+		colMax.resize(m_words.size());
+		for(size_t i = 0; i < m_shards.size(); i++)
+		{
+			for(size_t j = 0; j < m_shardCols[i].size(); j++)
+			{
+				colDocs[m_shardCols[i][j]] = m_shardDocs[i][j];
+				colMax[m_shardCols[i][j]] = m_shardMax[i][j];
+			}
+		}
+	}
+
+	// Write the rows
+	for(size_t i = 0; i + 1 < m_rowStarts.size(); i++)
+	{
+		writer.beginList();
+		for(size_t j = m_rowStarts[i]; j < m_rowStarts[i + 1]; j++)
+		{
+			size_t col = m_rowCols[j];
+			double val = (double)m_rowCounts[j] * log((double)m_docCount / colDocs[col]) / colMax[col];
+			if(val == 0.0)
+				continue; // Words that occur in every document have no weight
+			writer.writeInt(col);
+			writer.writeDouble(val);
+		}
+		writer.endList();
+	}
+	m_rowStarts.clear();
+	m_rowCols.clear();
+	m_rowCounts.clear();
+}
+
+void GDocumentIndexer_makeCorpus(std::vector<std::string>& texts, GRand& rand)
+{
+	const char* szWords[] =
+	{
+		"running", "runner", "Runs", "the", "apple", "Apples", "banana", "cat", "dog", "elephants",
+		"quickly", "quick", "about", "zebra", "houses", "housing", "jumped", "jumping", "with", "carefully",
+	};
+	size_t wordCount = sizeof(szWords) / sizeof(const char*);
+	for(size_t i = 0; i < 150; i++)
+	{
+		std::string text;
+		size_t len = (size_t)rand.next(40);
+		for(size_t j = 0; j < len; j++)
+		{
+			size_t w = (size_t)rand.next(1 + (i % wordCount));
+			text += szWords[w];
+			text += (rand.next(4) == 0 ? ", " : " ");
+		}
+		texts.push_back(text);
+	}
+}
+
+std::string GDocumentIndexer_index(GDocumentIndexer& indexer, const std::vector<std::string>& texts, size_t threads, size_t batchSize)
+{
+	indexer.setWorkerThreads(threads);
+	indexer.setBatchSize(batchSize);
+	std::ostringstream oss;
+	indexer.indexTexts(texts, oss);
+	return oss.str();
+}
+
+// static
+void GDocumentIndexer::test()
+{
+	GRand rand(0);
+	std::vector<std::string> texts;
+	GDocumentIndexer_makeCorpus(texts, rand);
+
+	// Make the same matrix with GVocabulary
+	GVocabulary vocab(true);
+	vocab.addTypicalStopWords();
+	for(size_t i = 0; i < texts.size(); i++)
+	{
+		vocab.newDoc();
+		vocab.addWordsFromTextBlock(texts[i].data(), texts[i].length());
+	}
+	GSparseMatrix expected(texts.size(), vocab.wordCount());
+	for(size_t i = 0; i < texts.size(); i++)
+	{
+		GWordIterator it(texts[i].data(), texts[i].length());
+		const char* pWord;
+		size_t wordLen;
+		while(it.next(&pWord, &wordLen))
+		{
+			if(wordLen < 4)
+				continue;
+			size_t col = vocab.wordIndex(pWord, wordLen);
+			if(col != INVALID_INDEX)
+				expected.set(i, col, expected.get(i, col) + vocab.weight(col));
+		}
+	}
+
+	// Check that the indexer makes the same matrix
+	GDocumentIndexer indexer(true);
+	indexer.addTypicalStopWords();
+	std::string json = GDocumentIndexer_index(indexer, texts, 1, 1000);
+	GDom doc;
+	doc.parseJson(json.c_str(), json.length());
+	GSparseMatrix actual(doc.root());
+	if(actual.rows() != expected.rows() || actual.cols() != expected.cols())
+		throw Ex("wrong size");
+	for(size_t i = 0; i < indexer.cols(); i++)
+	{
+		if(strcmp(indexer.word(i), vocab.stats(i).m_szWord) != 0)
+			throw Ex("The words were numbered differently");
+	}
+	for(size_t i = 0; i < expected.rows(); i++)
+	{
+		if(actual.rowNonDefValues(i) != expected.rowNonDefValues(i))
+			throw Ex("wrong number of elements");
+		for(GSparseMatrix::Iter it = expected.rowBegin(i); it != expected.rowEnd(i); it++)
+		{
+			if(std::abs(actual.get(i, it->first) - it->second) > 1e-12)
+				throw Ex("wrong value");
+		}
+	}
+
+	// The results should not depend on the number of threads or the batch size
+	if(GDocumentIndexer_index(indexer, texts, 4, 7) != json)
+		throw Ex("The results depend on the number of threads");
+
+	// With feature hashing, each word should go in the column of its hash
+	indexer.setBinary(true);
+	json = GDocumentIndexer_index(indexer, texts, 1, 1000);
+	GDom docBinary;
+	docBinary.parseJson(json.c_str(), json.length());
+	GSparseMatrix binary(docBinary.root());
+	GDocumentIndexer hasher(true);
+	hasher.addTypicalStopWords();
+	hasher.setHashBuckets(16);
+	hasher.setBinary(true);
+	json = GDocumentIndexer_index(hasher, texts, 1, 1000);
+	if(GDocumentIndexer_index(hasher, texts, 3, 10) != json)
+		throw Ex("The results depend on the number of threads");
+	GDom docHashed;
+	docHashed.parseJson(json.c_str(), json.length());
+	GSparseMatrix hashed(docHashed.root());
+	if(hashed.rows() != texts.size() || hashed.cols() != 16)
+		throw Ex("wrong size");
+	for(size_t i = 0; i < binary.rows(); i++)
+	{
+		std::vector<size_t> cols;
+		for(GSparseMatrix::Iter it = binary.rowBegin(i); it != binary.rowEnd(i); it++)
+		{
+			const char* szWord = indexer.word(it->first);
+			cols.push_back((size_t)(hashWord(szWord, strlen(szWord)) % 16));
+		}
+		std::sort(cols.begin(), cols.end());
+		cols.erase(std::unique(cols.begin(), cols.end()), cols.end());
+		if(hashed.rowNonDefValues(i) != cols.size())
+			throw Ex("wrong number of elements");
+		for(size_t j = 0; j < cols.size(); j++)
+		{
+			if(hashed.get(i, cols[j]) != 1.0)
+				throw Ex("expected a 1");
+		}
+	}
+}
+
 GDiffer::GDiffer()
 {
 }
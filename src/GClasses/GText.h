@@ -22,13 +22,21 @@
 #include <sys/types.h>
 #include <cstddef>
 #include <vector>
+#include <string>
+#include <iosfwd>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace GClasses {
 
 class GConstStringHashTable;
 class GConstStringToIndexHashTable;
 class GStemmer;
+class GStemmerCache;
 class GHeap;
+class GJsonWriter;
+class GDocumentIndexerDoc;
+class GDocumentIndexerWorker;
 
 
 /// This iterates over the words in a block of text
@@ -139,6 +147,131 @@ public:
 
 
 
+/// Converts a collection of text documents into the rows of a sparse matrix, with one column for each
+/// word in the vocabulary (or, with feature hashing, for each bucket of words). Unlike GVocabulary, each
+/// document is read only once. The documents are processed in batches. Worker threads load, tokenize, and stem
+/// the documents in a batch (with a shared GStemmerCache), then look up their words in a vocabulary that is split into shards by the hash
+/// of each word, with one shard per worker. The words that are new in each batch are numbered in the order in
+/// which they first occur, so the columns (and the whole matrix) do not depend on the number of threads, and
+/// they are the same as the ones GVocabulary would assign.
+/// The matrix is written to a stream in the same format as GSparseMatrix::serialize. When the values depend
+/// only on each document (with setBinary(true)), each batch of rows is written as soon as it is done. Otherwise,
+/// the word counts of each row are kept until the end, when the statistics of the whole corpus are known.
+class GDocumentIndexer
+{
+friend class GDocumentIndexerWorker;
+protected:
+	GStemmerCache* m_pStemmerCache;
+	size_t m_minWordSize;
+	size_t m_hashBuckets;
+	bool m_binary;
+	size_t m_workerThreads;
+	size_t m_batchSize;
+	std::unordered_set<std::string> m_stopWords;
+
+	// The vocabulary, split into shards
+	std::vector<std::unordered_map<std::string, size_t> > m_shards; // Maps each word to its index within the shard
+	std::vector<std::vector<size_t> > m_shardCols; // The column of each word in each shard
+	std::vector<std::vector<size_t> > m_shardDocs; // The number of documents that contain each word in each shard
+	std::vector<std::vector<size_t> > m_shardMax; // The max number of times each word in each shard occurs in any document
+	std::vector<std::string> m_words; // The word in each column
+
+	// Statistics about each bucket, when feature hashing is used
+	std::vector<size_t> m_bucketDocs;
+	std::vector<size_t> m_bucketMax;
+
+	// The rows that are waiting for the corpus statistics
+	std::vector<size_t> m_rowStarts;
+	std::vector<size_t> m_rowCols;
+	std::vector<size_t> m_rowCounts;
+
+	// The batch that the workers are currently processing
+	const std::vector<std::string>* m_pJobFilenames;
+	const std::vector<std::string>* m_pJobTexts;
+	size_t m_jobFirstDoc;
+	std::vector<GDocumentIndexerDoc*> m_batch;
+	size_t m_batchDocs;
+	size_t m_docCount;
+	int m_phase;
+
+public:
+	/// If stemWords is true, each word is reduced to its stem with the Porter stemming algorithm.
+	GDocumentIndexer(bool stemWords);
+	~GDocumentIndexer();
+
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
+	/// Sets the minimum word size. Smaller words will be ignored. The default is 4.
+	void setMinWordSize(size_t n) { m_minWordSize = n; }
+
+	/// Use feature hashing with the specified number of columns instead of building a vocabulary. Each word
+	/// is assigned to a column by its hash, so no vocabulary needs to be kept, but several words may share
+	/// a column. The default is 0, which means to build a vocabulary.
+	void setHashBuckets(size_t n) { m_hashBuckets = n; }
+
+	/// If b is true, each element is 1 if the word occurs in the document. Otherwise (the default), each element is
+	/// a/b*log(c/d), where a is the number of times the word occurs in the document, b is the max number of times it
+	/// occurs in any document, c is the number of documents, and d is the number of documents that contain the word.
+	void setBinary(bool b) { m_binary = b; }
+
+	/// Specify the number of worker threads to use. The default is 1. (The results do not depend on the number of threads.)
+	void setWorkerThreads(size_t n) { m_workerThreads = n; }
+
+	/// Specify the number of documents to process in each batch. The default is 4096.
+	void setBatchSize(size_t n) { m_batchSize = n; }
+
+	/// Adds a stop word (a common word that should always be ignored)
+	void addStopWord(const char* szWord);
+
+	/// Adds a typical set of stop words
+	void addTypicalStopWords();
+
+	/// Loads each of the specified files as a document, and writes a sparse matrix with one row per document to stream.
+	void indexFiles(const std::vector<std::string>& filenames, std::ostream& stream);
+
+	/// Writes a sparse matrix with one row for each of the specified documents to stream.
+	void indexTexts(const std::vector<std::string>& texts, std::ostream& stream);
+
+	/// Returns the number of columns in the matrix that was written.
+	size_t cols() const { return m_hashBuckets > 0 ? m_hashBuckets : m_words.size(); }
+
+	/// Returns the word in the specified column. (Returns NULL if feature hashing was used.)
+	const char* word(size_t col) const { return m_hashBuckets > 0 ? NULL : m_words[col].c_str(); }
+
+	/// Returns a 64-bit FNV-1a hash of the first len chars of szWord.
+	static unsigned long long hashWord(const char* szWord, size_t len);
+
+protected:
+	/// Indexes docCount documents, which come from m_pJobFilenames or m_pJobTexts.
+	void indexDocs(size_t docCount, std::ostream& stream);
+
+	/// Forgets the vocabulary and the rows from any previous call.
+	void clear();
+
+	/// Performs one job of the current phase.
+	void doJob(size_t job);
+
+	/// Loads and tokenizes one of the documents in the current batch.
+	void tokenize(size_t doc);
+
+	/// Looks up the words in the current batch that belong in the specified shard, and updates their statistics.
+	void lookUp(size_t shard);
+
+	/// Numbers the words that are new in the current batch in the order in which they first occur.
+	void numberNewWords();
+
+	/// Converts one document in the current batch into a row of the matrix.
+	void makeRow(size_t doc);
+
+	/// Writes the rows of the current batch.
+	void writeBatch(GJsonWriter& writer);
+
+	/// Writes the rows that were kept until the end, with the weight of each word.
+	void writeWeightedRows(GJsonWriter& writer);
+};
+
+
 /// Represents a portion of a diff. Each chunk represents a left-only, right-only, or matching section.
 class GDiffChunk
 {
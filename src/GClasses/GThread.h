@@ -150,7 +150,12 @@ public:
 	volatile bool m_working; // this exists only to support a debug assert
 #endif
 
-	GWorkerThread(GMasterThread& master) : m_keepAlive(true), m_boredom(0), m_master(master) {}
+	GWorkerThread(GMasterThread& master) : m_keepAlive(true), m_boredom(0), m_master(master)
+	{
+#ifdef _DEBUG
+		m_working = false;
+#endif
+	}
 	virtual ~GWorkerThread() {}
 
 	/// This method is called by the master thread. Users should not need to call it. It pulls jobs
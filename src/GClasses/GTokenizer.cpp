@@ -80,6 +80,30 @@ bool GCharSet::equals(const GCharSet& other) const
 
 
 GTokenizer::GTokenizer(const char* szFilename)
+{
+	if(GCompressor::isCompressedFile(szFilename))
+		initCompressed(szFilename);
+	else
+		initFile(szFilename);
+	m_qPos = 0;
+	m_qCount = 0;
+	m_pBufStart = new char[256];
+	m_pBufPos = m_pBufStart;
+	m_pBufEnd = m_pBufStart + 256;
+	m_pos = 0;
+	m_lineStart = 0;
+	m_line = 1;
+}
+
+void GTokenizer::initCompressed(const char* szFilename)
+{
+	// The blocks are decompressed a batch at a time as they are read, so the whole file is never in memory
+	GCompressedIStream* pStream = new GCompressedIStream(szFilename);
+	m_pStream = pStream;
+	pStream->exceptions(std::ios::badbit);
+}
+
+void GTokenizer::initFile(const char* szFilename)
 {
 	std::ifstream* pStream = new std::ifstream();
 	m_pStream = pStream;
@@ -94,14 +118,6 @@ GTokenizer::GTokenizer(const char* szFilename)
 	}
 	if(pStream->fail())
 		throw Ex("Error while trying to open the file, ", szFilename, ". ", strerror(errno));
-	m_qPos = 0;
-	m_qCount = 0;
-	m_pBufStart = new char[256];
-	m_pBufPos = m_pBufStart;
-	m_pBufEnd = m_pBufStart + 256;
-	m_pos = 0;
-	m_lineStart = 0;
-	m_line = 1;
 }
 
 GTokenizer::GTokenizer(const char* pFile, size_t len)
@@ -89,7 +89,7 @@ protected:
 	size_t m_line; // line number
 
 public:
-	/// Opens the specified filename.
+	/// Opens the specified filename. If the file was written by GCompressedOStream, it is decompressed as it is read.
 	/// charSets is a class that inherits from GCharSetHolder
 	GTokenizer(const char* szFilename);
 
@@ -218,6 +218,12 @@ public:
 	size_t tokenLength();
 
 protected:
+	/// Opens a file in the framed compressed format.
+	void initCompressed(const char* szFilename);
+
+	/// Opens an ordinary file.
+	void initFile(const char* szFilename);
+
 	/// Double the size of the token buffer.
 	void growBuf();
 
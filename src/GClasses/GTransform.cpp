@@ -28,6 +28,7 @@
 #include "GNeuralNet.h"
 #include "GRecommender.h"
 #include "GHolders.h"
+#include "GTruncatedSVD.h"
 #include <stdlib.h>
 #include <vector>
 #include <algorithm>
@@ -436,12 +437,12 @@ void GIncrementalTransformChainer::untransformToDistribution(const GVec& in, GPr
 // ---------------------------------------------------------------
 
 GPCA::GPCA(size_t target_Dims)
-: GIncrementalTransform(), m_targetDims(target_Dims), m_pBasisVectors(NULL), m_aboutOrigin(false), m_rand(0)
+: GIncrementalTransform(), m_targetDims(target_Dims), m_pBasisVectors(NULL), m_aboutOrigin(false), m_workerThreads(1), m_rand(0)
 {
 }
 
 GPCA::GPCA(const GDomNode* pNode)
-: GIncrementalTransform(pNode), m_rand(0)
+: GIncrementalTransform(pNode), m_workerThreads(1), m_rand(0)
 {
 	m_pBasisVectors = new GMatrix(pNode->get("basis"));
 	m_targetDims = m_pBasisVectors->rows();
@@ -483,26 +484,28 @@ GRelation* GPCA::trainInner(const GMatrix& data)
 	else
 		data.centroid(mean);
 
-	// Make a copy of the data
-	GMatrix tmpData(data.relation().cloneMinimal());
-	tmpData.copy(data);
-
-	// Compute the principle components
-	double sse = 0;
-	if(m_eigVals.size() > 0)
-		sse = tmpData.sumSquaredDistance(mean);
-	for(size_t i = 0; i < m_targetDims; i++)
+	// Compute the principal components with a truncated SVD of the centered data
+	size_t rank = std::min(m_targetDims, std::min(data.rows(), data.cols()));
+	if(rank > 0)
 	{
-		GVec& vec = m_pBasisVectors->row(i + 1);
-		tmpData.principalComponentIgnoreUnknowns(vec, mean, &m_rand);
-		tmpData.removeComponent(mean, vec);
-		if(m_eigVals.size() > 0)
+		GTruncatedSVD svd(rank);
+		svd.computeU(false);
+		svd.setIterations(4);
+		svd.setWorkerThreads(m_workerThreads);
+		svd.compute(data, m_rand, &mean);
+		for(size_t i = 0; i < rank; i++)
 		{
-			double t = tmpData.sumSquaredDistance(mean);
-			m_eigVals[i] = (sse - t) / (data.rows() - 1);
-			sse = t;
+			m_pBasisVectors->row(i + 1).copy(svd.v()[i]);
+			if(m_eigVals.size() > 0)
+				m_eigVals[i] = svd.singularValues()[i] * svd.singularValues()[i] / (data.rows() - 1);
 		}
 	}
+	for(size_t i = rank; i < m_targetDims; i++)
+	{
+		m_pBasisVectors->row(i + 1).fill(0.0, 0, before().size());
+		if(m_eigVals.size() > 0)
+			m_eigVals[i] = 0.0;
+	}
 
 	return new GUniformRelation(m_targetDims, 0);
 }
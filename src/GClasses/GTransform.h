@@ -235,6 +235,7 @@ protected:
 	GMatrix* m_pBasisVectors;
 	GVec m_eigVals;
 	bool m_aboutOrigin;
+	size_t m_workerThreads;
 	GRand m_rand;
 
 public:
@@ -256,6 +257,9 @@ public:
 	/// of computing them about the mean).
 	void aboutOrigin() { m_aboutOrigin = true; }
 
+	/// Specify the number of worker threads to use for training. The default is 1.
+	void setWorkerThreads(size_t n) { m_workerThreads = n; }
+
 	/// Returns the eigenvalues. Returns NULL if computeEigVals was not called.
 	GVec& eigVals() { return m_eigVals; }
 
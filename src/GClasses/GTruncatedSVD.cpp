@@ -0,0 +1,461 @@
+/*
+  The contents of this file are dedicated by all of its authors, including
+
+    Michael S. Gashler,
+    anonymous contributors,
+
+  to the public domain (http://creativecommons.org/publicdomain/zero/1.0/).
+
+  Note that some moral obligations still exist in the absence of legal ones.
+  For example, it would still be dishonest to deliberately misrepresent the
+  origin of a work. Although we impose no legal requirements to obtain a
+  license, it is beseeming for those who build on the works of others to
+  give back useful improvements, or find a way to pay it forward. If
+  you would like to cite us, a published paper about Waffles can be found
+  at http://jmlr.org/papers/volume12/gashler11a/gashler11a.pdf. If you find
+  our code to be useful, the Waffles team would love to hear how you use it.
+*/
+
+#include "GTruncatedSVD.h"
+#include "GError.h"
+#include "GRand.h"
+#include "GThread.h"
+#include "GHolders.h"
+#include <cmath>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+namespace GClasses {
+
+#define SVD_BLOCK_ROWS 64
+#define SVD_MAX_SLICES 16
+
+class GTruncatedSVDWorker : public GWorkerThread
+{
+protected:
+	GTruncatedSVD& m_svd;
+
+public:
+	GTruncatedSVDWorker(GMasterThread& master, GTruncatedSVD& svd)
+	: GWorkerThread(master), m_svd(svd)
+	{
+	}
+
+	virtual ~GTruncatedSVDWorker()
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		m_svd.doSlice(jobId);
+	}
+};
+
+
+GTruncatedSVD::GTruncatedSVD(size_t rank)
+: m_rank(rank),
+m_oversample(10),
+m_iters(2),
+m_workerThreads(1),
+m_computeU(true),
+m_pData(NULL),
+m_pCentroid(NULL),
+m_transposeOp(false),
+m_pIn(NULL),
+m_pOut(NULL),
+m_vecs(0),
+m_slices(1),
+m_pMaster(NULL)
+{
+	if(rank < 1)
+		throw Ex("The rank must be at least 1");
+}
+
+GTruncatedSVD::~GTruncatedSVD()
+{
+}
+
+void GTruncatedSVD::doSlice(size_t slice)
+{
+	const GMatrix& data = *m_pData;
+	size_t n = data.rows();
+	size_t d = data.cols();
+	size_t sliceStart = slice * n / m_slices;
+	size_t sliceEnd = (slice + 1) * n / m_slices;
+	GVec buf(SVD_BLOCK_ROWS * d);
+	double* pPartial = m_transposeOp ? m_partials.data() + slice * m_vecs * d : NULL;
+	for(size_t r = sliceStart; r < sliceEnd; r += SVD_BLOCK_ROWS)
+	{
+		// Copy a block of centered rows into contiguous memory
+		size_t b = std::min((size_t)SVD_BLOCK_ROWS, sliceEnd - r);
+		double* pB = buf.data();
+		for(size_t i = 0; i < b; i++)
+		{
+			const GVec& row = data[r + i];
+			for(size_t j = 0; j < d; j++)
+			{
+				if(row[j] == UNKNOWN_REAL_VALUE)
+					*(pB++) = 0.0;
+				else if(m_pCentroid)
+					*(pB++) = row[j] - (*m_pCentroid)[j];
+				else
+					*(pB++) = row[j];
+			}
+		}
+
+		// Multiply
+		if(m_transposeOp)
+			GVec::gemm(false, false, m_vecs, d, b, m_pIn + r, n, buf.data(), d, pPartial, d);
+		else
+			GVec::gemm(false, true, m_vecs, b, d, m_pIn, d, buf.data(), d, m_pOut + r, n);
+	}
+}
+
+void GTruncatedSVD::multiply(const double* in, size_t vecs, double* out, bool transpose)
+{
+	size_t n = m_pData->rows();
+	size_t d = m_pData->cols();
+	m_pIn = in;
+	m_pOut = out;
+	m_vecs = vecs;
+	m_transposeOp = transpose;
+	if(transpose)
+	{
+		// Each slice sums into its own buffer, and the buffers are added in a fixed order, so the results do not depend on the number of threads
+		m_partials.resize(m_slices * vecs * d);
+		m_partials.fill(0.0, 0, m_slices * vecs * d);
+		m_pMaster->doJobs(m_slices);
+		for(size_t i = 0; i < vecs * d; i++)
+		{
+			double sum = 0.0;
+			for(size_t j = 0; j < m_slices; j++)
+				sum += m_partials[j * vecs * d + i];
+			out[i] = sum;
+		}
+	}
+	else
+	{
+		for(size_t i = 0; i < vecs * n; i++)
+			out[i] = 0.0;
+		m_pMaster->doJobs(m_slices);
+	}
+}
+
+// static
+size_t GTruncatedSVD::orthonormalize(double* m, size_t keep, size_t rows, size_t cols)
+{
+	size_t out = keep;
+	for(size_t i = keep; i < rows; i++)
+	{
+		double* pRow = m + i * cols;
+		double origNorm = 0.0;
+		for(size_t k = 0; k < cols; k++)
+			origNorm += pRow[k] * pRow[k];
+		origNorm = std::sqrt(origNorm);
+		if(origNorm == 0.0)
+			continue;
+		for(size_t pass = 0; pass < 2; pass++)
+		{
+			for(size_t j = 0; j < out; j++)
+			{
+				double* pOther = m + j * cols;
+				double dot = 0.0;
+				for(size_t k = 0; k < cols; k++)
+					dot += pRow[k] * pOther[k];
+				for(size_t k = 0; k < cols; k++)
+					pRow[k] -= dot * pOther[k];
+			}
+		}
+		double norm = 0.0;
+		for(size_t k = 0; k < cols; k++)
+			norm += pRow[k] * pRow[k];
+		norm = std::sqrt(norm);
+		if(norm <= 1e-10 * origNorm)
+			continue; // This row is linearly dependent on the others
+		double* pDest = m + out * cols;
+		double scale = 1.0 / norm;
+		for(size_t k = 0; k < cols; k++)
+			pDest[k] = pRow[k] * scale;
+		out++;
+	}
+	return out;
+}
+
+// static
+void GTruncatedSVD::jacobi(double* b, size_t rows, size_t cols, double* j)
+{
+	for(size_t i = 0; i < rows * rows; i++)
+		j[i] = 0.0;
+	for(size_t i = 0; i < rows; i++)
+		j[i * rows + i] = 1.0;
+	for(size_t sweep = 0; sweep < 60; sweep++)
+	{
+		bool rotated = false;
+		for(size_t p = 0; p + 1 < rows; p++)
+		{
+			double* pP = b + p * cols;
+			for(size_t q = p + 1; q < rows; q++)
+			{
+				double* pQ = b + q * cols;
+				double alpha = 0.0;
+				double beta = 0.0;
+				double gamma = 0.0;
+				for(size_t k = 0; k < cols; k++)
+				{
+					alpha += pP[k] * pP[k];
+					beta += pQ[k] * pQ[k];
+					gamma += pP[k] * pQ[k];
+				}
+				if(alpha == 0.0 || beta == 0.0 || std::abs(gamma) <= 1e-15 * std::sqrt(alpha * beta))
+					continue;
+				rotated = true;
+				double zeta = (beta - alpha) / (2.0 * gamma);
+				double t = (zeta >= 0.0 ? 1.0 : -1.0) / (std::abs(zeta) + std::sqrt(1.0 + zeta * zeta));
+				double c = 1.0 / std::sqrt(1.0 + t * t);
+				double s = c * t;
+				for(size_t k = 0; k < cols; k++)
+				{
+					double x = pP[k];
+					double y = pQ[k];
+					pP[k] = c * x - s * y;
+					pQ[k] = s * x + c * y;
+				}
+				double* pJP = j + p * rows;
+				double* pJQ = j + q * rows;
+				for(size_t k = 0; k < rows; k++)
+				{
+					double x = pJP[k];
+					double y = pJQ[k];
+					pJP[k] = c * x - s * y;
+					pJQ[k] = s * x + c * y;
+				}
+			}
+		}
+		if(!rotated)
+			break;
+	}
+}
+
+void GTruncatedSVD::compute(const GMatrix& data, GRand& rand, const GVec* pCentroid)
+{
+	size_t n = data.rows();
+	size_t d = data.cols();
+	if(n < 1 || d < 1)
+		throw Ex("Expected a non-empty matrix");
+	size_t maxRank = std::min(n, d);
+	if(m_rank > maxRank)
+		throw Ex("Cannot compute ", to_str(m_rank), " singular values of a ", to_str(n), "x", to_str(d), " matrix");
+	if(pCentroid && pCentroid->size() != d)
+		throw Ex("The centroid has the wrong size");
+	m_pData = &data;
+	m_pCentroid = pCentroid;
+	m_slices = std::max((size_t)1, std::min((size_t)SVD_MAX_SLICES, (n + SVD_BLOCK_ROWS - 1) / SVD_BLOCK_ROWS));
+	GMasterThread master;
+	for(size_t i = 0; i < std::max((size_t)1, std::min(m_workerThreads, m_slices)); i++)
+		master.addWorker(new GTruncatedSVDWorker(master, *this));
+	m_pMaster = &master;
+
+	// Build an orthonormal basis for the block Krylov subspace [A w, (A A^T) A w, ...]
+	size_t blockSize = std::min(m_rank + m_oversample, maxRank);
+	size_t capacity = std::min(maxRank, blockSize * (m_iters + 1));
+	GVec basis(capacity * n); // Each row is a basis vector with one element per row of the data
+	GVec w(blockSize * d);
+	GVec y(blockSize * n);
+	w.fillNormal(rand);
+	multiply(w.data(), blockSize, y.data(), false);
+	size_t newRows = std::min(blockSize, capacity);
+	basis.copy(0, y, 0, newRows * n);
+	size_t basisRows = orthonormalize(basis.data(), 0, newRows, n);
+	size_t blockStart = 0;
+	for(size_t i = 0; i < m_iters && basisRows < capacity && basisRows > blockStart; i++)
+	{
+		size_t blockRows = basisRows - blockStart;
+		multiply(basis.data() + blockStart * n, blockRows, w.data(), true);
+		size_t wRows = orthonormalize(w.data(), 0, blockRows, d);
+		if(wRows == 0)
+			break;
+		multiply(w.data(), wRows, y.data(), false);
+		newRows = std::min(wRows, capacity - basisRows);
+		basis.copy(basisRows * n, y, 0, newRows * n);
+		blockStart = basisRows;
+		basisRows = orthonormalize(basis.data(), basisRows, basisRows + newRows, n);
+	}
+
+	// Project the data into the subspace, and decompose the small projected matrix
+	GVec b(basisRows * d);
+	multiply(basis.data(), basisRows, b.data(), true);
+	m_pMaster = NULL;
+	GVec rot(basisRows * basisRows);
+	jacobi(b.data(), basisRows, d, rot.data());
+	std::vector< std::pair<double, size_t> > order;
+	for(size_t i = 0; i < basisRows; i++)
+	{
+		double sq = 0.0;
+		const double* pRow = b.data() + i * d;
+		for(size_t k = 0; k < d; k++)
+			sq += pRow[k] * pRow[k];
+		order.push_back(std::make_pair(-std::sqrt(sq), i));
+	}
+	std::sort(order.begin(), order.end());
+
+	// Extract the singular values and vectors
+	m_singularValues.resize(m_rank);
+	m_v.resize(m_rank, d);
+	if(m_computeU)
+		m_u.resize(n, m_rank);
+	else
+		m_u.resize(0, 0);
+	for(size_t i = 0; i < m_rank; i++)
+	{
+		GVec& v = m_v[i];
+		if(i >= basisRows)
+		{
+			// The data has lower rank than requested
+			m_singularValues[i] = 0.0;
+			v.fill(0.0);
+			if(m_computeU)
+			{
+				for(size_t j = 0; j < n; j++)
+					m_u[j][i] = 0.0;
+			}
+			continue;
+		}
+		double s = -order[i].first;
+		size_t index = order[i].second;
+		m_singularValues[i] = s;
+		const double* pRow = b.data() + index * d;
+		double scale = (s > 0.0 ? 1.0 / s : 0.0);
+		for(size_t k = 0; k < d; k++)
+			v[k] = pRow[k] * scale;
+		if(m_computeU)
+		{
+			const double* pRot = rot.data() + index * basisRows;
+			for(size_t j = 0; j < n; j++)
+			{
+				double sum = 0.0;
+				for(size_t k = 0; k < basisRows; k++)
+					sum += pRot[k] * basis[k * n + j];
+				m_u[j][i] = sum;
+			}
+		}
+	}
+}
+
+#ifndef MIN_PREDICT
+// static
+void GTruncatedSVD::test()
+{
+	GRand rand(0);
+
+	// Make a noisy low-rank matrix
+	size_t n = 300;
+	size_t d = 40;
+	GMatrix left(n, 5);
+	GMatrix right(5, d);
+	for(size_t i = 0; i < n; i++)
+		left[i].fillNormal(rand);
+	for(size_t i = 0; i < 5; i++)
+	{
+		right[i].fillNormal(rand);
+		right[i] *= (double)(5 - i);
+	}
+	GMatrix* pA = GMatrix::multiply(left, right, false, false);
+	std::unique_ptr<GMatrix> hA(pA);
+	for(size_t i = 0; i < n; i++)
+	{
+		for(size_t j = 0; j < d; j++)
+			(*pA)[i][j] += 0.01 * rand.normal();
+	}
+
+	// Compare with the full SVD
+	GMatrix* pU;
+	double* pDiag;
+	GMatrix* pV;
+	pA->singularValueDecomposition(&pU, &pDiag, &pV, false, 200);
+	std::unique_ptr<GMatrix> hU(pU);
+	ArrayHolder<double> hDiag(pDiag);
+	std::unique_ptr<GMatrix> hV(pV);
+	GTruncatedSVD svd(5);
+	svd.setWorkerThreads(3);
+	svd.compute(*pA, rand);
+	for(size_t i = 0; i < 5; i++)
+	{
+		if(std::abs(svd.singularValues()[i] - pDiag[i]) > 1e-8 * pDiag[i])
+			throw Ex("Wrong singular value. Expected ", to_str(pDiag[i]), ", got ", to_str(svd.singularValues()[i]));
+		if(std::abs(std::abs(svd.v()[i].dotProduct(pV->row(i))) - 1.0) > 1e-6)
+			throw Ex("Wrong right singular vector");
+		if(i > 0 && svd.singularValues()[i] > svd.singularValues()[i - 1])
+			throw Ex("Not in descending order");
+	}
+
+	// Check that A v = s u
+	GVec av(n);
+	for(size_t i = 0; i < 5; i++)
+	{
+		pA->multiply(svd.v()[i], av);
+		for(size_t j = 0; j < n; j++)
+		{
+			if(std::abs(av[j] - svd.singularValues()[i] * svd.u()[j][i]) > 1e-8 * svd.singularValues()[0])
+				throw Ex("Wrong left singular vector");
+		}
+	}
+
+	// Check that the number of threads does not affect the results
+	GTruncatedSVD svd2(5);
+	GRand rand2(1);
+	svd2.compute(*pA, rand2);
+	GTruncatedSVD svd3(5);
+	svd3.setWorkerThreads(4);
+	GRand rand3(1);
+	svd3.compute(*pA, rand3);
+	for(size_t i = 0; i < 5; i++)
+	{
+		if(svd2.singularValues()[i] != svd3.singularValues()[i])
+			throw Ex("not deterministic");
+	}
+
+	// Check that centering about a centroid is the same as centering the data
+	GVec mean(d);
+	pA->centroid(mean);
+	GMatrix centered(n, d);
+	for(size_t i = 0; i < n; i++)
+	{
+		centered[i].copy((*pA)[i]);
+		centered[i] -= mean;
+	}
+	GTruncatedSVD svd4(3);
+	svd4.computeU(false);
+	svd4.compute(*pA, rand, &mean);
+	GTruncatedSVD svd5(3);
+	svd5.compute(centered, rand);
+	for(size_t i = 0; i < 3; i++)
+	{
+		if(std::abs(svd4.singularValues()[i] - svd5.singularValues()[i]) > 1e-8 * svd5.singularValues()[i])
+			throw Ex("Centering failed");
+	}
+	if(svd4.u().rows() != 0)
+		throw Ex("Expected no left singular vectors");
+
+	// Check a small full-rank matrix, where the Krylov subspace is the whole space
+	GMatrix small(6, 4);
+	for(size_t i = 0; i < small.rows(); i++)
+		small[i].fillNormal(rand);
+	GMatrix* pU2;
+	double* pDiag2;
+	GMatrix* pV2;
+	small.singularValueDecomposition(&pU2, &pDiag2, &pV2, false, 200);
+	std::unique_ptr<GMatrix> hU2(pU2);
+	ArrayHolder<double> hDiag2(pDiag2);
+	std::unique_ptr<GMatrix> hV2(pV2);
+	GTruncatedSVD svd6(4);
+	svd6.compute(small, rand);
+	for(size_t i = 0; i < 4; i++)
+	{
+		if(std::abs(svd6.singularValues()[i] - pDiag2[i]) > 1e-10)
+			throw Ex("Wrong singular value of a small matrix");
+	}
+}
+#endif // MIN_PREDICT
+
+} // namespace GClasses
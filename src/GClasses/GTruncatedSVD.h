@@ -0,0 +1,128 @@
+/*
+  The contents of this file are dedicated by all of its authors, including
+
+    Michael S. Gashler,
+    anonymous contributors,
+
+  to the public domain (http://creativecommons.org/publicdomain/zero/1.0/).
+
+  Note that some moral obligations still exist in the absence of legal ones.
+  For example, it would still be dishonest to deliberately misrepresent the
+  origin of a work. Although we impose no legal requirements to obtain a
+  license, it is beseeming for those who build on the works of others to
+  give back useful improvements, or find a way to pay it forward. If
+  you would like to cite us, a published paper about Waffles can be found
+  at http://jmlr.org/papers/volume12/gashler11a/gashler11a.pdf. If you find
+  our code to be useful, the Waffles team would love to hear how you use it.
+*/
+
+#ifndef __GTRUNCATEDSVD_H__
+#define __GTRUNCATEDSVD_H__
+
+#include "GMatrix.h"
+
+namespace GClasses {
+
+class GMasterThread;
+class GRand;
+class GTruncatedSVDWorker;
+
+
+/// Computes the largest singular values and vectors of a matrix with a randomized block Krylov method.
+/// A block of random vectors is multiplied by the matrix and its transpose a few times, and the results
+/// span a small subspace that captures the dominant singular vectors. The matrix is then projected into that
+/// subspace and decomposed exactly. Each multiplication is one pass over the data, performed with blocked
+/// matrix multiplications and split across worker threads, so this is much faster than extracting one
+/// component at a time when the matrix is large and only a few components are needed.
+/// The rows of the matrix may optionally be centered about a centroid without copying the data, so this
+/// can also compute principal components.
+class GTruncatedSVD
+{
+friend class GTruncatedSVDWorker;
+protected:
+	size_t m_rank;
+	size_t m_oversample;
+	size_t m_iters;
+	size_t m_workerThreads;
+	bool m_computeU;
+	GVec m_singularValues;
+	GMatrix m_u;
+	GMatrix m_v;
+
+	// The operation that the workers are currently performing
+	const GMatrix* m_pData;
+	const GVec* m_pCentroid;
+	bool m_transposeOp;
+	const double* m_pIn;
+	double* m_pOut;
+	size_t m_vecs;
+	size_t m_slices;
+	GVec m_partials;
+	GMasterThread* m_pMaster;
+
+public:
+	/// rank specifies the number of singular values and vectors to compute.
+	GTruncatedSVD(size_t rank);
+	~GTruncatedSVD();
+
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+
+	/// Returns the number of singular values that will be computed.
+	size_t rank() const { return m_rank; }
+
+	/// Specify the number of extra random vectors to use. More vectors make the results more accurate,
+	/// and cost more computation. The default is 10.
+	void setOversample(size_t n) { m_oversample = n; }
+
+	/// Specify the number of Krylov iterations. Each iteration costs two passes over the data. More iterations
+	/// make the results more accurate when the singular values decay slowly. The default is 2.
+	void setIterations(size_t n) { m_iters = n; }
+
+	/// Specify the number of worker threads to use. The default is 1. (The results do not depend on the number of threads.)
+	void setWorkerThreads(size_t n) { m_workerThreads = n; }
+
+	/// Specify whether to compute the left singular vectors. The default is true. (They have one element per row
+	/// of the data, so you might not want them when the data has many rows.)
+	void computeU(bool b) { m_computeU = b; }
+
+	/// Computes the truncated SVD of data. If pCentroid is not NULL, it is subtracted from each row of data first.
+	/// (The data is not modified.) Unknown values are treated as if they were equal to the centroid.
+	void compute(const GMatrix& data, GRand& rand, const GVec* pCentroid = NULL);
+
+	/// Returns the singular values in descending order.
+	const GVec& singularValues() const { return m_singularValues; }
+
+	/// Returns a matrix with one row per row of the data and rank columns. Its columns are the left singular vectors.
+	/// (This is empty if computeU(false) was called.)
+	GMatrix& u() { return m_u; }
+
+	/// Returns a matrix with rank rows and one column per column of the data. Its rows are the right singular vectors.
+	GMatrix& v() { return m_v; }
+
+	/// Computes the singular values of the matrix whose rows are given by b with one-sided Jacobi rotations.
+	/// The rotations are accumulated into j (rows x rows). When it returns, the rows of b are mutually orthogonal,
+	/// their magnitudes are the singular values, and their directions are the right singular vectors.
+	static void jacobi(double* b, size_t rows, size_t cols, double* j);
+
+	/// Orthonormalizes the rows of m (which has the specified number of rows and cols) against the first
+	/// keep rows, and against each other, using modified Gram-Schmidt with reorthogonalization.
+	/// Rows that are (numerically) linearly dependent on earlier ones are dropped, and the remaining rows are
+	/// packed after the first keep rows. Returns the number of rows that remain.
+	static size_t orthonormalize(double* m, size_t keep, size_t rows, size_t cols);
+
+protected:
+	/// Computes out = in * (data - centroid)^T, where in has vecs rows and as many columns as the data.
+	/// out has vecs rows and one column for each row of the data. If transpose is true, computes
+	/// out = in * (data - centroid) instead, where in has one column for each row of the data.
+	void multiply(const double* in, size_t vecs, double* out, bool transpose);
+
+	/// Performs one slice of the operation set up by multiply.
+	void doSlice(size_t slice);
+
+};
+
+
+} // namespace GClasses
+
+#endif // __GTRUNCATEDSVD_H__
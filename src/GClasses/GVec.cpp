@@ -29,6 +29,7 @@
 #include "GHolders.h"
 #include "GTokenizer.h"
 #include "GTime.h"
+#include "GThread.h"
 #include <cmath>
 #include <cstdio>
 #include <cstring>
@@ -431,6 +432,11 @@ GDomNode* GVec::serialize(GDom* pDoc) const
 	return pNode;
 }
 
+void GVec::serializeStream(GJsonWriter& writer) const
+{
+	writer.writeDoubles(m_data, m_size);
+}
+
 void GVec::deserialize(const GDomNode* pNode)
 {
 	GDomListIterator it(pNode);
@@ -442,6 +448,15 @@ void GVec::deserialize(const GDomNode* pNode)
 	}
 }
 
+void GVec::parseJson(const char* pJson, size_t len)
+{
+	std::vector<double> values;
+	GDom::parseJsonDoubles(pJson, len, values);
+	resize(values.size());
+	if(values.size() > 0)
+		memcpy(m_data, &values[0], sizeof(double) * values.size());
+}
+
 double GVec::dotProduct(const GVec& that) const
 {
 	GAssert(size() == that.size());
@@ -652,6 +667,281 @@ void GVec::swapContents(GVec& that)
 	std::swap(m_size, that.m_size);
 }
 
+#define GEMM_BLOCK_K 64
+#define GEMM_BLOCK_N 192
+
+// static
+void GVec::gemm(bool transposeA, bool transposeB, size_t m, size_t n, size_t k, const double* a, size_t lda, const double* b, size_t ldb, double* c, size_t ldc)
+{
+	if(m == 0 || n == 0 || k == 0)
+		return;
+	size_t aRowStep = transposeA ? 1 : lda;
+	size_t aColStep = transposeA ? lda : 1;
+	std::vector<double> panel;
+	if(transposeB)
+		panel.resize(std::min(k, (size_t)GEMM_BLOCK_K) * std::min(n, (size_t)GEMM_BLOCK_N));
+	for(size_t jj = 0; jj < n; jj += GEMM_BLOCK_N)
+	{
+		size_t nb = std::min((size_t)GEMM_BLOCK_N, n - jj);
+		for(size_t pp = 0; pp < k; pp += GEMM_BLOCK_K)
+		{
+			size_t kb = std::min((size_t)GEMM_BLOCK_K, k - pp);
+
+			// Obtain a block of op(b) with contiguous rows, transposing it if necessary
+			const double* bBlock;
+			size_t bStep;
+			if(transposeB)
+			{
+				for(size_t j = 0; j < nb; j++)
+				{
+					const double* src = b + (jj + j) * ldb + pp;
+					for(size_t p = 0; p < kb; p++)
+						panel[p * nb + j] = src[p];
+				}
+				bBlock = panel.data();
+				bStep = nb;
+			}
+			else
+			{
+				bBlock = b + pp * ldb + jj;
+				bStep = ldb;
+			}
+
+			// Multiply four rows at a time, so each value loaded from the block is used four times
+			size_t i = 0;
+			for( ; i + 4 <= m; i += 4)
+			{
+				double* c0 = c + i * ldc + jj;
+				double* c1 = c0 + ldc;
+				double* c2 = c1 + ldc;
+				double* c3 = c2 + ldc;
+				const double* a0 = a + i * aRowStep + pp * aColStep;
+				for(size_t p = 0; p < kb; p++)
+				{
+					double v0 = a0[p * aColStep];
+					double v1 = a0[aRowStep + p * aColStep];
+					double v2 = a0[2 * aRowStep + p * aColStep];
+					double v3 = a0[3 * aRowStep + p * aColStep];
+					const double* bRow = bBlock + p * bStep;
+					for(size_t j = 0; j < nb; j++)
+					{
+						double bv = bRow[j];
+						c0[j] += v0 * bv;
+						c1[j] += v1 * bv;
+						c2[j] += v2 * bv;
+						c3[j] += v3 * bv;
+					}
+				}
+			}
+			for( ; i < m; i++)
+			{
+				double* c0 = c + i * ldc + jj;
+				const double* a0 = a + i * aRowStep + pp * aColStep;
+				for(size_t p = 0; p < kb; p++)
+				{
+					double v0 = a0[p * aColStep];
+					const double* bRow = bBlock + p * bStep;
+					for(size_t j = 0; j < nb; j++)
+						c0[j] += v0 * bRow[j];
+				}
+			}
+		}
+	}
+}
+
+
+#define CHOLESKY_BLOCK 64
+
+/// Holds the state of a blocked Cholesky decomposition, so the panel solves and trailing
+/// updates for each block row can be performed as separate jobs.
+class GVec_cholesky
+{
+protected:
+	double* m_a;
+	size_t m_n;
+	size_t m_lda;
+	size_t m_step; // The index of the diagonal block that was most recently factored
+	size_t m_stepSize; // The size of that diagonal block
+	bool m_update; // True when the jobs perform trailing updates. False when they perform panel solves.
+	std::vector<double> m_negPanel;
+
+public:
+	GVec_cholesky(double* a, size_t n, size_t lda)
+	: m_a(a), m_n(n), m_lda(lda), m_step(0), m_stepSize(0), m_update(false)
+	{
+	}
+
+	/// Factors the diagonal block that starts at index kk in place. Returns false if it is not positive definite.
+	bool factorDiagonal(size_t kk, size_t kb)
+	{
+		for(size_t j = kk; j < kk + kb; j++)
+		{
+			double* rowJ = m_a + j * m_lda;
+			double d = rowJ[j];
+			for(size_t p = kk; p < j; p++)
+				d -= rowJ[p] * rowJ[p];
+			if(!(d > 0.0)) // (this also catches NaN)
+				return false;
+			d = std::sqrt(d);
+			rowJ[j] = d;
+			for(size_t i = j + 1; i < kk + kb; i++)
+			{
+				double* rowI = m_a + i * m_lda;
+				double t = rowI[j];
+				for(size_t p = kk; p < j; p++)
+					t -= rowI[p] * rowJ[p];
+				rowI[j] = t / d;
+			}
+		}
+		m_step = kk;
+		m_stepSize = kb;
+		m_negPanel.resize((m_n - kk - kb) * kb);
+		return true;
+	}
+
+	/// Returns the number of block rows below the most recently factored diagonal block.
+	size_t blockRows() const
+	{
+		size_t start = m_step + m_stepSize;
+		return (m_n - start + CHOLESKY_BLOCK - 1) / CHOLESKY_BLOCK;
+	}
+
+	/// Specifies whether subsequent jobs perform panel solves or trailing updates.
+	void setUpdate(bool b) { m_update = b; }
+
+	/// Performs the panel solve or trailing update for one block row.
+	void doJob(size_t job)
+	{
+		size_t kk = m_step;
+		size_t kb = m_stepSize;
+		size_t start = kk + kb;
+		size_t i0 = start + job * CHOLESKY_BLOCK;
+		size_t i1 = std::min(m_n, i0 + CHOLESKY_BLOCK);
+		if(m_update)
+		{
+			// Subtract the outer products of the panel from the lower part of this block row
+			GVec::gemm(false, true, i1 - i0, i1 - start, kb, m_negPanel.data() + (i0 - start) * kb, kb, m_a + start * m_lda + kk, m_lda, m_a + i0 * m_lda + start, m_lda);
+		}
+		else
+		{
+			// Solve X * D^T = A for the rows of the panel, where D is the factored diagonal block
+			for(size_t i = i0; i < i1; i++)
+			{
+				double* rowI = m_a + i * m_lda + kk;
+				double* pNeg = m_negPanel.data() + (i - start) * kb;
+				for(size_t j = 0; j < kb; j++)
+				{
+					const double* rowJ = m_a + (kk + j) * m_lda + kk;
+					double t = rowI[j];
+					for(size_t p = 0; p < j; p++)
+						t -= rowI[p] * rowJ[p];
+					rowI[j] = t / rowJ[j];
+					pNeg[j] = -rowI[j];
+				}
+			}
+		}
+	}
+};
+
+class GVec_choleskyWorker : public GWorkerThread
+{
+protected:
+	GVec_cholesky& m_chol;
+
+public:
+	GVec_choleskyWorker(GMasterThread& master, GVec_cholesky& chol)
+	: GWorkerThread(master), m_chol(chol)
+	{
+	}
+
+	virtual ~GVec_choleskyWorker()
+	{
+	}
+
+	virtual void doJob(size_t jobId)
+	{
+		m_chol.doJob(jobId);
+	}
+};
+
+// static
+bool GVec::cholesky(double* a, size_t n, size_t lda, size_t workerThreads)
+{
+	GVec_cholesky chol(a, n, lda);
+	GMasterThread master;
+	size_t maxJobs = std::max((size_t)1, (n + CHOLESKY_BLOCK - 1) / CHOLESKY_BLOCK - 1);
+	for(size_t i = 0; i < std::max((size_t)1, std::min(workerThreads, maxJobs)); i++)
+		master.addWorker(new GVec_choleskyWorker(master, chol));
+	for(size_t kk = 0; kk < n; kk += CHOLESKY_BLOCK)
+	{
+		size_t kb = std::min((size_t)CHOLESKY_BLOCK, n - kk);
+		if(!chol.factorDiagonal(kk, kb))
+			return false;
+		size_t jobs = chol.blockRows();
+		if(jobs == 0)
+			break;
+		chol.setUpdate(false);
+		master.doJobs(jobs);
+		chol.setUpdate(true);
+		master.doJobs(jobs);
+	}
+
+	// Zero the upper triangle
+	for(size_t i = 0; i < n; i++)
+	{
+		double* row = a + i * lda;
+		for(size_t j = i + 1; j < n; j++)
+			row[j] = 0.0;
+	}
+	return true;
+}
+
+// static
+void GVec::trsm(bool transpose, size_t n, size_t k, const double* l, size_t ldl, double* b, size_t ldb)
+{
+	if(transpose)
+	{
+		// Back substitution with L^T. Each solved row is subtracted from the rows above it.
+		for(size_t i = n; i > 0; i--)
+		{
+			const double* lRow = l + (i - 1) * ldl;
+			double* xRow = b + (i - 1) * ldb;
+			double d = 1.0 / lRow[i - 1];
+			for(size_t j = 0; j < k; j++)
+				xRow[j] *= d;
+			for(size_t p = 0; p + 1 < i; p++)
+			{
+				double s = lRow[p];
+				if(s == 0.0)
+					continue;
+				double* bRow = b + p * ldb;
+				for(size_t j = 0; j < k; j++)
+					bRow[j] -= s * xRow[j];
+			}
+		}
+	}
+	else
+	{
+		// Forward substitution with L. Each row subtracts the rows that were solved before it.
+		for(size_t i = 0; i < n; i++)
+		{
+			const double* lRow = l + i * ldl;
+			double* xRow = b + i * ldb;
+			for(size_t p = 0; p < i; p++)
+			{
+				double s = lRow[p];
+				if(s == 0.0)
+					continue;
+				const double* bRow = b + p * ldb;
+				for(size_t j = 0; j < k; j++)
+					xRow[j] -= s * bRow[j];
+			}
+			double d = 1.0 / lRow[i];
+			for(size_t j = 0; j < k; j++)
+				xRow[j] *= d;
+		}
+	}
+}
 
 // static
 void GVec::test()
@@ -742,6 +1032,76 @@ void GVec::test()
 	v6 /= 2;
 	if ( v6[0] != 5 || v6[1] != 5 )
 		throw Ex("failed");
+
+	// Test gemm against a naive matrix product with every combination of transposes
+	{
+		GRand rand(0);
+		size_t m = 7;
+		size_t n = 211; // spans more than one block
+		size_t k = 67;
+		GVec a(m * k);
+		GVec b(k * n);
+		a.fillNormal(rand);
+		b.fillNormal(rand);
+		for(size_t t = 0; t < 4; t++)
+		{
+			bool ta = (t & 1) != 0;
+			bool tb = (t & 2) != 0;
+			GVec c(m * n);
+			c.fill(1.0);
+			GVec::gemm(ta, tb, m, n, k, a.data(), ta ? m : k, b.data(), tb ? k : n, c.data(), n);
+			for(size_t i = 0; i < m; i++)
+			{
+				for(size_t j = 0; j < n; j++)
+				{
+					double sum = 1.0;
+					for(size_t p = 0; p < k; p++)
+						sum += (ta ? a[p * m + i] : a[i * k + p]) * (tb ? b[j * k + p] : b[p * n + j]);
+					if(std::abs(c[i * n + j] - sum) > 1e-9)
+						throw Ex("gemm failed");
+				}
+			}
+		}
+	}
+
+	// Test cholesky and trsm on a matrix that spans several blocks
+	{
+		GRand rand(0);
+		size_t n = 150;
+		size_t k = 5;
+		GVec g(n * n);
+		g.fillNormal(rand);
+		GVec a(n * n);
+		a.fill(0.0);
+		GVec::gemm(false, true, n, n, n, g.data(), n, g.data(), n, a.data(), n);
+		for(size_t i = 0; i < n; i++)
+			a[i * n + i] += 1.0;
+		GVec l;
+		l.copy(a);
+		if(!GVec::cholesky(l.data(), n, n))
+			throw Ex("cholesky failed");
+		GVec l2;
+		l2.copy(a);
+		if(!GVec::cholesky(l2.data(), n, n, 3) || l2.squaredDistance(l) != 0.0)
+			throw Ex("cholesky depends on the number of threads");
+		GVec llt(n * n);
+		llt.fill(0.0);
+		GVec::gemm(false, true, n, n, n, l.data(), n, l.data(), n, llt.data(), n);
+		if(llt.squaredDistance(a) > 1e-16 * a.squaredMagnitude())
+			throw Ex("cholesky failed");
+		GVec x(n * k);
+		x.fillNormal(rand);
+		GVec b(n * k);
+		b.fill(0.0);
+		GVec::gemm(false, false, n, k, n, llt.data(), n, x.data(), k, b.data(), k);
+		GVec::trsm(false, n, k, l.data(), n, b.data(), k);
+		GVec::trsm(true, n, k, l.data(), n, b.data(), k);
+		if(b.squaredDistance(x) > 1e-12 * x.squaredMagnitude())
+			throw Ex("trsm failed");
+		a[n * n - 1] = -1.0;
+		if(GVec::cholesky(a.data(), n, n))
+			throw Ex("expected the indefinite matrix to fail");
+	}
 }
 
 std::string to_str(const GVec& v)
@@ -1708,6 +2068,124 @@ void GTensor::convolve(const GTensor& in, const GTensor& filter, GTensor& out, b
 	}
 }
 
+// Visits every (filter element, output element) pair in the layout produced by im2col.
+// If gather is true, values are copied from image into cols. Otherwise, values in cols are added into image.
+void GTensor_lower(const GIndexVec& inShape, const GIndexVec& filterShape, const GIndexVec& outShape, size_t stride, double* image, double* cols, bool gather)
+{
+	size_t dc = inShape.size();
+	if(filterShape.size() != dc || outShape.size() != dc)
+		throw Ex("Expected the input, filter, and output to have the same number of dimensions");
+	size_t* kf = (size_t*)alloca(sizeof(size_t) * 3 * dc);
+	size_t* ko = kf + dc;
+	size_t* stepIn = ko + dc;
+	ssize_t* pad = (ssize_t*)alloca(sizeof(ssize_t) * dc);
+	size_t outCount = 1;
+	for(size_t i = 0; i < dc; i++)
+	{
+		stepIn[i] = (i == 0 ? 1 : stepIn[i - 1] * inShape[i - 1]);
+		pad[i] = ((ssize_t)(stride * (outShape[i] - 1) + filterShape[i]) - (ssize_t)inShape[i]) / 2;
+		outCount *= outShape[i];
+		kf[i] = 0;
+	}
+	size_t out0 = outShape[0];
+	ssize_t in0 = (ssize_t)inShape[0];
+	double* row = cols;
+	while(true) // kf
+	{
+		// Find the range of output positions along the first dimension that land inside the input
+		ssize_t off0 = (ssize_t)kf[0] - pad[0];
+		size_t lo = off0 >= 0 ? 0 : (size_t)((-off0 + (ssize_t)stride - 1) / (ssize_t)stride);
+		size_t hi = (in0 - 1 - off0 >= 0) ? std::min(out0, (size_t)((in0 - 1 - off0) / (ssize_t)stride) + 1) : 0;
+		lo = std::min(lo, out0);
+		hi = std::max(hi, lo);
+
+		// Visit each run of outputs along the first dimension
+		for(size_t i = 1; i < dc; i++)
+			ko[i] = 0;
+		double* run = row;
+		while(true) // ko
+		{
+			ssize_t base = 0;
+			bool inside = true;
+			for(size_t i = 1; i < dc; i++)
+			{
+				ssize_t idx = (ssize_t)(ko[i] * stride + kf[i]) - pad[i];
+				if(idx < 0 || idx >= (ssize_t)inShape[i])
+				{
+					inside = false;
+					break;
+				}
+				base += idx * (ssize_t)stepIn[i];
+			}
+			if(inside && hi > lo)
+			{
+				double* pIm = image + (base + off0 + (ssize_t)(lo * stride));
+				if(gather)
+				{
+					std::fill(run, run + lo, 0.0);
+					if(stride == 1)
+						memcpy(run + lo, pIm, sizeof(double) * (hi - lo));
+					else
+					{
+						for(size_t o = lo; o < hi; o++)
+						{
+							run[o] = *pIm;
+							pIm += stride;
+						}
+					}
+					std::fill(run + hi, run + out0, 0.0);
+				}
+				else
+				{
+					for(size_t o = lo; o < hi; o++)
+					{
+						*pIm += run[o];
+						pIm += stride;
+					}
+				}
+			}
+			else if(gather)
+				std::fill(run, run + out0, 0.0);
+			run += out0;
+
+			// increment the ko position
+			size_t i;
+			for(i = 1; i < dc; i++)
+			{
+				if(++ko[i] < outShape[i])
+					break;
+				ko[i] = 0;
+			}
+			if(i >= dc)
+				break;
+		}
+		row += outCount;
+
+		// increment the kf position
+		size_t i;
+		for(i = 0; i < dc; i++)
+		{
+			if(++kf[i] < filterShape[i])
+				break;
+			kf[i] = 0;
+		}
+		if(i >= dc)
+			break;
+	}
+}
+
+// static
+void GTensor::im2col(const GTensor& in, const GIndexVec& filterShape, const GIndexVec& outShape, size_t stride, double* cols)
+{
+	GTensor_lower(in.shape, filterShape, outShape, stride, (double*)in.data(), cols, true);
+}
+
+// static
+void GTensor::col2im(const double* cols, const GIndexVec& filterShape, const GIndexVec& outShape, size_t stride, GTensor& in)
+{
+	GTensor_lower(in.shape, filterShape, outShape, stride, in.data(), (double*)cols, false);
+}
+
 // static
 void GTensor::test()
 {
@@ -1768,6 +2246,36 @@ void GTensor::test()
 		if(std::sqrt(out.squaredDistance(expected)) > 1e-10)
 			throw Ex("wrong");
 	}
+
+	{
+		// Test that im2col followed by a matrix product agrees with convolve, and that col2im is its adjoint
+		GRand rand(0);
+		GVec in(7 * 6 * 3);
+		in.fillNormal(rand);
+		GTensor tin({7, 6, 3}, false, &in);
+		GVec k(4 * 3 * 3);
+		k.fillNormal(rand);
+		GTensor tk({4, 3, 3}, false, &k);
+		GVec out(7 * 6);
+		out.fill(0.0);
+		GTensor tout({7, 6, 1}, false, &out);
+		GTensor::convolve(tin, tk, tout, false, 1);
+		GVec cols(k.size() * out.size());
+		GTensor::im2col(tin, tk.shape, tout.shape, 1, cols.data());
+		GVec out2(out.size());
+		out2.fill(0.0);
+		GVec::gemm(false, false, 1, out.size(), k.size(), k.data(), k.size(), cols.data(), out.size(), out2.data(), out.size());
+		if(std::sqrt(out.squaredDistance(out2)) > 1e-10)
+			throw Ex("im2col disagrees with convolve");
+		GVec y(cols.size());
+		y.fillNormal(rand);
+		GVec back(in.size());
+		back.fill(0.0);
+		GTensor tback({7, 6, 3}, false, &back);
+		GTensor::col2im(y.data(), tk.shape, tout.shape, 1, tback);
+		if(std::abs(cols.dotProduct(y) - in.dotProduct(back)) > 1e-8)
+			throw Ex("col2im is not the adjoint of im2col");
+	}
 }
 
 
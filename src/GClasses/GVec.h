@@ -30,6 +30,7 @@ namespace GClasses {
 class GRand;
 class GDom;
 class GDomNode;
+class GJsonWriter;
 class GImage;
 class GDomListIterator;
 class GVecWrapper;
@@ -204,9 +205,15 @@ public:
 	/// Marshals this vector into a DOM node.
 	GDomNode* serialize(GDom* pDoc) const;
 
+	/// Writes this vector to writer as a JSON list, the same as the node returned by serialize, without building any nodes.
+	void serializeStream(GJsonWriter& writer) const;
+
 	/// Unmarshals this vector from a DOM.
 	void deserialize(const GDomNode* pNode);
 
+	/// Parses a JSON list of numbers, such as "[1.5,-2,3e4]", directly into this vector without building a DOM.
+	void parseJson(const char* pJson, size_t len);
+
 	/// Returns the dot product of this and that.
 	double dotProduct(const GVec& that) const;
 
@@ -270,6 +277,28 @@ public:
 	/// Swaps the contents of this vector with that vector.
 	void swapContents(GVec& that);
 
+	/// Computes c += op(a) * op(b), where op(a) is an m-by-k matrix, op(b) is a k-by-n matrix, and c is an m-by-n matrix.
+	/// All three matrices are dense and stored in row-major order. lda, ldb, and ldc specify the number of elements
+	/// between the starts of consecutive rows. If transposeA is true, a is stored as a k-by-m matrix, and its transpose
+	/// is used. Likewise, if transposeB is true, b is stored as an n-by-k matrix.
+	/// The product is computed in cache-sized blocks, so this is much faster than computing one dot product at a time.
+	static void gemm(bool transposeA, bool transposeB, size_t m, size_t n, size_t k, const double* a, size_t lda, const double* b, size_t ldb, double* c, size_t ldc);
+
+	/// Computes the Cholesky decomposition of the symmetric positive-definite n-by-n matrix a, which is stored
+	/// in row-major order with lda elements between the starts of consecutive rows. Only the lower triangle of a
+	/// is read. When it returns, a holds the lower-triangular matrix L such that L * L^T equals the original matrix,
+	/// and the elements above the diagonal are zero. The matrix is factored in square blocks, and the updates to the
+	/// trailing blocks are performed with gemm and split across workerThreads threads. (The results do not depend on
+	/// the number of threads.) Returns false if the matrix is not (numerically) positive definite, in which case the
+	/// contents of a are undefined.
+	static bool cholesky(double* a, size_t n, size_t lda, size_t workerThreads = 1);
+
+	/// Solves L * X = B for X, where L is an n-by-n lower-triangular matrix (such as one produced by cholesky),
+	/// and B is an n-by-k matrix. If transpose is true, solves L^T * X = B instead. Both matrices are stored in
+	/// row-major order, and ldl and ldb specify the number of elements between the starts of consecutive rows.
+	/// X overwrites B. Only the lower triangle of L is read.
+	static void trsm(bool transpose, size_t n, size_t k, const double* l, size_t ldl, double* b, size_t ldb);
+
 
 
 
@@ -697,6 +726,17 @@ public:
 	/// If flipFilter is true, then the filter is flipped in all dimensions.
 	static void convolve(const GTensor& in, const GTensor& filter, GTensor& out, bool flipFilter = false, size_t stride = 1);
 
+	/// Lowers the convolution of in with a filter of shape filterShape into an output of shape outShape to a matrix
+	/// (the "im2col" transform), so that convolving with many filters becomes a single matrix product.
+	/// cols must have room for (filter elements)*(output elements) values. It is filled as a row-major matrix with one
+	/// row for each filter element and one column for each output element. Padding is computed the same way as in
+	/// convolve, and values that fall in the padding are set to zero.
+	static void im2col(const GTensor& in, const GIndexVec& filterShape, const GIndexVec& outShape, size_t stride, double* cols);
+
+	/// The adjoint of im2col. Adds each value in cols to the element of in that im2col would have copied into that
+	/// position. (Values that im2col would have taken from the padding are ignored.)
+	static void col2im(const double* cols, const GIndexVec& filterShape, const GIndexVec& outShape, size_t stride, GTensor& in);
+
 	static void test();
 };
 
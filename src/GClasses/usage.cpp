@@ -239,6 +239,9 @@ UsageNode* makeAlgorithmUsageTree()
 		pOpts->add("-noise [var]=1.0", "The variance of the noise parameter.");
 		pOpts->add("-prior [var]=1024.0", "The prior variance for the weights. (This value will be multiplied by an identity matrix to form the prior covariance for the weights.");
 		pOpts->add("-maxsamples [n]=350", "The maximum number of samples to train with. (If the training data contains more than [n] rows, then it will automatically randomly sub-sample the training data in order to limit computational complexity.)");
+		pOpts->add("-inducing [m]", "Train a sparse model with [m] inducing points, which are drawn at random from the training data. The sparse model uses all of the training data (so -maxsamples does not apply), and training time grows linearly with the number of rows. This uses the variational free energy approximation.");
+		pOpts->add("-fitc [m]", "Like -inducing, except it uses the fully independent training conditional approximation, which also models the variance of each row that the inducing points do not explain.");
+		pOpts->add("-threads [n]=1", "Use [n] worker threads for the matrix decompositions and for absorbing the training data into a sparse model. (The results do not depend on the number of threads.)");
 		UsageNode* pKern = pOpts->add("-kernel [k]", "Specify the kernel to use");
 		pKern->add("identity", "This simple kernel causes it to learn a linear model. If no kernel is specified, this is the default.");
 		pKern->add("chisquared", "A Chi Squared kernel.");
@@ -277,7 +280,11 @@ UsageNode* makeAlgorithmUsageTree()
 		pOpts->add("-cosine", "Use the cosine method to evaluate the similarity between sparse vectors. (Only compatible with sparse training.)");
 	}
 	{
-		pRoot->add("linear", "A linear regression model");
+		UsageNode* pLin = pRoot->add("linear <options>", "A linear regression model. It is fitted in a single pass over the data by accumulating the sufficient statistics and solving for the least-squares weights directly.");
+		UsageNode* pOpts = pLin->add("<options>");
+		pOpts->add("-autotune", "Automatically determine a good set of parameters for this model with the current data.");
+		pOpts->add("-ridge [value]=0", "Specify a ridge (L2) regularization term. The sum of the squared weights, times this value, is added to the sum-squared error that is minimized.");
+		pOpts->add("-threads [n]=1", "Specify the number of worker threads to use for training.");
 	}
 	{
 		pRoot->add("meanmarginstree", "This is a very simple oblique (or linear combination) tree. (This algorithm is specified in Gashler, Michael S. and Giraud-Carrier, Christophe and Martinez, "
@@ -288,12 +295,14 @@ UsageNode* makeAlgorithmUsageTree()
 		UsageNode* pOpts = pNB->add("<options>");
 		pOpts->add("-autotune", "Automatically determine a good set of parameters for this model with the current data.");
 		pOpts->add("-ess [value]=0.2", "Specifies an equivalent sample size to prevent unsampled values from dominating the joint distribution. Good values typically range between 0 and 1.5.");
+		pOpts->add("-threads [n]=1", "Specify the number of worker threads to use when counting the training rows. (The model does not depend on the number of threads.)");
 	}
 	{
 		UsageNode* pNI = pRoot->add("naiveinstance <options>", "This is an instance learner that assumes each dimension is conditionally independant from other dimensions. It lacks the accuracy of knn in low dimensional feature space, but scales much better to high dimensionality.");
 		UsageNode* pOpts = pNI->add("<options>");
 		pOpts->add("-autotune", "Automatically determine a good set of parameters for this model with the current data.");
 		pOpts->add("-neighbors [k]=12", "Set the number of neighbors to use in each dimension");
+		pOpts->add("-threads [n]=1", "Specify the number of worker threads to use when indexing the training rows. (The model does not depend on the number of threads.)");
 	}
 	{
 		UsageNode* pNT = pRoot->add("neighbortransducer <options>", "This is a model-free transduction algorithm. It is an instance learner that propagates labels where the neighbors are most in agreement. This algorithm does well when classes sample a manifold (such as with text recognition).");
@@ -638,6 +647,8 @@ UsageNode* makeDimRedUsageTree()
 		UsageNode* pOpts = pIsomap->add("<options>");
 		pOpts->add("-seed [value]=0", "Specify a seed for the random number generator.");
 		pOpts->add("-tolerant", "If there are points that are disconnected from the rest of the graph, just drop them from the data. (This may cause the results to contain fewer rows than the input.)");
+		pOpts->add("-landmarks [n]=100", "Use Landmark Isomap. Geodesic distances are only computed from n randomly chosen landmarks, and the other points are placed relative to them. This needs much less time and memory than computing the distances between every pair of points, so use it with large datasets.");
+		pOpts->add("-threads [n]=1", "Specify the number of threads to use for computing geodesic distances.");
 		pIsomap->add("[dataset]=in.arff", "The filename of the high-dimensional data to reduce.");
 		pIsomap->add("[neighbor-count]=12", "The number of neighbors to use.");
 		pIsomap->add("[target_dims]=2", "The number of dimensions to reduce the data into.");
@@ -646,6 +657,9 @@ UsageNode* makeDimRedUsageTree()
 		UsageNode* SU = pRoot->add("scalingunfolder [dataset] [neighbor-count] [neighbor-finder] [target_dims] <options>", "Use the ScalingUnfolder algorithm to reduce dimensionality. (This algorithm was inspired by Maximum Variance Unfolding (MVU). It iteratively scales up the data, then restores distances in local neighborhoods. Unlike MVU, however, it does not use semidefinite programming.)");
 		UsageNode* pOpts = SU->add("<options>");
 		pOpts->add("-seed [value]=0", "Specify a seed for the random number generator.");
+		pOpts->add("-threads [n]=1", "Specify the number of threads to use. The points are split into spatially compact parts, and the parts are refined concurrently. (The results do not depend on the number of threads.)");
+		pOpts->add("-partsize [n]=2048", "Specify the maximum number of points in each part.");
+		pOpts->add("-progress [filename]=progress.arff", "Save the pass number, the stress (the normalized squared error in the neighbor distances), and the elapsed seconds after each scaling pass to the specified ARFF file.");
 		SU->add("[dataset]=in.arff", "The filename of the high-dimensional data to reduce.");
 		SU->add("[neighbor-count]=12", "The number of neighbors to use.");
 		SU->add("[target_dims]=2", "The number of dimensions to reduce the data into.");
@@ -705,11 +719,15 @@ UsageNode* makeDimRedUsageTree()
 		pOpts->add("-sigmafilename [filename]=sigma.arff", "Set the filename to which Sigma will be saved. Sigma is the matrix that contains the singular values on its diagonal. All values in Sigma except the diagonal will be zero. If this option is not specified, the default is to only print the diagonal values (not the whole matrix) to stdout. If this options is specified, nothing is printed to stdout.");
 		pOpts->add("-vfilename [filename]=v.arff", "Set the filename to which V will be saved. V is the matrix in which the row are the eigenvectors of the transpose of [matrix] times [matrix]. The default is v.arff.");
 		pOpts->add("-maxiters [n]=100", "Specify the number of times to iterate before giving up. The default is 100, which should be sufficient for most problems.");
+		pOpts->add("-rank [k]=10", "Compute only the k most significant singular values and vectors with a randomized block Krylov method. This is much faster than a full decomposition when k is small. U will have k columns, Sigma will be k-by-k, and V will have k rows. (-maxiters is ignored when this option is used.)");
+		pOpts->add("-threads [n]=1", "Specify the number of threads to use with -rank.");
+		pOpts->add("-seed [value]=0", "Specify a seed for the random number generator used with -rank.");
 	}
 	{
 		UsageNode* pLLE = pRoot->add("lle [dataset] [neighbor-count] [neighbor-finder] [target_dims] <options>", "Use the LLE algorithm to reduce dimensionality.");
 		UsageNode* pOpts = pLLE->add("<options>");
 		pOpts->add("-seed [value]=0", "Specify a seed for the random number generator.");
+		pOpts->add("-threads [n]=1", "Specify the number of threads to use for computing the neighbor weights and the eigenvectors. (The results do not depend on the number of threads.)");
 		pLLE->add("[dataset]=in.arff", "The filename of the high-dimensional data to reduce.");
 		pLLE->add("[neighbor-count]=12", "The number of neighbors to use.");
 		pLLE->add("[target_dims]=2", "The number of dimensions to reduce the data into.");
@@ -723,6 +741,8 @@ UsageNode* makeDimRedUsageTree()
 		pOpts->add("-seed [value]=0", "Specify a seed for the random number generator.");
 		pOpts->add("-continue [dataset]=prev.arff", "Continue refining the specified reduced-dimensional results. (This feature enables Manifold Sculpting to improve upon its own results, or to refine the results from another dimensionality reduction algorithm.)");
 		pOpts->add("-scalerate [value]=0.9999", "Specify the scaling rate. If not specified, the default is 0.999. A value close to 1 will give better results, but will cause the algorithm to take longer.");
+		pOpts->add("-threads [n]=1", "Specify the number of threads to use. Points whose neighborhoods do not overlap are adjusted concurrently. (The results do not depend on the number of threads.)");
+		pOpts->add("-progress [filename]=progress.arff", "Save the pass number, the stress (the normalized squared error in the neighbor distances), and the elapsed seconds after each pass to the specified ARFF file.");
 	}
 	{
 		UsageNode* pMDS = pRoot->add("multidimensionalscaling [distance-matrix] [target-dims]", "Perform MDS on the specified [distance-matrix].");
@@ -738,6 +758,7 @@ UsageNode* makeDimRedUsageTree()
 		pOpts->add("-eigenvalues [filename]=eigenvalues.arff", "Save the eigenvalues to the specified file.");
 		pOpts->add("-components [filename]=eigenvectors.arff", "Save the centroid and principal component vectors (in order of decreasing corresponding eigenvalue) to the specified file.");
 		pOpts->add("-aboutorigin", "Compute the principal components about the origin. (The default is to compute them relative to the centroid.)");
+		pOpts->add("-threads [n]=1", "Specify the number of threads to use to compute the principal components.");
 		pOpts->add("-modelin [filename]=in.json", "Load the PCA model from a json file.");
 		pOpts->add("-modelout [filename]=out.json", "Save the trained PCA model to a json file.");
 		pPCA->add("[dataset]=in.arff", "The filename of the high-dimensional data to reduce.");
@@ -991,7 +1012,9 @@ UsageNode* makeLearnUsageTree()
 {
 	UsageNode* pRoot = new UsageNode("waffles_learn [command]", "Supervised learning, transduction, cross-validation, etc.");
 	{
-		UsageNode* pAT = pRoot->add("autotune [dataset] <data_opts> [algname]", "Use cross-validation to automatically determine a good set of parameters for the specified algorithm with the specified data. The selected parameters are printed to stdout.");
+		UsageNode* pAT = pRoot->add("autotune <options> [dataset] <data_opts> [algname]", "Use cross-validation to automatically determine a good set of parameters for the specified algorithm with the specified data. Candidate configurations are pruned by successive halving: each round evaluates the surviving candidates with more of the data. The selected parameters are printed to stdout.");
+		UsageNode* pOpts = pAT->add("<options>");
+		pOpts->add("-threads [n]=1", "Specify the number of threads to use to evaluate the candidate configurations in parallel. The results do not depend on the number of threads.");
 		pAT->add("[dataset]=train.arff", "The filename of a dataset.");
 		UsageNode* pDO = pAT->add("<data_opts>");
 		pDO->add("-labels [attr_list]=0", "Specify which attributes to use as labels. (If not specified, the default is to use the last attribute for the label.) [attr_list] is a comma-separated list of zero-indexed columns. A hypen may be used to specify a"
@@ -1042,6 +1065,15 @@ UsageNode* makeLearnUsageTree()
 		pDO->add("-labels [attr_list]=0", "Specify which attributes to use as labels. (If not specified, the default is to use the last attribute for the label.) [attr_list] is a comma-separated list of zero-indexed columns. A hypen may be used to specify a range of columns.  A '*' preceding a value means to index from the right instead of the left. For example, \"0,2-5\" refers to columns 0, 2, 3, 4, and 5. \"*0\" refers to the last column. \"0-*1\" refers to all but the last column.");
 		pDO->add("-ignore [attr_list]=0", "Specify attributes to ignore. [attr_list] is a comma-separated list of zero-indexed columns. A hypen may be used to specify a range of columns.  A '*' preceding a value means to index from the right instead of the left. For example, \"0,2-5\" refers to columns 0, 2, 3, 4, and 5. \"*0\" refers to the last column. \"0-*1\" refers to all but the last column.");
 	}
+	{
+		UsageNode* pServe = pRoot->add("serve <options> [model-file]...", "Serve predictions from one or more trained models over HTTP until the process is killed. Each model is served at \"/predict/[name]\", where [name] is its filename without the extension. POST a JSON body of the form {\"rows\":[[f1,f2,...],...]} (or {\"pairs\":[[user,item],...]} for a collaborative filter), or a packed array of doubles with the content type \"application/octet-stream\", to get the predictions for a batch. \"GET /models\" lists the models, and \"GET /stats\" reports batching statistics.");
+		UsageNode* pOpts = pServe->add("<options>");
+		pOpts->add("-port [value]=8080", "Specify the port on which to listen.");
+		pOpts->add("-threads [n]=1", "Specify the number of worker threads that score requests. Each one has its own copy of each model. The default is 1.");
+		pOpts->add("-queue [n]=1024", "Specify the maximum number of requests that may wait for a worker. When the queue is full, requests are rejected with \"503 Service Unavailable\".");
+		pOpts->add("-batch [rows]=32 [ms]=5", "Score requests for supervised learners in batches. Requests are held for up to [ms] milliseconds, and the rows of the requests that arrive in that time are scored together, up to [rows] rows at a time. This improves throughput when there are many small requests. \"GET /stats\" reports the queueing delays and batch sizes.");
+		pServe->add("[model-file]=model.json", "The filename of a trained model. (This is the file to which you saved the output when you trained a supervised learning algorithm or a collaborative filter.)");
+	}
 	{
 		UsageNode* pTest = pRoot->add("test <options> [model-file] [dataset] <data_opts>", "Test a trained model using some test data. Results are printed to stdout for each dimension in the label vector. Predictive accuracy is reported for nominal label dimensions, and mean-squared-error is reported for continuous label dimensions.");
 		UsageNode* pOpts = pTest->add("<options>");
@@ -1098,6 +1130,7 @@ UsageNode* makeLearnUsageTree()
 		pOpts->add("-seed [value]=0", "Specify a seed for the random number generator. (Use this option to ensure that your results are reproduceable.)");
 		pOpts->add("-reps [value]=5", "Specify the number of repetitions to perform. If not specified, the default is 5.");
 		pOpts->add("-folds [value]=2", "Specify the number of folds to use. If not specified, the default is 2.");
+		pOpts->add("-threads [n]=1", "Specify the number of threads to use. Each fold is trained by a separate instance of the algorithm, and the folds are evaluated in parallel. The results do not depend on the number of threads.");
 		pOpts->add("-succinct", "Just report the average mean squared error. Do not report results at each fold.");
 		pCV->add("[dataset]=data.arff", "The filename of a dataset.");
 		UsageNode* pDO = pCV->add("<data_opts>");
@@ -1129,26 +1162,23 @@ UsageNode* makeLearnUsageTree()
 					" columns 0, 2, 3, 4, and 5. \"*0\" refers to the last column. \"0-*1\" refers to all but the last column.");
 		pDO->add("-ignore [attr_list]=0", "Specify attributes to ignore. [attr_list] is a comma-separated list of zero-indexed columns. A hypen may be used to specify a range of columns.  A '*' preceding a value means to index from the right instead of the left. For example, \"0,2-5\" refers to columns 0, 2, 3, 4, and 5. \"*0\" refers to the last column. \"0-*1\" refers to all but the last column.");
 	}
-/*	{
-		UsageNode* pTR = pRoot->add("trainrecurrent <options> [method] [obs-data] [action-data] [context-dims] [algorithm] [algorithm]", "Train a recurrent model of a dynamical system with the specified training [method]. The training data is specified by [obs-data], which specifies the sequence of observations, and [action-data], which specifies the sequence of actions. "
-			"[context-dims] specifies the number of dimensions in the state-space of the system. The two algorithms specify the two functions of a model of a dynamical system. The first [algorithm] models the transition function. The second [algorithm] models the observation function.");
+	{
+		UsageNode* pTR = pRoot->add("trainrecurrent <options> [dataset] <data_opts>", "Train a long short-term memory model to predict the label sequence from the feature sequence. Each row of [dataset] is one time step of a single long sequence. The sequence is split into several contiguous streams, which are trained together with truncated backpropagation through time. The trained model is printed to stdout in JSON format.");
 		UsageNode* pOpts = pTR->add("<options>");
 		pOpts->add("-seed [value]=0", "Specify a seed for the random number generator. (Use this option to ensure that your results are reproduceable.)");
-		pOpts->add("-paramdims 2 [wid] [hgt]", "If observations are images, use this option to parameterize the predictions, so only the channel values of each pixel are predicted. (Other values besides 2 dimensions are also supported.)");
-		pOpts->add("-state [filename]=state.arff", "Save the estimated state to the specified file. (Only has effect if moses is used as the training method.)");
-		pOpts->add("-validate [interval] 1 [obs] [action]", "Perform validation at [interval]-second intervals with observation data, [obs], and action data, [action]. (Also supports more than 1 validation sequence if desired.)");
-		pOpts->add("-out [filename]=model.json", "Save the resulting model to the specified file. If not speicified, the default is \"model.json\".");
-		pOpts->add("-noblur", "Do not use blurring. The default is to use blurring. Sometimes blurring improves results. Sometimes not.");
-		pOpts->add("-traintime [seconds]=3600", "Specify how many seconds to train the model. The default is 3600, which is 1 hour.");
-		pOpts->add("-isomap", "Use Isomap instead of Breadth-first Unfolding if moses is used as the training method.");
-
-		UsageNode* pMeth = pTR->add("[method]");
-		pMeth->add("moses", "Use Temporal-NLDR to estimate state, then build the model using the state estimate.");
-		pMeth->add("bptt [depth] [iters-per-grow-sequence]", "Backpropagation Through Time. [depth] specifies the number of instances of the transition function that will appear in the unfolded model. A good value might be 3. [iters-per-grow-sequence] specifies the number of pattern presentations before the sequence is incremented. A good value might be 50000.");
-		pMeth->add("evolutionary", "Train with evoluationary optimization");
-		pMeth->add("hillclimber", "Train with a hill-climbing algorithm.");
-		pMeth->add("annealing [deviation] [decay] [window]", "Train with simulated annealing. Good values might be 2.0 0.5 300");
-	}*/
+		pOpts->add("-units [n]=32", "Specify the number of LSTM units.");
+		pOpts->add("-batch [n]=16", "Specify the number of streams that the sequence is split into. All of the streams are processed together at each time step.");
+		pOpts->add("-bptt [steps]=20", "Specify the number of time steps to unroll before each weight update. The hidden state is carried across updates, but the gradient is truncated after this many steps.");
+		pOpts->add("-epochs [n]=100", "Specify the number of passes to make over the sequence.");
+		pOpts->add("-learningrate [value]=0.01", "Specify the learning rate.");
+		pOpts->add("-clip [value]=5.0", "Specify the largest magnitude allowed for the gradient. Larger gradients are scaled down. Use 0 to disable clipping.");
+		pOpts->add("-verbose", "Print the mean squared error of each epoch to stderr.");
+		pTR->add("[dataset]=data.arff", "The filename of a dataset. All attributes must be continuous.");
+		UsageNode* pDO = pTR->add("<data_opts>");
+		pDO->add("-labels [attr_list]=0", "Specify which attributes to use as labels. (If not specified, the default is to use the last attribute for the label.) [attr_list] is a comma-separated list of zero-indexed columns. A hypen may be used to specify a range of columns.  A '*' preceding a value means to index from the right instead of the left. For example, \"0,2-5\" refers to"
+					" columns 0, 2, 3, 4, and 5. \"*0\" refers to the last column. \"0-*1\" refers to all but the last column.");
+		pDO->add("-ignore [attr_list]=0", "Specify attributes to ignore. [attr_list] is a comma-separated list of zero-indexed columns. A hypen may be used to specify a range of columns.  A '*' preceding a value means to index from the right instead of the left. For example, \"0,2-5\" refers to columns 0, 2, 3, 4, and 5. \"*0\" refers to the last column. \"0-*1\" refers to all but the last column.");
+	}
 	{
 		UsageNode* pOpt = pRoot->add("regress [data] <data_opts> [equation]", "Use a hill climbing algorithm to optimize the parameters of [equation] to fit to the [data]. If [data] has d feature dimensions, then [equation] must have more than d parameters. The equation must be named f. The first d arguments to f are supplied by the data features. The remaining arguments are optimized by the hill climber. The data must have exactly 1 label dimension, which the equation will attempt to predict. The sum-squared error and parameter values are printed to stdout.");
 		pOpt->add("[dataset]=data.arff", "The filename of a dataset.");
@@ -1446,6 +1476,8 @@ UsageNode* makeSparseUsageTree()
 		pOpts->add("-binary", "Just use the value 1 if the word occurs in a document, or a 0 if it does not occur. The default behavior is to compute the somewhat more meaningful value: a/b*log(c/d), where a=the number of times the word occurs in this document, b=the max number of times this word occurs in any document, c=total number of documents, and d=number of documents that contain this word.");
 		pOpts->add("-out [features-filename] [labels-filename]", "Specify the filenames for the sparse feature matrix and the dense labels matrix. Note that if only one folder of documents is provided, then [labels-filename] will be ignored (since all documents come from the same folder/class), but a bogus filename must be provided for it anyway.");
 		pOpts->add("-vocabfile [filename]=vocab.txt", "Save the vocabulary of words to the specified file. The default is to not save the list of words. Note that the words will be stemmed (unless -nostem was specified), so it is normal for many of them to appear misspelled.");
+		pOpts->add("-hash [buckets]", "Use feature hashing instead of building a vocabulary. Each word is assigned to one of [buckets] columns by its hash, so several words may share a column. This option cannot be combined with -vocabfile.");
+		pOpts->add("-threads [n]=1", "Specify the number of worker threads to use for loading, tokenizing, and stemming the documents. (The results do not depend on the number of threads.)");
 	}
 	{
 		UsageNode* pMD = pRoot->add("multiplydense [sparse-matrix] [dense-matrix] <options>", "Multiplies a sparse matrix by a dense matrix. Prints the resulting dense matrix to stdout in ARFF format.");
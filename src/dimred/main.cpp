@@ -30,6 +30,7 @@
 #include "../GClasses/GRand.h"
 #include "../GClasses/GFile.h"
 #include "../GClasses/GTransform.h"
+#include "../GClasses/GTruncatedSVD.h"
 #include "../GClasses/GVec.h"
 #include "../GClasses/GHashTable.h"
 #include "../GClasses/GHillClimber.h"
@@ -513,12 +514,18 @@ void isomap(GArgReader& args)
 
 	// Parse Options
 	bool tolerant = false;
+	size_t landmarks = 0;
+	size_t threads = 1;
 	while(args.size() > 0)
 	{
 		if(args.if_pop("-seed"))
 			prng.setSeed(args.pop_uint());
 		else if(args.if_pop("-tolerant"))
 			tolerant = true;
+		else if(args.if_pop("-landmarks"))
+			landmarks = args.pop_uint();
+		else if(args.if_pop("-threads"))
+			threads = args.pop_uint();
 		else
 			throw Ex("Invalid option: ", args.peek());
 	}
@@ -528,6 +535,8 @@ void isomap(GArgReader& args)
 	transform.setNeighborFinder(pNF);
 	if(tolerant)
 		transform.dropDisconnectedPoints();
+	transform.setLandmarks(landmarks);
+	transform.setWorkerThreads(threads);
 	GMatrix* pDataAfter = transform.reduce(*pData);
 	Holder<GMatrix> hDataAfter(pDataAfter);
 	pDataAfter->print(cout);
@@ -546,10 +555,13 @@ void lle(GArgReader& args)
 	int targetDims = args.pop_uint();
 
 	// Parse Options
+	size_t threads = 1;
 	while(args.size() > 0)
 	{
 		if(args.if_pop("-seed"))
 			prng.setSeed(args.pop_uint());
+		else if(args.if_pop("-threads"))
+			threads = args.pop_uint();
 		else
 			throw Ex("Invalid option: ", args.peek());
 	}
@@ -557,6 +569,7 @@ void lle(GArgReader& args)
 	// Transform the data
 	GLLE transform(neighborCount, targetDims, &prng);
 	transform.setNeighborFinder(pNF);
+	transform.setWorkerThreads(threads);
 	GMatrix* pDataAfter = transform.reduce(*pData);
 	Holder<GMatrix> hDataAfter(pDataAfter);
 	pDataAfter->print(cout);
@@ -577,6 +590,8 @@ void ManifoldSculpting(GArgReader& args)
 	// Parse Options
 	const char* szPreprocessedData = NULL;
 	double scaleRate = 0.999;
+	size_t threads = 1;
+	const char* szProgress = NULL;
 	while(args.size() > 0)
 	{
 		if(args.if_pop("-seed"))
@@ -585,6 +600,10 @@ void ManifoldSculpting(GArgReader& args)
 			szPreprocessedData = args.pop_string();
 		else if(args.if_pop("-scalerate"))
 			scaleRate = args.pop_double();
+		else if(args.if_pop("-threads"))
+			threads = args.pop_uint();
+		else if(args.if_pop("-progress"))
+			szProgress = args.pop_string();
 		else
 			throw Ex("Invalid option: ", args.peek());
 	}
@@ -605,12 +624,17 @@ void ManifoldSculpting(GArgReader& args)
 	// Transform the data
 	GManifoldSculpting transform(neighborCount, targetDims, &prng);
 	transform.setSquishingRate(scaleRate);
+	transform.setWorkerThreads(threads);
+	if(szProgress)
+		transform.trackProgress();
 	if(pDataHint)
 		transform.setPreprocessedData(hDataHint.release());
 	transform.setNeighborFinder((GNeighborFinderGeneralizing*)pNF);
 	GMatrix* pDataAfter = transform.reduce(*pData);
 	Holder<GMatrix> hDataAfter(pDataAfter);
 	pDataAfter->print(cout);
+	if(szProgress)
+		transform.progress().saveArff(szProgress);
 }
 
 void multiDimensionalScaling(GArgReader& args)
@@ -649,10 +673,13 @@ void principalComponentAnalysis(GArgReader& args)
 	string modelIn;
 	string modelOut;
 	bool aboutOrigin = false;
+	size_t threads = 1;
 	while(args.next_is_flag())
 	{
 		if(args.if_pop("-seed"))
 			seed = args.pop_uint();
+		else if(args.if_pop("-threads"))
+			threads = args.pop_uint();
 		else if(args.if_pop("-roundtrip"))
 			roundTrip = args.pop_string();
 		else if(args.if_pop("-eigenvalues"))
@@ -684,10 +711,11 @@ void principalComponentAnalysis(GArgReader& args)
 			pTransform->aboutOrigin();
 		if(eigenvalues.length() > 0)
 			pTransform->computeEigVals();
+		pTransform->setWorkerThreads(threads);
+		pTransform->rand().setSeed(seed);
 		pTransform->train(*pData);
 	}
 	Holder<GPCA> hTransform(pTransform);
-	pTransform->rand().setSeed(seed);
 
 	GMatrix* pDataAfter = pTransform->transformBatch(*pData);
 	Holder<GMatrix> hDataAfter(pDataAfter);
@@ -741,10 +769,19 @@ void scalingUnfolder(GArgReader& args)
 	int targetDims = args.pop_uint();
 
 	// Parse Options
+	size_t threads = 1;
+	size_t partSize = 2048;
+	const char* szProgress = NULL;
 	while(args.size() > 0)
 	{
 		if(args.if_pop("-seed"))
 			nSeed = args.pop_uint();
+		else if(args.if_pop("-threads"))
+			threads = args.pop_uint();
+		else if(args.if_pop("-partsize"))
+			partSize = args.pop_uint();
+		else if(args.if_pop("-progress"))
+			szProgress = args.pop_string();
 		else
 			throw Ex("Invalid option: ", args.peek());
 	}
@@ -754,10 +791,16 @@ void scalingUnfolder(GArgReader& args)
 	transform.rand().setSeed(nSeed);
 	transform.setNeighborCount(neighborCount);
 	transform.setTargetDims(targetDims);
+	transform.setWorkerThreads(threads);
+	transform.setPartSize(partSize);
+	if(szProgress)
+		transform.trackProgress();
 	//transform.setNeighborFinder(pNF);
 	GMatrix* pDataAfter = transform.reduce(*pData);
 	Holder<GMatrix> hDataAfter(pDataAfter);
 	pDataAfter->print(cout);
+	if(szProgress)
+		transform.progress().saveArff(szProgress);
 }
 
 void selfOrganizingMap(GArgReader& args){
@@ -915,9 +958,18 @@ void singularValueDecomposition(GArgReader& args)
 	string sigmafilename;
 	string vfilename = "v.arff";
 	int maxIters = 100;
+	size_t rank = 0;
+	size_t threads = 1;
+	size_t seed = getpid() * (unsigned int)time(NULL);
 	while(args.size() > 0)
 	{
-		if(args.if_pop("-ufilename"))
+		if(args.if_pop("-rank"))
+			rank = args.pop_uint();
+		else if(args.if_pop("-threads"))
+			threads = args.pop_uint();
+		else if(args.if_pop("-seed"))
+			seed = args.pop_uint();
+		else if(args.if_pop("-ufilename"))
 			ufilename = args.pop_string();
 		else if(args.if_pop("-sigmafilename"))
 			sigmafilename = args.pop_string();
@@ -929,6 +981,31 @@ void singularValueDecomposition(GArgReader& args)
 			throw Ex("Invalid option: ", args.peek());
 	}
 
+	if(rank > 0)
+	{
+		// Compute only the most significant singular values and vectors
+		GRand rand(seed);
+		GTruncatedSVD svd(rank);
+		svd.setWorkerThreads(threads);
+		svd.compute(*pData, rand);
+		svd.u().saveArff(ufilename.c_str());
+		svd.v().saveArff(vfilename.c_str());
+		if(sigmafilename.length() > 0)
+		{
+			GMatrix sigma(rank, rank);
+			sigma.fill(0.0);
+			for(size_t i = 0; i < rank; i++)
+				sigma.row(i)[i] = svd.singularValues()[i];
+			sigma.saveArff(sigmafilename.c_str());
+		}
+		else
+		{
+			svd.singularValues().print(cout);
+			cout << "\n";
+		}
+		return;
+	}
+
 	GMatrix* pU;
 	double* pDiag;
 	GMatrix* pV;
@@ -49,6 +49,8 @@ int main(int argc, char *argv[])
 				GLearnerLib::predict(args);
 			else if(args.if_pop("predictdistribution"))
 				GLearnerLib::predictDistribution(args);
+			else if(args.if_pop("serve"))
+				GLearnerLib::serve(args);
 			else if(args.if_pop("transduce"))
 				GLearnerLib::Transduce(args);
 			else if(args.if_pop("transacc"))
@@ -61,8 +63,8 @@ int main(int argc, char *argv[])
 				GLearnerLib::PrecisionRecall(args);
  			else if(args.if_pop("sterilize"))
  				GLearnerLib::sterilize(args);
-//			else if(args.if_pop("trainrecurrent"))
-//				GLearnerLib::trainRecurrent(args);
+			else if(args.if_pop("trainrecurrent"))
+				GLearnerLib::trainRecurrent(args);
 			else if(args.if_pop("regress"))
 				GLearnerLib::regress(args);
 			else if(args.if_pop("metadata"))
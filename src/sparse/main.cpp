@@ -136,6 +136,8 @@ GNaiveBayes* InstantiateNaiveBayes(GArgReader& args)
 	{
 		if(args.if_pop("-ess"))
 			pModel->setEquivalentSampleSize(args.pop_double());
+		else if(args.if_pop("-threads"))
+			pModel->setWorkerThreads(args.pop_uint());
 		else
 			throw Ex("Invalid naivebayes option: ", args.peek());
 	}
@@ -149,8 +151,10 @@ GNaiveInstance* InstantiateNaiveInstance(GArgReader& args)
 	{
 		if(args.if_pop("-neighbors"))
 			pModel->setNeighbors(args.pop_uint());
+		else if(args.if_pop("-threads"))
+			pModel->setWorkerThreads(args.pop_uint());
 		else
-			throw Ex("Invalid neighbortransducer option: ", args.peek());
+			throw Ex("Invalid naiveinstance option: ", args.peek());
 	}
 	return pModel;
 }
@@ -201,6 +205,8 @@ GTransducer* InstantiateAlgorithm(GArgReader& args)
 			return InstantiateLinearRegressor(args);
 		else if(args.if_pop("naivebayes"))
 			return InstantiateNaiveBayes(args);
+		else if(args.if_pop("naiveinstance"))
+			return InstantiateNaiveInstance(args);
 		throw Ex("Unrecognized algorithm name: ", args.peek());
 	}
 	catch(const std::exception& e)
@@ -435,45 +441,13 @@ void transpose(GArgReader& args)
 	}
 }
 
-void addWordsToVocabFromTextFile(GVocabulary* pVocab, const char* szFilename)
-{
-	size_t len;
-	char* pFile = GFile::loadFile(szFilename, &len);
-	std::unique_ptr<char[]> hFile(pFile);
-	pVocab->newDoc();
-	pVocab->addWordsFromTextBlock(pFile, len);
-}
-
-void makeTextFileVector(GSparseMatrix* pFeatures, GMatrix* pLabels, int clss, size_t row, GVocabulary* pVocab, const char* szFilename, bool binary)
-{
-	size_t len;
-	char* pFile = GFile::loadFile(szFilename, &len);
-	std::unique_ptr<char[]> hFile(pFile);
-	GWordIterator it(pFile, len);
-	const char* pWord;
-	size_t wordLen;
-	while(true)
-	{
-		if(!it.next(&pWord, &wordLen))
-			break;
-		size_t col = pVocab->wordIndex(pWord, wordLen);
-		if(col != INVALID_INDEX)
-		{
-			if(binary)
-				pFeatures->set(row, col, 1.0);
-			else
-				pFeatures->set(row, col, pFeatures->get(row, col) + pVocab->weight(col));
-		}
-	}
-	if(pLabels)
-		pLabels->row(row)[0] = (double)clss;
-}
-
 void docsToSparseMatrix(GArgReader& args)
 {
 	// Parse options
 	bool useStemmer = true;
 	bool binary = false;
+	size_t hashBuckets = 0;
+	size_t threads = 1;
 	string featuresFilename = "features.sparse";
 	string labelsFilename = "labels.arff";
 	string vocabFile = "";
@@ -483,6 +457,10 @@ void docsToSparseMatrix(GArgReader& args)
 			useStemmer = false;
 		else if(args.if_pop("-binary"))
 			binary = true;
+		else if(args.if_pop("-hash"))
+			hashBuckets = args.pop_uint();
+		else if(args.if_pop("-threads"))
+			threads = args.pop_uint();
 		else if(args.if_pop("-out"))
 		{
 			featuresFilename = args.pop_string();
@@ -493,96 +471,77 @@ void docsToSparseMatrix(GArgReader& args)
 		else
 			throw Ex("Invalid option: ", args.peek());
 	}
+	if(hashBuckets > 0 && vocabFile.length() > 0)
+		throw Ex("The -vocabfile option cannot be used with -hash, because no vocabulary is built");
 
-	// Parse the vocabulary
-	GVocabulary vocab(useStemmer);
-	vocab.addTypicalStopWords();
+	// Find the documents
 	vector<string> folders;
+	vector<string> filenames;
+	vector<size_t> classes;
 	while(args.size() > 0)
 	{
 		const char* szFolder = args.pop_string();
 		folders.push_back(szFolder);
-		char cwd[300];
-		if(!getcwd(cwd, 300))
-			throw Ex("Failed to get cwd");
-		if(chdir(szFolder) != 0)
-			throw Ex("Failed to change directory to: ", szFolder, ", from: ", cwd);
+		vector<string> files;
+		GFile::fileList(files, szFolder);
+		for(vector<string>::iterator it = files.begin(); it != files.end(); it++)
 		{
-			vector<string> files;
-			GFile::fileList(files);
-			for(vector<string>::iterator it = files.begin(); it != files.end(); it++)
+			const char* filename = it->c_str();
+			PathData pd;
+			GFile::parsePath(filename, &pd);
+			if(_stricmp(filename + pd.extStart, ".txt") == 0)
 			{
-				const char* filename = it->c_str();
-				PathData pd;
-				GFile::parsePath(filename, &pd);
-				if(_stricmp(filename + pd.extStart, ".txt") == 0)
-					addWordsToVocabFromTextFile(&vocab, filename);
-				else
-					printf("Skipping file: %s. (Only .txt files are supported.)\n", filename);
+				filenames.push_back(string(szFolder) + "/" + *it);
+				classes.push_back(folders.size() - 1);
 			}
+			else
+				printf("Skipping file: %s. (Only .txt files are supported.)\n", filename);
 		}
-		if(chdir(cwd) != 0)
-			throw Ex("failed to change dir");
 	}
 	if(folders.size() == 0)
 		throw Ex("At least one folder name must be specified");
 	printf("-----\n");
-
-	// Make the sparse feature matrix and the label matrix
-	GSparseMatrix sparseFeatures(vocab.docCount(), vocab.wordCount());
-	GMatrix* pLabels = NULL;
-	if(folders.size() > 1)
-	{
-		vector<size_t> classes;
-		classes.push_back(folders.size());
-		pLabels = new GMatrix(classes);
-		pLabels->newRows(vocab.docCount());
-	}
-	std::unique_ptr<GMatrix> hLabels(pLabels);
-	size_t row = 0;
-	for(int clss = 0; clss < (int)folders.size(); clss++)
-	{
-		const char* szFolder = folders[clss].c_str();
-		char cwd[300];
-		if(!getcwd(cwd, 300))
-			throw Ex("Failed to get cwd");
-		if(chdir(szFolder) != 0)
-			throw Ex("Failed to change directory to: ", szFolder, ", from: ", cwd);
+	for(size_t i = 0; i < filenames.size(); i++)
+		printf("%d) %s\n", (int)i, filenames[i].c_str());
+
+	// Make the sparse feature matrix. (It is written as the documents are processed.)
+	GDocumentIndexer indexer(useStemmer);
+	indexer.addTypicalStopWords();
+	indexer.setBinary(binary);
+	indexer.setHashBuckets(hashBuckets);
+	indexer.setWorkerThreads(threads);
+	{
+		std::ofstream ofs;
+		ofs.exceptions(std::ios::badbit | std::ios::failbit);
+		try
 		{
-			vector<string> files;
-			GFile::fileList(files);
-			for(vector<string>::iterator it = files.begin(); it != files.end(); it++)
-			{
-				const char* filename = it->c_str();
-				PathData pd;
-				GFile::parsePath(filename, &pd);
-				if(_stricmp(filename + pd.extStart, ".txt") == 0)
-				{
-					printf("%d) %s\n", (int)row, filename);
-					makeTextFileVector(&sparseFeatures, pLabels, clss, row++, &vocab, filename, binary);
-				}
-			}
+			ofs.open(featuresFilename.c_str(), std::ios::binary);
 		}
-		if(chdir(cwd) != 0)
-			throw Ex("Failed to change dir");
+		catch(const std::exception&)
+		{
+			throw Ex("Error while trying to create the file, ", featuresFilename);
+		}
+		indexer.indexFiles(filenames, ofs);
 	}
 
-	// Save the files
+	// Save the other files
 	if(vocabFile.length() > 0)
 	{
 		FILE* pFile = fopen(vocabFile.c_str(), "w");
 		FileHolder hFile(pFile);
-		for(size_t i = 0; i < vocab.wordCount(); i++)
-		{
-			const char* szWord = vocab.stats(i).m_szWord;
-			fprintf(pFile, "%s\n", szWord);
-		}
+		for(size_t i = 0; i < indexer.cols(); i++)
+			fprintf(pFile, "%s\n", indexer.word(i));
+	}
+	if(folders.size() > 1)
+	{
+		vector<size_t> valueCounts;
+		valueCounts.push_back(folders.size());
+		GMatrix labels(valueCounts);
+		labels.newRows(filenames.size());
+		for(size_t i = 0; i < filenames.size(); i++)
+			labels[i][0] = (double)classes[i];
+		labels.saveArff(labelsFilename.c_str());
 	}
-	GDom doc;
-	doc.setRoot(sparseFeatures.serialize(&doc));
-	doc.saveJson(featuresFilename.c_str());
-	if(pLabels)
-		pLabels->saveArff(labelsFilename.c_str());
 }
 
 void shuffle(GArgReader& args)
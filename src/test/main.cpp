@@ -34,10 +34,12 @@
 #include "../GClasses/GAssignment.h"
 #include "../GClasses/GBayesianNetwork.h"
 #include "../GClasses/GBezier.h"
+#include "../GClasses/GBigInt.h"
 #include "../GClasses/GBits.h"
 #include "../GClasses/GBitTable.h"
 #include "../GClasses/GCluster.h"
 #include "../GClasses/GCrypto.h"
+#include "../GClasses/GDataPipeline.h"
 #include "../GClasses/GDecisionTree.h"
 #include "../GClasses/GDistance.h"
 #include "../GClasses/GDistribution.h"
@@ -52,6 +54,9 @@
 #include "../GClasses/GHiddenMarkovModel.h"
 #include "../GClasses/GHillClimber.h"
 #include "../GClasses/GHtml.h"
+#include "../GClasses/GHttp.h"
+#include "../GClasses/GIncrementalPCA.h"
+#include "../GClasses/GKernelTrick.h"
 #include "../GClasses/GKeyPair.h"
 #include "../GClasses/GKNN.h"
 #include "../GClasses/GLinear.h"
@@ -59,6 +64,7 @@
 #include "../GClasses/GMath.h"
 #include "../GClasses/GMatrix.h"
 #include "../GClasses/GMixtureOfGaussians.h"
+#include "../GClasses/GModelServer.h"
 #include "../GClasses/GNaiveBayes.h"
 #include "../GClasses/GNaiveInstance.h"
 #include "../GClasses/GNeighborFinder.h"
@@ -68,15 +74,19 @@
 #include "../GClasses/GPriorityQueue.h"
 #include "../GClasses/GRand.h"
 #include "../GClasses/GRayTrace.h"
+#include "../GClasses/GRecurrent.h"
 #include "../GClasses/GRecommender.h"
 #include "../GClasses/GRegion.h"
 #include "../GClasses/GSelfOrganizingMap.h"
 #include "../GClasses/GSocket.h"
 #include "../GClasses/GSparseMatrix.h"
 #include "../GClasses/GGridSearch.h"
+#include "../GClasses/GStemmer.h"
+#include "../GClasses/GText.h"
 #include "../GClasses/GThread.h"
 #include "../GClasses/GTime.h"
 #include "../GClasses/GTransform.h"
+#include "../GClasses/GTruncatedSVD.h"
 #include "../GClasses/GTree.h"
 #include "../GClasses/GVec.h"
 #include "../GClasses/GReverseBits.h"
@@ -898,53 +908,71 @@ public:
 		runTest("GBayesianModelAveraging", GBayesianModelAveraging::test);
 		runTest("GBayesianModelCombination", GBayesianModelCombination::test);
 		runTest("GBayesNet", GBayesNet::test);
+		runTest("GBayesNetChains", GBayesNetChains::test);
 		runTest("GBezier", GBezier::test);
+		runTest("GBigInt", GBigInt::test);
 		runTest("GBits", GBits::test);
 		runTest("GBitTable", GBitTable::test);
 		runTest("GBlockConv", GBlockConv::test);
+		runTest("GBlockMaxPooling2D", GBlockMaxPooling2D::test);
 		runTest("GBouncyBalls", GBouncyBalls::test);
 		runTest("GReverseBits", reverseBitsTest);
 		runTest("GBrandesBetweenness", GBrandesBetweennessCentrality::test);
 		runTest("GBucket", GBucket::test);
 		runTest("GCategoricalSamplerBatch", GCategoricalSamplerBatch::test);
+		runTest("GCompiledNeuralNet", GCompiledNeuralNet::test);
 		runTest("GCompressor", GCompressor::test);
 		runTest("GCoordVectorIterator", GCoordVectorIterator::test);
 		runTest("GCrypto", GCrypto::test);
 		runTest("GCycleCut", GCycleCut::test);
+		runTest("GDataPipeline", GDataPipeline::test);
 		runTest("GDecisionTree", GDecisionTree::test);
 		runTest("GDijkstra", GDijkstra::test);
 		runTest("GDistanceMetric", GDistanceMetric::test);
+		runTest("GDocumentIndexer", GDocumentIndexer::test);
 		runTest("GDom", GDom::test);
+		runTest("GDomServer", GDomServer::test);
 		runTest("GError.h - to_str", test_to_str);
 		runTest("GFloydWarshall", GFloydWarshall::test);
 		runTest("GFourier", GFourier::test);
+		runTest("GFusedLSTM", GFusedLSTM::test);
 		runTest("GGaussianProcess", GGaussianProcess::test);
 		runTest("GGraphCut", GGraphCut::test);
 		runTest("GHashTable", GHashTable::test);
 		runTest("GHiddenMarkovModel", GHiddenMarkovModel::test);
 		runTest("GHillClimber", GHillClimber::test);
 		runTest("GHtmlDoc", GHtmlDoc::test);
+		runTest("GHttpEventServer", GHttpEventServer::test);
+		runTest("GIncrementalPCA", GIncrementalPCA::test);
 		runTest("GIncrementalTransform", GIncrementalTransform::test);
 		runTest("GInstanceRecommender", GInstanceRecommender::test);
+		runTest("GIsomap", GIsomap::test);
+		runTest("GJsonWriter", GJsonWriter::test);
 		runTest("GKdTree", GKdTree::test);
+		runTest("GKernel", GKernel::test);
 		runTest("GKeyPair", GKeyPair::test);
 		runTest("GKNN", GKNN::test);
 		runTest("GLinearDistribution", GLinearDistribution::test);
 		runTest("GLinearProgramming", GLinearProgramming::test);
 		runTest("GLinearRegressor", GLinearRegressor::test);
+		runTest("GLLE", GLLE::test);
 		runTest("GManifold", GManifold::test);
+		runTest("GManifoldSculpting", GManifoldSculpting::test);
 		runTest("GMath", GMath::test);
 		runTest("GMatrix", GMatrix::test);
 		runTest("GMatrix::parseArff quoting", test_parsearff_quoting);
 		runTest("GMatrixFactorization", GMatrixFactorization::test);
 		runTest("GMeanMarginsTree", GMeanMarginsTree::test);
 		runTest("GMixtureOfGaussians", GMixtureOfGaussians::test);
+		runTest("GModelServer", GModelServer::test);
 		runTest("GMomentumGreedySearch", GMomentumGreedySearch::test);
+		runTest("GMultiSourceDijkstra", GMultiSourceDijkstra::test);
 		runTest("GNaiveBayes", GNaiveBayes::test);
 		runTest("GNaiveInstance", GNaiveInstance::test);
 		runTest("GNeuralNet", GNeuralNet::test);
 		runTest("GNeuralNetLearner", GNeuralNetLearner::test);
 		runTest("GPackageServer", GPackageServer::test);
+		runTest("GParallelValidator", GParallelValidator::test);
 		runTest("GPolynomial", GPolynomial::test);
 		runTest("GPriorityQueue", GPriorityQueue::test);
 		runTest("GProbeSearch", GProbeSearch::test);
@@ -956,16 +984,19 @@ public:
 		runTest("GRelationalTable", GRelationalTable_test);
 		runTest("GResamplingAdaBoost", GResamplingAdaBoost::test);
 		runTest("GRunningCovariance", GRunningCovariance::test);
+		runTest("GScalingUnfolder", GScalingUnfolder::test);
 		runTest("GSelfOrganizingMap", GSelfOrganizingMap::test);
 		runTest("GShortcutPruner", GShortcutPruner::test);
 		runTest("GSimplePriorityQueue", GSimplePriorityQueue_test);
 		runTest("GSparseClusterRecommender", GSparseClusterRecommender::test);
 		runTest("GSparseMatrix", GSparseMatrix::test);
 		runTest("GSpinLock", GSpinLock::test);
+		runTest("GStemmerCache", GStemmerCache::test);
 		runTest("GSubImageFinder", GSubImageFinder::test);
 		runTest("GSubImageFinder2", GSubImageFinder2::test);
 		runTest("GSupervisedLearner", GSupervisedLearner::test);
 		runTest("GTensor", GTensor::test);
+		runTest("GTruncatedSVD", GTruncatedSVD::test);
 		runTest("GVec", GVec::test);
 
 		// Test whether we can find and execute the command-line tools